@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "exec/tb-flush.h"
 #include "exec/exec-all.h"
+#include "exec/cputlb.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -22,6 +23,11 @@ void tlb_set_dirty(CPUState *cpu, vaddr vaddr)
 {
 }
 
+void tlb_foreach_ram_page(CPUState *cpu, void (*fn)(void *host, void *opaque),
+                          void *opaque)
+{
+}
+
 int probe_access_flags(CPUArchState *env, vaddr addr, int size,
                        MMUAccessType access_type, int mmu_idx,
                        bool nonfault, void **phost, uintptr_t retaddr)
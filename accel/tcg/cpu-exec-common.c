@@ -38,6 +38,7 @@ void cpu_loop_exit(CPUState *cpu)
     cpu->neg.can_do_io = true;
     /* Undo any setting in generated code.  */
     qemu_plugin_disable_mem_helpers(cpu);
+    /* With --enable-wasm-exceptions, this throws a wasm exception */
     siglongjmp(cpu->jmp_env, 1);
 }
 
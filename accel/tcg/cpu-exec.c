@@ -28,6 +28,7 @@
 #include "tcg/tcg.h"
 #include "qemu/atomic.h"
 #include "qemu/rcu.h"
+#include "qemu/heap-account.h"
 #include "exec/log.h"
 #include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
@@ -215,13 +216,26 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
+/* Drop the second-level jump cache entries of a previous tb_flush */
+static inline void tb_jmp_l2_check_gen(CPUJumpCache *jc)
+{
+    unsigned gen = qatomic_read(&tb_ctx.tb_flush_count);
+
+    if (unlikely(jc->l2_gen != gen)) {
+        memset(jc->l2, 0, sizeof(jc->l2));
+        jc->l2_gen = gen;
+    }
+}
+
 static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
                                           uint64_t cs_base, uint32_t flags,
                                           uint32_t cflags)
 {
+    CPUJumpCache *jc = cpu->tb_jmp_cache;
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
-    uint32_t h;
+    uint32_t h, l2;
 
     desc.env = cpu_env(cpu);
     desc.cs_base = cs_base;
@@ -233,9 +247,22 @@ static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
         return NULL;
     }
     desc.page_addr0 = phys_pc;
+
+    tb_jmp_l2_check_gen(jc);
+    l2 = tb_jmp_l2_hash_func(pc, flags, cs_base);
+    tb = jc->l2[l2];
+    if (tb && tb_lookup_cmp(tb, &desc)) {
+        cpu->tcg_exit_stats->l2_hit++;
+        return tb;
+    }
+
     h = tb_hash_func(phys_pc, (cflags & CF_PCREL ? 0 : pc),
                      flags, cs_base, cflags);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    if (tb) {
+        jc->l2[l2] = tb;
+    }
+    return tb;
 }
 
 /* Might cause an exception, so have a longjmp destination ready */
@@ -259,16 +286,20 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
 
         if (likely(tb &&
                    jc->array[hash].pc == pc &&
+                   jc->array[hash].asid == jc->asid &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
                    tb_cflags(tb) == cflags)) {
+            cpu->tcg_exit_stats->jc_hit++;
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
         if (tb == NULL) {
+            cpu->tcg_exit_stats->tb_miss++;
             return NULL;
         }
         jc->array[hash].pc = pc;
+        jc->array[hash].asid = jc->asid;
         /* Ensure pc is written first. */
         qatomic_store_release(&jc->array[hash].tb, tb);
     } else {
@@ -277,19 +308,24 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, vaddr pc,
 
         if (likely(tb &&
                    tb->pc == pc &&
+                   jc->array[hash].asid == jc->asid &&
                    tb->cs_base == cs_base &&
                    tb->flags == flags &&
                    tb_cflags(tb) == cflags)) {
+            cpu->tcg_exit_stats->jc_hit++;
             return tb;
         }
         tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
         if (tb == NULL) {
+            cpu->tcg_exit_stats->tb_miss++;
             return NULL;
         }
+        jc->array[hash].asid = jc->asid;
         /* Use the pc value already stored in tb->pc. */
         qatomic_set(&jc->array[hash].tb, tb);
     }
 
+    cpu->tcg_exit_stats->jc_miss++;
     return tb;
 }
 
@@ -420,8 +456,10 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
         cpu_loop_exit(cpu);
     }
 
+    cpu->tcg_exit_stats->goto_ptr++;
     tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
     if (tb == NULL) {
+        cpu->tcg_exit_stats->goto_ptr_miss++;
         return tcg_code_gen_epilogue;
     }
 
@@ -726,6 +764,7 @@ static inline bool cpu_handle_exception(CPUState *cpu, int *ret)
 #endif
         return false;
     }
+    tcg_exit_stats_inc(cpu, TCG_EXIT_EXCEPTION);
     if (cpu->exception_index >= EXCP_INTERRUPT) {
         /* exit request from the cpu execution loop */
         *ret = cpu->exception_index;
@@ -878,6 +917,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
                 }
                 cpu->exception_index = -1;
                 *last_tb = NULL;
+                tcg_exit_stats_inc(cpu, TCG_EXIT_INTERRUPT);
             }
             /* The target hook may have updated the 'cpu->interrupt_request';
              * reload the 'interrupt_request' value */
@@ -895,6 +935,13 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
         qemu_mutex_unlock_iothread();
     }
 
+#ifndef CONFIG_USER_ONLY
+    if (unlikely(guest_profile_enabled) &&
+        qatomic_read(&cpu->profile_sample)) {
+        guest_profile_sample(cpu);
+    }
+#endif
+
     /* Finally, check if we need to exit to the main loop.  */
     if (unlikely(qatomic_read(&cpu->exit_request))
         || (icount_enabled()
@@ -904,6 +951,7 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
         if (cpu->exception_index == -1) {
             cpu->exception_index = EXCP_INTERRUPT;
         }
+        tcg_exit_stats_inc(cpu, TCG_EXIT_EXIT_REQUEST);
         return true;
     }
 
@@ -919,6 +967,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     trace_exec_tb(tb, pc);
     tb = cpu_tb_exec(cpu, tb, tb_exit);
     if (*tb_exit != TB_EXIT_REQUESTED) {
+        tcg_exit_stats_inc(cpu, tb ? TCG_EXIT_UNCHAINED : TCG_EXIT_NOCHAIN);
         *last_tb = tb;
         return;
     }
@@ -926,6 +975,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
     *last_tb = NULL;
     insns_left = qatomic_read(&cpu->neg.icount_decr.u32);
     if (insns_left < 0) {
+        tcg_exit_stats_inc(cpu, TCG_EXIT_REQUESTED);
         /* Something asked us to stop executing chained TBs; just
          * continue round the main loop. Whatever requested the exit
          * will also have set something else (eg exit_request or
@@ -938,6 +988,7 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
 
     /* Instruction counter expired.  */
     assert(icount_enabled());
+    tcg_exit_stats_inc(cpu, TCG_EXIT_ICOUNT);
 #ifndef CONFIG_USER_ONLY
     /* Ensure global icount has gone forward */
     icount_update(cpu);
@@ -1012,6 +1063,7 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                  */
                 h = tb_jmp_cache_hash_func(pc);
                 jc = cpu->tb_jmp_cache;
+                jc->array[h].asid = jc->asid;
                 if (cflags & CF_PCREL) {
                     jc->array[h].pc = pc;
                     /* Ensure pc is written first. */
@@ -1020,6 +1072,8 @@ cpu_exec_loop(CPUState *cpu, SyncClocks *sc)
                     /* Use the pc value already stored in tb->pc. */
                     qatomic_set(&jc->array[h].tb, tb);
                 }
+                tb_jmp_l2_check_gen(jc);
+                jc->l2[tb_jmp_l2_hash_func(pc, flags, cs_base)] = tb;
             }
 
 #ifndef CONFIG_USER_ONLY
@@ -1058,6 +1112,105 @@ static int cpu_exec_setjmp(CPUState *cpu, SyncClocks *sc)
     return cpu_exec_loop(cpu, sc);
 }
 
+#ifndef CONFIG_USER_ONLY
+/*
+ * Speculative translation of direct successors.  Targets of goto_tb
+ * found while translating are queued per thread, and translated once the
+ * vCPU halts, so that they are already in the QHT when the guest gets
+ * there.  Translation has to happen on the vCPU thread: it reads guest
+ * code through the vCPU's TLB and uses the thread's own TCG region.
+ */
+#define TB_PREFETCH_MAX 32
+
+typedef struct TBPrefetch {
+    CPUState *cpu;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+} TBPrefetch;
+
+static __thread TBPrefetch tb_prefetch_queue[TB_PREFETCH_MAX];
+static __thread unsigned tb_prefetch_head, tb_prefetch_count;
+
+void tb_prefetch_note(TranslationBlock *tb, vaddr pc)
+{
+    TBPrefetch *p;
+
+    if (tb_prefetch_count == TB_PREFETCH_MAX) {
+        /* Drop the oldest entry; recent successors are more likely. */
+        tb_prefetch_head = (tb_prefetch_head + 1) % TB_PREFETCH_MAX;
+        tb_prefetch_count--;
+    }
+    p = &tb_prefetch_queue[(tb_prefetch_head + tb_prefetch_count++)
+                           % TB_PREFETCH_MAX];
+    p->cpu = current_cpu;
+    p->pc = pc;
+    p->cs_base = tb->cs_base;
+    p->flags = tb->flags;
+}
+
+/*
+ * Check that both the page of @pc and the following one can be fetched
+ * without a fault, so that translating there cannot raise a guest
+ * exception as a side effect.
+ */
+static bool tb_prefetch_probe(CPUArchState *env, vaddr pc)
+{
+    int mmu_idx = cpu_mmu_index(env, true);
+    void *host;
+    int flags;
+
+    flags = probe_access_flags(env, pc, 1, MMU_INST_FETCH, mmu_idx,
+                               true, &host, 0);
+    if (flags & (TLB_INVALID_MASK | TLB_MMIO)) {
+        return false;
+    }
+    flags = probe_access_flags(env, TARGET_PAGE_ALIGN(pc + 1), 1,
+                               MMU_INST_FETCH, mmu_idx, true, &host, 0);
+    return !(flags & (TLB_INVALID_MASK | TLB_MMIO));
+}
+
+static void tb_prefetch_drain(CPUState *cpu)
+{
+    CPUArchState *env = cpu_env(cpu);
+    uint32_t cflags = curr_cflags(cpu);
+
+    if (!QTAILQ_EMPTY(&cpu->breakpoints) || cpu->singlestep_enabled) {
+        tb_prefetch_count = 0;
+        return;
+    }
+
+    if (sigsetjmp(cpu->jmp_env, 0) != 0) {
+        /* Out of buffer space, or an unexpected fault: give up. */
+        if (tcg_ctx->gen_tb) {
+            tb_unlock_pages(tcg_ctx->gen_tb);
+            tcg_ctx->gen_tb = NULL;
+        }
+        if (qemu_mutex_iothread_locked()) {
+            qemu_mutex_unlock_iothread();
+        }
+        assert_no_pages_locked();
+        cpu->exception_index = -1;
+        tb_prefetch_count = 0;
+        return;
+    }
+
+    while (tb_prefetch_count) {
+        TBPrefetch *p = &tb_prefetch_queue[tb_prefetch_head];
+
+        tb_prefetch_head = (tb_prefetch_head + 1) % TB_PREFETCH_MAX;
+        tb_prefetch_count--;
+
+        if (p->cpu != cpu ||
+            tb_lookup(cpu, p->pc, p->cs_base, p->flags, cflags) ||
+            !tb_prefetch_probe(env, p->pc)) {
+            continue;
+        }
+        tb_gen_code(cpu, p->pc, p->cs_base, p->flags, cflags);
+    }
+}
+#endif /* !CONFIG_USER_ONLY */
+
 int cpu_exec(CPUState *cpu)
 {
     int ret;
@@ -1067,6 +1220,13 @@ int cpu_exec(CPUState *cpu)
     current_cpu = cpu;
 
     if (cpu_handle_halt(cpu)) {
+#ifndef CONFIG_USER_ONLY
+        if (unlikely(qatomic_read(&tb_prefetch)) && tb_prefetch_count) {
+            rcu_read_lock();
+            tb_prefetch_drain(cpu);
+            rcu_read_unlock();
+        }
+#endif
         return EXCP_HALTED;
     }
 
@@ -1100,6 +1260,8 @@ bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
     }
 
     cpu->tb_jmp_cache = g_new0(CPUJumpCache, 1);
+    heap_account_add(HEAP_SUBSYSTEM_TB_METADATA, sizeof(CPUJumpCache));
+    cpu->tcg_exit_stats = g_new0(TCGExitStats, 1);
     tlb_init(cpu);
 #ifndef CONFIG_USER_ONLY
     tcg_iommu_init_notifier_list(cpu);
@@ -1118,4 +1280,6 @@ void tcg_exec_unrealizefn(CPUState *cpu)
 
     tlb_destroy(cpu);
     g_free_rcu(cpu->tb_jmp_cache, rcu);
+    heap_account_sub(HEAP_SUBSYSTEM_TB_METADATA, sizeof(CPUJumpCache));
+    g_clear_pointer(&cpu->tcg_exit_stats, g_free);
 }
@@ -38,6 +38,9 @@
 #include "tb-hash.h"
 #include "internal-common.h"
 #include "internal-target.h"
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#include "../../tcg/wasm32.h"
+#endif
 #ifdef CONFIG_PLUGIN
 #include "qemu/plugin-memory.h"
 #endif
@@ -100,6 +103,25 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 {
     desc->window_begin_ns = ns;
     desc->window_max_entries = max_entries;
+    desc->window_fills = 0;
+}
+
+static inline size_t tlb_policy_min_size(void)
+{
+    unsigned bits = tlb_policy_min_bits ? tlb_policy_min_bits
+                                        : CPU_TLB_DYN_MIN_BITS;
+
+    return (size_t)1 << MIN(MAX(bits, CPU_TLB_DYN_MIN_BITS),
+                            CPU_TLB_DYN_MAX_BITS);
+}
+
+static inline size_t tlb_policy_max_size(void)
+{
+    unsigned bits = tlb_policy_max_bits ? tlb_policy_max_bits
+                                        : CPU_TLB_DYN_MAX_BITS;
+
+    return MAX((size_t)1 << MIN(bits, CPU_TLB_DYN_MAX_BITS),
+               tlb_policy_min_size());
 }
 
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
@@ -172,7 +194,20 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     }
     rate = desc->window_max_entries * 100 / old_size;
 
-    if (rate > 70) {
+    if (tlb_policy == TLB_POLICY_MISS_RATE) {
+        /*
+         * A refill ends in a page walk, which on slow hosts costs far more
+         * than flushing a larger table.  Grow when refills in the window
+         * reach a quarter of the entries, and only halve the table once a
+         * window passed with both low use and hardly any refills.
+         */
+        if (desc->window_fills > old_size / 4) {
+            new_size = old_size << 1;
+        } else if (window_expired && rate < 30 &&
+                   desc->window_fills < old_size / 32) {
+            new_size = old_size >> 1;
+        }
+    } else if (rate > 70) {
         new_size = MIN(old_size << 1, (uint64_t)1 << CPU_TLB_DYN_MAX_BITS);
     } else if (rate < 30 && window_expired) {
         size_t ceil = pow2ceil(desc->window_max_entries);
@@ -193,6 +228,7 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
         }
         new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
     }
+    new_size = MIN(MAX(new_size, tlb_policy_min_size()), tlb_policy_max_size());
 
     if (new_size == old_size) {
         if (window_expired) {
@@ -232,29 +268,97 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     }
 }
 
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+static inline void tlb_window_reset_locked(CPUTLBDescFast *fast)
+{
+    fast->win_lim = 0;
+    fast->win_base = 0;
+    fast->win_addend = 0;
+}
+
+/* Empty the window of @fast if it overlaps [@addr, @addr + @len). */
+static inline void tlb_window_flush_locked(CPUTLBDescFast *fast,
+                                           vaddr addr, vaddr len)
+{
+    uint64_t end = fast->win_base + fast->win_lim + WASM_RAM_WINDOW_SLACK;
+
+    if (fast->win_lim && addr < end && fast->win_base < addr + len) {
+        tlb_window_reset_locked(fast);
+    }
+}
+
+/*
+ * Grow the window of @fast by the page just filled, if it is plain
+ * readable RAM adjacent to the window with the same addend.  A page
+ * inside the window which no longer qualifies empties it.
+ */
+static void tlb_window_extend_locked(CPUTLBDescFast *fast, vaddr addr_page,
+                                     uintptr_t addend, unsigned read_flags,
+                                     int prot)
+{
+    if (!qatomic_read(&wasm_ram_window_enabled)) {
+        return;
+    }
+    if (read_flags || !(prot & PAGE_READ) ||
+        (fast->win_lim && fast->win_addend != addend)) {
+        tlb_window_flush_locked(fast, addr_page, TARGET_PAGE_SIZE);
+        return;
+    }
+    if (!fast->win_lim) {
+        fast->win_base = addr_page;
+        fast->win_addend = addend;
+        fast->win_lim = TARGET_PAGE_SIZE - WASM_RAM_WINDOW_SLACK;
+    } else if (addr_page == fast->win_base + fast->win_lim +
+                            WASM_RAM_WINDOW_SLACK) {
+        fast->win_lim += TARGET_PAGE_SIZE;
+    } else if (addr_page + TARGET_PAGE_SIZE == fast->win_base) {
+        fast->win_base = addr_page;
+        fast->win_lim += TARGET_PAGE_SIZE;
+    }
+}
+#else
+static inline void tlb_window_reset_locked(CPUTLBDescFast *fast) { }
+static inline void tlb_window_flush_locked(CPUTLBDescFast *fast,
+                                           vaddr addr, vaddr len) { }
+static inline void tlb_window_extend_locked(CPUTLBDescFast *fast,
+                                            vaddr addr_page, uintptr_t addend,
+                                            unsigned read_flags, int prot) { }
+#endif
+
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
+    tlb_window_reset_locked(fast);
     desc->n_used_entries = 0;
-    desc->large_page_addr = -1;
-    desc->large_page_mask = -1;
+    desc->n_large_pages = 0;
     desc->vindex = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
 
+/* Called with tlb_c.lock held */
+static inline void tlb_bump_gen_locked(CPUState *cpu)
+{
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    qatomic_set(&cpu->neg.tlb.c.gen, cpu->neg.tlb.c.gen + 1);
+#endif
+}
+
 static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
                                         int64_t now)
 {
     CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
     CPUTLBDescFast *fast = &cpu->neg.tlb.f[mmu_idx];
 
+    tlb_bump_gen_locked(cpu);
     tlb_mmu_resize_locked(desc, fast, now);
     tlb_mmu_flush_locked(desc, fast);
 }
 
 static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
 {
-    size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
+    size_t n_entries = MIN(MAX((size_t)1 << CPU_TLB_DYN_DEFAULT_BITS,
+                               tlb_policy_min_size()),
+                           tlb_policy_max_size());
 
     tlb_window_reset(desc, now, 0);
     desc->n_used_entries = 0;
@@ -322,9 +426,9 @@ static void flush_all_helper(CPUState *src, run_on_cpu_func fn,
     }
 }
 
-static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
+static void tlb_flush_by_mmuidx_do(CPUState *cpu, uint16_t asked,
+                                   bool keep_jmp_cache)
 {
-    uint16_t asked = data.host_int;
     uint16_t all_dirty, work, to_clean;
     int64_t now = get_clock_realtime();
 
@@ -346,7 +450,9 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 
-    tcg_flush_jmp_cache(cpu);
+    if (!keep_jmp_cache) {
+        tcg_flush_jmp_cache(cpu);
+    }
 
     if (to_clean == ALL_MMUIDX_BITS) {
         qatomic_set(&cpu->neg.tlb.c.full_flush_count,
@@ -362,6 +468,33 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
     }
 }
 
+static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    tlb_flush_by_mmuidx_do(cpu, data.host_int, false);
+}
+
+static void tlb_flush_asid_switch_async_work(CPUState *cpu,
+                                             run_on_cpu_data data)
+{
+    /* Entries filled from now on belong to the new address space */
+    if (cpu->tb_jmp_cache) {
+        cpu->tb_jmp_cache->asid = data.host_ulong;
+    }
+    tlb_flush_by_mmuidx_do(cpu, ALL_MMUIDX_BITS, true);
+}
+
+void tlb_flush_asid_switch(CPUState *cpu, uint32_t asid)
+{
+    tlb_debug("asid: 0x%" PRIx32 "\n", asid);
+
+    if (cpu->created && !qemu_cpu_is_self(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_asid_switch_async_work,
+                         RUN_ON_CPU_HOST_ULONG(asid));
+    } else {
+        tlb_flush_asid_switch_async_work(cpu, RUN_ON_CPU_HOST_ULONG(asid));
+    }
+}
+
 void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
 {
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
@@ -473,25 +606,79 @@ static inline void tlb_flush_vtlb_page_locked(CPUState *cpu, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(cpu, mmu_idx, page, -1);
 }
 
-static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
+/*
+ * Flush all the entries of the large page region @lp, and stop tracking
+ * it.  The entries are found through their index for a region smaller
+ * than the tlb, and by going through the whole tlb otherwise, which
+ * still costs less than the refills after a full flush.
+ */
+static void tlb_flush_large_page_locked(CPUState *cpu, int midx,
+                                        unsigned int i)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[midx].large_page_addr;
-    vaddr lp_mask = cpu->neg.tlb.d[midx].large_page_mask;
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    CPUTLBDescFast *f = &cpu->neg.tlb.f[midx];
+    CPUTLBLargePage lp = d->large_pages[i];
+    vaddr n_pages = (~lp.mask >> TARGET_PAGE_BITS) + 1;
+    size_t n_entries = tlb_n_entries(f);
 
-    /* Check if we need to flush due to large pages.  */
-    if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d (%016"
-                  VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
+    tlb_debug("flushing large pages midx %d (%016"
+              VADDR_PRIx "/%016" VADDR_PRIx ")\n",
+              midx, lp.addr, lp.mask);
+
+    d->large_pages[i] = d->large_pages[--d->n_large_pages];
+
+    tlb_bump_gen_locked(cpu);
+    tlb_window_flush_locked(f, lp.addr, ~lp.mask);
+    if (n_pages <= n_entries) {
+        for (vaddr j = 0; j < n_pages; j++) {
+            vaddr page = lp.addr + (j << TARGET_PAGE_BITS);
+
+            if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
     } else {
-        if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
-            tlb_n_used_entries_dec(cpu, midx);
+        for (size_t j = 0; j < n_entries; j++) {
+            if (tlb_flush_entry_mask_locked(&f->table[j], lp.addr, lp.mask)) {
+                tlb_n_used_entries_dec(cpu, midx);
+            }
+        }
+    }
+    tlb_flush_vtlb_page_mask_locked(cpu, midx, lp.addr, lp.mask);
+}
+
+/* Flush the large page regions that overlap [@addr, @addr + @len). */
+static void tlb_flush_large_pages_locked(CPUState *cpu, int midx,
+                                         vaddr addr, vaddr len)
+{
+    CPUTLBDesc *d = &cpu->neg.tlb.d[midx];
+    vaddr last = addr + len - 1;
+    unsigned int i = 0;
+
+    while (i < d->n_large_pages) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+
+        if (addr <= (lp->addr | ~lp->mask) && lp->addr <= last) {
+            /* Moves the last region into slot i */
+            tlb_flush_large_page_locked(cpu, midx, i);
+        } else {
+            i++;
         }
-        tlb_flush_vtlb_page_locked(cpu, midx, page);
     }
 }
 
+static void tlb_flush_page_locked(CPUState *cpu, int midx, vaddr page)
+{
+    tlb_flush_large_pages_locked(cpu, midx, page, TARGET_PAGE_SIZE);
+
+    tlb_bump_gen_locked(cpu);
+    tlb_window_flush_locked(&cpu->neg.tlb.f[midx], page, TARGET_PAGE_SIZE);
+    if (tlb_flush_entry_locked(tlb_entry(cpu, midx, page), page)) {
+        tlb_n_used_entries_dec(cpu, midx);
+    }
+    tlb_flush_vtlb_page_locked(cpu, midx, page);
+}
+
 /**
  * tlb_flush_page_by_mmuidx_async_0:
  * @cpu: cpu on which to flush
@@ -644,6 +831,9 @@ void tlb_flush_page_all_cpus(CPUState *src, vaddr addr)
     tlb_flush_page_by_mmuidx_all_cpus(src, addr, ALL_MMUIDX_BITS);
 }
 
+static void tlb_flush_coalesce_all_cpus_synced(CPUState *src_cpu, vaddr addr,
+                                               vaddr len, uint16_t idxmap);
+
 void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
                                               vaddr addr,
                                               uint16_t idxmap)
@@ -653,36 +843,7 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
-    /*
-     * Allocate memory to hold addr+idxmap only when needed.
-     * See tlb_flush_page_by_mmuidx for details.
-     */
-    if (idxmap < TARGET_PAGE_SIZE) {
-        flush_all_helper(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                         RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_1,
-                              RUN_ON_CPU_TARGET_PTR(addr | idxmap));
-    } else {
-        CPUState *dst_cpu;
-        TLBFlushPageByMMUIdxData *d;
-
-        /* Allocate a separate data block for each destination cpu.  */
-        CPU_FOREACH(dst_cpu) {
-            if (dst_cpu != src_cpu) {
-                d = g_new(TLBFlushPageByMMUIdxData, 1);
-                d->addr = addr;
-                d->idxmap = idxmap;
-                async_run_on_cpu(dst_cpu, tlb_flush_page_by_mmuidx_async_2,
-                                 RUN_ON_CPU_HOST_PTR(d));
-            }
-        }
-
-        d = g_new(TLBFlushPageByMMUIdxData, 1);
-        d->addr = addr;
-        d->idxmap = idxmap;
-        async_safe_run_on_cpu(src_cpu, tlb_flush_page_by_mmuidx_async_2,
-                              RUN_ON_CPU_HOST_PTR(d));
-    }
+    tlb_flush_coalesce_all_cpus_synced(src_cpu, addr, TARGET_PAGE_SIZE, idxmap);
 }
 
 void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
@@ -716,19 +877,11 @@ static void tlb_flush_range_locked(CPUState *cpu, int midx,
         return;
     }
 
-    /*
-     * Check if we need to flush due to large pages.
-     * Because large_page_mask contains all 1's from the msb,
-     * we only need to test the end of the range.
-     */
-    if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  "%016" VADDR_PRIx "/%016" VADDR_PRIx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(cpu, midx, get_clock_realtime());
-        return;
-    }
+    /* Large pages that overlap the range are flushed as a whole */
+    tlb_flush_large_pages_locked(cpu, midx, addr, len);
 
+    tlb_bump_gen_locked(cpu);
+    tlb_window_flush_locked(f, addr, len);
     for (vaddr i = 0; i < len; i += TARGET_PAGE_SIZE) {
         vaddr page = addr + i;
         CPUTLBEntry *entry = tlb_entry(cpu, midx, page);
@@ -793,6 +946,91 @@ static void tlb_flush_range_by_mmuidx_async_1(CPUState *cpu,
     g_free(d);
 }
 
+/*
+ * Flush coalescing for the synced all-cpus flushes.
+ *
+ * Guests tend to issue these in bursts (munmap, COW), and each used to
+ * be its own work item on every cpu plus one safe work item, which stops
+ * all vCPUs.  Instead, a request joins the flush already pending on the
+ * destination cpu if there is one, widening its range; only the first of
+ * a burst queues work.  Flushing more than asked for is always correct,
+ * and tlb_flush_range_locked falls back to a full flush for wide ranges.
+ */
+enum {
+    TLB_PENDING_ASYNC,
+    TLB_PENDING_SAFE,
+};
+
+static void tlb_flush_pending_work(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUTLBPendingFlush *pend = &cpu->neg.tlb.c.pending[data.host_int];
+    TLBFlushRangeData d;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    d.addr = pend->lo;
+    d.len = pend->hi - pend->lo;
+    d.idxmap = pend->idxmap;
+    d.bits = TARGET_LONG_BITS;
+    pend->queued = false;
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (d.len == TARGET_PAGE_SIZE) {
+        tlb_flush_page_by_mmuidx_async_0(cpu, d.addr, d.idxmap);
+    } else {
+        tlb_flush_range_by_mmuidx_async_0(cpu, d);
+    }
+}
+
+/* Add the page range [addr, addr + len) to the flush pending on @cpu. */
+static void tlb_flush_coalesce(CPUState *cpu, int which, vaddr addr,
+                               vaddr len, uint16_t idxmap)
+{
+    CPUTLBPendingFlush *pend = &cpu->neg.tlb.c.pending[which];
+    bool queue;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    queue = !pend->queued;
+    if (queue) {
+        pend->queued = true;
+        pend->lo = addr;
+        pend->hi = addr + len;
+        pend->idxmap = idxmap;
+    } else {
+        pend->lo = MIN(pend->lo, addr);
+        pend->hi = MAX(pend->hi, addr + len);
+        pend->idxmap |= idxmap;
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+
+    if (!queue) {
+        qatomic_set(&cpu->neg.tlb.c.merged_flush_count,
+                    cpu->neg.tlb.c.merged_flush_count + 1);
+        return;
+    }
+    qatomic_set(&cpu->neg.tlb.c.queued_flush_count,
+                cpu->neg.tlb.c.queued_flush_count + 1);
+    if (which == TLB_PENDING_SAFE) {
+        async_safe_run_on_cpu(cpu, tlb_flush_pending_work,
+                              RUN_ON_CPU_HOST_INT(which));
+    } else {
+        async_run_on_cpu(cpu, tlb_flush_pending_work,
+                         RUN_ON_CPU_HOST_INT(which));
+    }
+}
+
+static void tlb_flush_coalesce_all_cpus_synced(CPUState *src_cpu, vaddr addr,
+                                               vaddr len, uint16_t idxmap)
+{
+    CPUState *dst_cpu;
+
+    CPU_FOREACH(dst_cpu) {
+        if (dst_cpu != src_cpu) {
+            tlb_flush_coalesce(dst_cpu, TLB_PENDING_ASYNC, addr, len, idxmap);
+        }
+    }
+    tlb_flush_coalesce(src_cpu, TLB_PENDING_SAFE, addr, len, idxmap);
+}
+
 void tlb_flush_range_by_mmuidx(CPUState *cpu, vaddr addr,
                                vaddr len, uint16_t idxmap,
                                unsigned bits)
@@ -912,6 +1150,11 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
+    if (bits >= TARGET_LONG_BITS) {
+        tlb_flush_coalesce_all_cpus_synced(src_cpu, d.addr, len, idxmap);
+        return;
+    }
+
     /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
@@ -1011,6 +1254,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     int mmu_idx;
 
     qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    tlb_bump_gen_locked(cpu);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
         unsigned int n = tlb_n_entries(&cpu->neg.tlb.f[mmu_idx]);
@@ -1028,6 +1272,53 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
+/* Called with tlb_c.lock held */
+static void tlb_entry_ram_page_locked(CPUTLBEntry *tlb_entry,
+                                      void (*fn)(void *host, void *opaque),
+                                      void *opaque)
+{
+    MMUAccessType access_type;
+
+    for (access_type = MMU_DATA_LOAD; access_type <= MMU_INST_FETCH;
+         access_type++) {
+        uint64_t addr = tlb_read_idx(tlb_entry, access_type);
+
+        if ((addr & (TLB_INVALID_MASK | TLB_MMIO)) == 0) {
+            fn((void *)(uintptr_t)((addr & TARGET_PAGE_MASK) +
+                                   tlb_entry->addend), opaque);
+            return;
+        }
+    }
+}
+
+/*
+ * Call @fn with the host address of every RAM page that @cpu has in its
+ * TLB, i.e. that it accessed since the TLB was last flushed.  A page
+ * can be reported more than once.
+ */
+void tlb_foreach_ram_page(CPUState *cpu, void (*fn)(void *host, void *opaque),
+                          void *opaque)
+{
+    int mmu_idx;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        unsigned int i;
+        unsigned int n = tlb_n_entries(&cpu->neg.tlb.f[mmu_idx]);
+
+        for (i = 0; i < n; i++) {
+            tlb_entry_ram_page_locked(&cpu->neg.tlb.f[mmu_idx].table[i],
+                                      fn, opaque);
+        }
+
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            tlb_entry_ram_page_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
+                                      fn, opaque);
+        }
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+}
+
 /* Called with tlb_c.lock held */
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          vaddr addr)
@@ -1060,28 +1351,47 @@ void tlb_set_dirty(CPUState *cpu, vaddr addr)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
+/* Our TLB does not support large pages, so remember the areas covered by
+   large pages and flush all of an area if part of it is invalidated.  */
 static void tlb_add_large_page(CPUState *cpu, int mmu_idx,
                                vaddr addr, uint64_t size)
 {
-    vaddr lp_addr = cpu->neg.tlb.d[mmu_idx].large_page_addr;
+    CPUTLBDesc *d = &cpu->neg.tlb.d[mmu_idx];
     vaddr lp_mask = ~(size - 1);
+    CPUTLBLargePage *best = NULL;
+    vaddr best_mask = 0;
 
-    if (lp_addr == (vaddr)-1) {
-        /* No previous large page.  */
-        lp_addr = addr;
-    } else {
-        /* Extend the existing region to include the new page.
-           This is a compromise between unnecessary flushes and
-           the cost of maintaining a full variable size TLB.  */
-        lp_mask &= cpu->neg.tlb.d[mmu_idx].large_page_mask;
-        while (((lp_addr ^ addr) & lp_mask) != 0) {
-            lp_mask <<= 1;
+    for (unsigned int i = 0; i < d->n_large_pages; i++) {
+        CPUTLBLargePage *lp = &d->large_pages[i];
+        vaddr mask = lp->mask & lp_mask;
+
+        /* The smallest aligned region with both the region and the page */
+        while (((lp->addr ^ addr) & mask) != 0) {
+            mask <<= 1;
+        }
+        if (mask == lp->mask) {
+            /* Already covered */
+            return;
         }
+        if (!best || mask > best_mask) {
+            best = lp;
+            best_mask = mask;
+        }
+    }
+
+    /*
+     * Take a free slot unless a region fits within the new page.  With
+     * all the slots in use, extend the region that grows the least to
+     * include the new page.  This is a compromise between unnecessary
+     * flushes and the cost of maintaining a full variable size TLB.
+     */
+    if (d->n_large_pages < CPU_TLB_LARGE_PAGES &&
+        !(best && best_mask == lp_mask)) {
+        best = &d->large_pages[d->n_large_pages++];
+        best_mask = lp_mask;
     }
-    cpu->neg.tlb.d[mmu_idx].large_page_addr = lp_addr & lp_mask;
-    cpu->neg.tlb.d[mmu_idx].large_page_mask = lp_mask;
+    best->addr = addr & best_mask;
+    best->mask = best_mask;
 }
 
 static inline void tlb_set_compare(CPUTLBEntryFull *full, CPUTLBEntry *ent,
@@ -1160,6 +1470,11 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     if (is_ram || is_romd) {
         /* RAM and ROMD both have associated host memory. */
         addend = (uintptr_t)memory_region_get_ram_ptr(section->mr) + xlat;
+        /*
+         * Accesses through this entry bypass qemu_map_ram_ptr(), so a page
+         * still left in the migration file by lazy-ram-load is read now.
+         */
+        ramblock_lazy_populate(section->mr->ram_block, xlat, TARGET_PAGE_SIZE);
     } else {
         /* I/O does not; force the host address to NULL. */
         addend = 0;
@@ -1208,6 +1523,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * is unlikely to be contended.
      */
     qemu_spin_lock(&tlb->c.lock);
+    tlb_bump_gen_locked(cpu);
 
     /* Note that the tlb is no longer clean.  */
     tlb->c.dirty |= 1 << mmu_idx;
@@ -1260,6 +1576,8 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
     }
     tlb_set_compare(full, &tn, addr_page, read_flags,
                     MMU_DATA_LOAD, prot & PAGE_READ);
+    tlb_window_extend_locked(&tlb->f[mmu_idx], addr_page, tn.addend,
+                             is_ram ? read_flags : TLB_MMIO, prot);
 
     if (prot & PAGE_WRITE_INV) {
         write_flags |= TLB_INVALID_MASK;
@@ -1298,6 +1616,14 @@ void tlb_set_page(CPUState *cpu, vaddr addr,
                             prot, mmu_idx, size);
 }
 
+static inline void tlb_count_fill(CPUState *cpu, int mmu_idx)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+
+    desc->window_fills++;
+    qatomic_set(&desc->fill_count, desc->fill_count + 1);
+}
+
 /*
  * Note: tlb_fill() can trigger a resize of the TLB. This means that all of the
  * caller's prior references to the TLB table (e.g. CPUTLBEntry pointers) must
@@ -1312,6 +1638,7 @@ static void tlb_fill(CPUState *cpu, vaddr addr, int size,
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
      */
+    tlb_count_fill(cpu, mmu_idx);
     ok = cpu->cc->tcg_ops->tlb_fill(cpu, addr, size,
                                     access_type, mmu_idx, false, retaddr);
     assert(ok);
@@ -1343,6 +1670,21 @@ io_prepare(hwaddr *out_offset, CPUState *cpu, hwaddr xlat,
     return section;
 }
 
+/* The BQL around the dispatch, unless the region is lockless_io */
+static void io_lock(MemoryRegion *mr)
+{
+    if (!mr->lockless_io) {
+        qemu_mutex_lock_iothread();
+    }
+}
+
+static void io_unlock(MemoryRegion *mr)
+{
+    if (!mr->lockless_io) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
                       unsigned size, MMUAccessType access_type, int mmu_idx,
                       MemTxResult response, uintptr_t retaddr)
@@ -1372,6 +1714,9 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
         if (cmp == page) {
             /* Found entry in victim tlb, swap tlb and iotlb.  */
             CPUTLBEntry tmptlb, *tlb = &cpu->neg.tlb.f[mmu_idx].table[index];
+            CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+
+            qatomic_set(&desc->vtlb_hit_count, desc->vtlb_hit_count + 1);
 
             qemu_spin_lock(&cpu->neg.tlb.c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
@@ -1396,6 +1741,9 @@ static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
 
     trace_memory_notdirty_write_access(mem_vaddr, ram_addr, size);
 
+    /* Called before the store, so background-snapshot can copy the page */
+    ram_write_track(ram_addr, size);
+
     if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
         tb_invalidate_phys_range_fast(ram_addr, size, retaddr);
     }
@@ -1429,6 +1777,7 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
 
     if (!tlb_hit_page(tlb_addr, page_addr)) {
         if (!victim_tlb_hit(cpu, mmu_idx, index, access_type, page_addr)) {
+            tlb_count_fill(cpu, mmu_idx);
             if (!cpu->cc->tcg_ops->tlb_fill(cpu, addr, fault_size, access_type,
                                             mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1584,6 +1933,53 @@ void *tlb_vaddr_to_host(CPUArchState *env, abi_ptr addr,
     return flags ? NULL : host;
 }
 
+uint64_t cpu_memset_page_mmuidx_ra(CPUArchState *env, abi_ptr addr,
+                                   uint8_t val, uint64_t len,
+                                   int mmu_idx, uintptr_t ra)
+{
+    void *mem;
+
+    len = MIN(len, TARGET_PAGE_ALIGN(addr + 1) - addr);
+    mem = tlb_vaddr_to_host(env, addr, MMU_DATA_STORE, mmu_idx);
+    if (unlikely(!mem)) {
+        /* Once this has dirtied or filled the page, the next call is fast */
+        cpu_stb_mmuidx_ra(env, addr, val, mmu_idx, ra);
+        return 1;
+    }
+    memset(mem, val, len);
+    return len;
+}
+
+uint64_t cpu_memmove_page_mmuidx_ra(CPUArchState *env, abi_ptr dst,
+                                    abi_ptr src, uint64_t len,
+                                    int wmmu_idx, int rmmu_idx,
+                                    uintptr_t ra)
+{
+    void *wmem, *rmem;
+
+    len = MIN(len, TARGET_PAGE_ALIGN(dst + 1) - dst);
+    len = MIN(len, TARGET_PAGE_ALIGN(src + 1) - src);
+    wmem = tlb_vaddr_to_host(env, dst, MMU_DATA_STORE, wmmu_idx);
+    rmem = tlb_vaddr_to_host(env, src, MMU_DATA_LOAD, rmmu_idx);
+    if (unlikely(!rmem || !wmem)) {
+        uint8_t byte;
+
+        if (rmem) {
+            byte = *(uint8_t *)rmem;
+        } else {
+            byte = cpu_ldub_mmuidx_ra(env, src, rmmu_idx, ra);
+        }
+        if (wmem) {
+            *(uint8_t *)wmem = byte;
+        } else {
+            cpu_stb_mmuidx_ra(env, dst, byte, wmmu_idx, ra);
+        }
+        return 1;
+    }
+    memmove(wmem, rmem, len);
+    return len;
+}
+
 /*
  * Return a ram_addr_t for the virtual address for execution.
  *
@@ -1975,7 +2371,7 @@ static void *atomic_mmu_lookup(CPUState *cpu, vaddr addr, MemOpIdx oi,
  * @size: number of bytes
  * @mmu_idx: virtual address context
  * @ra: return address into tcg generated code, or 0
- * Context: iothread lock held
+ * Context: iothread lock held, unless the region is lockless_io
  *
  * Load @size bytes from @addr, which is memory-mapped i/o.
  * The bytes are concatenated in big-endian order with @ret_be.
@@ -2030,10 +2426,10 @@ static uint64_t do_ld_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
-    qemu_mutex_lock_iothread();
+    io_lock(mr);
     ret = int_ld_mmio_beN(cpu, full, ret_be, addr, size, mmu_idx,
                           type, ra, mr, mr_offset);
-    qemu_mutex_unlock_iothread();
+    io_unlock(mr);
 
     return ret;
 }
@@ -2054,12 +2450,12 @@ static Int128 do_ld16_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
-    qemu_mutex_lock_iothread();
+    io_lock(mr);
     a = int_ld_mmio_beN(cpu, full, ret_be, addr, size - 8, mmu_idx,
                         MMU_DATA_LOAD, ra, mr, mr_offset);
     b = int_ld_mmio_beN(cpu, full, ret_be, addr + size - 8, 8, mmu_idx,
                         MMU_DATA_LOAD, ra, mr, mr_offset + size - 8);
-    qemu_mutex_unlock_iothread();
+    io_unlock(mr);
 
     return int128_make128(b, a);
 }
@@ -2521,7 +2917,7 @@ static Int128 do_ld16_mmu(CPUState *cpu, vaddr addr,
  * @size: number of bytes
  * @mmu_idx: virtual address context
  * @ra: return address into tcg generated code, or 0
- * Context: iothread lock held
+ * Context: iothread lock held, unless the region is lockless_io
  *
  * Store @size bytes at @addr, which is memory-mapped i/o.
  * The bytes to store are extracted in little-endian order from @val_le;
@@ -2577,10 +2973,10 @@ static uint64_t do_st_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
-    qemu_mutex_lock_iothread();
+    io_lock(mr);
     ret = int_st_mmio_leN(cpu, full, val_le, addr, size, mmu_idx,
                           ra, mr, mr_offset);
-    qemu_mutex_unlock_iothread();
+    io_unlock(mr);
 
     return ret;
 }
@@ -2601,12 +2997,12 @@ static uint64_t do_st16_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
-    qemu_mutex_lock_iothread();
+    io_lock(mr);
     int_st_mmio_leN(cpu, full, int128_getlo(val_le), addr, 8,
                     mmu_idx, ra, mr, mr_offset);
     ret = int_st_mmio_leN(cpu, full, int128_gethi(val_le), addr + 8,
                           size - 8, mmu_idx, ra, mr, mr_offset + 8);
-    qemu_mutex_unlock_iothread();
+    io_unlock(mr);
 
     return ret;
 }
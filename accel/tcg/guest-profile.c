@@ -0,0 +1,136 @@
+/*
+ * Sampling profiler of the guest PC
+ *
+ * A realtime timer asks every vCPU for a sample.  The request only makes
+ * the vCPU leave translated code at the next TB boundary, like an
+ * interrupt would, and cpu_handle_interrupt() records the guest PC there.
+ * Unlike a callback per executed TB, this costs nothing between samples
+ * and keeps TB chaining intact.
+ *
+ * At exit the samples are written in the folded format of flamegraph.pl,
+ * one line per PC: "cpu<N>;<symbol>;0x<pc> <count>".
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "hw/core/cpu.h"
+#include "disas/disas.h"
+#include "sysemu/sysemu.h"
+#include "internal-common.h"
+
+typedef struct GuestProfileKey {
+    int cpu_index;
+    vaddr pc;
+} GuestProfileKey;
+
+typedef struct GuestProfileEntry {
+    GuestProfileKey key;
+    uint64_t count;
+} GuestProfileEntry;
+
+bool guest_profile_enabled;
+
+static QemuMutex guest_profile_lock;
+static GHashTable *guest_profile_samples;
+static QEMUTimer *guest_profile_timer;
+static int64_t guest_profile_period_ns;
+static char *guest_profile_path;
+
+static guint guest_profile_key_hash(gconstpointer p)
+{
+    const GuestProfileKey *k = p;
+
+    return g_int64_hash(&k->pc) ^ k->cpu_index;
+}
+
+static gboolean guest_profile_key_equal(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileKey *ka = a, *kb = b;
+
+    return ka->cpu_index == kb->cpu_index && ka->pc == kb->pc;
+}
+
+static void guest_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        /* A halted vCPU would report where it wakes up */
+        if (qatomic_read(&cpu->halted)) {
+            continue;
+        }
+        qatomic_set(&cpu->profile_sample, true);
+        /* The part of cpu_exit() which leaves translated code */
+        smp_wmb();
+        qatomic_set(&cpu->neg.icount_decr.u16.high, -1);
+    }
+    timer_mod(guest_profile_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + guest_profile_period_ns);
+}
+
+void guest_profile_sample(CPUState *cpu)
+{
+    GuestProfileKey key = { cpu->cpu_index, cpu->cc->get_pc(cpu) };
+    GuestProfileEntry *e;
+
+    qatomic_set(&cpu->profile_sample, false);
+
+    qemu_mutex_lock(&guest_profile_lock);
+    e = g_hash_table_lookup(guest_profile_samples, &key);
+    if (e == NULL) {
+        e = g_new0(GuestProfileEntry, 1);
+        e->key = key;
+        g_hash_table_insert(guest_profile_samples, &e->key, e);
+    }
+    e->count++;
+    qemu_mutex_unlock(&guest_profile_lock);
+}
+
+static void guest_profile_write(Notifier *n, void *data)
+{
+    GHashTableIter iter;
+    GuestProfileEntry *e;
+    FILE *f;
+
+    f = fopen(guest_profile_path, "w");
+    if (f == NULL) {
+        warn_report("Could not open %s: %s, no guest profile written",
+                    guest_profile_path, strerror(errno));
+        return;
+    }
+
+    qemu_mutex_lock(&guest_profile_lock);
+    g_hash_table_iter_init(&iter, guest_profile_samples);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        const char *sym = lookup_symbol(e->key.pc);
+
+        fprintf(f, "cpu%d;%s;0x%" VADDR_PRIx " %" PRIu64 "\n",
+                e->key.cpu_index, *sym ? sym : "[unknown]", e->key.pc,
+                e->count);
+    }
+    qemu_mutex_unlock(&guest_profile_lock);
+
+    fclose(f);
+}
+
+static Notifier guest_profile_notifier = { .notify = guest_profile_write };
+
+void guest_profile_init(const char *path, uint32_t hz)
+{
+    qemu_mutex_init(&guest_profile_lock);
+    guest_profile_samples = g_hash_table_new_full(guest_profile_key_hash,
+                                                  guest_profile_key_equal,
+                                                  NULL, g_free);
+    guest_profile_path = g_strdup(path);
+    guest_profile_period_ns = NANOSECONDS_PER_SECOND / MAX(hz, 1);
+    guest_profile_timer = timer_new_ns(QEMU_CLOCK_REALTIME,
+                                       guest_profile_tick, NULL);
+    timer_mod(guest_profile_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + guest_profile_period_ns);
+    qemu_add_exit_notifier(&guest_profile_notifier);
+    guest_profile_enabled = true;
+}
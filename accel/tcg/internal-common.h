@@ -14,6 +14,57 @@
 extern int64_t max_delay;
 extern int64_t max_advance;
 
+void tb_dump_smc_info(GString *buf);
+
+/* Why cpu_exec_loop gets control back from translated code */
+typedef enum TCGExitCause {
+    TCG_EXIT_UNCHAINED,     /* goto_tb to a TB which isn't linked yet */
+    TCG_EXIT_NOCHAIN,       /* exit_tb(0), e.g. a goto_ptr lookup miss */
+    TCG_EXIT_REQUESTED,     /* TB_EXIT_REQUESTED by cpu_exit() */
+    TCG_EXIT_ICOUNT,        /* icount decrementer expired */
+    TCG_EXIT_INTERRUPT,     /* interrupt taken by cpu_handle_interrupt */
+    TCG_EXIT_EXIT_REQUEST,  /* cpu->exit_request or icount budget used up */
+    TCG_EXIT_EXCEPTION,     /* exception_index set, mostly by longjmp */
+    TCG_EXIT__MAX
+} TCGExitCause;
+
+/*
+ * Per-vCPU counters, only updated by the vCPU thread.  Readers may see
+ * torn values on 32-bit hosts, which is fine for statistics.
+ */
+struct TCGExitStats {
+    uint64_t exits[TCG_EXIT__MAX];
+    uint64_t jc_hit;        /* tb_lookup hit in the CPUJumpCache */
+    uint64_t jc_miss;       /* ... missed it but found the TB */
+    uint64_t l2_hit;        /* ... of which in the second-level cache */
+    uint64_t tb_miss;       /* ... found no TB at all */
+    uint64_t goto_ptr;      /* lookups by helper_lookup_tb_ptr */
+    uint64_t goto_ptr_miss; /* ... returning to the epilogue */
+    uint64_t translate_waits;   /* tb_gen_code blocked on a page lock */
+    uint64_t translate_wait_ns; /* ... for this long in total */
+    uint64_t translate_retries; /* optimistic TBs refused at link time */
+    /* Round-robin scheduling, see tcg-accel-ops-rr.c */
+    int64_t rr_slice_ns;    /* length of the next slice, 0 until the first */
+    uint64_t rr_slices;     /* times the vCPU was run */
+    uint64_t rr_expired;    /* ... until the kick timer fired */
+    uint64_t rr_shortened;  /* ... for less, an interrupt was pending */
+    uint64_t rr_skipped;    /* turns skipped because it was halted */
+    uint64_t rr_run_ns;     /* host time it ran */
+};
+
+static inline void tcg_exit_stats_inc(CPUState *cpu, TCGExitCause cause)
+{
+    cpu->tcg_exit_stats->exits[cause]++;
+}
+
+void tcg_exit_stats_init(void);
+
+/* Sampling profiler of the guest PC, see guest-profile.c */
+extern bool guest_profile_enabled;
+
+void guest_profile_init(const char *path, uint32_t hz);
+void guest_profile_sample(CPUState *cpu);
+
 /*
  * Return true if CS is not running in parallel with other cpus, either
  * because there are no other cpus or we are within an exclusive context.
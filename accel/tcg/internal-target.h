@@ -77,6 +77,7 @@ void tb_htable_init(void);
 void tb_reset_jump(TranslationBlock *tb, int n);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
+void tb_flush_partial(CPUState *cpu);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                uintptr_t host_pc);
 
@@ -94,6 +95,25 @@ static inline vaddr log_pc(CPUState *cpu, const TranslationBlock *tb)
 }
 
 extern bool one_insn_per_tb;
+extern bool tb_prefetch;
+extern bool tb_optimistic_translation;
+
+/* Softmmu TLB resize policies, -accel tcg,tlb-policy= */
+typedef enum {
+    TLB_POLICY_USE_RATE,    /* size after the use rate in a time window */
+    TLB_POLICY_MISS_RATE,   /* grow on refill pressure, shrink slowly */
+} TLBPolicy;
+
+extern TLBPolicy tlb_policy;
+/* Floor and ceiling of the dynamic TLB size in bits, 0 for the default */
+extern unsigned tlb_policy_min_bits;
+extern unsigned tlb_policy_max_bits;
+
+#ifdef CONFIG_USER_ONLY
+static inline void tb_prefetch_note(TranslationBlock *tb, vaddr pc) { }
+#else
+void tb_prefetch_note(TranslationBlock *tb, vaddr pc);
+#endif
 
 /**
  * tcg_req_mo:
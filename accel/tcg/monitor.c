@@ -16,9 +16,13 @@
 #include "sysemu/cpus.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/tcg.h"
+#include "sysemu/stats.h"
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#include "../../tcg/wasm32.h"
+#endif
 
 
 static void dump_drift_info(GString *buf)
@@ -141,11 +145,128 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static void tlb_dump_coalesce_counts(GString *buf)
+{
+    CPUState *cpu;
+    size_t merged = 0, queued = 0;
+
+    CPU_FOREACH(cpu) {
+        merged += qatomic_read(&cpu->neg.tlb.c.merged_flush_count);
+        queued += qatomic_read(&cpu->neg.tlb.c.queued_flush_count);
+    }
+    g_string_append_printf(buf, "TLB merged flushes  %zu (%zu queued)\n",
+                           merged, queued);
+}
+
+static void tlb_dump_miss_counts(GString *buf)
+{
+    CPUState *cpu;
+
+    for (int i = 0; i < NB_MMU_MODES; i++) {
+        size_t fills = 0, vhits = 0, entries = 0;
+
+        CPU_FOREACH(cpu) {
+            CPUTLBDesc *d = &cpu->neg.tlb.d[i];
+
+            fills += qatomic_read(&d->fill_count);
+            vhits += qatomic_read(&d->vtlb_hit_count);
+            entries = MAX(entries, (qatomic_read(&cpu->neg.tlb.f[i].mask)
+                                    >> CPU_TLB_ENTRY_BITS) + 1);
+        }
+        if (fills || vhits) {
+            g_string_append_printf(buf, "TLB mmu_idx %-2d      %zu fills, "
+                                   "%zu victim hits, %zu entries\n",
+                                   i, fills, vhits, entries);
+        }
+    }
+}
+
 static void tcg_dump_info(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
 }
 
+static void dump_translate_wait_info(GString *buf)
+{
+    uint64_t waits = 0, wait_ns = 0, retries = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        const TCGExitStats *st = cpu->tcg_exit_stats;
+
+        if (st) {
+            waits += st->translate_waits;
+            wait_ns += st->translate_wait_ns;
+            retries += st->translate_retries;
+        }
+    }
+    g_string_append_printf(buf, "TB translate waits  %" PRIu64 " (%" PRIu64
+                           " us), optimistic retries %" PRIu64 "\n",
+                           waits, wait_ns / 1000, retries);
+}
+
+static void dump_tb_lookup_info(GString *buf)
+{
+    uint64_t jc_hit = 0, l2_hit = 0, htable = 0, miss = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        const TCGExitStats *st = cpu->tcg_exit_stats;
+
+        if (st) {
+            jc_hit += st->jc_hit;
+            l2_hit += st->l2_hit;
+            htable += st->jc_miss - st->l2_hit;
+            miss += st->tb_miss;
+        }
+    }
+    g_string_append_printf(buf, "TB lookups          jump cache %" PRIu64
+                           " l2 %" PRIu64 " htable %" PRIu64
+                           " misses %" PRIu64 "\n",
+                           jc_hit, l2_hit, htable, miss);
+}
+
+static void dump_halt_info(GString *buf)
+{
+    uint64_t wakeups = 0, wakeup_us = 0;
+    uint32_t max_us = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        wakeups += cpu->halt_parker.wakeups;
+        wakeup_us += cpu->halt_parker.wakeup_us;
+        max_us = MAX(max_us, cpu->halt_parker.wakeup_max_us);
+    }
+    g_string_append_printf(buf, "vCPU halt wakeups   %" PRIu64
+                           " (avg %" PRIu64 " us, max %u us)\n",
+                           wakeups, wakeups ? wakeup_us / wakeups : 0,
+                           max_us);
+}
+
+static void dump_rr_info(GString *buf)
+{
+    CPUState *cpu;
+
+    if (qemu_tcg_mttcg_enabled() || !first_cpu || !CPU_NEXT(first_cpu)) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        const TCGExitStats *st = cpu->tcg_exit_stats;
+
+        if (st) {
+            g_string_append_printf(buf, "RR vCPU %-3d slice  %" PRIi64
+                                   " ms, run %" PRIu64 " (expired %" PRIu64
+                                   " shortened %" PRIu64 ") skipped %" PRIu64
+                                   ", %" PRIu64 " ms\n",
+                                   cpu->cpu_index, st->rr_slice_ns / SCALE_MS,
+                                   st->rr_slices, st->rr_expired,
+                                   st->rr_shortened, st->rr_skipped,
+                                   st->rr_run_ns / SCALE_MS);
+        }
+    }
+}
+
 static void dump_exec_info(GString *buf)
 {
     struct tb_tree_stats tst = {};
@@ -189,13 +310,25 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "\nStatistics:\n");
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
+    g_string_append_printf(buf, "TB partial flushes  %u\n",
+                           qatomic_read(&tb_ctx.tb_partial_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    dump_translate_wait_info(buf);
+    dump_tb_lookup_info(buf);
+    dump_halt_info(buf);
+    dump_rr_info(buf);
+    tb_dump_smc_info(buf);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_dump_coalesce_counts(buf);
+    tlb_dump_miss_counts(buf);
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm32_dump_info(buf);
+#endif
     tcg_dump_info(buf);
 }
 
@@ -235,6 +368,147 @@ HumanReadableText *qmp_x_query_opcount(Error **errp)
     return human_readable_text_from_str(buf);
 }
 
+static const char *const tcg_exit_names[TCG_EXIT__MAX] = {
+    [TCG_EXIT_UNCHAINED] = "exits-unchained",
+    [TCG_EXIT_NOCHAIN] = "exits-nochain",
+    [TCG_EXIT_REQUESTED] = "exits-requested",
+    [TCG_EXIT_ICOUNT] = "exits-icount",
+    [TCG_EXIT_INTERRUPT] = "exits-interrupt",
+    [TCG_EXIT_EXIT_REQUEST] = "exits-exit-request",
+    [TCG_EXIT_EXCEPTION] = "exits-exception",
+};
+
+static StatsList *tcg_exit_stats_add(StatsList *list, strList *names,
+                                     const char *name, uint64_t v)
+{
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    Stats *stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = v;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void tcg_exit_query_stats_cb(StatsResultList **result,
+                                    StatsTarget target, strList *names,
+                                    strList *targets, Error **errp)
+{
+    CPUState *cpu;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+    CPU_FOREACH(cpu) {
+        const TCGExitStats *st = cpu->tcg_exit_stats;
+        StatsList *list = NULL;
+
+        if (!st ||
+            !apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
+            continue;
+        }
+        for (int i = 0; i < TCG_EXIT__MAX; i++) {
+            list = tcg_exit_stats_add(list, names, tcg_exit_names[i],
+                                      st->exits[i]);
+        }
+        list = tcg_exit_stats_add(list, names, "jump-cache-hits", st->jc_hit);
+        list = tcg_exit_stats_add(list, names, "jump-cache-misses",
+                                  st->jc_miss);
+        list = tcg_exit_stats_add(list, names, "jump-cache-l2-hits",
+                                  st->l2_hit);
+        list = tcg_exit_stats_add(list, names, "tb-lookup-misses",
+                                  st->tb_miss);
+        list = tcg_exit_stats_add(list, names, "goto-ptr-lookups",
+                                  st->goto_ptr);
+        list = tcg_exit_stats_add(list, names, "goto-ptr-misses",
+                                  st->goto_ptr_miss);
+        list = tcg_exit_stats_add(list, names, "translate-waits",
+                                  st->translate_waits);
+        list = tcg_exit_stats_add(list, names, "translate-wait-time",
+                                  st->translate_wait_ns);
+        list = tcg_exit_stats_add(list, names, "translate-retries",
+                                  st->translate_retries);
+        list = tcg_exit_stats_add(list, names, "rr-slice-length",
+                                  st->rr_slice_ns);
+        list = tcg_exit_stats_add(list, names, "rr-slices", st->rr_slices);
+        list = tcg_exit_stats_add(list, names, "rr-slices-expired",
+                                  st->rr_expired);
+        list = tcg_exit_stats_add(list, names, "rr-slices-shortened",
+                                  st->rr_shortened);
+        list = tcg_exit_stats_add(list, names, "rr-skipped", st->rr_skipped);
+        list = tcg_exit_stats_add(list, names, "rr-run-time", st->rr_run_ns);
+        list = tcg_exit_stats_add(list, names, "halt-wakeups",
+                                  cpu->halt_parker.wakeups);
+        list = tcg_exit_stats_add(list, names, "halt-wakeup-time",
+                                  cpu->halt_parker.wakeup_us * SCALE_US);
+        list = tcg_exit_stats_add(list, names, "halt-wakeup-time-max",
+                                  (uint64_t)cpu->halt_parker.wakeup_max_us *
+                                  SCALE_US);
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG,
+                            cpu->parent_obj.canonical_path, list);
+        }
+    }
+}
+
+static StatsSchemaValueList *tcg_exit_schema_add(StatsSchemaValueList *list,
+                                                 const char *name, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = STATS_TYPE_CUMULATIVE;
+    if (ns) {
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void tcg_exit_query_stats_schemas_cb(StatsSchemaList **result,
+                                            Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = tcg_exit_schema_add(list, "halt-wakeup-time-max", true);
+    list->value->type = STATS_TYPE_PEAK;
+    list = tcg_exit_schema_add(list, "halt-wakeup-time", true);
+    list = tcg_exit_schema_add(list, "halt-wakeups", false);
+    list = tcg_exit_schema_add(list, "rr-run-time", true);
+    list = tcg_exit_schema_add(list, "rr-skipped", false);
+    list = tcg_exit_schema_add(list, "rr-slices-shortened", false);
+    list = tcg_exit_schema_add(list, "rr-slices-expired", false);
+    list = tcg_exit_schema_add(list, "rr-slices", false);
+    list = tcg_exit_schema_add(list, "rr-slice-length", true);
+    list->value->type = STATS_TYPE_INSTANT;
+    list = tcg_exit_schema_add(list, "translate-retries", false);
+    list = tcg_exit_schema_add(list, "translate-wait-time", true);
+    list = tcg_exit_schema_add(list, "translate-waits", false);
+    list = tcg_exit_schema_add(list, "goto-ptr-misses", false);
+    list = tcg_exit_schema_add(list, "goto-ptr-lookups", false);
+    list = tcg_exit_schema_add(list, "tb-lookup-misses", false);
+    list = tcg_exit_schema_add(list, "jump-cache-l2-hits", false);
+    list = tcg_exit_schema_add(list, "jump-cache-misses", false);
+    list = tcg_exit_schema_add(list, "jump-cache-hits", false);
+    for (int i = TCG_EXIT__MAX - 1; i >= 0; i--) {
+        list = tcg_exit_schema_add(list, tcg_exit_names[i], false);
+    }
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU, list);
+}
+
+void tcg_exit_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_TCG, tcg_exit_query_stats_cb,
+                        tcg_exit_query_stats_schemas_cb);
+}
+
 static void hmp_tcg_register(void)
 {
     monitor_register_hmp_info_hrt("jit", qmp_x_query_jit);
@@ -33,7 +33,9 @@ struct TBContext {
     struct qht htable;
 
     /* statistics */
+    /* bumped by partial flushes too: TB addresses may have been reused */
     unsigned tb_flush_count;
+    unsigned tb_partial_flush_count;
     unsigned tb_phys_invalidate_count;
 };
 
@@ -60,6 +60,15 @@ static inline unsigned int tb_jmp_cache_hash_func(vaddr pc)
 
 #endif /* CONFIG_SOFTMMU */
 
+static inline unsigned int tb_jmp_l2_hash_func(vaddr pc, uint32_t flags,
+                                               uint64_t cs_base)
+{
+    uint64_t h = (pc ^ cs_base ^ ((uint64_t)flags << 32)) *
+                 0x9e3779b97f4a7c15ull;
+
+    return h >> (64 - TB_JMP_L2_BITS);
+}
+
 static inline
 uint32_t tb_hash_func(tb_page_addr_t phys_pc, vaddr pc,
                       uint32_t flags, uint64_t flags2, uint32_t cf_mask)
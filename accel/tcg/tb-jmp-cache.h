@@ -12,17 +12,38 @@
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
+#define TB_JMP_L2_BITS 13
+#define TB_JMP_L2_SIZE (1 << TB_JMP_L2_BITS)
+
 /*
  * Accessed in parallel; all accesses to 'tb' must be atomic.
  * For CF_PCREL, accesses to 'pc' must be protected by a
  * load_acquire/store_release to 'tb'.
+ *
+ * Entries are tagged with the guest address space 'asid' they were
+ * filled in, see tlb_flush_asid_switch().  Only the owning vCPU writes
+ * 'asid' and the tags.
  */
 struct CPUJumpCache {
     struct rcu_head rcu;
+    uint32_t asid;
     struct {
         TranslationBlock *tb;
+        uint32_t asid;
         vaddr pc;
     } array[TB_JMP_CACHE_SIZE];
+
+    /*
+     * Second level, looked up on a miss in 'array' before tb_ctx.htable
+     * and keyed by (pc, flags, cs_base).  Only the owning vCPU accesses
+     * it.  tcg_flush_jmp_cache() leaves it alone, so that it survives
+     * the TLB flushes of guest context switches, and each hit is checked
+     * against the physical address of pc like an htable lookup.  The
+     * entries belong to the tb_ctx.tb_flush_count generation 'l2_gen':
+     * after a flush the memory of their TBs may have been reused.
+     */
+    unsigned l2_gen;
+    TranslationBlock *l2[TB_JMP_L2_SIZE];
 };
 
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
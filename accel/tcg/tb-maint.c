@@ -18,8 +18,10 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/heap-account.h"
 #include "qemu/interval-tree.h"
 #include "qemu/qtree.h"
+#include "qemu/timer.h"
 #include "exec/cputlb.h"
 #include "exec/log.h"
 #include "exec/exec-all.h"
@@ -31,6 +33,9 @@
 #include "tb-context.h"
 #include "internal-common.h"
 #include "internal-target.h"
+#if !defined(CONFIG_TCG_INTERPRETER) && defined(EMSCRIPTEN)
+#include "../../tcg/wasm32.h"
+#endif
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -182,8 +187,25 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* guest writes that hit translated code, see page_smc_note_write() */
+    uint32_t smc_writes;
+    /* whole-page invalidations done while the page was SMC-hot */
+    uint32_t smc_batches;
+    /* bumped by every invalidation, see tb_lock_page0() */
+    unsigned int inval_gen;
 };
 
+/*
+ * A page that keeps being written while it holds translated code, as
+ * with a guest JIT, is "SMC-hot" after this many such writes.
+ */
+#define TB_SMC_HOT_WRITES 16
+
+/* The first SMC-hot pages, reported by "info jit" */
+#define TB_SMC_HOT_MAX 16
+static tb_page_addr_t tb_smc_hot_pages[TB_SMC_HOT_MAX];
+static unsigned tb_smc_hot_count;
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -227,6 +249,9 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, bool alloc)
             if (unlikely(existing)) {
                 g_free(p);
                 p = existing;
+            } else {
+                heap_account_add(HEAP_SUBSYSTEM_TB_METADATA,
+                                 sizeof(void *) * V_L2_SIZE);
             }
         }
 
@@ -253,6 +278,9 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, bool alloc)
             }
             g_free(pd);
             pd = existing;
+        } else {
+            heap_account_add(HEAP_SUBSYSTEM_TB_METADATA,
+                             sizeof(PageDesc) * V_L2_SIZE);
         }
     }
 
@@ -397,9 +425,59 @@ static void page_unlock(PageDesc *pd)
     page_unlock__debug(pd);
 }
 
+/*
+ * With -accel tcg,optimistic-translation=on the pages of a TB are not
+ * locked while it is being translated, which in turn lets vCPUs translate
+ * (and on wasm, build the module of) code of the same pages in parallel.
+ * The invalidation generation of the pages is sampled instead, and
+ * tb_link_page() locks the pages and refuses the TB if either of them
+ * was invalidated in the meantime.  The TB is then translated again with
+ * the pages locked, so a page rewritten in a loop can't starve a vCPU.
+ */
+static __thread bool tb_gen_unlocked;
+static __thread bool tb_gen_retry;
+static __thread unsigned int tb_gen_seen[2];
+
+static void tb_gen_account_wait(int64_t start)
+{
+    CPUState *cpu = current_cpu;
+
+    if (cpu && cpu->tcg_exit_stats) {
+        cpu->tcg_exit_stats->translate_waits++;
+        cpu->tcg_exit_stats->translate_wait_ns += get_clock() - start;
+    }
+}
+
+/* page_lock() for the TB being translated, accounting contention */
+static void page_lock_translate(PageDesc *pd)
+{
+    if (page_trylock(pd)) {
+        int64_t start = get_clock();
+
+        page_lock(pd);
+        tb_gen_account_wait(start);
+    }
+}
+
+static unsigned int page_inval_gen(tb_page_addr_t paddr)
+{
+    PageDesc *pd = page_find_alloc(paddr >> TARGET_PAGE_BITS, true);
+    unsigned int gen = qatomic_read(&pd->inval_gen);
+
+    /* pairs with the page lock taken by the invalidation */
+    smp_rmb();
+    return gen;
+}
+
 void tb_lock_page0(tb_page_addr_t paddr)
 {
-    page_lock(page_find_alloc(paddr >> TARGET_PAGE_BITS, true));
+    if (tb_optimistic_translation && !tb_gen_retry) {
+        tb_gen_unlocked = true;
+        tb_gen_seen[0] = page_inval_gen(paddr);
+        return;
+    }
+    tb_gen_retry = false;
+    page_lock_translate(page_find_alloc(paddr >> TARGET_PAGE_BITS, true));
 }
 
 void tb_lock_page1(tb_page_addr_t paddr0, tb_page_addr_t paddr1)
@@ -413,10 +491,15 @@ void tb_lock_page1(tb_page_addr_t paddr0, tb_page_addr_t paddr1)
         return;
     }
 
+    if (tb_gen_unlocked) {
+        tb_gen_seen[1] = page_inval_gen(paddr1);
+        return;
+    }
+
     pd1 = page_find_alloc(pindex1, true);
     if (pindex0 < pindex1) {
         /* Correct locking order, we may block. */
-        page_lock(pd1);
+        page_lock_translate(pd1);
         return;
     }
 
@@ -431,7 +514,7 @@ void tb_lock_page1(tb_page_addr_t paddr0, tb_page_addr_t paddr1)
      */
     pd0 = page_find_alloc(pindex0, false);
     page_unlock(pd0);
-    page_lock(pd1);
+    page_lock_translate(pd1);
     page_lock(pd0);
     siglongjmp(tcg_ctx->jmp_trans, -3);
 }
@@ -441,12 +524,13 @@ void tb_unlock_page1(tb_page_addr_t paddr0, tb_page_addr_t paddr1)
     tb_page_addr_t pindex0 = paddr0 >> TARGET_PAGE_BITS;
     tb_page_addr_t pindex1 = paddr1 >> TARGET_PAGE_BITS;
 
-    if (pindex0 != pindex1) {
+    if (pindex0 != pindex1 && !tb_gen_unlocked) {
         page_unlock(page_find_alloc(pindex1, false));
     }
 }
 
-static void tb_lock_pages(TranslationBlock *tb)
+static void tb_lock_pages_with(const TranslationBlock *tb,
+                               void (*lock)(PageDesc *))
 {
     tb_page_addr_t paddr0 = tb_page_addr0(tb);
     tb_page_addr_t paddr1 = tb_page_addr1(tb);
@@ -458,13 +542,45 @@ static void tb_lock_pages(TranslationBlock *tb)
     }
     if (unlikely(paddr1 != -1) && pindex0 != pindex1) {
         if (pindex0 < pindex1) {
-            page_lock(page_find_alloc(pindex0, true));
-            page_lock(page_find_alloc(pindex1, true));
+            lock(page_find_alloc(pindex0, true));
+            lock(page_find_alloc(pindex1, true));
             return;
         }
-        page_lock(page_find_alloc(pindex1, true));
+        lock(page_find_alloc(pindex1, true));
+    }
+    lock(page_find_alloc(pindex0, true));
+}
+
+static void tb_lock_pages(TranslationBlock *tb)
+{
+    tb_lock_pages_with(tb, page_lock);
+}
+
+/*
+ * Lock the pages of a TB translated without them, and return false if
+ * one of them was invalidated since tb_lock_page0() and tb_lock_page1().
+ */
+static bool tb_gen_lock_validate(TranslationBlock *tb)
+{
+    tb_page_addr_t paddr0 = tb_page_addr0(tb);
+    tb_page_addr_t paddr1 = tb_page_addr1(tb);
+    PageDesc *pd;
+
+    tb_gen_unlocked = false;
+    tb_lock_pages_with(tb, page_lock_translate);
+
+    pd = page_find_alloc(paddr0 >> TARGET_PAGE_BITS, false);
+    if (pd->inval_gen != tb_gen_seen[0]) {
+        return false;
+    }
+    if (paddr1 != -1 &&
+        ((paddr0 ^ paddr1) & TARGET_PAGE_MASK) != 0) {
+        pd = page_find_alloc(paddr1 >> TARGET_PAGE_BITS, false);
+        if (pd->inval_gen != tb_gen_seen[1]) {
+            return false;
+        }
     }
-    page_lock(page_find_alloc(pindex0, true));
+    return true;
 }
 
 void tb_unlock_pages(TranslationBlock *tb)
@@ -474,6 +590,11 @@ void tb_unlock_pages(TranslationBlock *tb)
     tb_page_addr_t pindex0 = paddr0 >> TARGET_PAGE_BITS;
     tb_page_addr_t pindex1 = paddr1 >> TARGET_PAGE_BITS;
 
+    if (tb_gen_unlocked) {
+        /* the TB being translated, nothing was locked */
+        tb_gen_unlocked = false;
+        return;
+    }
     if (unlikely(paddr0 == -1)) {
         return;
     }
@@ -774,6 +895,9 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     tb_remove_all();
 
     tcg_region_reset_all();
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm_mod_pool_reset();
+#endif
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
 
@@ -798,6 +922,73 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+/* Number of regions a partial flush tries to empty */
+#define TB_PARTIAL_FLUSH_REGIONS 8
+
+static unsigned tb_evict_heat(TranslationBlock *tb)
+{
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    return wasm_tb_heat(tb);
+#else
+    return 0;
+#endif
+}
+
+static void tb_evict(TranslationBlock *tb)
+{
+    tb_phys_invalidate(tb, -1);
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm_tb_evict(tb);
+#endif
+}
+
+static void do_tb_flush_partial(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    mmap_lock();
+    /* If it is already been done on request of another CPU, just retry. */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+
+    if (tcg_region_evict(TB_PARTIAL_FLUSH_REGIONS, tb_evict_heat,
+                         tb_evict) == 0) {
+        mmap_unlock();
+        do_tb_flush(cpu, tb_flush_count);
+        return;
+    }
+
+    /*
+     * Invalidation leaves jump cache entries behind (see
+     * do_tb_phys_invalidate), but the memory of these TBs is about to
+     * be reused.
+     */
+    CPU_FOREACH(cpu) {
+        tcg_flush_jmp_cache(cpu);
+    }
+    qatomic_inc(&tb_ctx.tb_partial_flush_count);
+    qatomic_inc(&tb_ctx.tb_flush_count);
+    mmap_unlock();
+    qemu_plugin_flush_cb();
+}
+
+/*
+ * Like tb_flush, but only evict the coldest regions of code_gen_buffer
+ * so that hot code survives.  It falls back to a full flush when no
+ * region can be evicted.
+ */
+void tb_flush_partial(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_flush_partial(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_flush_partial,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /* remove @orig from its @n_orig-th jump list */
 static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
 {
@@ -878,32 +1069,6 @@ static inline void tb_jmp_unlink(TranslationBlock *dest)
     qemu_spin_unlock(&dest->jmp_lock);
 }
 
-#if !defined(CONFIG_TCG_INTERPRETER) && defined(EMSCRIPTEN)
-#include "../../tcg/wasm32.h"
-#endif
-
-static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
-{
-    CPUState *cpu;
-
-    if (tb_cflags(tb) & CF_PCREL) {
-        /* A TB may be at any virtual address */
-        CPU_FOREACH(cpu) {
-            tcg_flush_jmp_cache(cpu);
-        }
-    } else {
-        uint32_t h = tb_jmp_cache_hash_func(tb->pc);
-
-        CPU_FOREACH(cpu) {
-            CPUJumpCache *jc = cpu->tb_jmp_cache;
-
-            if (qatomic_read(&jc->array[h].tb) == tb) {
-                qatomic_set(&jc->array[h].tb, NULL);
-            }
-        }
-    }
-}
-
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
@@ -935,8 +1100,18 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
         tb_remove(tb);
     }
 
-    /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    /*
+     * Stale jump cache entries are left alone: CF_INVALID, set above,
+     * makes tb_lookup reject the TB on every vCPU, which then refills
+     * the slot from the hash table.  The TB itself stays allocated until
+     * tb_flush, which clears all jump caches.  This avoids walking the
+     * caches of all vCPUs on every invalidation, and flushing them all
+     * outright for CF_PCREL TBs, which self-modifying guests hit hard.
+     */
+
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm_code_cache_invalidate(tb);
+#endif
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -979,6 +1154,8 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
  * Note that in !user-mode, another thread might have already added a TB
  * for the same block of guest code that @tb corresponds to. In that case,
  * the caller should discard the original @tb, and use instead the returned TB.
+ * If @tb was translated optimistically and its code may have changed since,
+ * return NULL: the caller should discard @tb and translate it again.
  */
 TranslationBlock *tb_link_page(TranslationBlock *tb)
 {
@@ -988,6 +1165,17 @@ TranslationBlock *tb_link_page(TranslationBlock *tb)
     assert_memory_lock();
     tcg_debug_assert(!(tb->cflags & CF_INVALID));
 
+#ifndef CONFIG_USER_ONLY
+    if (tb_gen_unlocked && !tb_gen_lock_validate(tb)) {
+        tb_unlock_pages(tb);
+        tb_gen_retry = true;
+        if (current_cpu && current_cpu->tcg_exit_stats) {
+            current_cpu->tcg_exit_stats->translate_retries++;
+        }
+        return NULL;
+    }
+#endif
+
     tb_record(tb);
 
     /* add in the hash table */
@@ -1117,6 +1305,9 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     /* Range may not cross a page. */
     tcg_debug_assert(((start ^ last) & TARGET_PAGE_MASK) == 0);
 
+    /* Fail the link of a TB of this page translated concurrently */
+    qatomic_set(&p->inval_gen, p->inval_gen + 1);
+
     /*
      * We remove all the TBs in the range [start, last].
      * XXX: see if in some cases it could be faster to invalidate all the code
@@ -1222,6 +1413,86 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t last)
     page_collection_unlock(pages);
 }
 
+static inline bool page_smc_hot(PageDesc *p)
+{
+    return qatomic_read(&p->smc_writes) >= TB_SMC_HOT_WRITES;
+}
+
+bool tb_page_smc_hot(tb_page_addr_t addr)
+{
+    PageDesc *p = page_find(addr >> TARGET_PAGE_BITS);
+
+    return p && page_smc_hot(p);
+}
+
+/*
+ * Account a guest write at @addr to translated code on @p, and return
+ * true if all of the TBs of the page should go at once.  Invalidating
+ * only the written range keeps the page write-protected, so a guest that
+ * rewrites a code page store by store traps on every store; dropping the
+ * whole page instead unprotects it, lets the remaining stores run at full
+ * speed and retranslates the page in one batch when it is next executed.
+ * Call with @p locked.
+ */
+static bool page_smc_note_write(PageDesc *p, tb_page_addr_t addr,
+                                uintptr_t ra)
+{
+    uint32_t writes;
+
+    if (!p->first_tb) {
+        return false;
+    }
+    writes = p->smc_writes + 1;
+    qatomic_set(&p->smc_writes, writes);
+    if (writes == TB_SMC_HOT_WRITES) {
+        unsigned n = qatomic_fetch_inc(&tb_smc_hot_count);
+
+        if (n < TB_SMC_HOT_MAX) {
+            tb_smc_hot_pages[n] = addr & TARGET_PAGE_MASK;
+        }
+    }
+    if (writes < TB_SMC_HOT_WRITES) {
+        return false;
+    }
+
+#ifdef TARGET_HAS_PRECISE_SMC
+    /*
+     * Widening the range must not take down the writer itself when it
+     * lives on the same page, which would restart it for every store.
+     */
+    if (ra) {
+        TranslationBlock *tb = tcg_tb_lookup(ra);
+
+        if (tb && (((tb_page_addr0(tb) ^ addr) & TARGET_PAGE_MASK) == 0 ||
+                   (tb_page_addr1(tb) != -1 &&
+                    ((tb_page_addr1(tb) ^ addr) & TARGET_PAGE_MASK) == 0))) {
+            return false;
+        }
+    }
+#endif
+    qatomic_set(&p->smc_batches, p->smc_batches + 1);
+    return true;
+}
+
+void tb_dump_smc_info(GString *buf)
+{
+    unsigned n = qatomic_read(&tb_smc_hot_count);
+
+    g_string_append_printf(buf, "SMC hot pages       %u\n", n);
+    for (unsigned i = 0; i < MIN(n, TB_SMC_HOT_MAX); i++) {
+        tb_page_addr_t addr = tb_smc_hot_pages[i];
+        PageDesc *p = page_find(addr >> TARGET_PAGE_BITS);
+
+        if (p == NULL) {
+            continue;
+        }
+        g_string_append_printf(buf, "  0x" TB_PAGE_ADDR_FMT
+                               " writes=%u page flushes=%u\n", addr,
+                               qatomic_read(&p->smc_writes),
+                               qatomic_read(&p->smc_batches));
+    }
+}
+
 /*
  * Call with all @pages in the range [@start, @start + len[ locked.
  */
@@ -1237,6 +1508,10 @@ static void tb_invalidate_phys_page_fast__locked(struct page_collection *pages,
     }
 
     assert_page_locked(p);
+    if (page_smc_note_write(p, start, ra)) {
+        start &= TARGET_PAGE_MASK;
+        len = TARGET_PAGE_SIZE;
+    }
     tb_invalidate_phys_page_range__locked(pages, p, start, start + len - 1, ra);
 }
 
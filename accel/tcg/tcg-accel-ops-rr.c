@@ -29,6 +29,7 @@
 #include "sysemu/replay.h"
 #include "sysemu/cpu-timers.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
 #include "qemu/notify.h"
 #include "qemu/guest-random.h"
 #include "exec/exec-all.h"
@@ -36,6 +37,7 @@
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
+#include "internal-common.h"
 
 /* Kick all RR vCPUs */
 void rr_kick_vcpu_thread(CPUState *unused)
@@ -57,14 +59,28 @@ void rr_kick_vcpu_thread(CPUState *unused)
  *
  * The timer is removed if all vCPUs are idle and restarted again once
  * idleness is complete.
+ *
+ * Each vCPU has its own slice, which is rearmed whenever it is
+ * scheduled: a vCPU which keeps running until the kick gets twice as long
+ * the next time, up to TCG_KICK_PERIOD_MAX, so compute bound guests switch
+ * less often, and one which halts goes back towards TCG_KICK_PERIOD.  A
+ * slice is cut down to TCG_KICK_PERIOD_MIN while an interrupt is pending
+ * for another vCPU, which then gets to handle it sooner.
  */
 
 static QEMUTimer *rr_kick_vcpu_timer;
 static CPUState *rr_current_cpu;
+static bool rr_slice_expired;
 
-static inline int64_t rr_next_kick_time(void)
+static int64_t rr_slice_ns(CPUState *cpu)
 {
-    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + TCG_KICK_PERIOD;
+    return cpu && cpu->tcg_exit_stats->rr_slice_ns ?
+           cpu->tcg_exit_stats->rr_slice_ns : TCG_KICK_PERIOD;
+}
+
+static inline int64_t rr_next_kick_time(CPUState *cpu)
+{
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + rr_slice_ns(cpu);
 }
 
 /* Kick the currently round-robin scheduled vCPU to next */
@@ -83,7 +99,9 @@ static void rr_kick_next_cpu(void)
 
 static void rr_kick_thread(void *opaque)
 {
-    timer_mod(rr_kick_vcpu_timer, rr_next_kick_time());
+    timer_mod(rr_kick_vcpu_timer,
+              rr_next_kick_time(qatomic_read(&rr_current_cpu)));
+    qatomic_set(&rr_slice_expired, true);
     rr_kick_next_cpu();
 }
 
@@ -94,8 +112,54 @@ static void rr_start_kick_timer(void)
                                            rr_kick_thread, NULL);
     }
     if (rr_kick_vcpu_timer && !timer_pending(rr_kick_vcpu_timer)) {
-        timer_mod(rr_kick_vcpu_timer, rr_next_kick_time());
+        timer_mod(rr_kick_vcpu_timer, rr_next_kick_time(NULL));
+    }
+}
+
+/* Rearm the kick timer for the slice of @cpu, which is about to run */
+static void rr_start_slice(CPUState *cpu)
+{
+    TCGExitStats *st = cpu->tcg_exit_stats;
+    int64_t slice = rr_slice_ns(cpu);
+    CPUState *other;
+
+    st->rr_slice_ns = slice;
+    st->rr_slices++;
+    if (!rr_kick_vcpu_timer) {
+        return;
     }
+
+    CPU_FOREACH(other) {
+        if (other != cpu && qatomic_read(&other->interrupt_request)) {
+            slice = MIN(slice, TCG_KICK_PERIOD_MIN);
+            st->rr_shortened++;
+            break;
+        }
+    }
+    qatomic_set(&rr_slice_expired, false);
+    timer_mod(rr_kick_vcpu_timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + slice);
+}
+
+/* Adapt the next slice of @cpu to how it ended this one */
+static void rr_end_slice(CPUState *cpu, int r, int64_t start)
+{
+    TCGExitStats *st = cpu->tcg_exit_stats;
+
+    st->rr_run_ns += get_clock() - start;
+    if (qatomic_read(&rr_slice_expired)) {
+        st->rr_expired++;
+        st->rr_slice_ns = MIN(st->rr_slice_ns * 2, TCG_KICK_PERIOD_MAX);
+    } else if (r == EXCP_HLT || r == EXCP_HALTED) {
+        st->rr_slice_ns = MAX(st->rr_slice_ns / 2, TCG_KICK_PERIOD);
+    }
+}
+
+/* Whether cpu_exec() would return at once for a halted @cpu */
+static bool rr_cpu_halted(CPUState *cpu)
+{
+    return cpu->halted && !qatomic_read(&cpu->interrupt_request) &&
+           !cpu_has_work(cpu);
 }
 
 static void rr_stop_kick_timer(void)
@@ -251,9 +315,14 @@ static void *rr_cpu_thread_fn(void *arg)
             qemu_clock_enable(QEMU_CLOCK_VIRTUAL,
                               (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
-            if (cpu_can_run(cpu)) {
+            if (cpu_can_run(cpu) && rr_cpu_halted(cpu)) {
+                /* Don't even enter cpu_exec(), let the next vCPU run */
+                cpu->tcg_exit_stats->rr_skipped++;
+            } else if (cpu_can_run(cpu)) {
+                int64_t start = get_clock();
                 int r;
 
+                rr_start_slice(cpu);
                 qemu_mutex_unlock_iothread();
                 if (icount_enabled()) {
                     icount_prepare_for_run(cpu, cpu_budget);
@@ -263,6 +332,7 @@ static void *rr_cpu_thread_fn(void *arg)
                     icount_process_data(cpu);
                 }
                 qemu_mutex_lock_iothread();
+                rr_end_slice(cpu, r, start);
 
                 if (r == EXCP_DEBUG) {
                     cpu_handle_guest_debug(cpu);
@@ -12,6 +12,10 @@
 
 #define TCG_KICK_PERIOD (NANOSECONDS_PER_SECOND / 10)
 
+/* Bounds of the slice of one vCPU, which adapts to how it uses them */
+#define TCG_KICK_PERIOD_MIN (TCG_KICK_PERIOD / 8)
+#define TCG_KICK_PERIOD_MAX (TCG_KICK_PERIOD * 4)
+
 /* Kick all RR vCPUs. */
 void rr_kick_vcpu_thread(CPUState *unused);
 
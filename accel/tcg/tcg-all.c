@@ -38,15 +38,29 @@
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
+#include "internal-common.h"
 #include "internal-target.h"
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#include "../../tcg/wasm32.h"
+#if !defined(CONFIG_USER_ONLY)
+#include "qapi/qapi-commands-machine.h"
+#include "sysemu/sysemu.h"
+#endif
+#endif
 
 struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
+    bool mttcg_auto;
     bool one_insn_per_tb;
+    bool tb_prefetch;
+    bool partial_flush;
+    bool optimistic_translation;
     int splitwx_enabled;
     unsigned long tb_size;
+    char *profile;
+    uint32_t profile_hz;
 };
 typedef struct TCGState TCGState;
 
@@ -83,6 +97,34 @@ static bool default_mttcg_enabled(void)
 #endif
 }
 
+/*
+ * thread=auto gives each vCPU its own thread when the host has a core for
+ * every one of them besides the main loop.  Otherwise they would only
+ * take time from each other, which browsers running each thread in a Web
+ * Worker handle particularly badly, and they share a single thread.
+ */
+static bool auto_mttcg_enabled(MachineState *ms)
+{
+#ifdef CONFIG_USER_ONLY
+    return default_mttcg_enabled();
+#else
+    long cores;
+
+    if (!default_mttcg_enabled() || ms->smp.cpus < 2) {
+        return false;
+    }
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    if (!wasm32_threads_available()) {
+        return false;
+    }
+    cores = get_core_nums();
+#else
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return ms->smp.cpus < cores;
+#endif
+}
+
 static void tcg_accel_instance_init(Object *obj)
 {
     TCGState *s = TCG_STATE(obj);
@@ -95,10 +137,37 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+    s->profile_hz = 1000;
 }
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+bool tb_prefetch;
+bool tb_optimistic_translation;
+TLBPolicy tlb_policy;
+unsigned tlb_policy_min_bits;
+unsigned tlb_policy_max_bits;
+
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER) && \
+    !defined(CONFIG_USER_ONLY)
+static void wasm_exit_stats(Notifier *n, void *data)
+{
+    g_autoptr(HumanReadableText) info = qmp_x_query_jit(NULL);
+
+    if (info) {
+        fputs(info->human_readable_text, stderr);
+    }
+}
+
+static Notifier wasm_exit_stats_notifier = { .notify = wasm_exit_stats };
+
+static void wasm_bundle_exit(Notifier *n, void *data)
+{
+    wasm_bundle_save();
+}
+
+static Notifier wasm_bundle_notifier = { .notify = wasm_bundle_exit };
+#endif
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -110,11 +179,34 @@ static int tcg_init_machine(MachineState *ms)
 #endif
 
     tcg_allowed = true;
+    if (s->mttcg_auto) {
+        s->mttcg_enabled = auto_mttcg_enabled(ms);
+    }
     mttcg_enabled = s->mttcg_enabled;
 
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+#ifndef CONFIG_USER_ONLY
+    tcg_exit_stats_init();
+    if (s->profile) {
+        guest_profile_init(s->profile, s->profile_hz);
+    }
+#endif
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm32_stats_init();
+#ifndef CONFIG_USER_ONLY
+    if (wasm_exit_stats_enabled) {
+        qemu_add_exit_notifier(&wasm_exit_stats_notifier);
+    }
+    if (wasm_bundle_out) {
+        qemu_add_exit_notifier(&wasm_bundle_notifier);
+    }
+    wasm_snapshot_hot_init();
+    /* The workers load while the machine is being created */
+    wasm32_prespawn_workers(mttcg_enabled ? ms->smp.cpus : 1);
+#endif
+#endif
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -131,6 +223,9 @@ static char *tcg_get_thread(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
 
+    if (s->mttcg_auto && !tcg_allowed) {
+        return g_strdup("auto");
+    }
     return g_strdup(s->mttcg_enabled ? "multi" : "single");
 }
 
@@ -149,9 +244,13 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
                         "you may get unexpected results");
 #endif
             s->mttcg_enabled = true;
+            s->mttcg_auto = false;
         }
     } else if (strcmp(value, "single") == 0) {
         s->mttcg_enabled = false;
+        s->mttcg_auto = false;
+    } else if (strcmp(value, "auto") == 0) {
+        s->mttcg_auto = true;
     } else {
         error_setg(errp, "Invalid 'thread' setting %s", value);
     }
@@ -181,6 +280,95 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+#ifndef CONFIG_USER_ONLY
+static char *tcg_get_profile(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->profile);
+}
+
+static void tcg_set_profile(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->profile);
+    s->profile = g_strdup(value);
+}
+
+static void tcg_get_profile_hz(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    visit_type_uint32(v, name, &s->profile_hz, errp);
+}
+
+static void tcg_set_profile_hz(Object *obj, Visitor *v,
+                               const char *name, void *opaque,
+                               Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0 || value > 100000) {
+        error_setg(errp, "Invalid '%s' setting %u", name, value);
+        return;
+    }
+
+    s->profile_hz = value;
+}
+#endif
+
+static char *tcg_get_tlb_policy(Object *obj, Error **errp)
+{
+    return g_strdup(tlb_policy == TLB_POLICY_MISS_RATE ? "miss-rate"
+                                                       : "use-rate");
+}
+
+static void tcg_set_tlb_policy(Object *obj, const char *value, Error **errp)
+{
+    if (strcmp(value, "miss-rate") == 0) {
+        tlb_policy = TLB_POLICY_MISS_RATE;
+    } else if (strcmp(value, "use-rate") == 0) {
+        tlb_policy = TLB_POLICY_USE_RATE;
+    } else {
+        error_setg(errp, "Invalid 'tlb-policy' setting %s", value);
+    }
+}
+
+static void tcg_get_tlb_bits(Object *obj, Visitor *v,
+                             const char *name, void *opaque,
+                             Error **errp)
+{
+    unsigned *bits = opaque;
+    uint32_t value = *bits;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tlb_bits(Object *obj, Visitor *v,
+                             const char *name, void *opaque,
+                             Error **errp)
+{
+    unsigned *bits = opaque;
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > 32) {
+        error_setg(errp, "Invalid '%s' setting %u", name, value);
+        return;
+    }
+
+    *bits = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -207,6 +395,219 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_tb_prefetch(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_prefetch;
+}
+
+static void tcg_set_tb_prefetch(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_prefetch = value;
+    qatomic_set(&tb_prefetch, value);
+}
+
+static bool tcg_get_partial_flush(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->partial_flush;
+}
+
+static void tcg_set_partial_flush(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->partial_flush = value;
+    tcg_partial_flush = value;
+}
+
+static bool tcg_get_optimistic_translation(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->optimistic_translation;
+}
+
+static void tcg_set_optimistic_translation(Object *obj, bool value,
+                                           Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->optimistic_translation = value;
+    tb_optimistic_translation = value;
+}
+
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+static bool tcg_get_wasm_code_cache(Object *obj, Error **errp)
+{
+    return wasm_code_cache_enabled;
+}
+
+static void tcg_set_wasm_code_cache(Object *obj, bool value, Error **errp)
+{
+    wasm_code_cache_enabled = value;
+}
+
+static bool tcg_get_wasm_shared_modules(Object *obj, Error **errp)
+{
+    return wasm_shared_modules_enabled;
+}
+
+static void tcg_set_wasm_shared_modules(Object *obj, bool value, Error **errp)
+{
+    wasm_shared_modules_enabled = value;
+}
+
+static bool tcg_get_wasm_names(Object *obj, Error **errp)
+{
+    return wasm_names_enabled;
+}
+
+static void tcg_set_wasm_names(Object *obj, bool value, Error **errp)
+{
+    wasm_names_enabled = value;
+}
+
+static bool tcg_get_wasm_marks(Object *obj, Error **errp)
+{
+    return wasm_marks_enabled;
+}
+
+static void tcg_set_wasm_marks(Object *obj, bool value, Error **errp)
+{
+    wasm_marks_enabled = value;
+}
+
+static bool tcg_get_wasm_lazy(Object *obj, Error **errp)
+{
+    return wasm_lazy_enabled;
+}
+
+static void tcg_set_wasm_lazy(Object *obj, bool value, Error **errp)
+{
+    wasm_lazy_enabled = value;
+}
+
+static char *tcg_get_wasm_bundle_in(Object *obj, Error **errp)
+{
+    return g_strdup(wasm_bundle_in);
+}
+
+static void tcg_set_wasm_bundle_in(Object *obj, const char *value,
+                                   Error **errp)
+{
+    g_free(wasm_bundle_in);
+    wasm_bundle_in = g_strdup(value);
+}
+
+static char *tcg_get_wasm_bundle_out(Object *obj, Error **errp)
+{
+    return g_strdup(wasm_bundle_out);
+}
+
+static void tcg_set_wasm_bundle_out(Object *obj, const char *value,
+                                    Error **errp)
+{
+    g_free(wasm_bundle_out);
+    wasm_bundle_out = g_strdup(value);
+}
+
+static bool tcg_get_wasm_snapshot_hot(Object *obj, Error **errp)
+{
+    return wasm_snapshot_hot_enabled;
+}
+
+static void tcg_set_wasm_snapshot_hot(Object *obj, bool value, Error **errp)
+{
+    wasm_snapshot_hot_enabled = value;
+}
+
+static bool tcg_get_wasm_guest_bounds(Object *obj, Error **errp)
+{
+    return wasm_guest_bounds_enabled;
+}
+
+static void tcg_set_wasm_guest_bounds(Object *obj, bool value, Error **errp)
+{
+    wasm_guest_bounds_enabled = value;
+}
+
+static bool tcg_get_wasm_tso(Object *obj, Error **errp)
+{
+    return wasm_tso_enabled;
+}
+
+static void tcg_set_wasm_tso(Object *obj, bool value, Error **errp)
+{
+    wasm_tso_enabled = value;
+}
+
+static bool tcg_get_wasm_ram_window(Object *obj, Error **errp)
+{
+    return wasm_ram_window_enabled;
+}
+
+static void tcg_set_wasm_ram_window(Object *obj, bool value, Error **errp)
+{
+    wasm_ram_window_enabled = value;
+}
+
+static bool tcg_get_wasm_transient_modules(Object *obj, Error **errp)
+{
+    return wasm_transient_modules_enabled;
+}
+
+static void tcg_set_wasm_transient_modules(Object *obj, bool value,
+                                           Error **errp)
+{
+    wasm_transient_modules_enabled = value;
+}
+
+static bool tcg_get_wasm_jit(Object *obj, Error **errp)
+{
+    return wasm_jit_enabled;
+}
+
+static void tcg_set_wasm_jit(Object *obj, bool value, Error **errp)
+{
+    wasm_jit_enabled = value;
+}
+
+static bool tcg_get_wasm_exit_stats(Object *obj, Error **errp)
+{
+    return wasm_exit_stats_enabled;
+}
+
+static void tcg_set_wasm_exit_stats(Object *obj, bool value, Error **errp)
+{
+    wasm_exit_stats_enabled = value;
+}
+
+static void tcg_get_wasm_yield_ms(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    uint32_t value = wasm_yield_ms;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_wasm_yield_ms(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0 || value > 1000) {
+        error_setg(errp, "Invalid '%s' setting %u", name, value);
+        return;
+    }
+
+    wasm_yield_ms = value;
+}
+#endif
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -252,6 +653,156 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_str(oc, "tlb-policy",
+                                  tcg_get_tlb_policy,
+                                  tcg_set_tlb_policy);
+    object_class_property_set_description(oc, "tlb-policy",
+        "Softmmu TLB resize policy (use-rate, miss-rate)");
+
+    object_class_property_add(oc, "tlb-min-bits", "int",
+        tcg_get_tlb_bits, tcg_set_tlb_bits,
+        NULL, &tlb_policy_min_bits);
+    object_class_property_set_description(oc, "tlb-min-bits",
+        "Log2 of the smallest softmmu TLB, 0 for the default");
+
+    object_class_property_add(oc, "tlb-max-bits", "int",
+        tcg_get_tlb_bits, tcg_set_tlb_bits,
+        NULL, &tlb_policy_max_bits);
+    object_class_property_set_description(oc, "tlb-max-bits",
+        "Log2 of the largest softmmu TLB, 0 for the default");
+
+    object_class_property_add_bool(oc, "tb-prefetch",
+                                   tcg_get_tb_prefetch,
+                                   tcg_set_tb_prefetch);
+    object_class_property_set_description(oc, "tb-prefetch",
+        "Translate the direct successors of new TBs while the vCPU is halted");
+
+    object_class_property_add_bool(oc, "partial-flush",
+                                   tcg_get_partial_flush,
+                                   tcg_set_partial_flush);
+    object_class_property_set_description(oc, "partial-flush",
+        "Evict the coldest code regions instead of flushing all TBs when "
+        "the code buffer is full");
+
+    object_class_property_add_bool(oc, "optimistic-translation",
+                                   tcg_get_optimistic_translation,
+                                   tcg_set_optimistic_translation);
+    object_class_property_set_description(oc, "optimistic-translation",
+        "Translate without holding the page locks and check at link time "
+        "that the code was not invalidated meanwhile");
+
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add_str(oc, "profile",
+                                  tcg_get_profile,
+                                  tcg_set_profile);
+    object_class_property_set_description(oc, "profile",
+        "Sample the guest PC and write the profile to this file at exit, "
+        "in the folded format of flamegraph.pl");
+
+    object_class_property_add(oc, "profile-hz", "int",
+        tcg_get_profile_hz, tcg_set_profile_hz,
+        NULL, NULL);
+    object_class_property_set_description(oc, "profile-hz",
+        "Guest PC samples per second and vCPU (default 1000)");
+#endif
+
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    object_class_property_add_bool(oc, "wasm-code-cache",
+                                   tcg_get_wasm_code_cache,
+                                   tcg_set_wasm_code_cache);
+    object_class_property_set_description(oc, "wasm-code-cache",
+        "Remember hot translation blocks across sessions in IndexedDB");
+
+    object_class_property_add_bool(oc, "wasm-shared-modules",
+                                   tcg_get_wasm_shared_modules,
+                                   tcg_set_wasm_shared_modules);
+    object_class_property_set_description(oc, "wasm-shared-modules",
+        "Compile each wasm module once and share it between vCPU threads");
+
+    object_class_property_add_bool(oc, "wasm-names",
+                                   tcg_get_wasm_names,
+                                   tcg_set_wasm_names);
+    object_class_property_set_description(oc, "wasm-names",
+        "Name wasm functions after the guest code for browser profilers");
+
+    object_class_property_add_bool(oc, "wasm-marks",
+                                   tcg_get_wasm_marks,
+                                   tcg_set_wasm_marks);
+    object_class_property_set_description(oc, "wasm-marks",
+        "Record wasm compilations in the browser performance timeline");
+
+    object_class_property_add_bool(oc, "wasm-lazy",
+                                   tcg_get_wasm_lazy,
+                                   tcg_set_wasm_lazy);
+    object_class_property_set_description(oc, "wasm-lazy",
+        "Emit wasm only for TBs which turned hot, retranslating them");
+
+    object_class_property_add_bool(oc, "wasm-ram-window",
+                                   tcg_get_wasm_ram_window,
+                                   tcg_set_wasm_ram_window);
+    object_class_property_set_description(oc, "wasm-ram-window",
+        "Let guest loads from linearly mapped RAM skip the TLB lookup");
+
+    object_class_property_add_bool(oc, "wasm-transient-modules",
+                                   tcg_get_wasm_transient_modules,
+                                   tcg_set_wasm_transient_modules);
+    object_class_property_set_description(oc, "wasm-transient-modules",
+        "Keep wasm modules out of the code buffer, dropping them once "
+        "instantiated with wasm-lazy");
+
+    object_class_property_add_bool(oc, "wasm-jit",
+                                   tcg_get_wasm_jit,
+                                   tcg_set_wasm_jit);
+    object_class_property_set_description(oc, "wasm-jit",
+        "Compile hot TBs to wasm; when off, everything runs in TCI");
+
+    object_class_property_add_bool(oc, "wasm-exit-stats",
+                                   tcg_get_wasm_exit_stats,
+                                   tcg_set_wasm_exit_stats);
+    object_class_property_set_description(oc, "wasm-exit-stats",
+        "Print the JIT statistics of \"info jit\" to stderr at exit");
+
+    object_class_property_add(oc, "wasm-yield-ms", "int",
+        tcg_get_wasm_yield_ms, tcg_set_wasm_yield_ms,
+        NULL, NULL);
+    object_class_property_set_description(oc, "wasm-yield-ms",
+        "Host milliseconds a vCPU thread runs before returning to the "
+        "browser main loop for finished compilations (default 10)");
+
+    object_class_property_add_str(oc, "wasm-bundle-in",
+                                  tcg_get_wasm_bundle_in,
+                                  tcg_set_wasm_bundle_in);
+    object_class_property_set_description(oc, "wasm-bundle-in",
+        "Compile the TBs listed in this bundle to wasm on first use");
+
+    object_class_property_add_str(oc, "wasm-bundle-out",
+                                  tcg_get_wasm_bundle_out,
+                                  tcg_set_wasm_bundle_out);
+    object_class_property_set_description(oc, "wasm-bundle-out",
+        "Write the TBs compiled to wasm to this bundle at exit");
+
+    object_class_property_add_bool(oc, "wasm-snapshot-hot",
+                                   tcg_get_wasm_snapshot_hot,
+                                   tcg_set_wasm_snapshot_hot);
+    object_class_property_set_description(oc, "wasm-snapshot-hot",
+        "Save the TBs compiled to wasm in snapshots, so that they skip "
+        "TCI after the snapshot is loaded");
+
+    object_class_property_add_bool(oc, "wasm-guest-bounds",
+                                   tcg_get_wasm_guest_bounds,
+                                   tcg_set_wasm_guest_bounds);
+    object_class_property_set_description(oc, "wasm-guest-bounds",
+        "Check user-mode accesses against reserved_va; when off, they are "
+        "a single wasm load or store at guest_base");
+
+    object_class_property_add_bool(oc, "wasm-tso",
+                                   tcg_get_wasm_tso,
+                                   tcg_set_wasm_tso);
+    object_class_property_set_description(oc, "wasm-tso",
+        "Emit the accesses that the guest orders as wasm atomics instead "
+        "of surrounding them with barriers");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
@@ -23,6 +23,7 @@
 #include "disas/disas.h"
 #include "exec/exec-all.h"
 #include "tcg/tcg.h"
+#include "tcg/startup.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -65,6 +66,9 @@
 #include "internal-target.h"
 #include "perf.h"
 #include "tcg/insn-start-words.h"
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#include "../../tcg/wasm32.h"
+#endif
 
 TBContext tb_ctx;
 
@@ -318,7 +322,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
         /* flush must be done */
-        tb_flush(cpu);
+        if (tcg_partial_flush) {
+            tb_flush_partial(cpu);
+        } else {
+            tb_flush(cpu);
+        }
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -422,6 +430,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
     tcg_ctx->gen_tb = NULL;
 
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    wasm_code_cache_tb(tb, pc, host_pc);
+#endif
+
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
         tb_unlock_pages(tb);
@@ -552,13 +564,19 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     existing_tb = tb_link_page(tb);
     assert_no_pages_locked();
 
-    /* if the TB already exists, discard what we just translated */
+    /*
+     * if the TB already exists, discard what we just translated;
+     * if its pages were invalidated meanwhile, translate it again
+     */
     if (unlikely(existing_tb != tb)) {
         uintptr_t orig_aligned = (uintptr_t)gen_code_buf;
 
         orig_aligned -= ROUND_UP(sizeof(*tb), qemu_icache_linesize);
         qatomic_set(&tcg_ctx->code_gen_ptr, (void *)orig_aligned);
         tcg_tb_remove(tb);
+        if (existing_tb == NULL) {
+            goto buffer_overflow;
+        }
         return existing_tb;
     }
     return tb;
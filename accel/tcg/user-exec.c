@@ -836,6 +836,44 @@ void *probe_access(CPUArchState *env, vaddr addr, int size,
     return size ? g2h(env_cpu(env), addr) : NULL;
 }
 
+uint64_t cpu_memset_page_mmuidx_ra(CPUArchState *env, abi_ptr addr,
+                                   uint8_t val, uint64_t len,
+                                   int mmu_idx, uintptr_t ra)
+{
+    void *mem;
+
+    len = MIN(len, TARGET_PAGE_ALIGN(addr + 1) - addr);
+    if (probe_access_flags(env, addr, len, MMU_DATA_STORE, mmu_idx,
+                           true, &mem, ra)) {
+        cpu_stb_mmuidx_ra(env, addr, val, mmu_idx, ra);
+        return 1;
+    }
+    memset(mem, val, len);
+    return len;
+}
+
+uint64_t cpu_memmove_page_mmuidx_ra(CPUArchState *env, abi_ptr dst,
+                                    abi_ptr src, uint64_t len,
+                                    int wmmu_idx, int rmmu_idx,
+                                    uintptr_t ra)
+{
+    void *wmem, *rmem;
+
+    len = MIN(len, TARGET_PAGE_ALIGN(dst + 1) - dst);
+    len = MIN(len, TARGET_PAGE_ALIGN(src + 1) - src);
+    if (probe_access_flags(env, dst, len, MMU_DATA_STORE, wmmu_idx,
+                           true, &wmem, ra) ||
+        probe_access_flags(env, src, len, MMU_DATA_LOAD, rmmu_idx,
+                           true, &rmem, ra)) {
+        uint8_t byte = cpu_ldub_mmuidx_ra(env, src, rmmu_idx, ra);
+
+        cpu_stb_mmuidx_ra(env, dst, byte, wmmu_idx, ra);
+        return 1;
+    }
+    memmove(wmem, rmem, len);
+    return len;
+}
+
 tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env, vaddr addr,
                                         void **hostp)
 {
@@ -2035,6 +2035,9 @@ void audio_create_pdos(Audiodev *dev)
 #endif
 #ifdef CONFIG_SPICE
         CASE(SPICE, spice, );
+#endif
+#ifdef CONFIG_AUDIO_WASM
+        CASE(WASM, wasm, );
 #endif
         CASE(WAV, wav, );
 
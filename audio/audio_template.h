@@ -384,6 +384,10 @@ AudiodevPerDirectionOptions *glue(audio_get_pdo_, TYPE)(Audiodev *dev)
 #ifdef CONFIG_SPICE
     case AUDIODEV_DRIVER_SPICE:
         return dev->u.spice.TYPE;
+#endif
+#ifdef CONFIG_AUDIO_WASM
+    case AUDIODEV_DRIVER_WASM:
+        return dev->u.wasm.TYPE;
 #endif
     case AUDIODEV_DRIVER_WAV:
         return dev->u.wav.TYPE;
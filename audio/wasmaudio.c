@@ -0,0 +1,203 @@
+/*
+ * QEMU audio backend feeding an AudioWorklet through a shared ring
+ *
+ * The mixing engine clips the output straight into a ring of float
+ * frames in the wasm heap, which is a SharedArrayBuffer, and an
+ * AudioWorkletProcessor takes them from there on the audio rendering
+ * thread of the browser.  Neither side calls the other per buffer: QEMU
+ * moves the tail and the worklet moves the head, and the worklet plays
+ * silence when the ring runs dry.
+ *
+ * The layout, all little endian 32-bit words, is described by
+ * WasmAudioShared.  head and tail count frames and wrap around at 2^32.
+ * examples/audio/wasm-audio-worklet.js implements the worklet.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "audio.h"
+
+#include <emscripten.h>
+
+#define AUDIO_CAP "wasm"
+#include "audio_int.h"
+
+/*
+ * Two periods of the default 10 ms audio timer, plus room for the jitter
+ * of the main loop; buffer-length and timer-period lower it.
+ */
+#define WASM_AUDIO_DEFAULT_BUFFER_US 30000
+
+typedef struct WasmAudioShared {
+    uint32_t head;      /* written by the worklet */
+    uint32_t tail;      /* written by QEMU */
+    uint32_t size;      /* frames, power of two */
+    uint32_t data;      /* address of the interleaved f32 frames */
+    uint32_t freq;
+    uint32_t nchannels;
+    uint32_t enabled;   /* written by QEMU, the worklet idles while clear */
+    uint32_t underruns; /* written by the worklet */
+} WasmAudioShared;
+
+typedef struct WasmVoiceOut {
+    HWVoiceOut hw;
+    WasmAudioShared *shared;
+    uint8_t *data;
+    char *id;
+} WasmVoiceOut;
+
+static uint32_t wasm_audio_free_frames(WasmAudioShared *shared)
+{
+    return shared->size - (shared->tail - qatomic_load_acquire(&shared->head));
+}
+
+static size_t wasm_buffer_get_free(HWVoiceOut *hw)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+
+    return wasm_audio_free_frames(wv->shared) * hw->info.bytes_per_frame;
+}
+
+/* Hands out the free part of the ring up to its end, for mixeng to fill */
+static void *wasm_get_buffer_out(HWVoiceOut *hw, size_t *size)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+    WasmAudioShared *shared = wv->shared;
+    uint32_t off = shared->tail & (shared->size - 1);
+    uint32_t frames = MIN(wasm_audio_free_frames(shared), shared->size - off);
+
+    *size = MIN(*size, (size_t)frames * hw->info.bytes_per_frame);
+    return wv->data + off * hw->info.bytes_per_frame;
+}
+
+static size_t wasm_put_buffer_out(HWVoiceOut *hw, void *buf, size_t size)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+    WasmAudioShared *shared = wv->shared;
+    uint32_t frames = size / hw->info.bytes_per_frame;
+
+    assert(buf == wv->data + (shared->tail & (shared->size - 1)) *
+           hw->info.bytes_per_frame);
+    qatomic_store_release(&shared->tail, shared->tail + frames);
+    return frames * hw->info.bytes_per_frame;
+}
+
+EM_JS(void, wasm_audio_attach_js, (const char *id, WasmAudioShared *shared), {
+    const msg = {
+        type: 'attach', audiodev: UTF8ToString(id), buffer: wasmMemory.buffer,
+        shared: shared
+    };
+
+    Module['wasmAudio'] = Module['wasmAudio'] || {};
+    Module['wasmAudio'][msg.audiodev] = msg;
+    if (Module['wasmAudioPort']) {
+        Module['wasmAudioPort'].postMessage(msg);
+    }
+});
+
+EM_JS(void, wasm_audio_detach_js, (const char *id), {
+    const audiodev = UTF8ToString(id);
+
+    if (Module['wasmAudio']) {
+        delete Module['wasmAudio'][audiodev];
+    }
+    if (Module['wasmAudioPort']) {
+        Module['wasmAudioPort'].postMessage({ type: 'detach',
+                                              audiodev: audiodev });
+    }
+});
+
+static int wasm_init_out(HWVoiceOut *hw, struct audsettings *as,
+                         void *drv_opaque)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+    Audiodev *dev = drv_opaque;
+    uint32_t frames;
+    struct audsettings os = {
+        .freq       = as->freq,
+        .nchannels  = as->nchannels,
+        .fmt        = AUDIO_FORMAT_F32,
+        .endianness = 0
+    };
+
+    /* The worklet copies floats straight into its output channels */
+    audio_pcm_init_info(&hw->info, &os);
+
+    frames = pow2ceil(audio_buffer_frames(dev->u.wasm.out, &os,
+                                          WASM_AUDIO_DEFAULT_BUFFER_US));
+    frames = MAX(frames, 128); /* one render quantum of the worklet */
+    hw->samples = frames;
+
+    wv->shared = qemu_memalign(64, ROUND_UP(sizeof(*wv->shared), 64) +
+                               (size_t)frames * hw->info.bytes_per_frame);
+    wv->data = (uint8_t *)wv->shared + ROUND_UP(sizeof(*wv->shared), 64);
+    *wv->shared = (WasmAudioShared) {
+        .size = frames,
+        .data = (uintptr_t)wv->data,
+        .freq = os.freq,
+        .nchannels = os.nchannels,
+    };
+
+    wv->id = g_strdup(dev->id);
+    wasm_audio_attach_js(wv->id, wv->shared);
+    return 0;
+}
+
+static void wasm_fini_out(HWVoiceOut *hw)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+
+    wasm_audio_detach_js(wv->id);
+    g_free(wv->id);
+    /* The worklet may still be looking at the ring, leak it */
+    qatomic_set(&wv->shared->enabled, 0);
+}
+
+static void wasm_enable_out(HWVoiceOut *hw, bool enable)
+{
+    WasmVoiceOut *wv = (WasmVoiceOut *)hw;
+
+    qatomic_set(&wv->shared->enabled, enable);
+}
+
+static void *wasm_audio_init(Audiodev *dev, Error **errp)
+{
+    return dev;
+}
+
+static void wasm_audio_fini(void *opaque)
+{
+}
+
+static struct audio_pcm_ops wasm_pcm_ops = {
+    .init_out        = wasm_init_out,
+    .fini_out        = wasm_fini_out,
+    .write           = audio_generic_write,
+    .buffer_get_free = wasm_buffer_get_free,
+    .get_buffer_out  = wasm_get_buffer_out,
+    .put_buffer_out  = wasm_put_buffer_out,
+    .enable_out      = wasm_enable_out,
+};
+
+static struct audio_driver wasm_audio_driver = {
+    .name           = "wasm",
+    .descr          = "AudioWorklet fed through a shared ring",
+    .init           = wasm_audio_init,
+    .fini           = wasm_audio_fini,
+    .pcm_ops        = &wasm_pcm_ops,
+    .max_voices_out = 1,
+    .max_voices_in  = 0,
+    .voice_size_out = sizeof(WasmVoiceOut),
+    .voice_size_in  = 0
+};
+
+static void register_audio_wasm(void)
+{
+    audio_driver_register(&wasm_audio_driver);
+}
+type_init(register_audio_wasm);
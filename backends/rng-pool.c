@@ -0,0 +1,179 @@
+/*
+ * QEMU Random Number Generator Backend serving requests from a pool
+ *
+ * rng-builtin asks the host for each request of the frontend, which is a
+ * handful of bytes at a time while the guest kernel seeds itself.  Where
+ * each ask is expensive, like a call out to crypto.getRandomValues() of
+ * the browser on emscripten, rng-pool asks for the whole pool at once and
+ * hands out its bytes from memory.  The pool is topped up by a bottom half
+ * once half of it went out, before the frontend runs dry.
+ *
+ * The bytes still come from qemu_guest_getrandom(), so -seed and
+ * record/replay behave like with rng-builtin.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "sysemu/rng.h"
+#include "qemu/main-loop.h"
+#include "qemu/guest-random.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qom/object.h"
+#include "sysemu/replay.h"
+
+#define TYPE_RNG_POOL "rng-pool"
+OBJECT_DECLARE_SIMPLE_TYPE(RngPool, RNG_POOL)
+
+#define RNG_POOL_DEFAULT_SIZE   (64 * KiB)
+#define RNG_POOL_MIN_SIZE       256
+#define RNG_POOL_MAX_SIZE       (16 * MiB)
+
+struct RngPool {
+    RngBackend parent;
+
+    uint8_t *pool;
+    uint32_t size;
+    uint32_t avail;     /* the bytes not handed out yet, at the start */
+
+    QEMUBH *bh;
+    QEMUBH *refill_bh;
+};
+
+static void rng_pool_refill(RngPool *s)
+{
+    qemu_guest_getrandom_nofail(s->pool + s->avail, s->size - s->avail);
+    s->avail = s->size;
+}
+
+static void rng_pool_refill_bh(void *opaque)
+{
+    rng_pool_refill(opaque);
+}
+
+static void rng_pool_receive_entropy_bh(void *opaque)
+{
+    RngPool *s = opaque;
+
+    while (!QSIMPLEQ_EMPTY(&s->parent.requests)) {
+        RngRequest *req = QSIMPLEQ_FIRST(&s->parent.requests);
+        size_t len;
+
+        if (!s->avail) {
+            /* The frontend outran the refill */
+            rng_pool_refill(s);
+        }
+
+        len = MIN(req->size, s->avail);
+        s->avail -= len;
+        req->receive_entropy(req->opaque, s->pool + s->avail, len);
+        /* The guest has them now, do not leave them around */
+        memset(s->pool + s->avail, 0, len);
+
+        rng_backend_finalize_request(&s->parent, req);
+    }
+
+    if (s->avail < s->size / 2) {
+        replay_bh_schedule_event(s->refill_bh);
+    }
+}
+
+static void rng_pool_request_entropy(RngBackend *b, RngRequest *req)
+{
+    RngPool *s = RNG_POOL(b);
+
+    replay_bh_schedule_event(s->bh);
+}
+
+static void rng_pool_opened(RngBackend *b, Error **errp)
+{
+    RngPool *s = RNG_POOL(b);
+
+    s->pool = g_malloc(s->size);
+    s->avail = 0;
+    rng_pool_refill(s);
+}
+
+static void rng_pool_get_size(Object *obj, Visitor *v, const char *name,
+                              void *opaque, Error **errp)
+{
+    RngPool *s = RNG_POOL(obj);
+
+    visit_type_uint32(v, name, &s->size, errp);
+}
+
+static void rng_pool_set_size(Object *obj, Visitor *v, const char *name,
+                              void *opaque, Error **errp)
+{
+    RngPool *s = RNG_POOL(obj);
+    RngBackend *b = RNG_BACKEND(obj);
+    uint32_t value;
+
+    if (b->opened) {
+        error_setg(errp, "cannot change the size of an opened pool");
+        return;
+    }
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < RNG_POOL_MIN_SIZE || value > RNG_POOL_MAX_SIZE) {
+        error_setg(errp, "size must be between %d bytes and %d MiB",
+                   RNG_POOL_MIN_SIZE, (int)(RNG_POOL_MAX_SIZE / MiB));
+        return;
+    }
+    s->size = value;
+}
+
+static void rng_pool_init(Object *obj)
+{
+    RngPool *s = RNG_POOL(obj);
+
+    s->size = RNG_POOL_DEFAULT_SIZE;
+    s->bh = qemu_bh_new(rng_pool_receive_entropy_bh, s);
+    s->refill_bh = qemu_bh_new(rng_pool_refill_bh, s);
+}
+
+static void rng_pool_finalize(Object *obj)
+{
+    RngPool *s = RNG_POOL(obj);
+
+    qemu_bh_delete(s->bh);
+    qemu_bh_delete(s->refill_bh);
+    if (s->pool) {
+        memset(s->pool, 0, s->size);
+        g_free(s->pool);
+    }
+}
+
+static void rng_pool_class_init(ObjectClass *klass, void *data)
+{
+    RngBackendClass *rbc = RNG_BACKEND_CLASS(klass);
+
+    rbc->request_entropy = rng_pool_request_entropy;
+    rbc->opened = rng_pool_opened;
+
+    object_class_property_add(klass, "size", "uint32",
+                              rng_pool_get_size, rng_pool_set_size,
+                              NULL, NULL);
+    object_class_property_set_description(klass, "size",
+                                          "Size of the pool in bytes");
+}
+
+static const TypeInfo rng_pool_info = {
+    .name = TYPE_RNG_POOL,
+    .parent = TYPE_RNG_BACKEND,
+    .instance_size = sizeof(RngPool),
+    .instance_init = rng_pool_init,
+    .instance_finalize = rng_pool_finalize,
+    .class_init = rng_pool_class_init,
+};
+
+static void register_types(void)
+{
+    type_register_static(&rng_pool_info);
+}
+
+type_init(register_types);
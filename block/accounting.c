@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -200,6 +201,98 @@ void block_latency_histograms_clear(BlockAcctStats *stats)
     }
 }
 
+static unsigned block_acct_hist_bucket(int64_t latency_ns)
+{
+    uint64_t v = MAX(latency_ns, 0);
+    int e;
+
+    if (v < (1 << BLOCK_ACCT_HIST_SUB_BITS)) {
+        return v;
+    }
+    e = 63 - clz64(v);
+    if (e >= BLOCK_ACCT_HIST_MAX_BITS) {
+        return BLOCK_ACCT_HIST_BUCKETS - 1;
+    }
+    return ((e - BLOCK_ACCT_HIST_SUB_BITS + 1) << BLOCK_ACCT_HIST_SUB_BITS) +
+           ((v >> (e - BLOCK_ACCT_HIST_SUB_BITS)) &
+            ((1 << BLOCK_ACCT_HIST_SUB_BITS) - 1));
+}
+
+/* Highest latency that falls into bucket @i */
+static uint64_t block_acct_hist_bucket_max(unsigned i)
+{
+    unsigned sub_count = 1 << BLOCK_ACCT_HIST_SUB_BITS;
+    unsigned group = i >> BLOCK_ACCT_HIST_SUB_BITS;
+
+    if (group == 0) {
+        return i;
+    }
+    return (((uint64_t)sub_count + (i & (sub_count - 1)) + 1) << (group - 1))
+           - 1;
+}
+
+/* Called with stats->lock held */
+static void block_acct_hist_account(BlockAcctLatencyHist *hist,
+                                    int64_t latency_ns)
+{
+    hist->count++;
+    hist->buckets[block_acct_hist_bucket(latency_ns)]++;
+}
+
+int64_t block_acct_clock_ns(void)
+{
+    return qemu_clock_get_ns(clock_type);
+}
+
+/*
+ * Account a request that waited @queue_ns in the BlockBackend before it was
+ * submitted to the block graph, where it took @service_ns.
+ */
+void block_acct_queue_service(BlockAcctStats *stats, enum BlockAcctType type,
+                              int64_t queue_ns, int64_t service_ns)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    WITH_QEMU_LOCK_GUARD(&stats->lock) {
+        block_acct_hist_account(
+            &stats->latency_log[type][BLOCK_ACCT_PHASE_QUEUE], queue_ns);
+        block_acct_hist_account(
+            &stats->latency_log[type][BLOCK_ACCT_PHASE_SERVICE], service_ns);
+    }
+}
+
+/*
+ * Returns the latency in nanoseconds below which @permille per mille of the
+ * accounted requests fall, or 0 if none were accounted.  The number of
+ * accounted requests is stored in @samples.
+ */
+uint64_t block_acct_latency_percentile(BlockAcctStats *stats,
+                                       enum BlockAcctType type,
+                                       enum BlockAcctPhase phase,
+                                       unsigned permille, uint64_t *samples)
+{
+    BlockAcctLatencyHist *hist = &stats->latency_log[type][phase];
+    uint64_t target, sum = 0;
+    unsigned i;
+
+    assert(type < BLOCK_MAX_IOTYPE && phase < BLOCK_ACCT_PHASE__MAX);
+    assert(permille <= 1000);
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    *samples = hist->count;
+    if (!hist->count) {
+        return 0;
+    }
+    target = MAX(DIV_ROUND_UP(hist->count * permille, 1000), 1);
+    for (i = 0; i < BLOCK_ACCT_HIST_BUCKETS - 1; i++) {
+        sum += hist->buckets[i];
+        if (sum >= target) {
+            break;
+        }
+    }
+    return block_acct_hist_bucket_max(i);
+}
+
 static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
                                  bool failed)
 {
@@ -223,6 +316,9 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
         } else {
             stats->nr_bytes[cookie->type] += cookie->bytes;
             stats->nr_ops[cookie->type]++;
+            block_acct_hist_account(
+                &stats->latency_log[cookie->type][BLOCK_ACCT_PHASE_TOTAL],
+                latency_ns);
         }
 
         block_latency_histogram_account(&stats->latency_histogram[cookie->type],
@@ -226,6 +226,39 @@ out:
     return ret;
 }
 
+/*
+ * A write completes once the target has it, not once it is on stable storage
+ * of the target.  Flush the target before the job succeeds, so that the sync
+ * bitmap is not cleared for data that a crash of the target could still lose.
+ */
+static int coroutine_fn backup_flush_target(BackupBlockJob *job)
+{
+    int ret;
+
+    while (true) {
+        bdrv_graph_co_rdlock();
+        ret = bdrv_co_flush(job->target_bs);
+        bdrv_graph_co_rdunlock();
+
+        if (ret >= 0 || job_is_cancelled(&job->common.job)) {
+            return ret;
+        }
+
+        switch (backup_error_action(job, false, -ret)) {
+        case BLOCK_ERROR_ACTION_REPORT:
+            return ret;
+        case BLOCK_ERROR_ACTION_STOP:
+            job_pause_point(&job->common.job);
+            break;
+        case BLOCK_ERROR_ACTION_IGNORE:
+            /* Retry the flush. */
+            break;
+        default:
+            abort();
+        }
+    }
+}
+
 static void backup_init_bcs_bitmap(BackupBlockJob *job)
 {
     uint64_t estimate;
@@ -295,7 +328,11 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
             job_yield(job);
         }
     } else {
-        return backup_loop(s);
+        ret = backup_loop(s);
+        if (ret < 0 || job_is_cancelled(job)) {
+            return ret;
+        }
+        return backup_flush_target(s);
     }
 
     return 0;
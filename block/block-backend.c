@@ -1347,6 +1347,8 @@ blk_co_do_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
 {
     int ret;
     BlockDriverState *bs;
+    int64_t start_ns = block_acct_clock_ns();
+    int64_t service_ns;
     IO_CODE();
 
     blk_wait_while_drained(blk);
@@ -1369,8 +1371,14 @@ blk_co_do_preadv_part(BlockBackend *blk, int64_t offset, int64_t bytes,
                 bytes, THROTTLE_READ);
     }
 
+    service_ns = block_acct_clock_ns();
     ret = bdrv_co_preadv_part(blk->root, offset, bytes, qiov, qiov_offset,
                               flags);
+    if (ret >= 0) {
+        block_acct_queue_service(&blk->stats, BLOCK_ACCT_READ,
+                                 service_ns - start_ns,
+                                 block_acct_clock_ns() - service_ns);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1422,6 +1430,8 @@ blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
 {
     int ret;
     BlockDriverState *bs;
+    int64_t start_ns = block_acct_clock_ns();
+    int64_t service_ns;
     IO_CODE();
 
     blk_wait_while_drained(blk);
@@ -1447,8 +1457,14 @@ blk_co_do_pwritev_part(BlockBackend *blk, int64_t offset, int64_t bytes,
         flags |= BDRV_REQ_FUA;
     }
 
+    service_ns = block_acct_clock_ns();
     ret = bdrv_co_pwritev_part(blk->root, offset, bytes, qiov, qiov_offset,
                                flags);
+    if (ret >= 0) {
+        block_acct_queue_service(&blk->stats, BLOCK_ACCT_WRITE,
+                                 service_ns - start_ns,
+                                 block_acct_clock_ns() - service_ns);
+    }
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -1800,6 +1816,8 @@ static int coroutine_fn
 blk_co_do_pdiscard(BlockBackend *blk, int64_t offset, int64_t bytes)
 {
     int ret;
+    int64_t start_ns = block_acct_clock_ns();
+    int64_t service_ns;
     IO_CODE();
 
     blk_wait_while_drained(blk);
@@ -1810,7 +1828,14 @@ blk_co_do_pdiscard(BlockBackend *blk, int64_t offset, int64_t bytes)
         return ret;
     }
 
-    return bdrv_co_pdiscard(blk->root, offset, bytes);
+    service_ns = block_acct_clock_ns();
+    ret = bdrv_co_pdiscard(blk->root, offset, bytes);
+    if (ret >= 0) {
+        block_acct_queue_service(&blk->stats, BLOCK_ACCT_UNMAP,
+                                 service_ns - start_ns,
+                                 block_acct_clock_ns() - service_ns);
+    }
+    return ret;
 }
 
 static void coroutine_fn blk_aio_pdiscard_entry(void *opaque)
@@ -1847,6 +1872,10 @@ int coroutine_fn blk_co_pdiscard(BlockBackend *blk, int64_t offset,
 /* To be called between exactly one pair of blk_inc/dec_in_flight() */
 static int coroutine_fn blk_co_do_flush(BlockBackend *blk)
 {
+    int64_t start_ns = block_acct_clock_ns();
+    int64_t service_ns;
+    int ret;
+
     IO_CODE();
     blk_wait_while_drained(blk);
     GRAPH_RDLOCK_GUARD();
@@ -1855,7 +1884,14 @@ static int coroutine_fn blk_co_do_flush(BlockBackend *blk)
         return -ENOMEDIUM;
     }
 
-    return bdrv_co_flush(blk_bs(blk));
+    service_ns = block_acct_clock_ns();
+    ret = bdrv_co_flush(blk_bs(blk));
+    if (ret >= 0) {
+        block_acct_queue_service(&blk->stats, BLOCK_ACCT_FLUSH,
+                                 service_ns - start_ns,
+                                 block_acct_clock_ns() - service_ns);
+    }
+    return ret;
 }
 
 static void coroutine_fn blk_aio_flush_entry(void *opaque)
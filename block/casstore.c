@@ -0,0 +1,863 @@
+/*
+ * Block driver for content-addressed, deduplicated chunk stores
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A casstore image is a manifest (the "file" child) listing the chunks
+ * of the image, and a directory or URL prefix holding the chunks, each in
+ * a file named after the SHA-256 of its contents.  The chunk boundaries
+ * are content-defined with a gear rolling hash, so images that differ
+ * only in places share most of their chunks, both in the store and in the
+ * HTTP caches in front of it.
+ *
+ * Images are written once, sequentially, by "qemu-img convert -O
+ * casstore": the manifest records the size and no chunks until the last
+ * byte is written.  After that they are read-only.  Reads load whole
+ * chunks in the thread pool, verify their hash and keep them in an LRU
+ * cache bounded by cache-size.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "crypto/hash.h"
+#include "sysemu/block-backend.h"
+#include "trace.h"
+#ifdef EMSCRIPTEN
+#include <emscripten.h>
+#endif
+
+#define CAS_MAGIC           0x5143415353544f52ULL /* "QCASSTOR" */
+#define CAS_VERSION         1
+#define CAS_HASH_ALG        QCRYPTO_HASH_ALG_SHA256
+#define CAS_DIGEST_LEN      32
+
+/* Content-defined chunking: 64k chunks on average */
+#define CAS_MIN_CHUNK       (16 * KiB)
+#define CAS_MAX_CHUNK       (256 * KiB)
+#define CAS_CUT_BITS        16
+
+#define CAS_OPT_CHUNKS      "chunks"
+#define CAS_OPT_CACHE_SIZE  "cache-size"
+
+#define CAS_DEFAULT_CACHE_SIZE  (64 * MiB)
+
+typedef struct QEMU_PACKED CasManifestHeader {
+    uint64_t magic;
+    uint32_t version;
+    /* QCryptoHashAlgorithm of the chunk names */
+    uint32_t hash_alg;
+    uint64_t size;
+    /* 0 until the whole image is written */
+    uint32_t nb_chunks;
+    uint32_t reserved;
+} CasManifestHeader;
+
+typedef struct QEMU_PACKED CasManifestEntry {
+    uint32_t len;
+    uint8_t digest[CAS_DIGEST_LEN];
+} CasManifestEntry;
+
+typedef struct BDRVCasState BDRVCasState;
+
+typedef struct CasChunk {
+    BDRVCasState *s;
+    char name[CAS_DIGEST_LEN * 2 + 1];
+    uint8_t digest[CAS_DIGEST_LEN];
+    uint8_t *data;
+    uint32_t len;
+    /* set until the thread pool is done with the chunk */
+    bool loading;
+    /* 0, or the error of the load once loading is clear */
+    int ret;
+    /* coroutines waiting for or copying from the chunk */
+    unsigned refs;
+    CoQueue waiters;
+    QTAILQ_ENTRY(CasChunk) lru;
+} CasChunk;
+
+typedef struct CasStoreJob {
+    BDRVCasState *s;
+    const uint8_t *data;
+    uint32_t len;
+    uint8_t digest[CAS_DIGEST_LEN];
+} CasStoreJob;
+
+struct BDRVCasState {
+    BlockDriverState *bs;
+    char *chunk_dir;
+    uint64_t size;
+    uint32_t nb_chunks;
+    CasManifestEntry *entries;
+    /* nb_chunks + 1 start offsets of the chunks in the image */
+    uint64_t *offsets;
+
+    uint64_t cache_size;
+    uint64_t cached_bytes;
+    /* chunk name -> CasChunk, loaded or loading */
+    GHashTable *chunks;
+    /* loaded chunks, least recently used first */
+    QTAILQ_HEAD(, CasChunk) lru;
+
+    /* only while the image is being written */
+    bool incomplete;
+    CoMutex write_lock;
+    uint64_t write_offset;
+    int write_error;
+    uint8_t *pending;
+    uint32_t pending_len;
+    uint64_t gear_hash;
+    GArray *written;
+};
+
+static uint64_t cas_gear[256];
+
+static QemuOptsList runtime_opts = {
+    .name = "casstore",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = CAS_OPT_CHUNKS,
+            .type = QEMU_OPT_STRING,
+            .help = "directory or URL prefix of the chunks",
+        },
+        {
+            .name = CAS_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of the chunk cache",
+        },
+        { /* end of list */ }
+    },
+};
+
+static QemuOptsList cas_create_opts = {
+    .name = "casstore-create-opts",
+    .head = QTAILQ_HEAD_INITIALIZER(cas_create_opts.head),
+    .desc = {
+        {
+            .name = BLOCK_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Virtual disk size"
+        },
+        {
+            .name = CAS_OPT_CHUNKS,
+            .type = QEMU_OPT_STRING,
+            .help = "Directory of the chunks (default: <filename>.chunks)"
+        },
+        { /* end of list */ }
+    }
+};
+
+static void cas_digest_to_name(const uint8_t *digest, char *name)
+{
+    for (int i = 0; i < CAS_DIGEST_LEN; i++) {
+        sprintf(name + i * 2, "%02x", digest[i]);
+    }
+}
+
+#ifdef EMSCRIPTEN
+/* Reads the resource at @url into @buf; returns its length, or -1 */
+EM_JS(int, cas_fetch_js, (const char *url, uint8_t *buf, int len), {
+        const xhr = new XMLHttpRequest();
+        xhr.open("GET", UTF8ToString(url), false);
+        // synchronous requests may only set the response type in workers
+        xhr.responseType = "arraybuffer";
+        try {
+            xhr.send();
+        } catch (e) {
+            return -1;
+        }
+        if (xhr.status != 200) {
+            return -1;
+        }
+        const data = new Uint8Array(xhr.response);
+        if (data.length != len) {
+            return -1;
+        }
+        new Uint8Array(wasmMemory.buffer, buf, len).set(data);
+        return len;
+});
+#endif
+
+/* Runs in a thread pool worker */
+static int cas_chunk_worker(void *opaque)
+{
+    CasChunk *c = opaque;
+    BDRVCasState *s = c->s;
+    g_autofree char *path = g_strdup_printf("%s/%s", s->chunk_dir, c->name);
+    g_autofree uint8_t *digest = NULL;
+    size_t digest_len;
+
+#ifdef EMSCRIPTEN
+    if (strstr(s->chunk_dir, "://")) {
+        if (cas_fetch_js(path, c->data, c->len) != c->len) {
+            return -EIO;
+        }
+    } else
+#endif
+    {
+        g_autofree char *contents = NULL;
+        gsize len;
+
+        if (!g_file_get_contents(path, &contents, &len, NULL) ||
+            len != c->len) {
+            return -EIO;
+        }
+        memcpy(c->data, contents, len);
+    }
+
+    /* the store is shared, don't trust it */
+    if (qcrypto_hash_bytes(CAS_HASH_ALG, (const char *)c->data, c->len,
+                           &digest, &digest_len, NULL) < 0 ||
+        memcmp(digest, c->digest, CAS_DIGEST_LEN)) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static void cas_chunk_free(CasChunk *c)
+{
+    g_free(c->data);
+    g_free(c);
+}
+
+static void cas_chunk_done(void *opaque, int ret)
+{
+    CasChunk *c = opaque;
+    BDRVCasState *s = c->s;
+
+    trace_cas_chunk_done(s->bs, c->name, ret);
+    c->loading = false;
+    c->ret = ret;
+    if (ret < 0) {
+        /* drop it so that the next read tries again */
+        g_hash_table_remove(s->chunks, c->name);
+        s->cached_bytes -= c->len;
+        qemu_co_queue_restart_all(&c->waiters);
+        if (!c->refs) {
+            cas_chunk_free(c);
+        }
+    } else {
+        QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+        qemu_co_queue_restart_all(&c->waiters);
+    }
+    bdrv_dec_in_flight(s->bs);
+}
+
+/* Make room for @len more bytes in the cache */
+static void cas_cache_reserve(BDRVCasState *s, uint32_t len)
+{
+    CasChunk *c, *next;
+
+    QTAILQ_FOREACH_SAFE(c, &s->lru, lru, next) {
+        if (s->cached_bytes + len <= s->cache_size) {
+            break;
+        }
+        if (!c->refs) {
+            QTAILQ_REMOVE(&s->lru, c, lru);
+            g_hash_table_remove(s->chunks, c->name);
+            s->cached_bytes -= c->len;
+            cas_chunk_free(c);
+        }
+    }
+}
+
+/*
+ * Start loading the chunk of manifest entry @index.  Reads may go over the
+ * cache limit while every chunk is in use.
+ */
+static CasChunk *cas_chunk_start(BDRVCasState *s, uint32_t index)
+{
+    CasManifestEntry *e = &s->entries[index];
+    CasChunk *c;
+
+    cas_cache_reserve(s, e->len);
+
+    c = g_new0(CasChunk, 1);
+    c->s = s;
+    cas_digest_to_name(e->digest, c->name);
+    memcpy(c->digest, e->digest, CAS_DIGEST_LEN);
+    c->len = e->len;
+    c->data = g_malloc(c->len);
+    c->loading = true;
+    qemu_co_queue_init(&c->waiters);
+    g_hash_table_insert(s->chunks, c->name, c);
+    s->cached_bytes += c->len;
+    trace_cas_chunk_start(s->bs, c->name);
+
+    /* keep drain waiting until the chunk is loaded */
+    bdrv_inc_in_flight(s->bs);
+    thread_pool_submit_aio(cas_chunk_worker, c, cas_chunk_done, c);
+    return c;
+}
+
+static CasChunk *cas_chunk_lookup(BDRVCasState *s, uint32_t index)
+{
+    char name[CAS_DIGEST_LEN * 2 + 1];
+
+    cas_digest_to_name(s->entries[index].digest, name);
+    return g_hash_table_lookup(s->chunks, name);
+}
+
+/* Returns the manifest entry that holds @offset */
+static uint32_t cas_find(BDRVCasState *s, uint64_t offset)
+{
+    uint32_t lo = 0, hi = s->nb_chunks;
+
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (s->offsets[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int coroutine_fn cas_co_read_chunk(BDRVCasState *s, uint32_t index,
+                                          uint64_t offset, uint64_t bytes,
+                                          QEMUIOVector *qiov,
+                                          size_t qiov_offset)
+{
+    CasChunk *c = cas_chunk_lookup(s, index);
+    int ret;
+
+    if (!c) {
+        c = cas_chunk_start(s, index);
+    }
+    c->refs++;
+    while (c->loading) {
+        qemu_co_queue_wait(&c->waiters, NULL);
+    }
+    c->refs--;
+
+    ret = c->ret;
+    if (ret < 0) {
+        if (!c->refs) {
+            cas_chunk_free(c);
+        }
+        return ret;
+    }
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+    qemu_iovec_from_buf(qiov, qiov_offset, c->data + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn cas_co_preadv(BlockDriverState *bs, int64_t offset,
+                                      int64_t bytes, QEMUIOVector *qiov,
+                                      BdrvRequestFlags flags)
+{
+    BDRVCasState *s = bs->opaque;
+    uint32_t index, last;
+    size_t qiov_offset = 0;
+    int ret;
+
+    if (s->incomplete) {
+        return -EIO;
+    }
+    if (offset + bytes > s->size) {
+        int64_t tail = offset + bytes - MAX(offset, s->size);
+
+        qemu_iovec_memset(qiov, bytes - tail, 0, tail);
+        bytes -= tail;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+
+    /* load the missing chunks of the request in parallel */
+    index = cas_find(s, offset);
+    last = cas_find(s, offset + bytes - 1);
+    for (uint32_t i = index; i <= last; i++) {
+        if (!cas_chunk_lookup(s, i)) {
+            cas_chunk_start(s, i);
+        }
+    }
+
+    while (bytes > 0) {
+        uint64_t chunk_offset = offset - s->offsets[index];
+        uint64_t n = MIN(bytes, s->offsets[index + 1] - offset);
+
+        ret = cas_co_read_chunk(s, index, chunk_offset, n, qiov, qiov_offset);
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+        index++;
+    }
+    return 0;
+}
+
+/* Runs in a thread pool worker */
+static int cas_store_worker(void *opaque)
+{
+    CasStoreJob *job = opaque;
+    char name[CAS_DIGEST_LEN * 2 + 1];
+    g_autofree uint8_t *digest = NULL;
+    g_autofree char *path = NULL;
+    size_t digest_len;
+
+    if (qcrypto_hash_bytes(CAS_HASH_ALG, (const char *)job->data, job->len,
+                           &digest, &digest_len, NULL) < 0) {
+        return -EIO;
+    }
+    memcpy(job->digest, digest, CAS_DIGEST_LEN);
+    cas_digest_to_name(digest, name);
+
+    /* an existing chunk has the same contents, which is the point */
+    path = g_strdup_printf("%s/%s", job->s->chunk_dir, name);
+    if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+        return 0;
+    }
+    return g_file_set_contents(path, (const char *)job->data, job->len, NULL) ?
+           0 : -EIO;
+}
+
+static int coroutine_fn cas_co_store_pending(BDRVCasState *s)
+{
+    CasStoreJob job = {
+        .s = s,
+        .data = s->pending,
+        .len = s->pending_len,
+    };
+    CasManifestEntry e;
+    int ret;
+
+    ret = thread_pool_submit_co(cas_store_worker, &job);
+    if (ret < 0) {
+        return ret;
+    }
+    e.len = job.len;
+    memcpy(e.digest, job.digest, CAS_DIGEST_LEN);
+    g_array_append_val(s->written, e);
+    s->pending_len = 0;
+    s->gear_hash = 0;
+    return 0;
+}
+
+/* Append @bytes from @buf, or zeroes if it is NULL, cutting chunks */
+static int coroutine_fn cas_co_feed(BDRVCasState *s, const uint8_t *buf,
+                                    size_t bytes)
+{
+    int ret;
+
+    for (size_t i = 0; i < bytes; i++) {
+        uint8_t b = buf ? buf[i] : 0;
+
+        s->gear_hash = (s->gear_hash << 1) + cas_gear[b];
+        s->pending[s->pending_len++] = b;
+        if (s->pending_len == CAS_MAX_CHUNK ||
+            (s->pending_len >= CAS_MIN_CHUNK &&
+             !(s->gear_hash >> (64 - CAS_CUT_BITS)))) {
+            ret = cas_co_store_pending(s);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Store the last chunk and the manifest; the image is read-only after that */
+static int coroutine_fn GRAPH_RDLOCK cas_co_finish(BlockDriverState *bs)
+{
+    BDRVCasState *s = bs->opaque;
+    CasManifestHeader header;
+    CasManifestEntry *entries;
+    uint32_t nb_chunks;
+    int ret;
+
+    if (s->pending_len) {
+        ret = cas_co_store_pending(s);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    nb_chunks = s->written->len;
+    entries = (CasManifestEntry *)g_array_free(s->written, false);
+    s->written = NULL;
+    s->offsets = g_new(uint64_t, nb_chunks + 1);
+    s->offsets[0] = 0;
+    for (uint32_t i = 0; i < nb_chunks; i++) {
+        s->offsets[i + 1] = s->offsets[i] + entries[i].len;
+        entries[i].len = cpu_to_be32(entries[i].len);
+    }
+
+    ret = bdrv_co_pwrite(bs->file, sizeof(header),
+                         nb_chunks * sizeof(CasManifestEntry), entries, 0);
+    for (uint32_t i = 0; i < nb_chunks; i++) {
+        entries[i].len = be32_to_cpu(entries[i].len);
+    }
+    s->entries = entries;
+    s->nb_chunks = nb_chunks;
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* the chunk list must be there before the header points to it */
+    ret = bdrv_co_flush(bs->file->bs);
+    if (ret < 0) {
+        return ret;
+    }
+    header = (CasManifestHeader) {
+        .magic = cpu_to_be64(CAS_MAGIC),
+        .version = cpu_to_be32(CAS_VERSION),
+        .hash_alg = cpu_to_be32(CAS_HASH_ALG),
+        .size = cpu_to_be64(s->size),
+        .nb_chunks = cpu_to_be32(nb_chunks),
+    };
+    ret = bdrv_co_pwrite(bs->file, 0, sizeof(header), &header, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_cas_finish(bs, nb_chunks);
+    g_free(s->pending);
+    s->pending = NULL;
+    s->incomplete = false;
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cas_co_write(BlockDriverState *bs, int64_t offset, int64_t bytes,
+             QEMUIOVector *qiov)
+{
+    BDRVCasState *s = bs->opaque;
+    g_autofree uint8_t *buf = NULL;
+    size_t done = 0;
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&s->write_lock);
+    if (!s->incomplete) {
+        return -EROFS;
+    }
+    if (s->write_error) {
+        return s->write_error;
+    }
+    if (offset != s->write_offset) {
+        /* chunk boundaries depend on everything before them */
+        return -ENOTSUP;
+    }
+
+    if (qiov) {
+        buf = g_malloc(MIN(bytes, CAS_MAX_CHUNK));
+    }
+    while (done < bytes) {
+        size_t n = MIN(bytes - done, CAS_MAX_CHUNK);
+
+        if (qiov) {
+            qemu_iovec_to_buf(qiov, done, buf, n);
+        }
+        ret = cas_co_feed(s, buf, n);
+        if (ret < 0) {
+            goto fail;
+        }
+        done += n;
+    }
+    s->write_offset += bytes;
+
+    if (s->write_offset == s->size) {
+        ret = cas_co_finish(bs);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    /* the chunking state is lost, the image must be written again */
+    s->write_error = ret;
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cas_co_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
+               QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    return cas_co_write(bs, offset, bytes, qiov);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cas_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     BdrvRequestFlags flags)
+{
+    return cas_co_write(bs, offset, bytes, NULL);
+}
+
+static int GRAPH_RDLOCK cas_load_manifest(BlockDriverState *bs, Error **errp)
+{
+    BDRVCasState *s = bs->opaque;
+    size_t entries_size;
+    int ret;
+
+    entries_size = (size_t)s->nb_chunks * sizeof(CasManifestEntry);
+    s->entries = g_try_malloc(entries_size);
+    if (!s->entries) {
+        error_setg(errp, "Could not allocate the chunk list");
+        return -ENOMEM;
+    }
+    ret = bdrv_pread(bs->file, sizeof(CasManifestHeader), entries_size,
+                     s->entries, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the chunk list");
+        return ret;
+    }
+
+    s->offsets = g_new(uint64_t, s->nb_chunks + 1);
+    s->offsets[0] = 0;
+    for (uint32_t i = 0; i < s->nb_chunks; i++) {
+        s->entries[i].len = be32_to_cpu(s->entries[i].len);
+        if (s->entries[i].len == 0 || s->entries[i].len > CAS_MAX_CHUNK) {
+            error_setg(errp, "Invalid length of chunk %" PRIu32, i);
+            return -EINVAL;
+        }
+        s->offsets[i + 1] = s->offsets[i] + s->entries[i].len;
+    }
+    if (s->offsets[s->nb_chunks] != s->size) {
+        error_setg(errp, "The chunks don't add up to the image size");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int cas_open(BlockDriverState *bs, QDict *options, int flags,
+                    Error **errp)
+{
+    BDRVCasState *s = bs->opaque;
+    CasManifestHeader header;
+    QemuOpts *opts;
+    const char *chunks, *manifest;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    ret = bdrv_pread(bs->file, 0, sizeof(header), &header, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the manifest header");
+        goto out;
+    }
+    if (be64_to_cpu(header.magic) != CAS_MAGIC) {
+        error_setg(errp, "Image is not a casstore manifest");
+        ret = -EINVAL;
+        goto out;
+    }
+    if (be32_to_cpu(header.version) != CAS_VERSION ||
+        be32_to_cpu(header.hash_alg) != CAS_HASH_ALG) {
+        error_setg(errp, "Unsupported casstore version %" PRIu32,
+                   be32_to_cpu(header.version));
+        ret = -ENOTSUP;
+        goto out;
+    }
+    s->size = be64_to_cpu(header.size);
+    s->nb_chunks = be32_to_cpu(header.nb_chunks);
+    if (s->nb_chunks > s->size || s->size > INT64_MAX) {
+        error_setg(errp, "Invalid casstore manifest header");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->incomplete = s->size && !s->nb_chunks;
+
+    manifest = bs->file->bs->filename;
+    strstart(manifest, "fetch:", &manifest);
+    chunks = qemu_opt_get(opts, CAS_OPT_CHUNKS);
+    s->chunk_dir = chunks ? g_strdup(chunks)
+                          : g_strdup_printf("%s.chunks", manifest);
+    s->cache_size = qemu_opt_get_size(opts, CAS_OPT_CACHE_SIZE,
+                                      CAS_DEFAULT_CACHE_SIZE);
+
+    if (s->incomplete) {
+        if (bdrv_is_read_only(bs)) {
+            error_setg(errp, "The casstore image is incomplete, it can only "
+                       "be opened for writing it");
+            ret = -EINVAL;
+            goto out;
+        }
+        qemu_co_mutex_init(&s->write_lock);
+        s->pending = g_malloc(CAS_MAX_CHUNK);
+        s->written = g_array_new(false, false, sizeof(CasManifestEntry));
+    } else {
+        ret = bdrv_apply_auto_read_only(bs, "casstore images are read-only "
+                                        "once written", errp);
+        if (ret < 0) {
+            goto out;
+        }
+        ret = cas_load_manifest(bs, errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+    trace_cas_open(bs, s->size, s->nb_chunks, s->chunk_dir);
+
+    s->bs = bs;
+    s->chunks = g_hash_table_new(g_str_hash, g_str_equal);
+    QTAILQ_INIT(&s->lru);
+    ret = 0;
+
+out:
+    qemu_opts_del(opts);
+    if (ret < 0) {
+        g_free(s->chunk_dir);
+        g_free(s->entries);
+        g_free(s->offsets);
+        g_free(s->pending);
+        if (s->written) {
+            g_array_free(s->written, true);
+        }
+    }
+    return ret;
+}
+
+static void cas_close(BlockDriverState *bs)
+{
+    BDRVCasState *s = bs->opaque;
+    GHashTableIter iter;
+    CasChunk *c;
+
+    /* drained, so no chunk is loading anymore */
+    g_hash_table_iter_init(&iter, s->chunks);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&c)) {
+        cas_chunk_free(c);
+    }
+    g_hash_table_destroy(s->chunks);
+    if (s->written) {
+        g_array_free(s->written, true);
+    }
+    g_free(s->pending);
+    g_free(s->entries);
+    g_free(s->offsets);
+    g_free(s->chunk_dir);
+}
+
+static int coroutine_fn GRAPH_UNLOCKED
+cas_co_create_opts(BlockDriver *drv, const char *filename, QemuOpts *opts,
+                   Error **errp)
+{
+    CasManifestHeader header;
+    BlockBackend *blk;
+    g_autofree char *chunks = NULL;
+    uint64_t size;
+    int ret;
+
+    size = ROUND_UP(qemu_opt_get_size_del(opts, BLOCK_OPT_SIZE, 0),
+                    BDRV_SECTOR_SIZE);
+    chunks = qemu_opt_get_del(opts, CAS_OPT_CHUNKS);
+    if (!chunks) {
+        chunks = g_strdup_printf("%s.chunks", filename);
+    }
+    if (g_mkdir_with_parents(chunks, 0755) < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not create the chunk directory "
+                         "'%s'", chunks);
+        return ret;
+    }
+
+    ret = bdrv_co_create_file(filename, opts, errp);
+    if (ret < 0) {
+        return ret;
+    }
+    blk = blk_co_new_open(filename, NULL, NULL,
+                          BDRV_O_RDWR | BDRV_O_RESIZE | BDRV_O_PROTOCOL, errp);
+    if (!blk) {
+        return -EIO;
+    }
+    blk_set_allow_write_beyond_eof(blk, true);
+
+    header = (CasManifestHeader) {
+        .magic = cpu_to_be64(CAS_MAGIC),
+        .version = cpu_to_be32(CAS_VERSION),
+        .hash_alg = cpu_to_be32(CAS_HASH_ALG),
+        .size = cpu_to_be64(size),
+    };
+    ret = blk_co_pwrite(blk, 0, sizeof(header), &header, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write the manifest");
+    }
+    blk_co_unref(blk);
+    return ret;
+}
+
+static void cas_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    bs->bl.request_alignment = BDRV_SECTOR_SIZE; /* No sub-sector I/O */
+}
+
+static int64_t coroutine_fn cas_co_getlength(BlockDriverState *bs)
+{
+    BDRVCasState *s = bs->opaque;
+    return s->size;
+}
+
+static const char *const cas_strong_runtime_opts[] = {
+    CAS_OPT_CHUNKS,
+
+    NULL
+};
+
+static BlockDriver bdrv_casstore = {
+    .format_name                = "casstore",
+    .instance_size              = sizeof(BDRVCasState),
+    .is_format                  = true,
+
+    .bdrv_open                  = cas_open,
+    .bdrv_close                 = cas_close,
+    .bdrv_co_create_opts        = cas_co_create_opts,
+    .bdrv_refresh_limits        = cas_refresh_limits,
+    .bdrv_co_getlength          = cas_co_getlength,
+    .bdrv_child_perm            = bdrv_default_perms,
+
+    .bdrv_co_preadv             = cas_co_preadv,
+    .bdrv_co_pwritev            = cas_co_pwritev,
+    .bdrv_co_pwrite_zeroes      = cas_co_pwrite_zeroes,
+
+    .create_opts                = &cas_create_opts,
+    .strong_runtime_opts        = cas_strong_runtime_opts,
+};
+
+static void bdrv_casstore_init(void)
+{
+    /* a fixed table, so that the same data gives the same chunks */
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+
+    for (int i = 0; i < ARRAY_SIZE(cas_gear); i++) {
+        /* splitmix64 */
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        cas_gear[i] = z ^ (z >> 31);
+    }
+    bdrv_register(&bdrv_casstore);
+}
+
+block_init(bdrv_casstore_init);
@@ -0,0 +1,640 @@
+/*
+ * Copy-on-write overlay driver persisting the writes to a read-only base
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The guest sees the "base" child (typically an immutable image read with
+ * the fetch driver) with its writes applied on top.  Written clusters are
+ * appended to the "file" child (typically an OPFS file) and a small map
+ * from guest clusters to their slot in the file tells which clusters come
+ * from there.  Only the clusters the user wrote are stored, so reopening
+ * the overlay costs the size of the delta and not of the base.
+ *
+ * Cluster data is written right away, but the map is written back in
+ * batches from a timer and on flush, after flushing the data it points
+ * to.  A crash loses at most the writes of the last interval.
+ *
+ * Layout of the file: the header, the map at COW_OVERLAY_TABLE_OFFSET
+ * (one big-endian slot + 1 per cluster, 0 meaning unallocated) and the
+ * slots from data_offset on.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/bitmap.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define COW_OVERLAY_MAGIC           0x514f564c59303031ULL /* "QOVLY001" */
+#define COW_OVERLAY_TABLE_OFFSET    4096
+#define COW_OVERLAY_PAGE_SIZE       4096
+#define COW_OVERLAY_PAGE_ENTRIES    (COW_OVERLAY_PAGE_SIZE / sizeof(uint32_t))
+
+#define COW_OVERLAY_OPT_CLUSTER_SIZE    "cluster-size"
+#define COW_OVERLAY_OPT_FLUSH_INTERVAL  "flush-interval"
+
+#define COW_OVERLAY_DEFAULT_CLUSTER_SIZE    (64 * KiB)
+#define COW_OVERLAY_DEFAULT_FLUSH_INTERVAL  1000 /* ms */
+
+typedef struct QEMU_PACKED CowOverlayHeader {
+    uint64_t magic;
+    uint32_t cluster_bits;
+    /* allocated slots the map may point to */
+    uint32_t nb_slots;
+    uint64_t base_size;
+    uint64_t data_offset;
+} CowOverlayHeader;
+
+typedef struct BDRVCowOverlayState {
+    BdrvChild *base;
+    uint64_t base_size;
+    uint32_t cluster_bits;
+    uint64_t cluster_size;
+    uint32_t nb_clusters;
+    uint64_t data_offset;
+
+    /* guest cluster -> slot + 1, or 0 if it still comes from the base */
+    uint32_t *map;
+    uint32_t nb_slots;
+    /* pages of the map, and the header, not written back yet */
+    unsigned long *dirty_pages;
+    uint32_t nb_pages;
+    bool dirty;
+
+    /* serializes cluster allocation */
+    CoMutex alloc_lock;
+    /* serializes writing back the map */
+    CoMutex flush_lock;
+    QEMUTimer *flush_timer;
+    int64_t flush_interval_ms;
+} BDRVCowOverlayState;
+
+static QemuOptsList runtime_opts = {
+    .name = "cow-overlay",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = COW_OVERLAY_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "granularity of the overlay when it is created",
+        },
+        {
+            .name = COW_OVERLAY_OPT_FLUSH_INTERVAL,
+            .type = QEMU_OPT_NUMBER,
+            .help = "milliseconds between writebacks of the map",
+        },
+        { /* end of list */ }
+    },
+};
+
+static uint64_t cow_overlay_slot_offset(BDRVCowOverlayState *s, uint32_t slot)
+{
+    return s->data_offset + ((uint64_t)slot << s->cluster_bits);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_write_back(BlockDriverState *bs)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    CowOverlayHeader header;
+    uint32_t *buf = NULL;
+    int64_t page;
+    int ret = 0;
+
+    qemu_co_mutex_lock(&s->flush_lock);
+    if (!s->dirty) {
+        goto out;
+    }
+    s->dirty = false;
+    trace_cow_overlay_write_back(bs, s->nb_slots);
+
+    /* the clusters the map points to must be stable before the map */
+    ret = bdrv_co_flush(bs->file->bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    buf = qemu_blockalign(bs->file->bs, COW_OVERLAY_PAGE_SIZE);
+    while ((page = find_first_bit(s->dirty_pages, s->nb_pages)) <
+           s->nb_pages) {
+        uint32_t first = page * COW_OVERLAY_PAGE_ENTRIES;
+
+        clear_bit(page, s->dirty_pages);
+        memset(buf, 0, COW_OVERLAY_PAGE_SIZE);
+        for (uint32_t i = 0; i < COW_OVERLAY_PAGE_ENTRIES &&
+                             first + i < s->nb_clusters; i++) {
+            buf[i] = cpu_to_be32(s->map[first + i]);
+        }
+        ret = bdrv_co_pwrite(bs->file, COW_OVERLAY_TABLE_OFFSET +
+                             page * COW_OVERLAY_PAGE_SIZE,
+                             COW_OVERLAY_PAGE_SIZE, buf, 0);
+        if (ret < 0) {
+            set_bit(page, s->dirty_pages);
+            goto fail;
+        }
+    }
+
+    header = (CowOverlayHeader) {
+        .magic = cpu_to_be64(COW_OVERLAY_MAGIC),
+        .cluster_bits = cpu_to_be32(s->cluster_bits),
+        .nb_slots = cpu_to_be32(s->nb_slots),
+        .base_size = cpu_to_be64(s->base_size),
+        .data_offset = cpu_to_be64(s->data_offset),
+    };
+    ret = bdrv_co_pwrite(bs->file, 0, sizeof(header), &header, 0);
+    if (ret == 0) {
+        goto out;
+    }
+
+fail:
+    s->dirty = true;
+out:
+    qemu_vfree(buf);
+    qemu_co_mutex_unlock(&s->flush_lock);
+    return ret;
+}
+
+static void coroutine_fn cow_overlay_write_back_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        cow_overlay_write_back(bs);
+    }
+    bdrv_dec_in_flight(bs);
+}
+
+static void cow_overlay_flush_timer_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    Coroutine *co;
+
+    /* keep drain waiting for the writeback */
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(cow_overlay_write_back_entry, bs);
+    aio_co_enter(bdrv_get_aio_context(bs), co);
+}
+
+static void cow_overlay_mark_dirty(BDRVCowOverlayState *s, uint32_t cluster)
+{
+    set_bit(cluster / COW_OVERLAY_PAGE_ENTRIES, s->dirty_pages);
+    s->dirty = true;
+    if (s->flush_timer && !timer_pending(s->flush_timer)) {
+        timer_mod(s->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  s->flush_interval_ms);
+    }
+}
+
+/*
+ * Give @cluster a slot and fill it with the base data, overwritten with
+ * @bytes at @offset of the cluster from @qiov, or with zeroes if @qiov is
+ * NULL.  Returns the slot + 1, or -errno.  *@written is false if another
+ * request allocated the cluster first and the data still has to be written.
+ */
+static int64_t coroutine_fn GRAPH_RDLOCK
+cow_overlay_alloc_cluster(BlockDriverState *bs, uint32_t cluster,
+                          uint64_t offset, uint64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          bool *written)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    uint64_t start = (uint64_t)cluster << s->cluster_bits;
+    uint64_t in_base = MIN(s->cluster_size, s->base_size - start);
+    uint8_t *buf;
+    int64_t ret;
+
+    *written = false;
+    qemu_co_mutex_lock(&s->alloc_lock);
+    if (s->map[cluster]) {
+        /* another request allocated it meanwhile */
+        ret = s->map[cluster];
+        goto out;
+    }
+
+    buf = qemu_blockalign0(bs, s->cluster_size);
+    if (offset != 0 || bytes < in_base) {
+        ret = bdrv_co_pread(s->base, start, in_base, buf, 0);
+        if (ret < 0) {
+            goto out_free;
+        }
+    }
+    if (qiov) {
+        qemu_iovec_to_buf(qiov, qiov_offset, buf + offset, bytes);
+    } else {
+        memset(buf + offset, 0, bytes);
+    }
+
+    trace_cow_overlay_alloc_cluster(bs, cluster, s->nb_slots);
+    ret = bdrv_co_pwrite(bs->file, cow_overlay_slot_offset(s, s->nb_slots),
+                         s->cluster_size, buf, 0);
+    if (ret == 0) {
+        s->map[cluster] = ++s->nb_slots;
+        cow_overlay_mark_dirty(s, cluster);
+        ret = s->map[cluster];
+        *written = true;
+    }
+
+out_free:
+    qemu_vfree(buf);
+out:
+    qemu_co_mutex_unlock(&s->alloc_lock);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov, size_t qiov_offset,
+                           BdrvRequestFlags flags)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    while (bytes > 0) {
+        uint32_t cluster = offset >> s->cluster_bits;
+        uint64_t in_cluster = offset & (s->cluster_size - 1);
+        uint32_t slot = s->map[cluster];
+        int64_t n = s->cluster_size - in_cluster;
+        uint32_t i;
+        int ret;
+
+        /* read runs of contiguous clusters from the same child at once */
+        for (i = 1; n < bytes && s->map[cluster + i] == (slot ? slot + i : 0);
+             i++) {
+            n += s->cluster_size;
+        }
+        n = MIN(n, bytes);
+
+        if (slot) {
+            ret = bdrv_co_preadv_part(bs->file,
+                                      cow_overlay_slot_offset(s, slot - 1) +
+                                      in_cluster, n, qiov, qiov_offset, 0);
+        } else {
+            ret = bdrv_co_preadv_part(s->base, offset, n, qiov, qiov_offset,
+                                      0);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_write(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, size_t qiov_offset,
+                     BdrvRequestFlags flags)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    while (bytes > 0) {
+        uint32_t cluster = offset >> s->cluster_bits;
+        uint64_t in_cluster = offset & (s->cluster_size - 1);
+        int64_t n = MIN(bytes, s->cluster_size - in_cluster);
+        int64_t slot = s->map[cluster];
+        int ret;
+
+        if (!slot) {
+            bool written;
+
+            slot = cow_overlay_alloc_cluster(bs, cluster, in_cluster, n,
+                                             qiov, qiov_offset, &written);
+            if (slot < 0) {
+                return slot;
+            }
+            if (written) {
+                goto next;
+            }
+        }
+        if (qiov) {
+            ret = bdrv_co_pwritev_part(bs->file,
+                                       cow_overlay_slot_offset(s, slot - 1) +
+                                       in_cluster, n, qiov, qiov_offset,
+                                       flags & BDRV_REQ_FUA);
+        } else {
+            ret = bdrv_co_pwrite_zeroes(bs->file,
+                                        cow_overlay_slot_offset(s, slot - 1) +
+                                        in_cluster, n, flags & BDRV_REQ_FUA);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+next:
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_pwritev_part(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, QEMUIOVector *qiov,
+                            size_t qiov_offset, BdrvRequestFlags flags)
+{
+    return cow_overlay_co_write(bs, offset, bytes, qiov, qiov_offset, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
+                             int64_t bytes, BdrvRequestFlags flags)
+{
+    return cow_overlay_co_write(bs, offset, bytes, NULL, 0, flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_flush_to_os(BlockDriverState *bs)
+{
+    return cow_overlay_write_back(bs);
+}
+
+/* Point the block layer at the overlay file or at the base */
+static int coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_block_status(BlockDriverState *bs, bool want_zero,
+                            int64_t offset, int64_t bytes, int64_t *pnum,
+                            int64_t *map, BlockDriverState **file)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    uint32_t cluster = offset >> s->cluster_bits;
+    uint64_t in_cluster = offset & (s->cluster_size - 1);
+    uint32_t slot = s->map[cluster];
+
+    *pnum = MIN(bytes, s->cluster_size - in_cluster);
+    if (slot) {
+        *map = cow_overlay_slot_offset(s, slot - 1) + in_cluster;
+        *file = bs->file->bs;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+    }
+    *map = offset;
+    *file = s->base->bs;
+    return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+cow_overlay_co_getlength(BlockDriverState *bs)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    return s->base_size;
+}
+
+static void cow_overlay_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                   BdrvChildRole role,
+                                   BlockReopenQueue *reopen_queue,
+                                   uint64_t perm, uint64_t shared,
+                                   uint64_t *nperm, uint64_t *nshared)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                       nperm, nshared);
+    if (c == s->base) {
+        /* the base is never written, it can be shared with anybody */
+        *nperm &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+    }
+}
+
+static int GRAPH_RDLOCK cow_overlay_load(BlockDriverState *bs, bool create,
+                                         Error **errp)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    CowOverlayHeader header;
+    uint64_t table_size;
+    int ret;
+
+    if (create) {
+        s->nb_slots = 0;
+    } else {
+        ret = bdrv_pread(bs->file, 0, sizeof(header), &header, 0);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read the overlay header");
+            return ret;
+        }
+        if (be64_to_cpu(header.magic) != COW_OVERLAY_MAGIC) {
+            error_setg(errp, "Image is not a cow-overlay file");
+            return -EINVAL;
+        }
+        if (be64_to_cpu(header.base_size) != s->base_size) {
+            error_setg(errp, "The overlay was made for a base of %" PRIu64
+                       " bytes, not %" PRIu64, be64_to_cpu(header.base_size),
+                       s->base_size);
+            return -EINVAL;
+        }
+        s->cluster_bits = be32_to_cpu(header.cluster_bits);
+        if (s->cluster_bits < 12 || s->cluster_bits > 21) {
+            error_setg(errp, "Unsupported overlay cluster size");
+            return -EINVAL;
+        }
+        s->nb_slots = be32_to_cpu(header.nb_slots);
+    }
+
+    s->cluster_size = 1ULL << s->cluster_bits;
+    s->nb_clusters = DIV_ROUND_UP(s->base_size, s->cluster_size);
+    s->nb_pages = DIV_ROUND_UP(s->nb_clusters, COW_OVERLAY_PAGE_ENTRIES);
+    table_size = (uint64_t)s->nb_pages * COW_OVERLAY_PAGE_SIZE;
+    s->data_offset = ROUND_UP(COW_OVERLAY_TABLE_OFFSET + table_size,
+                              s->cluster_size);
+    if (!create && be64_to_cpu(header.data_offset) != s->data_offset) {
+        error_setg(errp, "Corrupted cow-overlay header");
+        return -EINVAL;
+    }
+
+    /* one extra entry so that runs in preadv can look one cluster ahead */
+    s->map = g_new0(uint32_t, s->nb_clusters + 1);
+    s->dirty_pages = bitmap_new(s->nb_pages);
+    if (create) {
+        bitmap_set(s->dirty_pages, 0, s->nb_pages);
+        s->dirty = true;
+        return 0;
+    }
+
+    ret = bdrv_pread(bs->file, COW_OVERLAY_TABLE_OFFSET,
+                     s->nb_clusters * sizeof(uint32_t), s->map, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the overlay map");
+        return ret;
+    }
+    for (uint32_t i = 0; i < s->nb_clusters; i++) {
+        s->map[i] = be32_to_cpu(s->map[i]);
+        if (s->map[i] > s->nb_slots) {
+            error_setg(errp, "Corrupted cow-overlay map");
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static int cow_overlay_open(BlockDriverState *bs, QDict *options, int flags,
+                            Error **errp)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+    QemuOpts *opts;
+    uint64_t cluster_size;
+    int64_t len;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* the base is only read from */
+    if (!qdict_get_try_str(options, "base")) {
+        qdict_set_default_str(options, "base." BDRV_OPT_READ_ONLY, "on");
+    }
+    s->base = bdrv_open_child(NULL, options, "base", bs, &child_of_bds,
+                              BDRV_CHILD_DATA, false, errp);
+    if (!s->base) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    cluster_size = qemu_opt_get_size(opts, COW_OVERLAY_OPT_CLUSTER_SIZE,
+                                     COW_OVERLAY_DEFAULT_CLUSTER_SIZE);
+    if (cluster_size < 4 * KiB || cluster_size > 2 * MiB ||
+        !is_power_of_2(cluster_size)) {
+        error_setg(errp, "cluster-size must be a power of two between 4k "
+                   "and 2M");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->cluster_bits = ctz64(cluster_size);
+    s->flush_interval_ms = qemu_opt_get_number(opts,
+                                               COW_OVERLAY_OPT_FLUSH_INTERVAL,
+                                               COW_OVERLAY_DEFAULT_FLUSH_INTERVAL);
+    if (s->flush_interval_ms <= 0) {
+        error_setg(errp, "flush-interval must be positive");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    qemu_co_mutex_init(&s->alloc_lock);
+    qemu_co_mutex_init(&s->flush_lock);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    s->base_size = bdrv_getlength(s->base->bs);
+    if ((int64_t)s->base_size < 0) {
+        ret = s->base_size;
+        error_setg_errno(errp, -ret, "Could not get the size of the base");
+        goto out;
+    }
+    len = bdrv_getlength(bs->file->bs);
+    if (len < 0) {
+        ret = len;
+        error_setg_errno(errp, -ret, "Could not get the size of the overlay");
+        goto out;
+    }
+    if (len == 0 && bdrv_is_read_only(bs)) {
+        error_setg(errp, "The overlay is empty and can't be created "
+                   "read-only");
+        ret = -EINVAL;
+        goto out;
+    }
+    ret = cow_overlay_load(bs, len == 0, errp);
+    if (ret < 0) {
+        goto out;
+    }
+
+    s->flush_timer = aio_timer_new(bdrv_get_aio_context(bs),
+                                   QEMU_CLOCK_REALTIME, SCALE_MS,
+                                   cow_overlay_flush_timer_cb, bs);
+    if (s->dirty) {
+        /* a new overlay, get its header and map written */
+        timer_mod(s->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  s->flush_interval_ms);
+    }
+    bs->supported_write_flags = BDRV_REQ_FUA &
+                                bs->file->bs->supported_write_flags;
+    bs->supported_zero_flags = bs->supported_write_flags;
+    ret = 0;
+
+out:
+    qemu_opts_del(opts);
+    if (ret < 0) {
+        g_free(s->map);
+        g_free(s->dirty_pages);
+    }
+    return ret;
+}
+
+static void cow_overlay_detach_aio_context(BlockDriverState *bs)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    timer_free(s->flush_timer);
+    s->flush_timer = NULL;
+}
+
+static void cow_overlay_attach_aio_context(BlockDriverState *bs,
+                                           AioContext *new_context)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    s->flush_timer = aio_timer_new(new_context, QEMU_CLOCK_REALTIME, SCALE_MS,
+                                   cow_overlay_flush_timer_cb, bs);
+    if (s->dirty) {
+        timer_mod(s->flush_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  s->flush_interval_ms);
+    }
+}
+
+static void cow_overlay_close(BlockDriverState *bs)
+{
+    BDRVCowOverlayState *s = bs->opaque;
+
+    /* bdrv_close() flushed, which wrote the map back */
+    timer_free(s->flush_timer);
+    g_free(s->map);
+    g_free(s->dirty_pages);
+}
+
+static const char *const cow_overlay_strong_runtime_opts[] = {
+    "base",
+
+    NULL
+};
+
+static BlockDriver bdrv_cow_overlay = {
+    .format_name                = "cow-overlay",
+    .instance_size              = sizeof(BDRVCowOverlayState),
+    .is_format                  = true,
+
+    .bdrv_open                  = cow_overlay_open,
+    .bdrv_close                 = cow_overlay_close,
+    .bdrv_child_perm            = cow_overlay_child_perm,
+    .bdrv_co_getlength          = cow_overlay_co_getlength,
+
+    .bdrv_co_preadv_part        = cow_overlay_co_preadv_part,
+    .bdrv_co_pwritev_part       = cow_overlay_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes      = cow_overlay_co_pwrite_zeroes,
+    .bdrv_co_flush_to_os        = cow_overlay_co_flush_to_os,
+    .bdrv_co_block_status       = cow_overlay_co_block_status,
+
+    .bdrv_detach_aio_context    = cow_overlay_detach_aio_context,
+    .bdrv_attach_aio_context    = cow_overlay_attach_aio_context,
+
+    .strong_runtime_opts        = cow_overlay_strong_runtime_opts,
+};
+
+static void bdrv_cow_overlay_init(void)
+{
+    bdrv_register(&bdrv_cow_overlay);
+}
+
+block_init(bdrv_cow_overlay_init);
@@ -0,0 +1,575 @@
+/*
+ * Block protocol driver reading remote images with the Fetch/XHR API
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * In the browser this replaces preloading the whole disk image into MEMFS:
+ * the image is read in fixed-size chunks with HTTP range requests, on
+ * demand and with readahead, and a bounded number of chunks is kept in an
+ * LRU cache.  The requests are synchronous XMLHttpRequests issued from the
+ * thread pool, so the worker threads block instead of the main loop.
+ *
+ * Chunks evicted from the cache are copied to guest pages the balloon
+ * lent us, if any, where they stay until the balloon deflates.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "qemu/wasm-page-pool.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "trace.h"
+#include <emscripten.h>
+
+#define FETCH_OPT_URL           "url"
+#define FETCH_OPT_CHUNK_SIZE    "chunk-size"
+#define FETCH_OPT_READAHEAD     "readahead"
+#define FETCH_OPT_CACHE_SIZE    "cache-size"
+
+#define FETCH_DEFAULT_CHUNK_SIZE    (256 * KiB)
+#define FETCH_DEFAULT_READAHEAD     4
+#define FETCH_DEFAULT_CACHE_SIZE    (64 * MiB)
+
+typedef struct BDRVFetchState BDRVFetchState;
+
+typedef struct FetchChunk {
+    BDRVFetchState *s;
+    int64_t index;
+    uint8_t *data;
+    /* length of the chunk, only the last one of the image is shorter */
+    int len;
+    /* set until the thread pool is done with the chunk */
+    bool loading;
+    /* 0, or the error of the request once loading is clear */
+    int ret;
+    /* coroutines waiting for or copying from the chunk */
+    unsigned refs;
+    CoQueue waiters;
+    QTAILQ_ENTRY(FetchChunk) lru;
+    /*
+     * set instead of data once the chunk is evicted to lent pages, which
+     * are NULL once reclaimed; only valid with the page pool lock held
+     */
+    void **pages;
+    unsigned nr_pages;
+} FetchChunk;
+
+struct BDRVFetchState {
+    BlockDriverState *bs;
+    char *url;
+    int64_t len;
+    uint64_t chunk_size;
+    unsigned readahead;
+    unsigned max_chunks;
+    unsigned nb_chunks;
+    /* chunk index -> FetchChunk, loaded or loading */
+    GHashTable *chunks;
+    /* loaded chunks, least recently used first */
+    QTAILQ_HEAD(, FetchChunk) lru;
+};
+
+static QemuOptsList runtime_opts = {
+    .name = "fetch",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = FETCH_OPT_URL,
+            .type = QEMU_OPT_STRING,
+            .help = "URL of the image",
+        },
+        {
+            .name = FETCH_OPT_CHUNK_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the range requests (power of two)",
+        },
+        {
+            .name = FETCH_OPT_READAHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "number of chunks fetched ahead of a read",
+        },
+        {
+            .name = FETCH_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of the chunk cache",
+        },
+        { /* end of list */ }
+    },
+};
+
+/* Returns the size of the resource, or -1 */
+EM_JS(double, fetch_size_js, (const char *url), {
+        const xhr = new XMLHttpRequest();
+        xhr.open("HEAD", UTF8ToString(url), false);
+        try {
+            xhr.send();
+        } catch (e) {
+            return -1;
+        }
+        if (xhr.status < 200 || xhr.status >= 300) {
+            return -1;
+        }
+        const len = parseInt(xhr.getResponseHeader("Content-Length"), 10);
+        return isNaN(len) ? -1 : len;
+});
+
+/* Reads up to @len bytes at @offset into @buf; returns the count, or -1 */
+EM_JS(int, fetch_range_js, (const char *url, double offset, int len, uint8_t *buf), {
+        const xhr = new XMLHttpRequest();
+        xhr.open("GET", UTF8ToString(url), false);
+        // synchronous requests may only set the response type in workers
+        xhr.responseType = "arraybuffer";
+        xhr.setRequestHeader("Range", "bytes=" + offset + "-" + (offset + len - 1));
+        try {
+            xhr.send();
+        } catch (e) {
+            return -1;
+        }
+        let data;
+        if (xhr.status == 206) {
+            data = new Uint8Array(xhr.response);
+        } else if (xhr.status == 200) {
+            // the server ignored the range and sent the whole resource
+            data = new Uint8Array(xhr.response).subarray(offset);
+        } else {
+            return -1;
+        }
+        const n = Math.min(data.length, len);
+        new Uint8Array(wasmMemory.buffer, buf, n).set(data.subarray(0, n));
+        return n;
+});
+
+static void fetch_parse_filename(const char *filename, QDict *options,
+                                 Error **errp)
+{
+    const char *url;
+
+    if (!strstart(filename, "fetch:", &url) || !*url) {
+        error_setg(errp, "File name must be of the form 'fetch:<url>'");
+        return;
+    }
+    qdict_put_str(options, FETCH_OPT_URL, url);
+}
+
+static void fetch_chunk_put_pages(FetchChunk *c)
+{
+    wasm_page_pool_lock();
+    for (unsigned i = 0; i < c->nr_pages; i++) {
+        if (c->pages[i]) {
+            wasm_page_pool_return(c->pages[i]);
+        }
+    }
+    wasm_page_pool_unlock();
+    g_free(c->pages);
+    c->pages = NULL;
+    c->nr_pages = 0;
+}
+
+static void fetch_chunk_free(FetchChunk *c)
+{
+    if (c->pages) {
+        fetch_chunk_put_pages(c);
+    }
+    qemu_vfree(c->data);
+    g_free(c);
+}
+
+/* Called with the page pool lock held */
+static void fetch_chunk_reclaim(void *opaque, void *page)
+{
+    FetchChunk *c = opaque;
+
+    for (unsigned i = 0; i < c->nr_pages; i++) {
+        if (c->pages[i] == page) {
+            c->pages[i] = NULL;
+            return;
+        }
+    }
+}
+
+/* Moves the data of an idle chunk to lent pages, if there are enough */
+static bool fetch_chunk_spill(FetchChunk *c)
+{
+    size_t page_size = wasm_page_pool_page_size();
+    unsigned i;
+
+    c->nr_pages = DIV_ROUND_UP(c->len, page_size);
+    c->pages = g_new0(void *, c->nr_pages);
+
+    wasm_page_pool_lock();
+    for (i = 0; i < c->nr_pages; i++) {
+        c->pages[i] = wasm_page_pool_borrow(fetch_chunk_reclaim, c);
+        if (!c->pages[i]) {
+            break;
+        }
+        memcpy(c->pages[i], c->data + i * page_size,
+               MIN(page_size, c->len - i * page_size));
+    }
+    wasm_page_pool_unlock();
+
+    trace_fetch_chunk_spill(c->index, i == c->nr_pages);
+    if (i < c->nr_pages) {
+        fetch_chunk_put_pages(c);
+        return false;
+    }
+    qemu_vfree(c->data);
+    c->data = NULL;
+    return true;
+}
+
+/*
+ * Copies from an evicted chunk, unless a page it needs was reclaimed, in
+ * which case the chunk must be fetched again.
+ */
+static bool fetch_chunk_read_spilled(FetchChunk *c, uint64_t offset,
+                                     uint64_t bytes, QEMUIOVector *qiov,
+                                     size_t qiov_offset)
+{
+    size_t page_size = wasm_page_pool_page_size();
+    uint64_t i;
+    bool hit = true;
+
+    wasm_page_pool_lock();
+    for (i = offset / page_size; i <= (offset + bytes - 1) / page_size; i++) {
+        hit &= c->pages[i] != NULL;
+    }
+    while (hit && bytes > 0) {
+        uint64_t in_page = offset % page_size;
+        uint64_t n = MIN(bytes, page_size - in_page);
+
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            (uint8_t *)c->pages[offset / page_size] + in_page,
+                            n);
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+    wasm_page_pool_unlock();
+
+    trace_fetch_chunk_spill_read(c->index, hit);
+    return hit;
+}
+
+/* Runs in a thread pool worker */
+static int fetch_chunk_worker(void *opaque)
+{
+    FetchChunk *c = opaque;
+    BDRVFetchState *s = c->s;
+    int n;
+
+    n = fetch_range_js(s->url, (double)c->index * s->chunk_size, c->len,
+                       c->data);
+    return n == c->len ? 0 : -EIO;
+}
+
+static void fetch_chunk_done(void *opaque, int ret)
+{
+    FetchChunk *c = opaque;
+    BDRVFetchState *s = c->s;
+
+    trace_fetch_chunk_done(c->index, ret);
+    c->loading = false;
+    c->ret = ret;
+    if (ret < 0) {
+        /* drop it so that the next read tries again */
+        g_hash_table_remove(s->chunks, &c->index);
+        s->nb_chunks--;
+        qemu_co_queue_restart_all(&c->waiters);
+        if (!c->refs) {
+            fetch_chunk_free(c);
+        }
+    } else {
+        QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+        qemu_co_queue_restart_all(&c->waiters);
+    }
+    bdrv_dec_in_flight(s->bs);
+}
+
+/* Make room for one more chunk, or return false if all are in use */
+static bool fetch_cache_reserve(BDRVFetchState *s)
+{
+    FetchChunk *c;
+
+    if (s->nb_chunks < s->max_chunks) {
+        return true;
+    }
+    QTAILQ_FOREACH(c, &s->lru, lru) {
+        if (!c->refs) {
+            QTAILQ_REMOVE(&s->lru, c, lru);
+            s->nb_chunks--;
+            if (!fetch_chunk_spill(c)) {
+                g_hash_table_remove(s->chunks, &c->index);
+                fetch_chunk_free(c);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Start fetching chunk @index.  Demand reads may go over the cache limit
+ * while every chunk is in use; readahead is skipped instead.
+ */
+static FetchChunk *fetch_chunk_start(BDRVFetchState *s, int64_t index,
+                                     bool readahead)
+{
+    FetchChunk *c;
+
+    if (!fetch_cache_reserve(s) && readahead) {
+        return NULL;
+    }
+    trace_fetch_chunk_start(index, readahead);
+
+    c = g_new0(FetchChunk, 1);
+    c->s = s;
+    c->index = index;
+    c->len = MIN(s->chunk_size, s->len - index * s->chunk_size);
+    c->data = qemu_blockalign(s->bs, c->len);
+    c->loading = true;
+    qemu_co_queue_init(&c->waiters);
+    g_hash_table_insert(s->chunks, &c->index, c);
+    s->nb_chunks++;
+
+    /* keep drain waiting for readahead, which isn't part of any request */
+    bdrv_inc_in_flight(s->bs);
+    thread_pool_submit_aio(fetch_chunk_worker, c, fetch_chunk_done, c);
+    return c;
+}
+
+static void fetch_readahead(BDRVFetchState *s, int64_t index)
+{
+    int64_t nb = DIV_ROUND_UP(s->len, s->chunk_size);
+
+    for (int64_t i = index + 1; i <= index + s->readahead && i < nb; i++) {
+        if (!g_hash_table_contains(s->chunks, &i) &&
+            !fetch_chunk_start(s, i, true)) {
+            break;
+        }
+    }
+}
+
+static int coroutine_fn fetch_co_read_chunk(BDRVFetchState *s, int64_t index,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov,
+                                            size_t qiov_offset)
+{
+    FetchChunk *c = g_hash_table_lookup(s->chunks, &index);
+    int ret;
+
+    if (c && c->pages) {
+        if (fetch_chunk_read_spilled(c, offset, bytes, qiov, qiov_offset)) {
+            return 0;
+        }
+        g_hash_table_remove(s->chunks, &c->index);
+        fetch_chunk_free(c);
+        c = NULL;
+    }
+    if (!c) {
+        c = fetch_chunk_start(s, index, false);
+    }
+    c->refs++;
+    while (c->loading) {
+        qemu_co_queue_wait(&c->waiters, NULL);
+    }
+    c->refs--;
+
+    ret = c->ret;
+    if (ret < 0) {
+        if (!c->refs) {
+            fetch_chunk_free(c);
+        }
+        return ret;
+    }
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+    qemu_iovec_from_buf(qiov, qiov_offset, c->data + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn fetch_co_preadv(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes,
+                                        QEMUIOVector *qiov,
+                                        BdrvRequestFlags flags)
+{
+    BDRVFetchState *s = bs->opaque;
+    int64_t index = offset / s->chunk_size;
+    int64_t last;
+    size_t qiov_offset = 0;
+    int ret;
+
+    if (offset + bytes > s->len) {
+        int64_t tail = offset + bytes - MAX(offset, s->len);
+
+        qemu_iovec_memset(qiov, bytes - tail, 0, tail);
+        bytes -= tail;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+
+    /* fetch the missing chunks of the request in parallel */
+    last = (offset + bytes - 1) / s->chunk_size;
+    for (int64_t i = index; i <= last; i++) {
+        if (!g_hash_table_contains(s->chunks, &i)) {
+            fetch_chunk_start(s, i, false);
+        }
+    }
+    fetch_readahead(s, last);
+
+    while (bytes > 0) {
+        uint64_t chunk_offset = offset - index * s->chunk_size;
+        uint64_t n = MIN(bytes, s->chunk_size - chunk_offset);
+
+        ret = fetch_co_read_chunk(s, index, chunk_offset, n, qiov,
+                                  qiov_offset);
+        if (ret < 0) {
+            return ret;
+        }
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+        index++;
+    }
+    return 0;
+}
+
+static int fetch_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    BDRVFetchState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *url;
+    uint64_t cache_size;
+    int64_t readahead;
+    double len;
+    int ret;
+
+    bdrv_graph_rdlock_main_loop();
+    ret = bdrv_apply_auto_read_only(bs, "fetch driver does not support writes",
+                                    errp);
+    bdrv_graph_rdunlock_main_loop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    url = qemu_opt_get(opts, FETCH_OPT_URL);
+    if (!url) {
+        error_setg(errp, "fetch block driver requires an 'url' option");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->chunk_size = qemu_opt_get_size(opts, FETCH_OPT_CHUNK_SIZE,
+                                      FETCH_DEFAULT_CHUNK_SIZE);
+    if (s->chunk_size < BDRV_SECTOR_SIZE || s->chunk_size > 64 * MiB ||
+        !is_power_of_2(s->chunk_size)) {
+        error_setg(errp, "chunk-size must be a power of two between 512 "
+                   "and 64M");
+        ret = -EINVAL;
+        goto out;
+    }
+    readahead = qemu_opt_get_number(opts, FETCH_OPT_READAHEAD,
+                                    FETCH_DEFAULT_READAHEAD);
+    if (readahead < 0 || readahead > 256) {
+        error_setg(errp, "readahead must be between 0 and 256");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->readahead = readahead;
+    cache_size = qemu_opt_get_size(opts, FETCH_OPT_CACHE_SIZE,
+                                   FETCH_DEFAULT_CACHE_SIZE);
+    s->max_chunks = MAX(cache_size / s->chunk_size, s->readahead + 1);
+
+    trace_fetch_open(url);
+    len = fetch_size_js(url);
+    if (len < 0) {
+        error_setg(errp, "Could not get the size of '%s'", url);
+        ret = -EIO;
+        goto out;
+    }
+    trace_fetch_open_size(len);
+
+    s->bs = bs;
+    s->url = g_strdup(url);
+    s->len = len;
+    s->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    ret = 0;
+
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void fetch_close(BlockDriverState *bs)
+{
+    BDRVFetchState *s = bs->opaque;
+    GHashTableIter iter;
+    FetchChunk *c;
+
+    /* drained, so no chunk is loading anymore */
+    g_hash_table_iter_init(&iter, s->chunks);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&c)) {
+        fetch_chunk_free(c);
+    }
+    g_hash_table_destroy(s->chunks);
+    g_free(s->url);
+}
+
+static int64_t coroutine_fn fetch_co_getlength(BlockDriverState *bs)
+{
+    BDRVFetchState *s = bs->opaque;
+    return s->len;
+}
+
+static void fetch_refresh_filename(BlockDriverState *bs)
+{
+    BDRVFetchState *s = bs->opaque;
+
+    snprintf(bs->exact_filename, sizeof(bs->exact_filename), "fetch:%s",
+             s->url);
+}
+
+static const char *const fetch_strong_runtime_opts[] = {
+    FETCH_OPT_URL,
+
+    NULL
+};
+
+static BlockDriver bdrv_fetch = {
+    .format_name                = "fetch",
+    .protocol_name              = "fetch",
+
+    .instance_size              = sizeof(BDRVFetchState),
+    .bdrv_parse_filename        = fetch_parse_filename,
+    .bdrv_file_open             = fetch_open,
+    .bdrv_close                 = fetch_close,
+    .bdrv_co_getlength          = fetch_co_getlength,
+
+    .bdrv_co_preadv             = fetch_co_preadv,
+
+    .bdrv_refresh_filename      = fetch_refresh_filename,
+    .strong_runtime_opts        = fetch_strong_runtime_opts,
+};
+
+static void fetch_block_init(void)
+{
+    bdrv_register(&bdrv_fetch);
+}
+
+block_init(fetch_block_init);
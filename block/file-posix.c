@@ -1698,6 +1698,23 @@ qemu_pwritev(int fd, const struct iovec *iov, int nr_iov, off_t offset)
 
 #endif
 
+/*
+ * On emscripten, preadv/pwritev walk the segments in JS and each one is a
+ * separate FS read or write with its own stream and node lookups.  Below
+ * this size, copying the request through one buffer and doing a single
+ * pread/pwrite is cheaper.
+ */
+#define RAW_EMSCRIPTEN_COALESCE_MAX (256 * KiB)
+
+static bool raw_rw_coalesce(RawPosixAIOData *aiocb)
+{
+#ifdef EMSCRIPTEN
+    return aiocb->aio_nbytes <= RAW_EMSCRIPTEN_COALESCE_MAX;
+#else
+    return false;
+#endif
+}
+
 static ssize_t handle_aiocb_rw_vector(RawPosixAIOData *aiocb)
 {
     ssize_t len;
@@ -1787,7 +1804,7 @@ static int handle_aiocb_rw(void *opaque)
          * Try preadv/pwritev first and fall back to linearizing the
          * buffer if it's not supported.
          */
-        if (preadv_present) {
+        if (preadv_present && !raw_rw_coalesce(aiocb)) {
             nbytes = handle_aiocb_rw_vector(aiocb);
             if (nbytes == aiocb->aio_nbytes ||
                 (nbytes < 0 && nbytes != -ENOSYS)) {
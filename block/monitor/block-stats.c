@@ -0,0 +1,171 @@
+/*
+ * Block backend latency statistics for query-stats
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/qapi-types-stats.h"
+#include "qemu/module.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/stats.h"
+
+static const struct {
+    enum BlockAcctType type;
+    const char *name;
+} block_stats_types[] = {
+    { BLOCK_ACCT_READ, "read" },
+    { BLOCK_ACCT_WRITE, "write" },
+    { BLOCK_ACCT_FLUSH, "flush" },
+    { BLOCK_ACCT_UNMAP, "unmap" },
+};
+
+static const char *const block_stats_phases[BLOCK_ACCT_PHASE__MAX] = {
+    [BLOCK_ACCT_PHASE_TOTAL] = "total",
+    [BLOCK_ACCT_PHASE_QUEUE] = "queue",
+    [BLOCK_ACCT_PHASE_SERVICE] = "service",
+};
+
+static const struct {
+    unsigned permille;
+    const char *name;
+} block_stats_percentiles[] = {
+    { 500, "p50" },
+    { 990, "p99" },
+    { 999, "p999" },
+};
+
+static StatsList *block_stats_add(StatsList *list, strList *names,
+                                  const char *name, uint64_t v)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = v;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+/*
+ * The entries are prepended, so add them in the reverse order of the
+ * schema, which "info stats" walks in parallel.
+ */
+static StatsList *block_stats_add_type(StatsList *list, strList *names,
+                                       BlockAcctStats *stats, int i)
+{
+    g_autofree char *count_name =
+        g_strdup_printf("%s-requests", block_stats_types[i].name);
+    uint64_t samples;
+
+    block_acct_latency_percentile(stats, block_stats_types[i].type,
+                                  BLOCK_ACCT_PHASE_TOTAL, 0, &samples);
+    list = block_stats_add(list, names, count_name, samples);
+
+    for (int j = BLOCK_ACCT_PHASE__MAX - 1; j >= 0; j--) {
+        for (int k = ARRAY_SIZE(block_stats_percentiles) - 1; k >= 0; k--) {
+            g_autofree char *name =
+                g_strdup_printf("%s-%s-latency-%s", block_stats_types[i].name,
+                                block_stats_phases[j],
+                                block_stats_percentiles[k].name);
+            unsigned permille = block_stats_percentiles[k].permille;
+            uint64_t v;
+
+            v = block_acct_latency_percentile(stats, block_stats_types[i].type,
+                                              j, permille, &samples);
+            list = block_stats_add(list, names, name, v);
+        }
+    }
+    return list;
+}
+
+static void block_query_stats_cb(StatsResultList **result,
+                                 StatsTarget target, strList *names,
+                                 strList *targets, Error **errp)
+{
+    BlockBackend *blk = NULL;
+
+    if (target != STATS_TARGET_BLOCK) {
+        return;
+    }
+    while ((blk = blk_all_next(blk))) {
+        g_autofree char *id = blk_get_attached_dev_id(blk);
+        StatsList *list = NULL;
+
+        if (!*id) {
+            g_free(id);
+            id = g_strdup(blk_name(blk));
+        }
+        if (!*id || !apply_str_list_filter(id, targets)) {
+            continue;
+        }
+
+        for (int i = ARRAY_SIZE(block_stats_types) - 1; i >= 0; i--) {
+            list = block_stats_add_type(list, names, blk_get_stats(blk), i);
+        }
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_BLOCK, id, list);
+        }
+    }
+}
+
+static StatsSchemaValueList *block_schema_add(StatsSchemaValueList *list,
+                                              const char *name, bool ns)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    if (ns) {
+        value->type = STATS_TYPE_INSTANT;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = -9;
+    } else {
+        value->type = STATS_TYPE_CUMULATIVE;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void block_query_stats_schemas_cb(StatsSchemaList **result,
+                                         Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    for (int i = ARRAY_SIZE(block_stats_types) - 1; i >= 0; i--) {
+        g_autofree char *count_name =
+            g_strdup_printf("%s-requests", block_stats_types[i].name);
+
+        list = block_schema_add(list, count_name, false);
+        for (int j = BLOCK_ACCT_PHASE__MAX - 1; j >= 0; j--) {
+            for (int k = ARRAY_SIZE(block_stats_percentiles) - 1; k >= 0; k--) {
+                g_autofree char *name =
+                    g_strdup_printf("%s-%s-latency-%s",
+                                    block_stats_types[i].name,
+                                    block_stats_phases[j],
+                                    block_stats_percentiles[k].name);
+
+                list = block_schema_add(list, name, true);
+            }
+        }
+    }
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK, list);
+}
+
+static void block_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_query_stats_cb,
+                        block_query_stats_schemas_cb);
+}
+
+type_init(block_stats_register);
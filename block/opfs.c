@@ -0,0 +1,481 @@
+/*
+ * Block protocol driver for files of the Origin Private File System
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * On emscripten, file-posix goes through the JS FS layer and keeps disks
+ * in MEMFS, so they are bounded by the heap and lost on reload.  This
+ * driver keeps the image in the browser's OPFS instead and accesses it
+ * with a FileSystemSyncAccessHandle.  Such a handle is only usable from
+ * the worker that created it, so each image gets an I/O thread which
+ * opens the handle and then runs all requests on it synchronously,
+ * reading and writing the guest buffers in the shared heap directly.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+#include <emscripten.h>
+
+#define OPFS_OPT_PATH "path"
+
+typedef enum {
+    OPFS_REQ_READ,
+    OPFS_REQ_WRITE,
+    OPFS_REQ_ZEROES,
+    OPFS_REQ_FLUSH,
+    OPFS_REQ_TRUNCATE,
+    OPFS_REQ_LENGTH,
+} OPFSRequestType;
+
+typedef struct OPFSRequest {
+    OPFSRequestType type;
+    int64_t offset;
+    int64_t bytes;
+    QEMUIOVector *qiov;
+    Coroutine *co;
+    /* 0 or -errno, or the length of the file for OPFS_REQ_LENGTH */
+    int64_t ret;
+    QSIMPLEQ_ENTRY(OPFSRequest) next;
+} OPFSRequest;
+
+typedef struct BDRVOPFSState {
+    char *path;
+    /* identifies the handle in the JS state of the I/O thread */
+    int id;
+    QemuThread thread;
+    QemuSemaphore open_sem;
+    int open_done;
+    int open_ret;
+
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, OPFSRequest) queue;
+    bool stopping;
+} BDRVOPFSState;
+
+static int opfs_next_id;
+
+static QemuOptsList runtime_opts = {
+    .name = "opfs",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = OPFS_OPT_PATH,
+            .type = QEMU_OPT_STRING,
+            .help = "path of the image in the origin private file system",
+        },
+        { /* end of list */ }
+    },
+};
+
+/*
+ * Open (creating it and its directories if needed) @path in OPFS on the
+ * calling thread and set *@done_ptr once done, with *@ret_ptr set to 0 or
+ * -1.  This is asynchronous: the caller has to return to the event loop.
+ */
+EM_JS(void, opfs_open_js, (const char *path, int id, int *done_ptr, int *ret_ptr), {
+        const done = (ret) => {
+            const memory_v = new DataView(wasmMemory.buffer);
+            memory_v.setInt32(ret_ptr, ret, true);
+            memory_v.setInt32(done_ptr, 1, true);
+        };
+        const names = UTF8ToString(path).split("/").filter((n) => n.length);
+        if (typeof navigator == "undefined" || !navigator.storage ||
+            !names.length) {
+            done(-1);
+            return;
+        }
+        (async () => {
+            let dir = await navigator.storage.getDirectory();
+            for (const n of names.slice(0, -1)) {
+                dir = await dir.getDirectoryHandle(n, { create: true });
+            }
+            const file = await dir.getFileHandle(names[names.length - 1],
+                                                 { create: true });
+            const handle = await file.createSyncAccessHandle();
+            globalThis.__qemu_opfs = globalThis.__qemu_opfs || {};
+            globalThis.__qemu_opfs[id] = handle;
+        })().then(() => done(0), () => done(-1));
+});
+
+EM_JS(void, opfs_close_js, (int id), {
+        const handle = globalThis.__qemu_opfs[id];
+        delete globalThis.__qemu_opfs[id];
+        handle.close();
+});
+
+/* The functions below return the count or 0 on success, -1 on failure */
+
+EM_JS(double, opfs_rw_js, (int id, int write, double offset, uint8_t *buf, int len), {
+        const handle = globalThis.__qemu_opfs[id];
+        const view = new Uint8Array(wasmMemory.buffer, buf, len);
+        try {
+            return write ? handle.write(view, { at: offset })
+                         : handle.read(view, { at: offset });
+        } catch (e) {
+            return -1;
+        }
+});
+
+EM_JS(int, opfs_write_zeroes_js, (int id, double offset, double bytes), {
+        const handle = globalThis.__qemu_opfs[id];
+        try {
+            if (offset + bytes >= handle.getSize()) {
+                // growing the file fills it with zeroes
+                handle.truncate(offset);
+                handle.truncate(offset + bytes);
+                return 0;
+            }
+            const zeroes = new Uint8Array(Math.min(bytes, 1024 * 1024));
+            while (bytes > 0) {
+                const n = Math.min(bytes, zeroes.length);
+                if (handle.write(zeroes.subarray(0, n), { at: offset }) != n) {
+                    return -1;
+                }
+                offset += n;
+                bytes -= n;
+            }
+            return 0;
+        } catch (e) {
+            return -1;
+        }
+});
+
+EM_JS(double, opfs_ctl_js, (int id, int op, double arg), {
+        const handle = globalThis.__qemu_opfs[id];
+        try {
+            switch (op) {
+            case 0:
+                handle.flush();
+                return 0;
+            case 1:
+                handle.truncate(arg);
+                return 0;
+            default:
+                return handle.getSize();
+            }
+        } catch (e) {
+            return -1;
+        }
+});
+
+static int64_t opfs_do_rw(BDRVOPFSState *s, OPFSRequest *req)
+{
+    bool write = req->type == OPFS_REQ_WRITE;
+    int64_t offset = req->offset;
+
+    for (int i = 0; i < req->qiov->niov; i++) {
+        struct iovec *iov = &req->qiov->iov[i];
+        double n = opfs_rw_js(s->id, write, offset, iov->iov_base,
+                              iov->iov_len);
+
+        if (n < 0) {
+            return -EIO;
+        }
+        if (n < iov->iov_len) {
+            if (write) {
+                return -ENOSPC;
+            }
+            /* reads past the end of the file return zeroes */
+            qemu_iovec_memset(req->qiov, offset - req->offset + n, 0,
+                              req->bytes - (offset - req->offset + n));
+            return 0;
+        }
+        offset += n;
+    }
+    return 0;
+}
+
+static int64_t opfs_do_request(BDRVOPFSState *s, OPFSRequest *req)
+{
+    double ret;
+
+    switch (req->type) {
+    case OPFS_REQ_READ:
+    case OPFS_REQ_WRITE:
+        return opfs_do_rw(s, req);
+    case OPFS_REQ_ZEROES:
+        return opfs_write_zeroes_js(s->id, req->offset, req->bytes) < 0
+               ? -EIO : 0;
+    case OPFS_REQ_FLUSH:
+        return opfs_ctl_js(s->id, 0, 0) < 0 ? -EIO : 0;
+    case OPFS_REQ_TRUNCATE:
+        return opfs_ctl_js(s->id, 1, req->offset) < 0 ? -EIO : 0;
+    case OPFS_REQ_LENGTH:
+        ret = opfs_ctl_js(s->id, 2, 0);
+        return ret < 0 ? -EIO : ret;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void *opfs_io_thread(void *opaque)
+{
+    BDRVOPFSState *s = opaque;
+    OPFSRequest *req;
+
+    opfs_open_js(s->path, s->id, &s->open_done, &s->open_ret);
+    /* let the JS event loop of this thread resolve the promises */
+    while (!qatomic_read(&s->open_done)) {
+        emscripten_sleep(1);
+    }
+    qemu_sem_post(&s->open_sem);
+    if (s->open_ret < 0) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    while (true) {
+        while (QSIMPLEQ_EMPTY(&s->queue) && !s->stopping) {
+            qemu_cond_wait(&s->cond, &s->lock);
+        }
+        req = QSIMPLEQ_FIRST(&s->queue);
+        if (!req) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&s->queue, next);
+        qemu_mutex_unlock(&s->lock);
+
+        trace_opfs_request(s, req->type, req->offset, req->bytes);
+        req->ret = opfs_do_request(s, req);
+        aio_co_wake(req->co);
+
+        qemu_mutex_lock(&s->lock);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    opfs_close_js(s->id);
+    return NULL;
+}
+
+static int64_t coroutine_fn opfs_co_submit(BDRVOPFSState *s,
+                                           OPFSRequestType type,
+                                           int64_t offset, int64_t bytes,
+                                           QEMUIOVector *qiov)
+{
+    OPFSRequest req = {
+        .type = type,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .co = qemu_coroutine_self(),
+    };
+
+    qemu_mutex_lock(&s->lock);
+    QSIMPLEQ_INSERT_TAIL(&s->queue, &req, next);
+    qemu_cond_signal(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+
+    /* woken up by the I/O thread; it can't run before we have yielded */
+    qemu_coroutine_yield();
+    return req.ret;
+}
+
+static void opfs_parse_filename(const char *filename, QDict *options,
+                                Error **errp)
+{
+    const char *path;
+
+    if (!strstart(filename, "opfs:", &path) || !*path) {
+        error_setg(errp, "File name must be of the form 'opfs:<path>'");
+        return;
+    }
+    qdict_put_str(options, OPFS_OPT_PATH, path);
+}
+
+static int opfs_open(BlockDriverState *bs, QDict *options, int flags,
+                     Error **errp)
+{
+    BDRVOPFSState *s = bs->opaque;
+    QemuOpts *opts;
+    const char *path;
+    int ret = 0;
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    path = qemu_opt_get(opts, OPFS_OPT_PATH);
+    if (!path) {
+        error_setg(errp, "opfs block driver requires a 'path' option");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    s->path = g_strdup(path);
+    s->id = qatomic_fetch_inc(&opfs_next_id);
+    qemu_mutex_init(&s->lock);
+    qemu_cond_init(&s->cond);
+    qemu_sem_init(&s->open_sem, 0);
+    QSIMPLEQ_INIT(&s->queue);
+
+    trace_opfs_open(s, path);
+    qemu_thread_create(&s->thread, "opfs", opfs_io_thread, s,
+                       QEMU_THREAD_JOINABLE);
+    qemu_sem_wait(&s->open_sem);
+    if (s->open_ret < 0) {
+        qemu_thread_join(&s->thread);
+        error_setg(errp, "Could not open '%s' in the origin private file "
+                   "system; is it open in another tab?", path);
+        ret = -EIO;
+        goto fail;
+    }
+
+    bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP;
+    goto out;
+
+fail:
+    qemu_sem_destroy(&s->open_sem);
+    qemu_cond_destroy(&s->cond);
+    qemu_mutex_destroy(&s->lock);
+    g_free(s->path);
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void opfs_close(BlockDriverState *bs)
+{
+    BDRVOPFSState *s = bs->opaque;
+
+    qemu_mutex_lock(&s->lock);
+    s->stopping = true;
+    qemu_cond_signal(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+    qemu_thread_join(&s->thread);
+
+    qemu_sem_destroy(&s->open_sem);
+    qemu_cond_destroy(&s->cond);
+    qemu_mutex_destroy(&s->lock);
+    g_free(s->path);
+}
+
+static int coroutine_fn opfs_co_preadv(BlockDriverState *bs,
+                                       int64_t offset, int64_t bytes,
+                                       QEMUIOVector *qiov,
+                                       BdrvRequestFlags flags)
+{
+    return opfs_co_submit(bs->opaque, OPFS_REQ_READ, offset, bytes, qiov);
+}
+
+static int coroutine_fn opfs_co_pwritev(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes,
+                                        QEMUIOVector *qiov,
+                                        BdrvRequestFlags flags)
+{
+    return opfs_co_submit(bs->opaque, OPFS_REQ_WRITE, offset, bytes, qiov);
+}
+
+static int coroutine_fn opfs_co_pwrite_zeroes(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes,
+                                              BdrvRequestFlags flags)
+{
+    return opfs_co_submit(bs->opaque, OPFS_REQ_ZEROES, offset, bytes, NULL);
+}
+
+static int coroutine_fn opfs_co_flush(BlockDriverState *bs)
+{
+    return opfs_co_submit(bs->opaque, OPFS_REQ_FLUSH, 0, 0, NULL);
+}
+
+static int coroutine_fn opfs_co_truncate(BlockDriverState *bs, int64_t offset,
+                                         bool exact, PreallocMode prealloc,
+                                         BdrvRequestFlags flags, Error **errp)
+{
+    int ret;
+
+    if (prealloc != PREALLOC_MODE_OFF) {
+        error_setg(errp, "Preallocation mode '%s' unsupported for OPFS "
+                   "files", PreallocMode_str(prealloc));
+        return -ENOTSUP;
+    }
+    ret = opfs_co_submit(bs->opaque, OPFS_REQ_TRUNCATE, offset, 0, NULL);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to resize the file");
+    }
+    return ret;
+}
+
+static int64_t coroutine_fn opfs_co_getlength(BlockDriverState *bs)
+{
+    return opfs_co_submit(bs->opaque, OPFS_REQ_LENGTH, 0, 0, NULL);
+}
+
+/*
+ * OPFS files are not sparse as far as the API tells, so everything in
+ * the file is data and nothing needs to be read through another node.
+ */
+static int coroutine_fn opfs_co_block_status(BlockDriverState *bs,
+                                             bool want_zero, int64_t offset,
+                                             int64_t bytes, int64_t *pnum,
+                                             int64_t *map,
+                                             BlockDriverState **file)
+{
+    *pnum = bytes;
+    *map = offset;
+    *file = bs;
+    return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+}
+
+static int opfs_reopen_prepare(BDRVReopenState *reopen_state,
+                               BlockReopenQueue *queue, Error **errp)
+{
+    return 0;
+}
+
+static void opfs_refresh_filename(BlockDriverState *bs)
+{
+    BDRVOPFSState *s = bs->opaque;
+
+    snprintf(bs->exact_filename, sizeof(bs->exact_filename), "opfs:%s",
+             s->path);
+}
+
+static const char *const opfs_strong_runtime_opts[] = {
+    OPFS_OPT_PATH,
+
+    NULL
+};
+
+static BlockDriver bdrv_opfs = {
+    .format_name                = "opfs",
+    .protocol_name              = "opfs",
+
+    .instance_size              = sizeof(BDRVOPFSState),
+    .bdrv_parse_filename        = opfs_parse_filename,
+    .bdrv_file_open             = opfs_open,
+    .bdrv_close                 = opfs_close,
+    .bdrv_reopen_prepare        = opfs_reopen_prepare,
+    .bdrv_co_getlength          = opfs_co_getlength,
+    .bdrv_co_truncate           = opfs_co_truncate,
+
+    .bdrv_co_preadv             = opfs_co_preadv,
+    .bdrv_co_pwritev            = opfs_co_pwritev,
+    .bdrv_co_pwrite_zeroes      = opfs_co_pwrite_zeroes,
+    .bdrv_co_flush_to_disk      = opfs_co_flush,
+    .bdrv_co_block_status       = opfs_co_block_status,
+
+    .bdrv_refresh_filename      = opfs_refresh_filename,
+    .strong_runtime_opts        = opfs_strong_runtime_opts,
+};
+
+static void opfs_block_init(void)
+{
+    bdrv_register(&bdrv_opfs);
+}
+
+block_init(opfs_block_init);
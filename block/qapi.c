@@ -496,6 +496,33 @@ bdrv_latency_histogram_stats(BlockLatencyHistogram *hist)
     return info;
 }
 
+static BlockLatencyPercentiles *
+bdrv_latency_percentiles(BlockAcctStats *stats, enum BlockAcctType type,
+                         enum BlockAcctPhase phase)
+{
+    BlockLatencyPercentiles *p = g_new0(BlockLatencyPercentiles, 1);
+
+    p->p50 = block_acct_latency_percentile(stats, type, phase, 500,
+                                           &p->samples);
+    p->p99 = block_acct_latency_percentile(stats, type, phase, 990,
+                                           &p->samples);
+    p->p999 = block_acct_latency_percentile(stats, type, phase, 999,
+                                            &p->samples);
+    return p;
+}
+
+static BlockLatencyPercentilesInfo *
+bdrv_latency_percentiles_info(BlockAcctStats *stats, enum BlockAcctType type)
+{
+    BlockLatencyPercentilesInfo *info = g_new0(BlockLatencyPercentilesInfo, 1);
+
+    info->total = bdrv_latency_percentiles(stats, type, BLOCK_ACCT_PHASE_TOTAL);
+    info->queue = bdrv_latency_percentiles(stats, type, BLOCK_ACCT_PHASE_QUEUE);
+    info->service = bdrv_latency_percentiles(stats, type,
+                                             BLOCK_ACCT_PHASE_SERVICE);
+    return info;
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
@@ -591,6 +618,15 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_ZONE_APPEND]);
     ds->flush_latency_histogram
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
+
+    ds->rd_latency_percentiles =
+        bdrv_latency_percentiles_info(stats, BLOCK_ACCT_READ);
+    ds->wr_latency_percentiles =
+        bdrv_latency_percentiles_info(stats, BLOCK_ACCT_WRITE);
+    ds->flush_latency_percentiles =
+        bdrv_latency_percentiles_info(stats, BLOCK_ACCT_FLUSH);
+    ds->unmap_latency_percentiles =
+        bdrv_latency_percentiles_info(stats, BLOCK_ACCT_UNMAP);
 }
 
 static BlockStats * GRAPH_RDLOCK
@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "block/block-io.h"
+#include "qemu/heap-account.h"
 #include "qemu/memalign.h"
 #include "qcow2.h"
 #include "trace.h"
@@ -44,6 +45,8 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+    uint64_t                hits;
+    uint64_t                misses;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -143,6 +146,9 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
         g_free(c->entries);
         g_free(c);
         c = NULL;
+    } else {
+        heap_account_add(HEAP_SUBSYSTEM_BLOCK_CACHES,
+                         (size_t) num_tables * c->table_size);
     }
 
     return c;
@@ -156,6 +162,8 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    heap_account_sub(HEAP_SUBSYSTEM_BLOCK_CACHES,
+                     (size_t) c->size * c->table_size);
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -348,6 +356,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     do {
         const Qcow2CachedTable *t = &c->entries[i];
         if (t->offset == offset) {
+            c->hits++;
             goto found;
         }
         if (t->ref == 0 && t->lru_counter < min_lru_counter) {
@@ -367,6 +376,9 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     /* Cache miss: write a table back and replace it */
     i = min_lru_index;
+    if (read_from_disk) {
+        c->misses++;
+    }
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -460,3 +472,14 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+int qcow2_cache_get_num_tables(Qcow2Cache *c)
+{
+    return c->size;
+}
+
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses)
+{
+    *hits = c->hits;
+    *misses = c->misses;
+}
@@ -219,6 +219,142 @@ l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Load the L2 slices of guest slices *@next to @end - 1 into the cache,
+ * taking s->lock for one slice at a time so that requests can go between
+ * them.  Stops early when @bs is drained; *@next is where to resume.
+ */
+static void coroutine_fn GRAPH_RDLOCK
+l2_load_range(BlockDriverState *bs, int64_t *next, int64_t end)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t)s->l2_slice_size << s->cluster_bits;
+
+    for (; *next < end && !qatomic_read(&bs->quiesce_counter); (*next)++) {
+        uint64_t offset = *next * slice_bytes;
+        uint64_t l1_index = offset_to_l1_index(s, offset);
+        uint64_t l2_offset, *l2_slice;
+        int ret;
+
+        if (l1_index >= s->l1_size) {
+            *next = end;
+            break;
+        }
+        qemu_co_mutex_lock(&s->lock);
+        l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+        if (!l2_offset || offset_into_cluster(s, l2_offset) ||
+            qcow2_cache_is_table_offset(s->l2_table_cache,
+                l2_offset + l2_entry_size(s) * offset_to_l2_index(s, offset))) {
+            qemu_co_mutex_unlock(&s->lock);
+            continue;
+        }
+        ret = l2_load(bs, offset, l2_offset, &l2_slice);
+        if (ret == 0) {
+            qcow2_cache_put(s->l2_table_cache, (void **)&l2_slice);
+            s->l2_prefetches++;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret < 0) {
+            /* leave it to the request that needs the slice */
+            *next = end;
+            break;
+        }
+    }
+}
+
+typedef struct Qcow2L2Prefetch {
+    BlockDriverState *bs;
+    int64_t next;
+    int64_t end;
+} Qcow2L2Prefetch;
+
+static void coroutine_fn l2_prefetch_entry(void *opaque)
+{
+    Qcow2L2Prefetch *p = opaque;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        trace_qcow2_l2_prefetch(qemu_coroutine_self(), p->next, p->end);
+        l2_load_range(p->bs, &p->next, p->end);
+    }
+    bdrv_dec_in_flight(p->bs);
+    g_free(p);
+}
+
+/*
+ * Called with s->lock held for each L2 slice that qcow2_get_host_offset()
+ * looks at.  Reads that move on to the next slice are taken as a
+ * sequential scan, and the following slices are then loaded ahead in the
+ * background, so that their round trip overlaps with the data reads.  The
+ * window doubles with every slice that continues the scan.
+ */
+static void l2_prefetch_hint(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t slice_bytes = (uint64_t)s->l2_slice_size << s->cluster_bits;
+    int64_t slice = offset / slice_bytes;
+    Qcow2L2Prefetch *p;
+
+    if (!s->l2_prefetch || !qemu_in_coroutine() ||
+        slice == s->l2_prefetch_last) {
+        return;
+    }
+    if (slice == s->l2_prefetch_last + 1) {
+        s->l2_prefetch_window = MIN(MAX(s->l2_prefetch_window * 2, 1),
+                                    s->l2_prefetch_max);
+    } else {
+        s->l2_prefetch_window = 0;
+        s->l2_prefetch_end = 0;
+    }
+    s->l2_prefetch_last = slice;
+
+    if (!s->l2_prefetch_window ||
+        slice + 1 + s->l2_prefetch_window <= s->l2_prefetch_end) {
+        return;
+    }
+    p = g_new(Qcow2L2Prefetch, 1);
+    p->bs = bs;
+    p->next = MAX(slice + 1, s->l2_prefetch_end);
+    p->end = slice + 1 + s->l2_prefetch_window;
+    s->l2_prefetch_end = p->end;
+
+    /* keep drain waiting for it, it isn't part of any request */
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(l2_prefetch_entry, p));
+}
+
+static void coroutine_fn l2_preload_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        trace_qcow2_l2_preload(qemu_coroutine_self(), s->l2_preload_next,
+                               s->l2_preload_end);
+        l2_load_range(bs, &s->l2_preload_next, s->l2_preload_end);
+    }
+    s->l2_preload_running = false;
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Start or resume loading all L2 slices of the image into the cache in the
+ * background.  It pauses while @bs is drained.
+ */
+void qcow2_l2_preload_start(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->l2_preload || s->l2_preload_running ||
+        s->l2_preload_next >= s->l2_preload_end) {
+        return;
+    }
+    s->l2_preload_running = true;
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(l2_preload_entry, bs));
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -639,6 +775,7 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
     if (ret < 0) {
         return ret;
     }
+    l2_prefetch_hint(bs, offset);
 
     /* find the cluster offset for the given disk offset */
 
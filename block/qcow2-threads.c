@@ -388,6 +388,55 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
     return qcow2_co_do_compress(bs, dest, dest_size, src, src_size, fn);
 }
 
+/*
+ * Decompression buffers
+ *
+ * Reads of compressed clusters need a cluster-sized buffer each.  Up to
+ * QCOW2_MAX_DECOMPRESS_BUFS of them are kept around when they are released,
+ * with the list entry stored in the free buffer itself.
+ */
+
+struct Qcow2FreeBuf {
+    QSLIST_ENTRY(Qcow2FreeBuf) next;
+};
+
+void *qcow2_decompress_buf_get(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeBuf *buf = QSLIST_FIRST(&s->decompress_bufs);
+
+    if (!buf) {
+        return qemu_blockalign(bs, s->cluster_size);
+    }
+    QSLIST_REMOVE_HEAD(&s->decompress_bufs, next);
+    s->nb_decompress_bufs--;
+    return buf;
+}
+
+void qcow2_decompress_buf_put(BlockDriverState *bs, void *buf)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->nb_decompress_bufs >= QCOW2_MAX_DECOMPRESS_BUFS) {
+        qemu_vfree(buf);
+        return;
+    }
+    QSLIST_INSERT_HEAD(&s->decompress_bufs, (Qcow2FreeBuf *)buf, next);
+    s->nb_decompress_bufs++;
+}
+
+void qcow2_decompress_bufs_free(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2FreeBuf *buf;
+
+    while ((buf = QSLIST_FIRST(&s->decompress_bufs))) {
+        QSLIST_REMOVE_HEAD(&s->decompress_bufs, next);
+        qemu_vfree(buf);
+    }
+    s->nb_decompress_bufs = 0;
+}
+
 /*
  * qcow2_co_decompress()
  *
@@ -701,6 +701,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_L2_PREFETCH,
     NULL
 };
 
@@ -817,6 +818,16 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_L2_PREFETCH,
+            .type = QEMU_OPT_BOOL,
+            .help = "Load L2 slices ahead of sequential reads",
+        },
+        {
+            .name = QCOW2_OPT_L2_PRELOAD,
+            .type = QEMU_OPT_BOOL,
+            .help = "Load all L2 tables after open if they fit in the cache",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -878,6 +889,12 @@ static void qcow2_attach_aio_context(BlockDriverState *bs,
     cache_clean_timer_init(bs, new_context);
 }
 
+static void qcow2_drain_end(BlockDriverState *bs)
+{
+    /* the L2 preload stops while drained */
+    qcow2_l2_preload_start(bs);
+}
+
 static bool read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
                              uint64_t *l2_cache_size,
                              uint64_t *l2_cache_entry_size,
@@ -979,6 +996,9 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    bool l2_prefetch;
+    unsigned l2_prefetch_max;
+    bool l2_preload;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1061,6 +1081,11 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->l2_prefetch = qemu_opt_get_bool(opts, QCOW2_OPT_L2_PREFETCH, true);
+    /* don't let the prefetched slices push out more than a quarter */
+    r->l2_prefetch_max = MIN(QCOW2_L2_PREFETCH_MAX, l2_cache_size / 4);
+    r->l2_preload = qemu_opt_get_bool(opts, QCOW2_OPT_L2_PRELOAD, false);
+
     /* New interval for cache cleanup timer */
     r->cache_clean_interval =
         qemu_opt_get_number(opts, QCOW2_OPT_CACHE_CLEAN_INTERVAL,
@@ -1239,6 +1264,13 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
 
     s->discard_no_unref = r->discard_no_unref;
 
+    s->l2_prefetch = r->l2_prefetch;
+    s->l2_prefetch_max = r->l2_prefetch_max;
+    s->l2_prefetch_window = 0;
+    s->l2_prefetch_last = -1;
+    s->l2_prefetch_end = 0;
+    s->l2_preload = r->l2_preload;
+
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
         s->cache_clean_interval = r->cache_clean_interval;
@@ -1875,6 +1907,25 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 
     qemu_co_queue_init(&s->thread_task_queue);
 
+    /* Small images: load all of their L2 tables if they fit in the cache */
+    s->l2_preload_next = 0;
+    s->l2_preload_end = 0;
+    if (s->l2_preload && !(flags & BDRV_O_INACTIVE)) {
+        uint64_t slices = 0;
+
+        for (unsigned j = 0; j < s->l1_size; j++) {
+            if (s->l1_table[j] & L1E_OFFSET_MASK) {
+                slices += s->l2_size / s->l2_slice_size;
+            }
+        }
+        if (slices <= qcow2_cache_get_num_tables(s->l2_table_cache)) {
+            s->l2_preload_end =
+                DIV_ROUND_UP(bs->total_sectors * BDRV_SECTOR_SIZE,
+                             (uint64_t)s->l2_slice_size << s->cluster_bits);
+            qcow2_l2_preload_start(bs);
+        }
+    }
+
     return ret;
 
  fail:
@@ -2369,6 +2420,184 @@ static int coroutine_fn GRAPH_RDLOCK qcow2_co_preadv_task_entry(AioTask *task)
                                 t->qiov, t->qiov_offset);
 }
 
+/*
+ * A run of compressed clusters whose data lies back to back in the image
+ * file.  The compressed data is read with a single request and then the
+ * clusters are decompressed in parallel.
+ */
+typedef struct Qcow2CompressedRunTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+    int nb_clusters;
+    struct {
+        uint64_t l2_entry;
+        uint64_t bytes;
+    } clusters[QCOW2_MAX_COMPRESSED_RUN];
+} Qcow2CompressedRunTask;
+
+typedef struct Qcow2DecompressTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    const uint8_t *buf;
+    int csize;
+    int offset_in_cluster;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+} Qcow2DecompressTask;
+
+static coroutine_fn int qcow2_co_decompress_task_entry(AioTask *task)
+{
+    Qcow2DecompressTask *t = container_of(task, Qcow2DecompressTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    uint8_t *out_buf = qcow2_decompress_buf_get(t->bs);
+    int ret = 0;
+
+    if (qcow2_co_decompress(t->bs, out_buf, s->cluster_size,
+                            t->buf, t->csize) < 0)
+    {
+        ret = -EIO;
+        goto out;
+    }
+
+    qemu_iovec_from_buf(t->qiov, t->qiov_offset,
+                        out_buf + t->offset_in_cluster, t->bytes);
+
+out:
+    qcow2_decompress_buf_put(t->bs, out_buf);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed_run(Qcow2CompressedRunTask *run)
+{
+    BlockDriverState *bs = run->bs;
+    AioTaskPool *aio;
+    uint64_t start = 0, end = 0;
+    uint64_t coffsets[QCOW2_MAX_COMPRESSED_RUN];
+    int csizes[QCOW2_MAX_COMPRESSED_RUN];
+    size_t qiov_offset = run->qiov_offset;
+    uint8_t *buf;
+    int i, ret;
+
+    for (i = 0; i < run->nb_clusters; i++) {
+        qcow2_parse_compressed_l2_entry(bs, run->clusters[i].l2_entry,
+                                        &coffsets[i], &csizes[i]);
+        if (i == 0) {
+            start = coffsets[i];
+        }
+        end = MAX(end, coffsets[i] + csizes[i]);
+    }
+
+    trace_qcow2_co_preadv_compressed_run(qemu_coroutine_self(), bs,
+                                         run->offset, run->nb_clusters,
+                                         start, end - start);
+
+    buf = g_try_malloc(end - start);
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+    ret = bdrv_co_pread(bs->file, start, end - start, buf, 0);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    aio = aio_task_pool_new(QCOW2_MAX_THREADS);
+    for (i = 0; i < run->nb_clusters && aio_task_pool_status(aio) == 0; i++) {
+        Qcow2DecompressTask *t = g_new(Qcow2DecompressTask, 1);
+
+        *t = (Qcow2DecompressTask) {
+            .task.func = qcow2_co_decompress_task_entry,
+            .bs = bs,
+            .buf = buf + (coffsets[i] - start),
+            .csize = csizes[i],
+            .offset_in_cluster = i ? 0 : offset_into_cluster(bs->opaque,
+                                                             run->offset),
+            .bytes = run->clusters[i].bytes,
+            .qiov = run->qiov,
+            .qiov_offset = qiov_offset,
+        };
+        aio_task_pool_start_task(aio, &t->task);
+        qiov_offset += run->clusters[i].bytes;
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    g_free(aio);
+
+fail:
+    g_free(buf);
+    return ret;
+}
+
+/*
+ * This function can count as GRAPH_RDLOCK because qcow2_co_preadv_part() holds
+ * the graph lock and keeps it until this coroutine has terminated.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_preadv_compressed_run_entry(AioTask *task)
+{
+    return qcow2_co_preadv_compressed_run(
+        container_of(task, Qcow2CompressedRunTask, task));
+}
+
+/*
+ * Extend @run, whose first cluster has already been looked up, by the
+ * following compressed clusters as long as their data directly follows the
+ * data of the previous one in the image file.  Returns the number of bytes
+ * covered by the run.
+ */
+static uint64_t coroutine_fn GRAPH_RDLOCK
+qcow2_collect_compressed_run(BlockDriverState *bs, Qcow2CompressedRunTask *run,
+                             uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t done = run->clusters[0].bytes;
+    uint64_t start, end, coffset;
+    int csize;
+
+    qcow2_parse_compressed_l2_entry(bs, run->clusters[0].l2_entry,
+                                    &start, &csize);
+    end = start + csize;
+
+    qemu_co_mutex_lock(&s->lock);
+    while (done < bytes && run->nb_clusters < QCOW2_MAX_COMPRESSED_RUN) {
+        unsigned int cur_bytes = MIN(bytes - done, INT_MAX);
+        uint64_t l2_entry;
+        QCow2SubclusterType type;
+
+        if (qcow2_get_host_offset(bs, run->offset + done, &cur_bytes,
+                                  &l2_entry, &type) < 0 ||
+            type != QCOW2_SUBCLUSTER_COMPRESSED)
+        {
+            break;
+        }
+
+        qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+        if (coffset < start || coffset > end ||
+            coffset + csize - start >
+            (uint64_t)QCOW2_MAX_COMPRESSED_RUN * s->cluster_size)
+        {
+            break;
+        }
+        end = MAX(end, coffset + csize);
+
+        run->clusters[run->nb_clusters].l2_entry = l2_entry;
+        run->clusters[run->nb_clusters].bytes = cur_bytes;
+        run->nb_clusters++;
+        done += cur_bytes;
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return done;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                      QEMUIOVector *qiov, size_t qiov_offset,
@@ -2403,6 +2632,32 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             (type == QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC && !bs->backing))
         {
             qemu_iovec_memset(qiov, qiov_offset, 0, cur_bytes);
+        } else if (type == QCOW2_SUBCLUSTER_COMPRESSED && cur_bytes != bytes) {
+            Qcow2CompressedRunTask *run = g_new(Qcow2CompressedRunTask, 1);
+
+            *run = (Qcow2CompressedRunTask) {
+                .task.func = qcow2_co_preadv_compressed_run_entry,
+                .bs = bs,
+                .offset = offset,
+                .qiov = qiov,
+                .qiov_offset = qiov_offset,
+                .nb_clusters = 1,
+                .clusters[0] = { host_offset, cur_bytes },
+            };
+            cur_bytes = qcow2_collect_compressed_run(bs, run, bytes);
+
+            if (!aio && cur_bytes != bytes) {
+                aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            }
+            if (aio) {
+                aio_task_pool_start_task(aio, &run->task);
+            } else {
+                ret = qcow2_co_preadv_compressed_run(run);
+                g_free(run);
+                if (ret < 0) {
+                    goto out;
+                }
+            }
         } else {
             if (!aio && cur_bytes != bytes) {
                 aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
@@ -2792,6 +3047,7 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_decompress_bufs_free(bs);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4823,7 +5079,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
+    out_buf = qcow2_decompress_buf_get(bs);
 
     BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
@@ -4839,7 +5095,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
 fail:
-    qemu_vfree(out_buf);
+    qcow2_decompress_buf_put(bs, out_buf);
     g_free(buf);
 
     return ret;
@@ -5311,6 +5567,22 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BlockStatsSpecificQcow2 *q = &stats->u.qcow2;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    qcow2_cache_get_stats(s->l2_table_cache, &q->l2_cache_hits,
+                          &q->l2_cache_misses);
+    qcow2_cache_get_stats(s->refcount_block_cache, &q->refcount_cache_hits,
+                          &q->refcount_cache_misses);
+    q->l2_prefetches = s->l2_prefetches;
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -6160,6 +6432,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -6182,6 +6455,7 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_detach_aio_context            = qcow2_detach_aio_context,
     .bdrv_attach_aio_context            = qcow2_attach_aio_context,
+    .bdrv_drain_end                     = qcow2_drain_end,
 
     .bdrv_supports_persistent_dirty_bitmap =
             qcow2_supports_persistent_dirty_bitmap,
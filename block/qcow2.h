@@ -114,6 +114,9 @@
 /* Must be at least 2 to cover COW */
 #define MIN_L2_CACHE_SIZE 2 /* cache entries */
 
+/* Most L2 slices loaded ahead of a sequential scan */
+#define QCOW2_L2_PREFETCH_MAX 8
+
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define MIN_REFCOUNT_CACHE_SIZE 4 /* clusters */
 
@@ -150,6 +153,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_L2_PREFETCH "l2-prefetch"
+#define QCOW2_OPT_L2_PRELOAD "l2-preload"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -324,6 +329,14 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+/* Most compressed clusters read from the image file at once */
+#define QCOW2_MAX_COMPRESSED_RUN 16
+
+/* Decompression buffers kept for reuse */
+#define QCOW2_MAX_DECOMPRESS_BUFS (2 * QCOW2_MAX_THREADS)
+
+typedef struct Qcow2FreeBuf Qcow2FreeBuf;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -348,6 +361,20 @@ typedef struct BDRVQcow2State {
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /* L2 slices loaded ahead of sequential reads, in guest slice indexes */
+    bool l2_prefetch;
+    unsigned l2_prefetch_max;
+    unsigned l2_prefetch_window;
+    int64_t l2_prefetch_last;
+    int64_t l2_prefetch_end;
+    uint64_t l2_prefetches;
+
+    /* all L2 slices loaded in the background after open */
+    bool l2_preload;
+    bool l2_preload_running;
+    int64_t l2_preload_next;
+    int64_t l2_preload_end;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -411,6 +438,13 @@ typedef struct BDRVQcow2State {
     CoQueue thread_task_queue;
     int nb_threads;
 
+    /*
+     * Free cluster-sized buffers for decompressed data; only used from the
+     * AioContext of the node
+     */
+    QSLIST_HEAD(, Qcow2FreeBuf) decompress_bufs;
+    unsigned nb_decompress_bufs;
+
     BdrvChild *data_file;
 
     bool metadata_preallocation_checked;
@@ -932,6 +966,8 @@ qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
 
+void qcow2_l2_preload_start(BlockDriverState *bs);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
@@ -1021,6 +1057,8 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+int qcow2_cache_get_num_tables(Qcow2Cache *c);
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -1064,6 +1102,9 @@ qcow2_co_compress(BlockDriverState *bs, void *dest, size_t dest_size,
 ssize_t coroutine_fn
 qcow2_co_decompress(BlockDriverState *bs, void *dest, size_t dest_size,
                     const void *src, size_t src_size);
+void *qcow2_decompress_buf_get(BlockDriverState *bs);
+void qcow2_decompress_buf_put(BlockDriverState *bs, void *buf);
+void qcow2_decompress_bufs_free(BlockDriverState *bs);
 int coroutine_fn
 qcow2_co_encrypt(BlockDriverState *bs, uint64_t host_offset,
                  uint64_t guest_offset, void *buf, size_t len);
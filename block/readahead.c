@@ -0,0 +1,648 @@
+/*
+ * Read-ahead filter driver
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The filter is inserted above a node with high request latency.  It
+ * watches for sequential streams of reads and, once a stream is found,
+ * reads the data following it in larger chunks in the background.  Later
+ * reads of the stream are answered from the chunk cache.  Reads that are
+ * neither sequential nor cached are passed through unchanged.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/coroutine.h"
+#include "qemu/heap-account.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define READAHEAD_OPT_CHUNK_SIZE    "chunk-size"
+#define READAHEAD_OPT_WINDOW        "window"
+#define READAHEAD_OPT_CACHE_SIZE    "cache-size"
+
+#define READAHEAD_DEFAULT_CHUNK_SIZE    (128 * KiB)
+#define READAHEAD_DEFAULT_WINDOW        (2 * MiB)
+#define READAHEAD_DEFAULT_CACHE_SIZE    (16 * MiB)
+#define READAHEAD_MAX_CHUNK_SIZE        (16 * MiB)
+
+/* Number of interleaved sequential streams that are told apart */
+#define READAHEAD_MAX_STREAMS   4
+
+/* Reads following each other before a stream counts as sequential */
+#define READAHEAD_MIN_SEQUENTIAL    2
+
+typedef struct ReadaheadOpts {
+    uint64_t chunk_size;
+    uint64_t window;
+    uint64_t cache_size;
+} ReadaheadOpts;
+
+typedef struct BDRVReadaheadState BDRVReadaheadState;
+
+typedef struct ReadaheadChunk {
+    BDRVReadaheadState *s;
+    int64_t index;
+    uint8_t *data;
+    /* length of the chunk, only the last one of the node is shorter */
+    int64_t len;
+    /* set until the read of the chunk has completed */
+    bool loading;
+    /* set once the chunk has been dropped from the cache */
+    bool stale;
+    /* coroutines waiting for or copying from the chunk */
+    unsigned refs;
+    CoQueue waiters;
+    QTAILQ_ENTRY(ReadaheadChunk) lru;
+} ReadaheadChunk;
+
+typedef struct ReadaheadStream {
+    /* offset at which the next read of the stream is expected */
+    int64_t next;
+    /* end of the data read ahead for the stream so far */
+    int64_t ra_end;
+    /* current size of the read-ahead window, grows up to opts.window */
+    int64_t window;
+    /* number of reads that followed each other */
+    unsigned seq;
+    /* for replacing the least recently used stream */
+    uint64_t last_use;
+} ReadaheadStream;
+
+struct BDRVReadaheadState {
+    BlockDriverState *bs;
+    ReadaheadOpts opts;
+    int64_t len;
+    unsigned max_chunks;
+    unsigned nb_chunks;
+    /* chunk index -> ReadaheadChunk, loaded or loading */
+    GHashTable *chunks;
+    /* loaded chunks, least recently used first */
+    QTAILQ_HEAD(, ReadaheadChunk) lru;
+    ReadaheadStream streams[READAHEAD_MAX_STREAMS];
+    uint64_t nb_reads;
+};
+
+static QemuOptsList runtime_opts = {
+    .name = "readahead",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READAHEAD_OPT_CHUNK_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the read-ahead requests (power of two)",
+        },
+        {
+            .name = READAHEAD_OPT_WINDOW,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum amount of data read ahead of a sequential "
+                    "stream, default 2M",
+        },
+        {
+            .name = READAHEAD_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of the chunk cache, default 16M",
+        },
+        { /* end of list */ }
+    },
+};
+
+static bool readahead_absorb_opts(ReadaheadOpts *dest, QDict *options,
+                                  Error **errp)
+{
+    QemuOpts *opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return false;
+    }
+
+    dest->chunk_size = qemu_opt_get_size(opts, READAHEAD_OPT_CHUNK_SIZE,
+                                         READAHEAD_DEFAULT_CHUNK_SIZE);
+    dest->window = qemu_opt_get_size(opts, READAHEAD_OPT_WINDOW,
+                                     READAHEAD_DEFAULT_WINDOW);
+    dest->cache_size = qemu_opt_get_size(opts, READAHEAD_OPT_CACHE_SIZE,
+                                         READAHEAD_DEFAULT_CACHE_SIZE);
+
+    qemu_opts_del(opts);
+
+    if (dest->chunk_size < BDRV_SECTOR_SIZE ||
+        dest->chunk_size > READAHEAD_MAX_CHUNK_SIZE ||
+        !is_power_of_2(dest->chunk_size)) {
+        error_setg(errp, "chunk-size must be a power of two between %llu "
+                   "and %" PRId64, BDRV_SECTOR_SIZE, READAHEAD_MAX_CHUNK_SIZE);
+        return false;
+    }
+    if (dest->window > dest->cache_size) {
+        error_setg(errp, "window must not be larger than cache-size");
+        return false;
+    }
+    if (dest->cache_size / dest->chunk_size > UINT_MAX) {
+        error_setg(errp, "cache-size is too large");
+        return false;
+    }
+
+    return true;
+}
+
+static void readahead_chunk_free(ReadaheadChunk *c)
+{
+    heap_account_sub(HEAP_SUBSYSTEM_BLOCK_CACHES, c->len);
+    qemu_vfree(c->data);
+    g_free(c);
+}
+
+/*
+ * Take @c out of the cache.  The caller has already removed it from the
+ * hash table; readers still waiting for it fall back to the child.
+ */
+static void readahead_chunk_drop(BDRVReadaheadState *s, ReadaheadChunk *c)
+{
+    s->nb_chunks--;
+    c->stale = true;
+    if (c->loading) {
+        /* freed when the read completes */
+        return;
+    }
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    if (!c->refs) {
+        readahead_chunk_free(c);
+    }
+}
+
+/* Drop the chunks overlapping [@offset, @offset + @bytes) */
+static void readahead_invalidate(BDRVReadaheadState *s, int64_t offset,
+                                 int64_t bytes)
+{
+    int64_t last;
+
+    if (bytes <= 0) {
+        return;
+    }
+    last = (offset + bytes - 1) / s->opts.chunk_size;
+    for (int64_t i = offset / s->opts.chunk_size; i <= last; i++) {
+        ReadaheadChunk *c = g_hash_table_lookup(s->chunks, &i);
+
+        if (c) {
+            g_hash_table_remove(s->chunks, &i);
+            readahead_chunk_drop(s, c);
+        }
+    }
+}
+
+static void readahead_invalidate_all(BDRVReadaheadState *s)
+{
+    GHashTableIter iter;
+    ReadaheadChunk *c;
+
+    g_hash_table_iter_init(&iter, s->chunks);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&c)) {
+        g_hash_table_iter_remove(&iter);
+        readahead_chunk_drop(s, c);
+    }
+    memset(s->streams, 0, sizeof(s->streams));
+}
+
+static void coroutine_fn readahead_chunk_load_entry(void *opaque)
+{
+    ReadaheadChunk *c = opaque;
+    BDRVReadaheadState *s = c->s;
+    int ret;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = bdrv_co_pread(s->bs->file, c->index * s->opts.chunk_size,
+                            c->len, c->data, 0);
+    }
+    trace_readahead_chunk_done(s->bs, c->index, ret);
+
+    c->loading = false;
+    if (c->stale) {
+        qemu_co_queue_restart_all(&c->waiters);
+        if (!c->refs) {
+            readahead_chunk_free(c);
+        }
+    } else if (ret < 0) {
+        /* drop it so that the failing reads go to the child again */
+        g_hash_table_remove(s->chunks, &c->index);
+        s->nb_chunks--;
+        c->stale = true;
+        qemu_co_queue_restart_all(&c->waiters);
+        if (!c->refs) {
+            readahead_chunk_free(c);
+        }
+    } else {
+        QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+        qemu_co_queue_restart_all(&c->waiters);
+    }
+    bdrv_dec_in_flight(s->bs);
+}
+
+/* Make room for one more chunk, or return false if all are in use */
+static bool readahead_cache_reserve(BDRVReadaheadState *s)
+{
+    ReadaheadChunk *c;
+
+    if (s->nb_chunks < s->max_chunks) {
+        return true;
+    }
+    QTAILQ_FOREACH(c, &s->lru, lru) {
+        if (!c->refs) {
+            g_hash_table_remove(s->chunks, &c->index);
+            readahead_chunk_drop(s, c);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Start reading chunk @index in the background */
+static bool readahead_chunk_start(BDRVReadaheadState *s, int64_t index)
+{
+    ReadaheadChunk *c;
+    int64_t len = MIN(s->opts.chunk_size,
+                      s->len - index * s->opts.chunk_size);
+    uint8_t *data;
+
+    if (!readahead_cache_reserve(s)) {
+        return false;
+    }
+    data = qemu_try_blockalign(s->bs, len);
+    if (!data) {
+        return false;
+    }
+    trace_readahead_chunk_start(s->bs, index);
+    heap_account_add(HEAP_SUBSYSTEM_BLOCK_CACHES, len);
+
+    c = g_new0(ReadaheadChunk, 1);
+    c->s = s;
+    c->index = index;
+    c->data = data;
+    c->len = len;
+    c->loading = true;
+    qemu_co_queue_init(&c->waiters);
+    g_hash_table_insert(s->chunks, &c->index, c);
+    s->nb_chunks++;
+
+    /* keep drain waiting for read-ahead, which isn't part of any request */
+    bdrv_inc_in_flight(s->bs);
+    aio_co_enter(bdrv_get_aio_context(s->bs),
+                 qemu_coroutine_create(readahead_chunk_load_entry, c));
+    return true;
+}
+
+/*
+ * Account a read of [@offset, @offset + @bytes) to the stream it continues,
+ * or start tracking a new stream, and read ahead if the stream is
+ * sequential.
+ */
+static void readahead_update_streams(BDRVReadaheadState *s, int64_t offset,
+                                     int64_t bytes)
+{
+    ReadaheadStream *st = NULL;
+    int64_t end = offset + bytes;
+    int64_t ra_target;
+
+    for (int i = 0; i < READAHEAD_MAX_STREAMS; i++) {
+        ReadaheadStream *cur = &s->streams[i];
+
+        if (cur->seq && cur->next == offset) {
+            st = cur;
+            break;
+        }
+        if (!st || cur->last_use < st->last_use) {
+            st = cur;
+        }
+    }
+
+    if (st->seq && st->next == offset) {
+        st->seq++;
+    } else {
+        *st = (ReadaheadStream) { .seq = 1 };
+    }
+    st->next = end;
+    st->last_use = ++s->nb_reads;
+
+    if (st->seq < READAHEAD_MIN_SEQUENTIAL || !s->opts.window) {
+        return;
+    }
+
+    /* start small and grow the window while the stream goes on */
+    if (!st->window) {
+        st->window = MAX(4 * bytes, s->opts.chunk_size);
+    } else {
+        st->window *= 2;
+    }
+    st->window = MIN(st->window, s->opts.window);
+
+    ra_target = MIN(end + st->window, s->len);
+    if (st->ra_end < end) {
+        st->ra_end = end;
+    }
+    if (st->ra_end >= ra_target) {
+        return;
+    }
+    trace_readahead_stream(s->bs, offset, st->ra_end, ra_target);
+
+    while (st->ra_end < ra_target) {
+        int64_t index = st->ra_end / s->opts.chunk_size;
+
+        if (!g_hash_table_contains(s->chunks, &index) &&
+            !readahead_chunk_start(s, index)) {
+            break;
+        }
+        st->ra_end = (index + 1) * s->opts.chunk_size;
+    }
+}
+
+/*
+ * Copy from chunk @c, waiting for it if it is still being read.  Returns 1
+ * if the chunk could not be used and the data must be read from the child.
+ */
+static int coroutine_fn
+readahead_co_read_chunk(BDRVReadaheadState *s, ReadaheadChunk *c,
+                        uint64_t offset, uint64_t bytes, QEMUIOVector *qiov,
+                        size_t qiov_offset)
+{
+    c->refs++;
+    while (c->loading) {
+        qemu_co_queue_wait(&c->waiters, NULL);
+    }
+    c->refs--;
+
+    if (c->stale) {
+        if (!c->refs) {
+            readahead_chunk_free(c);
+        }
+        return 1;
+    }
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    QTAILQ_INSERT_TAIL(&s->lru, c, lru);
+    qemu_iovec_from_buf(qiov, qiov_offset, c->data + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                         QEMUIOVector *qiov, size_t qiov_offset,
+                         BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    if (offset + bytes > s->len) {
+        /* the length changed under us, leave this one to the child */
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+    }
+
+    readahead_update_streams(s, offset, bytes);
+
+    while (bytes > 0) {
+        int64_t index = offset / s->opts.chunk_size;
+        uint64_t chunk_offset = offset - index * s->opts.chunk_size;
+        int64_t n = MIN(bytes, s->opts.chunk_size - chunk_offset);
+        ReadaheadChunk *c = g_hash_table_lookup(s->chunks, &index);
+
+        ret = 1;
+        if (c) {
+            ret = readahead_co_read_chunk(s, c, chunk_offset, n, qiov,
+                                          qiov_offset);
+        } else {
+            /* pass the uncached part through in one request */
+            while (n < bytes) {
+                int64_t next = (offset + n) / s->opts.chunk_size;
+
+                if (g_hash_table_contains(s->chunks, &next)) {
+                    break;
+                }
+                n = MIN(bytes, n + s->opts.chunk_size);
+            }
+        }
+        if (ret) {
+            ret = bdrv_co_preadv_part(bs->file, offset, n, qiov, qiov_offset,
+                                      flags);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                          QEMUIOVector *qiov, size_t qiov_offset,
+                          BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    /*
+     * Invalidate before and after the write: read-ahead started while the
+     * write is in flight may still see the old data.
+     */
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    readahead_invalidate(s, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           BdrvRequestFlags flags)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+    readahead_invalidate(s, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int ret;
+
+    readahead_invalidate(s, offset, bytes);
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    readahead_invalidate(s, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+readahead_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                      PreallocMode prealloc, BdrvRequestFlags flags,
+                      Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    int64_t len;
+    int ret;
+
+    readahead_invalidate_all(s);
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    readahead_invalidate_all(s);
+
+    len = bdrv_co_getlength(bs->file->bs);
+    if (len >= 0) {
+        s->len = len;
+    }
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK readahead_co_flush(BlockDriverState *bs)
+{
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+readahead_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static void readahead_apply_opts(BDRVReadaheadState *s, ReadaheadOpts *opts)
+{
+    s->opts = *opts;
+    s->max_chunks = MAX(s->opts.cache_size / s->opts.chunk_size, 1);
+}
+
+static int readahead_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVReadaheadState *s = bs->opaque;
+    ReadaheadOpts opts;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    if (!readahead_absorb_opts(&opts, options, errp)) {
+        return -EINVAL;
+    }
+
+    s->len = bdrv_getlength(bs->file->bs);
+    if (s->len < 0) {
+        error_setg_errno(errp, -s->len, "Failed to get length");
+        return s->len;
+    }
+
+    s->bs = bs;
+    readahead_apply_opts(s, &opts);
+    s->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void readahead_close(BlockDriverState *bs)
+{
+    BDRVReadaheadState *s = bs->opaque;
+
+    /* drained, so no chunk is loading or referenced */
+    readahead_invalidate_all(s);
+    g_hash_table_destroy(s->chunks);
+}
+
+static int readahead_reopen_prepare(BDRVReopenState *reopen_state,
+                                    BlockReopenQueue *queue, Error **errp)
+{
+    ReadaheadOpts *opts = g_new0(ReadaheadOpts, 1);
+
+    if (!readahead_absorb_opts(opts, reopen_state->options, errp)) {
+        g_free(opts);
+        return -EINVAL;
+    }
+
+    reopen_state->opaque = opts;
+
+    return 0;
+}
+
+static void readahead_reopen_commit(BDRVReopenState *state)
+{
+    BDRVReadaheadState *s = state->bs->opaque;
+
+    /* the chunk size may change, start over with an empty cache */
+    readahead_invalidate_all(s);
+    readahead_apply_opts(s, state->opaque);
+
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void readahead_reopen_abort(BDRVReopenState *state)
+{
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void readahead_child_perm(BlockDriverState *bs, BdrvChild *c,
+    BdrvChildRole role, BlockReopenQueue *reopen_queue,
+    uint64_t perm, uint64_t shared, uint64_t *nperm, uint64_t *nshared)
+{
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+
+    /* Writes that bypass the filter would leave stale data in the cache */
+    *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+static BlockDriver bdrv_readahead_filter = {
+    .format_name = "readahead",
+    .instance_size = sizeof(BDRVReadaheadState),
+
+    .bdrv_co_getlength    = readahead_co_getlength,
+    .bdrv_open            = readahead_open,
+    .bdrv_close           = readahead_close,
+
+    .bdrv_reopen_prepare  = readahead_reopen_prepare,
+    .bdrv_reopen_commit   = readahead_reopen_commit,
+    .bdrv_reopen_abort    = readahead_reopen_abort,
+
+    .bdrv_co_preadv_part = readahead_co_preadv_part,
+    .bdrv_co_pwritev_part = readahead_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = readahead_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = readahead_co_pdiscard,
+    .bdrv_co_flush = readahead_co_flush,
+    .bdrv_co_truncate = readahead_co_truncate,
+
+    .bdrv_child_perm = readahead_child_perm,
+
+    .is_filter = true,
+};
+
+static void bdrv_readahead_init(void)
+{
+    bdrv_register(&bdrv_readahead_filter);
+}
+
+block_init(bdrv_readahead_init);
@@ -0,0 +1,410 @@
+/*
+ * Block protocol driver keeping a sparse image in memory
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * On emscripten, a writable disk in MEMFS is one dense array that is
+ * reallocated and copied as the file grows, so a large sparse image cannot
+ * even be created.  This driver splits the image into chunks that are
+ * allocated on their first write of non-zero data and read as zeroes until
+ * then.  Discarding or zeroing whole chunks frees them again, so the image
+ * only takes memory for the data the guest actually keeps.
+ *
+ * A two-level table maps chunk numbers to chunks: each L2 table covers
+ * SPARSE_MEM_L2_SIZE chunks and is only allocated along with its first
+ * chunk.  The contents are lost when the node is closed.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/host-utils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+
+#define SPARSE_MEM_OPT_CHUNK_SIZE       "chunk-size"
+#define SPARSE_MEM_DEFAULT_CHUNK_SIZE   (64 * KiB)
+
+#define SPARSE_MEM_L2_BITS  10
+#define SPARSE_MEM_L2_SIZE  (1 << SPARSE_MEM_L2_BITS)
+
+typedef struct BDRVSparseMemState {
+    int64_t length;
+    unsigned int chunk_bits;
+    uint64_t chunk_size;
+    /* l1[i][j] is chunk (i << SPARSE_MEM_L2_BITS) + j, or NULL */
+    uint8_t ***l1;
+    uint64_t l1_size;
+    uint64_t nb_allocated;
+} BDRVSparseMemState;
+
+static QemuOptsList runtime_opts = {
+    .name = "sparse-mem",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = BLOCK_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the image",
+        },
+        {
+            .name = SPARSE_MEM_OPT_CHUNK_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "granularity of the allocations",
+        },
+        { /* end of list */ }
+    },
+};
+
+static void sparse_mem_parse_filename(const char *filename, QDict *options,
+                                      Error **errp)
+{
+    /* Only so that a sparse-mem:// filename is accepted */
+    if (strcmp(filename, "sparse-mem://")) {
+        error_setg(errp, "The only allowed filename for this driver is "
+                   "'sparse-mem://'");
+    }
+}
+
+static uint64_t sparse_mem_l1_size(BDRVSparseMemState *s, int64_t length)
+{
+    uint64_t nb_chunks = DIV_ROUND_UP(length, s->chunk_size);
+
+    return DIV_ROUND_UP(nb_chunks, SPARSE_MEM_L2_SIZE);
+}
+
+static void sparse_mem_resize_l1(BDRVSparseMemState *s, int64_t length)
+{
+    uint64_t l1_size = sparse_mem_l1_size(s, length);
+
+    /* The L2 tables past the end were emptied by the caller */
+    for (uint64_t i = l1_size; i < s->l1_size; i++) {
+        g_free(s->l1[i]);
+    }
+    s->l1 = g_renew(uint8_t **, s->l1, l1_size);
+    if (l1_size > s->l1_size) {
+        memset(s->l1 + s->l1_size, 0,
+               (l1_size - s->l1_size) * sizeof(*s->l1));
+    }
+    s->l1_size = l1_size;
+}
+
+/* Offset of the first chunk of the L2 table after the one of @chunk */
+static int64_t sparse_mem_next_l2(BDRVSparseMemState *s, uint64_t chunk)
+{
+    return ((chunk >> SPARSE_MEM_L2_BITS) + 1) <<
+           (SPARSE_MEM_L2_BITS + s->chunk_bits);
+}
+
+static uint8_t *sparse_mem_chunk(BDRVSparseMemState *s, uint64_t chunk)
+{
+    uint8_t **l2 = s->l1[chunk >> SPARSE_MEM_L2_BITS];
+
+    return l2 ? l2[chunk & (SPARSE_MEM_L2_SIZE - 1)] : NULL;
+}
+
+static uint8_t **sparse_mem_slot(BDRVSparseMemState *s, uint64_t chunk)
+{
+    uint8_t ***l2 = &s->l1[chunk >> SPARSE_MEM_L2_BITS];
+
+    if (!*l2) {
+        *l2 = g_new0(uint8_t *, SPARSE_MEM_L2_SIZE);
+    }
+    return &(*l2)[chunk & (SPARSE_MEM_L2_SIZE - 1)];
+}
+
+/*
+ * Make [@offset, @offset + @bytes) read as zeroes: free the chunks it
+ * covers entirely and, if @zero_partial, clear the rest in place.
+ */
+static void sparse_mem_clear(BDRVSparseMemState *s, int64_t offset,
+                             int64_t bytes, bool zero_partial)
+{
+    while (bytes > 0) {
+        uint64_t chunk = offset >> s->chunk_bits;
+        uint64_t in_chunk = offset & (s->chunk_size - 1);
+        int64_t n = MIN(bytes, s->chunk_size - in_chunk);
+        uint8_t **l2 = s->l1[chunk >> SPARSE_MEM_L2_BITS];
+        uint8_t **slot;
+
+        if (!l2) {
+            /* Nothing allocated up to the next L2 table */
+            n = MIN(bytes, sparse_mem_next_l2(s, chunk) - offset);
+        } else {
+            slot = &l2[chunk & (SPARSE_MEM_L2_SIZE - 1)];
+            if (*slot && n == s->chunk_size) {
+                g_free(*slot);
+                *slot = NULL;
+                s->nb_allocated--;
+            } else if (*slot && zero_partial) {
+                memset(*slot + in_chunk, 0, n);
+            }
+        }
+        offset += n;
+        bytes -= n;
+    }
+}
+
+static int sparse_mem_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVSparseMemState *s = bs->opaque;
+    QemuOpts *opts;
+    uint64_t chunk_size, size;
+    int ret = 0;
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    if (!qemu_opt_get(opts, BLOCK_OPT_SIZE)) {
+        error_setg(errp, "sparse-mem block driver requires a 'size' option");
+        ret = -EINVAL;
+        goto out;
+    }
+    size = qemu_opt_get_size(opts, BLOCK_OPT_SIZE, 0);
+    if (size > BDRV_MAX_LENGTH) {
+        error_setg(errp, "size must not exceed %" PRId64, BDRV_MAX_LENGTH);
+        ret = -EINVAL;
+        goto out;
+    }
+    s->length = size;
+    chunk_size = qemu_opt_get_size(opts, SPARSE_MEM_OPT_CHUNK_SIZE,
+                                   SPARSE_MEM_DEFAULT_CHUNK_SIZE);
+    if (chunk_size < 4 * KiB || chunk_size > 2 * MiB ||
+        !is_power_of_2(chunk_size)) {
+        error_setg(errp, "chunk-size must be a power of two between 4k "
+                   "and 2M");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->chunk_bits = ctz64(chunk_size);
+    s->chunk_size = chunk_size;
+    sparse_mem_resize_l1(s, s->length);
+
+    bs->supported_write_flags = BDRV_REQ_FUA;
+    bs->supported_zero_flags = BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void sparse_mem_close(BlockDriverState *bs)
+{
+    BDRVSparseMemState *s = bs->opaque;
+
+    sparse_mem_clear(s, 0, s->length, false);
+    sparse_mem_resize_l1(s, 0);
+}
+
+static void sparse_mem_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    BDRVSparseMemState *s = bs->opaque;
+
+    bs->bl.pdiscard_alignment = s->chunk_size;
+}
+
+static int coroutine_fn sparse_mem_co_preadv(BlockDriverState *bs,
+                                             int64_t offset, int64_t bytes,
+                                             QEMUIOVector *qiov,
+                                             BdrvRequestFlags flags)
+{
+    BDRVSparseMemState *s = bs->opaque;
+    size_t done = 0;
+
+    while (done < bytes) {
+        uint64_t pos = offset + done;
+        uint64_t in_chunk = pos & (s->chunk_size - 1);
+        size_t n = MIN(bytes - done, s->chunk_size - in_chunk);
+        uint8_t *data = sparse_mem_chunk(s, pos >> s->chunk_bits);
+
+        if (data) {
+            qemu_iovec_from_buf(qiov, done, data + in_chunk, n);
+        } else {
+            qemu_iovec_memset(qiov, done, 0, n);
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static int coroutine_fn sparse_mem_co_pwritev(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              BdrvRequestFlags flags)
+{
+    BDRVSparseMemState *s = bs->opaque;
+    size_t done = 0;
+
+    while (done < bytes) {
+        uint64_t pos = offset + done;
+        uint64_t in_chunk = pos & (s->chunk_size - 1);
+        size_t n = MIN(bytes - done, s->chunk_size - in_chunk);
+        uint64_t chunk = pos >> s->chunk_bits;
+        uint8_t **slot;
+
+        /* A hole already reads as zeroes, writing them changes nothing */
+        if (!sparse_mem_chunk(s, chunk) && qemu_iovec_is_zero(qiov, done, n)) {
+            done += n;
+            continue;
+        }
+
+        slot = sparse_mem_slot(s, chunk);
+        if (!*slot) {
+            *slot = n == s->chunk_size ? g_try_malloc(s->chunk_size) :
+                                         g_try_malloc0(s->chunk_size);
+            if (!*slot) {
+                return -ENOMEM;
+            }
+            s->nb_allocated++;
+        }
+        qemu_iovec_to_buf(qiov, done, *slot + in_chunk, n);
+        done += n;
+    }
+    return 0;
+}
+
+static int coroutine_fn sparse_mem_co_pwrite_zeroes(BlockDriverState *bs,
+                                                    int64_t offset,
+                                                    int64_t bytes,
+                                                    BdrvRequestFlags flags)
+{
+    sparse_mem_clear(bs->opaque, offset, bytes, true);
+    return 0;
+}
+
+static int coroutine_fn sparse_mem_co_pdiscard(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes)
+{
+    sparse_mem_clear(bs->opaque, offset, bytes, false);
+    return 0;
+}
+
+static int coroutine_fn sparse_mem_co_truncate(BlockDriverState *bs,
+                                               int64_t offset, bool exact,
+                                               PreallocMode prealloc,
+                                               BdrvRequestFlags flags,
+                                               Error **errp)
+{
+    BDRVSparseMemState *s = bs->opaque;
+
+    if (prealloc != PREALLOC_MODE_OFF) {
+        error_setg(errp, "Preallocation mode '%s' unsupported for sparse-mem "
+                   "images", PreallocMode_str(prealloc));
+        return -ENOTSUP;
+    }
+
+    /* What is cut off must read as zeroes if the image grows back */
+    if (offset < s->length) {
+        sparse_mem_clear(s, offset, s->length - offset, true);
+    }
+    sparse_mem_resize_l1(s, offset);
+    s->length = offset;
+    return 0;
+}
+
+static int64_t coroutine_fn sparse_mem_co_getlength(BlockDriverState *bs)
+{
+    BDRVSparseMemState *s = bs->opaque;
+
+    return s->length;
+}
+
+static int64_t coroutine_fn
+sparse_mem_co_get_allocated_file_size(BlockDriverState *bs)
+{
+    BDRVSparseMemState *s = bs->opaque;
+
+    return s->nb_allocated << s->chunk_bits;
+}
+
+static int coroutine_fn sparse_mem_co_block_status(BlockDriverState *bs,
+                                                   bool want_zero,
+                                                   int64_t offset,
+                                                   int64_t bytes,
+                                                   int64_t *pnum,
+                                                   int64_t *map,
+                                                   BlockDriverState **file)
+{
+    BDRVSparseMemState *s = bs->opaque;
+    uint64_t chunk = offset >> s->chunk_bits;
+    bool allocated = sparse_mem_chunk(s, chunk);
+    int64_t end = offset + bytes;
+    int64_t pos = (chunk + 1) << s->chunk_bits;
+
+    /* Extend the answer over the following chunks in the same state */
+    while (pos < end) {
+        chunk = pos >> s->chunk_bits;
+        if (!allocated && !s->l1[chunk >> SPARSE_MEM_L2_BITS]) {
+            pos = sparse_mem_next_l2(s, chunk);
+            continue;
+        }
+        if (!!sparse_mem_chunk(s, chunk) != allocated) {
+            break;
+        }
+        pos += s->chunk_size;
+    }
+
+    *pnum = MIN(pos, end) - offset;
+    *map = offset;
+    *file = bs;
+    return BDRV_BLOCK_OFFSET_VALID |
+           (allocated ? BDRV_BLOCK_DATA : BDRV_BLOCK_ZERO);
+}
+
+static int sparse_mem_reopen_prepare(BDRVReopenState *reopen_state,
+                                     BlockReopenQueue *queue, Error **errp)
+{
+    return 0;
+}
+
+static void sparse_mem_refresh_filename(BlockDriverState *bs)
+{
+    snprintf(bs->exact_filename, sizeof(bs->exact_filename),
+             "sparse-mem://");
+}
+
+static const char *const sparse_mem_strong_runtime_opts[] = {
+    BLOCK_OPT_SIZE,
+    SPARSE_MEM_OPT_CHUNK_SIZE,
+
+    NULL
+};
+
+static BlockDriver bdrv_sparse_mem = {
+    .format_name                = "sparse-mem",
+    .protocol_name              = "sparse-mem",
+
+    .instance_size              = sizeof(BDRVSparseMemState),
+    .bdrv_parse_filename        = sparse_mem_parse_filename,
+    .bdrv_file_open             = sparse_mem_open,
+    .bdrv_close                 = sparse_mem_close,
+    .bdrv_reopen_prepare        = sparse_mem_reopen_prepare,
+    .bdrv_refresh_limits        = sparse_mem_refresh_limits,
+    .bdrv_co_getlength          = sparse_mem_co_getlength,
+    .bdrv_co_get_allocated_file_size = sparse_mem_co_get_allocated_file_size,
+    .bdrv_co_truncate           = sparse_mem_co_truncate,
+
+    .bdrv_co_preadv             = sparse_mem_co_preadv,
+    .bdrv_co_pwritev            = sparse_mem_co_pwritev,
+    .bdrv_co_pwrite_zeroes      = sparse_mem_co_pwrite_zeroes,
+    .bdrv_co_pdiscard           = sparse_mem_co_pdiscard,
+    .bdrv_co_block_status       = sparse_mem_co_block_status,
+
+    .bdrv_refresh_filename      = sparse_mem_refresh_filename,
+    .strong_runtime_opts        = sparse_mem_strong_runtime_opts,
+};
+
+static void sparse_mem_block_init(void)
+{
+    bdrv_register(&bdrv_sparse_mem);
+}
+
+block_init(sparse_mem_block_init);
@@ -0,0 +1,535 @@
+/*
+ * Block driver for images in the zstd seekable format
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The seekable format (contrib/seekable_format in the zstd sources) is a
+ * sequence of independent zstd frames followed by a skippable frame that
+ * holds the seek table: the compressed and decompressed size of every
+ * frame.  A read decompresses only the frames it covers.  Frames are
+ * decompressed in the thread pool, all frames of a request and the
+ * readahead in parallel, and the decompressed frames are kept in an LRU
+ * cache bounded by cache-size.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "trace.h"
+#include <zstd.h>
+
+#define ZSTD_SEEKABLE_MAGIC         0x8F92EAB1
+#define ZSTD_SEEKABLE_SKIPPABLE     0x184D2A5E
+#define ZSTD_SEEKABLE_FOOTER_SIZE   9
+#define ZSTD_SEEKABLE_SKIP_HDR_SIZE 8
+#define ZSTD_SEEKABLE_CHECKSUM_FLAG 0x80
+#define ZSTD_SEEKABLE_RESERVED      0x7c
+
+/* Maximum decompressed frame size */
+#define ZSTD_SEEKABLE_MAX_FRAME     (64 * MiB)
+#define ZSTD_SEEKABLE_MAX_FRAMES    (1 << 27)
+
+#define ZSTD_SEEKABLE_OPT_READAHEAD     "readahead"
+#define ZSTD_SEEKABLE_OPT_CACHE_SIZE    "cache-size"
+
+#define ZSTD_SEEKABLE_DEFAULT_READAHEAD     2
+#define ZSTD_SEEKABLE_DEFAULT_CACHE_SIZE    (64 * MiB)
+
+typedef struct BDRVZstdSeekableState BDRVZstdSeekableState;
+
+typedef struct ZstdFrame {
+    BDRVZstdSeekableState *s;
+    int64_t index;
+    uint8_t *data;
+    size_t len;
+    /* compressed data, only while loading */
+    uint8_t *compressed;
+    size_t compressed_len;
+    /* set until the frame is decompressed */
+    bool loading;
+    /* 0, or the error of the load once loading is clear */
+    int ret;
+    /* coroutines waiting for or copying from the frame */
+    unsigned refs;
+    CoQueue waiters;
+    QTAILQ_ENTRY(ZstdFrame) lru;
+} ZstdFrame;
+
+struct BDRVZstdSeekableState {
+    BlockDriverState *bs;
+    uint32_t nb_frames;
+    /* nb_frames + 1 start offsets of the frames in the file and the image */
+    uint64_t *compressed_offsets;
+    uint64_t *offsets;
+    unsigned readahead;
+    uint64_t cache_size;
+    uint64_t cached_bytes;
+    /* frame index -> ZstdFrame, loaded or loading */
+    GHashTable *frames;
+    /* loaded frames, least recently used first */
+    QTAILQ_HEAD(, ZstdFrame) lru;
+};
+
+static QemuOptsList runtime_opts = {
+    .name = "zstd-seekable",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = ZSTD_SEEKABLE_OPT_READAHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "number of frames decompressed ahead of a read",
+        },
+        {
+            .name = ZSTD_SEEKABLE_OPT_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "maximum size of the decompressed frame cache",
+        },
+        { /* end of list */ }
+    },
+};
+
+static void zstd_frame_free(ZstdFrame *f)
+{
+    g_free(f->compressed);
+    g_free(f->data);
+    g_free(f);
+}
+
+/* Returns the frame that holds @offset */
+static int64_t zstd_seekable_find(BDRVZstdSeekableState *s, uint64_t offset)
+{
+    uint32_t lo = 0, hi = s->nb_frames;
+
+    /* empty frames share their offset with the next one, skip them */
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (s->offsets[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Runs in a thread pool worker */
+static int zstd_frame_worker(void *opaque)
+{
+    ZstdFrame *f = opaque;
+    size_t ret;
+
+    ret = ZSTD_decompress(f->data, f->len, f->compressed, f->compressed_len);
+    return ZSTD_isError(ret) || ret != f->len ? -EIO : 0;
+}
+
+static void coroutine_fn zstd_frame_load_entry(void *opaque)
+{
+    ZstdFrame *f = opaque;
+    BDRVZstdSeekableState *s = f->s;
+    int ret;
+
+    WITH_GRAPH_RDLOCK_GUARD() {
+        ret = bdrv_co_pread(s->bs->file, s->compressed_offsets[f->index],
+                            f->compressed_len, f->compressed, 0);
+    }
+    if (ret == 0) {
+        ret = thread_pool_submit_co(zstd_frame_worker, f);
+    }
+    trace_zstd_seekable_frame_done(s->bs, f->index, ret);
+
+    g_free(f->compressed);
+    f->compressed = NULL;
+    f->loading = false;
+    f->ret = ret;
+    if (ret < 0) {
+        /* drop it so that the next read tries again */
+        g_hash_table_remove(s->frames, &f->index);
+        s->cached_bytes -= f->len;
+        qemu_co_queue_restart_all(&f->waiters);
+        if (!f->refs) {
+            zstd_frame_free(f);
+        }
+    } else {
+        QTAILQ_INSERT_TAIL(&s->lru, f, lru);
+        qemu_co_queue_restart_all(&f->waiters);
+    }
+    bdrv_dec_in_flight(s->bs);
+}
+
+/* Make room for @len more bytes, or return false if all frames are in use */
+static bool zstd_cache_reserve(BDRVZstdSeekableState *s, size_t len)
+{
+    ZstdFrame *f, *next;
+
+    QTAILQ_FOREACH_SAFE(f, &s->lru, lru, next) {
+        if (s->cached_bytes + len <= s->cache_size) {
+            break;
+        }
+        if (!f->refs) {
+            QTAILQ_REMOVE(&s->lru, f, lru);
+            g_hash_table_remove(s->frames, &f->index);
+            s->cached_bytes -= f->len;
+            zstd_frame_free(f);
+        }
+    }
+    return s->cached_bytes + len <= s->cache_size;
+}
+
+/*
+ * Start decompressing frame @index.  Demand reads may go over the cache
+ * limit while every frame is in use; readahead is skipped instead.
+ */
+static ZstdFrame *zstd_frame_start(BDRVZstdSeekableState *s, int64_t index,
+                                   bool readahead)
+{
+    size_t len = s->offsets[index + 1] - s->offsets[index];
+    size_t compressed_len = s->compressed_offsets[index + 1] -
+                            s->compressed_offsets[index];
+    uint8_t *data, *compressed;
+    ZstdFrame *f;
+
+    if (!zstd_cache_reserve(s, len) && readahead) {
+        return NULL;
+    }
+    data = g_try_malloc(MAX(len, 1));
+    compressed = g_try_malloc(compressed_len);
+    if (!data || !compressed) {
+        g_free(data);
+        g_free(compressed);
+        return NULL;
+    }
+    trace_zstd_seekable_frame_start(s->bs, index, readahead);
+
+    f = g_new0(ZstdFrame, 1);
+    f->s = s;
+    f->index = index;
+    f->data = data;
+    f->len = len;
+    f->compressed = compressed;
+    f->compressed_len = compressed_len;
+    f->loading = true;
+    qemu_co_queue_init(&f->waiters);
+    g_hash_table_insert(s->frames, &f->index, f);
+    s->cached_bytes += len;
+
+    /* keep drain waiting for readahead, which isn't part of any request */
+    bdrv_inc_in_flight(s->bs);
+    aio_co_enter(bdrv_get_aio_context(s->bs),
+                 qemu_coroutine_create(zstd_frame_load_entry, f));
+    return f;
+}
+
+static void zstd_readahead(BDRVZstdSeekableState *s, int64_t index)
+{
+    for (int64_t i = index + 1;
+         i <= index + s->readahead && i < s->nb_frames; i++) {
+        if (!g_hash_table_contains(s->frames, &i) &&
+            !zstd_frame_start(s, i, true)) {
+            break;
+        }
+    }
+}
+
+static int coroutine_fn
+zstd_co_read_frame(BDRVZstdSeekableState *s, int64_t index, uint64_t offset,
+                   uint64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    ZstdFrame *f = g_hash_table_lookup(s->frames, &index);
+    int ret;
+
+    if (!f) {
+        f = zstd_frame_start(s, index, false);
+        if (!f) {
+            return -ENOMEM;
+        }
+    }
+    f->refs++;
+    while (f->loading) {
+        qemu_co_queue_wait(&f->waiters, NULL);
+    }
+    f->refs--;
+
+    ret = f->ret;
+    if (ret < 0) {
+        if (!f->refs) {
+            zstd_frame_free(f);
+        }
+        return ret;
+    }
+    QTAILQ_REMOVE(&s->lru, f, lru);
+    QTAILQ_INSERT_TAIL(&s->lru, f, lru);
+    qemu_iovec_from_buf(qiov, qiov_offset, f->data + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn
+zstd_seekable_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                        QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    BDRVZstdSeekableState *s = bs->opaque;
+    uint64_t len = s->offsets[s->nb_frames];
+    int64_t index, last;
+    size_t qiov_offset = 0;
+    int ret;
+
+    /* the tail of the last sector */
+    if (offset + bytes > len) {
+        int64_t tail = offset + bytes - MAX(offset, len);
+
+        qemu_iovec_memset(qiov, bytes - tail, 0, tail);
+        bytes -= tail;
+    }
+    if (bytes == 0) {
+        return 0;
+    }
+
+    /* decompress the missing frames of the request in parallel */
+    index = zstd_seekable_find(s, offset);
+    last = zstd_seekable_find(s, offset + bytes - 1);
+    for (int64_t i = index; i <= last; i++) {
+        if (!g_hash_table_contains(s->frames, &i)) {
+            zstd_frame_start(s, i, false);
+        }
+    }
+    zstd_readahead(s, last);
+
+    while (bytes > 0) {
+        uint64_t frame_offset = offset - s->offsets[index];
+        uint64_t n = MIN(bytes, s->offsets[index + 1] - offset);
+
+        if (n) {
+            ret = zstd_co_read_frame(s, index, frame_offset, n, qiov,
+                                     qiov_offset);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+        index++;
+    }
+    return 0;
+}
+
+static int GRAPH_RDLOCK zstd_seekable_load(BlockDriverState *bs, Error **errp)
+{
+    BDRVZstdSeekableState *s = bs->opaque;
+    uint8_t footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+    uint8_t skip[ZSTD_SEEKABLE_SKIP_HDR_SIZE];
+    uint8_t *table;
+    size_t entry_size, table_size;
+    int64_t file_len, table_offset;
+    int ret;
+
+    file_len = bdrv_getlength(bs->file->bs);
+    if (file_len < 0) {
+        error_setg_errno(errp, -file_len, "Could not get the image size");
+        return file_len;
+    }
+    if (file_len < ZSTD_SEEKABLE_FOOTER_SIZE + ZSTD_SEEKABLE_SKIP_HDR_SIZE) {
+        error_setg(errp, "Image is too small for a zstd seekable file");
+        return -EINVAL;
+    }
+
+    ret = bdrv_pread(bs->file, file_len - ZSTD_SEEKABLE_FOOTER_SIZE,
+                     sizeof(footer), footer, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the seek table footer");
+        return ret;
+    }
+    if (ldl_le_p(footer + 5) != ZSTD_SEEKABLE_MAGIC) {
+        error_setg(errp, "Image is not a zstd seekable file");
+        return -EINVAL;
+    }
+    if (footer[4] & ZSTD_SEEKABLE_RESERVED) {
+        error_setg(errp, "Unsupported zstd seekable descriptor 0x%x",
+                   footer[4]);
+        return -ENOTSUP;
+    }
+    s->nb_frames = ldl_le_p(footer);
+    if (s->nb_frames == 0 || s->nb_frames > ZSTD_SEEKABLE_MAX_FRAMES) {
+        error_setg(errp, "Unsupported number of frames %" PRIu32,
+                   s->nb_frames);
+        return -EINVAL;
+    }
+
+    /* the checksums are not verified, zstd checks its own frame checksums */
+    entry_size = footer[4] & ZSTD_SEEKABLE_CHECKSUM_FLAG ? 12 : 8;
+    table_size = (size_t)s->nb_frames * entry_size;
+    table_offset = file_len - ZSTD_SEEKABLE_FOOTER_SIZE - (int64_t)table_size;
+    if (table_offset < ZSTD_SEEKABLE_SKIP_HDR_SIZE) {
+        error_setg(errp, "The seek table does not fit in the image");
+        return -EINVAL;
+    }
+    ret = bdrv_pread(bs->file, table_offset - ZSTD_SEEKABLE_SKIP_HDR_SIZE,
+                     sizeof(skip), skip, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the seek table");
+        return ret;
+    }
+    if (ldl_le_p(skip) != ZSTD_SEEKABLE_SKIPPABLE ||
+        ldl_le_p(skip + 4) != table_size + ZSTD_SEEKABLE_FOOTER_SIZE) {
+        error_setg(errp, "Invalid seek table frame");
+        return -EINVAL;
+    }
+
+    table = g_try_malloc(table_size);
+    if (!table) {
+        error_setg(errp, "Could not allocate the seek table");
+        return -ENOMEM;
+    }
+    ret = bdrv_pread(bs->file, table_offset, table_size, table, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read the seek table");
+        goto out;
+    }
+
+    s->compressed_offsets = g_new(uint64_t, s->nb_frames + 1);
+    s->offsets = g_new(uint64_t, s->nb_frames + 1);
+    s->compressed_offsets[0] = 0;
+    s->offsets[0] = 0;
+    for (uint32_t i = 0; i < s->nb_frames; i++) {
+        uint32_t compressed_len = ldl_le_p(table + i * entry_size);
+        uint32_t len = ldl_le_p(table + i * entry_size + 4);
+
+        if (len > ZSTD_SEEKABLE_MAX_FRAME ||
+            compressed_len > ZSTD_compressBound(ZSTD_SEEKABLE_MAX_FRAME)) {
+            error_setg(errp, "Frame %" PRIu32 " is too large (maximum is %d "
+                       "MB)", i, ZSTD_SEEKABLE_MAX_FRAME / MiB);
+            ret = -EINVAL;
+            goto out;
+        }
+        s->compressed_offsets[i + 1] = s->compressed_offsets[i] +
+                                       compressed_len;
+        s->offsets[i + 1] = s->offsets[i] + len;
+    }
+    if (s->compressed_offsets[s->nb_frames] + ZSTD_SEEKABLE_SKIP_HDR_SIZE >
+        table_offset) {
+        error_setg(errp, "The frames overlap the seek table");
+        ret = -EINVAL;
+        goto out;
+    }
+    ret = 0;
+
+out:
+    g_free(table);
+    return ret;
+}
+
+static int zstd_seekable_open(BlockDriverState *bs, QDict *options, int flags,
+                              Error **errp)
+{
+    BDRVZstdSeekableState *s = bs->opaque;
+    QemuOpts *opts;
+    int64_t readahead;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    bdrv_graph_rdlock_main_loop();
+    ret = bdrv_apply_auto_read_only(bs, NULL, errp);
+    bdrv_graph_rdunlock_main_loop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    readahead = qemu_opt_get_number(opts, ZSTD_SEEKABLE_OPT_READAHEAD,
+                                    ZSTD_SEEKABLE_DEFAULT_READAHEAD);
+    if (readahead < 0 || readahead > 256) {
+        error_setg(errp, "readahead must be between 0 and 256");
+        ret = -EINVAL;
+        goto out;
+    }
+    s->readahead = readahead;
+    s->cache_size = qemu_opt_get_size(opts, ZSTD_SEEKABLE_OPT_CACHE_SIZE,
+                                      ZSTD_SEEKABLE_DEFAULT_CACHE_SIZE);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    ret = zstd_seekable_load(bs, errp);
+    if (ret < 0) {
+        g_free(s->compressed_offsets);
+        g_free(s->offsets);
+        goto out;
+    }
+    trace_zstd_seekable_open(bs, s->nb_frames, s->offsets[s->nb_frames]);
+
+    s->bs = bs;
+    s->frames = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    ret = 0;
+
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void zstd_seekable_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    bs->bl.request_alignment = BDRV_SECTOR_SIZE; /* No sub-sector I/O */
+}
+
+static int64_t coroutine_fn zstd_seekable_co_getlength(BlockDriverState *bs)
+{
+    BDRVZstdSeekableState *s = bs->opaque;
+    return s->offsets[s->nb_frames];
+}
+
+static void zstd_seekable_close(BlockDriverState *bs)
+{
+    BDRVZstdSeekableState *s = bs->opaque;
+    GHashTableIter iter;
+    ZstdFrame *f;
+
+    /* drained, so no frame is loading anymore */
+    g_hash_table_iter_init(&iter, s->frames);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&f)) {
+        zstd_frame_free(f);
+    }
+    g_hash_table_destroy(s->frames);
+    g_free(s->compressed_offsets);
+    g_free(s->offsets);
+}
+
+static BlockDriver bdrv_zstd_seekable = {
+    .format_name                = "zstd-seekable",
+    .instance_size              = sizeof(BDRVZstdSeekableState),
+    .is_format                  = true,
+
+    .bdrv_open                  = zstd_seekable_open,
+    .bdrv_close                 = zstd_seekable_close,
+    .bdrv_refresh_limits        = zstd_seekable_refresh_limits,
+    .bdrv_co_getlength          = zstd_seekable_co_getlength,
+    .bdrv_child_perm            = bdrv_default_perms,
+
+    .bdrv_co_preadv             = zstd_seekable_co_preadv,
+};
+
+static void bdrv_zstd_seekable_init(void)
+{
+    bdrv_register(&bdrv_zstd_seekable);
+}
+
+block_init(bdrv_zstd_seekable_init);
@@ -19,7 +19,9 @@
 #include "qapi/qapi-commands-block-export.h"
 #include "block/nbd.h"
 #include "io/channel-socket.h"
+#include "io/channel-websock.h"
 #include "io/net-listener.h"
+#include "qemu/error-report.h"
 
 typedef struct NBDServerData {
     QIONetListener *listener;
@@ -27,6 +29,7 @@ typedef struct NBDServerData {
     char *tlsauthz;
     uint32_t max_connections;
     uint32_t connections;
+    bool websocket;
 } NBDServerData;
 
 static NBDServerData *nbd_server;
@@ -57,15 +60,46 @@ static void nbd_blockdev_client_closed(NBDClient *client, bool ignored)
     nbd_update_server_watch(nbd_server);
 }
 
+static void nbd_websock_handshake(QIOTask *task, gpointer opaque)
+{
+    QIOChannelWebsock *wioc = QIO_CHANNEL_WEBSOCK(qio_task_get_source(task));
+    QIOChannelSocket *cioc = opaque;
+    Error *err = NULL;
+
+    if (qio_task_propagate_error(task, &err)) {
+        error_reportf_err(err, "NBD websocket handshake failed: ");
+        qio_channel_close(QIO_CHANNEL(wioc), NULL);
+        assert(nbd_server->connections > 0);
+        nbd_server->connections--;
+        nbd_update_server_watch(nbd_server);
+    } else {
+        nbd_client_new(cioc, QIO_CHANNEL(wioc), nbd_server->tlscreds,
+                       nbd_server->tlsauthz, nbd_blockdev_client_closed);
+    }
+    object_unref(OBJECT(wioc));
+    object_unref(OBJECT(cioc));
+}
+
 static void nbd_accept(QIONetListener *listener, QIOChannelSocket *cioc,
                        gpointer opaque)
 {
+    QIOChannelWebsock *wioc;
+
     nbd_server->connections++;
     nbd_update_server_watch(nbd_server);
 
     qio_channel_set_name(QIO_CHANNEL(cioc), "nbd-server");
-    nbd_client_new(cioc, nbd_server->tlscreds, nbd_server->tlsauthz,
-                   nbd_blockdev_client_closed);
+    if (!nbd_server->websocket) {
+        nbd_client_new(cioc, NULL, nbd_server->tlscreds,
+                       nbd_server->tlsauthz, nbd_blockdev_client_closed);
+        return;
+    }
+
+    /* NBD negotiation, including STARTTLS, happens in websocket frames */
+    wioc = qio_channel_websock_new_server(QIO_CHANNEL(cioc));
+    qio_channel_set_name(QIO_CHANNEL(wioc), "nbd-server-websocket");
+    object_ref(OBJECT(cioc));
+    qio_channel_websock_handshake(wioc, nbd_websock_handshake, cioc, NULL);
 }
 
 static void nbd_update_server_watch(NBDServerData *s)
@@ -125,7 +159,7 @@ static QCryptoTLSCreds *nbd_get_tls_creds(const char *id, Error **errp)
 
 void nbd_server_start(SocketAddress *addr, const char *tls_creds,
                       const char *tls_authz, uint32_t max_connections,
-                      Error **errp)
+                      bool websocket, Error **errp)
 {
     if (nbd_server) {
         error_setg(errp, "NBD server already running");
@@ -134,6 +168,7 @@ void nbd_server_start(SocketAddress *addr, const char *tls_creds,
 
     nbd_server = g_new0(NBDServerData, 1);
     nbd_server->max_connections = max_connections;
+    nbd_server->websocket = websocket;
     nbd_server->listener = qio_net_listener_new();
 
     qio_net_listener_set_name(nbd_server->listener,
@@ -169,18 +204,20 @@ void nbd_server_start(SocketAddress *addr, const char *tls_creds,
 void nbd_server_start_options(NbdServerOptions *arg, Error **errp)
 {
     nbd_server_start(arg->addr, arg->tls_creds, arg->tls_authz,
-                     arg->max_connections, errp);
+                     arg->max_connections, arg->websocket, errp);
 }
 
 void qmp_nbd_server_start(SocketAddressLegacy *addr,
                           const char *tls_creds,
                           const char *tls_authz,
                           bool has_max_connections, uint32_t max_connections,
+                          bool has_websocket, bool websocket,
                           Error **errp)
 {
     SocketAddress *addr_flat = socket_address_flatten(addr);
 
-    nbd_server_start(addr_flat, tls_creds, tls_authz, max_connections, errp);
+    nbd_server_start(addr_flat, tls_creds, tls_authz, max_connections,
+                     websocket, errp);
     qapi_free_SocketAddress(addr_flat);
 }
 
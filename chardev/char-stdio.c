@@ -23,9 +23,11 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/sockets.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "chardev/char.h"
 
@@ -35,6 +37,7 @@
 #else
 #include <termios.h>
 #include "chardev/char-fd.h"
+#include "chardev/char-io.h"
 #endif
 
 #ifndef _WIN32
@@ -76,6 +79,115 @@ static void qemu_chr_set_echo_stdio(Chardev *chr, bool echo)
     tcsetattr(0, TCSANOW, &tty);
 }
 
+/*
+ * Output coalescing: writes of the frontend are appended to stdio_out,
+ * which a bottom half writes out once per main loop iteration.  All of
+ * it is done with chr_write_lock held.
+ */
+#define STDIO_OUT_MAX (64 * KiB)
+
+#ifdef EMSCRIPTEN
+#define STDIO_COALESCE_DEFAULT true
+#else
+#define STDIO_COALESCE_DEFAULT false
+#endif
+
+static GByteArray *stdio_out;
+static QEMUBH *stdio_flush_bh;
+static GSource *stdio_flush_src;
+static int (*stdio_fd_chr_write)(Chardev *chr, const uint8_t *buf, int len);
+
+static void stdio_flush_locked(Chardev *chr);
+
+static gboolean stdio_flush_ready(QIOChannel *ioc, GIOCondition cond,
+                                  gpointer opaque)
+{
+    Chardev *chr = opaque;
+
+    qemu_mutex_lock(&chr->chr_write_lock);
+    g_source_unref(stdio_flush_src);
+    stdio_flush_src = NULL;
+    stdio_flush_locked(chr);
+    qemu_mutex_unlock(&chr->chr_write_lock);
+    return G_SOURCE_REMOVE;
+}
+
+static void stdio_flush_locked(Chardev *chr)
+{
+    FDChardev *s = FD_CHARDEV(chr);
+    int ret;
+
+    if (!stdio_out->len) {
+        return;
+    }
+
+    ret = io_channel_send(s->ioc_out, stdio_out->data, stdio_out->len);
+    if (ret > 0) {
+        g_byte_array_remove_range(stdio_out, 0, ret);
+    } else if (ret < 0 && errno != EAGAIN) {
+        /* Lost, as it would have been without coalescing */
+        g_byte_array_set_size(stdio_out, 0);
+    }
+
+    if (stdio_out->len && !stdio_flush_src) {
+        stdio_flush_src = qio_channel_create_watch(s->ioc_out, G_IO_OUT);
+        g_source_set_callback(stdio_flush_src, (GSourceFunc)stdio_flush_ready,
+                              chr, NULL);
+        g_source_attach(stdio_flush_src, chr->gcontext);
+    }
+}
+
+static void stdio_flush_bh_cb(void *opaque)
+{
+    Chardev *chr = opaque;
+
+    qemu_mutex_lock(&chr->chr_write_lock);
+    stdio_flush_locked(chr);
+    qemu_mutex_unlock(&chr->chr_write_lock);
+}
+
+static int stdio_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    if (!stdio_out) {
+        return stdio_fd_chr_write(chr, buf, len);
+    }
+
+    if (stdio_out->len + len > STDIO_OUT_MAX) {
+        stdio_flush_locked(chr);
+    }
+    len = MIN(len, STDIO_OUT_MAX - stdio_out->len);
+    if (!len) {
+        /* The frontend waits for G_IO_OUT on stdout and retries */
+        errno = EAGAIN;
+        return -1;
+    }
+
+    g_byte_array_append(stdio_out, buf, len);
+    qemu_bh_schedule(stdio_flush_bh);
+    return len;
+}
+
+static void stdio_coalesce_cleanup(Chardev *chr)
+{
+    if (!stdio_out) {
+        return;
+    }
+
+    /* Best effort, stdout is non-blocking */
+    qemu_mutex_lock(&chr->chr_write_lock);
+    stdio_flush_locked(chr);
+    qemu_mutex_unlock(&chr->chr_write_lock);
+
+    if (stdio_flush_src) {
+        g_source_destroy(stdio_flush_src);
+        g_source_unref(stdio_flush_src);
+        stdio_flush_src = NULL;
+    }
+    g_clear_pointer(&stdio_flush_bh, qemu_bh_delete);
+    g_byte_array_free(stdio_out, true);
+    stdio_out = NULL;
+}
+
 static void term_stdio_handler(int sig)
 {
     /* restore echo after resume from suspend. */
@@ -117,6 +229,11 @@ static void qemu_chr_open_stdio(Chardev *chr,
 
     stdio_allow_signal = !opts->has_signal || opts->signal;
     qemu_chr_set_echo_stdio(chr, false);
+
+    if (opts->has_coalesce ? opts->coalesce : STDIO_COALESCE_DEFAULT) {
+        stdio_out = g_byte_array_sized_new(4 * KiB);
+        stdio_flush_bh = qemu_bh_new(stdio_flush_bh_cb, chr);
+    }
 }
 #endif
 
@@ -130,6 +247,10 @@ static void qemu_chr_parse_stdio(QemuOpts *opts, ChardevBackend *backend,
     qemu_chr_parse_common(opts, qapi_ChardevStdio_base(stdio));
     stdio->has_signal = true;
     stdio->signal = qemu_opt_get_bool(opts, "signal", true);
+    if (qemu_opt_get(opts, "coalesce")) {
+        stdio->has_coalesce = true;
+        stdio->coalesce = qemu_opt_get_bool(opts, "coalesce", false);
+    }
 }
 
 static void char_stdio_class_init(ObjectClass *oc, void *data)
@@ -140,12 +261,15 @@ static void char_stdio_class_init(ObjectClass *oc, void *data)
 #ifndef _WIN32
     cc->open = qemu_chr_open_stdio;
     cc->chr_set_echo = qemu_chr_set_echo_stdio;
+    stdio_fd_chr_write = cc->chr_write;
+    cc->chr_write = stdio_chr_write;
 #endif
 }
 
 static void char_stdio_finalize(Object *obj)
 {
 #ifndef _WIN32
+    stdio_coalesce_cleanup(CHARDEV(obj));
     term_exit();
 #endif
 }
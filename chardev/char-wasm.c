@@ -0,0 +1,353 @@
+/*
+ * Shared memory byte rings between QEMU-wasm and a JavaScript controller
+ *
+ * The bytes of the character device go through two rings in the wasm
+ * heap, which is a SharedArrayBuffer, so that a controller running in the
+ * page or in a worker can drive QMP or a serial console without going
+ * through the emulated sockets or TTY of emscripten.
+ *
+ * The layout, all little endian 32-bit words, is described by
+ * WasmCharShared.  The rings hold a plain byte stream; head and tail
+ * count bytes and wrap around at 2^32.  Like for -netdev wasm, each side
+ * rings the doorbell of the other once per batch: it increments the
+ * doorbell and wakes it up with Atomics.notify().  A consumer also rings
+ * the doorbell of the producer after it made room in a ring.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/thread.h"
+#include "qemu/event_notifier.h"
+#include "qapi/error.h"
+#include "chardev/char.h"
+#include "qom/object.h"
+
+#include <emscripten.h>
+#include <emscripten/threading.h>
+
+#define WASM_CHR_DEFAULT_RING_SIZE  (64 * KiB)
+#define WASM_CHR_MIN_RING_SIZE      (4 * KiB)
+#define WASM_CHR_MAX_RING_SIZE      (16 * MiB)
+
+typedef struct WasmCharRing {
+    uint32_t head;      /* written by the consumer */
+    uint32_t tail;      /* written by the producer */
+    uint32_t size;      /* power of two */
+    uint32_t data;      /* address of the bytes in the heap */
+} WasmCharRing;
+
+typedef struct WasmCharShared {
+    WasmCharRing rx;            /* JS to guest */
+    WasmCharRing tx;            /* guest to JS */
+    uint32_t qemu_doorbell;     /* QEMU waits on it */
+    uint32_t js_doorbell;       /* JS waits on it */
+} WasmCharShared;
+
+struct WasmChardev {
+    Chardev parent;
+
+    WasmCharShared *shared;
+    uint8_t *rx_data;
+    uint8_t *tx_data;
+
+    /* Turns the doorbell of QEMU into something the main loop can poll */
+    QemuThread thread;
+    EventNotifier kick;
+    bool quit;
+
+    /* The JS doorbell is rung by a bottom half, once per batch */
+    QEMUBH *js_bh;
+};
+typedef struct WasmChardev WasmChardev;
+
+#define TYPE_CHARDEV_WASM "chardev-wasm"
+DECLARE_INSTANCE_CHECKER(WasmChardev, WASM_CHARDEV, TYPE_CHARDEV_WASM)
+
+/* G_IO_OUT watch, ready while the tx ring has room */
+typedef struct WasmCharWatch {
+    GSource source;
+    WasmChardev *s;
+} WasmCharWatch;
+
+static uint32_t wasm_chr_tx_room(WasmChardev *s)
+{
+    WasmCharRing *ring = &s->shared->tx;
+
+    return ring->size - (ring->tail - qatomic_load_acquire(&ring->head));
+}
+
+static void wasm_chr_js_bh(void *opaque)
+{
+    WasmChardev *s = opaque;
+
+    qatomic_inc(&s->shared->js_doorbell);
+    emscripten_futex_wake(&s->shared->js_doorbell, INT_MAX);
+}
+
+static int wasm_chr_write(Chardev *chr, const uint8_t *buf, int len)
+{
+    WasmChardev *s = WASM_CHARDEV(chr);
+    WasmCharRing *ring = &s->shared->tx;
+    uint32_t tail = ring->tail;
+    uint32_t off = tail & (ring->size - 1);
+    uint32_t n = MIN(len, wasm_chr_tx_room(s));
+    uint32_t first = MIN(n, ring->size - off);
+
+    if (!n) {
+        /* The frontend waits for G_IO_OUT and retries */
+        errno = EAGAIN;
+        return -1;
+    }
+
+    memcpy(s->tx_data + off, buf, first);
+    memcpy(s->tx_data, buf + first, n - first);
+    qatomic_store_release(&ring->tail, tail + n);
+    qemu_bh_schedule(s->js_bh);
+    return n;
+}
+
+/* Hands the bytes of the rx ring to the frontend */
+static void wasm_chr_read(WasmChardev *s)
+{
+    Chardev *chr = CHARDEV(s);
+    WasmCharRing *ring = &s->shared->rx;
+    uint32_t head = ring->head;
+
+    for (;;) {
+        uint32_t avail = qatomic_load_acquire(&ring->tail) - head;
+        uint32_t off = head & (ring->size - 1);
+        int n;
+
+        if (!avail || avail > ring->size) {
+            break;
+        }
+        n = MIN(qemu_chr_be_can_write(chr), MIN(avail, ring->size - off));
+        if (n <= 0) {
+            /* chr_accept_input() comes back once the frontend can take more */
+            break;
+        }
+        qemu_chr_be_write(chr, s->rx_data + off, n);
+        head += n;
+    }
+
+    if (head != ring->head) {
+        qatomic_store_release(&ring->head, head);
+        qemu_bh_schedule(s->js_bh);
+    }
+}
+
+static void wasm_chr_accept_input(Chardev *chr)
+{
+    wasm_chr_read(WASM_CHARDEV(chr));
+}
+
+static void wasm_chr_kick(EventNotifier *e)
+{
+    WasmChardev *s = container_of(e, WasmChardev, kick);
+
+    event_notifier_test_and_clear(e);
+    wasm_chr_read(s);
+}
+
+static gboolean wasm_chr_watch_prepare(GSource *source, gint *timeout)
+{
+    WasmCharWatch *w = container_of(source, WasmCharWatch, source);
+
+    /* The kick of the doorbell wakes the main loop up to check again */
+    *timeout = -1;
+    return wasm_chr_tx_room(w->s) > 0;
+}
+
+static gboolean wasm_chr_watch_check(GSource *source)
+{
+    WasmCharWatch *w = container_of(source, WasmCharWatch, source);
+
+    return wasm_chr_tx_room(w->s) > 0;
+}
+
+static gboolean wasm_chr_watch_dispatch(GSource *source, GSourceFunc callback,
+                                        gpointer user_data)
+{
+    FEWatchFunc func = (FEWatchFunc)callback;
+
+    if (!func) {
+        return G_SOURCE_REMOVE;
+    }
+    return func(NULL, G_IO_OUT, user_data);
+}
+
+static GSourceFuncs wasm_chr_watch_funcs = {
+    .prepare = wasm_chr_watch_prepare,
+    .check = wasm_chr_watch_check,
+    .dispatch = wasm_chr_watch_dispatch,
+};
+
+static GSource *wasm_chr_add_watch(Chardev *chr, GIOCondition cond)
+{
+    WasmCharWatch *w;
+
+    if (!(cond & G_IO_OUT)) {
+        return NULL;
+    }
+
+    w = (WasmCharWatch *)g_source_new(&wasm_chr_watch_funcs, sizeof(*w));
+    w->s = WASM_CHARDEV(chr);
+    return &w->source;
+}
+
+static void *wasm_chr_doorbell_thread(void *opaque)
+{
+    WasmChardev *s = opaque;
+    uint32_t *doorbell = &s->shared->qemu_doorbell;
+    uint32_t seen = qatomic_load_acquire(doorbell);
+
+    while (!qatomic_read(&s->quit)) {
+        uint32_t now;
+
+        emscripten_futex_wait(doorbell, seen, INFINITY);
+        now = qatomic_load_acquire(doorbell);
+        if (now != seen) {
+            /* However many batches came in, that is one wakeup */
+            seen = now;
+            event_notifier_set(&s->kick);
+        }
+    }
+    return NULL;
+}
+
+EM_JS(void, wasm_chr_attach_js, (const char *id, WasmCharShared *shared), {
+    const msg = {
+        type: 'attach', chardev: UTF8ToString(id), buffer: wasmMemory.buffer,
+        shared: shared
+    };
+
+    Module['wasmChardev'] = Module['wasmChardev'] || {};
+    Module['wasmChardev'][msg.chardev] = msg;
+    if (Module['wasmChardevPort']) {
+        Module['wasmChardevPort'].postMessage(msg);
+    }
+});
+
+EM_JS(void, wasm_chr_detach_js, (const char *id), {
+    const chardev = UTF8ToString(id);
+
+    if (Module['wasmChardev']) {
+        delete Module['wasmChardev'][chardev];
+    }
+    if (Module['wasmChardevPort']) {
+        Module['wasmChardevPort'].postMessage({ type: 'detach',
+                                                chardev: chardev });
+    }
+});
+
+static void qemu_chr_open_wasm(Chardev *chr, ChardevBackend *backend,
+                               bool *be_opened, Error **errp)
+{
+    ChardevWasm *opts = backend->u.wasm.data;
+    WasmChardev *s = WASM_CHARDEV(chr);
+    uint64_t size = opts->has_size ? opts->size : WASM_CHR_DEFAULT_RING_SIZE;
+    int ret;
+
+    if (size < WASM_CHR_MIN_RING_SIZE || size > WASM_CHR_MAX_RING_SIZE ||
+        !is_power_of_2(size)) {
+        error_setg(errp, "size must be a power of two between %d KiB "
+                   "and %d MiB", (int)(WASM_CHR_MIN_RING_SIZE / KiB),
+                   (int)(WASM_CHR_MAX_RING_SIZE / MiB));
+        return;
+    }
+
+    ret = event_notifier_init(&s->kick, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to create the doorbell notifier");
+        return;
+    }
+    event_notifier_set_handler(&s->kick, wasm_chr_kick);
+    s->js_bh = qemu_bh_new(wasm_chr_js_bh, s);
+
+    s->shared = qemu_memalign(64, ROUND_UP(sizeof(*s->shared), 64) + 2 * size);
+    memset(s->shared, 0, sizeof(*s->shared));
+    s->rx_data = (uint8_t *)s->shared + ROUND_UP(sizeof(*s->shared), 64);
+    s->tx_data = s->rx_data + size;
+    s->shared->rx = (WasmCharRing) {
+        .size = size,
+        .data = (uintptr_t)s->rx_data,
+    };
+    s->shared->tx = (WasmCharRing) {
+        .size = size,
+        .data = (uintptr_t)s->tx_data,
+    };
+
+    qemu_thread_create(&s->thread, "wasm-chardev", wasm_chr_doorbell_thread,
+                       s, QEMU_THREAD_JOINABLE);
+    wasm_chr_attach_js(chr->label, s->shared);
+}
+
+static void qemu_chr_parse_wasm(QemuOpts *opts, ChardevBackend *backend,
+                                Error **errp)
+{
+    ChardevWasm *wasm;
+    uint64_t size = qemu_opt_get_size(opts, "size", 0);
+
+    backend->type = CHARDEV_BACKEND_KIND_WASM;
+    wasm = backend->u.wasm.data = g_new0(ChardevWasm, 1);
+    qemu_chr_parse_common(opts, qapi_ChardevWasm_base(wasm));
+    if (size) {
+        wasm->has_size = true;
+        wasm->size = size;
+    }
+}
+
+static void char_wasm_finalize(Object *obj)
+{
+    WasmChardev *s = WASM_CHARDEV(obj);
+
+    if (!s->shared) {
+        /* open failed */
+        return;
+    }
+
+    wasm_chr_detach_js(CHARDEV(obj)->label);
+
+    qatomic_set(&s->quit, true);
+    qatomic_inc(&s->shared->qemu_doorbell);
+    emscripten_futex_wake(&s->shared->qemu_doorbell, INT_MAX);
+    qemu_thread_join(&s->thread);
+
+    event_notifier_set_handler(&s->kick, NULL);
+    event_notifier_cleanup(&s->kick);
+    qemu_bh_delete(s->js_bh);
+    qemu_vfree(s->shared);
+}
+
+static void char_wasm_class_init(ObjectClass *oc, void *data)
+{
+    ChardevClass *cc = CHARDEV_CLASS(oc);
+
+    cc->parse = qemu_chr_parse_wasm;
+    cc->open = qemu_chr_open_wasm;
+    cc->chr_write = wasm_chr_write;
+    cc->chr_accept_input = wasm_chr_accept_input;
+    cc->chr_add_watch = wasm_chr_add_watch;
+}
+
+static const TypeInfo char_wasm_type_info = {
+    .name = TYPE_CHARDEV_WASM,
+    .parent = TYPE_CHARDEV,
+    .instance_size = sizeof(WasmChardev),
+    .instance_finalize = char_wasm_finalize,
+    .class_init = char_wasm_class_init,
+};
+
+static void register_types(void)
+{
+    type_register_static(&char_wasm_type_info);
+}
+
+type_init(register_types);
@@ -880,6 +880,9 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "signal",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "coalesce",
+            .type = QEMU_OPT_BOOL,
         },{
             .name = "name",
             .type = QEMU_OPT_STRING,
@@ -0,0 +1,12 @@
+#
+# A minimal version of the config that only supports the microvm
+# machine with virtio-mmio devices, for guests booted straight into
+# their kernel.  Use it with --without-default-devices, so that none of
+# the PCI and ISA devices of the pc machines are built in.
+#
+
+CONFIG_MICROVM=y
+CONFIG_VIRTIO_BLK=y
+CONFIG_VIRTIO_NET=y
+CONFIG_VIRTIO_SERIAL=y
+CONFIG_VIRTIO_RNG=y
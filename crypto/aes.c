@@ -1440,6 +1440,57 @@ int AES_set_decrypt_key(const unsigned char *userKey, const int bits,
 }
 
 #ifndef AES_ASM
+/*
+ * With host acceleration, whole blocks go through the round fragments.
+ * The words of the key schedule are big endian loads of the round keys,
+ * and the decryption schedule is the one of the equivalent inverse cipher,
+ * which InvMixColumns before AddRoundKey expects.
+ */
+static void aes_accel_rk(AESState *r, const u32 *rk)
+{
+    for (int i = 0; i < 4; i++) {
+        stl_be_p(&r->w[i], rk[i]);
+    }
+}
+
+static void aes_accel_encrypt(const unsigned char *in, unsigned char *out,
+                              const AES_KEY *key)
+{
+    const u32 *rk = key->rd_key;
+    AESState st, k;
+    int r;
+
+    memcpy(&st, in, AES_BLOCK_SIZE);
+    aes_accel_rk(&k, rk);
+    st.v ^= k.v;
+    for (r = 1; r < key->rounds; r++) {
+        aes_accel_rk(&k, rk + 4 * r);
+        aesenc_SB_SR_MC_AK(&st, &st, &k, HOST_BIG_ENDIAN);
+    }
+    aes_accel_rk(&k, rk + 4 * r);
+    aesenc_SB_SR_AK(&st, &st, &k, HOST_BIG_ENDIAN);
+    memcpy(out, &st, AES_BLOCK_SIZE);
+}
+
+static void aes_accel_decrypt(const unsigned char *in, unsigned char *out,
+                              const AES_KEY *key)
+{
+    const u32 *rk = key->rd_key;
+    AESState st, k;
+    int r;
+
+    memcpy(&st, in, AES_BLOCK_SIZE);
+    aes_accel_rk(&k, rk);
+    st.v ^= k.v;
+    for (r = 1; r < key->rounds; r++) {
+        aes_accel_rk(&k, rk + 4 * r);
+        aesdec_ISB_ISR_IMC_AK(&st, &st, &k, HOST_BIG_ENDIAN);
+    }
+    aes_accel_rk(&k, rk + 4 * r);
+    aesdec_ISB_ISR_AK(&st, &st, &k, HOST_BIG_ENDIAN);
+    memcpy(out, &st, AES_BLOCK_SIZE);
+}
+
 /*
  * Encrypt a single block
  * in and out can overlap
@@ -1454,6 +1505,10 @@ void AES_encrypt(const unsigned char *in, unsigned char *out,
 #endif /* ?FULL_UNROLL */
 
         assert(in && out && key);
+        if (HAVE_AES_ACCEL) {
+                aes_accel_encrypt(in, out, key);
+                return;
+        }
         rk = key->rd_key;
 
         /*
@@ -1645,6 +1700,10 @@ void AES_decrypt(const unsigned char *in, unsigned char *out,
 #endif /* ?FULL_UNROLL */
 
         assert(in && out && key);
+        if (HAVE_AES_ACCEL) {
+                aes_accel_decrypt(in, out, key);
+                return;
+        }
         rk = key->rd_key;
 
         /*
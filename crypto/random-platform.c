@@ -26,6 +26,24 @@
 #ifdef _WIN32
 #include <wincrypt.h>
 static HCRYPTPROV hCryptProv;
+#elif defined(__EMSCRIPTEN__)
+#include <emscripten.h>
+
+/*
+ * getentropy() of emscripten calls out to JS for each 256 bytes; take
+ * the 64 KiB that crypto.getRandomValues() allows at once instead.  It
+ * does not take views of a SharedArrayBuffer, so go through a copy.
+ */
+EM_JS(void, qcrypto_random_bytes_js, (void *buf, size_t buflen), {
+    const chunk = new Uint8Array(Math.min(buflen, 65536));
+
+    for (let off = 0; off < buflen; off += chunk.length) {
+        const view = chunk.subarray(0, Math.min(chunk.length, buflen - off));
+
+        crypto.getRandomValues(view);
+        HEAPU8.set(view, buf + off);
+    }
+});
 #else
 # ifdef CONFIG_GETRANDOM
 #  include <sys/random.h>
@@ -43,6 +61,8 @@ int qcrypto_random_init(Error **errp)
                          "Unable to create cryptographic provider");
         return -1;
     }
+#elif defined(__EMSCRIPTEN__)
+    /* crypto.getRandomValues() is always there */
 #else
 # ifdef CONFIG_GETRANDOM
     if (getrandom(NULL, 0, 0) == 0) {
@@ -74,6 +94,8 @@ int qcrypto_random_bytes(void *buf,
                          "Unable to read random bytes");
         return -1;
     }
+#elif defined(__EMSCRIPTEN__)
+    qcrypto_random_bytes_js(buf, buflen);
 #else
 # ifdef CONFIG_GETRANDOM
     if (likely(fd < 0)) {
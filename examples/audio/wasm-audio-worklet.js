@@ -0,0 +1,69 @@
+/**
+ * QEMU WASM audio - AudioWorkletProcessor for -audiodev wasm
+ *
+ * Plays the frames that audio/wasmaudio.c writes to a ring in the wasm
+ * heap.  The worklet only reads the ring and moves its head; it never
+ * calls into QEMU, and plays silence when the ring runs dry.
+ *
+ * Load it with audioWorklet.addModule() and create the node with the
+ * 'attach' message from QEMU as processorOptions, see wasm-audio.js.
+ */
+
+// Offsets of the 32-bit words of WasmAudioShared, see audio/wasmaudio.c
+const HEAD = 0;
+const TAIL = 1;
+const SIZE = 2;
+const DATA = 3;
+const NCHANNELS = 5;
+const ENABLED = 6;
+const UNDERRUNS = 7;
+
+class QemuWasmAudioProcessor extends AudioWorkletProcessor {
+    constructor(options) {
+        super();
+        const msg = options.processorOptions;
+
+        this.words = new Uint32Array(msg.buffer, msg.shared, 8);
+        this.size = this.words[SIZE];
+        this.nchannels = this.words[NCHANNELS];
+        this.frames = new Float32Array(msg.buffer, this.words[DATA],
+                                       this.size * this.nchannels);
+        this.port.onmessage = (e) => {
+            if (e.data.type === 'detach') {
+                this.words = null;
+            }
+        };
+    }
+
+    process(inputs, outputs) {
+        const out = outputs[0];
+        const quantum = out[0].length;
+
+        if (!this.words) {
+            return false;
+        }
+
+        const head = this.words[HEAD];
+        const avail = (Atomics.load(this.words, TAIL) - head) >>> 0;
+        const n = Math.min(avail, quantum);
+
+        for (let c = 0; c < out.length; c++) {
+            const dst = out[c];
+            const src = Math.min(c, this.nchannels - 1);
+
+            for (let i = 0; i < n; i++) {
+                const f = (head + i) & (this.size - 1);
+                dst[i] = this.frames[f * this.nchannels + src];
+            }
+            dst.fill(0, n);
+        }
+
+        if (n < quantum && Atomics.load(this.words, ENABLED)) {
+            Atomics.add(this.words, UNDERRUNS, 1);
+        }
+        Atomics.store(this.words, HEAD, (head + n) >>> 0);
+        return true;
+    }
+}
+
+registerProcessor('qemu-wasm-audio', QemuWasmAudioProcessor);
@@ -0,0 +1,46 @@
+/**
+ * QEMU WASM audio - page side of -audiodev wasm
+ *
+ * Creates an AudioContext at the rate of the QEMU voice and plays it
+ * through wasm-audio-worklet.js.  QEMU posts
+ *
+ *   { type: 'attach', audiodev, buffer, shared }
+ *
+ * to Module.wasmAudioPort when the guest opens its audio device; pass it
+ * to startWasmAudio().
+ */
+
+// Offsets of the 32-bit words of WasmAudioShared, see audio/wasmaudio.c
+const FREQ = 4;
+const NCHANNELS = 5;
+const UNDERRUNS = 7;
+
+export async function startWasmAudio(msg, workletUrl) {
+    const words = new Uint32Array(msg.buffer, msg.shared, 8);
+    const ctx = new AudioContext({
+        sampleRate: words[FREQ],
+        latencyHint: 'interactive',
+    });
+
+    await ctx.audioWorklet.addModule(workletUrl);
+
+    const node = new AudioWorkletNode(ctx, 'qemu-wasm-audio', {
+        numberOfInputs: 0,
+        outputChannelCount: [words[NCHANNELS]],
+        processorOptions: msg,
+    });
+    node.connect(ctx.destination);
+
+    return {
+        ctx: ctx,
+        node: node,
+        get underruns() {
+            return Atomics.load(words, UNDERRUNS);
+        },
+        stop() {
+            node.port.postMessage({ type: 'detach' });
+            node.disconnect();
+            return ctx.close();
+        },
+    };
+}
@@ -0,0 +1,223 @@
+/**
+ * QEMU WASM benchmark - boots an example guest and runs workloads in it
+ *
+ * Talks to the guest through its serial console, like a user at the
+ * terminal would, and to QEMU through the monitor multiplexed on the same
+ * console (Ctrl-A c), where "info jit" reports TB counts, wasm instance
+ * counts and the heap high-water mark.
+ *
+ * All times are in milliseconds from the start of the wasm instantiation.
+ */
+
+// Same command lines as examples/*/src/htdocs/module.js
+const GUESTS = {
+    x86_64: {
+        disk: '/dev/vda',
+        args: [
+            '-nographic', '-m', '512M', '-accel', 'tcg,tb-size=500',
+            '-L', '/pack/', '-nic', 'none',
+            '-drive', 'if=virtio,format=raw,file=/pack/rootfs.bin',
+            '-kernel', '/pack/bzImage',
+            '-append', 'earlyprintk=ttyS0,115200n8 console=ttyS0,115200n8 ' +
+                       'root=/dev/vda rootwait ro loglevel=7',
+        ],
+    },
+    // The same guest on microvm: PVH entry into the uncompressed vmlinux
+    // through qboot, virtio-mmio devices and no option ROMs or ISA serial
+    'x86_64-microvm': {
+        disk: '/dev/vda',
+        args: [
+            '-M', 'microvm,acpi=off,x-option-roms=off,isa-serial=off',
+            '-nodefaults', '-no-user-config', '-nographic',
+            '-m', '512M', '-accel', 'tcg,tb-size=500', '-L', '/pack/',
+            '-chardev', 'stdio,id=con0,mux=on', '-mon', 'chardev=con0',
+            '-device', 'virtio-serial-device',
+            '-device', 'virtconsole,chardev=con0',
+            '-drive', 'id=disk0,if=none,format=raw,file=/pack/rootfs.bin',
+            '-device', 'virtio-blk-device,drive=disk0',
+            '-kernel', '/pack/vmlinux',
+            '-append', 'console=hvc0 root=/dev/vda rootwait ro loglevel=7 ' +
+                       'reboot=t',
+        ],
+    },
+    aarch64: {
+        disk: '/dev/mmcblk0',
+        args: [
+            '-nic', 'none', '-M', 'raspi3ap', '-nographic', '-m', '512M',
+            '-accel', 'tcg,tb-size=500', '-smp', '4',
+            '-dtb', '/pack/bcm2710-rpi-3-b-plus.dtb',
+            '-kernel', '/pack/kernel8.img',
+            '-drive', 'file=/pack/rootfs.bin,format=raw,if=sd',
+            '-append', 'earlycon=pl011,0x3f201000 console=ttyAMA0,115200 ' +
+                       'loglevel=8 initcall_blacklist=bcm2835_pm_driver_init ' +
+                       'root=/dev/mmcblk0 rootfstype=ext4 rootwait ' +
+                       'no_console_suspend',
+        ],
+    },
+    riscv64: {
+        disk: '/dev/vda',
+        args: [
+            '-nographic', '-m', '512M', '-accel', 'tcg,tb-size=500',
+            '-machine', 'virt', '-L', '/pack/', '-nic', 'none',
+            '-drive', 'if=virtio,format=raw,file=/pack/rootfs.bin',
+            '-kernel', '/pack/Image',
+            '-append', 'earlyprintk=ttyS0 console=ttyS0 root=/dev/vda ' +
+                       'rootwait ro quiet virtio_net.napi_tx=false loglevel=7',
+        ],
+    },
+};
+
+// Console lines marking the boot phases
+const MILESTONES = [
+    ['kernel', /Linux version/],
+    ['userspace', /Run \/sbin\/init|Freeing unused kernel/],
+    ['console', /Please press Enter to activate this console/],
+];
+
+// Each is run as one shell command line between two markers
+const WORKLOADS = {
+    cpu: () => "i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done",
+    hash: () => 'dd if=/dev/zero bs=1M count=8 2>/dev/null | md5sum',
+    memory: () => 'dd if=/dev/zero of=/tmp/m bs=1M count=32 2>/dev/null; ' +
+                  'cat /tmp/m > /dev/null; rm /tmp/m',
+    disk: (g) => `dd if=${g.disk} of=/dev/null bs=64k 2>/dev/null`,
+    // Loopback only, the examples have no NIC
+    network: () => 'ifconfig lo 127.0.0.1 up; ' +
+                   '(nc -l -p 5000 > /dev/null &); sleep 1; ' +
+                   'dd if=/dev/zero bs=64k count=64 2>/dev/null | ' +
+                   'nc 127.0.0.1 5000',
+};
+
+// Splits what the terminal prints into lines and waits for patterns
+class Console {
+    constructor(xterm) {
+        this.xterm = xterm;
+        this.lines = [];
+        this.waiters = [];
+        xterm.onLineFeed(() => {
+            const buf = xterm.buffer.active;
+            const line = buf.getLine(buf.baseY + buf.cursorY - 1);
+
+            if (line) {
+                this.push(line.translateToString(true));
+            }
+        });
+    }
+
+    push(text) {
+        this.lines.push(text);
+        this.waiters = this.waiters.filter((w) => !w(text));
+    }
+
+    /* Resolves with the lines up to and including the first matching one */
+    waitFor(re, timeoutMs = 30 * 60 * 1000) {
+        const from = this.lines.length;
+
+        return new Promise((resolve, reject) => {
+            const timer = setTimeout(() => reject(new Error(`timeout: ${re}`)),
+                                     timeoutMs);
+            this.waiters.push((text) => {
+                if (!re.test(text)) {
+                    return false;
+                }
+                clearTimeout(timer);
+                resolve(this.lines.slice(from));
+                return true;
+            });
+        });
+    }
+
+    type(text) {
+        this.xterm.paste(text);
+    }
+}
+
+function parseJitInfo(lines) {
+    const info = { tbs: 0, wasmInstances: 0, wasmAlive: 0, heapKiB: 0 };
+
+    for (const line of lines) {
+        let m;
+
+        if ((m = line.match(/^TB count\s+(\d+)/))) {
+            info.tbs = +m[1];
+        } else if ((m = line.match(/^functions alive\s+(\d+)/))) {
+            info.wasmAlive = +m[1];
+        } else if ((m = line.match(/instantiated (\d+)\s+evicted/))) {
+            info.wasmInstances += +m[1];
+        } else if ((m = line.match(/^heap high water\s+(\d+) KiB/))) {
+            info.heapKiB = +m[1];
+        }
+    }
+    return info;
+}
+
+async function queryJit(con) {
+    con.type('\x01c');
+    // The echo of the second command ends the output of the first one
+    con.type('info jit\rinfo version\r');
+    const lines = await con.waitFor(/^\(qemu\) info version/);
+    con.type('\x01c\r');
+    return parseJitInfo(lines);
+}
+
+/*
+ * With incoming, the guest is restored from a state saved by "migrate
+ * file:..." on the same command line and the boot milestones are skipped:
+ * shell is then the time to a working shell after the restore.
+ */
+export async function runBenchmark(guestName, xterm, initEmscriptenModule,
+                                   incoming) {
+    const guest = GUESTS[guestName];
+    if (!guest) {
+        throw new Error(`unknown guest ${guestName}`);
+    }
+
+    const { master, slave } = openpty();
+    xterm.loadAddon(master);
+
+    const con = new Console(xterm);
+    const result = { guest: guestName, incoming: incoming || undefined,
+                     milestones: {}, workloads: {} };
+    const milestoneRes = incoming ? [] : MILESTONES;
+    const t0 = performance.now();
+    const now = () => Math.round(performance.now() - t0);
+
+    Module.pty = slave;
+    Module['arguments'] = incoming ?
+        [...guest.args, '-incoming', `file:${incoming}`] : guest.args;
+    Module['mainScriptUrlOrBlob'] = location.origin + '/out.js';
+    Module['onRuntimeInitialized'] = () => {
+        result.milestones.instantiated = now();
+    };
+
+    const milestones = milestoneRes.map(([name, re]) =>
+        con.waitFor(re).then(() => {
+            result.milestones[name] = now();
+        }));
+
+    await initEmscriptenModule(Module);
+    // Same poll workaround as the examples
+    const oldPoll = Module['TTY'].stream_ops.poll;
+    Module['TTY'].stream_ops.poll = function (stream, timeout) {
+        if (!slave.readable) {
+            return (slave.readable ? 1 : 0) | (slave.writable ? 4 : 0);
+        }
+        return oldPoll.call(stream, timeout);
+    };
+
+    await Promise.all(milestones);
+    con.type('\r');
+    con.type('echo BENCH-READY\r');
+    await con.waitFor(/^BENCH-READY$/);
+    result.milestones.shell = now();
+    result.boot = await queryJit(con);
+
+    for (const [name, cmd] of Object.entries(WORKLOADS)) {
+        const start = now();
+
+        con.type(`${cmd(guest)}; echo BENCH-DONE-${name}\r`);
+        await con.waitFor(new RegExp(`^BENCH-DONE-${name}$`));
+        result.workloads[name] = { ms: now() - start, ...(await queryJit(con)) };
+    }
+    return result;
+}
@@ -0,0 +1,92 @@
+/**
+ * Headless runner for htdocs/bench.html
+ *
+ *   node run.mjs <htdocs> <guest>[@<state>] [<guest>[@<state>]...] > result.json
+ *
+ * A guest followed by @<state> is restored from the file <state> of the
+ * wasm file system instead of booted, see runBenchmark().
+ * Serves <htdocs> with the headers needed for SharedArrayBuffer, opens the
+ * benchmark page for each guest in headless Chrome through puppeteer and
+ * prints the results as one JSON array.
+ */
+
+import http from 'node:http';
+import fs from 'node:fs';
+import path from 'node:path';
+import puppeteer from 'puppeteer';
+
+const TYPES = {
+    '.html': 'text/html',
+    '.js': 'text/javascript',
+    '.mjs': 'text/javascript',
+    '.wasm': 'application/wasm',
+    '.css': 'text/css',
+};
+
+function serve(root) {
+    const server = http.createServer((req, res) => {
+        const url = new URL(req.url, 'http://localhost');
+        const file = path.join(root, path.normalize(url.pathname));
+
+        if (!file.startsWith(path.resolve(root))) {
+            res.writeHead(403).end();
+            return;
+        }
+        fs.readFile(file, (err, data) => {
+            if (err) {
+                res.writeHead(404).end();
+                return;
+            }
+            res.writeHead(200, {
+                'Content-Type': TYPES[path.extname(file)] ||
+                                'application/octet-stream',
+                'Cross-Origin-Opener-Policy': 'same-origin',
+                'Cross-Origin-Embedder-Policy': 'require-corp',
+                'Cross-Origin-Resource-Policy': 'cross-origin',
+            });
+            res.end(data);
+        });
+    });
+
+    return new Promise((resolve) => {
+        server.listen(0, '127.0.0.1', () => resolve(server));
+    });
+}
+
+async function main() {
+    const [root, ...guests] = process.argv.slice(2);
+
+    if (!root || guests.length === 0) {
+        console.error('usage: run.mjs <htdocs> ' +
+                      '<x86_64|x86_64-microvm|aarch64|riscv64>[@<state>]...');
+        process.exit(1);
+    }
+
+    const server = await serve(path.resolve(root));
+    const port = server.address().port;
+    const browser = await puppeteer.launch({ headless: 'new' });
+    const results = [];
+
+    try {
+        for (const spec of guests) {
+            const [guest, incoming] = spec.split('@');
+            const query = new URLSearchParams({ guest: guest });
+            const page = await browser.newPage();
+
+            if (incoming) {
+                query.set('incoming', incoming);
+            }
+            await page.goto(`http://127.0.0.1:${port}/bench.html?${query}`);
+            await page.waitForFunction('window.benchResult !== undefined',
+                                       { timeout: 0, polling: 1000 });
+            results.push(await page.evaluate('window.benchResult'));
+            await page.close();
+        }
+    } finally {
+        await browser.close();
+        server.close();
+    }
+    console.log(JSON.stringify(results, null, 2));
+}
+
+await main();
@@ -0,0 +1,112 @@
+/**
+ * QEMU WASM chardev - JavaScript side of -chardev wasm
+ *
+ * Exchanges bytes with QEMU through the byte rings that chardev/char-wasm.c
+ * sets up in the wasm heap.  QEMU posts
+ *
+ *   { type: 'attach', chardev, buffer, shared }
+ *
+ * to Module.wasmChardevPort; pass that message to the WasmChardev
+ * constructor, from the page or from any worker.
+ *
+ * Bytes written with write() are only visible to QEMU after flush(), which
+ * rings its doorbell once for all of them.
+ */
+
+// Offsets of the 32-bit words of WasmCharShared, see chardev/char-wasm.c
+const RX = 0;
+const TX = 4;
+const HEAD = 0;
+const TAIL = 1;
+const SIZE = 2;
+const DATA = 3;
+const QEMU_DOORBELL = 8;
+const JS_DOORBELL = 9;
+
+export class WasmChardev {
+    /**
+     * @param msg the 'attach' message from QEMU
+     * @param onData called with the bytes from the guest, a copy
+     */
+    constructor(msg, onData) {
+        this.chardev = msg.chardev;
+        this.words = new Uint32Array(msg.buffer, msg.shared, 10);
+        this.heap = new Uint8Array(msg.buffer);
+        this.onData = onData;
+        this.pending = false;
+        this.running = false;
+    }
+
+    _ring(base) {
+        return {
+            size: this.words[base + SIZE],
+            data: this.words[base + DATA]
+        };
+    }
+
+    /**
+     * Queues bytes (a Uint8Array) for the guest.  Returns how many fit in
+     * the ring; write the rest when QEMU has rung the doorbell.
+     */
+    write(bytes) {
+        const ring = this._ring(RX);
+        const tail = this.words[RX + TAIL];
+        const head = Atomics.load(this.words, RX + HEAD);
+        const off = tail & (ring.size - 1);
+        const n = Math.min(bytes.length, ring.size - ((tail - head) >>> 0));
+        const first = Math.min(n, ring.size - off);
+
+        this.heap.set(bytes.subarray(0, first), ring.data + off);
+        this.heap.set(bytes.subarray(first, n), ring.data);
+        if (n) {
+            Atomics.store(this.words, RX + TAIL, (tail + n) >>> 0);
+            this.pending = true;
+        }
+        return n;
+    }
+
+    /** Rings the doorbell of QEMU if bytes were written or taken. */
+    flush() {
+        if (this.pending) {
+            this.pending = false;
+            Atomics.add(this.words, QEMU_DOORBELL, 1);
+            Atomics.notify(this.words, QEMU_DOORBELL);
+        }
+    }
+
+    _receive() {
+        const ring = this._ring(TX);
+        const tail = Atomics.load(this.words, TX + TAIL);
+        let head = this.words[TX + HEAD];
+
+        while (head !== tail) {
+            const off = head & (ring.size - 1);
+            const n = Math.min((tail - head) >>> 0, ring.size - off);
+
+            this.onData(this.heap.slice(ring.data + off, ring.data + off + n));
+            head = (head + n) >>> 0;
+        }
+        if (head !== this.words[TX + HEAD]) {
+            Atomics.store(this.words, TX + HEAD, head);
+            // QEMU may be waiting for room
+            this.pending = true;
+        }
+    }
+
+    /** Takes bytes from the guest until stop() */
+    async start() {
+        this.running = true;
+        while (this.running) {
+            const seen = Atomics.load(this.words, JS_DOORBELL);
+
+            this._receive();
+            this.flush();
+            await Atomics.waitAsync(this.words, JS_DOORBELL, seen).value;
+        }
+    }
+
+    stop() {
+        this.running = false;
+        Atomics.notify(this.words, JS_DOORBELL);
+    }
+}
@@ -0,0 +1,227 @@
+/**
+ * QEMU WASM disk sync - incremental upload of a disk to an NBD server
+ *
+ * Keeps a persistent dirty bitmap on a qcow2 disk and, on each sync(),
+ * copies the clusters dirtied since the last sync to an NBD export with an
+ * incremental backup job (blockdev-backup sync=bitmap).  The job runs with
+ * bitmap-mode=always, so the bitmap only loses the bits of the clusters the
+ * server acknowledged, and with on-target-error=stop, so a lost connection
+ * pauses it until the NBD client has reconnected instead of failing it.
+ *
+ * Drives QEMU over a QMP monitor on a -chardev wasm, see
+ * ../chardev/wasm-chardev.js.
+ */
+
+import { WasmChardev } from '../chardev/wasm-chardev.js';
+
+/** A QMP client over a WasmChardev */
+export class Qmp {
+    /**
+     * @param msg the 'attach' message of the monitor chardev
+     * @param onEvent called with each QMP event
+     */
+    constructor(msg, onEvent) {
+        this.chardev = new WasmChardev(msg, (bytes) => this._receive(bytes));
+        this.decoder = new TextDecoder();
+        this.encoder = new TextEncoder();
+        this.line = '';
+        this.pending = [];
+        this.onEvent = onEvent;
+        this.chardev.start();
+        this.ready = this.execute('qmp_capabilities');
+    }
+
+    _receive(bytes) {
+        const lines = (this.line + this.decoder.decode(bytes, { stream: true }))
+              .split('\n');
+
+        this.line = lines.pop();
+        for (const line of lines) {
+            if (!line.trim()) {
+                continue;
+            }
+            const msg = JSON.parse(line);
+            if (msg.event) {
+                this.onEvent(msg);
+            } else if (msg.QMP) {
+                // greeting
+            } else {
+                const { resolve, reject } = this.pending.shift();
+                if (msg.error) {
+                    reject(new Error(msg.error.desc));
+                } else {
+                    resolve(msg.return);
+                }
+            }
+        }
+    }
+
+    _write(bytes) {
+        const n = this.chardev.write(bytes);
+
+        this.chardev.flush();
+        if (n < bytes.length) {
+            // The ring is full, try again once QEMU took some
+            setTimeout(() => this._write(bytes.subarray(n)), 10);
+        }
+    }
+
+    /** Runs a command, resolves to its return value */
+    execute(command, args) {
+        const cmd = args ? { execute: command, arguments: args }
+                         : { execute: command };
+
+        return new Promise((resolve, reject) => {
+            this.pending.push({ resolve, reject });
+            this._write(this.encoder.encode(JSON.stringify(cmd) + '\n'));
+        });
+    }
+}
+
+export class DiskSync {
+    /**
+     * @param msg the 'attach' message of the monitor chardev
+     * @param opts.node node name of the qcow2 format node of the disk
+     * @param opts.bitmap name of the dirty bitmap, 'sync0' by default
+     * @param opts.host, opts.port, opts.export the NBD export to sync to
+     * @param opts.websocket resource path if the server speaks websocket
+     * @param opts.reconnectDelay seconds the NBD client keeps requests
+     *        while reconnecting, 10 by default
+     * @param opts.resumeDelay milliseconds to wait before resuming a job
+     *        paused by an error, 5000 by default
+     * @param opts.onProgress called with (done, total) in bytes
+     */
+    constructor(msg, opts) {
+        this.opts = Object.assign({
+            bitmap: 'sync0',
+            reconnectDelay: 10,
+            resumeDelay: 5000,
+            onProgress: () => {}
+        }, opts);
+        this.jobId = 'disk-sync';
+        this.target = 'disk-sync-target';
+        this.job = null;
+        this.qmp = new Qmp(msg, (ev) => this._event(ev));
+    }
+
+    _event(ev) {
+        const data = ev.data || {};
+
+        if (!this.job || data.device !== this.jobId) {
+            return;
+        }
+        switch (ev.event) {
+        case 'BLOCK_JOB_ERROR':
+            // action is 'stop': the job is paused, ask it to try again later
+            if (data.action === 'stop') {
+                setTimeout(() => {
+                    this.qmp.execute('block-job-resume', { device: this.jobId })
+                        .catch(() => {});
+                }, this.opts.resumeDelay);
+            }
+            break;
+        case 'BLOCK_JOB_COMPLETED':
+        case 'BLOCK_JOB_CANCELLED':
+            this.opts.onProgress(data.offset, data.len);
+            this._done(ev.event === 'BLOCK_JOB_CANCELLED' ? 'cancelled'
+                                                          : data.error);
+            break;
+        }
+    }
+
+    _done(error) {
+        const job = this.job;
+
+        this.job = null;
+        clearInterval(job.timer);
+        this.qmp.execute('blockdev-del', { 'node-name': this.target })
+            .catch(() => {})
+            .then(() => error ? job.reject(new Error(error)) : job.resolve());
+    }
+
+    /**
+     * Adds the persistent bitmap if the disk does not have it yet.  Only
+     * call this while the disk and the export have the same content; from
+     * then on, the bitmap tracks what they differ in.
+     */
+    async setup() {
+        await this.qmp.ready;
+
+        const nodes = await this.qmp.execute('query-named-block-nodes',
+                                             { flat: true });
+        const node = nodes.find((n) => n['node-name'] === this.opts.node);
+
+        if (!node) {
+            throw new Error(`no node ${this.opts.node}`);
+        }
+        if ((node['dirty-bitmaps'] || []).some(
+                (b) => b.name === this.opts.bitmap)) {
+            return;
+        }
+        await this.qmp.execute('block-dirty-bitmap-add', {
+            node: this.opts.node,
+            name: this.opts.bitmap,
+            persistent: true
+        });
+    }
+
+    /** Copies the clusters dirtied since the last sync to the export */
+    async sync() {
+        const o = this.opts;
+        const server = { type: 'inet', host: o.host, port: String(o.port) };
+
+        await this.qmp.ready;
+        if (this.job) {
+            return this.job.promise;
+        }
+
+        await this.qmp.execute('blockdev-add', Object.assign({
+            driver: 'nbd',
+            'node-name': this.target,
+            server: server,
+            export: o.export,
+            'reconnect-delay': o.reconnectDelay
+        }, o.websocket ? { websocket: o.websocket } : {}));
+
+        const job = {};
+        job.promise = new Promise((resolve, reject) => {
+            job.resolve = resolve;
+            job.reject = reject;
+        });
+        this.job = job;
+
+        try {
+            await this.qmp.execute('blockdev-backup', {
+                'job-id': this.jobId,
+                device: o.node,
+                target: this.target,
+                sync: 'bitmap',
+                bitmap: o.bitmap,
+                'bitmap-mode': 'always',
+                'on-target-error': 'stop'
+            });
+        } catch (e) {
+            this.job = null;
+            await this.qmp.execute('blockdev-del', { 'node-name': this.target })
+                .catch(() => {});
+            throw e;
+        }
+
+        job.timer = setInterval(async () => {
+            const jobs = await this.qmp.execute('query-block-jobs');
+            const j = jobs.find((j) => j.device === this.jobId);
+            if (j) {
+                o.onProgress(j.offset, j.len);
+            }
+        }, 1000);
+        return job.promise;
+    }
+
+    /** Stops a running sync; the clusters not copied yet stay dirty */
+    async cancel() {
+        if (this.job) {
+            await this.qmp.execute('block-job-cancel',
+                                   { device: this.jobId, force: true });
+        }
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * QEMU WASM networking - JavaScript side of -netdev wasm
+ *
+ * Exchanges Ethernet frames with QEMU through the packet rings that
+ * net/wasm.c sets up in the wasm heap.  QEMU posts
+ *
+ *   { type: 'attach', netdev, buffer, shared }
+ *
+ * to Module.wasmNetPort; pass that message to the WasmNet constructor,
+ * from whichever worker runs the network stack.
+ *
+ * Frames sent with send() are only visible to QEMU after flush(), which
+ * rings its doorbell once for all of them.
+ */
+
+// Offsets of the 32-bit words of WasmNetShared, see net/wasm.c
+const RX = 0;
+const TX = 4;
+const HEAD = 0;
+const TAIL = 1;
+const SIZE = 2;
+const DATA = 3;
+const QEMU_DOORBELL = 8;
+const JS_DOORBELL = 9;
+
+const WRAP = 0xffffffff;
+
+function recordSize(len) {
+    return (len + 4 + 3) & ~3;
+}
+
+export class WasmNet {
+    /**
+     * @param msg the 'attach' message from QEMU
+     * @param onFrame called with each frame from the guest, a copy
+     */
+    constructor(msg, onFrame) {
+        this.netdev = msg.netdev;
+        this.words = new Uint32Array(msg.buffer, msg.shared, 10);
+        this.heap = new Uint8Array(msg.buffer);
+        this.view = new DataView(msg.buffer);
+        this.onFrame = onFrame;
+        this.pending = false;
+        this.running = false;
+    }
+
+    _ring(base) {
+        return {
+            size: this.words[base + SIZE],
+            data: this.words[base + DATA]
+        };
+    }
+
+    /**
+     * Queues a frame for the guest.  Returns false if the ring is full,
+     * try again when QEMU has rung the doorbell.
+     */
+    send(frame) {
+        const ring = this._ring(RX);
+        let tail = this.words[RX + TAIL];
+        const head = Atomics.load(this.words, RX + HEAD);
+        let room = ring.size - ((tail - head) >>> 0);
+        let off = tail & (ring.size - 1);
+        const rec = recordSize(frame.length);
+
+        if (frame.length > ring.size / 2) {
+            return true; // would never fit, drop it
+        }
+        if (rec > ring.size - off) {
+            if (room < ring.size - off + rec) {
+                return false;
+            }
+            this.view.setUint32(ring.data + off, WRAP, true);
+            tail = (tail + ring.size - off) >>> 0;
+            room -= ring.size - off;
+            off = 0;
+        }
+        if (room < rec) {
+            return false;
+        }
+
+        this.view.setUint32(ring.data + off, frame.length, true);
+        this.heap.set(frame, ring.data + off + 4);
+        Atomics.store(this.words, RX + TAIL, (tail + rec) >>> 0);
+        this.pending = true;
+        return true;
+    }
+
+    /** Rings the doorbell of QEMU if frames were sent or taken. */
+    flush() {
+        if (this.pending) {
+            this.pending = false;
+            Atomics.add(this.words, QEMU_DOORBELL, 1);
+            Atomics.notify(this.words, QEMU_DOORBELL);
+        }
+    }
+
+    _receive() {
+        const ring = this._ring(TX);
+        const tail = Atomics.load(this.words, TX + TAIL);
+        let head = this.words[TX + HEAD];
+
+        while (head !== tail) {
+            const off = head & (ring.size - 1);
+            const len = this.view.getUint32(ring.data + off, true);
+
+            if (len === WRAP) {
+                head = (head + ring.size - off) >>> 0;
+                continue;
+            }
+            const start = ring.data + off + 4;
+            this.onFrame(this.heap.slice(start, start + len));
+            head = (head + recordSize(len)) >>> 0;
+        }
+        if (head !== this.words[TX + HEAD]) {
+            Atomics.store(this.words, TX + HEAD, head);
+            // QEMU may be waiting for room
+            this.pending = true;
+        }
+    }
+
+    /** Takes frames from the guest until stop() */
+    async start() {
+        this.running = true;
+        while (this.running) {
+            const seen = Atomics.load(this.words, JS_DOORBELL);
+
+            this._receive();
+            this.flush();
+            await Atomics.waitAsync(this.words, JS_DOORBELL, seen).value;
+        }
+    }
+
+    stop() {
+        this.running = false;
+        Atomics.notify(this.words, JS_DOORBELL);
+    }
+}
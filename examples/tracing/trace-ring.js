@@ -0,0 +1,229 @@
+/**
+ * QEMU WASM ring trace backend - JavaScript reader
+ *
+ * Reads the trace records that QEMU built with --enable-trace-backends=ring
+ * writes to a ring in the wasm memory, and formats them like the "log"
+ * backend would.  The layout of the ring is described in trace/ring.h.
+ *
+ * Usage:
+ *   import { TraceRing } from './trace-ring.js';
+ *   const ring = new TraceRing(Module);
+ *   setInterval(() => ring.poll((ev) => console.log(ring.format(ev))), 100);
+ *
+ * Polling must keep up with the producers: records that do not fit in the
+ * ring are dropped, and counted in ring.dropped.
+ */
+
+// From trace/ring.h
+const TRACE_RING_MAGIC = 0x51524e47;
+const TRACE_RING_VERSION = 1;
+const TRACE_RING_PAD_ID = 0xffffffff;
+
+// TraceRingHeader fields, as 32-bit word indexes
+const HDR_MAGIC = 0;
+const HDR_VERSION = 1;
+const HDR_SIZE = 2;
+const HDR_HEAD = 3;
+const HDR_TAIL = 4;
+const HDR_DROPPED = 5;
+const HDR_TABLE = 6;
+const HDR_TABLE_GEN = 7;
+const HDR_BYTES = 32;
+
+// TraceRingRecord
+const REC_BYTES = 16;
+
+// Argument sizes of the printf length modifiers on wasm32
+const LENGTH_BITS = { hh: 8, h: 16, '': 32, l: 32, ll: 64, j: 64, z: 32, t: 32 };
+
+export class TraceRing {
+    /**
+     * @param {Object} module - The Emscripten Module object, which must
+     *     export _qemu_trace_ring_get and HEAPU8
+     */
+    constructor(module) {
+        this.module = module;
+        this.base = module._qemu_trace_ring_get();
+        if (!this.base) {
+            throw new Error('QEMU was not built with the ring trace backend');
+        }
+        this.decoder = new TextDecoder();
+        this.events = new Map();
+        this.tableGen = -1;
+
+        const hdr = this._words();
+        if (hdr[HDR_MAGIC] !== TRACE_RING_MAGIC ||
+            hdr[HDR_VERSION] !== TRACE_RING_VERSION) {
+            throw new Error('unknown trace ring format');
+        }
+        this.size = hdr[HDR_SIZE];
+    }
+
+    // Views are recreated on each use: the memory may have grown
+    _words() {
+        return new Uint32Array(this.module.HEAPU8.buffer, this.base, HDR_BYTES / 4);
+    }
+
+    get dropped() {
+        return Atomics.load(this._words(), HDR_DROPPED);
+    }
+
+    _readTable(hdr) {
+        const heap = this.module.HEAPU8;
+        const start = Atomics.load(hdr, HDR_TABLE);
+        let end = start;
+
+        while (heap[end] !== 0) {
+            end++;
+        }
+        this.events.clear();
+        for (const line of this.decoder.decode(heap.slice(start, end)).split('\n')) {
+            const m = line.match(/^(\d+) (\S+) (\S+) (.*)$/);
+
+            if (m) {
+                this.events.set(+m[1], {
+                    name: m[2],
+                    args: m[3] === '-' ? '' : m[3],
+                    fmt: m[4],
+                });
+            }
+        }
+    }
+
+    /**
+     * Take all the records in the ring.
+     *
+     * @param {Function} callback - Called with { name, fmt, timestampNs,
+     *     args } for each record, where args holds BigInts and strings
+     * @returns {number} the number of records taken
+     */
+    poll(callback) {
+        const heap = this.module.HEAPU8;
+        const hdr = this._words();
+        const data = this.base + HDR_BYTES;
+        const view = new DataView(heap.buffer);
+        const words = new Int32Array(heap.buffer);
+        let tail = Atomics.load(hdr, HDR_TAIL);
+        let n = 0;
+
+        const gen = Atomics.load(hdr, HDR_TABLE_GEN);
+        if (gen !== this.tableGen) {
+            this._readTable(hdr);
+            this.tableGen = gen;
+        }
+
+        for (;;) {
+            const rec = data + (tail & (this.size - 1));
+            const length = Atomics.load(words, rec >> 2);
+
+            if (length === 0) {
+                break;
+            }
+
+            const id = view.getUint32(rec + 4, true);
+            if (id !== TRACE_RING_PAD_ID) {
+                const ev = this.events.get(id);
+
+                if (ev) {
+                    callback(this._decode(ev, view, heap, rec));
+                    n++;
+                }
+            }
+
+            Atomics.store(words, rec >> 2, 0);
+            tail = (tail + length) >>> 0;
+            Atomics.store(hdr, HDR_TAIL, tail);
+        }
+        return n;
+    }
+
+    _decode(ev, view, heap, rec) {
+        const args = [];
+        let p = rec + REC_BYTES;
+
+        for (const kind of ev.args) {
+            if (kind === 's') {
+                const len = view.getUint32(p, true);
+
+                args.push(this.decoder.decode(heap.slice(p + 4, p + 4 + len)));
+                p += 4 + len;
+            } else {
+                args.push(view.getBigUint64(p, true));
+                p += 8;
+            }
+        }
+        return {
+            name: ev.name,
+            fmt: ev.fmt,
+            timestampNs: view.getBigUint64(rec + 8, true),
+            args: args,
+        };
+    }
+
+    /**
+     * Format a record taken by poll() like the "log" backend does.
+     */
+    format(ev) {
+        let i = 0;
+        const text = ev.fmt.replace(
+            /%([-+ 0#]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|j|z|t)?([diouxXcsp%])/g,
+            (all, flags, width, prec, len, conv) => {
+                if (conv === '%') {
+                    return '%';
+                }
+                return pad(formatArg(ev.args[i++], flags, prec, len || '', conv),
+                           flags, +width || 0);
+            });
+        return `${ev.name} ${text}`;
+    }
+}
+
+function formatArg(v, flags, prec, len, conv) {
+    const bits = LENGTH_BITS[len];
+
+    switch (conv) {
+    case 's':
+        return prec === undefined ? String(v) : String(v).slice(0, +prec);
+    case 'c':
+        return String.fromCharCode(Number(BigInt.asUintN(8, v)));
+    case 'p':
+        return '0x' + BigInt.asUintN(32, v).toString(16);
+    case 'd':
+    case 'i': {
+        const n = BigInt.asIntN(bits, v);
+        const sign = n < 0n ? '-' : flags.includes('+') ? '+' :
+                     flags.includes(' ') ? ' ' : '';
+        return sign + zeroes((n < 0n ? -n : n).toString(), prec);
+    }
+    default: {
+        const n = BigInt.asUintN(bits, v);
+        const radix = conv === 'o' ? 8 : conv === 'u' ? 10 : 16;
+        let s = zeroes(n.toString(radix), prec);
+
+        if (conv === 'X') {
+            s = s.toUpperCase();
+        }
+        if (flags.includes('#') && n !== 0n && radix !== 10) {
+            s = (radix === 8 ? '0' : conv === 'X' ? '0X' : '0x') + s;
+        }
+        return s;
+    }
+    }
+}
+
+function zeroes(s, prec) {
+    return prec === undefined ? s : s.padStart(+prec, '0');
+}
+
+function pad(s, flags, width) {
+    if (flags.includes('-')) {
+        return s.padEnd(width);
+    }
+    if (flags.includes('0')) {
+        const sign = /^[-+ ]|^0[xX]/.exec(s);
+        const head = sign ? sign[0] : '';
+
+        return head + s.slice(head.length).padStart(width - head.length, '0');
+    }
+    return s.padStart(width);
+}
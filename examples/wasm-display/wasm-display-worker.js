@@ -0,0 +1,121 @@
+/**
+ * QEMU WASM Display - rendering worker for wasm-display.js
+ *
+ * Draws the framebuffer on an OffscreenCanvas, reading it straight from
+ * the shared wasm heap, so that rendering does not compete with input
+ * handling and the terminal on the main thread.
+ *
+ * Messages from the page:
+ *   { type: 'start', canvas, buffer, info }  OffscreenCanvas, transferred,
+ *                                            the wasm heap and the address
+ *                                            of WasmFramebufferInfo, or 0
+ *   { type: 'start' }                        restart after a stop
+ *   { type: 'stop' }
+ *
+ * Messages from QEMU, through Module.wasmDisplayPort:
+ *   { type: 'update' }                       the framebuffer changed
+ *   { type: 'switch', width, height, buffer, info }  new surface
+ *
+ * Messages to the page:
+ *   { type: 'stats', stats }                 once per second
+ */
+
+import { WasmDisplay } from './wasm-display.js';
+
+/*
+ * Stands in for the Emscripten module: WasmDisplay only needs the heap
+ * views and the framebuffer accessors, which read WasmFramebufferInfo
+ * directly.  See the layout in WasmDisplay._getFramebufferInfo().
+ */
+class SharedHeap {
+    constructor(buffer, info) {
+        this.info = info;
+        this.setBuffer(buffer);
+    }
+
+    setBuffer(buffer) {
+        // The heap may have grown, views only cover the old size
+        this.HEAPU8 = new Uint8Array(buffer);
+        this.HEAP32 = new Int32Array(buffer);
+    }
+
+    _wasm_get_framebuffer_info() {
+        return this.info;
+    }
+
+    _wasm_get_framebuffer_damage_count() {
+        return this.HEAP32[(this.info + 40) >> 2];
+    }
+
+    _wasm_get_framebuffer_damage() {
+        return this.info + 44;
+    }
+
+    // Same as wasm_framebuffer_ack()
+    _wasm_framebuffer_ack() {
+        this.HEAPU8[this.info + 24] = 0;
+        this.HEAP32[(this.info + 40) >> 2] = 0;
+    }
+}
+
+let heap = null;
+let display = null;
+let statsTimer = null;
+
+if (typeof self.requestAnimationFrame === 'undefined') {
+    // Workers of some browsers have no animation frames
+    self.requestAnimationFrame =
+        (cb) => setTimeout(() => cb(performance.now()), 0);
+    self.cancelAnimationFrame = clearTimeout;
+}
+
+function start(msg) {
+    if (!display) {
+        heap = new SharedHeap(msg.buffer, msg.info);
+        // Only draw when QEMU says something changed
+        display = new WasmDisplay(msg.canvas, heap, {
+            enableInput: false,
+            scaleToFit: false,
+            hardwareCursor: false,
+            onDemand: true
+        });
+    }
+
+    display.start();
+    clearInterval(statsTimer);
+    statsTimer = setInterval(() => {
+        self.postMessage({ type: 'stats', stats: display.getStats() });
+    }, 1000);
+}
+
+function stop() {
+    display.stop();
+    clearInterval(statsTimer);
+    statsTimer = null;
+}
+
+self.onmessage = (event) => {
+    const msg = event.data;
+
+    if (msg.type === 'start') {
+        start(msg);
+        return;
+    }
+    if (!display) {
+        return;
+    }
+
+    switch (msg.type) {
+    case 'stop':
+        stop();
+        break;
+    case 'switch':
+        heap.setBuffer(msg.buffer);
+        heap.info = msg.info;
+        display.requestFrame();
+        break;
+    case 'update':
+        display.requestFrame();
+        break;
+    }
+};
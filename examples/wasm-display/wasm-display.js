@@ -10,8 +10,18 @@
  *   import { WasmDisplay } from './wasm-display.js';
  *   const display = new WasmDisplay(canvas, Module);
  *   display.start();
+ *
+ * With the worker option, the canvas is handed to wasm-display-worker.js,
+ * which runs another WasmDisplay on it: the page then only handles input.
  */
 
+// Input ring event types and size, from include/ui/wasm-display.h
+const INPUT_KEY = 1;
+const INPUT_MOTION = 2;
+const INPUT_BUTTON = 3;
+const INPUT_WHEEL = 4;
+const INPUT_RING_SIZE = 256;
+
 export class WasmDisplay {
     /**
      * Create a new WASM display instance.
@@ -23,10 +33,8 @@ export class WasmDisplay {
     constructor(canvas, module, options = {}) {
         this.canvas = canvas;
         this.module = module;
-        this.ctx = canvas.getContext('2d', {
-            alpha: false,
-            desynchronized: true  // Better performance on some browsers
-        });
+        // In worker mode the canvas is transferred, it must have no context
+        this.ctx = options.worker ? null : this._getContext();
 
         // Options with defaults
         this.options = {
@@ -34,6 +42,9 @@ export class WasmDisplay {
             enableInput: options.enableInput !== false,
             scaleToFit: options.scaleToFit !== false,
             cursorStyle: options.cursorStyle || 'default',
+            hardwareCursor: options.hardwareCursor !== false,
+            worker: options.worker || null,
+            onDemand: options.onDemand || false,
             ...options
         };
 
@@ -44,6 +55,15 @@ export class WasmDisplay {
         this.imageData = null;
         this.width = 0;
         this.height = 0;
+        this.inputRing = 0;
+        this.inputQueued = false;
+        this.cursorInfo = 0;
+        this.cursorShapeSerial = 0;
+        this.cursorMoveSerial = 0;
+        this.cursorStyle = null;
+        this.cursor = { x: 0, y: 0, visible: true };
+        this.worker = null;
+        this.workerStats = null;
 
         // Performance metrics
         this.stats = {
@@ -62,17 +82,30 @@ export class WasmDisplay {
         this._handleMouseUp = this._handleMouseUp.bind(this);
         this._handleWheel = this._handleWheel.bind(this);
         this._handleContextMenu = this._handleContextMenu.bind(this);
+        this._handleVisibilityChange = this._handleVisibilityChange.bind(this);
 
         // Setup global callbacks for QEMU notifications
         this._setupCallbacks();
     }
 
+    _getContext() {
+        return this.canvas.getContext('2d', {
+            alpha: false,
+            desynchronized: true  // Better performance on some browsers
+        });
+    }
+
     /**
      * Setup global callback functions that QEMU calls.
      */
     _setupCallbacks() {
         const self = this;
 
+        // In the rendering worker QEMU's notifications arrive as messages
+        if (typeof window === 'undefined') {
+            return;
+        }
+
         window.onWasmDisplayReady = function() {
             console.log('WASM Display: Ready');
             if (self.options.onReady) {
@@ -106,11 +139,23 @@ export class WasmDisplay {
 
         this.running = true;
 
+        if (this.options.worker && !this.ctx && !this._startWorker()) {
+            // Render here after all
+            this.ctx = this._getContext();
+        }
+
         // Setup input handlers
         if (this.options.enableInput) {
             this._setupInputHandlers();
         }
 
+        // Let QEMU refresh at an idle rate while the page is hidden
+        if (typeof document !== 'undefined') {
+            document.addEventListener('visibilitychange',
+                                      this._handleVisibilityChange);
+            this._handleVisibilityChange();
+        }
+
         // Start render loop
         this._render();
 
@@ -128,11 +173,70 @@ export class WasmDisplay {
             this.frameRequest = null;
         }
 
+        if (this.worker) {
+            this.worker.postMessage({ type: 'stop' });
+            this.module.wasmDisplayPort = null;
+        }
+
         this._removeInputHandlers();
+        if (typeof document !== 'undefined') {
+            document.removeEventListener('visibilitychange',
+                                         this._handleVisibilityChange);
+        }
 
         console.log('WASM Display: Stopped');
     }
 
+    /**
+     * Hand the canvas to a worker that draws straight from the shared
+     * wasm heap.  QEMU posts its update notifications to the worker
+     * through Module.wasmDisplayPort.  Returns false if the browser or
+     * the QEMU build cannot do that, the canvas is then left alone.
+     */
+    _startWorker() {
+        if (this.worker) {
+            // Restarting, the worker still has the canvas
+            this.worker.postMessage({ type: 'start' });
+            this.module.wasmDisplayPort = this.worker;
+            return true;
+        }
+
+        const buffer = this.module.HEAPU8 && this.module.HEAPU8.buffer;
+        if (typeof SharedArrayBuffer === 'undefined' ||
+            !(buffer instanceof SharedArrayBuffer) ||
+            !this.canvas.transferControlToOffscreen ||
+            !this.module._wasm_get_framebuffer_info) {
+            console.warn('WASM Display: No shared memory or OffscreenCanvas, ' +
+                         'rendering on the main thread');
+            return false;
+        }
+
+        const canvas = this.canvas.transferControlToOffscreen();
+        this.worker = new Worker(this.options.worker, { type: 'module' });
+        this.worker.onmessage = (event) => {
+            if (event.data.type === 'stats') {
+                this.workerStats = event.data.stats;
+            }
+        };
+        this.worker.postMessage({
+            type: 'start',
+            canvas,
+            buffer,
+            info: this.module._wasm_get_framebuffer_info()
+        }, [canvas]);
+        this.module.wasmDisplayPort = this.worker;
+        return true;
+    }
+
+    /**
+     * Render a frame soon, for the onDemand mode of the rendering worker.
+     */
+    requestFrame() {
+        if (this.running && !this.frameRequest) {
+            this.frameRequest = requestAnimationFrame(this._render);
+        }
+    }
+
     /**
      * Main render loop.
      */
@@ -141,18 +245,30 @@ export class WasmDisplay {
 
         const now = performance.now();
 
+        // Send the motion and wheel events of the last frame in one go
+        this._kickInput();
+
         try {
-            // Get framebuffer info from QEMU
-            const fbInfo = this._getFramebufferInfo();
+            // Get framebuffer info from QEMU, the worker does in worker mode
+            const fbInfo = this.worker ? null : this._getFramebufferInfo();
 
             if (fbInfo && fbInfo.dirty) {
                 this._updateCanvas(fbInfo);
                 this._ackFramebuffer();
 
+                // Let consumers such as WasmDisplayEncoder see the frame
+                if (this.options.onFrame) {
+                    this.options.onFrame(this.canvas, fbInfo.damage);
+                }
+
                 // Update stats
                 this.stats.frameCount++;
             }
 
+            if (this.options.enableInput && this.options.hardwareCursor) {
+                this._updateCursor();
+            }
+
             // Calculate FPS every second
             if (now - this.stats.lastTime >= 1000) {
                 this.stats.fps = this.stats.frameCount;
@@ -164,8 +280,34 @@ export class WasmDisplay {
             console.error('WASM Display: Render error', e);
         }
 
-        // Schedule next frame
-        this.frameRequest = requestAnimationFrame(this._render);
+        // Schedule next frame, or wait for QEMU to ask for it
+        if (this.options.onDemand) {
+            this.frameRequest = null;
+        } else {
+            this.frameRequest = requestAnimationFrame(this._render);
+        }
+    }
+
+    /**
+     * Views of the wasm memory.  When QEMU is built with
+     * ALLOW_MEMORY_GROWTH, the memory is grown from QEMU's threads, and
+     * emscripten only refreshes HEAPU8 and HEAP32 of the thread that grew
+     * it; build the views from Module.wasmMemory when it is exported.
+     */
+    _heap() {
+        const memory = this.module.wasmMemory;
+
+        if (!memory) {
+            return { HEAPU8: this.module.HEAPU8, HEAP32: this.module.HEAP32 };
+        }
+        if (!this.heap ||
+            this.heap.HEAPU8.byteLength !== memory.buffer.byteLength) {
+            this.heap = {
+                HEAPU8: new Uint8Array(memory.buffer),
+                HEAP32: new Int32Array(memory.buffer),
+            };
+        }
+        return this.heap;
     }
 
     /**
@@ -188,17 +330,20 @@ export class WasmDisplay {
         //     int32_t bpp;        // offset 16
         //     uint32_t format;    // offset 20
         //     bool dirty;         // offset 24
-        //     uint64_t frame_count; // offset 28 (aligned to 8)
+        //     uint64_t frame_count; // offset 32 (aligned to 8)
+        //     int32_t damage_count; // offset 40
+        //     WasmRect damage[16];  // offset 44
         // }
 
-        const HEAP32 = this.module.HEAP32;
-        const HEAPU8 = this.module.HEAPU8;
+        const HEAP32 = this._heap().HEAP32;
+        const HEAPU8 = this._heap().HEAPU8;
 
         const dataPtr = HEAP32[infoPtr >> 2];
         const width = HEAP32[(infoPtr + 4) >> 2];
         const height = HEAP32[(infoPtr + 8) >> 2];
         const stride = HEAP32[(infoPtr + 12) >> 2];
         const bpp = HEAP32[(infoPtr + 16) >> 2];
+        const format = HEAP32[(infoPtr + 20) >> 2];
         const dirty = HEAPU8[infoPtr + 24] !== 0;
 
         if (width <= 0 || height <= 0 || !dataPtr) {
@@ -211,8 +356,122 @@ export class WasmDisplay {
             height,
             stride,
             bpp,
-            dirty
+            format,
+            dirty,
+            damage: this._getDamage(width, height)
+        };
+    }
+
+    /**
+     * Draw the guest cursor as the CSS cursor of the canvas, so that it
+     * stays out of the framebuffer and moves at the host's pointer rate.
+     * See WasmCursorInfo in include/ui/wasm-display.h.
+     */
+    _updateCursor() {
+        if (!this.module._wasm_get_cursor_info) {
+            return;
+        }
+        if (!this.cursorInfo) {
+            this.cursorInfo = this.module._wasm_get_cursor_info();
+            if (!this.cursorInfo) return;
+        }
+
+        // struct WasmCursorInfo {
+        //     uint8_t *data;          // offset 0
+        //     int32_t width;          // offset 4
+        //     int32_t height;         // offset 8
+        //     int32_t hot_x;          // offset 12
+        //     int32_t hot_y;          // offset 16
+        //     int32_t x;              // offset 20
+        //     int32_t y;              // offset 24
+        //     int32_t visible;        // offset 28
+        //     uint32_t shape_serial;  // offset 32
+        //     uint32_t move_serial;   // offset 36
+        // }
+        const HEAP32 = this._heap().HEAP32;
+        const info = this.cursorInfo >> 2;
+        const shapeSerial = HEAP32[info + 8];
+        const moveSerial = HEAP32[info + 9];
+
+        if (shapeSerial === this.cursorShapeSerial &&
+            moveSerial === this.cursorMoveSerial) {
+            return;
+        }
+
+        if (shapeSerial !== this.cursorShapeSerial) {
+            this.cursorShapeSerial = shapeSerial;
+            this.cursorStyle = this._cursorToCss(HEAP32[info],
+                                                 HEAP32[info + 1],
+                                                 HEAP32[info + 2],
+                                                 HEAP32[info + 3],
+                                                 HEAP32[info + 4]);
+        }
+        this.cursorMoveSerial = moveSerial;
+        this.cursor = {
+            x: HEAP32[info + 5],
+            y: HEAP32[info + 6],
+            visible: HEAP32[info + 7] !== 0
         };
+
+        let style = this.cursorStyle || this.options.cursorStyle;
+        if (moveSerial !== 0 && !this.cursor.visible) {
+            style = 'none';
+        }
+        if (this.canvas.style.cursor !== style) {
+            this.canvas.style.cursor = style;
+        }
+    }
+
+    /**
+     * Turn the RGBA cursor image into a CSS cursor value.
+     */
+    _cursorToCss(dataPtr, width, height, hotX, hotY) {
+        if (!dataPtr || width <= 0 || height <= 0) {
+            return null;
+        }
+
+        const canvas = document.createElement('canvas');
+        canvas.width = width;
+        canvas.height = height;
+        const image = new ImageData(width, height);
+        image.data.set(this._heap().HEAPU8.subarray(dataPtr,
+                                                    dataPtr + width * height * 4));
+        canvas.getContext('2d').putImageData(image, 0, 0);
+
+        return `url(${canvas.toDataURL()}) ${hotX} ${hotY}, ` +
+               this.options.cursorStyle;
+    }
+
+    /**
+     * Get the regions updated since the last ack, as {x, y, w, h}.
+     * Falls back to the whole framebuffer if QEMU has no damage list.
+     */
+    _getDamage(width, height) {
+        const full = [{ x: 0, y: 0, w: width, h: height }];
+
+        if (!this.module._wasm_get_framebuffer_damage ||
+            !this.module._wasm_get_framebuffer_damage_count) {
+            return full;
+        }
+
+        const count = this.module._wasm_get_framebuffer_damage_count();
+        const rectPtr = this.module._wasm_get_framebuffer_damage();
+        if (!count || !rectPtr) {
+            return full;
+        }
+
+        const HEAP32 = this._heap().HEAP32;
+        const rects = [];
+        for (let i = 0; i < count; i++) {
+            const base = (rectPtr >> 2) + i * 4;
+            rects.push({
+                x: HEAP32[base],
+                y: HEAP32[base + 1],
+                w: HEAP32[base + 2],
+                h: HEAP32[base + 3]
+            });
+        }
+        return rects;
     }
 
     /**
@@ -229,6 +488,7 @@ export class WasmDisplay {
      */
     _updateCanvas(fbInfo) {
         const { dataPtr, width, height, stride } = fbInfo;
+        let damage = fbInfo.damage;
 
         // Resize canvas if needed
         if (this.width !== width || this.height !== height) {
@@ -236,29 +496,66 @@ export class WasmDisplay {
         }
 
         // Get framebuffer data
-        const HEAPU8 = this.module.HEAPU8;
-        const size = height * stride;
+        const HEAPU8 = this._heap().HEAPU8;
 
-        // Create ImageData if needed
+        // Create ImageData if needed, it then needs a full upload
         if (!this.imageData || this.imageData.width !== width || this.imageData.height !== height) {
             this.imageData = this.ctx.createImageData(width, height);
+            damage = [{ x: 0, y: 0, w: width, h: height }];
         }
 
-        // Copy pixel data (RGBA format from QEMU)
-        const srcData = HEAPU8.subarray(dataPtr, dataPtr + size);
         const dstData = this.imageData.data;
-
-        // Direct copy since QEMU already converts to RGBA
-        for (let y = 0; y < height; y++) {
-            const srcOffset = y * stride;
-            const dstOffset = y * width * 4;
-            for (let x = 0; x < width * 4; x++) {
-                dstData[dstOffset + x] = srcData[srcOffset + x];
+        const dst32 = new Uint32Array(dstData.buffer);
+
+        // With -display wasm,zero-copy=on the data is the guest surface,
+        // in one of the 32 bpp pixman types: ARGB (BGRX in memory), ABGR
+        // (RGBX), BGRA (XRGB) or RGBA (XBGR)
+        const type = (fbInfo.format >> 16) & 0xff;
+        const swizzle = this._swizzle(type);
+        const noAlpha = type === 3 && ((fbInfo.format >> 12) & 0xf) === 0;
+
+        // Copy and draw only the damaged regions
+        for (const { x, y, w, h } of damage) {
+            for (let row = y; row < y + h; row++) {
+                const src = dataPtr + row * stride + x * 4;
+                const dst = row * width + x;
+
+                if (swizzle) {
+                    const src32 = new Uint32Array(HEAPU8.buffer, src, w);
+                    for (let i = 0; i < w; i++) {
+                        dst32[dst + i] = swizzle(src32[i]);
+                    }
+                } else {
+                    dstData.set(HEAPU8.subarray(src, src + w * 4), dst * 4);
+                    if (noAlpha) {
+                        // Nothing guarantees the X byte is opaque
+                        for (let i = 0; i < w; i++) {
+                            dst32[dst + i] |= 0xff000000;
+                        }
+                    }
+                }
             }
+            this.ctx.putImageData(this.imageData, 0, 0, x, y, w, h);
         }
+    }
 
-        // Draw to canvas
-        this.ctx.putImageData(this.imageData, 0, 0);
+    /**
+     * Get the function that turns a little endian 32 bpp pixel of the
+     * given pixman type into RGBA, or null if it is RGBA already.
+     */
+    _swizzle(type) {
+        switch (type) {
+        case 2:     // ARGB: B G R X
+            return (p) => 0xff000000 | ((p >> 16) & 0xff) | (p & 0xff00) |
+                          ((p & 0xff) << 16);
+        case 8:     // BGRA: X R G B
+            return (p) => 0xff000000 | (p >>> 8);
+        case 9:     // RGBA: X B G R
+            return (p) => 0xff000000 | (p >>> 24) | ((p >>> 8) & 0xff00) |
+                          ((p << 8) & 0xff0000);
+        default:
+            return null;
+        }
     }
 
     /**
@@ -281,9 +578,11 @@ export class WasmDisplay {
             }
         }
 
-        // Set actual canvas resolution
-        this.canvas.width = width;
-        this.canvas.height = height;
+        // Set actual canvas resolution, which is the worker's in worker mode
+        if (!this.worker) {
+            this.canvas.width = width;
+            this.canvas.height = height;
+        }
 
         // Clear ImageData cache
         this.imageData = null;
@@ -367,10 +666,57 @@ export class WasmDisplay {
         };
     }
 
+    /**
+     * Queue an input event in QEMU's input ring (see WasmInputRing in
+     * include/ui/wasm-display.h), so that a whole frame of events costs
+     * a single call into QEMU.  Returns false if the event could not be
+     * queued and has to be sent directly.
+     */
+    _queueInput(type, a, b) {
+        if (!this.module._wasm_get_input_ring ||
+            !this.module._wasm_input_kick) {
+            return false;
+        }
+        if (!this.inputRing) {
+            this.inputRing = this.module._wasm_get_input_ring();
+            if (!this.inputRing) return false;
+        }
+
+        const HEAP32 = this._heap().HEAP32;
+        const base = this.inputRing >> 2;
+        const head = Atomics.load(HEAP32, base);
+        const tail = Atomics.load(HEAP32, base + 1);
+
+        if (((head - tail) >>> 0) >= INPUT_RING_SIZE) {
+            return false;
+        }
+
+        const ev = base + 2 + ((head >>> 0) % INPUT_RING_SIZE) * 4;
+        HEAP32[ev] = type;
+        HEAP32[ev + 1] = a;
+        HEAP32[ev + 2] = b;
+        Atomics.store(HEAP32, base, (head + 1) | 0);
+        this.inputQueued = true;
+        return true;
+    }
+
+    /**
+     * Have QEMU process the queued input events.
+     */
+    _kickInput() {
+        if (this.inputQueued) {
+            this.inputQueued = false;
+            this.module._wasm_input_kick();
+        }
+    }
+
     _handleKeyDown(event) {
         event.preventDefault();
         const keycode = this._keyToQKeyCode(event);
-        if (keycode && this.module._wasm_send_keyboard_event) {
+        if (!keycode) return;
+        if (this._queueInput(INPUT_KEY, keycode, 1)) {
+            this._kickInput();
+        } else if (this.module._wasm_send_keyboard_event) {
             this.module._wasm_send_keyboard_event(keycode, 1);
         }
     }
@@ -378,38 +724,48 @@ export class WasmDisplay {
     _handleKeyUp(event) {
         event.preventDefault();
         const keycode = this._keyToQKeyCode(event);
-        if (keycode && this.module._wasm_send_keyboard_event) {
+        if (!keycode) return;
+        if (this._queueInput(INPUT_KEY, keycode, 0)) {
+            this._kickInput();
+        } else if (this.module._wasm_send_keyboard_event) {
             this.module._wasm_send_keyboard_event(keycode, 0);
         }
     }
 
     _handleMouseMove(event) {
         const pos = this._getMousePosition(event);
-        if (this.module._wasm_send_mouse_motion) {
+        // Motion is only sent on the next frame, QEMU keeps the last one
+        if (!this._queueInput(INPUT_MOTION, pos.x, pos.y) &&
+            this.module._wasm_send_mouse_motion) {
             this.module._wasm_send_mouse_motion(pos.x, pos.y);
         }
     }
 
     _handleMouseDown(event) {
         event.preventDefault();
-        if (this.module._wasm_send_mouse_button) {
+        if (this._queueInput(INPUT_BUTTON, event.button, 1)) {
+            this._kickInput();
+        } else if (this.module._wasm_send_mouse_button) {
             this.module._wasm_send_mouse_button(event.button, 1);
         }
     }
 
     _handleMouseUp(event) {
         event.preventDefault();
-        if (this.module._wasm_send_mouse_button) {
+        if (this._queueInput(INPUT_BUTTON, event.button, 0)) {
+            this._kickInput();
+        } else if (this.module._wasm_send_mouse_button) {
             this.module._wasm_send_mouse_button(event.button, 0);
         }
     }
 
     _handleWheel(event) {
         event.preventDefault();
-        if (this.module._wasm_send_mouse_wheel) {
-            const dx = Math.sign(event.deltaX);
-            const dy = Math.sign(event.deltaY);
-            this.module._wasm_send_mouse_wheel(dx, -dy);  // Invert Y for natural scrolling
+        const dx = Math.sign(event.deltaX);
+        const dy = -Math.sign(event.deltaY);  // Invert Y for natural scrolling
+        if (!this._queueInput(INPUT_WHEEL, dx, dy) &&
+            this.module._wasm_send_mouse_wheel) {
+            this.module._wasm_send_mouse_wheel(dx, dy);
         }
     }
 
@@ -417,11 +773,32 @@ export class WasmDisplay {
         event.preventDefault();
     }
 
+    _handleVisibilityChange() {
+        if (this.module._wasm_set_display_visible) {
+            this.module._wasm_set_display_visible(
+                document.visibilityState === 'hidden' ? 0 : 1);
+        }
+    }
+
+    /**
+     * Get the guest cursor position and visibility, for pages that draw
+     * it themselves, e.g. while the pointer is locked.
+     */
+    getCursor() {
+        return { ...this.cursor };
+    }
+
     /**
      * Get current performance statistics.
      */
     getStats() {
-        return { ...this.stats };
+        // In worker mode the frames are counted there
+        const stats = { ...this.stats, ...this.workerStats };
+        if (this.module._wasm_get_refresh_interval) {
+            // Current QEMU refresh interval in ms, larger while idle
+            stats.refreshInterval = this.module._wasm_get_refresh_interval();
+        }
+        return stats;
     }
 }
 
@@ -0,0 +1,89 @@
+/**
+ * QEMU WASM Display - VideoEncoder worker for wasm-encoder.js
+ *
+ * Messages from the page:
+ *   { type: 'configure', config }     VideoEncoderConfig
+ *   { type: 'encode', frame, keyFrame } VideoFrame, transferred
+ *   { type: 'close' }
+ *
+ * Messages to the page:
+ *   { type: 'chunk', chunk }  { type, timestamp, duration, data,
+ *                               decoderConfig }, data transferred
+ *   { type: 'done' }          one frame left the encoder queue
+ *   { type: 'error', message }
+ */
+
+let encoder = null;
+// Older browsers have no dequeue event, count the output chunks instead
+let dequeueEvents = false;
+
+function postError(e) {
+    self.postMessage({ type: 'error', message: String(e) });
+}
+
+function output(chunk, metadata) {
+    const data = new ArrayBuffer(chunk.byteLength);
+    chunk.copyTo(data);
+
+    self.postMessage({
+        type: 'chunk',
+        chunk: {
+            type: chunk.type,            // 'key' or 'delta'
+            timestamp: chunk.timestamp,  // us
+            duration: chunk.duration,
+            data,
+            // Present with the first chunk and after a configure
+            decoderConfig: metadata ? metadata.decoderConfig : undefined
+        }
+    }, [data]);
+
+    if (!dequeueEvents) {
+        self.postMessage({ type: 'done' });
+    }
+}
+
+function configure(config) {
+    if (encoder && encoder.state !== 'closed') {
+        encoder.close();
+    }
+    encoder = new VideoEncoder({ output, error: postError });
+    dequeueEvents = 'ondequeue' in encoder;
+    if (dequeueEvents) {
+        encoder.addEventListener('dequeue', () => {
+            self.postMessage({ type: 'done' });
+        });
+    }
+    encoder.configure(config);
+}
+
+self.onmessage = (event) => {
+    const msg = event.data;
+
+    try {
+        switch (msg.type) {
+        case 'configure':
+            configure(msg.config);
+            break;
+        case 'encode':
+            if (!encoder || encoder.state !== 'configured') {
+                msg.frame.close();
+                self.postMessage({ type: 'done' });
+                break;
+            }
+            encoder.encode(msg.frame, { keyFrame: msg.keyFrame });
+            msg.frame.close();
+            break;
+        case 'close':
+            if (encoder && encoder.state !== 'closed') {
+                encoder.close();
+            }
+            self.close();
+            break;
+        }
+    } catch (e) {
+        if (msg.frame) {
+            msg.frame.close();
+        }
+        postError(e);
+    }
+};
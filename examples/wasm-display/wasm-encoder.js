@@ -0,0 +1,233 @@
+/**
+ * QEMU WASM Display - Encoded stream output
+ *
+ * Feeds the frames that WasmDisplay draws to a WebCodecs VideoEncoder
+ * running on a worker, and hands out the encoded chunks, for example
+ * to send them over a WebSocket to remote viewers.
+ *
+ * Only frames with damage are encoded: a static screen costs nothing,
+ * and a new viewer can ask for a key frame with requestKeyFrame().
+ *
+ * Usage:
+ *   import { WasmDisplayEncoder } from './wasm-encoder.js';
+ *   const encoder = new WasmDisplayEncoder(display, {
+ *       codec: 'vp09.00.10.08',
+ *       onChunk: (chunk) => socket.send(chunk.data)
+ *   });
+ *   encoder.start();
+ */
+
+export class WasmDisplayEncoder {
+    /**
+     * Create an encoder for a WasmDisplay.
+     *
+     * @param {WasmDisplay} display - The display whose frames to encode
+     * @param {Object} options - Optional configuration
+     */
+    constructor(display, options = {}) {
+        this.display = display;
+
+        // Options with defaults
+        this.options = {
+            codec: options.codec || 'avc1.42001f',  // H.264 baseline
+            bitrate: options.bitrate || 2000000,
+            maxFps: options.maxFps || 30,
+            keyFrameInterval: options.keyFrameInterval || 10000,  // ms
+            // Frames queued in the encoder before we drop new ones
+            maxQueue: options.maxQueue || 2,
+            workerUrl: options.workerUrl ||
+                new URL('./wasm-encoder-worker.js', import.meta.url),
+            ...options
+        };
+
+        // State
+        this.worker = null;
+        this.width = 0;
+        this.height = 0;
+        this.pending = 0;
+        this.lastFrameTime = 0;
+        this.lastKeyFrameTime = 0;
+        this.keyFrameRequested = true;
+        this.startTime = 0;
+        this.catchUp = null;
+
+        this.stats = {
+            framesEncoded: 0,
+            framesDropped: 0,
+            bytes: 0
+        };
+
+        this._onFrame = this._onFrame.bind(this);
+        this._onMessage = this._onMessage.bind(this);
+    }
+
+    /**
+     * Check whether the browser can encode with the configured codec.
+     */
+    static async isSupported(codec = 'avc1.42001f', width = 1024,
+                             height = 768) {
+        if (typeof VideoEncoder === 'undefined') {
+            return false;
+        }
+        const support = await VideoEncoder.isConfigSupported({
+            codec, width, height
+        });
+        return support.supported;
+    }
+
+    /**
+     * Start encoding the frames that the display draws.
+     */
+    start() {
+        if (this.worker) return;
+
+        this.worker = new Worker(this.options.workerUrl, { type: 'module' });
+        this.worker.onmessage = this._onMessage;
+        this.startTime = performance.now();
+        this.keyFrameRequested = true;
+
+        this.previousOnFrame = this.display.options.onFrame;
+        this.display.options.onFrame = this._onFrame;
+    }
+
+    /**
+     * Stop encoding, dropping the frames that are still queued.
+     */
+    stop() {
+        if (!this.worker) return;
+
+        this.display.options.onFrame = this.previousOnFrame;
+        clearTimeout(this.catchUp);
+        this.catchUp = null;
+        this.worker.postMessage({ type: 'close' });
+        this.worker = null;
+        this.width = 0;
+        this.height = 0;
+        this.pending = 0;
+    }
+
+    /**
+     * Make the next encoded frame a key frame, e.g. for a new viewer.
+     */
+    requestKeyFrame() {
+        this.keyFrameRequested = true;
+    }
+
+    /**
+     * Get encoder statistics.
+     */
+    getStats() {
+        return { ...this.stats, queued: this.pending };
+    }
+
+    _onFrame(canvas, damage) {
+        if (this.previousOnFrame) {
+            this.previousOnFrame(canvas, damage);
+        }
+        if (!this.worker || !damage || !damage.length) {
+            return;
+        }
+
+        this._maybeEncode(canvas);
+    }
+
+    _maybeEncode(canvas) {
+        const now = performance.now();
+        if (now - this.lastFrameTime < 1000 / this.options.maxFps) {
+            // The damage is in the canvas, a later frame will carry it
+            this.stats.framesDropped++;
+            this._scheduleCatchUp();
+            return;
+        }
+        if (this.pending >= this.options.maxQueue) {
+            this.stats.framesDropped++;
+            this._scheduleCatchUp();
+            return;
+        }
+
+        this._encode(canvas, now);
+    }
+
+    /**
+     * Encode the canvas once more after dropped frames, so that the
+     * final state of the screen is always sent.
+     */
+    _scheduleCatchUp() {
+        if (this.catchUp) return;
+
+        this.catchUp = setTimeout(() => {
+            this.catchUp = null;
+            if (this.worker) {
+                this._maybeEncode(this.display.canvas);
+            }
+        }, 1000 / this.options.maxFps);
+    }
+
+    _encode(canvas, now) {
+        if (canvas.width !== this.width || canvas.height !== this.height) {
+            // Codecs want even dimensions
+            this.width = canvas.width & ~1;
+            this.height = canvas.height & ~1;
+            this.worker.postMessage({
+                type: 'configure',
+                config: {
+                    codec: this.options.codec,
+                    width: this.width,
+                    height: this.height,
+                    bitrate: this.options.bitrate,
+                    framerate: this.options.maxFps,
+                    latencyMode: 'realtime'
+                }
+            });
+            this.keyFrameRequested = true;
+        }
+
+        const keyFrame = this.keyFrameRequested ||
+            now - this.lastKeyFrameTime >= this.options.keyFrameInterval;
+        const frame = new VideoFrame(canvas, {
+            timestamp: Math.round((now - this.startTime) * 1000),  // us
+            visibleRect: { x: 0, y: 0, width: this.width,
+                           height: this.height }
+        });
+
+        this.worker.postMessage({ type: 'encode', frame, keyFrame },
+                                [frame]);
+        this.pending++;
+        this.lastFrameTime = now;
+        if (keyFrame) {
+            this.keyFrameRequested = false;
+            this.lastKeyFrameTime = now;
+        }
+    }
+
+    _onMessage(event) {
+        const msg = event.data;
+
+        switch (msg.type) {
+        case 'chunk':
+            this.stats.bytes += msg.chunk.data.byteLength;
+            if (this.options.onChunk) {
+                this.options.onChunk(msg.chunk);
+            }
+            break;
+        case 'done':
+            this.pending = Math.max(this.pending - 1, 0);
+            this.stats.framesEncoded++;
+            break;
+        case 'error':
+            console.error('WASM Display Encoder:', msg.message);
+            this.keyFrameRequested = true;
+            this.width = 0;  // Configure again on the next frame
+            this.pending = 0;
+            if (this.options.onError) {
+                this.options.onError(msg.message);
+            }
+            break;
+        }
+    }
+}
+
+// For non-module usage
+if (typeof window !== 'undefined') {
+    window.WasmDisplayEncoder = WasmDisplayEncoder;
+}
@@ -2829,6 +2829,20 @@ float32 float64_to_float32(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (likely(float64_is_normal(a)) && can_use_fpu(s)) {
+        union_float64 ua;
+        union_float32 ur;
+
+        ua.s = a;
+        ur.h = ua.h;
+        /* Only an overflow or an underflow would raise more than inexact */
+        if (likely(isfinite(ur.h) && fabsf(ur.h) > FLT_MIN)) {
+            return ur.s;
+        }
+    } else if (float64_is_zero(a)) {
+        return float32_set_sign(float32_zero, float64_is_neg(a));
+    }
+
     float64_unpack_canonical(&p, a, s);
     parts_float_to_float(&p, s);
     return float32_round_pack_canonical(&p, s);
@@ -2994,6 +3008,15 @@ float32 float32_round_to_int(float32 a, float_status *s)
 {
     FloatParts64 p;
 
+    /* rintf() rounds to nearest even, and can only raise inexact */
+    if (likely(float32_is_zero_or_normal(a)) && can_use_fpu(s)) {
+        union_float32 ua;
+
+        ua.s = a;
+        ua.h = rintf(ua.h);
+        return ua.s;
+    }
+
     float32_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float32_params);
     return float32_round_pack_canonical(&p, s);
@@ -3003,6 +3026,14 @@ float64 float64_round_to_int(float64 a, float_status *s)
 {
     FloatParts64 p;
 
+    if (likely(float64_is_zero_or_normal(a)) && can_use_fpu(s)) {
+        union_float64 ua;
+
+        ua.s = a;
+        ua.h = rint(ua.h);
+        return ua.s;
+    }
+
     float64_unpack_canonical(&p, a, s);
     parts_round_to_int(&p, s->float_rounding_mode, 0, s, &float64_params);
     return float64_round_pack_canonical(&p, s);
@@ -3263,6 +3294,61 @@ static int64_t floatx80_to_int64_scalbn(floatx80 a, FloatRoundMode rmode,
     return parts_float_to_sint(&p, rmode, scale, INT64_MIN, INT64_MAX, s);
 }
 
+/*
+ * Hardfloat conversions to integers, rounding to nearest even or towards
+ * zero.  The rounded value is integral, so it converts exactly when it is
+ * in [@min, @lim); everything else, including NaNs and infinities, takes
+ * the softfloat path that raises invalid.  Like the arithmetic hardfloat
+ * ops, this relies on inexact being set already.
+ */
+static inline bool hard_float32_to_int(float32 a, bool round_to_zero,
+                                       double min, double lim,
+                                       float_status *s, int64_t *ret)
+{
+    union_float32 ua;
+    double d;
+
+    if (QEMU_NO_HARDFLOAT ||
+        !(s->float_exception_flags & float_flag_inexact) ||
+        (!round_to_zero &&
+         s->float_rounding_mode != float_round_nearest_even) ||
+        unlikely(!float32_is_zero_or_normal(a))) {
+        return false;
+    }
+
+    ua.s = a;
+    d = round_to_zero ? truncf(ua.h) : rintf(ua.h);
+    if (unlikely(!(d >= min && d < lim))) {
+        return false;
+    }
+    *ret = d;
+    return true;
+}
+
+static inline bool hard_float64_to_int(float64 a, bool round_to_zero,
+                                       double min, double lim,
+                                       float_status *s, int64_t *ret)
+{
+    union_float64 ua;
+    double d;
+
+    if (QEMU_NO_HARDFLOAT ||
+        !(s->float_exception_flags & float_flag_inexact) ||
+        (!round_to_zero &&
+         s->float_rounding_mode != float_round_nearest_even) ||
+        unlikely(!float64_is_zero_or_normal(a))) {
+        return false;
+    }
+
+    ua.s = a;
+    d = round_to_zero ? trunc(ua.h) : rint(ua.h);
+    if (unlikely(!(d >= min && d < lim))) {
+        return false;
+    }
+    *ret = d;
+    return true;
+}
+
 int8_t float16_to_int8(float16 a, float_status *s)
 {
     return float16_to_int8_scalbn(a, s->float_rounding_mode, 0, s);
@@ -3290,11 +3376,21 @@ int16_t float32_to_int16(float32 a, float_status *s)
 
 int32_t float32_to_int32(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float32_to_int(a, false, -0x1p31, 0x1p31, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float32_to_int64(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float32_to_int(a, false, -0x1p63, 0x1p63, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -3305,11 +3401,21 @@ int16_t float64_to_int16(float64 a, float_status *s)
 
 int32_t float64_to_int32(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float64_to_int(a, false, -0x1p31, 0x1p31, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
 int64_t float64_to_int64(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float64_to_int(a, false, -0x1p63, 0x1p63, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, s->float_rounding_mode, 0, s);
 }
 
@@ -3360,11 +3466,21 @@ int16_t float32_to_int16_round_to_zero(float32 a, float_status *s)
 
 int32_t float32_to_int32_round_to_zero(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float32_to_int(a, true, -0x1p31, 0x1p31, s, &r)) {
+        return r;
+    }
     return float32_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float32_to_int64_round_to_zero(float32 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float32_to_int(a, true, -0x1p63, 0x1p63, s, &r)) {
+        return r;
+    }
     return float32_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -3375,11 +3491,21 @@ int16_t float64_to_int16_round_to_zero(float64 a, float_status *s)
 
 int32_t float64_to_int32_round_to_zero(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float64_to_int(a, true, -0x1p31, 0x1p31, s, &r)) {
+        return r;
+    }
     return float64_to_int32_scalbn(a, float_round_to_zero, 0, s);
 }
 
 int64_t float64_to_int64_round_to_zero(float64 a, float_status *s)
 {
+    int64_t r;
+
+    if (hard_float64_to_int(a, true, -0x1p63, 0x1p63, s, &r)) {
+        return r;
+    }
     return float64_to_int64_scalbn(a, float_round_to_zero, 0, s);
 }
 
@@ -4283,6 +4409,23 @@ static float32 float32_minmax(float32 a, float32 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    /* Ordered inputs that are neither NaNs nor denormals raise no flags */
+    if (!QEMU_NO_HARDFLOAT && likely(float32_is_zero_or_normal(a) &&
+                                     float32_is_zero_or_normal(b))) {
+        union_float32 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (flags & minmax_ismag) {
+            ua.h = fabsf(ua.h);
+            ub.h = fabsf(ub.h);
+        }
+        /* Ties, including zeros of either sign, are left to softfloat */
+        if (likely(ua.h != ub.h)) {
+            return (ua.h < ub.h) == !!(flags & minmax_ismin) ? a : b;
+        }
+    }
+
     float32_unpack_canonical(&pa, a, s);
     float32_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
@@ -4294,6 +4437,22 @@ static float64 float64_minmax(float64 a, float64 b, float_status *s, int flags)
 {
     FloatParts64 pa, pb, *pr;
 
+    if (!QEMU_NO_HARDFLOAT && likely(float64_is_zero_or_normal(a) &&
+                                     float64_is_zero_or_normal(b))) {
+        union_float64 ua, ub;
+
+        ua.s = a;
+        ub.s = b;
+        if (flags & minmax_ismag) {
+            ua.h = fabs(ua.h);
+            ub.h = fabs(ub.h);
+        }
+        /* Ties, including zeros of either sign, are left to softfloat */
+        if (likely(ua.h != ub.h)) {
+            return (ua.h < ub.h) == !!(flags & minmax_ismin) ? a : b;
+        }
+    }
+
     float64_unpack_canonical(&pa, a, s);
     float64_unpack_canonical(&pb, b, s);
     pr = parts_minmax(&pa, &pb, s, flags);
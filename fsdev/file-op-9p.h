@@ -94,6 +94,8 @@ typedef struct FsDriverEntry {
     FsThrottle fst;
     mode_t fmode;
     mode_t dmode;
+    /* Milliseconds to cache file attributes for, 0 to not cache them */
+    uint64_t cache_ttl;
 } FsDriverEntry;
 
 struct FsContext {
@@ -59,6 +59,7 @@ static FsDriverTable FsDrivers[] = {
             "fmode",
             "dmode",
             "multidevs",
+            "cache_ttl",
             "throttling.bps-total",
             "throttling.bps-read",
             "throttling.bps-write",
@@ -100,6 +101,18 @@ static FsDriverTable FsDrivers[] = {
             NULL
         },
     },
+#ifdef EMSCRIPTEN
+    {
+        .name = "opfs",
+        .ops = &opfs_ops,
+        .opts = (const char * []) {
+            COMMON_FS_DRIVER_OPTIONS,
+            "path",
+            "cache_ttl",
+            NULL
+        },
+    },
+#endif
 };
 
 static int validate_opt(void *opaque, const char *name, const char *value,
@@ -660,6 +660,22 @@ SRST
     Show iothread's identifiers.
 ERST
 
+    {
+        .name       = "heap",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the memory held by the main heap consumers",
+        .cmd        = hmp_info_heap,
+        .flags      = "p",
+    },
+
+SRST
+  ``info heap``
+    Show the memory held by guest RAM, translated code and its metadata,
+    wasm modules, coroutine stacks, block caches and framebuffers, and on
+    emscripten how much of the heap is taken.
+ERST
+
     {
         .name       = "rocker",
         .args_type  = "name:s",
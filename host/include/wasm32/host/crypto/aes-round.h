@@ -0,0 +1,174 @@
+/*
+ * wasm SIMD128 specific aes acceleration.
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef WASM32_HOST_CRYPTO_AES_ROUND_H
+#define WASM32_HOST_CRYPTO_AES_ROUND_H
+
+#ifdef __wasm_simd128__
+#include "crypto/aes.h"
+#include <wasm_simd128.h>
+
+/*
+ * There is no AES instruction, but a module built with SIMD128 always has
+ * i8x16.swizzle, which gives constant time table lookups without touching
+ * memory per byte: SubBytes is 16 lookups in the 16-byte rows of the
+ * S-box, where indexes outside of 0-15 select zero.
+ */
+#define HAVE_AES_ACCEL  true
+#define ATTR_AES_ACCEL
+
+static inline v128_t aes_accel_ld(const AESState *p, bool be)
+{
+    v128_t t = wasm_v128_load(p);
+
+    if (be) {
+        t = wasm_i8x16_shuffle(t, t, 15, 14, 13, 12, 11, 10, 9, 8,
+                               7, 6, 5, 4, 3, 2, 1, 0);
+    }
+    return t;
+}
+
+static inline void aes_accel_st(AESState *p, v128_t t, bool be)
+{
+    if (be) {
+        t = wasm_i8x16_shuffle(t, t, 15, 14, 13, 12, 11, 10, 9, 8,
+                               7, 6, 5, 4, 3, 2, 1, 0);
+    }
+    wasm_v128_store(p, t);
+}
+
+static inline v128_t aes_accel_lookup(const uint8_t *box, v128_t x)
+{
+    v128_t r = wasm_i8x16_swizzle(wasm_v128_load(box), x);
+
+    for (int i = 1; i < 16; i++) {
+        x = wasm_i8x16_sub(x, wasm_i8x16_splat(16));
+        r = wasm_v128_or(r, wasm_i8x16_swizzle(wasm_v128_load(box + i * 16),
+                                               x));
+    }
+    return r;
+}
+
+/* SubBytes + ShiftRows */
+static inline v128_t aes_accel_sb_sr(v128_t x)
+{
+    x = wasm_i8x16_shuffle(x, x, 0, 5, 10, 15, 4, 9, 14, 3,
+                           8, 13, 2, 7, 12, 1, 6, 11);
+    return aes_accel_lookup(AES_sbox, x);
+}
+
+/* InvSubBytes + InvShiftRows */
+static inline v128_t aes_accel_isb_isr(v128_t x)
+{
+    x = wasm_i8x16_shuffle(x, x, 0, 13, 10, 7, 4, 1, 14, 11,
+                           8, 5, 2, 15, 12, 9, 6, 3);
+    return aes_accel_lookup(AES_isbox, x);
+}
+
+/* Multiply each byte by x in GF(2^8) */
+static inline v128_t aes_accel_xtime(v128_t x)
+{
+    v128_t carry = wasm_i8x16_shr(x, 7);
+
+    return wasm_v128_xor(wasm_i8x16_shl(x, 1),
+                         wasm_v128_and(carry, wasm_i8x16_splat(0x1b)));
+}
+
+/* Rotate each column up by 1, 2 and 3 rows */
+#define AES_ACCEL_ROT(c, r, n)  ((c) * 4 + (((r) + (n)) & 3))
+#define aes_accel_rot(x, n)                                                 \
+    wasm_i8x16_shuffle(x, x,                                                \
+        AES_ACCEL_ROT(0, 0, n), AES_ACCEL_ROT(0, 1, n),                     \
+        AES_ACCEL_ROT(0, 2, n), AES_ACCEL_ROT(0, 3, n),                     \
+        AES_ACCEL_ROT(1, 0, n), AES_ACCEL_ROT(1, 1, n),                     \
+        AES_ACCEL_ROT(1, 2, n), AES_ACCEL_ROT(1, 3, n),                     \
+        AES_ACCEL_ROT(2, 0, n), AES_ACCEL_ROT(2, 1, n),                     \
+        AES_ACCEL_ROT(2, 2, n), AES_ACCEL_ROT(2, 3, n),                     \
+        AES_ACCEL_ROT(3, 0, n), AES_ACCEL_ROT(3, 1, n),                     \
+        AES_ACCEL_ROT(3, 2, n), AES_ACCEL_ROT(3, 3, n))
+
+static inline v128_t aes_accel_mc(v128_t x)
+{
+    v128_t x2 = aes_accel_xtime(x);
+    v128_t x3 = wasm_v128_xor(x2, x);
+
+    /* 2.a[r] + 3.a[r + 1] + a[r + 2] + a[r + 3] */
+    return wasm_v128_xor(wasm_v128_xor(x2, aes_accel_rot(x3, 1)),
+                         wasm_v128_xor(aes_accel_rot(x, 2),
+                                       aes_accel_rot(x, 3)));
+}
+
+static inline v128_t aes_accel_imc(v128_t x)
+{
+    /* InvMixColumns is MixColumns after adding 4.(a[r] + a[r + 2]) */
+    v128_t u = aes_accel_xtime(aes_accel_xtime(
+                   wasm_v128_xor(x, aes_accel_rot(x, 2))));
+
+    return aes_accel_mc(wasm_v128_xor(x, u));
+}
+
+static inline void
+aesenc_MC_accel(AESState *ret, const AESState *st, bool be)
+{
+    aes_accel_st(ret, aes_accel_mc(aes_accel_ld(st, be)), be);
+}
+
+static inline void
+aesenc_SB_SR_AK_accel(AESState *ret, const AESState *st,
+                      const AESState *rk, bool be)
+{
+    v128_t t = aes_accel_sb_sr(aes_accel_ld(st, be));
+
+    aes_accel_st(ret, wasm_v128_xor(t, aes_accel_ld(rk, be)), be);
+}
+
+static inline void
+aesenc_SB_SR_MC_AK_accel(AESState *ret, const AESState *st,
+                         const AESState *rk, bool be)
+{
+    v128_t t = aes_accel_mc(aes_accel_sb_sr(aes_accel_ld(st, be)));
+
+    aes_accel_st(ret, wasm_v128_xor(t, aes_accel_ld(rk, be)), be);
+}
+
+static inline void
+aesdec_IMC_accel(AESState *ret, const AESState *st, bool be)
+{
+    aes_accel_st(ret, aes_accel_imc(aes_accel_ld(st, be)), be);
+}
+
+static inline void
+aesdec_ISB_ISR_AK_accel(AESState *ret, const AESState *st,
+                        const AESState *rk, bool be)
+{
+    v128_t t = aes_accel_isb_isr(aes_accel_ld(st, be));
+
+    aes_accel_st(ret, wasm_v128_xor(t, aes_accel_ld(rk, be)), be);
+}
+
+static inline void
+aesdec_ISB_ISR_AK_IMC_accel(AESState *ret, const AESState *st,
+                            const AESState *rk, bool be)
+{
+    v128_t t = aes_accel_isb_isr(aes_accel_ld(st, be));
+
+    t = wasm_v128_xor(t, aes_accel_ld(rk, be));
+    aes_accel_st(ret, aes_accel_imc(t), be);
+}
+
+static inline void
+aesdec_ISB_ISR_IMC_AK_accel(AESState *ret, const AESState *st,
+                            const AESState *rk, bool be)
+{
+    v128_t t = aes_accel_imc(aes_accel_isb_isr(aes_accel_ld(st, be)));
+
+    aes_accel_st(ret, wasm_v128_xor(t, aes_accel_ld(rk, be)), be);
+}
+#else
+/* Without SIMD128, the table code of crypto/aes.c is as good as it gets. */
+#include "host/include/generic/host/crypto/aes-round.h"
+#endif
+
+#endif /* WASM32_HOST_CRYPTO_AES_ROUND_H */
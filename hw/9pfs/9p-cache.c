@@ -0,0 +1,180 @@
+/*
+ * 9p attribute cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Not so fast! You might want to read the 9p developer docs first:
+ * https://wiki.qemu.org/Documentation/9p
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "9p-cache.h"
+#include "trace.h"
+
+/* Past that many entries, start over rather than track the oldest */
+#define V9FS_STAT_CACHE_MAX 65536
+
+typedef struct V9fsStatCacheEntry {
+    int64_t expires;
+    int err;
+    struct stat st;
+} V9fsStatCacheEntry;
+
+struct V9fsStatCache {
+    QemuMutex lock;
+    GHashTable *entries;
+    int64_t ttl;
+};
+
+/*
+ * The path strings of the local driver are the keys, paths of other
+ * drivers are not strings, they cannot enable the cache.
+ */
+
+void v9fs_stat_cache_init(V9fsState *s, uint64_t ttl_ms)
+{
+    V9fsStatCache *c;
+
+    if (!ttl_ms) {
+        return;
+    }
+
+    c = g_new0(V9fsStatCache, 1);
+    qemu_mutex_init(&c->lock);
+    c->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                       g_free, g_free);
+    c->ttl = MIN(ttl_ms, INT64_MAX / 2);
+    s->stat_cache = c;
+}
+
+void v9fs_stat_cache_destroy(V9fsState *s)
+{
+    V9fsStatCache *c = s->stat_cache;
+
+    if (!c) {
+        return;
+    }
+
+    g_hash_table_destroy(c->entries);
+    qemu_mutex_destroy(&c->lock);
+    g_free(c);
+    s->stat_cache = NULL;
+}
+
+bool v9fs_stat_cache_lookup(V9fsState *s, V9fsPath *path,
+                            struct stat *stbuf, int *err)
+{
+    V9fsStatCache *c = s->stat_cache;
+    V9fsStatCacheEntry *e;
+    bool hit = false;
+
+    if (!c || !path->data) {
+        return false;
+    }
+
+    qemu_mutex_lock(&c->lock);
+    e = g_hash_table_lookup(c->entries, path->data);
+    if (e && e->expires > qemu_clock_get_ms(QEMU_CLOCK_REALTIME)) {
+        *err = e->err;
+        if (!e->err) {
+            *stbuf = e->st;
+        }
+        hit = true;
+    }
+    qemu_mutex_unlock(&c->lock);
+
+    trace_v9fs_stat_cache_lookup(path->data, hit);
+    return hit;
+}
+
+static void v9fs_stat_cache_insert(V9fsStatCache *c, V9fsPath *path,
+                                   int err, struct stat *stbuf)
+{
+    V9fsStatCacheEntry *e = g_new(V9fsStatCacheEntry, 1);
+
+    e->expires = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + c->ttl;
+    e->err = err;
+    if (!err) {
+        e->st = *stbuf;
+    }
+
+    qemu_mutex_lock(&c->lock);
+    if (g_hash_table_size(c->entries) >= V9FS_STAT_CACHE_MAX) {
+        g_hash_table_remove_all(c->entries);
+    }
+    g_hash_table_replace(c->entries, g_strdup(path->data), e);
+    qemu_mutex_unlock(&c->lock);
+}
+
+int v9fs_stat_cache_lstat(V9fsState *s, V9fsPath *path, struct stat *stbuf)
+{
+    V9fsStatCache *c = s->stat_cache;
+    int err;
+
+    if (v9fs_stat_cache_lookup(s, path, stbuf, &err)) {
+        if (err < 0) {
+            errno = -err;
+            return -1;
+        }
+        return 0;
+    }
+
+    err = s->ops->lstat(&s->ctx, path, stbuf);
+    if (c && path->data) {
+        /* Only remember answers, not failures to get one */
+        if (!err) {
+            v9fs_stat_cache_insert(c, path, 0, stbuf);
+        } else if (errno == ENOENT || errno == ENOTDIR) {
+            v9fs_stat_cache_insert(c, path, -errno, NULL);
+        }
+    }
+    return err;
+}
+
+static void v9fs_stat_cache_remove(V9fsStatCache *c, const char *path)
+{
+    g_autofree char *dir = g_path_get_dirname(path);
+
+    qemu_mutex_lock(&c->lock);
+    g_hash_table_remove(c->entries, path);
+    g_hash_table_remove(c->entries, dir);
+    qemu_mutex_unlock(&c->lock);
+}
+
+void v9fs_stat_cache_invalidate(V9fsState *s, V9fsPath *path)
+{
+    if (s->stat_cache && path->data) {
+        v9fs_stat_cache_remove(s->stat_cache, path->data);
+    }
+}
+
+void v9fs_stat_cache_invalidate_name(V9fsState *s, V9fsPath *dirpath,
+                                     const char *name)
+{
+    g_autofree char *path = NULL;
+
+    if (!s->stat_cache || !dirpath->data) {
+        return;
+    }
+
+    /* The same path as local_name_to_path() makes */
+    path = g_strdup_printf("%s/%s", dirpath->data, name);
+    v9fs_stat_cache_remove(s->stat_cache, path);
+}
+
+void v9fs_stat_cache_clear(V9fsState *s)
+{
+    V9fsStatCache *c = s->stat_cache;
+
+    if (!c) {
+        return;
+    }
+
+    qemu_mutex_lock(&c->lock);
+    g_hash_table_remove_all(c->entries);
+    qemu_mutex_unlock(&c->lock);
+}
@@ -0,0 +1,49 @@
+/*
+ * 9p attribute cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_9P_CACHE_H
+#define QEMU_9P_CACHE_H
+
+#include "9p.h"
+
+/*
+ * Results of lstat() by path, including the paths that do not exist, for
+ * cache_ttl milliseconds.  Requests that change a file drop what is known
+ * about it and its directory, so the cache only misses changes that are
+ * made behind QEMU's back, as the guest does with cache=loose anyway.
+ *
+ * All the functions can be called from the worker threads, and do nothing,
+ * or call into the fs driver directly, if @s has no cache.
+ */
+
+void v9fs_stat_cache_init(V9fsState *s, uint64_t ttl_ms);
+void v9fs_stat_cache_destroy(V9fsState *s);
+
+/*
+ * Same as s->ops->lstat(): returns 0, or -1 with errno set, from the
+ * cache or else from the fs driver.
+ */
+int v9fs_stat_cache_lstat(V9fsState *s, V9fsPath *path, struct stat *stbuf);
+
+/*
+ * Returns true if @path is in the cache, with the result of lstat() in
+ * @err: 0 with @stbuf filled in, or a negative errno.
+ */
+bool v9fs_stat_cache_lookup(V9fsState *s, V9fsPath *path,
+                            struct stat *stbuf, int *err);
+
+/* @path changed: drops it and its directory */
+void v9fs_stat_cache_invalidate(V9fsState *s, V9fsPath *path);
+
+/* @name in @dirpath changed: drops it and @dirpath */
+void v9fs_stat_cache_invalidate_name(V9fsState *s, V9fsPath *dirpath,
+                                     const char *name);
+
+/* Drops everything, for renames that move whole trees */
+void v9fs_stat_cache_clear(V9fsState *s);
+
+#endif
@@ -1567,6 +1567,7 @@ static int local_parse_opts(QemuOpts *opts, FsDriverEntry *fse, Error **errp)
         }
     }
 
+    fse->cache_ttl = qemu_opt_get_number(opts, "cache_ttl", 0);
     fse->path = g_strdup(path);
 
     return 0;
@@ -0,0 +1,1089 @@
+/*
+ * 9p backend for directories of the Origin Private File System
+ *
+ * Copyright (c) 2025 QEMU-WASM Contributors
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * With the local fsdriver, shared folders live in emscripten's MEMFS and
+ * so in the wasm heap.  This fsdriver serves a directory of the browser's
+ * OPFS instead, so that the files are only bounded by the storage quota.
+ *
+ * Like block/opfs.c, it needs an I/O thread per export: the directory API
+ * is asynchronous, and FileSystemSyncAccessHandles, which read and write
+ * the guest buffers in the shared heap directly, are only usable from the
+ * worker that created them.  The 9p worker threads hand requests to the
+ * I/O thread and wait for it, the main loop does not.
+ *
+ * There are no symbolic links, hard links, special files, extended
+ * attributes or owners in OPFS: they fail with EPERM or ENOTSUP, and
+ * chmod, chown and utimensat are ignored.  Files can only be moved where
+ * the browser supports FileSystemHandle.move(), otherwise EXDEV makes the
+ * guest copy them.
+ */
+
+/*
+ * Not so fast! You might want to read the 9p developer docs first:
+ * https://wiki.qemu.org/Documentation/9p
+ */
+
+#include "qemu/osdep.h"
+#include "9p.h"
+#include "fsdev/qemu-fsdev.h"
+#include "qapi/error.h"
+#include "qemu/atomic.h"
+#include "qemu/option.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "trace.h"
+#include <emscripten.h>
+
+typedef enum {
+    /* Asynchronous in JS */
+    OPFS9P_REQ_LSTAT,
+    OPFS9P_REQ_MKDIR,
+    OPFS9P_REQ_CREATE,
+    OPFS9P_REQ_REMOVE,
+    OPFS9P_REQ_RENAME,
+    OPFS9P_REQ_OPENDIR,
+    OPFS9P_REQ_OPEN,
+    OPFS9P_REQ_TRUNCATE,
+    OPFS9P_REQ_STATFS,
+    /* Synchronous on an open file or directory */
+    OPFS9P_REQ_PREADV,
+    OPFS9P_REQ_PWRITEV,
+    OPFS9P_REQ_FSTAT,
+    OPFS9P_REQ_FSYNC,
+    OPFS9P_REQ_CLOSE,
+    OPFS9P_REQ_DIRENT,
+    OPFS9P_REQ_CLOSEDIR,
+} OPFS9pRequestType;
+
+/* What OPFS knows about a file, filled in by JS */
+typedef struct OPFS9pStat {
+    double size;
+    double mtime;       /* in ms */
+    double ino;
+    int32_t dir;
+} OPFS9pStat;
+
+typedef struct OPFS9pRequest {
+    OPFS9pRequestType type;
+    const char *path;
+    const char *path2;
+    int fd;
+    double arg;
+    const struct iovec *iov;
+    int iovcnt;
+    void *out;
+    /* the result or -errno */
+    int64_t ret;
+    QemuSemaphore done;
+    QSIMPLEQ_ENTRY(OPFS9pRequest) next;
+} OPFS9pRequest;
+
+typedef struct OPFS9pData {
+    char *root;
+    /* identifies the export in the JS state of the I/O thread */
+    int id;
+    QemuThread thread;
+    QemuSemaphore open_sem;
+    int open_done;
+    int open_ret;
+
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, OPFS9pRequest) queue;
+    bool stopping;
+} OPFS9pData;
+
+typedef struct OPFS9pDir {
+    int id;
+    char *path;
+    off_t pos;
+    struct dirent dent;
+} OPFS9pDir;
+
+static int opfs9p_next_id;
+
+/* Errors of the JS functions, as negative numbers */
+static const int opfs9p_errnos[] = {
+    0, ENOENT, ENOTDIR, EISDIR, ENOTEMPTY, EBUSY, ENOSPC, EEXIST, EIO, EXDEV,
+};
+
+static int opfs9p_errno(double ret)
+{
+    int code = -ret;
+
+    return code > 0 && code < ARRAY_SIZE(opfs9p_errnos) ? opfs9p_errnos[code]
+                                                        : EIO;
+}
+
+/*
+ * Set up the state of the export @id and open its @root directory,
+ * creating it if needed, then set *@done_ptr with *@ret_ptr set to 0 or
+ * -1.  This is asynchronous: the caller has to return to the event loop.
+ */
+EM_JS(void, opfs9p_init_js, (int id, const char *root, int *done_ptr, int *ret_ptr), {
+        const done = (ret) => {
+            const memory_v = new DataView(wasmMemory.buffer);
+            memory_v.setInt32(ret_ptr, ret, true);
+            memory_v.setInt32(done_ptr, 1, true);
+        };
+        const split = (path) => path.split("/").filter((n) => n && n != ".");
+        const st = {
+            root: null,
+            // path -> { handle, refs, mtime } of the files with a sync handle
+            files: new Map(),
+            fds: new Map(),
+            dirs: new Map(),
+            inodes: new Map(),
+            next: 1,
+            split,
+            ino(path) {
+                const key = split(path).join("/");
+                if (!this.inodes.has(key)) {
+                    this.inodes.set(key, this.next++);
+                }
+                return this.inodes.get(key);
+            },
+            async lookup(path) {
+                let h = this.root;
+                for (const n of split(path)) {
+                    if (h.kind != "directory") {
+                        throw new DOMException("", "TypeMismatchError");
+                    }
+                    try {
+                        h = await h.getDirectoryHandle(n);
+                    } catch (e) {
+                        if (e.name != "TypeMismatchError") {
+                            throw e;
+                        }
+                        h = await h.getFileHandle(n);
+                    }
+                }
+                return h;
+            },
+            async parent(path) {
+                const names = split(path);
+                if (!names.length) {
+                    throw new DOMException("", "InvalidModificationError");
+                }
+                const dir = await this.lookup(names.slice(0, -1).join("/"));
+                if (dir.kind != "directory") {
+                    throw new DOMException("", "TypeMismatchError");
+                }
+                return [dir, names[names.length - 1]];
+            },
+            error(e) {
+                switch (e && e.name) {
+                case "NotFoundError": return -1;
+                case "TypeMismatchError": return -2;
+                case "InvalidModificationError": return -4;
+                case "NoModificationAllowedError": return -5;
+                case "QuotaExceededError": return -6;
+                default: return -8;
+                }
+            },
+        };
+        globalThis.__qemu_opfs9p = globalThis.__qemu_opfs9p || {};
+        globalThis.__qemu_opfs9p[id] = st;
+
+        if (typeof navigator == "undefined" || !navigator.storage) {
+            done(-1);
+            return;
+        }
+        (async () => {
+            let dir = await navigator.storage.getDirectory();
+            for (const n of split(UTF8ToString(root))) {
+                dir = await dir.getDirectoryHandle(n, { create: true });
+            }
+            st.root = dir;
+        })().then(() => done(0), () => done(-1));
+});
+
+EM_JS(void, opfs9p_cleanup_js, (int id), {
+        const st = globalThis.__qemu_opfs9p[id];
+        delete globalThis.__qemu_opfs9p[id];
+        for (const f of st.files.values()) {
+            f.handle.close();
+        }
+});
+
+/*
+ * Run the asynchronous request @type and set *@done_ptr once done, with
+ * *@ret_ptr set to the result or a negative error.
+ */
+EM_JS(void, opfs9p_async_js, (int id, int type, const char *path_ptr, const char *path2_ptr, double arg, void *out, double *ret_ptr, int *done_ptr), {
+        const st = globalThis.__qemu_opfs9p[id];
+        const path = UTF8ToString(path_ptr);
+        const path2 = path2_ptr ? UTF8ToString(path2_ptr) : "";
+        const done = (ret) => {
+            const memory_v = new DataView(wasmMemory.buffer);
+            memory_v.setFloat64(ret_ptr, ret, true);
+            memory_v.setInt32(done_ptr, 1, true);
+        };
+        const exists = async (dir, name) => {
+            try {
+                await dir.getFileHandle(name);
+                return true;
+            } catch (e) {
+                if (e.name == "TypeMismatchError") {
+                    return true;
+                }
+                if (e.name != "NotFoundError") {
+                    throw e;
+                }
+                return false;
+            }
+        };
+        const ops = [
+            // stat
+            async () => {
+                const h = await st.lookup(path);
+                const memory_v = new DataView(wasmMemory.buffer);
+                let size = 0, mtime = 0;
+                const open = st.files.get(st.split(path).join("/"));
+                if (open) {
+                    // a file with a sync handle cannot be read as a File
+                    size = open.handle.getSize();
+                    mtime = open.mtime;
+                } else if (h.kind == "file") {
+                    const file = await h.getFile();
+                    size = file.size;
+                    mtime = file.lastModified;
+                }
+                memory_v.setFloat64(out, size, true);
+                memory_v.setFloat64(out + 8, mtime, true);
+                memory_v.setFloat64(out + 16, st.ino(path), true);
+                memory_v.setInt32(out + 24, h.kind == "directory", true);
+                return 0;
+            },
+            // mkdir
+            async () => {
+                const [dir, name] = await st.parent(path);
+                if (await exists(dir, name)) {
+                    return -7;
+                }
+                await dir.getDirectoryHandle(name, { create: true });
+                return 0;
+            },
+            // create, exclusive if arg is set
+            async () => {
+                const [dir, name] = await st.parent(path);
+                if (arg && await exists(dir, name)) {
+                    return -7;
+                }
+                await dir.getFileHandle(name, { create: true });
+                return 0;
+            },
+            // remove, only a directory if arg is 1, not one if it is 0
+            async () => {
+                const [dir, name] = await st.parent(path);
+                const h = await st.lookup(path);
+                if (arg == 1 && h.kind != "directory") {
+                    return -2;
+                }
+                if (arg == 0 && h.kind == "directory") {
+                    return -3;
+                }
+                if (st.files.has(st.split(path).join("/"))) {
+                    return -5;
+                }
+                await dir.removeEntry(name);
+                st.inodes.delete(st.split(path).join("/"));
+                return 0;
+            },
+            // rename to path2
+            async () => {
+                const h = await st.lookup(path);
+                const [dir, name] = await st.parent(path2);
+                const from = st.split(path).join("/");
+                const to = st.split(path2).join("/");
+                if (!h.move || h.kind == "directory" || st.files.has(from)) {
+                    // the guest copies it instead
+                    return -9;
+                }
+                await h.move(dir, name);
+                if (st.inodes.has(from)) {
+                    st.inodes.set(to, st.inodes.get(from));
+                    st.inodes.delete(from);
+                }
+                return 0;
+            },
+            // opendir, the listing is taken right away
+            async () => {
+                const h = await st.lookup(path);
+                if (h.kind != "directory") {
+                    return -2;
+                }
+                const base = st.split(path).join("/");
+                const list = [
+                    { name: ".", dir: true, ino: st.ino(base) },
+                    { name: "..", dir: true,
+                      ino: st.ino(st.split(base).slice(0, -1).join("/")) },
+                ];
+                for await (const [name, child] of h.entries()) {
+                    list.push({ name, dir: child.kind == "directory",
+                                ino: st.ino(base + "/" + name) });
+                }
+                const fd = st.next++;
+                st.dirs.set(fd, list);
+                return fd;
+            },
+            // open, truncating the file if arg is set
+            async () => {
+                const key = st.split(path).join("/");
+                let f = st.files.get(key);
+                if (!f) {
+                    const h = await st.lookup(path);
+                    if (h.kind != "file") {
+                        return -3;
+                    }
+                    const mtime = (await h.getFile()).lastModified;
+                    f = { handle: await h.createSyncAccessHandle(), refs: 0,
+                          mtime, path: key };
+                    st.files.set(key, f);
+                }
+                f.refs++;
+                if (arg) {
+                    f.handle.truncate(0);
+                    f.mtime = Date.now();
+                }
+                const fd = st.next++;
+                st.fds.set(fd, f);
+                return fd;
+            },
+            // truncate to arg
+            async () => {
+                const open = st.files.get(st.split(path).join("/"));
+                if (open) {
+                    open.handle.truncate(arg);
+                    open.mtime = Date.now();
+                    return 0;
+                }
+                const h = await st.lookup(path);
+                if (h.kind != "file") {
+                    return -3;
+                }
+                const handle = await h.createSyncAccessHandle();
+                try {
+                    handle.truncate(arg);
+                } finally {
+                    handle.close();
+                }
+                return 0;
+            },
+            // statfs
+            async () => {
+                const est = await navigator.storage.estimate();
+                const memory_v = new DataView(wasmMemory.buffer);
+                memory_v.setFloat64(out, est.quota || 0, true);
+                memory_v.setFloat64(out + 8, est.usage || 0, true);
+                return 0;
+            },
+        ];
+        ops[type]().then(done, (e) => done(st.error(e)));
+});
+
+/* The functions below return the count or 0 on success, or an error */
+
+EM_JS(double, opfs9p_rw_js, (int id, int fd, int write, double offset, uint8_t *buf, int len), {
+        const st = globalThis.__qemu_opfs9p[id];
+        const f = st.fds.get(fd);
+        const view = new Uint8Array(wasmMemory.buffer, buf, len);
+        try {
+            if (write) {
+                f.mtime = Date.now();
+                return f.handle.write(view, { at: offset });
+            }
+            return f.handle.read(view, { at: offset });
+        } catch (e) {
+            return st.error(e);
+        }
+});
+
+EM_JS(int, opfs9p_fstat_js, (int id, int fd, void *out), {
+        const st = globalThis.__qemu_opfs9p[id];
+        const f = st.fds.get(fd);
+        const memory_v = new DataView(wasmMemory.buffer);
+        try {
+            memory_v.setFloat64(out, f.handle.getSize(), true);
+            memory_v.setFloat64(out + 8, f.mtime, true);
+            memory_v.setFloat64(out + 16, st.ino(f.path), true);
+            memory_v.setInt32(out + 24, 0, true);
+            return 0;
+        } catch (e) {
+            return st.error(e);
+        }
+});
+
+EM_JS(int, opfs9p_fsync_js, (int id, int fd), {
+        const st = globalThis.__qemu_opfs9p[id];
+        try {
+            st.fds.get(fd).handle.flush();
+            return 0;
+        } catch (e) {
+            return st.error(e);
+        }
+});
+
+EM_JS(int, opfs9p_close_js, (int id, int fd), {
+        const st = globalThis.__qemu_opfs9p[id];
+        const f = st.fds.get(fd);
+        st.fds.delete(fd);
+        if (--f.refs == 0) {
+            st.files.delete(f.path);
+            f.handle.close();
+        }
+        return 0;
+});
+
+/*
+ * Copy the name of entry @index of the listing @fd to @buf and its inode
+ * number to *@ino_ptr.  Returns 2 for a directory, 1 for a file, 0 past
+ * the end.
+ */
+EM_JS(int, opfs9p_dirent_js, (int id, int fd, double index, char *buf, int len, double *ino_ptr), {
+        const st = globalThis.__qemu_opfs9p[id];
+        const e = st.dirs.get(fd)[index];
+        if (!e) {
+            return 0;
+        }
+        stringToUTF8(e.name, buf, len);
+        new DataView(wasmMemory.buffer).setFloat64(ino_ptr, e.ino, true);
+        return e.dir ? 2 : 1;
+});
+
+EM_JS(int, opfs9p_closedir_js, (int id, int fd), {
+        globalThis.__qemu_opfs9p[id].dirs.delete(fd);
+        return 0;
+});
+
+static int64_t opfs9p_do_rw(OPFS9pData *data, OPFS9pRequest *req)
+{
+    bool write = req->type == OPFS9P_REQ_PWRITEV;
+    int64_t total = 0;
+
+    for (int i = 0; i < req->iovcnt; i++) {
+        const struct iovec *iov = &req->iov[i];
+        double n = opfs9p_rw_js(data->id, req->fd, write, req->arg + total,
+                                iov->iov_base, iov->iov_len);
+
+        if (n < 0) {
+            return total ? total : -opfs9p_errno(n);
+        }
+        total += n;
+        if (n < iov->iov_len) {
+            break;
+        }
+    }
+    return total;
+}
+
+static int64_t opfs9p_do_request(OPFS9pData *data, OPFS9pRequest *req)
+{
+    double ret;
+    int done = 0;
+
+    switch (req->type) {
+    case OPFS9P_REQ_PREADV:
+    case OPFS9P_REQ_PWRITEV:
+        return opfs9p_do_rw(data, req);
+    case OPFS9P_REQ_FSTAT:
+        ret = opfs9p_fstat_js(data->id, req->fd, req->out);
+        break;
+    case OPFS9P_REQ_FSYNC:
+        ret = opfs9p_fsync_js(data->id, req->fd);
+        break;
+    case OPFS9P_REQ_CLOSE:
+        ret = opfs9p_close_js(data->id, req->fd);
+        break;
+    case OPFS9P_REQ_DIRENT: {
+        OPFS9pDir *dir = req->out;
+        double ino;
+
+        ret = opfs9p_dirent_js(data->id, dir->id, dir->pos,
+                               dir->dent.d_name, sizeof(dir->dent.d_name),
+                               &ino);
+        dir->dent.d_ino = ino;
+        dir->dent.d_type = ret == 2 ? DT_DIR : DT_REG;
+        break;
+    }
+    case OPFS9P_REQ_CLOSEDIR:
+        ret = opfs9p_closedir_js(data->id, req->fd);
+        break;
+    default:
+        opfs9p_async_js(data->id, req->type, req->path, req->path2, req->arg,
+                        req->out, &ret, &done);
+        /* let the JS event loop of this thread resolve the promises */
+        while (!qatomic_read(&done)) {
+            emscripten_sleep(0);
+        }
+        break;
+    }
+    return ret < 0 ? -opfs9p_errno(ret) : ret;
+}
+
+static void *opfs9p_io_thread(void *opaque)
+{
+    OPFS9pData *data = opaque;
+    OPFS9pRequest *req;
+
+    opfs9p_init_js(data->id, data->root, &data->open_done, &data->open_ret);
+    while (!qatomic_read(&data->open_done)) {
+        emscripten_sleep(1);
+    }
+    qemu_sem_post(&data->open_sem);
+    if (data->open_ret < 0) {
+        opfs9p_cleanup_js(data->id);
+        return NULL;
+    }
+
+    qemu_mutex_lock(&data->lock);
+    while (true) {
+        while (QSIMPLEQ_EMPTY(&data->queue) && !data->stopping) {
+            qemu_cond_wait(&data->cond, &data->lock);
+        }
+        req = QSIMPLEQ_FIRST(&data->queue);
+        if (!req) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&data->queue, next);
+        qemu_mutex_unlock(&data->lock);
+
+        trace_opfs9p_request(data, req->type, req->path ?: "");
+        req->ret = opfs9p_do_request(data, req);
+        qemu_sem_post(&req->done);
+
+        qemu_mutex_lock(&data->lock);
+    }
+    qemu_mutex_unlock(&data->lock);
+
+    opfs9p_cleanup_js(data->id);
+    return NULL;
+}
+
+/*
+ * Run @req on the I/O thread and wait for it.  Returns the result, or -1
+ * with errno set, like the fs driver callbacks.
+ */
+static int64_t opfs9p_submit(FsContext *ctx, OPFS9pRequest *req)
+{
+    OPFS9pData *data = ctx->private;
+
+    qemu_sem_init(&req->done, 0);
+    qemu_mutex_lock(&data->lock);
+    QSIMPLEQ_INSERT_TAIL(&data->queue, req, next);
+    qemu_cond_signal(&data->cond);
+    qemu_mutex_unlock(&data->lock);
+
+    qemu_sem_wait(&req->done);
+    qemu_sem_destroy(&req->done);
+
+    if (req->ret < 0) {
+        errno = -req->ret;
+        return -1;
+    }
+    return req->ret;
+}
+
+static int64_t opfs9p_path_request(FsContext *ctx, OPFS9pRequestType type,
+                                   const char *path, const char *path2,
+                                   double arg, void *out)
+{
+    OPFS9pRequest req = {
+        .type = type,
+        .path = path,
+        .path2 = path2,
+        .arg = arg,
+        .out = out,
+    };
+
+    return opfs9p_submit(ctx, &req);
+}
+
+static int64_t opfs9p_fd_request(FsContext *ctx, OPFS9pRequestType type,
+                                 int fd, void *out)
+{
+    OPFS9pRequest req = {
+        .type = type,
+        .fd = fd,
+        .out = out,
+    };
+
+    return opfs9p_submit(ctx, &req);
+}
+
+static void opfs9p_fill_stat(OPFS9pStat *o, struct stat *stbuf)
+{
+    int64_t mtime = o->mtime;
+
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->st_mode = o->dir ? S_IFDIR | 0755 : S_IFREG | 0644;
+    stbuf->st_nlink = o->dir ? 2 : 1;
+    stbuf->st_ino = o->ino;
+    stbuf->st_size = o->size;
+    stbuf->st_blksize = 4096;
+    stbuf->st_blocks = DIV_ROUND_UP((int64_t)o->size, 512);
+    stbuf->st_mtim.tv_sec = mtime / 1000;
+    stbuf->st_mtim.tv_nsec = (mtime % 1000) * 1000000;
+    stbuf->st_atim = stbuf->st_mtim;
+    stbuf->st_ctim = stbuf->st_mtim;
+}
+
+static int opfs9p_lstat(FsContext *ctx, V9fsPath *fs_path, struct stat *stbuf)
+{
+    OPFS9pStat o;
+
+    if (opfs9p_path_request(ctx, OPFS9P_REQ_LSTAT, fs_path->data, NULL, 0,
+                            &o) < 0) {
+        return -1;
+    }
+    opfs9p_fill_stat(&o, stbuf);
+    return 0;
+}
+
+static ssize_t opfs9p_readlink(FsContext *ctx, V9fsPath *fs_path,
+                               char *buf, size_t bufsz)
+{
+    /* Nothing is a symbolic link */
+    errno = EINVAL;
+    return -1;
+}
+
+static int opfs9p_close(FsContext *ctx, V9fsFidOpenState *fs)
+{
+    return opfs9p_fd_request(ctx, OPFS9P_REQ_CLOSE, fs->fd, NULL);
+}
+
+static int opfs9p_closedir(FsContext *ctx, V9fsFidOpenState *fs)
+{
+    OPFS9pDir *dir = fs->private;
+
+    opfs9p_fd_request(ctx, OPFS9P_REQ_CLOSEDIR, dir->id, NULL);
+    g_free(dir->path);
+    g_free(dir);
+    return 0;
+}
+
+static int opfs9p_open_path(FsContext *ctx, const char *path, int flags,
+                            V9fsFidOpenState *fs)
+{
+    int64_t fd = opfs9p_path_request(ctx, OPFS9P_REQ_OPEN, path, NULL,
+                                     !!(flags & O_TRUNC), NULL);
+
+    if (fd < 0) {
+        return -1;
+    }
+    fs->fd = fd;
+    return fs->fd;
+}
+
+static int opfs9p_open(FsContext *ctx, V9fsPath *fs_path,
+                       int flags, V9fsFidOpenState *fs)
+{
+    return opfs9p_open_path(ctx, fs_path->data, flags, fs);
+}
+
+static int opfs9p_opendir(FsContext *ctx,
+                          V9fsPath *fs_path, V9fsFidOpenState *fs)
+{
+    OPFS9pDir *dir;
+    int64_t id;
+
+    id = opfs9p_path_request(ctx, OPFS9P_REQ_OPENDIR, fs_path->data, NULL, 0,
+                             NULL);
+    if (id < 0) {
+        return -1;
+    }
+
+    dir = g_new0(OPFS9pDir, 1);
+    dir->id = id;
+    dir->path = g_strdup(fs_path->data);
+    fs->private = dir;
+    return 0;
+}
+
+static void opfs9p_rewinddir(FsContext *ctx, V9fsFidOpenState *fs)
+{
+    OPFS9pDir *dir = fs->private;
+
+    dir->pos = 0;
+}
+
+static off_t opfs9p_telldir(FsContext *ctx, V9fsFidOpenState *fs)
+{
+    OPFS9pDir *dir = fs->private;
+
+    return dir->pos;
+}
+
+static struct dirent *opfs9p_readdir(FsContext *ctx, V9fsFidOpenState *fs)
+{
+    OPFS9pDir *dir = fs->private;
+    OPFS9pRequest req = {
+        .type = OPFS9P_REQ_DIRENT,
+        .out = dir,
+    };
+
+    if (opfs9p_submit(ctx, &req) <= 0) {
+        return NULL;
+    }
+    dir->dent.d_off = ++dir->pos;
+    return &dir->dent;
+}
+
+static void opfs9p_seekdir(FsContext *ctx, V9fsFidOpenState *fs, off_t off)
+{
+    OPFS9pDir *dir = fs->private;
+
+    dir->pos = off;
+}
+
+static ssize_t opfs9p_rw(FsContext *ctx, OPFS9pRequestType type,
+                         V9fsFidOpenState *fs, const struct iovec *iov,
+                         int iovcnt, off_t offset)
+{
+    OPFS9pRequest req = {
+        .type = type,
+        .fd = fs->fd,
+        .arg = offset,
+        .iov = iov,
+        .iovcnt = iovcnt,
+    };
+
+    return opfs9p_submit(ctx, &req);
+}
+
+static ssize_t opfs9p_preadv(FsContext *ctx, V9fsFidOpenState *fs,
+                             const struct iovec *iov,
+                             int iovcnt, off_t offset)
+{
+    return opfs9p_rw(ctx, OPFS9P_REQ_PREADV, fs, iov, iovcnt, offset);
+}
+
+static ssize_t opfs9p_pwritev(FsContext *ctx, V9fsFidOpenState *fs,
+                              const struct iovec *iov,
+                              int iovcnt, off_t offset)
+{
+    return opfs9p_rw(ctx, OPFS9P_REQ_PWRITEV, fs, iov, iovcnt, offset);
+}
+
+/* OPFS has no owners or permissions to keep */
+static int opfs9p_chmod(FsContext *ctx, V9fsPath *fs_path, FsCred *credp)
+{
+    return 0;
+}
+
+static int opfs9p_chown(FsContext *ctx, V9fsPath *fs_path, FsCred *credp)
+{
+    return 0;
+}
+
+static int opfs9p_utimensat(FsContext *ctx, V9fsPath *fs_path,
+                            const struct timespec *buf)
+{
+    return 0;
+}
+
+static int opfs9p_mknod(FsContext *ctx, V9fsPath *dir_path,
+                        const char *name, FsCred *credp)
+{
+    g_autofree char *path = NULL;
+
+    if (!S_ISREG(credp->fc_mode)) {
+        errno = EPERM;
+        return -1;
+    }
+    path = g_strdup_printf("%s/%s", dir_path->data, name);
+    return opfs9p_path_request(ctx, OPFS9P_REQ_CREATE, path, NULL, 1, NULL);
+}
+
+static int opfs9p_mkdir(FsContext *ctx, V9fsPath *dir_path,
+                        const char *name, FsCred *credp)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir_path->data, name);
+
+    return opfs9p_path_request(ctx, OPFS9P_REQ_MKDIR, path, NULL, 0, NULL);
+}
+
+static int opfs9p_fstat(FsContext *ctx, int fid_type,
+                        V9fsFidOpenState *fs, struct stat *stbuf)
+{
+    OPFS9pStat o;
+    int64_t ret;
+
+    if (fid_type == P9_FID_DIR) {
+        OPFS9pDir *dir = fs->private;
+
+        ret = opfs9p_path_request(ctx, OPFS9P_REQ_LSTAT, dir->path, NULL, 0,
+                                  &o);
+    } else {
+        ret = opfs9p_fd_request(ctx, OPFS9P_REQ_FSTAT, fs->fd, &o);
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    opfs9p_fill_stat(&o, stbuf);
+    return 0;
+}
+
+static int opfs9p_open2(FsContext *ctx, V9fsPath *dir_path, const char *name,
+                        int flags, FsCred *credp, V9fsFidOpenState *fs)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir_path->data, name);
+
+    if (opfs9p_path_request(ctx, OPFS9P_REQ_CREATE, path, NULL,
+                            !!(flags & O_EXCL), NULL) < 0) {
+        return -1;
+    }
+    return opfs9p_open_path(ctx, path, flags, fs);
+}
+
+static int opfs9p_symlink(FsContext *ctx, const char *oldpath,
+                          V9fsPath *dir_path, const char *name, FsCred *credp)
+{
+    errno = EPERM;
+    return -1;
+}
+
+static int opfs9p_link(FsContext *ctx, V9fsPath *oldpath,
+                       V9fsPath *dirpath, const char *name)
+{
+    errno = EPERM;
+    return -1;
+}
+
+static int opfs9p_truncate(FsContext *ctx, V9fsPath *fs_path, off_t size)
+{
+    return opfs9p_path_request(ctx, OPFS9P_REQ_TRUNCATE, fs_path->data, NULL,
+                               size, NULL);
+}
+
+static int opfs9p_rename(FsContext *ctx, const char *oldpath,
+                         const char *newpath)
+{
+    return opfs9p_path_request(ctx, OPFS9P_REQ_RENAME, oldpath, newpath, 0,
+                               NULL);
+}
+
+static int opfs9p_renameat(FsContext *ctx, V9fsPath *olddir,
+                           const char *old_name, V9fsPath *newdir,
+                           const char *new_name)
+{
+    g_autofree char *oldpath = g_strdup_printf("%s/%s", olddir->data,
+                                               old_name);
+    g_autofree char *newpath = g_strdup_printf("%s/%s", newdir->data,
+                                               new_name);
+
+    return opfs9p_rename(ctx, oldpath, newpath);
+}
+
+static int opfs9p_remove(FsContext *ctx, const char *path)
+{
+    return opfs9p_path_request(ctx, OPFS9P_REQ_REMOVE, path, NULL, -1, NULL);
+}
+
+static int opfs9p_unlinkat(FsContext *ctx, V9fsPath *dir,
+                           const char *name, int flags)
+{
+    g_autofree char *path = g_strdup_printf("%s/%s", dir->data, name);
+
+    return opfs9p_path_request(ctx, OPFS9P_REQ_REMOVE, path, NULL,
+                               !!(flags & AT_REMOVEDIR), NULL);
+}
+
+static int opfs9p_fsync(FsContext *ctx, int fid_type,
+                        V9fsFidOpenState *fs, int datasync)
+{
+    if (fid_type == P9_FID_DIR) {
+        return 0;
+    }
+    return opfs9p_fd_request(ctx, OPFS9P_REQ_FSYNC, fs->fd, NULL);
+}
+
+static int opfs9p_statfs(FsContext *ctx, V9fsPath *fs_path,
+                         struct statfs *stbuf)
+{
+    double est[2];
+
+    if (opfs9p_path_request(ctx, OPFS9P_REQ_STATFS, fs_path->data, NULL, 0,
+                            est) < 0) {
+        return -1;
+    }
+
+    /* The storage quota of the origin */
+    memset(stbuf, 0, sizeof(*stbuf));
+    stbuf->f_bsize = 4096;
+    stbuf->f_blocks = est[0] / 4096;
+    stbuf->f_bfree = MAX(est[0] - est[1], 0) / 4096;
+    stbuf->f_bavail = stbuf->f_bfree;
+    stbuf->f_namelen = 255;
+    return 0;
+}
+
+static ssize_t opfs9p_lgetxattr(FsContext *ctx, V9fsPath *path,
+                                const char *name, void *value, size_t size)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+static ssize_t opfs9p_llistxattr(FsContext *ctx, V9fsPath *path,
+                                 void *value, size_t size)
+{
+    return 0;
+}
+
+static int opfs9p_lsetxattr(FsContext *ctx, V9fsPath *path, const char *name,
+                            void *value, size_t size, int flags)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+static int opfs9p_lremovexattr(FsContext *ctx, V9fsPath *path,
+                               const char *name)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+/* Paths are the same as the local fsdriver's */
+static int opfs9p_name_to_path(FsContext *ctx, V9fsPath *dir_path,
+                               const char *name, V9fsPath *target)
+{
+    if (dir_path) {
+        if (!strcmp(name, ".")) {
+            v9fs_path_copy(target, dir_path);
+        } else if (!strcmp(name, "..")) {
+            if (!strcmp(dir_path->data, ".")) {
+                v9fs_path_sprintf(target, ".");
+            } else {
+                g_autofree char *tmp = g_path_get_dirname(dir_path->data);
+
+                v9fs_path_sprintf(target, "%s", tmp);
+            }
+        } else {
+            assert(!strchr(name, '/'));
+            v9fs_path_sprintf(target, "%s/%s", dir_path->data, name);
+        }
+    } else if (!strcmp(name, "/") || !strcmp(name, ".") ||
+               !strcmp(name, "..")) {
+        v9fs_path_sprintf(target, ".");
+    } else {
+        assert(!strchr(name, '/'));
+        v9fs_path_sprintf(target, "./%s", name);
+    }
+    return 0;
+}
+
+static int opfs9p_init(FsContext *ctx, Error **errp)
+{
+    OPFS9pData *data = g_new0(OPFS9pData, 1);
+
+    data->root = g_strdup(ctx->fs_root);
+    data->id = qatomic_fetch_inc(&opfs9p_next_id);
+    qemu_mutex_init(&data->lock);
+    qemu_cond_init(&data->cond);
+    qemu_sem_init(&data->open_sem, 0);
+    QSIMPLEQ_INIT(&data->queue);
+
+    qemu_thread_create(&data->thread, "opfs-9p", opfs9p_io_thread, data,
+                       QEMU_THREAD_JOINABLE);
+    qemu_sem_wait(&data->open_sem);
+    if (data->open_ret < 0) {
+        qemu_thread_join(&data->thread);
+        error_setg(errp, "Could not open '%s' in the origin private file "
+                   "system", data->root);
+        qemu_sem_destroy(&data->open_sem);
+        qemu_cond_destroy(&data->cond);
+        qemu_mutex_destroy(&data->lock);
+        g_free(data->root);
+        g_free(data);
+        return -1;
+    }
+
+    /* Paths are built without asking the I/O thread */
+    ctx->export_flags |= V9FS_PATHNAME_FSCONTEXT;
+    ctx->private = data;
+    return 0;
+}
+
+static void opfs9p_cleanup(FsContext *ctx)
+{
+    OPFS9pData *data = ctx->private;
+
+    if (!data) {
+        return;
+    }
+
+    qemu_mutex_lock(&data->lock);
+    data->stopping = true;
+    qemu_cond_signal(&data->cond);
+    qemu_mutex_unlock(&data->lock);
+    qemu_thread_join(&data->thread);
+
+    qemu_sem_destroy(&data->open_sem);
+    qemu_cond_destroy(&data->cond);
+    qemu_mutex_destroy(&data->lock);
+    g_free(data->root);
+    g_free(data);
+    ctx->private = NULL;
+}
+
+static int opfs9p_parse_opts(QemuOpts *opts, FsDriverEntry *fse,
+                             Error **errp)
+{
+    const char *path = qemu_opt_get(opts, "path");
+
+    if (!path) {
+        error_setg(errp, "path property not set");
+        return -1;
+    }
+
+    fse->cache_ttl = qemu_opt_get_number(opts, "cache_ttl", 0);
+    fse->path = g_strdup(path);
+    return 0;
+}
+
+FileOperations opfs_ops = {
+    .parse_opts = opfs9p_parse_opts,
+    .init = opfs9p_init,
+    .cleanup = opfs9p_cleanup,
+    .lstat = opfs9p_lstat,
+    .readlink = opfs9p_readlink,
+    .close = opfs9p_close,
+    .closedir = opfs9p_closedir,
+    .open = opfs9p_open,
+    .opendir = opfs9p_opendir,
+    .rewinddir = opfs9p_rewinddir,
+    .telldir = opfs9p_telldir,
+    .readdir = opfs9p_readdir,
+    .seekdir = opfs9p_seekdir,
+    .preadv = opfs9p_preadv,
+    .pwritev = opfs9p_pwritev,
+    .chmod = opfs9p_chmod,
+    .mknod = opfs9p_mknod,
+    .mkdir = opfs9p_mkdir,
+    .fstat = opfs9p_fstat,
+    .open2 = opfs9p_open2,
+    .symlink = opfs9p_symlink,
+    .link = opfs9p_link,
+    .truncate = opfs9p_truncate,
+    .rename = opfs9p_rename,
+    .chown = opfs9p_chown,
+    .utimensat = opfs9p_utimensat,
+    .remove = opfs9p_remove,
+    .fsync = opfs9p_fsync,
+    .statfs = opfs9p_statfs,
+    .lgetxattr = opfs9p_lgetxattr,
+    .llistxattr = opfs9p_llistxattr,
+    .lsetxattr = opfs9p_lsetxattr,
+    .lremovexattr = opfs9p_lremovexattr,
+    .name_to_path = opfs9p_name_to_path,
+    .renameat = opfs9p_renameat,
+    .unlinkat = opfs9p_unlinkat,
+};
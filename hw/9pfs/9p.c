@@ -23,15 +23,18 @@
 #include <glib/gprintf.h>
 #include "hw/virtio/virtio.h"
 #include "qapi/error.h"
+#include "qemu/bswap.h"
 #include "qemu/error-report.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
+#include "qemu/units.h"
 #include "virtio-9p.h"
 #include "fsdev/qemu-fsdev.h"
 #include "9p-xattr.h"
 #include "9p-util.h"
 #include "coth.h"
+#include "9p-cache.h"
 #include "trace.h"
 #include "migration/blocker.h"
 #include "qemu/xxhash.h"
@@ -386,6 +389,7 @@ static int coroutine_fn free_fid(V9fsPDU *pdu, V9fsFidState *fidp)
     } else if (fidp->fid_type == P9_FID_XATTR) {
         retval = v9fs_xattr_fid_clunk(pdu, fidp);
     }
+    v9fs_free_dirents(fidp->readahead.entries);
     v9fs_path_free(&fidp->path);
     g_free(fidp);
     return retval;
@@ -1847,7 +1851,7 @@ static void coroutine_fn v9fs_walk(void *opaque)
             any_err |= err = -EINTR;
             break;
         }
-        err = s->ops->lstat(&s->ctx, &dpath, &fidst);
+        err = v9fs_stat_cache_lstat(s, &dpath, &fidst);
         if (err < 0) {
             any_err |= err = -errno;
             break;
@@ -1872,7 +1876,7 @@ static void coroutine_fn v9fs_walk(void *opaque)
                     any_err |= err = -EINTR;
                     break;
                 }
-                err = s->ops->lstat(&s->ctx, &pathes[nwalked], &stbuf);
+                err = v9fs_stat_cache_lstat(s, &pathes[nwalked], &stbuf);
                 if (err < 0) {
                     any_err |= err = -errno;
                     break;
@@ -2230,6 +2234,51 @@ static void v9fs_init_qiov_from_pdu(QEMUIOVector *qiov, V9fsPDU *pdu,
     qemu_iovec_concat(qiov, &elem, skip, size);
 }
 
+/*
+ * The PDU iovecs, narrowed in place to the data of a read or write
+ *
+ * Reads and writes hand these straight to the fs driver, without
+ * allocating a copy of the scatter-gather list of the request.
+ */
+typedef struct V9fsPDUIov {
+    struct iovec *iov;
+    unsigned int niov;
+    IOVDiscardUndo front;
+    IOVDiscardUndo back;
+} V9fsPDUIov;
+
+/*
+ * Narrow the PDU iovecs down to @size bytes after @skip.  They must be
+ * restored with v9fs_pdu_iov_put() before anything else is marshalled.
+ */
+static void v9fs_pdu_iov_get(V9fsPDUIov *piov, V9fsPDU *pdu,
+                             size_t skip, size_t size, bool is_write)
+{
+    size_t avail;
+
+    if (is_write) {
+        pdu->s->transport->init_out_iov_from_pdu(pdu, &piov->iov, &piov->niov,
+                                                 size + skip);
+    } else {
+        pdu->s->transport->init_in_iov_from_pdu(pdu, &piov->iov, &piov->niov,
+                                                size + skip);
+    }
+
+    iov_discard_front_undoable(&piov->iov, &piov->niov, skip, &piov->front);
+    avail = iov_size(piov->iov, piov->niov);
+    iov_discard_back_undoable(piov->iov, &piov->niov,
+                              avail > size ? avail - size : 0, &piov->back);
+}
+
+static void v9fs_pdu_iov_put(V9fsPDUIov *piov)
+{
+    /* In the reverse order, they may have trimmed the same iovec */
+    iov_discard_undo(&piov->back);
+    iov_discard_undo(&piov->front);
+    piov->back.modified_iov = NULL;
+    piov->front.modified_iov = NULL;
+}
+
 static int v9fs_xattr_read(V9fsState *s, V9fsPDU *pdu, V9fsFidState *fidp,
                            uint64_t off, uint32_t max_count)
 {
@@ -2385,21 +2434,35 @@ static void coroutine_fn v9fs_read(void *opaque)
         }
         err += offset + count;
     } else if (fidp->fid_type == P9_FID_FILE) {
+        V9fsPDUIov piov;
         QEMUIOVector qiov_full;
-        QEMUIOVector qiov;
+        QEMUIOVector qiov = { };
+        struct iovec *iov;
+        int niov;
         int32_t len;
 
-        v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset + 4, max_count, false);
-        qemu_iovec_init(&qiov, qiov_full.niov);
+        v9fs_pdu_iov_get(&piov, pdu, offset + 4, max_count, false);
+        qemu_iovec_init_external(&qiov_full, piov.iov, piov.niov);
+        iov = qiov_full.iov;
+        niov = qiov_full.niov;
         do {
-            qemu_iovec_reset(&qiov);
-            qemu_iovec_concat(&qiov, &qiov_full, count, qiov_full.size - count);
+            if (count) {
+                /* Short read, only the rest of the buffer is left */
+                if (!qiov.iov) {
+                    qemu_iovec_init(&qiov, qiov_full.niov);
+                }
+                qemu_iovec_reset(&qiov);
+                qemu_iovec_concat(&qiov, &qiov_full, count,
+                                  qiov_full.size - count);
+                iov = qiov.iov;
+                niov = qiov.niov;
+            }
             if (0) {
-                print_sg(qiov.iov, qiov.niov);
+                print_sg(iov, niov);
             }
             /* Loop in case of EINTR */
             do {
-                len = v9fs_co_preadv(pdu, fidp, qiov.iov, qiov.niov, off);
+                len = v9fs_co_preadv(pdu, fidp, iov, niov, off);
                 if (len >= 0) {
                     off   += len;
                     count += len;
@@ -2411,14 +2474,15 @@ static void coroutine_fn v9fs_read(void *opaque)
                 goto out_free_iovec;
             }
         } while (count < max_count && len > 0);
+        v9fs_pdu_iov_put(&piov);
         err = pdu_marshal(pdu, offset, "d", count);
         if (err < 0) {
             goto out_free_iovec;
         }
         err += offset + count;
 out_free_iovec:
+        v9fs_pdu_iov_put(&piov);
         qemu_iovec_destroy(&qiov);
-        qemu_iovec_destroy(&qiov_full);
     } else if (fidp->fid_type == P9_FID_XATTR) {
         err = v9fs_xattr_read(s, pdu, fidp, off, max_count);
     } else {
@@ -2447,7 +2511,7 @@ size_t v9fs_readdir_response_size(V9fsString *name)
     return 24 + v9fs_string_size(name);
 }
 
-static void v9fs_free_dirents(struct V9fsDirEnt *e)
+void v9fs_free_dirents(struct V9fsDirEnt *e)
 {
     struct V9fsDirEnt *next = NULL;
 
@@ -2459,15 +2523,36 @@ static void v9fs_free_dirents(struct V9fsDirEnt *e)
     }
 }
 
+/*
+ * Encodes one Rreaddir entry at @p, which must have room for
+ * v9fs_readdir_response_size() bytes, and returns its size
+ */
+static size_t v9fs_pack_dirent(uint8_t *p, const V9fsQID *qid, off_t off,
+                               const struct dirent *dent)
+{
+    size_t namelen = strlen(dent->d_name);
+
+    stb_p(p, qid->type);
+    stl_le_p(p + 1, qid->version);
+    stq_le_p(p + 5, qid->path);
+    stq_le_p(p + 13, off);
+    stb_p(p + 21, dent->d_type);
+    stw_le_p(p + 22, namelen);
+    memcpy(p + 24, dent->d_name, namelen);
+    return 24 + namelen;
+}
+
 static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
                                         off_t offset, int32_t max_count)
 {
     size_t size;
     V9fsQID qid;
-    V9fsString name;
-    int len, err = 0;
+    int err = 0;
     int32_t count = 0;
-    off_t off;
+    int32_t nr_entries = 0;
+    int32_t bufsize;
+    g_autofree uint8_t *buf = NULL;
+    V9fsPDUIov piov;
     struct dirent *dent;
     struct stat *st;
     struct V9fsDirEnt *entries = NULL;
@@ -2485,15 +2570,19 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
      * individually, because hopping between threads (this main IO thread
      * and background IO driver thread) would sum up to huge latencies.
      */
-    count = v9fs_co_readdir_many(pdu, fidp, &entries, offset, max_count,
-                                 dostat);
-    if (count < 0) {
-        err = count;
-        count = 0;
+    bufsize = v9fs_co_readdir_many(pdu, fidp, &entries, offset, max_count,
+                                   dostat);
+    if (bufsize < 0) {
+        err = bufsize;
         goto out;
     }
-    count = 0;
 
+    /*
+     * The fs driver already summed up the size of the entries, so encode
+     * them in a single pass and copy them to the PDU at once rather than
+     * marshalling each field.
+     */
+    buf = g_malloc(bufsize);
     for (struct V9fsDirEnt *e = entries; e; e = e->next) {
         dent = e->dent;
 
@@ -2521,6 +2610,7 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
              * user would get that error anyway when accessing those
              * files/dirs through other ways.
              */
+            qid.path = 0;
             size = MIN(sizeof(dent->d_ino), sizeof(qid.path));
             memcpy(&qid.path, &dent->d_ino, size);
             /* Fill the other fields with dummy values */
@@ -2528,24 +2618,23 @@ static int coroutine_fn v9fs_do_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
             qid.version = 0;
         }
 
-        off = qemu_dirent_off(dent);
-        v9fs_string_init(&name);
-        v9fs_string_sprintf(&name, "%s", dent->d_name);
-
-        /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
-        len = pdu_marshal(pdu, 11 + count, "Qqbs",
-                          &qid, off,
-                          dent->d_type, &name);
-
-        v9fs_string_free(&name);
-
-        if (len < 0) {
-            err = len;
-            break;
-        }
+        count += v9fs_pack_dirent(buf + count, &qid, qemu_dirent_off(dent),
+                                  dent);
+        nr_entries++;
+    }
+    if (err < 0) {
+        goto out;
+    }
+    assert(count <= bufsize);
 
-        count += len;
+    /* 11 = 7 + 4 (7 = start offset, 4 = space for storing count) */
+    v9fs_pdu_iov_get(&piov, pdu, 11, count, false);
+    if (iov_from_buf(piov.iov, piov.niov, 0, buf, count) != count) {
+        err = -ENOBUFS;
     }
+    v9fs_pdu_iov_put(&piov);
+    trace_v9fs_readdir_entries(pdu->tag, pdu->id, fidp->fid, nr_entries,
+                               count);
 
 out:
     v9fs_free_dirents(entries);
@@ -2669,8 +2758,11 @@ static void coroutine_fn v9fs_write(void *opaque)
     V9fsFidState *fidp;
     V9fsPDU *pdu = opaque;
     V9fsState *s = pdu->s;
+    V9fsPDUIov piov;
     QEMUIOVector qiov_full;
-    QEMUIOVector qiov;
+    QEMUIOVector qiov = { };
+    struct iovec *iov;
+    int niov;
 
     err = pdu_unmarshal(pdu, offset, "dqd", &fid, &off, &count);
     if (err < 0) {
@@ -2678,7 +2770,8 @@ static void coroutine_fn v9fs_write(void *opaque)
         return;
     }
     offset += err;
-    v9fs_init_qiov_from_pdu(&qiov_full, pdu, offset, count, true);
+    v9fs_pdu_iov_get(&piov, pdu, offset, count, true);
+    qemu_iovec_init_external(&qiov_full, piov.iov, piov.niov);
     trace_v9fs_write(pdu->tag, pdu->id, fid, off, count, qiov_full.niov);
 
     fidp = get_fid(pdu, fid);
@@ -2702,16 +2795,26 @@ static void coroutine_fn v9fs_write(void *opaque)
         err = -EINVAL;
         goto out;
     }
-    qemu_iovec_init(&qiov, qiov_full.niov);
+    iov = qiov_full.iov;
+    niov = qiov_full.niov;
     do {
-        qemu_iovec_reset(&qiov);
-        qemu_iovec_concat(&qiov, &qiov_full, total, qiov_full.size - total);
+        if (total) {
+            /* Short write, only the rest of the buffer is left */
+            if (!qiov.iov) {
+                qemu_iovec_init(&qiov, qiov_full.niov);
+            }
+            qemu_iovec_reset(&qiov);
+            qemu_iovec_concat(&qiov, &qiov_full, total,
+                              qiov_full.size - total);
+            iov = qiov.iov;
+            niov = qiov.niov;
+        }
         if (0) {
-            print_sg(qiov.iov, qiov.niov);
+            print_sg(iov, niov);
         }
         /* Loop in case of EINTR */
         do {
-            len = v9fs_co_pwritev(pdu, fidp, qiov.iov, qiov.niov, off);
+            len = v9fs_co_pwritev(pdu, fidp, iov, niov, off);
             if (len >= 0) {
                 off   += len;
                 total += len;
@@ -2736,7 +2839,7 @@ out_qiov:
 out:
     put_fid(pdu, fidp);
 out_nofid:
-    qemu_iovec_destroy(&qiov_full);
+    v9fs_pdu_iov_put(&piov);
     pdu_complete(pdu, err);
 }
 
@@ -4181,6 +4284,8 @@ void pdu_submit(V9fsPDU *pdu, P9MsgHeader *hdr)
 
     qemu_co_queue_init(&pdu->complete);
     co = qemu_coroutine_create(handler, pdu);
+    /* Handlers only suspend in v9fs_co_run_in_worker(), not deep down */
+    qemu_coroutine_set_stack_hint(co, 256 * KiB);
     qemu_coroutine_enter(co);
 }
 
@@ -4243,6 +4348,7 @@ int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
 
     s->ctx.fmode = fse->fmode;
     s->ctx.dmode = fse->dmode;
+    v9fs_stat_cache_init(s, fse->cache_ttl);
 
     s->fids = g_hash_table_new(NULL, NULL);
     qemu_co_rwlock_init(&s->rename_lock);
@@ -4308,6 +4414,7 @@ void v9fs_device_unrealize_common(V9fsState *s)
         g_hash_table_destroy(s->fids);
         s->fids = NULL;
     }
+    v9fs_stat_cache_destroy(s);
     g_free(s->tag);
     qp_table_destroy(&s->qpd_table);
     qp_table_destroy(&s->qpp_table);
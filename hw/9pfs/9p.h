@@ -131,6 +131,7 @@ static inline char *rpath(FsContext *ctx, const char *path)
 typedef struct V9fsPDU V9fsPDU;
 typedef struct V9fsState V9fsState;
 typedef struct V9fsTransport V9fsTransport;
+typedef struct V9fsStatCache V9fsStatCache;
 
 typedef struct {
     uint32_t size_le;
@@ -253,6 +254,22 @@ typedef struct V9fsDirEnt {
     struct V9fsDirEnt *next;
 } V9fsDirEnt;
 
+/*
+ * The directory entries that follow those of the last Treaddir on a fid,
+ * read on the same trip to the fs driver, for the next Treaddir to use.
+ */
+typedef struct V9fsDirReadAhead {
+    bool valid;
+    /* position in the directory they start at */
+    off_t offset;
+    /* the request they are good for */
+    int32_t maxsize;
+    bool dostat;
+    /* response message body size of @entries (in bytes) */
+    int32_t size;
+    V9fsDirEnt *entries;
+} V9fsDirReadAhead;
+
 /*
  * Filled by fs driver on open and other
  * calls.
@@ -280,6 +297,8 @@ struct V9fsFidState {
     uid_t uid;
     int ref;
     bool clunked;
+    /* protected by the readdir mutex of fs.dir */
+    V9fsDirReadAhead readahead;
     QSIMPLEQ_ENTRY(V9fsFidState) next;
     QSLIST_ENTRY(V9fsFidState) reclaim_next;
 };
@@ -363,6 +382,8 @@ struct V9fsState {
     uint64_t qp_ndevices; /* Amount of entries in qpd_table. */
     uint16_t qp_affix_next;
     uint64_t qp_fullpath_next;
+    /* Cached lstat() results, NULL unless cache_ttl is set */
+    V9fsStatCache *stat_cache;
 };
 
 /* 9p2000.L open flags */
@@ -459,6 +480,7 @@ void v9fs_path_free(V9fsPath *path);
 void v9fs_path_sprintf(V9fsPath *path, const char *fmt, ...);
 void v9fs_path_copy(V9fsPath *dst, const V9fsPath *src);
 size_t v9fs_readdir_response_size(V9fsString *name);
+void v9fs_free_dirents(V9fsDirEnt *e);
 int v9fs_name_to_path(V9fsState *s, V9fsPath *dirpath,
                       const char *name, V9fsPath *path);
 int v9fs_device_realize_common(V9fsState *s, const V9fsTransport *t,
@@ -21,8 +21,10 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "coth.h"
+#include "9p-cache.h"
 #include "9p-xattr.h"
 #include "9p-util.h"
+#include "trace.h"
 
 /*
  * Intended to be called from bottom-half (e.g. background I/O thread)
@@ -64,52 +66,30 @@ int coroutine_fn v9fs_co_readdir(V9fsPDU *pdu, V9fsFidState *fidp,
 }
 
 /*
- * This is solely executed on a background IO thread.
+ * Collects directory entries from the current position on, up to a
+ * response message body size of @maxsize.  *@pos is set to the position
+ * after the last one and *@eof to whether the end of the directory was
+ * reached.
  *
- * See v9fs_co_readdir_many() (as its only user) below for details.
+ * This is solely executed on a background IO thread.
  */
-static int coroutine_fn
-do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
-                off_t offset, int32_t maxsize, bool dostat)
+static int do_readdir_batch(V9fsPDU *pdu, V9fsFidState *fidp,
+                            struct V9fsDirEnt **entries, int32_t maxsize,
+                            bool dostat, off_t *pos, bool *eof)
 {
     V9fsState *s = pdu->s;
     V9fsString name;
     int len, err = 0;
     int32_t size = 0;
-    off_t saved_dir_pos;
     struct dirent *dent;
     struct V9fsDirEnt *e = NULL;
     V9fsPath path;
     struct stat stbuf;
 
     *entries = NULL;
+    *eof = false;
     v9fs_path_init(&path);
 
-    /*
-     * TODO: Here should be a warn_report_once() if lock failed.
-     *
-     * With a good 9p client we should not get into concurrency here,
-     * because a good client would not use the same fid for concurrent
-     * requests. We do the lock here for safety reasons though. However
-     * the client would then suffer performance issues, so better log that
-     * issue here.
-     */
-    v9fs_readdir_lock(&fidp->fs.dir);
-
-    /* seek directory to requested initial position */
-    if (offset == 0) {
-        s->ops->rewinddir(&s->ctx, &fidp->fs);
-    } else {
-        s->ops->seekdir(&s->ctx, &fidp->fs, offset);
-    }
-
-    /* save the directory position */
-    saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
-    if (saved_dir_pos < 0) {
-        err = saved_dir_pos;
-        goto out;
-    }
-
     while (true) {
         /* interrupt loop if request was cancelled by a Tflush request */
         if (v9fs_request_cancelled(pdu)) {
@@ -120,6 +100,7 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
         /* get directory entry from fs driver */
         err = do_readdir(pdu, fidp, &dent);
         if (err || !dent) {
+            *eof = !err;
             break;
         }
 
@@ -156,7 +137,7 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
                 break;
             }
 
-            err = s->ops->lstat(&s->ctx, &path, &stbuf);
+            err = v9fs_stat_cache_lstat(s, &path, &stbuf);
             if (err < 0) {
                 err = -errno;
                 break;
@@ -167,18 +148,119 @@ do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
         }
 
         size += len;
-        saved_dir_pos = qemu_dirent_off(dent);
+        *pos = qemu_dirent_off(dent);
+    }
+
+    v9fs_path_free(&path);
+    if (err < 0) {
+        return err;
+    }
+    return size;
+}
+
+/*
+ * This is solely executed on a background IO thread.
+ *
+ * See v9fs_co_readdir_many() (as its only user) below for details.
+ */
+static int coroutine_fn
+do_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp, struct V9fsDirEnt **entries,
+                off_t offset, int32_t maxsize, bool dostat)
+{
+    V9fsState *s = pdu->s;
+    V9fsDirReadAhead *ra = &fidp->readahead;
+    int err = 0;
+    off_t saved_dir_pos;
+    bool eof;
+
+    *entries = NULL;
+
+    /*
+     * TODO: Here should be a warn_report_once() if lock failed.
+     *
+     * With a good 9p client we should not get into concurrency here,
+     * because a good client would not use the same fid for concurrent
+     * requests. We do the lock here for safety reasons though. However
+     * the client would then suffer performance issues, so better log that
+     * issue here.
+     */
+    v9fs_readdir_lock(&fidp->fs.dir);
+
+    /* seek directory to requested initial position */
+    if (offset == 0) {
+        s->ops->rewinddir(&s->ctx, &fidp->fs);
+    } else {
+        s->ops->seekdir(&s->ctx, &fidp->fs, offset);
     }
 
+    /* save the directory position */
+    saved_dir_pos = s->ops->telldir(&s->ctx, &fidp->fs);
+    if (saved_dir_pos < 0) {
+        err = saved_dir_pos;
+        goto out;
+    }
+
+    v9fs_free_dirents(ra->entries);
+    *ra = (V9fsDirReadAhead) { };
+
+    err = do_readdir_batch(pdu, fidp, entries, maxsize, dostat,
+                           &saved_dir_pos, &eof);
+    if (err < 0) {
+        goto out_seek;
+    }
+
+    /*
+     * Clients keep on reading from where this request stops, so read the
+     * next batch now rather than on another trip to this thread.  At the
+     * end of the directory that is an empty batch, which saves the trip
+     * of the last Treaddir.
+     */
+    ra->offset = saved_dir_pos;
+    ra->maxsize = maxsize;
+    ra->dostat = dostat;
+    if (eof) {
+        ra->valid = true;
+    } else {
+        s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
+        ra->size = do_readdir_batch(pdu, fidp, &ra->entries, maxsize, dostat,
+                                    &saved_dir_pos, &eof);
+        ra->valid = ra->size >= 0;
+        if (!ra->valid) {
+            /* the next request gets to see the error */
+            v9fs_free_dirents(ra->entries);
+            ra->entries = NULL;
+            saved_dir_pos = ra->offset;
+        }
+    }
+
+out_seek:
     /* restore (last) saved position */
     s->ops->seekdir(&s->ctx, &fidp->fs, saved_dir_pos);
 
 out:
     v9fs_readdir_unlock(&fidp->fs.dir);
-    v9fs_path_free(&path);
-    if (err < 0) {
-        return err;
+    return err;
+}
+
+/*
+ * Takes the entries read ahead by the last request on @fidp if they are
+ * the ones asked for, returns their size or -1 if there are none.
+ */
+static int coroutine_fn
+v9fs_readdir_take_readahead(V9fsFidState *fidp, struct V9fsDirEnt **entries,
+                            off_t offset, int32_t maxsize, bool dostat)
+{
+    V9fsDirReadAhead *ra = &fidp->readahead;
+    int size = -1;
+
+    v9fs_readdir_lock(&fidp->fs.dir);
+    if (ra->valid && offset != 0 && ra->offset == offset &&
+        ra->maxsize == maxsize && ra->dostat == dostat) {
+        *entries = ra->entries;
+        size = ra->size;
+        *ra = (V9fsDirReadAhead) { };
     }
+    v9fs_readdir_unlock(&fidp->fs.dir);
     return size;
 }
 
@@ -223,6 +305,15 @@ int coroutine_fn v9fs_co_readdir_many(V9fsPDU *pdu, V9fsFidState *fidp,
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+
+    /* Rewinding always reads the directory afresh */
+    err = v9fs_readdir_take_readahead(fidp, entries, offset, maxsize, dostat);
+    trace_v9fs_readdir_readahead(pdu->tag, pdu->id, fidp->fid, offset,
+                                 err >= 0);
+    if (err >= 0) {
+        return err;
+    }
+
     v9fs_co_run_in_worker({
         err = do_readdir_many(pdu, fidp, entries, offset, maxsize, dostat);
     });
@@ -295,6 +386,7 @@ int coroutine_fn v9fs_co_mkdir(V9fsPDU *pdu, V9fsFidState *fidp,
             if (err < 0) {
                 err = -errno;
             } else {
+                v9fs_stat_cache_invalidate_name(s, &fidp->path, name->data);
                 v9fs_path_init(&path);
                 err = v9fs_name_to_path(s, &fidp->path, name->data, &path);
                 if (!err) {
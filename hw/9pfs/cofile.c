@@ -21,6 +21,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "coth.h"
+#include "9p-cache.h"
 
 int coroutine_fn v9fs_co_st_gen(V9fsPDU *pdu, V9fsPath *path, mode_t st_mode,
                                 V9fsStatDotl *v9stat)
@@ -54,10 +55,13 @@ int coroutine_fn v9fs_co_lstat(V9fsPDU *pdu, V9fsPath *path, struct stat *stbuf)
     if (v9fs_request_cancelled(pdu)) {
         return -EINTR;
     }
+    if (v9fs_stat_cache_lookup(s, path, stbuf, &err)) {
+        return err;
+    }
     v9fs_path_read_lock(s);
     v9fs_co_run_in_worker(
         {
-            err = s->ops->lstat(&s->ctx, path, stbuf);
+            err = v9fs_stat_cache_lstat(s, path, stbuf);
             if (err < 0) {
                 err = -errno;
             }
@@ -117,6 +121,9 @@ int coroutine_fn v9fs_co_open(V9fsPDU *pdu, V9fsFidState *fidp, int flags)
                 err = 0;
             }
         });
+    if (flags & O_TRUNC) {
+        v9fs_stat_cache_invalidate(s, &fidp->path);
+    }
     v9fs_path_unlock(s);
     if (!err) {
         total_open_fd++;
@@ -156,6 +163,7 @@ int coroutine_fn v9fs_co_open2(V9fsPDU *pdu, V9fsFidState *fidp,
             if (err < 0) {
                 err = -errno;
             } else {
+                v9fs_stat_cache_invalidate_name(s, &fidp->path, name->data);
                 v9fs_path_init(&path);
                 err = v9fs_name_to_path(s, &fidp->path, name->data, &path);
                 if (!err) {
@@ -239,6 +247,8 @@ int coroutine_fn v9fs_co_link(V9fsPDU *pdu, V9fsFidState *oldfid,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, &oldfid->path);
+    v9fs_stat_cache_invalidate_name(s, &newdirfid->path, name->data);
     v9fs_path_unlock(s);
     return err;
 }
@@ -260,6 +270,7 @@ int coroutine_fn v9fs_co_pwritev(V9fsPDU *pdu, V9fsFidState *fidp,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, &fidp->path);
     return err;
 }
 
@@ -21,6 +21,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "coth.h"
+#include "9p-cache.h"
 
 static ssize_t __readlink(V9fsState *s, V9fsPath *path, V9fsString *buf)
 {
@@ -114,6 +115,7 @@ int coroutine_fn v9fs_co_chmod(V9fsPDU *pdu, V9fsPath *path, mode_t mode)
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, path);
     v9fs_path_unlock(s);
     return err;
 }
@@ -135,6 +137,7 @@ int coroutine_fn v9fs_co_utimensat(V9fsPDU *pdu, V9fsPath *path,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, path);
     v9fs_path_unlock(s);
     return err;
 }
@@ -160,6 +163,7 @@ int coroutine_fn v9fs_co_chown(V9fsPDU *pdu, V9fsPath *path, uid_t uid,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, path);
     v9fs_path_unlock(s);
     return err;
 }
@@ -180,6 +184,7 @@ int coroutine_fn v9fs_co_truncate(V9fsPDU *pdu, V9fsPath *path, off_t size)
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, path);
     v9fs_path_unlock(s);
     return err;
 }
@@ -208,6 +213,7 @@ int coroutine_fn v9fs_co_mknod(V9fsPDU *pdu, V9fsFidState *fidp,
             if (err < 0) {
                 err = -errno;
             } else {
+                v9fs_stat_cache_invalidate_name(s, &fidp->path, name->data);
                 v9fs_path_init(&path);
                 err = v9fs_name_to_path(s, &fidp->path, name->data, &path);
                 if (!err) {
@@ -240,6 +246,7 @@ int coroutine_fn v9fs_co_remove(V9fsPDU *pdu, V9fsPath *path)
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate(s, path);
     v9fs_path_unlock(s);
     return err;
 }
@@ -261,6 +268,7 @@ int coroutine_fn v9fs_co_unlinkat(V9fsPDU *pdu, V9fsPath *path,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_invalidate_name(s, path, name->data);
     v9fs_path_unlock(s);
     return err;
 }
@@ -282,6 +290,7 @@ int coroutine_fn v9fs_co_rename(V9fsPDU *pdu, V9fsPath *oldpath,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_clear(s);
     return err;
 }
 
@@ -303,6 +312,7 @@ int coroutine_fn v9fs_co_renameat(V9fsPDU *pdu, V9fsPath *olddirpath,
                 err = -errno;
             }
         });
+    v9fs_stat_cache_clear(s);
     return err;
 }
 
@@ -330,6 +340,7 @@ int coroutine_fn v9fs_co_symlink(V9fsPDU *pdu, V9fsFidState *dfidp,
             if (err < 0) {
                 err = -errno;
             } else {
+                v9fs_stat_cache_invalidate_name(s, &dfidp->path, name->data);
                 v9fs_path_init(&path);
                 err = v9fs_name_to_path(s, &dfidp->path, name->data, &path);
                 if (!err) {
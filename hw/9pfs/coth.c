@@ -23,6 +23,68 @@
 #include "qemu/main-loop.h"
 #include "coth.h"
 
+#ifdef EMSCRIPTEN
+/*
+ * The block layer's thread pool starts threads on demand and lets them
+ * exit when idle, and each thread is a web worker that takes long to
+ * start.  9p requests go to a few threads that stay around instead.
+ * The file system calls they make are still proxied to the browser
+ * thread by emscripten, but QEMU's main loop no longer waits for them.
+ */
+#define V9FS_WORKER_THREADS 4
+
+static QemuMutex v9fs_worker_lock;
+static QemuCond v9fs_worker_cond;
+static GQueue v9fs_worker_queue = G_QUEUE_INIT;
+
+static void *v9fs_worker_thread(void *opaque)
+{
+    while (true) {
+        Coroutine *co;
+
+        qemu_mutex_lock(&v9fs_worker_lock);
+        while (g_queue_is_empty(&v9fs_worker_queue)) {
+            qemu_cond_wait(&v9fs_worker_cond, &v9fs_worker_lock);
+        }
+        co = g_queue_pop_head(&v9fs_worker_queue);
+        qemu_mutex_unlock(&v9fs_worker_lock);
+
+        /* Runs the code block, until it yields to go back */
+        qemu_coroutine_enter(co);
+
+        /*
+         * The main loop enters all the coroutines scheduled since its
+         * last iteration from a single bottom half
+         */
+        aio_co_schedule(qemu_get_aio_context(), co);
+    }
+    return NULL;
+}
+
+/* Called from QEMU I/O thread.  */
+void co_run_in_worker_bh(void *opaque)
+{
+    static bool started;
+    Coroutine *co = opaque;
+
+    if (!started) {
+        qemu_mutex_init(&v9fs_worker_lock);
+        qemu_cond_init(&v9fs_worker_cond);
+        for (int i = 0; i < V9FS_WORKER_THREADS; i++) {
+            QemuThread thread;
+
+            qemu_thread_create(&thread, "9p-worker", v9fs_worker_thread,
+                               NULL, QEMU_THREAD_DETACHED);
+        }
+        started = true;
+    }
+
+    qemu_mutex_lock(&v9fs_worker_lock);
+    g_queue_push_tail(&v9fs_worker_queue, co);
+    qemu_cond_signal(&v9fs_worker_cond);
+    qemu_mutex_unlock(&v9fs_worker_lock);
+}
+#else
 /* Called from QEMU I/O thread.  */
 static void coroutine_enter_cb(void *opaque, int ret)
 {
@@ -43,3 +105,4 @@ void co_run_in_worker_bh(void *opaque)
     Coroutine *co = opaque;
     thread_pool_submit_aio(coroutine_enter_func, co, coroutine_enter_cb, co);
 }
+#endif
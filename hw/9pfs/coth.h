@@ -19,7 +19,6 @@
 #include "qemu/coroutine-core.h"
 #include "9p.h"
 
-#ifndef EMSCRIPTEN
 /*
  * we want to use bottom half because we want to make sure the below
  * sequence of events.
@@ -39,6 +38,8 @@
  * fs driver request on a background I/O thread (bottom half) in one rush
  * first and then eventually assembling the final response from that data
  * on main I/O thread (top half).
+ *
+ * On emscripten the worker threads are a dedicated pool, see coth.c.
  */
 #define v9fs_co_run_in_worker(code_block)                               \
     do {                                                                \
@@ -58,12 +59,6 @@
         /* re-enter back to qemu thread */                              \
         qemu_coroutine_yield();                                         \
     } while (0)
-#else
-#define v9fs_co_run_in_worker(code_block)                               \
-    do {                                                                \
-        code_block;                                                     \
-    } while (0);
-#endif
 
 void co_run_in_worker_bh(void *);
 int coroutine_fn v9fs_co_readlink(V9fsPDU *, V9fsPath *, V9fsString *);
@@ -43,48 +43,62 @@ static void virtio_9p_push_and_notify(V9fsPDU *pdu)
     virtio_notify(VIRTIO_DEVICE(v), v->vq);
 }
 
+/* Requests popped at once by handle_9p_output() */
+#define VIRTIO_9P_POP_BATCH 16
+
 static void handle_9p_output(VirtIODevice *vdev, VirtQueue *vq)
 {
     V9fsVirtioState *v = (V9fsVirtioState *)vdev;
     V9fsState *s = &v->state;
-    V9fsPDU *pdu;
+    V9fsPDU *pdus[VIRTIO_9P_POP_BATCH];
+    VirtQueueElement *elems[VIRTIO_9P_POP_BATCH];
+    unsigned int npdus, nelems, handled, i;
     ssize_t len;
-    VirtQueueElement *elem;
-
-    while ((pdu = pdu_alloc(s))) {
-        P9MsgHeader out;
 
-        elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            goto out_free_pdu;
+    do {
+        /* Only pop as many requests as there are PDUs to handle them */
+        for (npdus = 0; npdus < ARRAY_SIZE(pdus); npdus++) {
+            pdus[npdus] = pdu_alloc(s);
+            if (!pdus[npdus]) {
+                break;
+            }
         }
-
-        if (iov_size(elem->in_sg, elem->in_num) < 7) {
-            virtio_error(vdev,
-                         "The guest sent a VirtFS request without space for "
-                         "the reply");
-            goto out_free_req;
+        nelems = virtqueue_pop_batch(vq, sizeof(VirtQueueElement),
+                                     (void **)elems, npdus);
+
+        for (i = 0; i < nelems; i++) {
+            VirtQueueElement *elem = elems[i];
+            P9MsgHeader out;
+
+            if (iov_size(elem->in_sg, elem->in_num) < 7) {
+                virtio_error(vdev,
+                             "The guest sent a VirtFS request without space "
+                             "for the reply");
+                break;
+            }
+
+            len = iov_to_buf(elem->out_sg, elem->out_num, 0, &out, 7);
+            if (len != 7) {
+                virtio_error(vdev, "The guest sent a malformed VirtFS request: "
+                             "header size is %zd, should be 7", len);
+                break;
+            }
+
+            v->elems[pdus[i]->idx] = elem;
+
+            pdu_submit(pdus[i], &out);
         }
 
-        len = iov_to_buf(elem->out_sg, elem->out_num, 0, &out, 7);
-        if (len != 7) {
-            virtio_error(vdev, "The guest sent a malformed VirtFS request: "
-                         "header size is %zd, should be 7", len);
-            goto out_free_req;
+        handled = i;
+        for (; i < nelems; i++) {
+            /* The device is broken, give back what was not handled */
+            virtqueue_detach_element(vq, elems[i], 0);
+            g_free(elems[i]);
         }
-
-        v->elems[pdu->idx] = elem;
-
-        pdu_submit(pdu, &out);
-    }
-
-    return;
-
-out_free_req:
-    virtqueue_detach_element(vq, elem, 0);
-    g_free(elem);
-out_free_pdu:
-    pdu_free(pdu);
+        for (i = handled; i < npdus; i++) {
+            pdu_free(pdus[i]);
+        }
+    } while (npdus && handled == npdus);
 }
 
 static uint64_t virtio_9p_get_features(VirtIODevice *vdev, uint64_t features,
@@ -15,6 +15,7 @@
 #include "qemu/defer-call.h"
 #include "qapi/error.h"
 #include "qemu/iov.h"
+#include "qemu/bitmap.h"
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
@@ -54,6 +55,42 @@ static void virtio_blk_free_request(VirtIOBlockReq *req)
     g_free(req);
 }
 
+static void virtio_blk_notify_bh(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    unsigned long i;
+
+    trace_virtio_blk_notify_batch(vdev, s->notify_batch);
+    s->notify_batch = 0;
+
+    for (i = find_first_bit(s->notify_pending, s->conf.num_queues);
+         i < s->conf.num_queues;
+         i = find_next_bit(s->notify_pending, s->conf.num_queues, i + 1)) {
+        clear_bit(i, s->notify_pending);
+        virtio_notify(vdev, virtio_get_queue(vdev, i));
+    }
+}
+
+/* Delivers the notifications that are still waiting for the bottom half */
+static void virtio_blk_flush_notify(VirtIOBlock *s)
+{
+    if (s->notify_bh && s->notify_batch) {
+        qemu_bh_cancel(s->notify_bh);
+        virtio_blk_notify_bh(s);
+    }
+}
+
+static void virtio_blk_free_notify(VirtIOBlock *s)
+{
+    if (s->notify_bh) {
+        qemu_bh_delete(s->notify_bh);
+        s->notify_bh = NULL;
+        g_free(s->notify_pending);
+        s->notify_pending = NULL;
+    }
+}
+
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
@@ -67,6 +104,17 @@ static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
     virtqueue_push(req->vq, &req->elem, req->in_len);
     if (s->dataplane_started && !s->dataplane_disabled) {
         virtio_blk_data_plane_notify(s->dataplane, req->vq);
+    } else if (s->notify_bh) {
+        /*
+         * Each notification costs the guest an interrupt, which is expensive
+         * under TCG.  Requests that complete in the same iteration of the
+         * event loop are notified together by the bottom half, which runs
+         * after them.  virtio_notify() still checks the used event index
+         * of the guest against the whole batch.
+         */
+        set_bit(virtio_get_queue_index(req->vq), s->notify_pending);
+        s->notify_batch++;
+        qemu_bh_schedule(s->notify_bh);
     } else {
         virtio_notify(vdev, req->vq);
     }
@@ -235,14 +283,20 @@ out:
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
+/* Requests popped at once by virtio_blk_handle_vq() */
+#define VIRTIO_BLK_POP_BATCH 16
+
+static unsigned int virtio_blk_get_requests(VirtIOBlock *s, VirtQueue *vq,
+                                            VirtIOBlockReq **reqs,
+                                            unsigned int max)
 {
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
+    unsigned int n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq),
+                                         (void **)reqs, max);
 
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
+    for (unsigned int i = 0; i < n; i++) {
+        virtio_blk_init_request(s, vq, reqs[i]);
     }
-    return req;
+    return n;
 }
 
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
@@ -1130,7 +1184,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
+    unsigned int i, n;
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -1142,10 +1197,18 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+        while ((n = virtio_blk_get_requests(s, vq, reqs, ARRAY_SIZE(reqs)))) {
+            for (i = 0; i < n; i++) {
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, give back what was not handled */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(reqs[i]->vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
                 break;
             }
         }
@@ -1253,6 +1316,13 @@ static void virtio_blk_reset(VirtIODevice *vdev)
 
     aio_context_release(ctx);
 
+    /* The queues are gone, so is the need to notify them */
+    if (s->notify_bh) {
+        qemu_bh_cancel(s->notify_bh);
+        bitmap_zero(s->notify_pending, s->conf.num_queues);
+        s->notify_batch = 0;
+    }
+
     assert(!s->dataplane_started);
     blk_set_enable_write_cache(s->blk, s->original_wce);
 }
@@ -1408,6 +1478,9 @@ static void virtio_blk_set_status(VirtIODevice *vdev, uint8_t status)
 {
     VirtIOBlock *s = VIRTIO_BLK(vdev);
 
+    /* Also called on vm stop, the interrupt must be raised before migration */
+    virtio_blk_flush_notify(s);
+
     if (!(status & (VIRTIO_CONFIG_S_DRIVER | VIRTIO_CONFIG_S_DRIVER_OK))) {
         assert(!s->dataplane_started);
     }
@@ -1635,6 +1708,11 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
     for (i = 0; i < conf->num_queues; i++) {
         virtio_add_queue(vdev, conf->queue_size, virtio_blk_handle_output);
     }
+    if (conf->batch_completions) {
+        s->notify_bh = qemu_bh_new_guarded(virtio_blk_notify_bh, s,
+                                           &dev->mem_reentrancy_guard);
+        s->notify_pending = bitmap_new(conf->num_queues);
+    }
     qemu_coroutine_inc_pool_size(conf->num_queues * conf->queue_size / 2);
     virtio_blk_data_plane_create(vdev, conf, &s->dataplane, &err);
     if (err != NULL) {
@@ -1642,6 +1720,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         for (i = 0; i < conf->num_queues; i++) {
             virtio_del_queue(vdev, i);
         }
+        virtio_blk_free_notify(s);
         virtio_cleanup(vdev);
         return;
     }
@@ -1672,6 +1751,8 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     unsigned i;
 
     blk_drain(s->blk);
+    virtio_blk_flush_notify(s);
+    virtio_blk_free_notify(s);
     del_boot_device_lchs(dev, "/disk@0,0");
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
@@ -1735,6 +1816,8 @@ static Property virtio_blk_properties[] = {
                        conf.max_write_zeroes_sectors, BDRV_REQUEST_MAX_SECTORS),
     DEFINE_PROP_BOOL("x-enable-wce-if-config-wce", VirtIOBlock,
                      conf.x_enable_wce_if_config_wce, true),
+    DEFINE_PROP_BOOL("batch-completions", VirtIOBlock,
+                     conf.batch_completions, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -250,6 +250,7 @@ static void cpu_common_initfn(Object *obj)
     cpu->cflags_next_tb = -1;
 
     qemu_mutex_init(&cpu->work_mutex);
+    qemu_parker_init(&cpu->halt_parker);
     qemu_lockcnt_init(&cpu->in_ioctl_lock);
     QSIMPLEQ_INIT(&cpu->work_list);
     QTAILQ_INIT(&cpu->breakpoints);
@@ -263,6 +264,7 @@ static void cpu_common_finalize(Object *obj)
     CPUState *cpu = CPU(obj);
 
     qemu_lockcnt_destroy(&cpu->in_ioctl_lock);
+    qemu_parker_destroy(&cpu->halt_parker);
     qemu_mutex_destroy(&cpu->work_mutex);
 }
 
@@ -101,6 +101,67 @@ ssize_t load_image_size(const char *filename, void *addr, size_t size)
     return actsize < 0 ? -1 : l;
 }
 
+/*
+ * With emscripten, the files that the file packager preloaded are in
+ * MEMFS, which may already hold their contents in the wasm heap.  A
+ * read-only shared mmap() of such a file then returns the contents in
+ * place, where read() would copy them; the mmap() of emscripten only
+ * copies the other files.  Elsewhere, keep reading images into memory
+ * of our own, so that changes to the file do not show up in the ROM.
+ */
+static void *map_image_fd(int fd, size_t size)
+{
+#ifdef EMSCRIPTEN
+    void *ptr;
+
+    if (!size) {
+        return NULL;
+    }
+    ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+#else
+    return NULL;
+#endif
+}
+
+static void unmap_image(void *ptr, size_t size)
+{
+#ifdef EMSCRIPTEN
+    munmap(ptr, size);
+#else
+    g_assert_not_reached();
+#endif
+}
+
+void *load_image_mapped(const char *filename, size_t *size, Error **errp)
+{
+    GMappedFile *mapped_file;
+    GError *gerr = NULL;
+    int fd;
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    if (fd >= 0) {
+        off_t len = lseek(fd, 0, SEEK_END);
+        void *ptr = len > 0 ? map_image_fd(fd, len) : NULL;
+
+        close(fd);
+        if (ptr) {
+            *size = len;
+            return ptr;
+        }
+    }
+
+    mapped_file = g_mapped_file_new(filename, false, &gerr);
+    if (!mapped_file) {
+        error_setg(errp, "%s", gerr->message);
+        g_error_free(gerr);
+        return NULL;
+    }
+    /* The contents stay mapped for as long as QEMU runs */
+    *size = g_mapped_file_get_length(mapped_file);
+    return g_mapped_file_get_contents(mapped_file) ?: (void *)"";
+}
+
 /* read()-like version */
 ssize_t read_targphys(const char *name,
                       int fd, hwaddr dst_addr, size_t nbytes)
@@ -975,6 +1036,8 @@ struct Rom {
     char *fw_dir;
     char *fw_file;
     GMappedFile *mapped_file;
+    /* data was mapped straight from the file by map_image_fd() */
+    bool data_mapped;
 
     bool committed;
 
@@ -987,13 +1050,16 @@ static QTAILQ_HEAD(, Rom) roms = QTAILQ_HEAD_INITIALIZER(roms);
 
 /*
  * rom->data can be heap-allocated or memory-mapped (e.g. when added with
- * rom_add_elf_program())
+ * rom_add_elf_program() or from a preloaded file by rom_add_file())
  */
 static void rom_free_data(Rom *rom)
 {
     if (rom->mapped_file) {
         g_mapped_file_unref(rom->mapped_file);
         rom->mapped_file = NULL;
+    } else if (rom->data_mapped) {
+        unmap_image(rom->data, rom->datasize);
+        rom->data_mapped = false;
     } else {
         g_free(rom->data);
     }
@@ -1114,13 +1180,19 @@ ssize_t rom_add_file(const char *file, const char *fw_dir,
     }
 
     rom->datasize = rom->romsize;
-    rom->data     = g_malloc0(rom->datasize);
-    lseek(fd, 0, SEEK_SET);
-    rc = read(fd, rom->data, rom->datasize);
-    if (rc != rom->datasize) {
-        fprintf(stderr, "rom: file %-20s: read error: rc=%zd (expected %zd)\n",
-                rom->name, rc, rom->datasize);
-        goto err;
+    rom->data     = map_image_fd(fd, rom->datasize);
+    if (rom->data) {
+        rom->data_mapped = true;
+    } else {
+        rom->data = g_malloc0(rom->datasize);
+        lseek(fd, 0, SEEK_SET);
+        rc = read(fd, rom->data, rom->datasize);
+        if (rc != rom->datasize) {
+            fprintf(stderr,
+                    "rom: file %-20s: read error: rc=%zd (expected %zd)\n",
+                    rom->name, rc, rom->datasize);
+            goto err;
+        }
     }
     close(fd);
     rom_insert(rom);
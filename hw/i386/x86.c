@@ -865,21 +865,17 @@ void x86_load_linux(X86MachineState *x86ms,
 
             /* load initrd */
             if (initrd_filename) {
-                GMappedFile *mapped_file;
-                gsize initrd_size;
-                gchar *initrd_data;
-                GError *gerr = NULL;
+                size_t initrd_size;
+                void *initrd_data;
+                Error *err = NULL;
 
-                mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
-                if (!mapped_file) {
+                initrd_data = load_image_mapped(initrd_filename, &initrd_size,
+                                                &err);
+                if (!initrd_data) {
                     fprintf(stderr, "qemu: error reading initrd %s: %s\n",
-                            initrd_filename, gerr->message);
+                            initrd_filename, error_get_pretty(err));
                     exit(1);
                 }
-                x86ms->initrd_mapped_file = mapped_file;
-
-                initrd_data = g_mapped_file_get_contents(mapped_file);
-                initrd_size = g_mapped_file_get_length(mapped_file);
                 initrd_max = x86ms->below_4g_mem_size - acpi_data_size - 1;
                 if (initrd_size >= initrd_max) {
                     fprintf(stderr, "qemu: initrd is too large, cannot support."
@@ -1006,26 +1002,21 @@ void x86_load_linux(X86MachineState *x86ms,
 
     /* load initrd */
     if (initrd_filename) {
-        GMappedFile *mapped_file;
-        gsize initrd_size;
-        gchar *initrd_data;
-        GError *gerr = NULL;
+        size_t initrd_size;
+        void *initrd_data;
+        Error *err = NULL;
 
         if (protocol < 0x200) {
             fprintf(stderr, "qemu: linux kernel too old to load a ram disk\n");
             exit(1);
         }
 
-        mapped_file = g_mapped_file_new(initrd_filename, false, &gerr);
-        if (!mapped_file) {
+        initrd_data = load_image_mapped(initrd_filename, &initrd_size, &err);
+        if (!initrd_data) {
             fprintf(stderr, "qemu: error reading initrd %s: %s\n",
-                    initrd_filename, gerr->message);
+                    initrd_filename, error_get_pretty(err));
             exit(1);
         }
-        x86ms->initrd_mapped_file = mapped_file;
-
-        initrd_data = g_mapped_file_get_contents(mapped_file);
-        initrd_size = g_mapped_file_get_length(mapped_file);
         if (initrd_size >= initrd_max) {
             fprintf(stderr, "qemu: initrd is too large, cannot support."
                     "(max: %"PRIu32", need %"PRId64")\n",
@@ -1058,15 +1049,36 @@ void x86_load_linux(X86MachineState *x86ms,
     kernel_size -= setup_size;
 
     setup  = g_malloc(setup_size);
-    kernel = g_malloc(kernel_size);
     fseek(f, 0, SEEK_SET);
     if (fread(setup, 1, setup_size, f) != setup_size) {
         fprintf(stderr, "fread() failed\n");
         exit(1);
     }
-    if (fread(kernel, 1, kernel_size, f) != kernel_size) {
-        fprintf(stderr, "fread() failed\n");
-        exit(1);
+#ifdef EMSCRIPTEN
+    if (!dtb_filename) {
+        /*
+         * fw_cfg hands out the kernel as it is in the file, so take it in
+         * place from the preloaded file.  Other hosts keep a copy of
+         * their own, like for the setup code.
+         */
+        uint8_t *image;
+        size_t image_size;
+
+        image = load_image_mapped(kernel_filename, &image_size, &error_fatal);
+        if (image_size != setup_size + kernel_size) {
+            fprintf(stderr, "qemu: kernel file '%s' changed while loading\n",
+                    kernel_filename);
+            exit(1);
+        }
+        kernel = image + setup_size;
+    } else
+#endif
+    {
+        kernel = g_malloc(kernel_size);
+        if (fread(kernel, 1, kernel_size, f) != kernel_size) {
+            fprintf(stderr, "fread() failed\n");
+            exit(1);
+        }
     }
     fclose(f);
 
@@ -123,6 +123,7 @@ struct E1000State_st {
     bool mit_timer_on;         /* Mitigation timer is running. */
     bool mit_irq_level;        /* Tracks interrupt pin level. */
     uint32_t mit_ide;          /* Tracks E1000_TXD_CMD_IDE bit. */
+    uint32_t mit_rx_packets;   /* Received since the last interrupt. */
 
     QEMUTimer *flush_queue_timer;
 
@@ -332,6 +333,9 @@ set_interrupt_cause(E1000State *s, int index, uint32_t val)
         timer_mod(s->mit_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
                   mit_delay * 256);
         s->mit_ide = 0;
+
+        trace_e1000_mit_irq(pending_ints, s->mit_rx_packets, mit_delay);
+        s->mit_rx_packets = 0;
     }
 
     s->mit_irq_level = (pending_ints != 0);
@@ -385,6 +389,7 @@ static void e1000_reset_hold(Object *obj)
     d->mit_timer_on = 0;
     d->mit_irq_level = 0;
     d->mit_ide = 0;
+    d->mit_rx_packets = 0;
     memset(d->phy_reg, 0, sizeof d->phy_reg);
     memcpy(d->phy_reg, phy_reg_init, sizeof phy_reg_init);
     d->phy_reg[MII_PHYID2] = edc->phy_id2;
@@ -998,6 +1003,7 @@ e1000_receive_iov(NetClientState *nc, const struct iovec *iov, int iovcnt)
     } while (desc_offset < total_size);
 
     e1000x_update_rx_total_stats(s->mac_reg, pkt_type, size, total_size);
+    s->mit_rx_packets++;
 
     n = E1000_ICS_RXT0;
     if ((rdt = s->mac_reg[RDT]) < s->mac_reg[RDH])
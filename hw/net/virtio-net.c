@@ -44,6 +44,7 @@
 #include "monitor/qdev.h"
 #include "hw/pci/pci_device.h"
 #include "net_rx_pkt.h"
+#include "net_tx_pkt.h"
 #include "hw/virtio/vhost.h"
 #include "sysemu/qtest.h"
 
@@ -379,6 +380,68 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
+/* Notifies the pending packets and holds back the next ones for a while */
+static void virtio_net_rx_notify_now(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+
+    trace_virtio_net_rx_notify(n, vq2q(virtio_get_queue_index(q->rx_vq)),
+                               q->rx_pending);
+    q->rx_pending = 0;
+    virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    timer_mod(q->rx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+              n->net_conf.rx_coalesce_us * SCALE_US);
+}
+
+/*
+ * rx interrupt coalescing.  Interrupts are expensive under TCG, where each
+ * of them makes the vCPU leave the translated code.  The first packet after
+ * an idle period is notified right away, then notifications are held back
+ * for rx-coalesce-us or until rx-coalesce-frames packets are pending.  The
+ * queue goes back to immediate notifications once a whole period went by
+ * without packets.  Notifications stay subject to the event index of the
+ * guest as usual.
+ */
+static void virtio_net_rx_notify(VirtIONetQueue *q)
+{
+    VirtIONet *n = q->n;
+
+    if (!q->rx_timer) {
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+        return;
+    }
+
+    q->rx_pending++;
+    if (!timer_pending(q->rx_timer) ||
+        q->rx_pending >= n->net_conf.rx_coalesce_frames) {
+        virtio_net_rx_notify_now(q);
+    }
+}
+
+static void virtio_net_rx_timer(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    /* Still busy, start another period, or else go back to idle */
+    if (q->rx_pending) {
+        virtio_net_rx_notify_now(q);
+    }
+}
+
+static void virtio_net_rx_notify_flush(VirtIONetQueue *q)
+{
+    if (q->rx_timer) {
+        if (q->rx_pending) {
+            trace_virtio_net_rx_notify(q->n,
+                                       vq2q(virtio_get_queue_index(q->rx_vq)),
+                                       q->rx_pending);
+            q->rx_pending = 0;
+            virtio_notify(VIRTIO_DEVICE(q->n), q->rx_vq);
+        }
+        timer_del(q->rx_timer);
+    }
+}
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -394,6 +457,9 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         bool queue_started;
         q = &n->vqs[i];
 
+        /* Don't leave a notification behind, it would not survive migration */
+        virtio_net_rx_notify_flush(q);
+
         if ((!n->multiqueue && i != 0) || i >= n->curr_queue_pairs) {
             queue_status = 0;
         } else {
@@ -647,6 +713,11 @@ static int peer_has_vnet_hdr(VirtIONet *n)
     return n->has_vnet_hdr;
 }
 
+static bool virtio_net_sw_offload(VirtIONet *n)
+{
+    return n->sw_offload && !n->has_vnet_hdr;
+}
+
 static int peer_has_ufo(VirtIONet *n)
 {
     if (!peer_has_vnet_hdr(n))
@@ -793,12 +864,14 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
     if (!peer_has_vnet_hdr(n)) {
-        virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
-        virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
+        if (!virtio_net_sw_offload(n)) {
+            virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
+            virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO6);
+            virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
+        }
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_ECN);
 
-        virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO4);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_TSO6);
         virtio_clear_feature(&features, VIRTIO_NET_F_GUEST_ECN);
@@ -1691,6 +1764,24 @@ static void work_around_broken_dhclient(struct virtio_net_hdr *hdr,
     }
 }
 
+/*
+ * With sw-offload, tell the guest that it need not verify the checksums
+ * that QEMU found to be correct.
+ */
+static bool virtio_net_rx_csum_valid(VirtIONet *n, const void *buf,
+                                     size_t size)
+{
+    bool csum_valid = false;
+
+    if (!virtio_net_sw_offload(n) ||
+        !virtio_vdev_has_feature(VIRTIO_DEVICE(n), VIRTIO_NET_F_GUEST_CSUM)) {
+        return false;
+    }
+
+    net_rx_pkt_attach_data(n->rx_pkt, buf, size, false);
+    return net_rx_pkt_validate_l4_csum(n->rx_pkt, &csum_valid) && csum_valid;
+}
+
 static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
                            const void *buf, size_t size)
 {
@@ -1706,7 +1797,8 @@ static void receive_header(VirtIONet *n, const struct iovec *iov, int iov_cnt,
         iov_from_buf(iov, iov_cnt, 0, buf, sizeof(struct virtio_net_hdr));
     } else {
         struct virtio_net_hdr hdr = {
-            .flags = 0,
+            .flags = virtio_net_rx_csum_valid(n, buf, size) ?
+                     VIRTIO_NET_HDR_F_DATA_VALID : 0,
             .gso_type = VIRTIO_NET_HDR_GSO_NONE
         };
         iov_from_buf(iov, iov_cnt, 0, &hdr, sizeof hdr);
@@ -2013,7 +2105,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_rx_notify(q);
 
     return size;
 
@@ -2672,12 +2764,69 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     }
 }
 
+static void virtio_net_tx_pkt_free_frag(void *opaque, void *base, size_t len)
+{
+    /* The fragments point into the element, which the caller releases */
+}
+
+/*
+ * Checksums and segments a packet for a peer that takes no vnet header,
+ * the way the host kernel would for tap.  The segments are sent
+ * synchronously, the net layer queues them if the peer is busy.
+ */
+static void virtio_net_tx_sw_offload(VirtIONetQueue *q,
+                                     const struct virtio_net_hdr *hdr,
+                                     const struct iovec *out_sg,
+                                     unsigned int out_num)
+{
+    VirtIONet *n = q->n;
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    struct iovec sg[VIRTQUEUE_MAX_SIZE];
+    unsigned int sg_num, i;
+    bool ok = true;
+
+    sg_num = iov_copy(sg, ARRAY_SIZE(sg), out_sg, out_num,
+                      n->guest_hdr_len, -1);
+    for (i = 0; ok && i < sg_num; i++) {
+        ok = net_tx_pkt_add_raw_fragment(q->tx_pkt, sg[i].iov_base,
+                                         sg[i].iov_len);
+    }
+
+    ok = ok && net_tx_pkt_parse(q->tx_pkt) &&
+         net_tx_pkt_build_vheader(q->tx_pkt,
+                                  hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE,
+                                  hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM,
+                                  hdr->gso_size);
+    if (ok) {
+        net_tx_pkt_send(q->tx_pkt, qemu_get_subqueue(n->nic, queue_index));
+    }
+    net_tx_pkt_reset(q->tx_pkt, virtio_net_tx_pkt_free_frag, NULL);
+}
+
+/* Packets popped at once by virtio_net_flush_tx() */
+#define VIRTIO_NET_TX_POP_BATCH 32
+
+/*
+ * Gives back the elements popped in a batch that were not sent yet.  They
+ * must be pushed back last first, so that the ring is rewound in order.
+ */
+static void virtio_net_tx_unpop(VirtIONetQueue *q, VirtQueueElement **elems,
+                                unsigned int num)
+{
+    while (num--) {
+        virtqueue_unpop(q->tx_vq, elems[num], 0);
+        g_free(elems[num]);
+    }
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *batch[VIRTIO_NET_TX_POP_BATCH];
+    unsigned int batch_len = 0, batch_idx = 0;
     int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
@@ -2695,10 +2844,18 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        if (batch_idx == batch_len) {
+            /* Never pop more than the burst, so that none are left over */
+            batch_len = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                            (void **)batch,
+                                            MIN(ARRAY_SIZE(batch),
+                                                n->tx_burst - num_packets));
+            batch_idx = 0;
+            if (!batch_len) {
+                break;
+            }
         }
+        elem = batch[batch_idx++];
 
         out_num = elem->out_num;
         out_sg = elem->out_sg;
@@ -2706,7 +2863,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
-            return -EINVAL;
+            goto err;
         }
 
         if (n->has_vnet_hdr) {
@@ -2715,7 +2872,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
-                return -EINVAL;
+                goto err;
             }
             if (n->needs_vnet_hdr_swap) {
                 virtio_net_hdr_swap(vdev, (void *) &mhdr);
@@ -2730,6 +2887,20 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 out_num += 1;
                 out_sg = sg2;
             }
+        } else if (q->tx_pkt) {
+            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
+                n->guest_hdr_len) {
+                virtio_error(vdev, "virtio-net header incorrect");
+                virtqueue_detach_element(q->tx_vq, elem, 0);
+                g_free(elem);
+                goto err;
+            }
+            virtio_net_hdr_swap(vdev, &mhdr.hdr);
+            if ((mhdr.hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) ||
+                mhdr.hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+                virtio_net_tx_sw_offload(q, &mhdr.hdr, out_sg, out_num);
+                goto drop;
+            }
         }
         /*
          * If host wants to see the guest header as is, we can
@@ -2753,6 +2924,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         if (ret == 0) {
             virtio_queue_set_notification(q->tx_vq, 0);
             q->async_tx.elem = elem;
+            virtio_net_tx_unpop(q, batch + batch_idx, batch_len - batch_idx);
             return -EBUSY;
         }
 
@@ -2766,6 +2938,14 @@ drop:
         }
     }
     return num_packets;
+
+err:
+    /* The device is broken, give back what was not sent */
+    while (batch_idx < batch_len) {
+        virtqueue_detach_element(q->tx_vq, batch[batch_idx], 0);
+        g_free(batch[batch_idx++]);
+    }
+    return -EINVAL;
 }
 
 static void virtio_net_tx_timer(void *opaque);
@@ -2926,6 +3106,11 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
 
     n->vqs[index].rx_vq = virtio_add_queue(vdev, n->net_conf.rx_queue_size,
                                            virtio_net_handle_rx);
+    if (n->net_conf.rx_coalesce_us) {
+        n->vqs[index].rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                              virtio_net_rx_timer,
+                                              &n->vqs[index]);
+    }
 
     if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
         n->vqs[index].tx_vq =
@@ -2942,6 +3127,10 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
                                                   &DEVICE(vdev)->mem_reentrancy_guard);
     }
 
+    if (n->sw_offload) {
+        net_tx_pkt_init(&n->vqs[index].tx_pkt, VIRTQUEUE_MAX_SIZE);
+    }
+
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
 }
@@ -2954,6 +3143,11 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
 
     qemu_purge_queued_packets(nc);
 
+    if (q->rx_timer) {
+        timer_free(q->rx_timer);
+        q->rx_timer = NULL;
+    }
+    q->rx_pending = 0;
     virtio_del_queue(vdev, index * 2);
     if (q->tx_timer) {
         timer_free(q->tx_timer);
@@ -2962,6 +3156,10 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
         qemu_bh_delete(q->tx_bh);
         q->tx_bh = NULL;
     }
+    if (q->tx_pkt) {
+        net_tx_pkt_uninit(q->tx_pkt);
+        q->tx_pkt = NULL;
+    }
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
 }
@@ -3935,6 +4133,9 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
+    DEFINE_PROP_UINT32("rx-coalesce-us", VirtIONet, net_conf.rx_coalesce_us, 0),
+    DEFINE_PROP_UINT32("rx-coalesce-frames", VirtIONet,
+                       net_conf.rx_coalesce_frames, 64),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
                        VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("host_mtu", VirtIONet, net_conf.mtu, 0),
@@ -3943,6 +4144,7 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_BOOL("sw-offload", VirtIONet, sw_offload, false),
     DEFINE_PROP_BIT64("guest_uso4", VirtIONet, host_features,
                       VIRTIO_NET_F_GUEST_USO4, true),
     DEFINE_PROP_BIT64("guest_uso6", VirtIONet, host_features,
@@ -196,6 +196,7 @@
 #include "qemu/log.h"
 #include "qemu/units.h"
 #include "qemu/range.h"
+#include "qemu/main-loop.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/sysemu.h"
@@ -644,6 +645,60 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+static void nvme_ctx_lock(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+
+    if (n->iothread) {
+        aio_context_acquire(n->ctx);
+    }
+}
+
+static void nvme_ctx_unlock(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+
+    if (n->iothread) {
+        aio_context_release(n->ctx);
+    }
+}
+
+/* The admin queue always stays in the main loop */
+static AioContext *nvme_queue_ctx(NvmeCtrl *n, uint16_t qid)
+{
+    return qid ? n->ctx : qemu_get_aio_context();
+}
+
+/*
+ * The device reentrancy guard is not thread safe: a bottom half of the
+ * iothread holding it would make concurrent MMIO from a vCPU look like a
+ * reentrant access and drop it.  The iothread never does MMIO to the
+ * device, so its bottom halves go without it.
+ */
+static MemReentrancyGuard *nvme_queue_guard(NvmeCtrl *n, uint16_t qid)
+{
+    if (n->iothread && qid) {
+        return NULL;
+    }
+    return &DEVICE(n)->mem_reentrancy_guard;
+}
+
+static void nvme_set_notifier(NvmeCtrl *n, EventNotifier *e,
+                              EventNotifierHandler *handler)
+{
+    if (n->iothread) {
+        aio_set_event_notifier(n->ctx, e, handler, NULL, NULL);
+    } else {
+        event_notifier_set_handler(e, handler);
+    }
+}
+
+/* Interrupts are raised under the BQL, the iothread leaves them to irq_bh */
+static bool nvme_irq_defer(NvmeCtrl *n)
+{
+    return n->iothread && !qemu_mutex_iothread_locked();
+}
+
 static void nvme_irq_check(NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
@@ -652,6 +707,10 @@ static void nvme_irq_check(NvmeCtrl *n)
     if (msix_enabled(pci)) {
         return;
     }
+    if (nvme_irq_defer(n)) {
+        qemu_bh_schedule(n->irq_bh);
+        return;
+    }
     if (~intms & n->irq_status) {
         pci_irq_assert(pci);
     } else {
@@ -666,7 +725,12 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
     if (cq->irq_enabled) {
         if (msix_enabled(pci)) {
             trace_pci_nvme_irq_msix(cq->vector);
-            msix_notify(pci, cq->vector);
+            if (nvme_irq_defer(n)) {
+                qatomic_set(&cq->irq_pending, true);
+                qemu_bh_schedule(n->irq_bh);
+            } else {
+                msix_notify(pci, cq->vector);
+            }
         } else {
             trace_pci_nvme_irq_pin();
             assert(cq->vector < 32);
@@ -693,6 +757,24 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    PCIDevice *pci = PCI_DEVICE(n);
+
+    QEMU_LOCK_GUARD(&n->lock);
+
+    for (int i = 1; i <= n->params.max_ioqpairs; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && qatomic_xchg(&cq->irq_pending, false) &&
+            msix_enabled(pci)) {
+            msix_notify(pci, cq->vector);
+        }
+    }
+    nvme_irq_check(n);
+}
+
 static void nvme_req_clear(NvmeRequest *req)
 {
     req->ns = NULL;
@@ -1487,9 +1569,17 @@ static void nvme_post_cqes(void *opaque)
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    bool pending;
     int ret;
 
+    QEMU_LOCK_GUARD(&n->lock);
+
+    if (n->cq[cq->cqid] != cq) {
+        /* deleted while the iothread was waiting for the lock */
+        return;
+    }
+
+    pending = cq->head != cq->tail;
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -2134,6 +2224,8 @@ static void nvme_misc_cb(void *opaque, int ret)
 {
     NvmeRequest *req = opaque;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_misc_cb(nvme_cid(req));
 
     if (ret) {
@@ -2151,6 +2243,8 @@ void nvme_rw_complete_cb(void *opaque, int ret)
     BlockAcctCookie *acct = &req->acct;
     BlockAcctStats *stats = blk_get_stats(blk);
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_rw_complete_cb(nvme_cid(req), blk_name(blk));
 
     if (ret) {
@@ -2174,6 +2268,8 @@ static void nvme_rw_cb(void *opaque, int ret)
 
     BlockBackend *blk = ns->blkconf.blk;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_rw_cb(nvme_cid(req), blk_name(blk));
 
     if (ret) {
@@ -2234,6 +2330,8 @@ static void nvme_verify_cb(void *opaque, int ret)
     uint64_t cdw3 = le32_to_cpu(rw->cdw3);
     uint16_t status;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     reftag |= cdw3 << 32;
 
     trace_pci_nvme_verify_cb(nvme_cid(req), prinfo, apptag, appmask, reftag);
@@ -2284,6 +2382,8 @@ static void nvme_verify_mdata_in_cb(void *opaque, int ret)
     uint64_t offset = nvme_moff(ns, slba);
     BlockBackend *blk = ns->blkconf.blk;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_verify_mdata_in_cb(nvme_cid(req), blk_name(blk));
 
     if (ret) {
@@ -2333,6 +2433,8 @@ static void nvme_compare_mdata_cb(void *opaque, int ret)
     BlockAcctStats *stats = blk_get_stats(blk);
     uint16_t status = NVME_SUCCESS;
 
+    QEMU_LOCK_GUARD(&n->lock);
+
     reftag |= cdw3 << 32;
 
     trace_pci_nvme_compare_mdata_cb(nvme_cid(req));
@@ -2417,6 +2519,8 @@ static void nvme_compare_data_cb(void *opaque, int ret)
     g_autofree uint8_t *buf = NULL;
     uint16_t status;
 
+    QEMU_LOCK_GUARD(&n->lock);
+
     trace_pci_nvme_compare_data_cb(nvme_cid(req));
 
     if (ret) {
@@ -2513,6 +2617,8 @@ static void nvme_dsm_md_cb(void *opaque, int ret)
     uint64_t slba;
     uint32_t nlb;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (ret < 0 || iocb->ret < 0 || !ns->lbaf.ms) {
         goto done;
     }
@@ -2555,6 +2661,8 @@ static void nvme_dsm_cb(void *opaque, int ret)
     uint64_t slba;
     uint32_t nlb;
 
+    QEMU_LOCK_GUARD(&n->lock);
+
     if (iocb->ret < 0) {
         goto done;
     } else if (ret < 0) {
@@ -2872,6 +2980,8 @@ static void nvme_copy_out_completed_cb(void *opaque, int ret)
     NvmeNamespace *ns = req->ns;
     uint32_t nlb;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     nvme_copy_source_range_parse(iocb->ranges, iocb->idx, iocb->format, NULL,
                                  &nlb, NULL, NULL, NULL);
 
@@ -2901,6 +3011,8 @@ static void nvme_copy_out_cb(void *opaque, int ret)
     size_t mlen;
     uint8_t *mbounce;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (ret < 0 || iocb->ret < 0 || !ns->lbaf.ms) {
         goto out;
     }
@@ -2936,6 +3048,8 @@ static void nvme_copy_in_completed_cb(void *opaque, int ret)
     size_t len;
     uint16_t status;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (ret < 0) {
         iocb->ret = ret;
         goto out;
@@ -3028,6 +3142,8 @@ static void nvme_copy_in_cb(void *opaque, int ret)
     uint64_t slba;
     uint32_t nlb;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (ret < 0 || iocb->ret < 0 || !ns->lbaf.ms) {
         goto out;
     }
@@ -3306,6 +3422,8 @@ static void nvme_flush_ns_cb(void *opaque, int ret)
     NvmeFlushAIOCB *iocb = opaque;
     NvmeNamespace *ns = iocb->ns;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(iocb->req)->lock);
+
     if (ret < 0) {
         iocb->ret = ret;
         goto out;
@@ -3901,6 +4019,8 @@ static void nvme_zone_reset_epilogue_cb(void *opaque, int ret)
     int64_t moff;
     int count;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (ret < 0 || iocb->ret < 0 || !ns->lbaf.ms) {
         goto out;
     }
@@ -3923,6 +4043,8 @@ static void nvme_zone_reset_cb(void *opaque, int ret)
     NvmeRequest *req = iocb->req;
     NvmeNamespace *ns = req->ns;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     if (iocb->ret < 0) {
         goto done;
     } else if (ret < 0) {
@@ -4495,6 +4617,12 @@ static void nvme_cq_notifier(EventNotifier *e)
         return;
     }
 
+    QEMU_LOCK_GUARD(&n->lock);
+
+    if (n->cq[cq->cqid] != cq) {
+        return;
+    }
+
     nvme_update_cq_head(cq);
 
     if (cq->tail == cq->head) {
@@ -4519,7 +4647,7 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    nvme_set_notifier(n, &cq->notifier, nvme_cq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4548,13 +4676,26 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    nvme_set_notifier(n, &sq->notifier, nvme_sq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+static void nvme_release_sq(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    if (sq->ioeventfd_enabled) {
+        event_notifier_cleanup(&sq->notifier);
+    }
+    g_free(sq->io_req);
+    if (sq->sqid) {
+        g_free(sq);
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
@@ -4564,13 +4705,19 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
-        event_notifier_cleanup(&sq->notifier);
+        nvme_set_notifier(n, &sq->notifier, NULL);
     }
-    g_free(sq->io_req);
-    if (sq->sqid) {
-        g_free(sq);
+
+    if (n->iothread && sq->sqid) {
+        /*
+         * The iothread may be about to run the bottom half or the notifier
+         * of the queue, and finds it gone once it has the lock; free it
+         * after that.
+         */
+        aio_bh_schedule_oneshot(n->ctx, nvme_release_sq, sq);
+        return;
     }
+    nvme_release_sq(sq);
 }
 
 static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
@@ -4589,6 +4736,25 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
     trace_pci_nvme_del_sq(qid);
 
     sq = n->sq[qid];
+    if (n->iothread) {
+        /*
+         * blk_aio_cancel() polls the AioContext of the request, which only
+         * the iothread may do; cancel them all and wait for the namespaces
+         * to settle instead.
+         */
+        QTAILQ_FOREACH(r, &sq->out_req_list, entry) {
+            if (r->aiocb) {
+                blk_aio_cancel_async(r->aiocb);
+            }
+        }
+        for (int i = 1; i <= NVME_MAX_NAMESPACES; i++) {
+            NvmeNamespace *ns = nvme_ns(n, i);
+
+            if (ns) {
+                nvme_ns_drain(ns);
+            }
+        }
+    }
     while (!QTAILQ_EMPTY(&sq->out_req_list)) {
         r = QTAILQ_FIRST(&sq->out_req_list);
         assert(r->aiocb);
@@ -4635,8 +4801,8 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    sq->bh = aio_bh_new_guarded(nvme_queue_ctx(n, sqid), nvme_process_sq, sq,
+                                nvme_queue_guard(n, sqid));
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -5209,6 +5375,18 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_release_cq(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    if (cq->ioeventfd_enabled) {
+        event_notifier_cleanup(&cq->notifier);
+    }
+    if (cq->cqid) {
+        g_free(cq);
+    }
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
@@ -5219,15 +5397,18 @@ static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
-        event_notifier_cleanup(&cq->notifier);
+        nvme_set_notifier(n, &cq->notifier, NULL);
     }
     if (msix_enabled(pci)) {
         msix_vector_unuse(pci, cq->vector);
     }
-    if (cq->cqid) {
-        g_free(cq);
+
+    if (n->iothread && cq->cqid) {
+        /* Like for the submission queues, see nvme_free_sq() */
+        aio_bh_schedule_oneshot(n->ctx, nvme_release_cq, cq);
+        return;
     }
+    nvme_release_cq(cq);
 }
 
 static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -5287,8 +5468,8 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->bh = aio_bh_new_guarded(nvme_queue_ctx(n, cqid), nvme_post_cqes, cq,
+                                nvme_queue_guard(n, cqid));
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -6496,6 +6677,8 @@ static void nvme_format_ns_cb(void *opaque, int ret)
     NvmeNamespace *ns = iocb->ns;
     int bytes;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(iocb->req)->lock);
+
     if (iocb->ret < 0) {
         goto done;
     } else if (ret < 0) {
@@ -6995,13 +7178,21 @@ static void nvme_process_sq(void *opaque)
 {
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
-    NvmeCQueue *cq = n->cq[sq->cqid];
+    NvmeCQueue *cq;
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    QEMU_LOCK_GUARD(&n->lock);
+
+    if (n->sq[sq->sqid] != sq) {
+        /* deleted while the iothread was waiting for the lock */
+        return;
+    }
+    cq = n->cq[sq->cqid];
+
     if (n->dbbuf_enabled) {
         nvme_update_sq_tail(sq);
     }
@@ -7519,6 +7710,8 @@ static uint64_t nvme_mmio_read(void *opaque, hwaddr addr, unsigned size)
 
     trace_pci_nvme_mmio_read(addr, size);
 
+    QEMU_LOCK_GUARD(&n->lock);
+
     if (unlikely(addr & (sizeof(uint32_t) - 1))) {
         NVME_GUEST_ERR(pci_nvme_ub_mmiord_misaligned32,
                        "MMIO read not 32-bit aligned,"
@@ -7715,6 +7908,8 @@ static void nvme_mmio_write(void *opaque, hwaddr addr, uint64_t data,
 
     trace_pci_nvme_mmio_write(addr, data, size);
 
+    QEMU_LOCK_GUARD(&n->lock);
+
     if (pci_is_vf(PCI_DEVICE(n)) && !nvme_sctrl(n)->scs &&
         addr != NVME_REG_CSTS) {
         trace_pci_nvme_err_ignored_mmio_vf_offline(addr, size);
@@ -7778,6 +7973,12 @@ static bool nvme_check_params(NvmeCtrl *n, Error **errp)
         return false;
     }
 
+    if (n->iothread && (n->subsys || params->sriov_max_vfs)) {
+        /* the namespaces of a subsystem may be shared by other controllers */
+        error_setg(errp, "iothread is unavailable with a subsystem");
+        return false;
+    }
+
     if (params->max_ioqpairs < 1 ||
         params->max_ioqpairs > NVME_MAX_IOQPAIRS) {
         error_setg(errp, "max_ioqpairs must be between 1 and %d",
@@ -7924,6 +8125,16 @@ static void nvme_init_state(NvmeCtrl *n)
     n->aer_reqs = g_new0(NvmeRequest *, n->params.aerl + 1);
     QTAILQ_INIT(&n->aer_queue);
 
+    n->ctx = n->iothread ? iothread_get_aio_context(n->iothread) :
+                           qemu_get_aio_context();
+    n->lock = (QemuLockable) {
+        .object = n,
+        .lock = nvme_ctx_lock,
+        .unlock = nvme_ctx_unlock,
+    };
+    n->irq_bh = qemu_bh_new_guarded(nvme_irq_bh, n,
+                                    &DEVICE(n)->mem_reentrancy_guard);
+
     list->numcntl = cpu_to_le16(max_vfs);
     for (i = 0; i < max_vfs; i++) {
         sctrl = &list->sec[i];
@@ -8339,6 +8550,10 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
             return;
         }
 
+        if (nvme_ns_set_aio_context(ns, n->ctx, errp)) {
+            return;
+        }
+
         nvme_attach_ns(n, ns);
     }
 }
@@ -8349,7 +8564,14 @@ static void nvme_exit(PCIDevice *pci_dev)
     NvmeNamespace *ns;
     int i;
 
-    nvme_ctrl_reset(n, NVME_RESET_FUNCTION);
+    WITH_QEMU_LOCK_GUARD(&n->lock) {
+        nvme_ctrl_reset(n, NVME_RESET_FUNCTION);
+    }
+    qemu_bh_delete(n->irq_bh);
+
+    if (n->namespace.blkconf.blk) {
+        nvme_ns_set_aio_context(&n->namespace, qemu_get_aio_context(), NULL);
+    }
 
     if (n->subsys) {
         for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
@@ -8400,6 +8622,8 @@ static Property nvme_props[] = {
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
     DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
@@ -8463,6 +8687,7 @@ static void nvme_pci_reset(DeviceState *qdev)
     NvmeCtrl *n = NVME(pci_dev);
 
     trace_pci_nvme_pci_reset();
+    QEMU_LOCK_GUARD(&n->lock);
     nvme_ctrl_reset(n, NVME_RESET_FUNCTION);
 }
 
@@ -407,6 +407,8 @@ static void nvme_dif_rw_cb(void *opaque, int ret)
     NvmeNamespace *ns = req->ns;
     BlockBackend *blk = ns->blkconf.blk;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_dif_rw_cb(nvme_cid(req), blk_name(blk));
 
     qemu_iovec_destroy(&ctx->data.iov);
@@ -435,6 +437,8 @@ static void nvme_dif_rw_check_cb(void *opaque, int ret)
     uint64_t cdw3 = le32_to_cpu(rw->cdw3);
     uint16_t status;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     reftag |= cdw3 << 32;
 
     trace_pci_nvme_dif_rw_check_cb(nvme_cid(req), prinfo, apptag, appmask,
@@ -492,6 +496,8 @@ static void nvme_dif_rw_mdata_in_cb(void *opaque, int ret)
     uint64_t offset = nvme_moff(ns, slba);
     BlockBackend *blk = ns->blkconf.blk;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_dif_rw_mdata_in_cb(nvme_cid(req), blk_name(blk));
 
     if (ret) {
@@ -521,6 +527,8 @@ static void nvme_dif_rw_mdata_out_cb(void *opaque, int ret)
     uint64_t offset = nvme_moff(ns, slba);
     BlockBackend *blk = ns->blkconf.blk;
 
+    QEMU_LOCK_GUARD(&nvme_ctrl(req)->lock);
+
     trace_pci_nvme_dif_rw_mdata_out_cb(nvme_cid(req), blk_name(blk));
 
     if (ret) {
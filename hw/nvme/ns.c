@@ -16,6 +16,7 @@
 #include "qemu/units.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "qapi/error.h"
 #include "qemu/bitops.h"
 #include "sysemu/sysemu.h"
@@ -676,6 +677,24 @@ int nvme_ns_setup(NvmeNamespace *ns, Error **errp)
     return 0;
 }
 
+/* Moves the backend of the namespace to the AioContext of the I/O queues */
+int nvme_ns_set_aio_context(NvmeNamespace *ns, AioContext *ctx, Error **errp)
+{
+    BlockBackend *blk = ns->blkconf.blk;
+    AioContext *old_ctx = blk_get_aio_context(blk);
+    int ret;
+
+    if (old_ctx == ctx) {
+        return 0;
+    }
+
+    aio_context_acquire(old_ctx);
+    ret = blk_set_aio_context(blk, ctx, errp);
+    aio_context_release(old_ctx);
+
+    return ret;
+}
+
 void nvme_ns_drain(NvmeNamespace *ns)
 {
     blk_drain(ns->blkconf.blk);
@@ -705,10 +724,15 @@ void nvme_ns_cleanup(NvmeNamespace *ns)
 static void nvme_ns_unrealize(DeviceState *dev)
 {
     NvmeNamespace *ns = NVME_NS(dev);
+    AioContext *ctx = blk_get_aio_context(ns->blkconf.blk);
 
+    aio_context_acquire(ctx);
     nvme_ns_drain(ns);
     nvme_ns_shutdown(ns);
     nvme_ns_cleanup(ns);
+    aio_context_release(ctx);
+
+    nvme_ns_set_aio_context(ns, qemu_get_aio_context(), NULL);
 }
 
 static void nvme_ns_realize(DeviceState *dev, Error **errp)
@@ -788,6 +812,10 @@ static void nvme_ns_realize(DeviceState *dev, Error **errp)
 
     }
 
+    if (nvme_ns_set_aio_context(ns, n->ctx, errp)) {
+        return;
+    }
+
     nvme_attach_ns(n, ns);
 }
 
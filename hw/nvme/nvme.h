@@ -19,8 +19,10 @@
 #define HW_NVME_NVME_H
 
 #include "qemu/uuid.h"
+#include "qemu/lockable.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "sysemu/iothread.h"
 
 #include "block/nvme.h"
 
@@ -369,6 +371,7 @@ static inline void nvme_fdp_stat_inc(uint64_t *a, uint64_t b)
 
 void nvme_ns_init_format(NvmeNamespace *ns);
 int nvme_ns_setup(NvmeNamespace *ns, Error **errp);
+int nvme_ns_set_aio_context(NvmeNamespace *ns, AioContext *ctx, Error **errp);
 void nvme_ns_drain(NvmeNamespace *ns);
 void nvme_ns_shutdown(NvmeNamespace *ns);
 void nvme_ns_cleanup(NvmeNamespace *ns);
@@ -494,6 +497,7 @@ typedef struct NvmeCQueue {
     QEMUBH      *bh;
     EventNotifier notifier;
     bool        ioeventfd_enabled;
+    bool        irq_pending;    /* MSI-X message left to nvme_irq_bh */
     QTAILQ_HEAD(, NvmeSQueue) sq_list;
     QTAILQ_HEAD(, NvmeRequest) req_list;
 } NvmeCQueue;
@@ -552,6 +556,17 @@ typedef struct NvmeCtrl {
     uint64_t    dbbuf_eis;
     bool        dbbuf_enabled;
 
+    /*
+     * With an iothread, the I/O queues run in its AioContext, and lock
+     * takes the AioContext lock in every entry point: MMIO, bottom halves,
+     * notifiers and completion callbacks.  Without one, lock does nothing
+     * and everything runs in the main loop under the BQL.
+     */
+    IOThread     *iothread;
+    AioContext   *ctx;
+    QemuLockable lock;
+    QEMUBH       *irq_bh;
+
     struct {
         MemoryRegion mem;
         uint8_t      *buf;
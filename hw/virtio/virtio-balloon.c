@@ -18,6 +18,9 @@
 #include "qemu/module.h"
 #include "qemu/timer.h"
 #include "qemu/madvise.h"
+#ifdef EMSCRIPTEN
+#include "qemu/wasm-page-pool.h"
+#endif
 #include "hw/virtio/virtio.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/qdev-properties.h"
@@ -77,6 +80,28 @@ static bool virtio_balloon_inhibited(void)
             migration_in_bg_snapshot();
 }
 
+static void balloon_discard_range(VirtIOBalloon *balloon, RAMBlock *rb,
+                                  ram_addr_t rb_offset, size_t size)
+{
+    if (ram_block_discard_range(rb, rb_offset, size)) {
+        /* We ignore errors from ram_block_discard_range(), because it
+         * has already reported them, and failing to discard a balloon
+         * page is not fatal */
+        return;
+    }
+#ifdef EMSCRIPTEN
+    /*
+     * The pages can't be given back to the browser, but the guest promised
+     * not to touch them before it tells us about deflating them.
+     */
+    if (balloon->wasm_page_pool && !qemu_ram_is_shared(rb) &&
+        virtio_vdev_has_feature(VIRTIO_DEVICE(balloon),
+                                VIRTIO_BALLOON_F_MUST_TELL_HOST)) {
+        wasm_page_pool_donate(qemu_ram_get_host_addr(rb) + rb_offset, size);
+    }
+#endif
+}
+
 static void balloon_inflate_page(VirtIOBalloon *balloon,
                                  MemoryRegion *mr, hwaddr mr_offset,
                                  PartiallyBalloonedPage *pbp)
@@ -95,10 +120,7 @@ static void balloon_inflate_page(VirtIOBalloon *balloon,
     if (rb_page_size == BALLOON_PAGE_SIZE) {
         /* Easy case */
 
-        ram_block_discard_range(rb, rb_offset, rb_page_size);
-        /* We ignore errors from ram_block_discard_range(), because it
-         * has already reported them, and failing to discard a balloon
-         * page is not fatal */
+        balloon_discard_range(balloon, rb, rb_offset, rb_page_size);
         return;
     }
 
@@ -134,10 +156,7 @@ static void balloon_inflate_page(VirtIOBalloon *balloon,
         /* We've accumulated a full host page, we can actually discard
          * it now */
 
-        ram_block_discard_range(rb, rb_aligned_offset, rb_page_size);
-        /* We ignore errors from ram_block_discard_range(), because it
-         * has already reported them, and failing to discard a balloon
-         * page is not fatal */
+        balloon_discard_range(balloon, rb, rb_aligned_offset, rb_page_size);
         virtio_balloon_pbp_free(pbp);
     }
 }
@@ -425,6 +444,14 @@ static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
 
             trace_virtio_balloon_handle_output(memory_region_name(section.mr),
                                                pa);
+#ifdef EMSCRIPTEN
+            if (vq == s->dvq && s->wasm_page_pool) {
+                /* Inhibited or not, the guest is about to use the page */
+                wasm_page_pool_reclaim(memory_region_get_ram_ptr(section.mr) +
+                                       section.offset_within_region,
+                                       BALLOON_PAGE_SIZE);
+            }
+#endif
             if (!virtio_balloon_inhibited()) {
                 if (vq == s->ivq) {
                     balloon_inflate_page(s, section.mr,
@@ -775,6 +802,10 @@ static uint64_t virtio_balloon_get_features(VirtIODevice *vdev, uint64_t f,
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
     f |= dev->host_features;
     virtio_add_feature(&f, VIRTIO_BALLOON_F_STATS_VQ);
+    if (dev->wasm_page_pool) {
+        /* Otherwise the guest could reuse lent pages without a deflate */
+        virtio_add_feature(&f, VIRTIO_BALLOON_F_MUST_TELL_HOST);
+    }
 
     return f;
 }
@@ -912,6 +943,11 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
     }
     balloon_stats_destroy_timer(s);
     qemu_remove_balloon_handler(s);
+#ifdef EMSCRIPTEN
+    if (s->wasm_page_pool) {
+        wasm_page_pool_reclaim_all();
+    }
+#endif
 
     virtio_delete_queue(s->ivq);
     virtio_delete_queue(s->dvq);
@@ -939,6 +975,13 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
         s->stats_vq_elem = NULL;
     }
 
+#ifdef EMSCRIPTEN
+    /* The balloon is empty again, without any deflate */
+    if (s->wasm_page_pool) {
+        wasm_page_pool_reclaim_all();
+    }
+#endif
+
     s->poison_val = 0;
 }
 
@@ -1019,6 +1062,9 @@ static Property virtio_balloon_properties[] = {
                      qemu_4_0_config_size, false),
     DEFINE_PROP_LINK("iothread", VirtIOBalloon, iothread, TYPE_IOTHREAD,
                      IOThread *),
+#ifdef EMSCRIPTEN
+    DEFINE_PROP_BOOL("wasm-page-pool", VirtIOBalloon, wasm_page_pool, false),
+#endif
     DEFINE_PROP_END_OF_LIST(),
 };
 
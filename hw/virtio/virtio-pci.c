@@ -35,10 +35,12 @@
 #include "hw/loader.h"
 #include "sysemu/kvm.h"
 #include "hw/virtio/virtio-pci.h"
+#include "qemu/processor.h"
 #include "qemu/range.h"
 #include "hw/virtio/virtio-bus.h"
 #include "qapi/visitor.h"
 #include "sysemu/replay.h"
+#include "sysemu/tcg.h"
 #include "trace.h"
 
 #define VIRTIO_PCI_REGION_SIZE(dev)     VIRTIO_PCI_CONFIG_OFF(msix_present(dev))
@@ -324,6 +326,19 @@ static inline int virtio_pci_queue_mem_mult(struct VirtIOPCIProxy *proxy)
         QEMU_VIRTIO_PCI_QUEUE_MEM_MULT : 4;
 }
 
+static void virtio_pci_set_doorbell(VirtIOPCIProxy *proxy, int n,
+                                    EventNotifier *notifier)
+{
+    qatomic_set(&proxy->vqs[n].doorbell, notifier);
+    if (!notifier) {
+        /* The caller is about to close the old one */
+        smp_mb();
+        while (qatomic_read(&proxy->doorbell_users)) {
+            cpu_relax();
+        }
+    }
+}
+
 static int virtio_pci_ioeventfd_assign(DeviceState *d, EventNotifier *notifier,
                                        int n, bool assign)
 {
@@ -340,10 +355,18 @@ static int virtio_pci_ioeventfd_assign(DeviceState *d, EventNotifier *notifier,
                          virtio_get_queue_index(vq);
     hwaddr legacy_addr = VIRTIO_PCI_QUEUE_NOTIFY;
 
+    /* Lockless notify writes signal the notifier without an eventfd */
+    if (proxy->notify_bh) {
+        virtio_pci_set_doorbell(proxy, n, assign ? notifier : NULL);
+        modern_mr = NULL;
+    }
+
     if (assign) {
         if (modern) {
-            memory_region_add_eventfd(modern_mr, modern_addr, 0,
-                                      false, n, notifier);
+            if (modern_mr) {
+                memory_region_add_eventfd(modern_mr, modern_addr, 0,
+                                          false, n, notifier);
+            }
             if (modern_pio) {
                 memory_region_add_eventfd(modern_notify_mr, 0, 2,
                                               true, n, notifier);
@@ -355,8 +378,10 @@ static int virtio_pci_ioeventfd_assign(DeviceState *d, EventNotifier *notifier,
         }
     } else {
         if (modern) {
-            memory_region_del_eventfd(modern_mr, modern_addr, 0,
-                                      false, n, notifier);
+            if (modern_mr) {
+                memory_region_del_eventfd(modern_mr, modern_addr, 0,
+                                          false, n, notifier);
+            }
             if (modern_pio) {
                 memory_region_del_eventfd(modern_notify_mr, 0, 2,
                                           true, n, notifier);
@@ -1675,14 +1700,52 @@ static uint64_t virtio_pci_notify_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+static void virtio_pci_notify_bh(void *opaque)
+{
+    VirtIOPCIProxy *proxy = opaque;
+    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+
+    for (int i = 0; i < ARRAY_SIZE(proxy->notify_pending); i++) {
+        unsigned long pending = qatomic_xchg(&proxy->notify_pending[i], 0);
+
+        while (pending && vdev) {
+            int bit = ctzl(pending);
+
+            pending &= pending - 1;
+            virtio_queue_notify(vdev, i * BITS_PER_LONG + bit);
+        }
+    }
+}
+
 static void virtio_pci_notify_write(void *opaque, hwaddr addr,
                                     uint64_t val, unsigned size)
 {
     VirtIOPCIProxy *proxy = opaque;
-    VirtIODevice *vdev = virtio_bus_get_device(&proxy->bus);
+    VirtIODevice *vdev;
 
     unsigned queue = addr / virtio_pci_queue_mem_mult(proxy);
 
+    if (proxy->notify_bh) {
+        /* lockless_io: only the BH can look at the device */
+        if (queue < VIRTIO_QUEUE_MAX) {
+            EventNotifier *doorbell;
+
+            trace_virtio_pci_notify_write(addr, val, size);
+            qatomic_inc(&proxy->doorbell_users);
+            doorbell = qatomic_read(&proxy->vqs[queue].doorbell);
+            if (doorbell) {
+                /* Like an ioeventfd, wakes the AioContext of the queue */
+                event_notifier_set(doorbell);
+            } else {
+                set_bit_atomic(queue, proxy->notify_pending);
+                qemu_bh_schedule(proxy->notify_bh);
+            }
+            qatomic_dec(&proxy->doorbell_users);
+        }
+        return;
+    }
+
+    vdev = virtio_bus_get_device(&proxy->bus);
     if (vdev != NULL && queue < VIRTIO_QUEUE_MAX) {
         trace_virtio_pci_notify_write(addr, val, size);
         virtio_queue_notify(vdev, queue);
@@ -1852,6 +1915,9 @@ static void virtio_pci_modern_regions_init(VirtIOPCIProxy *proxy,
                           proxy,
                           name->str,
                           proxy->notify.size);
+    if (proxy->notify_bh) {
+        memory_region_enable_lockless_io(&proxy->notify.mr);
+    }
 
     g_string_printf(name, "virtio-pci-notify-pio-%s", vdev_name);
     memory_region_init_io(&proxy->notify_pio.mr, OBJECT(proxy),
@@ -2108,6 +2174,17 @@ static void virtio_pci_realize(PCIDevice *pci_dev, Error **errp)
         proxy->flags &= ~VIRTIO_PCI_FLAG_USE_IOEVENTFD;
     }
 
+    /*
+     * Spare MTTCG vCPUs the BQL on queue notifications, which are handled
+     * asynchronously anyway with ioeventfd.  With KVM, the ioeventfds of
+     * the notify region are what handles them.
+     */
+    if (tcg_enabled() && replay_mode == REPLAY_MODE_NONE) {
+        proxy->notify_bh =
+            qemu_bh_new_guarded(virtio_pci_notify_bh, proxy,
+                                &DEVICE(proxy)->mem_reentrancy_guard);
+    }
+
     /*
      * virtio pci bar layout used by default.
      * subclasses can re-arrange things if needed.
@@ -2238,6 +2315,7 @@ static void virtio_pci_exit(PCIDevice *pci_dev)
         pci_is_express(pci_dev)) {
         pcie_aer_exit(pci_dev);
     }
+    g_clear_pointer(&proxy->notify_bh, qemu_bh_delete);
 }
 
 static void virtio_pci_reset(DeviceState *qdev)
@@ -2248,6 +2326,7 @@ static void virtio_pci_reset(DeviceState *qdev)
 
     virtio_bus_reset(bus);
     msix_unuse_all_vectors(&proxy->pci_dev);
+    bitmap_zero(proxy->notify_pending, VIRTIO_QUEUE_MAX);
 
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         proxy->vqs[i].enabled = 0;
@@ -813,7 +813,8 @@ void virtqueue_unpop(VirtQueue *vq, const VirtQueueElement *elem,
 {
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        virtqueue_packed_rewind(vq, 1);
+        /* Chained descriptors each take a slot of the packed ring */
+        virtqueue_packed_rewind(vq, elem->ndescs);
     } else {
         virtqueue_split_rewind(vq, 1);
     }
@@ -1495,10 +1496,36 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Returns the region caches of @vq if they can cover its descriptor ring.
+ * Must be called under the RCU read lock.
+ */
+static VRingMemoryRegionCaches *virtqueue_pop_caches(VirtQueue *vq,
+                                                     size_t desc_size)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+
+    if (!caches) {
+        virtio_error(vq->vdev, "Region caches not initialized");
+        return NULL;
+    }
+
+    if (caches->desc.len < vq->vring.num * desc_size) {
+        virtio_error(vq->vdev, "Cannot map descriptor ring");
+        return NULL;
+    }
+    return caches;
+}
+
+/*
+ * Pops the element at the head of a split ring that is known not to be
+ * empty.  Must be called under the RCU read lock.  The avail event is
+ * left to the caller, which only needs to set it once per batch.
+ */
+static void *virtqueue_split_pop_one(VirtQueue *vq, size_t sz,
+                                     VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1512,14 +1539,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1534,23 +1553,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1634,10 +1638,55 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/*
+ * Pops up to @max elements, as many as the guest made available, with one
+ * lookup of the region caches and one update of the avail event for all
+ * of them.
+ */
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
 {
-    unsigned int i, max;
     VRingMemoryRegionCaches *caches;
+    unsigned int n;
+    uint16_t avail;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = virtqueue_pop_caches(vq, sizeof(VRingDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    /* virtio_queue_empty_rcu() has read the avail index */
+    avail = vq->shadow_avail_idx - vq->last_avail_idx;
+    max = MIN(max, avail);
+    for (n = 0; n < max; n++) {
+        elems[n] = virtqueue_split_pop_one(vq, sz, caches);
+        if (!elems[n]) {
+            break;
+        }
+    }
+
+    if (virtio_vdev_has_feature(vq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
+/*
+ * Pops the element at the head of a packed ring that is known not to be
+ * empty.  Must be called under the RCU read lock.
+ */
+static void *virtqueue_packed_pop_one(VirtQueue *vq, size_t sz,
+                                      VRingMemoryRegionCaches *caches)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1652,11 +1701,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1669,17 +1713,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     i = vq->last_avail_idx;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
     id = desc.id;
@@ -1771,17 +1804,61 @@ err_undo_map:
     goto done;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+/*
+ * The packed ring has no avail index, each descriptor says whether it is
+ * available, so the batch goes on until one is not.
+ */
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int max)
 {
-    if (virtio_device_disabled(vq->vdev)) {
-        return NULL;
+    VRingMemoryRegionCaches *caches;
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return 0;
+    }
+
+    caches = virtqueue_pop_caches(vq, sizeof(VRingPackedDesc));
+    if (!caches) {
+        return 0;
+    }
+
+    while (n < max) {
+        elems[n] = virtqueue_packed_pop_one(vq, sz, caches);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+        if (virtio_queue_packed_empty_rcu(vq)) {
+            break;
+        }
+    }
+    return n;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    if (virtio_device_disabled(vq->vdev) || !max) {
+        return 0;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop_batch(vq, sz, elems, max);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
+    }
+}
+
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem;
+
+    if (!virtqueue_pop_batch(vq, sz, &elem, 1)) {
+        return NULL;
     }
+    return elem;
 }
 
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
@@ -79,6 +79,35 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Log-linear latency histogram, in the style of HDR histograms: latencies
+ * below 2^BLOCK_ACCT_HIST_SUB_BITS ns have a bucket each, and every further
+ * power of two is split into 2^BLOCK_ACCT_HIST_SUB_BITS buckets.  Values
+ * taken from it are thus off by at most 1/8.  Latencies of
+ * 2^BLOCK_ACCT_HIST_MAX_BITS ns (about 68 seconds) and more all go into the
+ * last bucket.
+ */
+#define BLOCK_ACCT_HIST_SUB_BITS    3
+#define BLOCK_ACCT_HIST_MAX_BITS    36
+#define BLOCK_ACCT_HIST_BUCKETS \
+    ((BLOCK_ACCT_HIST_MAX_BITS - BLOCK_ACCT_HIST_SUB_BITS + 1) << \
+     BLOCK_ACCT_HIST_SUB_BITS)
+
+enum BlockAcctPhase {
+    /* from block_acct_start() to the completion of the request */
+    BLOCK_ACCT_PHASE_TOTAL,
+    /* in the BlockBackend, waiting for drained sections and throttling */
+    BLOCK_ACCT_PHASE_QUEUE,
+    /* in the block graph below the BlockBackend */
+    BLOCK_ACCT_PHASE_SERVICE,
+    BLOCK_ACCT_PHASE__MAX,
+};
+
+typedef struct BlockAcctLatencyHist {
+    uint64_t count;
+    uint64_t buckets[BLOCK_ACCT_HIST_BUCKETS];
+} BlockAcctLatencyHist;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -92,6 +121,7 @@ struct BlockAcctStats {
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+    BlockAcctLatencyHist latency_log[BLOCK_MAX_IOTYPE][BLOCK_ACCT_PHASE__MAX];
 };
 
 typedef struct BlockAcctCookie {
@@ -112,6 +142,13 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
+int64_t block_acct_clock_ns(void);
+void block_acct_queue_service(BlockAcctStats *stats, enum BlockAcctType type,
+                              int64_t queue_ns, int64_t service_ns);
+uint64_t block_acct_latency_percentile(BlockAcctStats *stats,
+                                       enum BlockAcctType type,
+                                       enum BlockAcctPhase phase,
+                                       unsigned permille, uint64_t *samples);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
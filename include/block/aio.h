@@ -251,6 +251,13 @@ struct AioContext {
     int epollfd;
 
     const FDMonOps *fdmon_ops;
+
+#ifdef EMSCRIPTEN
+    /* Bumped when the handlers change, see fdmon-emscripten.c */
+    unsigned fdmon_generation;
+    /* Bumped when one of the fds of an IOThread context is notified */
+    uint32_t fdmon_seq;
+#endif
 };
 
 /**
@@ -403,6 +403,7 @@ AioContext *nbd_export_aio_context(NBDExport *exp);
 NBDExport *nbd_export_find(const char *name);
 
 void nbd_client_new(QIOChannelSocket *sioc,
+                    QIOChannel *ioc,
                     QCryptoTLSCreds *tlscreds,
                     const char *tlsauthz,
                     void (*close_fn)(NBDClient *, bool));
@@ -414,7 +415,7 @@ bool nbd_server_is_running(void);
 int nbd_server_max_connections(void);
 void nbd_server_start(SocketAddress *addr, const char *tls_creds,
                       const char *tls_authz, uint32_t max_connections,
-                      Error **errp);
+                      bool websocket, Error **errp);
 void nbd_server_start_options(NbdServerOptions *arg, Error **errp);
 
 /* nbd_read
@@ -481,7 +482,8 @@ NBDClientConnection *nbd_client_connection_new(const SocketAddress *saddr,
                                                const char *export_name,
                                                const char *x_dirty_bitmap,
                                                QCryptoTLSCreds *tlscreds,
-                                               const char *tlshostname);
+                                               const char *tlshostname,
+                                               const char *websocket);
 void nbd_client_connection_release(NBDClientConnection *conn);
 
 QIOChannel *coroutine_fn
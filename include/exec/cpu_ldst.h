@@ -472,4 +472,46 @@ void *tlb_vaddr_to_host(CPUArchState *env, abi_ptr addr,
                         MMUAccessType access_type, int mmu_idx);
 #endif
 
+/**
+ * cpu_memset_page_mmuidx_ra:
+ * @env: CPUArchState
+ * @addr: guest virtual address of the first byte to set
+ * @val: byte value
+ * @len: number of bytes to set, not zero
+ * @mmu_idx: MMU index to use for the stores
+ * @ra: return address for the unwinder
+ *
+ * Set bytes starting at @addr, but not past the end of its page, with a
+ * single memset() of host memory when the page is plain RAM.  Otherwise
+ * only the first byte is stored, through the slow path, so that faults,
+ * watchpoints, I/O and clean pages are handled exactly as for a guest
+ * store; the page is usually fast the next time around.
+ *
+ * Return the number of bytes set, at least one.  Nothing but the first
+ * byte can fault, so the caller only needs its guest state up to date for
+ * that byte, and should loop until all of @len has been done.
+ */
+uint64_t cpu_memset_page_mmuidx_ra(CPUArchState *env, abi_ptr addr,
+                                   uint8_t val, uint64_t len,
+                                   int mmu_idx, uintptr_t ra);
+
+/**
+ * cpu_memmove_page_mmuidx_ra:
+ * @env: CPUArchState
+ * @dst: guest virtual address of the first byte to write
+ * @src: guest virtual address of the first byte to read
+ * @len: number of bytes to copy, not zero
+ * @wmmu_idx: MMU index to use for the stores
+ * @rmmu_idx: MMU index to use for the loads
+ * @ra: return address for the unwinder
+ *
+ * Like cpu_memset_page_mmuidx_ra(), but copy forwards from @src to @dst
+ * without crossing a page of either, with memmove() semantics within the
+ * chunk.  Return the number of bytes copied, at least one.
+ */
+uint64_t cpu_memmove_page_mmuidx_ra(CPUArchState *env, abi_ptr dst,
+                                    abi_ptr src, uint64_t len,
+                                    int wmmu_idx, int rmmu_idx,
+                                    uintptr_t ra);
+
 #endif /* CPU_LDST_H */
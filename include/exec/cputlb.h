@@ -26,5 +26,7 @@
 /* cputlb.c */
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
+void tlb_foreach_ram_page(CPUState *cpu, void (*fn)(void *host, void *opaque),
+                          void *opaque);
 #endif
 #endif
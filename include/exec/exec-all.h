@@ -96,6 +96,21 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr);
  * use one of the other functions for efficiency.
  */
 void tlb_flush(CPUState *cpu);
+/**
+ * tlb_flush_asid_switch:
+ * @cpu: CPU whose TLB should be flushed
+ * @asid: tag of the guest address space the CPU switches to
+ *
+ * Flush the entire TLB like tlb_flush(), for a change of the current
+ * ASID or PCID, without TLB maintenance implied.  The TB jump cache
+ * is kept: its entries are tagged with @asid and serve again once the
+ * CPU switches back to it.  This relies on the guest invalidating its
+ * TLB after changing the mappings of an ASID, which the target turns
+ * into a tlb_flush() or one of its variants, clearing the jump cache
+ * of every ASID.  @asid must identify the whole translation regime that
+ * the target tags this way.
+ */
+void tlb_flush_asid_switch(CPUState *cpu, uint32_t asid);
 /**
  * tlb_flush_all_cpus:
  * @cpu: src CPU of the flush
@@ -297,6 +312,9 @@ static inline void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
 static inline void tlb_flush(CPUState *cpu)
 {
 }
+static inline void tlb_flush_asid_switch(CPUState *cpu, uint32_t asid)
+{
+}
 static inline void tlb_flush_all_cpus(CPUState *src_cpu)
 {
 }
@@ -526,6 +544,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr, MemTxAttrs attrs);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t last);
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr);
+#ifdef CONFIG_USER_ONLY
+static inline bool tb_page_smc_hot(tb_page_addr_t addr)
+{
+    return false;
+}
+#else
+bool tb_page_smc_hot(tb_page_addr_t addr);
+#endif
 
 /* GETPC is the true target of the return instruction that we'll execute.  */
 #if defined(CONFIG_TCG_INTERPRETER) || defined(EMSCRIPTEN)
@@ -77,6 +77,12 @@ static inline void fuzz_dma_read_cb(size_t addr,
 
 extern unsigned int global_dirty_tracking;
 
+/*
+ * Set while background-snapshot learns about writes to guest RAM through
+ * the memory API and the TLB instead of userfaultfd; see ram_write_track().
+ */
+extern bool global_write_tracking;
+
 typedef struct MemoryRegionOps MemoryRegionOps;
 
 struct ReservedRegion {
@@ -829,6 +835,8 @@ struct MemoryRegion {
 
     /* For devices designed to perform re-entrant IO into their own IO MRs */
     bool disable_reentrancy_guard;
+    /* Accessed without the BQL, see memory_region_enable_lockless_io() */
+    bool lockless_io;
 };
 
 struct IOMMUMemoryRegion {
@@ -2236,6 +2244,20 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_enable_lockless_io: Dispatch accesses without the BQL.
+ *
+ * Enable BQL-free access for an I/O memory region: vCPUs, and the
+ * address_space_* accessors, call its #MemoryRegionOps without taking
+ * the BQL.  The callbacks must then be thread safe, and take the BQL
+ * themselves before touching state that it protects.  They also run
+ * without the reentrancy guard of the owner, which is not thread safe.
+ * The region must not have ioeventfds, whose dispatch needs the BQL.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_enable_lockless_io(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -3043,7 +3065,7 @@ address_space_write_cached(MemoryRegionCache *cache, hwaddr addr,
                            const void *buf, hwaddr len)
 {
     assert(addr < cache->len && len <= cache->len - addr);
-    if (likely(cache->ptr)) {
+    if (likely(cache->ptr) && likely(!qatomic_read(&global_write_tracking))) {
         memcpy(cache->ptr + addr, buf, len);
         return MEMTX_OK;
     } else {
@@ -80,6 +80,50 @@ static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
     return (b && b->host && offset < b->used_length) ? true : false;
 }
 
+void ramblock_lazy_populate_slow(RAMBlock *rb, ram_addr_t offset,
+                                 ram_addr_t length);
+
+/**
+ * ramblock_lazy_populate: make sure a range of a RAM block is loaded
+ *
+ * @rb: the ramblock to operate on
+ * @offset: the offset of the range inside the block
+ * @length: the length of the range
+ *
+ * After a lazy-ram-load migration, the contents of the machine's RAM
+ * are read from the migration file the first time they are needed.
+ * Anything that hands out a host pointer into guest RAM calls this
+ * before the pointer is used.  Must be called within an RCU critical
+ * section.
+ */
+static inline void ramblock_lazy_populate(RAMBlock *rb, ram_addr_t offset,
+                                          ram_addr_t length)
+{
+    if (unlikely(qatomic_read(&rb->lazy_load))) {
+        ramblock_lazy_populate_slow(rb, offset, length);
+    }
+}
+
+void ram_write_track_slow(ram_addr_t addr, ram_addr_t length);
+
+/**
+ * ram_write_track: announce a write to guest RAM
+ *
+ * @addr: the ram_addr_t of the first byte to be written
+ * @length: the length of the write
+ *
+ * On hosts without userfaultfd, background-snapshot keeps a copy of the
+ * pages it has not saved yet before the guest or a device first changes
+ * them.  The TLB_NOTDIRTY slow path and everything that writes to guest
+ * RAM outside of the TLB call this before the write.
+ */
+static inline void ram_write_track(ram_addr_t addr, ram_addr_t length)
+{
+    if (unlikely(qatomic_read(&global_write_tracking))) {
+        ram_write_track_slow(addr, length);
+    }
+}
+
 static inline void *ramblock_ptr(RAMBlock *block, ram_addr_t offset)
 {
     assert(offset_in_ramblock(block, offset));
@@ -149,6 +193,63 @@ static inline void qemu_ram_block_writeback(RAMBlock *block)
 #define DIRTY_CLIENTS_ALL     ((1 << DIRTY_MEMORY_NUM) - 1)
 #define DIRTY_CLIENTS_NOCODE  (DIRTY_CLIENTS_ALL & ~(1 << DIRTY_MEMORY_CODE))
 
+/* The summary that follows @block, see DIRTY_MEMORY_SUMMARY_WORDS */
+static inline unsigned long *dirty_memory_summary(unsigned long *block)
+{
+    return block + BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+}
+
+/* Called after setting the bits [@offset, @offset + @nr) of @block */
+static inline void dirty_memory_summary_set(unsigned long *block,
+                                            unsigned long offset,
+                                            unsigned long nr)
+{
+    unsigned long *summary = dirty_memory_summary(block);
+    unsigned long bit = BIT_WORD(offset) / DIRTY_MEMORY_SUMMARY_WORDS;
+    unsigned long last = BIT_WORD(offset + nr - 1) /
+                         DIRTY_MEMORY_SUMMARY_WORDS;
+
+    /*
+     * The bits were set with an atomic RMW or followed by a full barrier;
+     * a summary read before them could miss the clearing of a scan.
+     */
+    smp_mb__after_rmw();
+    for (; bit <= last; bit++) {
+        /* Avoid bouncing the cache line of a summary that is already set */
+        if (!test_bit(bit, summary)) {
+            set_bit_atomic(bit, summary);
+        }
+    }
+}
+
+/*
+ * Return how many of the @nr words of @block from @word, at most the end
+ * of the summary bit that covers @word, can be skipped or taken at once.
+ * *@dirty is false when they are all clean.  The summary bit is cleared
+ * when those are all of its words, which the caller must then take with
+ * atomic operations.
+ */
+static inline unsigned long dirty_memory_summary_take(unsigned long *block,
+                                                      unsigned long word,
+                                                      unsigned long nr,
+                                                      bool *dirty)
+{
+    unsigned long *summary = dirty_memory_summary(block);
+    unsigned long bit = word / DIRTY_MEMORY_SUMMARY_WORDS;
+    unsigned long n = DIRTY_MEMORY_SUMMARY_WORDS -
+                      word % DIRTY_MEMORY_SUMMARY_WORDS;
+
+    if (!test_bit(bit, summary)) {
+        *dirty = false;
+        return MIN(n, nr);
+    }
+    *dirty = true;
+    if (n == DIRTY_MEMORY_SUMMARY_WORDS && nr >= n) {
+        qatomic_and(&summary[BIT_WORD(bit)], ~BIT_MASK(bit));
+    }
+    return MIN(n, nr);
+}
+
 static inline bool cpu_physical_memory_get_dirty(ram_addr_t start,
                                                  ram_addr_t length,
                                                  unsigned client)
@@ -281,6 +382,7 @@ static inline void cpu_physical_memory_set_dirty_flag(ram_addr_t addr,
     blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
 
     set_bit_atomic(offset, blocks->blocks[idx]);
+    dirty_memory_summary_set(blocks->blocks[idx], offset, 1);
 }
 
 static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
@@ -313,14 +415,21 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
             if (likely(mask & (1 << DIRTY_MEMORY_MIGRATION))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(
+                        blocks[DIRTY_MEMORY_MIGRATION]->blocks[idx],
+                        offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_VGA))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(blocks[DIRTY_MEMORY_VGA]->blocks[idx],
+                                         offset, next - page);
             }
             if (unlikely(mask & (1 << DIRTY_MEMORY_CODE))) {
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
                                   offset, next - page);
+                dirty_memory_summary_set(blocks[DIRTY_MEMORY_CODE]->blocks[idx],
+                                         offset, next - page);
             }
 
             page = next;
@@ -380,11 +489,16 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
 
                     nbits = ctpopl(temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
+                    dirty_memory_summary_set(blocks[DIRTY_MEMORY_VGA][idx],
+                                             offset * BITS_PER_LONG, 1);
 
                     if (global_dirty_tracking) {
                         qatomic_or(
                                 &blocks[DIRTY_MEMORY_MIGRATION][idx][offset],
                                 temp);
+                        dirty_memory_summary_set(
+                                blocks[DIRTY_MEMORY_MIGRATION][idx],
+                                offset * BITS_PER_LONG, 1);
                         if (unlikely(
                             global_dirty_tracking & GLOBAL_DIRTY_DIRTY_RATE)) {
                             total_dirty_pages += nbits;
@@ -396,6 +510,8 @@ uint64_t cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     if (tcg_enabled()) {
                         qatomic_or(&blocks[DIRTY_MEMORY_CODE][idx][offset],
                                    temp);
+                        dirty_memory_summary_set(blocks[DIRTY_MEMORY_CODE][idx],
+                                                 offset * BITS_PER_LONG, 1);
                     }
                 }
 
@@ -478,7 +594,7 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
     if (((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
          (start + rb->offset) &&
         !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1))) {
-        int k;
+        int k, n;
         int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
         unsigned long * const *src;
         unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
@@ -489,17 +605,27 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = qatomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
-            if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
-                unsigned long new_dirty;
-                new_dirty = ~dest[k];
-                dest[k] |= bits;
-                new_dirty &= bits;
-                num_dirty += ctpopl(new_dirty);
+        for (k = page; k < page + nr; k += n) {
+            bool dirty;
+            unsigned long j;
+
+            /* Summary bits never straddle two blocks */
+            n = dirty_memory_summary_take(src[idx], offset, page + nr - k,
+                                          &dirty);
+            for (j = 0; dirty && j < n; j++) {
+                if (src[idx][offset + j]) {
+                    unsigned long *word = &src[idx][offset + j];
+                    unsigned long bits = qatomic_xchg(word, 0);
+                    unsigned long new_dirty;
+                    new_dirty = ~dest[k + j];
+                    dest[k + j] |= bits;
+                    new_dirty &= bits;
+                    num_dirty += ctpopl(new_dirty);
+                }
             }
 
-            if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+            offset += n;
+            if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
                 offset = 0;
                 idx++;
             }
@@ -75,6 +75,28 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * With mapped-ram, the pages of this block live at a fixed offset
+     * in the migration file.  file_bmap has a bit set for each page
+     * that was written there; it is only used while saving.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
+
+    /*
+     * Set on the destination of a lazy-ram-load migration while parts
+     * of the block have not been read from the migration file yet.
+     * RCU-protected; see ramblock_lazy_populate().
+     */
+    struct RAMBlockLazyLoad *lazy_load;
+
+    /*
+     * Set on the source of a background-snapshot that tracks writes
+     * without userfaultfd.  RCU-protected; see ram_write_track().
+     */
+    struct RAMBlockWriteTrack *write_track;
 };
 #endif
 #endif
@@ -39,6 +39,18 @@ typedef struct RAMBlockNotifier RAMBlockNotifier;
  * pointed to from the new DirtyMemoryBlocks).
  */
 #define DIRTY_MEMORY_BLOCK_SIZE ((ram_addr_t)256 * 1024 * 8)
+
+/* Each block is followed by a summary of its words, see
+ * dirty_memory_summary().  A summary bit is set whenever one of the
+ * DIRTY_MEMORY_SUMMARY_WORDS words that it covers may have become dirty,
+ * after the bits themselves; a scan that clears a summary bit before
+ * taking the words it covers misses nothing, and skips the words of a
+ * clear summary bit without reading them.  Clearing dirty bits without
+ * the summary only leaves it stale.
+ */
+#define DIRTY_MEMORY_SUMMARY_WORDS 64
+#define DIRTY_MEMORY_SUMMARY_BITS \
+    (DIRTY_MEMORY_BLOCK_SIZE / BITS_PER_LONG / DIRTY_MEMORY_SUMMARY_WORDS)
 typedef struct {
     struct rcu_head rcu;
     unsigned long *blocks[];
@@ -51,6 +51,16 @@ typedef struct CPUTLBDescFast {
     uintptr_t mask;
     /* The array of tlb entries itself. */
     CPUTLBEntry *table;
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    /*
+     * Linear RAM window for loads: an access of up to 8 bytes at addr
+     * with addr - win_base < win_lim is plain RAM at addr + win_addend.
+     * win_lim is 0 when the window is empty.
+     */
+    uint64_t win_base;
+    uint64_t win_lim;
+    uintptr_t win_addend;
+#endif
 } CPUTLBDescFast QEMU_ALIGNED(2 * sizeof(void *));
 
 #endif /* EXEC_TLB_COMMON_H */
@@ -1,6 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1-or-later */
 /*
- * Declaration of guest_base.
+ * Declaration of guest_base and reserved_va.
  *  Copyright (c) 2003 Fabrice Bellard
  */
 
@@ -9,4 +9,7 @@
 
 extern uintptr_t guest_base;
 
+/* See exec/cpu-all.h */
+extern unsigned long reserved_va;
+
 #endif
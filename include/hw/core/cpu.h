@@ -202,6 +202,9 @@ struct CPUClass {
 /* Use a fully associative victim tlb of 8 entries. */
 #define CPU_VTLB_SIZE 8
 
+/* Track the large pages of each mmu_idx in up to 8 separate regions. */
+#define CPU_TLB_LARGE_PAGES 8
+
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
  * so the layout is not as critical as that of CPUTLBEntry. This is
@@ -262,24 +265,41 @@ typedef struct CPUTLBEntryFull {
     } extra;
 } CPUTLBEntryFull;
 
+/*
+ * An aligned region covering one or more of the large pages allocated
+ * into the tlb.  A page is in the region if (page & mask) == addr.
+ */
+typedef struct CPUTLBLargePage {
+    vaddr addr;
+    vaddr mask;
+} CPUTLBLargePage;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
  */
 typedef struct CPUTLBDesc {
     /*
-     * Describe a region covering all of the large pages allocated
-     * into the tlb.  When any page within this region is flushed,
-     * we must flush the entire tlb.  The region is matched if
-     * (addr & large_page_mask) == large_page_addr.
+     * Describe the regions covering the large pages allocated into the
+     * tlb.  When any page within a region is flushed, we must flush all
+     * the entries of the region.  Once all the slots are in use, a new
+     * large page extends the region that grows the least.
      */
-    vaddr large_page_addr;
-    vaddr large_page_mask;
+    CPUTLBLargePage large_pages[CPU_TLB_LARGE_PAGES];
+    unsigned n_large_pages;
     /* host time (in ns) at the beginning of the time window */
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
     size_t n_used_entries;
+    /* tlb_fill calls in the window, for the miss-rate resize policy */
+    size_t window_fills;
+    /*
+     * Statistics, read and written atomically like those in CPUTLBCommon:
+     * misses resolved by a page walk and misses served by the victim tlb.
+     */
+    size_t fill_count;
+    size_t vtlb_hit_count;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
     /* The tlb victim table, in two parts.  */
@@ -288,6 +308,17 @@ typedef struct CPUTLBDesc {
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
+/*
+ * Page flushes queued on a cpu but not yet run, merged into the single
+ * range [lo, hi) over the mmu_idx in idxmap.  Protected by tlb_c.lock.
+ */
+typedef struct CPUTLBPendingFlush {
+    bool queued;
+    uint16_t idxmap;
+    vaddr lo;
+    vaddr hi;
+} CPUTLBPendingFlush;
+
 /*
  * Data elements that are shared between all MMU modes.
  */
@@ -308,6 +339,21 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Synced page flushes merged into a pending one, and those queued */
+    size_t merged_flush_count;
+    size_t queued_flush_count;
+    /*
+     * Pending coalesced flushes: [0] is run as plain async work, [1] as
+     * safe work in the exclusive context of a synced flush.
+     */
+    CPUTLBPendingFlush pending[2];
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    /*
+     * Bumped under tlb_c.lock whenever an entry may have been changed or
+     * removed.  The wasm32 TCI tier uses it to validate its last-page cache.
+     */
+    uint32_t gen;
+#endif
 } CPUTLBCommon;
 
 /*
@@ -413,6 +459,8 @@ struct qemu_work_item;
  * @has_waiter: #true if a CPU is currently waiting for the cpu_exec_end;
  * valid under cpu_list_lock.
  * @created: Indicates whether the CPU thread has been successfully created.
+ * @halt_parker: Where the CPU thread sleeps in qemu_wait_io_event(), unparked
+ *   by qemu_cpu_kick().
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
  * @stop: Indicates a pending stop request.
@@ -471,6 +519,7 @@ struct CPUState {
     int thread_id;
     bool running, has_waiter;
     struct QemuCond *halt_cond;
+    QemuParker halt_parker;
     bool thread_kicked;
     bool created;
     bool stop;
@@ -482,6 +531,8 @@ struct CPUState {
     bool unplug;
     bool crash_occurred;
     bool exit_request;
+    /* set by the guest PC profiler to get a sample at the next TB exit */
+    bool profile_sample;
     int exclusive_context_count;
     uint32_t cflags_next_tb;
     /* updates protected by BQL */
@@ -501,6 +552,8 @@ struct CPUState {
     MemoryRegion *memory;
 
     CPUJumpCache *tb_jmp_cache;
+    /* why the TCG execution loop left translated code, for query-stats */
+    TCGExitStats *tcg_exit_stats;
 
     GArray *gdb_regs;
     int gdb_num_regs;
@@ -29,6 +29,22 @@ int64_t get_image_size(const char *filename);
  */
 ssize_t load_image_size(const char *filename, void *addr, size_t size);
 
+/**
+ * load_image_mapped: map an image file read-only
+ * @filename: Path to the image file
+ * @size: Returns the size of the image in bytes
+ * @errp: Error object
+ *
+ * Map the contents of an image file into memory, for data that is
+ * handed to the guest as is, like the blobs of fw_cfg.  With emscripten,
+ * the contents of a preloaded file are returned in place rather than
+ * copied.  The contents must not be written to, and stay mapped for as
+ * long as QEMU runs.
+ *
+ * Returns a pointer to the contents, or NULL on error.
+ */
+void *load_image_mapped(const char *filename, size_t *size, Error **errp);
+
 /**load_image_targphys_as:
  * @filename: Path to the image file
  * @addr: Address to load the image to
@@ -71,6 +71,8 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+    /* Lend inflated pages to host caches, see qemu/wasm-page-pool.h */
+    bool wasm_page_pool;
 };
 
 #endif
@@ -46,6 +46,7 @@ struct VirtIOBlkConf
     uint32_t max_discard_sectors;
     uint32_t max_write_zeroes_sectors;
     bool x_enable_wce_if_config_wce;
+    bool batch_completions;
 };
 
 struct VirtIOBlockDataPlane;
@@ -65,6 +66,11 @@ struct VirtIOBlock {
     uint64_t host_features;
     size_t config_size;
     BlockRAMRegistrar blk_ram_registrar;
+
+    /* Completions notified at once, see virtio_blk_req_complete() */
+    QEMUBH *notify_bh;
+    unsigned long *notify_pending;
+    unsigned int notify_batch;
 };
 
 typedef struct VirtIOBlockReq {
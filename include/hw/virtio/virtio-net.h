@@ -51,6 +51,8 @@ typedef struct virtio_net_conf
     char *tx;
     uint16_t rx_queue_size;
     uint16_t tx_queue_size;
+    uint32_t rx_coalesce_us;
+    uint32_t rx_coalesce_frames;
     uint16_t mtu;
     int32_t speed;
     char *duplex_str;
@@ -154,12 +156,17 @@ typedef struct VirtioNetRssData {
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
+    /* Holds back rx notifications while packets keep coming */
+    QEMUTimer *rx_timer;
+    uint32_t rx_pending;
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     uint32_t tx_waiting;
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Segments and checksums packets for sw-offload */
+    struct NetTxPkt *tx_pkt;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -215,6 +222,11 @@ struct VirtIONet {
     AnnounceTimer announce_timer;
     bool needs_vnet_hdr_swap;
     bool mtu_bypass_backend;
+    /*
+     * Offer checksum and TSO offloads even if the peer takes no vnet
+     * header, and do them in QEMU
+     */
+    bool sw_offload;
     /* primary failover device is hidden*/
     bool failover_primary_hidden;
     bool failover;
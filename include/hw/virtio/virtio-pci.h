@@ -125,6 +125,8 @@ typedef struct VirtIOPCIQueue {
   uint32_t desc[2];
   uint32_t avail[2];
   uint32_t used[2];
+  /* Host notifier signalled by lockless notify writes, see notify_bh */
+  EventNotifier *doorbell;
 } VirtIOPCIQueue;
 
 struct VirtIOPCIProxy {
@@ -163,6 +165,16 @@ struct VirtIOPCIProxy {
     VirtIOIRQFD *vector_irqfd;
     int nvqs_with_notifiers;
     VirtioBusState bus;
+
+    /*
+     * With TCG, vCPUs write to the modern notify region without the BQL.
+     * They signal the doorbell of the queue if ioeventfd is on, and the
+     * queues are kicked from this bottom half otherwise.
+     */
+    QEMUBH *notify_bh;
+    unsigned long notify_pending[BITS_TO_LONGS(VIRTIO_QUEUE_MAX)];
+    /* vCPUs between reading a doorbell and signalling it */
+    unsigned doorbell_users;
 };
 
 static inline bool virtio_pci_modern(VirtIOPCIProxy *proxy)
@@ -264,6 +264,20 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/**
+ * virtqueue_pop_batch: pop up to @max elements at once
+ * @vq: the #VirtQueue
+ * @sz: the size of each element, as for virtqueue_pop()
+ * @elems: filled with the elements
+ * @max: the size of @elems
+ *
+ * Same as calling virtqueue_pop() until it returns NULL or @max elements
+ * were popped, but the ring state is only looked up once.
+ *
+ * Returns: the number of elements popped
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -45,11 +45,12 @@ union QIOChannelWebsockMask {
  * technical restriction on which type of master channel is
  * used as the transport.
  *
- * This channel object is currently only capable of running as
- * a websocket server and is a pretty crude implementation
- * of it, not supporting the full websockets protocol feature
- * set. It is sufficient to use with a simple websockets
- * client for encapsulating VNC for noVNC in-browser client.
+ * This channel object is a pretty crude implementation of the
+ * websockets protocol, not supporting its full feature set. As a
+ * server, it is sufficient to use with a simple websockets client
+ * for encapsulating VNC for noVNC in-browser client. As a client,
+ * it carries protocols like NBD to a websockets endpoint, and is
+ * meant to be used in blocking mode or from coroutines.
  */
 
 struct QIOChannelWebsock {
@@ -65,6 +66,18 @@ struct QIOChannelWebsock {
     Error *io_err;
     gboolean io_eof;
     uint8_t opcode;
+    bool client;
+    bool blocking;
+
+    /* Handlers of the caller, which the master runs through ours */
+    AioContext *read_ctx;
+    IOHandler *io_read;
+    AioContext *write_ctx;
+    IOHandler *io_write;
+    void *aio_opaque;
+    /* Where a client flushes output that writev() left behind */
+    AioContext *flush_ctx;
+    bool flushing;
 };
 
 /**
@@ -105,4 +118,35 @@ void qio_channel_websock_handshake(QIOChannelWebsock *ioc,
                                    gpointer opaque,
                                    GDestroyNotify destroy);
 
+/**
+ * qio_channel_websock_new_client:
+ * @master: the underlying channel object
+ *
+ * Create a new websockets channel that runs the client side of the
+ * websockets protocol on top of the @master channel, which must be
+ * connected and in blocking mode.  The handshake is done with
+ * qio_channel_websock_handshake_client().
+ *
+ * Returns: the new websockets channel object
+ */
+QIOChannelWebsock *
+qio_channel_websock_new_client(QIOChannel *master);
+
+/**
+ * qio_channel_websock_handshake_client:
+ * @ioc: the websocks channel object
+ * @host: the value of the Host header
+ * @path: the path of the resource to request
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Perform the websockets client handshake, upgrading the connection
+ * to the @path resource.  This blocks until the server replied.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_websock_handshake_client(QIOChannelWebsock *ioc,
+                                         const char *host,
+                                         const char *path,
+                                         Error **errp);
+
 #endif /* QIO_CHANNEL_WEBSOCK_H */
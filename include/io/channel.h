@@ -141,6 +141,16 @@ struct QIOChannelClass {
                      off_t offset,
                      int whence,
                      Error **errp);
+    ssize_t (*io_pwrite)(QIOChannel *ioc,
+                         const char *buf,
+                         size_t buflen,
+                         off_t offset,
+                         Error **errp);
+    ssize_t (*io_pread)(QIOChannel *ioc,
+                        char *buf,
+                        size_t buflen,
+                        off_t offset,
+                        Error **errp);
     void (*io_set_aio_fd_handler)(QIOChannel *ioc,
                                   AioContext *read_ctx,
                                   IOHandler *io_read,
@@ -630,6 +640,41 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
                           int whence,
                           Error **errp);
 
+/**
+ * qio_channel_pwrite:
+ * @ioc: the channel object
+ * @buf: the memory region to write data from
+ * @buflen: the number of bytes to write
+ * @offset: the position in the channel to write at
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Write all of @buf at @offset, without changing the current
+ * I/O position of @ioc.  Only channels that support random
+ * access provide this, so other implementations will report
+ * an error.
+ *
+ * Returns: 0 if all bytes were written, or -1 on error
+ */
+int qio_channel_pwrite(QIOChannel *ioc, const char *buf, size_t buflen,
+                       off_t offset, Error **errp);
+
+/**
+ * qio_channel_pread:
+ * @ioc: the channel object
+ * @buf: the memory region to read data into
+ * @buflen: the number of bytes to read
+ * @offset: the position in the channel to read from
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Read exactly @buflen bytes from @offset into @buf, without
+ * changing the current I/O position of @ioc.  Reaching the end
+ * of the channel before @buflen bytes were read is an error.
+ *
+ * Returns: 0 if all bytes were read, or -1 on error
+ */
+int qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                      off_t offset, Error **errp);
+
 
 /**
  * qio_channel_create_watch:
@@ -26,7 +26,23 @@ struct iovec;
 #define CSUM_UDP    0x04
 #define CSUM_ALL    (CSUM_IP | CSUM_TCP | CSUM_UDP)
 
+/**
+ * net_checksum_add_cont: add up data for the internet checksum
+ *
+ * @len: length of @buf, nothing is added if not positive
+ * @buf: the data, at any alignment
+ * @seq: offset of @buf in the data being checksummed; only its parity
+ *       matters, an odd offset swaps the two bytes of every word
+ *
+ * Returns the one's complement sum of the big endian 16-bit words of @buf,
+ * folded to 16 bits: a value between 0 and 0xffff, which is 0 only if
+ * all bytes of @buf are zero.  An odd @len counts the last byte as
+ * followed by a zero byte.  Sums of consecutive pieces of data can be
+ * added up in a uint32_t and passed to net_checksum_finish(), which gives
+ * the same checksum as for the data as a whole.
+ */
 uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq);
+bool test_net_checksum_next_accel(void);
 uint16_t net_checksum_finish(uint32_t sum);
 uint16_t net_checksum_tcpudp(uint16_t length, uint16_t proto,
                              uint8_t *addrs, uint8_t *buf);
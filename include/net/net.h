@@ -140,6 +140,11 @@ struct SocketReadState {
     uint32_t packet_len;
     uint32_t vnet_hdr_len;
     uint8_t buf[NET_BUFSIZE];
+    /*
+     * The packet, when finalize is called: buf, or the data given to
+     * net_fill_rstate() if the whole packet was there
+     */
+    const uint8_t *packet;
     SocketReadStateFinalize *finalize;
 };
 
@@ -78,6 +78,18 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 NetPacketSent *sent_cb);
 
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
+
+typedef struct NetQueueStats {
+    uint64_t queued;        /* packets that had to be queued */
+    uint64_t dropped;       /* because the queue was full */
+    uint64_t purged;        /* because their sender went away */
+    uint32_t depth;
+    uint32_t max_depth;
+    uint64_t pool_hits;     /* queued packets that reused a buffer */
+    uint64_t pool_misses;
+} NetQueueStats;
+
 bool qemu_net_queue_flush(NetQueue *queue);
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats);
 
 #endif /* QEMU_NET_QUEUE_H */
@@ -76,6 +76,16 @@ typedef void coroutine_fn CoroutineEntry(void *opaque);
  */
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
 
+/**
+ * Tell how much stack a new coroutine needs while it is suspended
+ *
+ * Backends that save the stack of suspended coroutines, like the emscripten
+ * fiber one, size that space from @size instead of the default of 1 MiB.
+ * Must be called before the coroutine is first entered.  Other backends
+ * ignore it.
+ */
+void qemu_coroutine_set_stack_hint(Coroutine *co, size_t size);
+
 /**
  * Transfer control to a coroutine
  */
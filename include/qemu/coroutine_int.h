@@ -46,6 +46,9 @@ struct Coroutine {
     void *entry_arg;
     Coroutine *caller;
 
+    /* Set by qemu_coroutine_set_stack_hint(), 0 for the default */
+    size_t stack_hint;
+
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
@@ -0,0 +1,27 @@
+/*
+ * Heap accounting by subsystem
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_HEAP_ACCOUNT_H
+#define QEMU_HEAP_ACCOUNT_H
+
+#include "qapi/qapi-types-misc.h"
+
+/*
+ * Subsystems account their big allocations where they make them, and
+ * query-heap reports the totals.  The small allocations are not worth the
+ * cost of tracking: what matters when the heap is fixed, as with wasm, is
+ * which of the few big consumers to shrink.  Counters are updated with
+ * atomics and may be used from any thread.
+ */
+
+void heap_account_add(HeapSubsystem sub, size_t bytes);
+void heap_account_sub(HeapSubsystem sub, size_t bytes);
+
+/* Returns the bytes held by @sub, and the most it held at once in @peak */
+size_t heap_account_get(HeapSubsystem sub, size_t *peak);
+
+#endif
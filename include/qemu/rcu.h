@@ -65,6 +65,13 @@ struct rcu_reader_data {
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
 
+    /*
+     * Number of call_rcu1() calls made by this thread while registered.
+     * Written by the thread only, summed up by the call_rcu thread.
+     */
+    unsigned long call_count;
+    bool registered;
+
     /*
      * NotifierList used to force an RCU grace period.  Accessed under
      * rcu_registry_lock.  Note that the notifier is called _outside_
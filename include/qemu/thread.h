@@ -186,6 +186,30 @@ void qemu_event_reset(QemuEvent *ev);
 void qemu_event_wait(QemuEvent *ev);
 void qemu_event_destroy(QemuEvent *ev);
 
+/*
+ * QemuParker: a thread sleeps in qemu_parker_park() until another one
+ * calls qemu_parker_unpark().  The parked thread calls
+ * qemu_parker_prepare() before it checks whether it has to sleep, so that
+ * an unpark coming after the check is not lost.  It is a QemuEvent, which
+ * is a futex where there is one, plus statistics of the time between the
+ * first unpark and the parked thread running again; they are only
+ * written by the parked thread.
+ */
+typedef struct QemuParker {
+    QemuEvent event;
+    bool parked;
+    uint32_t unpark_us;     /* first unpark since prepare, 0 if none */
+    uint64_t wakeups;
+    uint64_t wakeup_us;     /* total latency of the wakeups */
+    uint32_t wakeup_max_us;
+} QemuParker;
+
+void qemu_parker_init(QemuParker *p);
+void qemu_parker_prepare(QemuParker *p);
+void qemu_parker_park(QemuParker *p);
+void qemu_parker_unpark(QemuParker *p);
+void qemu_parker_destroy(QemuParker *p);
+
 void qemu_thread_create(QemuThread *thread, const char *name,
                         void *(*start_routine)(void *),
                         void *arg, int mode);
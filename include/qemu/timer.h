@@ -86,7 +86,11 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
+    /* links in the pairing heap of pending timers, see util/qemu-timer.c */
+    QEMUTimer *child;
     QEMUTimer *next;
+    QEMUTimer *prev;
+    uint64_t seq;               /* arming order, for equal expire times */
     int attributes;
     int scale;
 };
@@ -762,6 +766,16 @@ int qemu_timeout_ns_to_ms(int64_t ns);
  */
 int qemu_poll_ns(GPollFD *fds, guint nfds, int64_t timeout);
 
+#ifdef EMSCRIPTEN
+/*
+ * qemu_poll_ns() for emscripten, whose poll() does not block, and the
+ * function that wakes up whoever waits for @fd.  See
+ * util/fdmon-emscripten.c.
+ */
+int qemu_poll_emscripten(GPollFD *fds, guint nfds, int64_t timeout);
+void qemu_poll_notify(int fd);
+#endif
+
 /**
  * qemu_soonest_timeout:
  * @timeout1: first timeout in nanoseconds (or -1 for infinite)
@@ -829,12 +843,45 @@ static inline int64_t get_clock(void)
 
 extern int use_rt_clock;
 
+#ifdef EMSCRIPTEN
+/*
+ * With emscripten, clock_gettime() is a call to performance.now() in JS.
+ * Once qemu_clock_coarse_start() has run, clock_coarse_ns holds the
+ * latest value returned by get_clock() in any thread, which a thread
+ * refreshes every tick and which get_clock_coarse() reads instead.
+ * Because every get_clock() raises it, mixing both never makes time go
+ * back.  It is zero while the coarse clock is off.
+ */
+extern int64_t clock_coarse_ns;
+
+void qemu_clock_coarse_start(int64_t period_ns);
+
+static inline void clock_coarse_update(int64_t ns)
+{
+    int64_t old = qatomic_read__nocheck(&clock_coarse_ns);
+
+    while (old && old < ns) {
+        int64_t seen = qatomic_cmpxchg__nocheck(&clock_coarse_ns, old, ns);
+        if (seen == old) {
+            break;
+        }
+        old = seen;
+    }
+}
+#endif
+
 static inline int64_t get_clock(void)
 {
     if (use_rt_clock) {
         struct timespec ts;
+        int64_t ns;
+
         clock_gettime(CLOCK_MONOTONIC, &ts);
-        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+        ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#ifdef EMSCRIPTEN
+        clock_coarse_update(ns);
+#endif
+        return ns;
     } else {
         /* XXX: using gettimeofday leads to problems if the date
            changes, so it should be avoided. */
@@ -843,6 +890,25 @@ static inline int64_t get_clock(void)
 }
 #endif
 
+/*
+ * get_clock_coarse:
+ *
+ * Like get_clock(), but the value may be up to one tick of the coarse
+ * clock old, see -run-with clock-tick.  For callers that read the clock
+ * often and do not time short intervals, such as the guest clocks.
+ */
+static inline int64_t get_clock_coarse(void)
+{
+#ifdef EMSCRIPTEN
+    int64_t ns = qatomic_read__nocheck(&clock_coarse_ns);
+
+    if (ns) {
+        return ns;
+    }
+#endif
+    return get_clock();
+}
+
 /*******************************************/
 /* host CPU ticks (if available) */
 
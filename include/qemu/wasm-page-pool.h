@@ -0,0 +1,42 @@
+/*
+ * Guest pages lent to host caches on emscripten
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_WASM_PAGE_POOL_H
+#define QEMU_WASM_PAGE_POOL_H
+
+/*
+ * A WebAssembly.Memory never shrinks, so guest RAM given up by the guest
+ * can't go back to the browser.  A donor, the balloon, hands such pages
+ * to the pool instead, and host caches borrow them to hold data they can
+ * drop at any time.  Pages are wasm_page_pool_page_size() bytes.
+ *
+ * Borrowed pages may be reclaimed whenever the donor needs them back.
+ * The reclaim function of the borrower is then called with the pool lock
+ * held, after which the page belongs to the guest again: borrowers must
+ * only touch their pages with the pool lock held, and the only thing a
+ * reclaim function may do is to forget about the page.  For the same
+ * reason, a page is returned with the lock held, once the borrower checked
+ * that it still owns it.  The lock is recursive.
+ */
+
+typedef void WasmPagePoolReclaimFunc(void *opaque, void *page);
+
+size_t wasm_page_pool_page_size(void);
+
+/* For the donor, @host must be page aligned */
+void wasm_page_pool_donate(void *host, size_t size);
+void wasm_page_pool_reclaim(void *host, size_t size);
+void wasm_page_pool_reclaim_all(void);
+
+/* For borrowers; returns a page, or NULL if there is none left */
+void *wasm_page_pool_borrow(WasmPagePoolReclaimFunc *reclaim, void *opaque);
+void wasm_page_pool_return(void *page);
+
+void wasm_page_pool_lock(void);
+void wasm_page_pool_unlock(void);
+
+#endif
@@ -60,6 +60,9 @@ struct TCGHelperInfo {
     unsigned nr_out             : 8;
     TCGCallReturnKind out_kind  : 8;
 
+    /* If set, expands calls inline, see tcg_set_helper_inline(). */
+    void (*inline_gen)(struct TCGTemp *ret, struct TCGTemp **args);
+
     /* Maximum physical arguments are constrained by TCG_TYPE_I128. */
     TCGCallArgumentLoc in[MAX_CALL_IARGS * (128 / TCG_TARGET_REG_BITS)];
 };
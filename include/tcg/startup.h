@@ -36,6 +36,13 @@
  */
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
 
+/*
+ * Split the JIT buffer into more regions, so that a full buffer can be
+ * recovered by evicting the coldest ones instead of flushing all TBs.
+ * Must be set before tcg_init.
+ */
+extern bool tcg_partial_flush;
+
 /**
  * tcg_register_thread: Register this thread with the TCG runtime
  *
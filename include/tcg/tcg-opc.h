@@ -310,6 +310,13 @@ DEF(last_generic, 0, 0, 0, TCG_OPF_NOT_PRESENT)
 DEF(tci_movi, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 DEF(tci_movl, 1, 0, 1, TCG_OPF_NOT_PRESENT)
 #endif
+#if defined(EMSCRIPTEN) && !defined(TCG_TARGET_INTERPRETER)
+/* Fused compare and branch, one dispatch instead of setcond + brcond. */
+DEF(tci_brcond_i32, 0, 2, 2, TCG_OPF_NOT_PRESENT)
+DEF(tci_brcond_i64, 0, 2, 2, TCG_OPF_NOT_PRESENT)
+/* Prefix carrying the fifth bit of the register operands of the next insn. */
+DEF(tci_wide, 0, 0, 1, TCG_OPF_NOT_PRESENT)
+#endif
 
 #undef DATA64_ARGS
 #undef IMPL
@@ -357,6 +357,8 @@ typedef TCGv_ptr TCGv_env;
 #define TCG_CALL_NO_RETURN          0x0008
 /* Helper is part of Plugins.  */
 #define TCG_CALL_PLUGIN             0x0010
+/* Helper never switches coroutines, so it cannot unwind a wasm TB.  */
+#define TCG_CALL_NO_UNWIND          0x0020
 
 /* convenience version of most used call flags */
 #define TCG_CALL_NO_RWG         TCG_CALL_NO_READ_GLOBALS
@@ -755,6 +757,8 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+size_t tcg_region_evict(size_t nr, unsigned (*heat)(TranslationBlock *),
+                        void (*evict)(TranslationBlock *));
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1026,6 +1030,42 @@ extern tcg_prologue_fn *tcg_qemu_tb_exec;
 
 void tcg_register_jit(const void *buf, size_t buf_size);
 
+/*
+ * Softfloat helpers that a backend may compute with host float ops.
+ * The helper takes its float64 operands in arguments arg[] and a
+ * float_status at status_ofs from the pointer in argument status_arg.
+ * A backend must still call the helper whenever softfloat could raise
+ * a flag that is not set yet, or round differently from the host.
+ */
+typedef enum TCGFPHelperOp {
+    TCG_FP_ADD_F64,
+    TCG_FP_SUB_F64,
+    TCG_FP_MUL_F64,
+    TCG_FP_DIV_F64,
+    TCG_FP_SQRT_F64,
+} TCGFPHelperOp;
+
+typedef struct TCGFPHelper {
+    const void *func;
+    TCGFPHelperOp op;
+    int arg[2];
+    int status_arg;
+    intptr_t status_ofs;
+} TCGFPHelper;
+
+void tcg_register_fp_helper(const TCGFPHelper *h);
+const TCGFPHelper *tcg_fp_helper_lookup(const void *func);
+
+/*
+ * Have gen_helper_*() of @info emit the TCG ops of @gen, which compute
+ * the same outputs from the same arguments, rather than a call.  This is
+ * meant for helpers so small that the call costs more than the work,
+ * which is especially true of the wasm backend.  @gen receives the
+ * arguments as passed to tcg_gen_callN(), before any extension.
+ */
+void tcg_set_helper_inline(TCGHelperInfo *info,
+                           void (*gen)(TCGTemp *ret, TCGTemp **args));
+
 #if TCG_TARGET_MAYBE_vec
 /* Return zero if the tuple (opc, type, vece) is unsupportable;
    return > 0 if it is directly supportable;
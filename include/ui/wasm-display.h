@@ -31,21 +31,90 @@
 extern "C" {
 #endif
 
+/**
+ * Maximum number of damage rectangles kept between two acks.
+ * Once it is reached, new updates are merged into the rectangle
+ * that grows the least.
+ */
+#define WASM_FB_MAX_DAMAGE 16
+
+/**
+ * A region of the framebuffer that changed, in pixels.
+ */
+typedef struct WasmRect {
+    int32_t x;
+    int32_t y;
+    int32_t w;
+    int32_t h;
+} WasmRect;
+
+/**
+ * Input events that JavaScript queues in the WasmInputRing.
+ */
+enum {
+    WASM_INPUT_KEY = 1,     /* a: QKeyCode, b: 1 for press, 0 for release */
+    WASM_INPUT_MOTION,      /* a: X position, b: Y position */
+    WASM_INPUT_BUTTON,      /* a: 0=left, 1=middle, 2=right, b: down */
+    WASM_INPUT_WHEEL,       /* a: horizontal delta, b: vertical delta */
+};
+
+typedef struct WasmInputEvent {
+    int32_t type;
+    int32_t a;
+    int32_t b;
+    int32_t reserved;
+} WasmInputEvent;
+
+/* Number of events in the input ring, a power of two */
+#define WASM_INPUT_RING_SIZE 256
+
+/**
+ * Single producer, single consumer ring of input events.
+ * JavaScript writes events[head % WASM_INPUT_RING_SIZE] and then
+ * increments head, with Atomics, as long as head - tail is less than
+ * WASM_INPUT_RING_SIZE.  QEMU consumes them and increments tail.
+ */
+typedef struct WasmInputRing {
+    uint32_t head;      /* Written by JavaScript */
+    uint32_t tail;      /* Written by QEMU */
+    WasmInputEvent events[WASM_INPUT_RING_SIZE];
+} WasmInputRing;
+
 /**
  * Framebuffer information structure for JavaScript interop.
  * This structure is accessible from JavaScript via Emscripten.
  */
 typedef struct WasmFramebufferInfo {
-    uint8_t *data;      /* Pointer to RGBA pixel data */
+    uint8_t *data;      /* Pointer to pixel data, RGBA unless zero-copy */
     int32_t width;      /* Width in pixels */
     int32_t height;     /* Height in pixels */
     int32_t stride;     /* Bytes per row (pitch) */
     int32_t bpp;        /* Bits per pixel (typically 32 for RGBA) */
-    uint32_t format;    /* Pixel format (pixman format code) */
+    uint32_t format;    /* Pixel format of data (pixman format code) */
     bool dirty;         /* True if framebuffer has been updated */
     uint64_t frame_count; /* Frame counter for sync */
+    int32_t damage_count; /* Number of valid entries in damage */
+    WasmRect damage[WASM_FB_MAX_DAMAGE]; /* Regions updated since last ack */
 } WasmFramebufferInfo;
 
+/**
+ * Hardware cursor information for JavaScript interop.
+ * JavaScript draws the cursor itself, as a CSS cursor or an overlay,
+ * so that the guest moving it does not touch the framebuffer.
+ */
+typedef struct WasmCursorInfo {
+    uint8_t *data;          /* width * height RGBA pixels, or NULL */
+    int32_t width;          /* Cursor size in pixels */
+    int32_t height;
+    int32_t hot_x;          /* Hotspot */
+    int32_t hot_y;
+    int32_t x;              /* Position set by the guest */
+    int32_t y;
+    int32_t visible;        /* 0 if the guest hides the cursor */
+    uint32_t shape_serial;  /* Incremented when the image changes */
+    uint32_t move_serial;   /* Incremented when position or visibility do */
+} WasmCursorInfo;
+
 /**
  * Get the framebuffer info structure.
  * Called from JavaScript to access framebuffer data.
@@ -76,7 +145,7 @@ bool wasm_get_framebuffer_size(int32_t *out_width, int32_t *out_height);
 /**
  * Acknowledge framebuffer read.
  * Called from JavaScript after copying framebuffer to canvas.
- * Clears the dirty flag.
+ * Clears the dirty flag and the damage list.
  */
 void wasm_framebuffer_ack(void);
 
@@ -87,6 +156,24 @@ void wasm_framebuffer_ack(void);
  */
 bool wasm_framebuffer_is_dirty(void);
 
+/**
+ * Get the number of damage rectangles.
+ *
+ * Returns: the number of entries of wasm_get_framebuffer_damage()
+ * that are valid.
+ */
+int32_t wasm_get_framebuffer_damage_count(void);
+
+/**
+ * Get the regions of the framebuffer updated since last ack.
+ * The rectangles do not overlap and are clipped to the framebuffer,
+ * so that JavaScript can upload only them with putImageData() or
+ * texSubImage2D().
+ *
+ * Returns: Pointer to the damage rectangles, or NULL if not initialized.
+ */
+WasmRect *wasm_get_framebuffer_damage(void);
+
 /**
  * Get current frame count.
  * Useful for JavaScript to detect frame updates.
@@ -95,6 +182,48 @@ bool wasm_framebuffer_is_dirty(void);
  */
 uint64_t wasm_get_frame_count(void);
 
+/**
+ * Get the current display refresh interval.
+ * It grows while the guest screen is static, and is reset by guest
+ * updates and input events.
+ *
+ * Returns: the interval between two refreshes in milliseconds.
+ */
+uint32_t wasm_get_refresh_interval(void);
+
+/**
+ * Tell the display whether the page is visible.
+ * Called from JavaScript on visibilitychange, the display only
+ * refreshes at an idle rate while hidden.
+ *
+ * @visible: false if the page is hidden
+ */
+void wasm_set_display_visible(bool visible);
+
+/**
+ * Get the hardware cursor info structure.
+ * JavaScript can poll its serials once per frame instead of handling
+ * the onWasmMouseUpdate and onWasmCursorDefine callbacks.
+ *
+ * Returns: Pointer to WasmCursorInfo structure, or NULL if not initialized.
+ */
+WasmCursorInfo *wasm_get_cursor_info(void);
+
+/**
+ * Get the input ring.
+ * JavaScript can queue any number of input events there and then make
+ * a single wasm_input_kick() call, instead of one call per event.
+ *
+ * Returns: Pointer to the WasmInputRing, or NULL if not initialized.
+ */
+WasmInputRing *wasm_get_input_ring(void);
+
+/**
+ * Have the main loop process the events queued in the input ring.
+ * Events are also processed at each display refresh.
+ */
+void wasm_input_kick(void);
+
 /**
  * Send keyboard event from JavaScript.
  *
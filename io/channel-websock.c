@@ -23,8 +23,10 @@
 #include "qemu/bswap.h"
 #include "io/channel-websock.h"
 #include "crypto/hash.h"
+#include "crypto/random.h"
 #include "trace.h"
 #include "qemu/iov.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
 
 /* Max amount to allow in rawinput/encoutput buffers */
@@ -92,6 +94,19 @@
 #define QIO_CHANNEL_WEBSOCK_HTTP_METHOD "GET"
 #define QIO_CHANNEL_WEBSOCK_HTTP_PATH "/"
 #define QIO_CHANNEL_WEBSOCK_HTTP_VERSION "HTTP/1.1"
+#define QIO_CHANNEL_WEBSOCK_HTTP_SWITCHING "101"
+#define QIO_CHANNEL_WEBSOCK_HEADER_ACCEPT "sec-websocket-accept"
+#define QIO_CHANNEL_WEBSOCK_CLIENT_NONCE_LEN 16
+
+#define QIO_CHANNEL_WEBSOCK_HANDSHAKE_REQ     \
+    "GET %s HTTP/1.1\r\n"                      \
+    "Host: %s\r\n"                             \
+    "Upgrade: websocket\r\n"                   \
+    "Connection: Upgrade\r\n"                  \
+    "Sec-WebSocket-Key: %s\r\n"                \
+    "Sec-WebSocket-Protocol: binary\r\n"       \
+    "Sec-WebSocket-Version: "                  \
+    QIO_CHANNEL_WEBSOCK_SUPPORTED_VERSION "\r\n\r\n"
 
 /* The websockets packet header is variable length
  * depending on the size of the payload... */
@@ -199,6 +214,67 @@ enum {
     QIO_CHANNEL_WEBSOCK_STATUS_SERVER_ERR = 1011,
 };
 
+/*
+ * Parse all the header fields of format
+ *
+ *   $NAME: $VALUE
+ *
+ * e.g.
+ *
+ *   Cache-control: no-cache
+ *
+ * Returns the number of fields, or 0 on error.
+ */
+static size_t
+qio_channel_websock_extract_fields(char *buffer,
+                                   QIOChannelWebsockHTTPHeader *hdrs,
+                                   size_t nhdrsalloc,
+                                   Error **errp)
+{
+    char *nl, *sep, *tmp;
+    size_t nhdrs = 0;
+
+    do {
+        QIOChannelWebsockHTTPHeader *hdr;
+
+        nl = strstr(buffer, QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
+        if (nl) {
+            *nl = '\0';
+        }
+
+        sep = strchr(buffer, ':');
+        if (!sep) {
+            error_setg(errp, "Malformed HTTP header");
+            return 0;
+        }
+        *sep = '\0';
+        sep++;
+        while (*sep == ' ') {
+            sep++;
+        }
+
+        if (nhdrs >= nhdrsalloc) {
+            error_setg(errp, "Too many HTTP headers");
+            return 0;
+        }
+
+        hdr = &hdrs[nhdrs++];
+        hdr->name = buffer;
+        hdr->value = sep;
+
+        /* Canonicalize header name for easier identification later */
+        for (tmp = hdr->name; *tmp; tmp++) {
+            *tmp = g_ascii_tolower(*tmp);
+        }
+
+        if (nl) {
+            buffer = nl + strlen(QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
+        }
+    } while (nl != NULL);
+
+    return nhdrs;
+}
+
 static size_t
 qio_channel_websock_extract_headers(QIOChannelWebsock *ioc,
                                     char *buffer,
@@ -206,8 +282,8 @@ qio_channel_websock_extract_headers(QIOChannelWebsock *ioc,
                                     size_t nhdrsalloc,
                                     Error **errp)
 {
-    char *nl, *sep, *tmp;
-    size_t nhdrs = 0;
+    char *nl, *tmp;
+    size_t nhdrs;
 
     /*
      * First parse the HTTP protocol greeting of format:
@@ -263,53 +339,10 @@ qio_channel_websock_extract_headers(QIOChannelWebsock *ioc,
 
     buffer = nl + strlen(QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
 
-    /*
-     * Now parse all the header fields of format
-     *
-     *   $NAME: $VALUE
-     *
-     * e.g.
-     *
-     *   Cache-control: no-cache
-     */
-    do {
-        QIOChannelWebsockHTTPHeader *hdr;
-
-        nl = strstr(buffer, QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
-        if (nl) {
-            *nl = '\0';
-        }
-
-        sep = strchr(buffer, ':');
-        if (!sep) {
-            error_setg(errp, "Malformed HTTP header");
-            goto bad_request;
-        }
-        *sep = '\0';
-        sep++;
-        while (*sep == ' ') {
-            sep++;
-        }
-
-        if (nhdrs >= nhdrsalloc) {
-            error_setg(errp, "Too many HTTP headers");
-            goto bad_request;
-        }
-
-        hdr = &hdrs[nhdrs++];
-        hdr->name = buffer;
-        hdr->value = sep;
-
-        /* Canonicalize header name for easier identification later */
-        for (tmp = hdr->name; *tmp; tmp++) {
-            *tmp = g_ascii_tolower(*tmp);
-        }
-
-        if (nl) {
-            buffer = nl + strlen(QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
-        }
-    } while (nl != NULL);
-
+    nhdrs = qio_channel_websock_extract_fields(buffer, hdrs, nhdrsalloc, errp);
+    if (!nhdrs) {
+        goto bad_request;
+    }
     return nhdrs;
 
  bad_request:
@@ -614,7 +647,8 @@ static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
                                        size_t size)
 {
     size_t header_size;
-    size_t i;
+    size_t i, start;
+    QIOChannelWebsockMask mask, *maskp;
     union {
         char buf[QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT];
         QIOChannelWebsockHeader ws;
@@ -627,20 +661,32 @@ static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
     if (size < QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_THRESHOLD_7_BIT) {
         header.ws.b1 = (uint8_t)size;
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT;
+        maskp = &header.ws.u.m;
     } else if (size < QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_THRESHOLD_16_BIT) {
         header.ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_16_BIT;
         header.ws.u.s16.l16 = cpu_to_be16((uint16_t)size);
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT;
+        maskp = &header.ws.u.s16.m16;
     } else {
         header.ws.b1 = QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_64_BIT;
         header.ws.u.s64.l64 = cpu_to_be64(size);
         header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT;
+        maskp = &header.ws.u.s64.m64;
+    }
+
+    /* Only frames sent by a client are masked */
+    if (ioc->client) {
+        mask.u = g_random_int();
+        *maskp = mask;
+        header.ws.b1 |= QIO_CHANNEL_WEBSOCK_HEADER_FIELD_HAS_MASK;
+    } else {
+        header_size -= QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK;
     }
-    header_size -= QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK;
 
     trace_qio_channel_websock_encode(ioc, opcode, header_size, size);
     buffer_reserve(&ioc->encoutput, header_size + size);
     buffer_append(&ioc->encoutput, header.buf, header_size);
+    start = ioc->encoutput.offset;
     for (i = 0; i < niov && size != 0; i++) {
         size_t want = iov[i].iov_len;
         if (want > size) {
@@ -649,6 +695,12 @@ static void qio_channel_websock_encode(QIOChannelWebsock *ioc,
         buffer_append(&ioc->encoutput, iov[i].iov_base, want);
         size -= want;
     }
+
+    if (ioc->client) {
+        for (i = start; i < ioc->encoutput.offset; i++) {
+            ioc->encoutput.buffer[i] ^= mask.c[(i - start) % 4];
+        }
+    }
 }
 
 
@@ -685,6 +737,7 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
     unsigned char opcode, fin, has_mask;
     size_t header_size;
     size_t payload_len;
+    size_t no_mask_len;
     QIOChannelWebsockHeader *header =
         (QIOChannelWebsockHeader *)ioc->encinput.buffer;
 
@@ -697,7 +750,8 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
             "internal server error");
         return -1;
     }
-    if (ioc->encinput.offset < QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT) {
+    if (ioc->encinput.offset < QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT -
+                               QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK) {
         /* header not complete */
         return QIO_CHANNEL_ERR_BLOCK;
     }
@@ -724,7 +778,8 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
 
     /* Websocket frame sanity check:
      * * Fragmentation is only supported for binary frames.
-     * * All frames sent by a client MUST be masked.
+     * * All frames sent by a client MUST be masked, and frames sent
+     *   by a server MUST NOT.
      * * Only binary and ping/pong encoding is supported.
      */
     if (!fin) {
@@ -748,17 +803,29 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
             return -1;
         }
     }
-    if (!has_mask) {
+    if (ioc->client && has_mask) {
+        error_setg(errp, "server websocket frames must not be masked");
+        qio_channel_websock_write_close(
+            ioc, QIO_CHANNEL_WEBSOCK_STATUS_PROTOCOL_ERR,
+            "server frames must not be masked");
+        return -1;
+    }
+    if (!ioc->client && !has_mask) {
         error_setg(errp, "client websocket frames must be masked");
         qio_channel_websock_write_close(
             ioc, QIO_CHANNEL_WEBSOCK_STATUS_PROTOCOL_ERR,
             "client frames must be masked");
         return -1;
     }
+    no_mask_len = has_mask ? 0 : QIO_CHANNEL_WEBSOCK_HEADER_LEN_MASK;
 
     if (payload_len < QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_16_BIT) {
+        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT - no_mask_len;
+        if (ioc->encinput.offset < header_size) {
+            /* header not complete */
+            return QIO_CHANNEL_ERR_BLOCK;
+        }
         ioc->payload_remain = payload_len;
-        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_7_BIT;
         ioc->mask = header->u.m;
     } else if (opcode & QIO_CHANNEL_WEBSOCK_CONTROL_OPCODE_MASK) {
         error_setg(errp, "websocket control frame is too large");
@@ -767,20 +834,27 @@ static int qio_channel_websock_decode_header(QIOChannelWebsock *ioc,
             "control frame is too large");
         return -1;
     } else if (payload_len == QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_16_BIT &&
-               ioc->encinput.offset >= QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT) {
+               ioc->encinput.offset >=
+               QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT - no_mask_len) {
         ioc->payload_remain = be16_to_cpu(header->u.s16.l16);
-        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT;
+        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_16_BIT - no_mask_len;
         ioc->mask = header->u.s16.m16;
     } else if (payload_len == QIO_CHANNEL_WEBSOCK_PAYLOAD_LEN_MAGIC_64_BIT &&
-               ioc->encinput.offset >= QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT) {
+               ioc->encinput.offset >=
+               QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT - no_mask_len) {
         ioc->payload_remain = be64_to_cpu(header->u.s64.l64);
-        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT;
+        header_size = QIO_CHANNEL_WEBSOCK_HEADER_LEN_64_BIT - no_mask_len;
         ioc->mask = header->u.s64.m64;
     } else {
         /* header not complete */
         return QIO_CHANNEL_ERR_BLOCK;
     }
 
+    if (!has_mask) {
+        /* What was read as the mask is the start of the payload */
+        ioc->mask.u = 0;
+    }
+
     trace_qio_channel_websock_header_full_decode(
         ioc, header_size, ioc->payload_remain, ioc->mask.u);
     buffer_advance(&ioc->encinput, header_size);
@@ -816,15 +890,17 @@ static int qio_channel_websock_decode_payload(QIOChannelWebsock *ioc,
 
         ioc->payload_remain -= payload_len;
 
-        /* unmask frame */
-        /* process 1 frame (32 bit op) */
-        payload32 = (uint32_t *)ioc->encinput.buffer;
-        for (i = 0; i < payload_len / 4; i++) {
-            payload32[i] ^= ioc->mask.u;
-        }
-        /* process the remaining bytes (if any) */
-        for (i *= 4; i < payload_len; i++) {
-            ioc->encinput.buffer[i] ^= ioc->mask.c[i % 4];
+        /* unmask frame, except for the unmasked frames of a server */
+        if (ioc->mask.u) {
+            /* process 1 frame (32 bit op) */
+            payload32 = (uint32_t *)ioc->encinput.buffer;
+            for (i = 0; i < payload_len / 4; i++) {
+                payload32[i] ^= ioc->mask.u;
+            }
+            /* process the remaining bytes (if any) */
+            for (i *= 4; i < payload_len; i++) {
+                ioc->encinput.buffer[i] ^= ioc->mask.c[i % 4];
+            }
         }
     }
 
@@ -892,6 +968,27 @@ qio_channel_websock_new_server(QIOChannel *master)
     return wioc;
 }
 
+QIOChannelWebsock *
+qio_channel_websock_new_client(QIOChannel *master)
+{
+    QIOChannelWebsock *wioc;
+    QIOChannel *ioc;
+
+    wioc = QIO_CHANNEL_WEBSOCK(object_new(TYPE_QIO_CHANNEL_WEBSOCK));
+    ioc = QIO_CHANNEL(wioc);
+
+    wioc->master = master;
+    wioc->client = true;
+    wioc->blocking = true;
+    if (qio_channel_has_feature(master, QIO_CHANNEL_FEATURE_SHUTDOWN)) {
+        qio_channel_set_feature(ioc, QIO_CHANNEL_FEATURE_SHUTDOWN);
+    }
+    object_ref(OBJECT(master));
+
+    trace_qio_channel_websock_new_client(wioc, master);
+    return wioc;
+}
+
 void qio_channel_websock_handshake(QIOChannelWebsock *ioc,
                                    QIOTaskFunc func,
                                    gpointer opaque,
@@ -914,6 +1011,182 @@ void qio_channel_websock_handshake(QIOChannelWebsock *ioc,
 }
 
 
+static int qio_channel_websock_handshake_client_check(QIOChannelWebsock *ioc,
+                                                      char *buffer,
+                                                      const char *key,
+                                                      Error **errp)
+{
+    QIOChannelWebsockHTTPHeader hdrs[32];
+    size_t nhdrs;
+    const char *connection, *upgrade, *accept;
+    g_autofree char *combined_key = NULL;
+    g_autofree char *expected = NULL;
+    char *nl, *tmp;
+    char **connectionv;
+    bool upgraded = false;
+    size_t i;
+
+    /*
+     * The status line of the reply, e.g.
+     *
+     *   HTTP/1.1 101 Switching Protocols
+     */
+    nl = strstr(buffer, QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM);
+    if (!nl) {
+        error_setg(errp, "Missing HTTP header delimiter");
+        return -1;
+    }
+    *nl = '\0';
+    trace_qio_channel_websock_http_greeting(ioc, buffer);
+
+    tmp = strchr(buffer, ' ');
+    if (!tmp) {
+        error_setg(errp, "Missing HTTP status delimiter");
+        return -1;
+    }
+    *tmp++ = '\0';
+    if (!g_str_equal(buffer, QIO_CHANNEL_WEBSOCK_HTTP_VERSION)) {
+        error_setg(errp, "Unsupported HTTP version %s", buffer);
+        return -1;
+    }
+    if (strncmp(tmp, QIO_CHANNEL_WEBSOCK_HTTP_SWITCHING,
+                strlen(QIO_CHANNEL_WEBSOCK_HTTP_SWITCHING)) != 0) {
+        error_setg(errp, "Websocket upgrade refused: %s", tmp);
+        return -1;
+    }
+
+    nhdrs = qio_channel_websock_extract_fields(
+        nl + strlen(QIO_CHANNEL_WEBSOCK_HANDSHAKE_DELIM),
+        hdrs, G_N_ELEMENTS(hdrs), errp);
+    if (!nhdrs) {
+        return -1;
+    }
+
+    upgrade = qio_channel_websock_find_header(
+        hdrs, nhdrs, QIO_CHANNEL_WEBSOCK_HEADER_UPGRADE);
+    if (!upgrade ||
+        strcasecmp(upgrade, QIO_CHANNEL_WEBSOCK_UPGRADE_WEBSOCKET) != 0) {
+        error_setg(errp, "Incorrect upgrade method '%s'",
+                   upgrade ? upgrade : "");
+        return -1;
+    }
+
+    connection = qio_channel_websock_find_header(
+        hdrs, nhdrs, QIO_CHANNEL_WEBSOCK_HEADER_CONNECTION);
+    connectionv = g_strsplit(connection ? connection : "", ",", 0);
+    for (i = 0; connectionv != NULL && connectionv[i] != NULL; i++) {
+        g_strstrip(connectionv[i]);
+        if (strcasecmp(connectionv[i],
+                       QIO_CHANNEL_WEBSOCK_CONNECTION_UPGRADE) == 0) {
+            upgraded = true;
+        }
+    }
+    g_strfreev(connectionv);
+    if (!upgraded) {
+        error_setg(errp, "No connection upgrade in reply '%s'",
+                   connection ? connection : "");
+        return -1;
+    }
+
+    accept = qio_channel_websock_find_header(
+        hdrs, nhdrs, QIO_CHANNEL_WEBSOCK_HEADER_ACCEPT);
+    if (!accept) {
+        error_setg(errp, "Missing websocket accept header data");
+        return -1;
+    }
+
+    combined_key = g_strconcat(key, QIO_CHANNEL_WEBSOCK_GUID, NULL);
+    if (qcrypto_hash_base64(QCRYPTO_HASH_ALG_SHA1,
+                            combined_key, strlen(combined_key),
+                            &expected, errp) < 0) {
+        return -1;
+    }
+    if (!g_str_equal(accept, expected)) {
+        error_setg(errp, "Websocket accept key '%s' does not match", accept);
+        return -1;
+    }
+
+    return 0;
+}
+
+int qio_channel_websock_handshake_client(QIOChannelWebsock *ioc,
+                                         const char *host,
+                                         const char *path,
+                                         Error **errp)
+{
+    uint8_t nonce[QIO_CHANNEL_WEBSOCK_CLIENT_NONCE_LEN];
+    g_autofree char *key = NULL;
+    g_autofree char *req = NULL;
+    char *handshake_end;
+    Error *err = NULL;
+    ssize_t ret;
+
+    assert(ioc->client);
+    trace_qio_channel_websock_handshake_start(ioc);
+
+    if (qcrypto_random_bytes(nonce, sizeof(nonce), &err) < 0) {
+        goto fail;
+    }
+    key = g_base64_encode(nonce, sizeof(nonce));
+    req = g_strdup_printf(QIO_CHANNEL_WEBSOCK_HANDSHAKE_REQ, path, host, key);
+
+    if (qio_channel_write_all(ioc->master, req, strlen(req), &err) < 0) {
+        goto fail;
+    }
+
+    trace_qio_channel_websock_handshake_reply(ioc);
+    for (;;) {
+        buffer_reserve(&ioc->encinput, 4096);
+        ret = qio_channel_read(ioc->master,
+                               (char *)ioc->encinput.buffer +
+                               ioc->encinput.offset,
+                               4096 - ioc->encinput.offset,
+                               &err);
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_wait(ioc->master, G_IO_IN);
+            continue;
+        }
+        if (ret < 0) {
+            goto fail;
+        }
+        if (ret == 0) {
+            error_setg(&err, "End of file while reading websocket reply");
+            goto fail;
+        }
+        ioc->encinput.offset += ret;
+
+        handshake_end = g_strstr_len((char *)ioc->encinput.buffer,
+                                     ioc->encinput.offset,
+                                     QIO_CHANNEL_WEBSOCK_HANDSHAKE_END);
+        if (handshake_end) {
+            break;
+        }
+        if (ioc->encinput.offset >= 4096) {
+            error_setg(&err, "Websocket reply too large");
+            goto fail;
+        }
+    }
+
+    *handshake_end = '\0';
+    if (qio_channel_websock_handshake_client_check(
+            ioc, (char *)ioc->encinput.buffer, key, &err) < 0) {
+        goto fail;
+    }
+
+    /* The server may have sent frames right after its reply */
+    buffer_advance(&ioc->encinput,
+                   handshake_end - (char *)ioc->encinput.buffer +
+                   strlen(QIO_CHANNEL_WEBSOCK_HANDSHAKE_END));
+    trace_qio_channel_websock_handshake_complete(ioc);
+    return 0;
+
+ fail:
+    trace_qio_channel_websock_handshake_fail(ioc, error_get_pretty(err));
+    error_propagate(errp, err);
+    return -1;
+}
+
+
 static void qio_channel_websock_finalize(Object *obj)
 {
     QIOChannelWebsock *ioc = QIO_CHANNEL_WEBSOCK(obj);
@@ -945,25 +1218,36 @@ static ssize_t qio_channel_websock_read_wire(QIOChannelWebsock *ioc,
                                ioc->encinput.offset,
                                want,
                                errp);
-        if (ret < 0) {
+        if (ret == QIO_CHANNEL_ERR_BLOCK && ioc->encinput.offset) {
+            /* Decode the frames left over from the handshake or before */
+        } else if (ret < 0) {
             return ret;
-        }
-        if (ret == 0 && ioc->encinput.offset == 0) {
+        } else if (ret == 0) {
             ioc->io_eof = TRUE;
-            return 0;
+            if (ioc->encinput.offset == 0) {
+                return 0;
+            }
+        } else {
+            ioc->encinput.offset += ret;
         }
-        ioc->encinput.offset += ret;
     }
 
     while (ioc->encinput.offset != 0) {
         if (ioc->payload_remain == 0) {
             ret = qio_channel_websock_decode_header(ioc, errp);
+            if (ret == QIO_CHANNEL_ERR_BLOCK) {
+                /* The rest of the header is still to come */
+                break;
+            }
             if (ret < 0) {
                 return ret;
             }
         }
 
         ret = qio_channel_websock_decode_payload(ioc, errp);
+        if (ret == QIO_CHANNEL_ERR_BLOCK) {
+            break;
+        }
         if (ret < 0) {
             return ret;
         }
@@ -1010,6 +1294,7 @@ static void qio_channel_websock_flush_free(gpointer user_data)
 }
 
 static void qio_channel_websock_set_watch(QIOChannelWebsock *ioc);
+static void qio_channel_websock_update_aio_handlers(QIOChannelWebsock *wioc);
 
 static gboolean qio_channel_websock_flush(QIOChannel *ioc,
                                           GIOCondition condition,
@@ -1076,6 +1361,84 @@ static void qio_channel_websock_set_watch(QIOChannelWebsock *ioc)
 }
 
 
+static void qio_channel_websock_aio_read(void *opaque)
+{
+    QIOChannelWebsock *wioc = opaque;
+
+    wioc->io_read(wioc->aio_opaque);
+}
+
+static void qio_channel_websock_aio_write(void *opaque)
+{
+    QIOChannelWebsock *wioc = opaque;
+
+    if (wioc->flushing) {
+        ssize_t ret = qio_channel_websock_write_wire(wioc, &wioc->io_err);
+
+        if (ret < 0 && ret != QIO_CHANNEL_ERR_BLOCK) {
+            /* The next readv or writev reports the error */
+            buffer_reset(&wioc->encoutput);
+        }
+        if (!wioc->encoutput.offset) {
+            wioc->flushing = false;
+            qio_channel_websock_update_aio_handlers(wioc);
+        }
+    }
+
+    if (wioc->io_write) {
+        wioc->io_write(wioc->aio_opaque);
+    }
+}
+
+static void qio_channel_websock_update_aio_handlers(QIOChannelWebsock *wioc)
+{
+    AioContext *write_ctx = wioc->write_ctx;
+    IOHandler *io_write = NULL;
+
+    /* Both are used from the AioContext of the coroutines of the caller */
+    if (!write_ctx || (wioc->flushing && !wioc->io_write)) {
+        write_ctx = wioc->flush_ctx;
+    }
+    if (wioc->io_write || wioc->flushing) {
+        io_write = qio_channel_websock_aio_write;
+    }
+    if (!wioc->read_ctx && !write_ctx) {
+        return;
+    }
+
+    qio_channel_set_aio_fd_handler(wioc->master,
+                                   wioc->read_ctx,
+                                   wioc->io_read ?
+                                   qio_channel_websock_aio_read : NULL,
+                                   write_ctx, io_write, wioc);
+}
+
+static void qio_channel_websock_set_aio_fd_handler(QIOChannel *ioc,
+                                                   AioContext *read_ctx,
+                                                   IOHandler *io_read,
+                                                   AioContext *write_ctx,
+                                                   IOHandler *io_write,
+                                                   void *opaque)
+{
+    QIOChannelWebsock *wioc = QIO_CHANNEL_WEBSOCK(ioc);
+
+    /*
+     * The handlers run on the master, but a write handler of our own
+     * may be needed to flush the frames that the last writev left.
+     */
+    if (read_ctx) {
+        wioc->read_ctx = read_ctx;
+        wioc->io_read = io_read;
+    }
+    if (write_ctx) {
+        wioc->write_ctx = write_ctx;
+        wioc->io_write = io_write;
+    }
+    wioc->aio_opaque = opaque;
+    qio_channel_websock_update_aio_handlers(wioc);
+}
+
+
 static ssize_t qio_channel_websock_readv(QIOChannel *ioc,
                                          const struct iovec *iov,
                                          size_t niov,
@@ -1094,11 +1457,18 @@ static ssize_t qio_channel_websock_readv(QIOChannel *ioc,
         return -1;
     }
 
-    if (!wioc->rawinput.offset) {
+    while (!wioc->rawinput.offset) {
         ret = qio_channel_websock_read_wire(QIO_CHANNEL_WEBSOCK(ioc), errp);
         if (ret < 0) {
             return ret;
         }
+        if (wioc->io_eof) {
+            break;
+        }
+        if (!wioc->blocking && !wioc->rawinput.offset) {
+            /* Only control frames or part of a frame were read */
+            return QIO_CHANNEL_ERR_BLOCK;
+        }
     }
 
     for (i = 0 ; i < niov ; i++) {
@@ -1118,7 +1488,9 @@ static ssize_t qio_channel_websock_readv(QIOChannel *ioc,
     }
 
     buffer_advance(&wioc->rawinput, got);
-    qio_channel_websock_set_watch(wioc);
+    if (!wioc->client) {
+        qio_channel_websock_set_watch(wioc);
+    }
     return got;
 }
 
@@ -1168,7 +1540,19 @@ static ssize_t qio_channel_websock_writev(QIOChannel *ioc,
         return -1;
     }
 
-    qio_channel_websock_set_watch(wioc);
+    if (!wioc->client) {
+        qio_channel_websock_set_watch(wioc);
+    } else if (wioc->encoutput.offset && !wioc->flushing) {
+        /*
+         * Nobody else drains the output of a client: flush it when the
+         * master is writable, next to the handlers of qio_channel_yield()
+         */
+        wioc->flush_ctx = qemu_in_coroutine() ?
+            qemu_coroutine_get_aio_context(qemu_coroutine_self()) :
+            iohandler_get_aio_context();
+        wioc->flushing = true;
+        qio_channel_websock_update_aio_handlers(wioc);
+    }
 
     if (want == 0) {
         return QIO_CHANNEL_ERR_BLOCK;
@@ -1184,6 +1568,7 @@ static int qio_channel_websock_set_blocking(QIOChannel *ioc,
     QIOChannelWebsock *wioc = QIO_CHANNEL_WEBSOCK(ioc);
 
     qio_channel_set_blocking(wioc->master, enabled, errp);
+    wioc->blocking = enabled;
     return 0;
 }
 
@@ -1319,6 +1704,7 @@ static void qio_channel_websock_class_init(ObjectClass *klass,
     ioc_klass->io_close = qio_channel_websock_close;
     ioc_klass->io_shutdown = qio_channel_websock_shutdown;
     ioc_klass->io_create_watch = qio_channel_websock_create_watch;
+    ioc_klass->io_set_aio_fd_handler = qio_channel_websock_set_aio_fd_handler;
 }
 
 static const TypeInfo qio_channel_websock_info = {
@@ -506,6 +506,57 @@ off_t qio_channel_io_seek(QIOChannel *ioc,
     return klass->io_seek(ioc, offset, whence, errp);
 }
 
+int qio_channel_pwrite(QIOChannel *ioc, const char *buf, size_t buflen,
+                       off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_pwrite) {
+        error_setg(errp, "Channel does not support positioned writes");
+        return -1;
+    }
+
+    while (buflen > 0) {
+        ssize_t len = klass->io_pwrite(ioc, buf, buflen, offset, errp);
+
+        if (len < 0) {
+            return -1;
+        }
+        buf += len;
+        buflen -= len;
+        offset += len;
+    }
+    return 0;
+}
+
+int qio_channel_pread(QIOChannel *ioc, char *buf, size_t buflen,
+                      off_t offset, Error **errp)
+{
+    QIOChannelClass *klass = QIO_CHANNEL_GET_CLASS(ioc);
+
+    if (!klass->io_pread) {
+        error_setg(errp, "Channel does not support positioned reads");
+        return -1;
+    }
+
+    while (buflen > 0) {
+        ssize_t len = klass->io_pread(ioc, buf, buflen, offset, errp);
+
+        if (len < 0) {
+            return -1;
+        }
+        if (len == 0) {
+            error_setg(errp, "Unexpected end-of-file at offset %lld",
+                       (long long int)offset);
+            return -1;
+        }
+        buf += len;
+        buflen -= len;
+        offset += len;
+    }
+    return 0;
+}
+
 int qio_channel_flush(QIOChannel *ioc,
                                 Error **errp)
 {
@@ -0,0 +1,485 @@
+/*
+ * Several migration channels carried over a single stream
+ *
+ * Transports such as file: and fd: provide only one stream, but multifd
+ * needs a channel per thread.  The channels are multiplexed as segments
+ * tagged with a channel id; on the destination a thread splits them out
+ * again so that the multifd threads decode their pages in parallel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "io/channel.h"
+#include "channel.h"
+#include "channel-mux.h"
+#include "trace.h"
+
+/* "QMUX" */
+#define MUX_MAGIC 0x514d5558
+
+typedef struct QEMU_PACKED {
+    uint32_t magic;
+    uint32_t nb_channels;
+} MuxHeader;
+
+typedef struct QEMU_PACKED {
+    uint32_t id;
+    uint32_t len;
+} MuxSegmentHeader;
+
+typedef struct MuxSegment {
+    uint8_t *data;
+    size_t len;
+    size_t offset;
+    QSIMPLEQ_ENTRY(MuxSegment) next;
+} MuxSegment;
+
+typedef struct QIOChannelMux QIOChannelMux;
+
+typedef struct MigrationMux {
+    QIOChannel *ioc;
+    unsigned int nb_channels;
+    bool incoming;
+    int refcnt;
+
+    /* Protected by lock */
+    QemuMutex lock;
+    QemuCond cond;
+    QIOChannelMux **channels;
+    unsigned int nb_open;
+    bool eof;
+    Error *error;
+} MigrationMux;
+
+#define TYPE_QIO_CHANNEL_MUX "qio-channel-mux"
+OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelMux, QIO_CHANNEL_MUX)
+
+struct QIOChannelMux {
+    QIOChannel parent;
+    MigrationMux *mux;
+    unsigned int id;
+    bool shutdown;
+    /* Incoming data not read yet; protected by mux->lock */
+    QSIMPLEQ_HEAD(, MuxSegment) segments;
+};
+
+static MigrationMux *migration_mux_new(QIOChannel *ioc,
+                                       unsigned int nb_channels)
+{
+    MigrationMux *mux = g_new0(MigrationMux, 1);
+
+    object_ref(OBJECT(ioc));
+    mux->ioc = ioc;
+    mux->nb_channels = nb_channels;
+    mux->refcnt = 1;
+    mux->channels = g_new0(QIOChannelMux *, nb_channels);
+    qemu_mutex_init(&mux->lock);
+    qemu_cond_init(&mux->cond);
+    return mux;
+}
+
+static void migration_mux_ref(MigrationMux *mux)
+{
+    qatomic_inc(&mux->refcnt);
+}
+
+static void migration_mux_unref(MigrationMux *mux)
+{
+    if (qatomic_fetch_dec(&mux->refcnt) != 1) {
+        return;
+    }
+
+    object_unref(OBJECT(mux->ioc));
+    error_free(mux->error);
+    g_free(mux->channels);
+    qemu_cond_destroy(&mux->cond);
+    qemu_mutex_destroy(&mux->lock);
+    g_free(mux);
+}
+
+static QIOChannelMux *migration_mux_open(MigrationMux *mux, unsigned int id)
+{
+    QIOChannelMux *mioc;
+    g_autofree char *name = NULL;
+
+    assert(id < mux->nb_channels);
+
+    mioc = QIO_CHANNEL_MUX(object_new(TYPE_QIO_CHANNEL_MUX));
+    migration_mux_ref(mux);
+    mioc->mux = mux;
+    mioc->id = id;
+
+    qemu_mutex_lock(&mux->lock);
+    assert(!mux->channels[id]);
+    mux->channels[id] = mioc;
+    mux->nb_open++;
+    qemu_mutex_unlock(&mux->lock);
+
+    name = g_strdup_printf("migration-mux-%u", id);
+    qio_channel_set_name(QIO_CHANNEL(mioc), name);
+    return mioc;
+}
+
+static void migration_mux_set_error(MigrationMux *mux, Error *err)
+{
+    qemu_mutex_lock(&mux->lock);
+    if (!mux->error) {
+        mux->error = err;
+    } else {
+        error_free(err);
+    }
+    qemu_cond_broadcast(&mux->cond);
+    qemu_mutex_unlock(&mux->lock);
+}
+
+QIOChannel *migration_mux_new_outgoing(QIOChannel *ioc,
+                                       unsigned int nb_channels,
+                                       Error **errp)
+{
+    MuxHeader hdr = {
+        .magic = cpu_to_be32(MUX_MAGIC),
+        .nb_channels = cpu_to_be32(nb_channels),
+    };
+    MigrationMux *mux;
+    QIOChannelMux *mioc;
+
+    if (qio_channel_write_all(ioc, (char *)&hdr, sizeof(hdr), errp) < 0) {
+        return NULL;
+    }
+
+    trace_migration_mux_new(nb_channels);
+
+    mux = migration_mux_new(ioc, nb_channels);
+    mioc = migration_mux_open(mux, 0);
+    migration_mux_unref(mux);
+
+    return QIO_CHANNEL(mioc);
+}
+
+QIOChannel *migration_mux_open_outgoing(QIOChannel *ioc, unsigned int id)
+{
+    QIOChannelMux *mioc = (QIOChannelMux *)object_dynamic_cast(
+        OBJECT(ioc), TYPE_QIO_CHANNEL_MUX);
+
+    if (!mioc) {
+        return NULL;
+    }
+    return QIO_CHANNEL(migration_mux_open(mioc->mux, id));
+}
+
+/* Splits the incoming stream into the queues of the channels */
+static void *migration_mux_demux_thread(void *opaque)
+{
+    MigrationMux *mux = opaque;
+    Error *local_err = NULL;
+
+    for (;;) {
+        MuxSegmentHeader hdr;
+        MuxSegment *seg;
+        uint32_t id;
+        int ret;
+
+        ret = qio_channel_read_all_eof(mux->ioc, (char *)&hdr, sizeof(hdr),
+                                       &local_err);
+        if (ret <= 0) {
+            break;
+        }
+
+        id = be32_to_cpu(hdr.id);
+        if (id >= mux->nb_channels) {
+            error_setg(&local_err, "Invalid multiplexed channel %u", id);
+            break;
+        }
+
+        seg = g_new0(MuxSegment, 1);
+        seg->len = be32_to_cpu(hdr.len);
+        seg->data = g_malloc(seg->len);
+        if (qio_channel_read_all(mux->ioc, (char *)seg->data, seg->len,
+                                 &local_err) < 0) {
+            g_free(seg->data);
+            g_free(seg);
+            break;
+        }
+
+        trace_migration_mux_segment(id, seg->len);
+
+        qemu_mutex_lock(&mux->lock);
+        if (mux->channels[id]) {
+            QSIMPLEQ_INSERT_TAIL(&mux->channels[id]->segments, seg, next);
+            seg = NULL;
+            qemu_cond_broadcast(&mux->cond);
+        }
+        qemu_mutex_unlock(&mux->lock);
+
+        /* Data for a channel that is gone is dropped */
+        if (seg) {
+            g_free(seg->data);
+            g_free(seg);
+        }
+    }
+
+    if (local_err) {
+        migration_mux_set_error(mux, local_err);
+    } else {
+        qemu_mutex_lock(&mux->lock);
+        mux->eof = true;
+        qemu_cond_broadcast(&mux->cond);
+        qemu_mutex_unlock(&mux->lock);
+    }
+
+    migration_mux_unref(mux);
+    return NULL;
+}
+
+void migration_mux_process_incoming(QIOChannel *ioc, unsigned int nb_channels)
+{
+    g_autofree QIOChannelMux **channels = NULL;
+    Error *local_err = NULL;
+    MigrationMux *mux;
+    QemuThread thread;
+    MuxHeader hdr;
+    unsigned int i;
+
+    if (qio_channel_read_all(ioc, (char *)&hdr, sizeof(hdr),
+                             &local_err) < 0) {
+        error_report_err(local_err);
+        return;
+    }
+    if (be32_to_cpu(hdr.magic) != MUX_MAGIC) {
+        error_report("Migration stream has no multifd channels; "
+                     "disable multifd on the destination");
+        return;
+    }
+    if (be32_to_cpu(hdr.nb_channels) != nb_channels) {
+        error_report("Migration stream has %u multifd channels, "
+                     "but %u are set up", be32_to_cpu(hdr.nb_channels) - 1,
+                     nb_channels - 1);
+        return;
+    }
+
+    trace_migration_mux_new(nb_channels);
+
+    /*
+     * All channels exist before the thread runs, so that no data is
+     * dropped, and the thread runs before the channels are processed,
+     * since that already reads from them.
+     */
+    mux = migration_mux_new(ioc, nb_channels);
+    mux->incoming = true;
+    channels = g_new(QIOChannelMux *, nb_channels);
+    for (i = 0; i < nb_channels; i++) {
+        channels[i] = migration_mux_open(mux, i);
+    }
+
+    /* The thread takes over the reference of the mux */
+    qemu_thread_create(&thread, "mig/demux", migration_mux_demux_thread,
+                       mux, QEMU_THREAD_DETACHED);
+
+    for (i = 0; i < nb_channels; i++) {
+        migration_channel_process_incoming(QIO_CHANNEL(channels[i]));
+        object_unref(OBJECT(channels[i]));
+    }
+}
+
+static void qio_channel_mux_finalize(Object *obj)
+{
+    QIOChannelMux *mioc = QIO_CHANNEL_MUX(obj);
+    MigrationMux *mux = mioc->mux;
+    MuxSegment *seg, *next_seg;
+    bool wake;
+
+    if (!mux) {
+        return;
+    }
+
+    qemu_mutex_lock(&mux->lock);
+    mux->channels[mioc->id] = NULL;
+    wake = --mux->nb_open == 0 && mux->incoming && !mux->eof && !mux->error;
+    QSIMPLEQ_FOREACH_SAFE(seg, &mioc->segments, next, next_seg) {
+        g_free(seg->data);
+        g_free(seg);
+    }
+    qemu_mutex_unlock(&mux->lock);
+
+    /* Wake up the demux thread if it still waits for data */
+    if (wake && qio_channel_has_feature(mux->ioc, QIO_CHANNEL_FEATURE_SHUTDOWN)) {
+        qio_channel_shutdown(mux->ioc, QIO_CHANNEL_SHUTDOWN_BOTH, NULL);
+    }
+
+    migration_mux_unref(mux);
+}
+
+static void qio_channel_mux_init(Object *obj)
+{
+    QIOChannelMux *mioc = QIO_CHANNEL_MUX(obj);
+
+    qio_channel_set_feature(QIO_CHANNEL(mioc), QIO_CHANNEL_FEATURE_SHUTDOWN);
+    QSIMPLEQ_INIT(&mioc->segments);
+}
+
+static ssize_t qio_channel_mux_readv(QIOChannel *ioc,
+                                     const struct iovec *iov,
+                                     size_t niov,
+                                     int **fds,
+                                     size_t *nfds,
+                                     int flags,
+                                     Error **errp)
+{
+    QIOChannelMux *mioc = QIO_CHANNEL_MUX(ioc);
+    MigrationMux *mux = mioc->mux;
+    size_t want = iov_size(iov, niov);
+    ssize_t done = 0;
+
+    qemu_mutex_lock(&mux->lock);
+    while (QSIMPLEQ_EMPTY(&mioc->segments)) {
+        if (mioc->shutdown || mux->eof) {
+            goto out;
+        }
+        if (mux->error) {
+            error_propagate(errp, error_copy(mux->error));
+            done = -1;
+            goto out;
+        }
+        qemu_cond_wait(&mux->cond, &mux->lock);
+    }
+
+    while (done < want && !QSIMPLEQ_EMPTY(&mioc->segments)) {
+        MuxSegment *seg = QSIMPLEQ_FIRST(&mioc->segments);
+        size_t n = MIN(want - done, seg->len - seg->offset);
+
+        iov_from_buf(iov, niov, done, seg->data + seg->offset, n);
+        seg->offset += n;
+        done += n;
+
+        if (seg->offset == seg->len) {
+            QSIMPLEQ_REMOVE_HEAD(&mioc->segments, next);
+            g_free(seg->data);
+            g_free(seg);
+        }
+    }
+
+out:
+    qemu_mutex_unlock(&mux->lock);
+    return done;
+}
+
+static ssize_t qio_channel_mux_writev(QIOChannel *ioc,
+                                      const struct iovec *iov,
+                                      size_t niov,
+                                      int *fds,
+                                      size_t nfds,
+                                      int flags,
+                                      Error **errp)
+{
+    QIOChannelMux *mioc = QIO_CHANNEL_MUX(ioc);
+    MigrationMux *mux = mioc->mux;
+    size_t len = iov_size(iov, niov);
+    MuxSegmentHeader hdr = {
+        .id = cpu_to_be32(mioc->id),
+        .len = cpu_to_be32(len),
+    };
+    g_autofree struct iovec *seg_iov = g_new(struct iovec, niov + 1);
+    int ret;
+
+    if (nfds) {
+        error_setg(errp, "Multiplexed channels cannot pass file descriptors");
+        return -1;
+    }
+    assert(len <= UINT32_MAX);
+
+    seg_iov[0].iov_base = &hdr;
+    seg_iov[0].iov_len = sizeof(hdr);
+    memcpy(seg_iov + 1, iov, niov * sizeof(*iov));
+
+    qemu_mutex_lock(&mux->lock);
+    if (mioc->shutdown) {
+        error_setg(errp, "Channel is shut down");
+        ret = -1;
+    } else {
+        ret = qio_channel_writev_all(mux->ioc, seg_iov, niov + 1, errp);
+    }
+    qemu_mutex_unlock(&mux->lock);
+
+    return ret < 0 ? -1 : len;
+}
+
+static int qio_channel_mux_set_blocking(QIOChannel *ioc,
+                                        bool enabled,
+                                        Error **errp)
+{
+    /* I/O always blocks; the underlying stream is driven by a thread */
+    return 0;
+}
+
+static int qio_channel_mux_shutdown(QIOChannel *ioc,
+                                    QIOChannelShutdown how,
+                                    Error **errp)
+{
+    QIOChannelMux *mioc = QIO_CHANNEL_MUX(ioc);
+    MigrationMux *mux = mioc->mux;
+
+    qemu_mutex_lock(&mux->lock);
+    mioc->shutdown = true;
+    qemu_cond_broadcast(&mux->cond);
+    qemu_mutex_unlock(&mux->lock);
+    return 0;
+}
+
+static int qio_channel_mux_close(QIOChannel *ioc,
+                                 Error **errp)
+{
+    return qio_channel_mux_shutdown(ioc, QIO_CHANNEL_SHUTDOWN_BOTH, errp);
+}
+
+static GSource *qio_channel_mux_create_watch(QIOChannel *ioc,
+                                             GIOCondition condition)
+{
+    return g_idle_source_new();
+}
+
+static void qio_channel_mux_set_aio_fd_handler(QIOChannel *ioc,
+                                               AioContext *read_ctx,
+                                               IOHandler *io_read,
+                                               AioContext *write_ctx,
+                                               IOHandler *io_write,
+                                               void *opaque)
+{
+}
+
+static void qio_channel_mux_class_init(ObjectClass *klass,
+                                       void *class_data G_GNUC_UNUSED)
+{
+    QIOChannelClass *ioc_klass = QIO_CHANNEL_CLASS(klass);
+
+    ioc_klass->io_writev = qio_channel_mux_writev;
+    ioc_klass->io_readv = qio_channel_mux_readv;
+    ioc_klass->io_set_blocking = qio_channel_mux_set_blocking;
+    ioc_klass->io_shutdown = qio_channel_mux_shutdown;
+    ioc_klass->io_close = qio_channel_mux_close;
+    ioc_klass->io_create_watch = qio_channel_mux_create_watch;
+    ioc_klass->io_set_aio_fd_handler = qio_channel_mux_set_aio_fd_handler;
+}
+
+static const TypeInfo qio_channel_mux_info = {
+    .parent = TYPE_QIO_CHANNEL,
+    .name = TYPE_QIO_CHANNEL_MUX,
+    .instance_size = sizeof(QIOChannelMux),
+    .instance_init = qio_channel_mux_init,
+    .instance_finalize = qio_channel_mux_finalize,
+    .class_init = qio_channel_mux_class_init,
+};
+
+static void qio_channel_mux_register_types(void)
+{
+    type_register_static(&qio_channel_mux_info);
+}
+
+type_init(qio_channel_mux_register_types);
@@ -0,0 +1,46 @@
+/*
+ * Several migration channels carried over a single stream
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_CHANNEL_MUX_H
+#define QEMU_MIGRATION_CHANNEL_MUX_H
+
+#include "io/channel.h"
+
+/**
+ * migration_mux_new_outgoing:
+ * @ioc: the stream to carry the channels
+ * @nb_channels: the number of channels, including the main one
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Writes the multiplexing header to @ioc and returns the main
+ * migration channel, channel 0, or NULL on error.
+ */
+QIOChannel *migration_mux_new_outgoing(QIOChannel *ioc,
+                                       unsigned int nb_channels,
+                                       Error **errp);
+
+/**
+ * migration_mux_open_outgoing:
+ * @ioc: the main migration channel
+ * @id: the channel to open
+ *
+ * Returns channel @id of the stream that carries @ioc, or NULL if
+ * @ioc is not a multiplexed channel.
+ */
+QIOChannel *migration_mux_open_outgoing(QIOChannel *ioc, unsigned int id);
+
+/**
+ * migration_mux_process_incoming:
+ * @ioc: the stream carrying the channels
+ * @nb_channels: the number of channels, including the main one
+ *
+ * Splits @ioc into its channels and hands each of them, main
+ * channel first, to migration_channel_process_incoming().
+ */
+void migration_mux_process_incoming(QIOChannel *ioc, unsigned int nb_channels);
+
+#endif
@@ -16,8 +16,10 @@
 
 #include "qemu/osdep.h"
 #include "channel.h"
+#include "channel-mux.h"
 #include "fd.h"
 #include "migration.h"
+#include "options.h"
 #include "monitor/monitor.h"
 #include "io/channel-util.h"
 #include "trace.h"
@@ -39,6 +41,17 @@ void fd_start_outgoing_migration(MigrationState *s, const char *fdname, Error **
     }
 
     qio_channel_set_name(ioc, "migration-fd-outgoing");
+    if (migrate_multifd()) {
+        /* The multifd channels share the fd with the main one */
+        QIOChannel *mioc = migration_mux_new_outgoing(
+            ioc, migrate_multifd_channels() + 1, errp);
+
+        object_unref(OBJECT(ioc));
+        if (!mioc) {
+            return;
+        }
+        ioc = mioc;
+    }
     migration_channel_connect(s, ioc, NULL, NULL);
     object_unref(OBJECT(ioc));
 }
@@ -47,7 +60,11 @@ static gboolean fd_accept_incoming_migration(QIOChannel *ioc,
                                              GIOCondition condition,
                                              gpointer opaque)
 {
-    migration_channel_process_incoming(ioc);
+    if (migrate_multifd()) {
+        migration_mux_process_incoming(ioc, migrate_multifd_channels() + 1);
+    } else {
+        migration_channel_process_incoming(ioc);
+    }
     object_unref(OBJECT(ioc));
     return G_SOURCE_REMOVE;
 }
@@ -0,0 +1,525 @@
+/*
+ * Incoming migration from a URL, downloaded with parallel range requests
+ *
+ * The stream is split into chunks which a few worker threads fetch ahead
+ * of the reader, so that loading device state and early RAM overlaps
+ * with downloading the rest of the snapshot.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/thread.h"
+#include "qemu/iov.h"
+#include "qapi/error.h"
+#include "io/channel.h"
+#include "channel.h"
+#include "fetch.h"
+#include "migration.h"
+#include "trace.h"
+
+#include <emscripten.h>
+
+#define FETCH_DEFAULT_CHUNK_SIZE    (1 * MiB)
+#define FETCH_MAX_CHUNK_SIZE        (64 * MiB)
+#define FETCH_DEFAULT_REQUESTS      4
+#define FETCH_MAX_REQUESTS          32
+
+#define TYPE_QIO_CHANNEL_FETCH "qio-channel-fetch"
+OBJECT_DECLARE_SIMPLE_TYPE(QIOChannelFetch, QIO_CHANNEL_FETCH)
+
+typedef enum {
+    FETCH_SLOT_EMPTY,
+    FETCH_SLOT_LOADING,
+    FETCH_SLOT_READY,
+    FETCH_SLOT_FAILED,
+} FetchSlotState;
+
+/* One chunk of the read-ahead window */
+typedef struct FetchSlot {
+    int64_t index;
+    FetchSlotState state;
+    uint8_t *data;
+} FetchSlot;
+
+struct QIOChannelFetch {
+    QIOChannel parent;
+
+    char *url;
+    uint64_t len;
+    uint64_t chunk_size;
+    int64_t nb_chunks;
+
+    QemuThread *threads;
+    unsigned int nb_threads;
+
+    /* Protected by lock */
+    QemuMutex lock;
+    QemuCond cond;
+    FetchSlot *slots;
+    unsigned int nb_slots;
+    uint64_t pos;
+    int64_t next_fetch;
+    bool stop;
+};
+
+/* Returns the size of the resource at @url, or -1 */
+EM_JS(double, migration_fetch_size_js, (const char *url), {
+        const xhr = new XMLHttpRequest();
+        xhr.open("HEAD", UTF8ToString(url), false);
+        try {
+            xhr.send();
+        } catch (e) {
+            return -1;
+        }
+        if (xhr.status < 200 || xhr.status >= 300) {
+            return -1;
+        }
+        const len = parseInt(xhr.getResponseHeader("Content-Length"), 10);
+        return isNaN(len) ? -1 : len;
+});
+
+/* Reads up to @len bytes at @offset into @buf; returns the count, or -1 */
+EM_JS(int, migration_fetch_range_js,
+      (const char *url, double offset, int len, uint8_t *buf), {
+        const xhr = new XMLHttpRequest();
+        xhr.open("GET", UTF8ToString(url), false);
+        // synchronous requests may only set the response type in workers
+        xhr.responseType = "arraybuffer";
+        xhr.setRequestHeader("Range", "bytes=" + offset + "-" + (offset + len - 1));
+        try {
+            xhr.send();
+        } catch (e) {
+            return -1;
+        }
+        let data;
+        if (xhr.status == 206) {
+            data = new Uint8Array(xhr.response);
+        } else if (xhr.status == 200) {
+            // the server ignored the range and sent the whole resource
+            data = new Uint8Array(xhr.response).subarray(offset);
+        } else {
+            return -1;
+        }
+        const n = Math.min(data.length, len);
+        new Uint8Array(wasmMemory.buffer, buf, n).set(data.subarray(0, n));
+        return n;
+});
+
+static uint64_t qio_channel_fetch_chunk_len(QIOChannelFetch *fioc,
+                                            int64_t index)
+{
+    return MIN(fioc->chunk_size, fioc->len - index * fioc->chunk_size);
+}
+
+/*
+ * Picks the next chunk of the window that is neither loaded nor being
+ * loaded, or -1 if there is none.  Called with lock held.
+ */
+static int64_t qio_channel_fetch_next_chunk(QIOChannelFetch *fioc)
+{
+    int64_t cur = fioc->pos / fioc->chunk_size;
+    int64_t end = MIN(cur + fioc->nb_slots, fioc->nb_chunks);
+    int64_t index;
+
+    for (index = MAX(fioc->next_fetch, cur); index < end; index++) {
+        if (fioc->slots[index % fioc->nb_slots].index != index) {
+            fioc->next_fetch = index + 1;
+            return index;
+        }
+    }
+    fioc->next_fetch = index;
+    return -1;
+}
+
+static void *qio_channel_fetch_worker(void *opaque)
+{
+    QIOChannelFetch *fioc = opaque;
+
+    qemu_mutex_lock(&fioc->lock);
+    while (!fioc->stop) {
+        int64_t index = qio_channel_fetch_next_chunk(fioc);
+        FetchSlot *slot;
+        uint64_t len;
+        uint8_t *buf;
+        int ret;
+
+        if (index < 0) {
+            qemu_cond_wait(&fioc->cond, &fioc->lock);
+            continue;
+        }
+
+        /*
+         * The chunk this slot held is behind the reader, so it can be
+         * dropped.  The new data is only installed once complete.
+         */
+        slot = &fioc->slots[index % fioc->nb_slots];
+        g_clear_pointer(&slot->data, g_free);
+        slot->index = index;
+        slot->state = FETCH_SLOT_LOADING;
+        len = qio_channel_fetch_chunk_len(fioc, index);
+        qemu_mutex_unlock(&fioc->lock);
+
+        trace_migration_fetch_chunk_start(index, len);
+        buf = g_malloc(len);
+        ret = migration_fetch_range_js(fioc->url, index * fioc->chunk_size,
+                                       len, buf);
+        trace_migration_fetch_chunk_done(index, ret);
+
+        qemu_mutex_lock(&fioc->lock);
+        if (slot->index == index && slot->state == FETCH_SLOT_LOADING) {
+            if (ret == len) {
+                slot->data = buf;
+                slot->state = FETCH_SLOT_READY;
+            } else {
+                g_free(buf);
+                slot->state = FETCH_SLOT_FAILED;
+            }
+        } else {
+            /* A seek moved the window away while the request ran */
+            g_free(buf);
+        }
+        qemu_cond_broadcast(&fioc->cond);
+    }
+    qemu_mutex_unlock(&fioc->lock);
+
+    return NULL;
+}
+
+static QIOChannelFetch *qio_channel_fetch_new(FetchMigrationArgs *args,
+                                              Error **errp)
+{
+    QIOChannelFetch *fioc;
+    uint64_t chunk_size = args->has_chunk_size ? args->chunk_size
+                                               : FETCH_DEFAULT_CHUNK_SIZE;
+    uint32_t requests = args->has_requests ? args->requests
+                                           : FETCH_DEFAULT_REQUESTS;
+    double len;
+    unsigned int i;
+
+    if (chunk_size < 4 * KiB || chunk_size > FETCH_MAX_CHUNK_SIZE) {
+        error_setg(errp, "chunk-size must be between 4k and %" PRIu64,
+                   (uint64_t)FETCH_MAX_CHUNK_SIZE);
+        return NULL;
+    }
+    if (requests < 1 || requests > FETCH_MAX_REQUESTS) {
+        error_setg(errp, "requests must be between 1 and %d",
+                   FETCH_MAX_REQUESTS);
+        return NULL;
+    }
+
+    len = migration_fetch_size_js(args->url);
+    if (len < 0) {
+        error_setg(errp, "Could not get the size of %s", args->url);
+        return NULL;
+    }
+
+    fioc = QIO_CHANNEL_FETCH(object_new(TYPE_QIO_CHANNEL_FETCH));
+    fioc->url = g_strdup(args->url);
+    fioc->len = len;
+    fioc->chunk_size = chunk_size;
+    fioc->nb_chunks = DIV_ROUND_UP(fioc->len, chunk_size);
+
+    /* Twice as many slots as requests keeps every worker busy */
+    fioc->nb_slots = requests * 2;
+    fioc->slots = g_new0(FetchSlot, fioc->nb_slots);
+    for (i = 0; i < fioc->nb_slots; i++) {
+        fioc->slots[i].index = -1;
+    }
+
+    fioc->nb_threads = requests;
+    fioc->threads = g_new0(QemuThread, requests);
+    for (i = 0; i < requests; i++) {
+        qemu_thread_create(&fioc->threads[i], "mig/fetch",
+                           qio_channel_fetch_worker, fioc,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    return fioc;
+}
+
+static void qio_channel_fetch_init(Object *obj)
+{
+    QIOChannelFetch *fioc = QIO_CHANNEL_FETCH(obj);
+
+    qemu_mutex_init(&fioc->lock);
+    qemu_cond_init(&fioc->cond);
+}
+
+static void qio_channel_fetch_stop(QIOChannelFetch *fioc)
+{
+    unsigned int i;
+
+    if (!fioc->threads) {
+        return;
+    }
+
+    qemu_mutex_lock(&fioc->lock);
+    fioc->stop = true;
+    qemu_cond_broadcast(&fioc->cond);
+    qemu_mutex_unlock(&fioc->lock);
+
+    for (i = 0; i < fioc->nb_threads; i++) {
+        qemu_thread_join(&fioc->threads[i]);
+    }
+    g_clear_pointer(&fioc->threads, g_free);
+
+    for (i = 0; i < fioc->nb_slots; i++) {
+        g_clear_pointer(&fioc->slots[i].data, g_free);
+        fioc->slots[i].index = -1;
+        fioc->slots[i].state = FETCH_SLOT_EMPTY;
+    }
+}
+
+static void qio_channel_fetch_finalize(Object *obj)
+{
+    QIOChannelFetch *fioc = QIO_CHANNEL_FETCH(obj);
+
+    qio_channel_fetch_stop(fioc);
+    g_free(fioc->slots);
+    g_free(fioc->url);
+    qemu_cond_destroy(&fioc->cond);
+    qemu_mutex_destroy(&fioc->lock);
+}
+
+static ssize_t qio_channel_fetch_readv(QIOChannel *ioc,
+                                       const struct iovec *iov,
+                                       size_t niov,
+                                       int **fds,
+                                       size_t *nfds,
+                                       int flags,
+                                       Error **errp)
+{
+    QIOChannelFetch *fioc = QIO_CHANNEL_FETCH(ioc);
+    size_t want = iov_size(iov, niov);
+    ssize_t ret = -1;
+    int64_t index;
+    FetchSlot *slot;
+    uint64_t start;
+    size_t n;
+
+    qemu_mutex_lock(&fioc->lock);
+    for (;;) {
+        if (fioc->stop) {
+            error_setg(errp, "Channel is closed");
+            goto out;
+        }
+        if (fioc->pos >= fioc->len || !want) {
+            ret = 0;
+            goto out;
+        }
+
+        index = fioc->pos / fioc->chunk_size;
+        slot = &fioc->slots[index % fioc->nb_slots];
+        if (slot->index == index) {
+            if (slot->state == FETCH_SLOT_READY) {
+                break;
+            }
+            if (slot->state == FETCH_SLOT_FAILED) {
+                error_setg(errp, "Could not read %s at offset %" PRIu64,
+                           fioc->url, index * fioc->chunk_size);
+                goto out;
+            }
+        } else if (fioc->next_fetch > index) {
+            /* The slot was reclaimed by a seek; request it again */
+            fioc->next_fetch = index;
+            qemu_cond_broadcast(&fioc->cond);
+        }
+        qemu_cond_wait(&fioc->cond, &fioc->lock);
+    }
+
+    start = index * fioc->chunk_size;
+    n = MIN(want, start + qio_channel_fetch_chunk_len(fioc, index) - fioc->pos);
+    iov_from_buf(iov, niov, 0, slot->data + (fioc->pos - start), n);
+    fioc->pos += n;
+    ret = n;
+
+    /* Moving into the next chunk frees a slot for the workers */
+    if (fioc->pos / fioc->chunk_size != index) {
+        qemu_cond_broadcast(&fioc->cond);
+    }
+
+out:
+    qemu_mutex_unlock(&fioc->lock);
+    return ret;
+}
+
+static ssize_t qio_channel_fetch_writev(QIOChannel *ioc,
+                                        const struct iovec *iov,
+                                        size_t niov,
+                                        int *fds,
+                                        size_t nfds,
+                                        int flags,
+                                        Error **errp)
+{
+    error_setg(errp, "fetch migration channels are read-only");
+    return -1;
+}
+
+static ssize_t qio_channel_fetch_pread(QIOChannel *ioc, char *buf,
+                                       size_t buflen, off_t offset,
+                                       Error **errp)
+{
+    QIOChannelFetch *fioc = QIO_CHANNEL_FETCH(ioc);
+    int ret;
+
+    if (offset >= fioc->len) {
+        return 0;
+    }
+
+    buflen = MIN(buflen, MIN(fioc->len - offset, INT_MAX));
+    ret = migration_fetch_range_js(fioc->url, offset, buflen, (uint8_t *)buf);
+    if (ret < 0) {
+        error_setg(errp, "Could not read %s at offset %" PRIu64,
+                   fioc->url, (uint64_t)offset);
+        return -1;
+    }
+    return ret;
+}
+
+static off_t qio_channel_fetch_seek(QIOChannel *ioc, off_t offset,
+                                    int whence, Error **errp)
+{
+    QIOChannelFetch *fioc = QIO_CHANNEL_FETCH(ioc);
+    int64_t cur;
+    unsigned int i;
+    off_t pos;
+
+    qemu_mutex_lock(&fioc->lock);
+    switch (whence) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = fioc->pos + offset;
+        break;
+    case SEEK_END:
+        pos = fioc->len + offset;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (pos < 0) {
+        qemu_mutex_unlock(&fioc->lock);
+        error_setg(errp, "Invalid seek offset");
+        return -1;
+    }
+
+    if (pos != fioc->pos) {
+        fioc->pos = pos;
+        cur = pos / fioc->chunk_size;
+
+        /* Drop the chunks that fall outside the new window */
+        for (i = 0; i < fioc->nb_slots; i++) {
+            FetchSlot *slot = &fioc->slots[i];
+
+            if (slot->index < cur || slot->index >= cur + fioc->nb_slots) {
+                g_clear_pointer(&slot->data, g_free);
+                slot->index = -1;
+                slot->state = FETCH_SLOT_EMPTY;
+            }
+        }
+        fioc->next_fetch = cur;
+        qemu_cond_broadcast(&fioc->cond);
+    }
+    qemu_mutex_unlock(&fioc->lock);
+
+    return pos;
+}
+
+static int qio_channel_fetch_set_blocking(QIOChannel *ioc, bool enabled,
+                                          Error **errp)
+{
+    if (!enabled) {
+        error_setg(errp, "Non-blocking mode not supported for fetch channels");
+        return -1;
+    }
+    return 0;
+}
+
+static int qio_channel_fetch_close(QIOChannel *ioc, Error **errp)
+{
+    /* Only the read-ahead stops; pread keeps working for lazy RAM load */
+    qio_channel_fetch_stop(QIO_CHANNEL_FETCH(ioc));
+    return 0;
+}
+
+static GSource *qio_channel_fetch_create_watch(QIOChannel *ioc,
+                                               GIOCondition condition)
+{
+    /* Reads block until data arrives, so the channel is always ready */
+    return g_idle_source_new();
+}
+
+static void qio_channel_fetch_set_aio_fd_handler(QIOChannel *ioc,
+                                                 AioContext *read_ctx,
+                                                 IOHandler *io_read,
+                                                 AioContext *write_ctx,
+                                                 IOHandler *io_write,
+                                                 void *opaque)
+{
+}
+
+static void qio_channel_fetch_class_init(ObjectClass *klass,
+                                         void *class_data G_GNUC_UNUSED)
+{
+    QIOChannelClass *ioc_klass = QIO_CHANNEL_CLASS(klass);
+
+    ioc_klass->io_writev = qio_channel_fetch_writev;
+    ioc_klass->io_readv = qio_channel_fetch_readv;
+    ioc_klass->io_pread = qio_channel_fetch_pread;
+    ioc_klass->io_set_blocking = qio_channel_fetch_set_blocking;
+    ioc_klass->io_seek = qio_channel_fetch_seek;
+    ioc_klass->io_close = qio_channel_fetch_close;
+    ioc_klass->io_create_watch = qio_channel_fetch_create_watch;
+    ioc_klass->io_set_aio_fd_handler = qio_channel_fetch_set_aio_fd_handler;
+}
+
+static const TypeInfo qio_channel_fetch_info = {
+    .parent = TYPE_QIO_CHANNEL,
+    .name = TYPE_QIO_CHANNEL_FETCH,
+    .instance_size = sizeof(QIOChannelFetch),
+    .instance_init = qio_channel_fetch_init,
+    .instance_finalize = qio_channel_fetch_finalize,
+    .class_init = qio_channel_fetch_class_init,
+};
+
+static void qio_channel_fetch_register_types(void)
+{
+    type_register_static(&qio_channel_fetch_info);
+}
+
+type_init(qio_channel_fetch_register_types);
+
+static gboolean fetch_accept_incoming_migration(QIOChannel *ioc,
+                                                GIOCondition condition,
+                                                gpointer opaque)
+{
+    migration_channel_process_incoming(ioc);
+    object_unref(OBJECT(ioc));
+    return G_SOURCE_REMOVE;
+}
+
+void fetch_start_incoming_migration(FetchMigrationArgs *fetch_args,
+                                    Error **errp)
+{
+    QIOChannelFetch *fioc;
+    QIOChannel *ioc;
+
+    fioc = qio_channel_fetch_new(fetch_args, errp);
+    if (!fioc) {
+        return;
+    }
+
+    trace_migration_fetch_incoming(fetch_args->url, fioc->len);
+
+    ioc = QIO_CHANNEL(fioc);
+    qio_channel_set_name(ioc, "migration-fetch-incoming");
+    qio_channel_add_watch_full(ioc, G_IO_IN,
+                               fetch_accept_incoming_migration,
+                               NULL, NULL,
+                               g_main_context_get_thread_default());
+}
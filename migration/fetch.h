@@ -0,0 +1,15 @@
+/*
+ * Incoming migration from a URL, downloaded with parallel range requests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_FETCH_H
+#define QEMU_MIGRATION_FETCH_H
+
+#include "qapi/qapi-types-migration.h"
+
+void fetch_start_incoming_migration(FetchMigrationArgs *fetch_args,
+                                    Error **errp);
+#endif
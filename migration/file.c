@@ -9,8 +9,10 @@
 #include "qemu/cutils.h"
 #include "qapi/error.h"
 #include "channel.h"
+#include "channel-mux.h"
 #include "file.h"
 #include "migration.h"
+#include "options.h"
 #include "io/channel-file.h"
 #include "io/channel-util.h"
 #include "trace.h"
@@ -40,13 +42,16 @@ void file_start_outgoing_migration(MigrationState *s,
                                    FileMigrationArgs *file_args, Error **errp)
 {
     g_autoptr(QIOChannelFile) fioc = NULL;
+    g_autoptr(QIOChannel) mioc = NULL;
     g_autofree char *filename = g_strdup(file_args->filename);
     uint64_t offset = file_args->offset;
+    /* dedup-pages reads back pages from the file to compare them */
+    int flags = migrate_dedup_pages() ? O_RDWR : O_WRONLY;
     QIOChannel *ioc;
 
     trace_migration_file_outgoing(filename);
 
-    fioc = qio_channel_file_new_path(filename, O_CREAT | O_WRONLY | O_TRUNC,
+    fioc = qio_channel_file_new_path(filename, O_CREAT | flags | O_TRUNC,
                                      0600, errp);
     if (!fioc) {
         return;
@@ -57,6 +62,15 @@ void file_start_outgoing_migration(MigrationState *s,
         return;
     }
     qio_channel_set_name(ioc, "migration-file-outgoing");
+    if (migrate_multifd()) {
+        /* The multifd channels share the file with the main one */
+        mioc = migration_mux_new_outgoing(ioc, migrate_multifd_channels() + 1,
+                                          errp);
+        if (!mioc) {
+            return;
+        }
+        ioc = mioc;
+    }
     migration_channel_connect(s, ioc, NULL, NULL);
 }
 
@@ -64,7 +78,11 @@ static gboolean file_accept_incoming_migration(QIOChannel *ioc,
                                                GIOCondition condition,
                                                gpointer opaque)
 {
-    migration_channel_process_incoming(ioc);
+    if (migrate_multifd()) {
+        migration_mux_process_incoming(ioc, migrate_multifd_channels() + 1);
+    } else {
+        migration_channel_process_incoming(ioc);
+    }
     object_unref(OBJECT(ioc));
     return G_SOURCE_REMOVE;
 }
@@ -186,6 +186,27 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->compression->compression_rate);
     }
 
+    if (info->stages) {
+        uint64List *bucket;
+
+        monitor_printf(mon, "bitmap sync time: %" PRIu64 " us\n",
+                       info->stages->bitmap_sync);
+        monitor_printf(mon, "page scan time: %" PRIu64 " us\n",
+                       info->stages->page_scan);
+        monitor_printf(mon, "compression time: %" PRIu64 " us\n",
+                       info->stages->compression);
+        monitor_printf(mon, "channel write time: %" PRIu64 " us\n",
+                       info->stages->channel_write);
+        monitor_printf(mon, "device save time: %" PRIu64 " us\n",
+                       info->stages->device_save);
+        monitor_printf(mon, "iterations by log2(ms):");
+        for (bucket = info->stages->iteration_histogram; bucket;
+             bucket = bucket->next) {
+            monitor_printf(mon, " %" PRIu64, bucket->value);
+        }
+        monitor_printf(mon, "\n");
+    }
+
     if (info->has_cpu_throttle_percentage) {
         monitor_printf(mon, "cpu throttle percentage: %" PRIu64 "\n",
                        info->cpu_throttle_percentage);
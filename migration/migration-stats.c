@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/stats64.h"
+#include "qemu/host-utils.h"
 #include "qemu-file.h"
 #include "trace.h"
 #include "migration-stats.h"
@@ -68,3 +69,33 @@ uint64_t migration_transferred_bytes(void)
     trace_migration_transferred_bytes(qemu_file, multifd, rdma);
     return qemu_file + multifd + rdma;
 }
+
+void migration_stage_end(MigrationStage stage, int64_t start)
+{
+    stat64_add(&mig_stats.stage_ns[stage], get_clock() - start);
+}
+
+uint64_t migration_stage_us(MigrationStage stage)
+{
+    return stat64_get(&mig_stats.stage_ns[stage]) / SCALE_US;
+}
+
+void migration_iteration_end(int64_t start)
+{
+    uint64_t us = (get_clock() - start) / SCALE_US;
+    int bucket = 0;
+
+    /* Bucket i holds the iterations of less than 2^i milliseconds */
+    if (us >= 1000) {
+        bucket = MIN(64 - clz64(us / 1000), MIGRATION_ITERATION_BUCKETS - 1);
+    }
+    stat64_add(&mig_stats.iteration_histogram[bucket], 1);
+
+    trace_migration_iteration_end(
+        us,
+        migration_stage_us(MIGRATION_STAGE_BITMAP_SYNC),
+        migration_stage_us(MIGRATION_STAGE_PAGE_SCAN),
+        migration_stage_us(MIGRATION_STAGE_COMPRESSION),
+        migration_stage_us(MIGRATION_STAGE_CHANNEL_WRITE),
+        migration_stage_us(MIGRATION_STAGE_DEVICE_SAVE));
+}
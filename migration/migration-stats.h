@@ -14,6 +14,7 @@
 #define QEMU_MIGRATION_STATS_H
 
 #include "qemu/stats64.h"
+#include "qemu/timer.h"
 
 /*
  * Amount of time to allocate to each "chunk" of bandwidth-throttled
@@ -27,6 +28,25 @@
  */
 #define RATE_LIMIT_DISABLED 0
 
+/*
+ * Stages of a migration that we account the time spent in.
+ */
+typedef enum {
+    MIGRATION_STAGE_BITMAP_SYNC,
+    MIGRATION_STAGE_PAGE_SCAN,
+    MIGRATION_STAGE_COMPRESSION,
+    MIGRATION_STAGE_CHANNEL_WRITE,
+    MIGRATION_STAGE_DEVICE_SAVE,
+    MIGRATION_STAGE__MAX,
+} MigrationStage;
+
+/*
+ * Number of buckets of the iteration histogram.  Bucket i counts the
+ * iterations that took less than 2^i milliseconds, the last one all
+ * the longer ones.
+ */
+#define MIGRATION_ITERATION_BUCKETS 12
+
 /*
  * These are the ram migration statistic counters.  It is loosely
  * based on MigrationStats.  We change to Stat64 any counter that
@@ -60,6 +80,10 @@ typedef struct {
      * guest is stopped.
      */
     Stat64 downtime_bytes;
+    /*
+     * Number of iterations of the migration thread by duration.
+     */
+    Stat64 iteration_histogram[MIGRATION_ITERATION_BUCKETS];
     /*
      * Number of bytes sent through multifd channels.
      */
@@ -97,6 +121,11 @@ typedef struct {
      * Number of bytes sent through RDMA.
      */
     Stat64 rdma_bytes;
+    /*
+     * Number of nanoseconds spent in each MigrationStage, summed over
+     * all the threads that do that work.
+     */
+    Stat64 stage_ns[MIGRATION_STAGE__MAX];
     /*
      * Number of pages transferred that were full of zeros.
      */
@@ -136,4 +165,42 @@ void migration_rate_set(uint64_t new_rate);
  * channel, multifd, qemu_file, rdma, ....
  */
 uint64_t migration_transferred_bytes(void);
+
+/**
+ * migration_stage_start: Start timing a stage of the migration
+ *
+ * Returns the time to pass to migration_stage_end().
+ */
+static inline int64_t migration_stage_start(void)
+{
+    return get_clock();
+}
+
+/**
+ * migration_stage_end: Account the time spent in a stage
+ *
+ * Adds the time since @start to the counter of @stage.
+ *
+ * @stage: the stage that was timed
+ * @start: the return value of migration_stage_start()
+ */
+void migration_stage_end(MigrationStage stage, int64_t start);
+
+/**
+ * migration_stage_us: Get the time spent in a stage
+ *
+ * Returns the number of microseconds accounted to @stage.
+ *
+ * @stage: the stage
+ */
+uint64_t migration_stage_us(MigrationStage stage);
+
+/**
+ * migration_iteration_end: Account an iteration of the migration thread
+ *
+ * Adds the iteration that started at @start to the iteration histogram.
+ *
+ * @start: the return value of migration_stage_start()
+ */
+void migration_iteration_end(int64_t start);
 #endif
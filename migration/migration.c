@@ -21,6 +21,9 @@
 #include "exec.h"
 #include "fd.h"
 #include "file.h"
+#ifdef CONFIG_WASM_MIGRATION
+#include "fetch.h"
+#endif
 #include "socket.h"
 #include "sysemu/runstate.h"
 #include "sysemu/sysemu.h"
@@ -132,7 +135,10 @@ static bool transport_supports_multi_channels(SocketAddress *saddr)
 {
     return saddr->type == SOCKET_ADDRESS_TYPE_INET ||
            saddr->type == SOCKET_ADDRESS_TYPE_UNIX ||
-           saddr->type == SOCKET_ADDRESS_TYPE_VSOCK;
+           saddr->type == SOCKET_ADDRESS_TYPE_VSOCK ||
+           /* multifd channels are multiplexed over the single fd */
+           (saddr->type == SOCKET_ADDRESS_TYPE_FD && migrate_multifd() &&
+            !migrate_postcopy_preempt());
 }
 
 static bool
@@ -146,6 +152,22 @@ migration_channels_and_transport_compatible(MigrationAddress *addr,
         return false;
     }
 
+    if (migrate_mapped_ram() &&
+        addr->transport != MIGRATION_ADDRESS_TYPE_FILE
+#ifdef CONFIG_WASM_MIGRATION
+        && addr->transport != MIGRATION_ADDRESS_TYPE_FETCH
+#endif
+        ) {
+        error_setg(errp, "Migration with mapped-ram requires a file URI");
+        return false;
+    }
+
+    if (migrate_dedup_pages() &&
+        addr->transport != MIGRATION_ADDRESS_TYPE_FILE) {
+        error_setg(errp, "Migration with dedup-pages requires a file URI");
+        return false;
+    }
+
     return true;
 }
 
@@ -464,6 +486,7 @@ bool migrate_uri_parse(const char *uri, MigrationChannel **channel,
     g_autoptr(MigrationAddress) addr = g_new0(MigrationAddress, 1);
     InetSocketAddress *isock = &addr->u.rdma;
     strList **tail = &addr->u.exec.args;
+    const char *rest;
 
     if (strstart(uri, "exec:", NULL)) {
         addr->transport = MIGRATION_ADDRESS_TYPE_EXEC;
@@ -501,6 +524,26 @@ bool migrate_uri_parse(const char *uri, MigrationChannel **channel,
                               errp)) {
             return false;
         }
+#ifdef CONFIG_WASM_MIGRATION
+    } else if (strstart(uri, "fetch:", NULL)) {
+        addr->transport = MIGRATION_ADDRESS_TYPE_FETCH;
+        addr->u.fetch.url = g_strdup(uri + strlen("fetch:"));
+#endif
+    } else if (strstart(uri, "ws://", &rest) ||
+               strstart(uri, "wss://", &rest)) {
+        WebsocketMigrationArgs *ws = &addr->u.websocket;
+        const char *path = strchr(rest, '/');
+        g_autofree char *hostport = path ? g_strndup(rest, path - rest)
+                                         : g_strdup(rest);
+
+        addr->transport = MIGRATION_ADDRESS_TYPE_WEBSOCKET;
+        ws->addr = g_new0(InetSocketAddress, 1);
+        if (inet_parse(ws->addr, hostport, errp)) {
+            return false;
+        }
+        ws->path = g_strdup(path ? path : "/");
+        ws->has_secure = true;
+        ws->secure = strstart(uri, "wss://", NULL);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
         return false;
@@ -584,6 +627,12 @@ static void qemu_start_incoming_migration(const char *uri, bool has_channels,
         exec_start_incoming_migration(addr->u.exec.args, errp);
     } else if (addr->transport == MIGRATION_ADDRESS_TYPE_FILE) {
         file_start_incoming_migration(&addr->u.file, errp);
+#ifdef CONFIG_WASM_MIGRATION
+    } else if (addr->transport == MIGRATION_ADDRESS_TYPE_FETCH) {
+        fetch_start_incoming_migration(&addr->u.fetch, errp);
+#endif
+    } else if (addr->transport == MIGRATION_ADDRESS_TYPE_WEBSOCKET) {
+        websocket_start_incoming_migration(&addr->u.websocket, errp);
     } else {
         error_setg(errp, "unknown migration protocol: %s", uri);
     }
@@ -1087,6 +1136,21 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->downtime_bytes = stat64_get(&mig_stats.downtime_bytes);
     info->ram->postcopy_bytes = stat64_get(&mig_stats.postcopy_bytes);
 
+    info->stages = g_malloc0(sizeof(*info->stages));
+    info->stages->bitmap_sync =
+        migration_stage_us(MIGRATION_STAGE_BITMAP_SYNC);
+    info->stages->page_scan = migration_stage_us(MIGRATION_STAGE_PAGE_SCAN);
+    info->stages->compression =
+        migration_stage_us(MIGRATION_STAGE_COMPRESSION);
+    info->stages->channel_write =
+        migration_stage_us(MIGRATION_STAGE_CHANNEL_WRITE);
+    info->stages->device_save =
+        migration_stage_us(MIGRATION_STAGE_DEVICE_SAVE);
+    for (int i = MIGRATION_ITERATION_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(info->stages->iteration_histogram,
+                          stat64_get(&mig_stats.iteration_histogram[i]));
+    }
+
     if (migrate_xbzrle()) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
@@ -1968,6 +2032,13 @@ void qmp_migrate(const char *uri, bool has_channels,
         return;
     }
 
+#ifdef CONFIG_WASM_MIGRATION
+    if (addr->transport == MIGRATION_ADDRESS_TYPE_FETCH) {
+        error_setg(errp, "fetch URIs can only be used for incoming migration");
+        return;
+    }
+#endif
+
     resume_requested = has_resume && resume;
     if (!migrate_prepare(s, has_blk && blk, has_inc && inc,
                          resume_requested, errp)) {
@@ -1998,6 +2069,8 @@ void qmp_migrate(const char *uri, bool has_channels,
         exec_start_outgoing_migration(s, addr->u.exec.args, &local_err);
     } else if (addr->transport == MIGRATION_ADDRESS_TYPE_FILE) {
         file_start_outgoing_migration(s, &addr->u.file, &local_err);
+    } else if (addr->transport == MIGRATION_ADDRESS_TYPE_WEBSOCKET) {
+        websocket_start_outgoing_migration(s, &addr->u.websocket, &local_err);
     } else {
         error_setg(&local_err, QERR_INVALID_PARAMETER_VALUE, "uri",
                    "a valid migration protocol");
@@ -3113,7 +3186,9 @@ static MigIterateState migration_iteration_run(MigrationState *s)
     }
 
     /* Just another iteration step */
+    int64_t start = migration_stage_start();
     qemu_savevm_state_iterate(s->to_dst_file, in_postcopy);
+    migration_iteration_end(start);
     return MIG_ITERATE_RESUME;
 }
 
@@ -3490,7 +3565,10 @@ static void *bg_migration_thread(void *opaque)
      */
     qemu_fflush(fb);
 
-    /* Now initialize UFFD context and start tracking RAM writes */
+    /*
+     * Now initialize UFFD context and start tracking RAM writes, or let
+     * TCG copy the pages the guest writes to if UFFD-WP is not available
+     */
     if (ram_write_tracking_start()) {
         goto fail;
     }
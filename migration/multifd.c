@@ -21,6 +21,7 @@
 #include "migration.h"
 #include "migration-stats.h"
 #include "socket.h"
+#include "channel-mux.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -693,7 +694,10 @@ static void *multifd_send_thread(void *opaque)
             }
 
             if (p->normal_num) {
+                int64_t start = migration_stage_start();
+
                 ret = multifd_send_state->ops->send_prepare(p, &local_err);
+                migration_stage_end(MIGRATION_STAGE_COMPRESSION, start);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
@@ -896,6 +900,22 @@ static void multifd_new_send_channel_async(QIOTask *task, gpointer opaque)
 
 static void multifd_new_send_channel_create(gpointer opaque)
 {
+    MultiFDSendParams *p = opaque;
+    MigrationState *s = migrate_get_current();
+    QIOChannel *ioc;
+
+    ioc = migration_mux_open_outgoing(qemu_file_get_ioc(s->to_dst_file),
+                                      p->id + 1);
+
+    if (ioc) {
+        /* Single-stream transports carry the channels next to the main one */
+        QIOTask *task = qio_task_new(OBJECT(ioc),
+                                     multifd_new_send_channel_async,
+                                     opaque, NULL);
+        qio_task_complete(task);
+        return;
+    }
+
     socket_send_channel_create(multifd_new_send_channel_async, opaque);
 }
 
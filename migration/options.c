@@ -29,6 +29,7 @@
 #include "ram.h"
 #include "options.h"
 #include "sysemu/kvm.h"
+#include "sysemu/tcg.h"
 
 /* Maximum migrate downtime set to 2000 seconds */
 #define MAX_MIGRATE_DOWNTIME_SECONDS 2000
@@ -204,6 +205,15 @@ Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-switchover-ack",
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
+    DEFINE_PROP_MIG_CAP("x-mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-lazy-ram-load", MIGRATION_CAPABILITY_LAZY_RAM_LOAD),
+    DEFINE_PROP_MIG_CAP("x-dedup-pages", MIGRATION_CAPABILITY_DEDUP_PAGES),
+    DEFINE_PROP_MIG_CAP("x-incremental-snapshot",
+                        MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-prioritized-snapshot",
+                        MIGRATION_CAPABILITY_PRIORITIZED_SNAPSHOT),
+    DEFINE_PROP_MIG_CAP("x-compressed-ram",
+                        MIGRATION_CAPABILITY_COMPRESSED_RAM),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -242,6 +252,20 @@ bool migrate_compress(void)
     return s->capabilities[MIGRATION_CAPABILITY_COMPRESS];
 }
 
+bool migrate_compressed_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_COMPRESSED_RAM];
+}
+
+bool migrate_dedup_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_DEDUP_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -263,6 +287,13 @@ bool migrate_events(void)
     return s->capabilities[MIGRATION_CAPABILITY_EVENTS];
 }
 
+bool migrate_incremental_snapshot(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -277,6 +308,20 @@ bool migrate_late_block_activate(void)
     return s->capabilities[MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE];
 }
 
+bool migrate_lazy_ram_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_LAZY_RAM_LOAD];
+}
+
+bool migrate_mapped_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
+}
+
 bool migrate_multifd(void)
 {
     MigrationState *s = migrate_get_current();
@@ -312,6 +357,13 @@ bool migrate_postcopy_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_prioritized_snapshot(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PRIORITIZED_SNAPSHOT];
+}
+
 bool migrate_rdma_pin_all(void)
 {
     MigrationState *s = migrate_get_current();
@@ -454,6 +506,47 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
     MIGRATION_CAPABILITY_ZERO_COPY_SEND);
 
+/* Mapped-ram compatibility check list */
+static const
+INITIALIZE_MIGRATE_CAPS_SET(check_caps_mapped_ram,
+    MIGRATION_CAPABILITY_POSTCOPY_RAM,
+    MIGRATION_CAPABILITY_POSTCOPY_PREEMPT,
+    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_RELEASE_RAM,
+    MIGRATION_CAPABILITY_RDMA_PIN_ALL,
+    MIGRATION_CAPABILITY_COMPRESS,
+    MIGRATION_CAPABILITY_XBZRLE,
+    MIGRATION_CAPABILITY_X_COLO,
+    MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT,
+    MIGRATION_CAPABILITY_DEDUP_PAGES);
+
+/* Dedup-pages compatibility check list */
+static const
+INITIALIZE_MIGRATE_CAPS_SET(check_caps_dedup_pages,
+    MIGRATION_CAPABILITY_POSTCOPY_RAM,
+    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_RELEASE_RAM,
+    MIGRATION_CAPABILITY_RDMA_PIN_ALL,
+    MIGRATION_CAPABILITY_COMPRESS,
+    MIGRATION_CAPABILITY_XBZRLE,
+    MIGRATION_CAPABILITY_X_COLO);
+
+/* Incremental-snapshot compatibility check list */
+static const
+INITIALIZE_MIGRATE_CAPS_SET(check_caps_incremental_snapshot,
+    MIGRATION_CAPABILITY_POSTCOPY_RAM,
+    MIGRATION_CAPABILITY_POSTCOPY_PREEMPT,
+    MIGRATION_CAPABILITY_MULTIFD,
+    MIGRATION_CAPABILITY_RELEASE_RAM,
+    MIGRATION_CAPABILITY_RDMA_PIN_ALL,
+    MIGRATION_CAPABILITY_COMPRESS,
+    MIGRATION_CAPABILITY_XBZRLE,
+    MIGRATION_CAPABILITY_X_COLO,
+    MIGRATION_CAPABILITY_BACKGROUND_SNAPSHOT,
+    MIGRATION_CAPABILITY_X_IGNORE_SHARED,
+    MIGRATION_CAPABILITY_MAPPED_RAM,
+    MIGRATION_CAPABILITY_DEDUP_PAGES);
+
 static bool migrate_incoming_started(void)
 {
     return !!migration_incoming_get_current()->transport_data;
@@ -645,6 +738,86 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        int idx;
+
+        for (idx = 0; idx < check_caps_mapped_ram.size; idx++) {
+            int incomp_cap = check_caps_mapped_ram.caps[idx];
+            if (new_caps[incomp_cap]) {
+                error_setg(errp, "Mapped-ram is not compatible with %s",
+                           MigrationCapability_str(incomp_cap));
+                return false;
+            }
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_DEDUP_PAGES]) {
+        int idx;
+
+        for (idx = 0; idx < check_caps_dedup_pages.size; idx++) {
+            int incomp_cap = check_caps_dedup_pages.caps[idx];
+            if (new_caps[incomp_cap]) {
+                error_setg(errp, "Dedup-pages is not compatible with %s",
+                           MigrationCapability_str(incomp_cap));
+                return false;
+            }
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_INCREMENTAL_SNAPSHOT]) {
+        int idx;
+
+        for (idx = 0; idx < check_caps_incremental_snapshot.size; idx++) {
+            int incomp_cap = check_caps_incremental_snapshot.caps[idx];
+            if (new_caps[incomp_cap]) {
+                error_setg(errp,
+                           "Incremental-snapshot is not compatible with %s",
+                           MigrationCapability_str(incomp_cap));
+                return false;
+            }
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_PRIORITIZED_SNAPSHOT] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Capability 'prioritized-snapshot' requires "
+                         "capability 'mapped-ram'");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_COMPRESSED_RAM]) {
+#ifndef CONFIG_ZSTD
+        error_setg(errp, "compressed-ram requires QEMU built with zstd");
+        return false;
+#endif
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'compressed-ram' requires "
+                             "capability 'mapped-ram'");
+            return false;
+        }
+        if (new_caps[MIGRATION_CAPABILITY_PRIORITIZED_SNAPSHOT]) {
+            error_setg(errp, "compressed-ram is not compatible with "
+                             "prioritized-snapshot");
+            return false;
+        }
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_LAZY_RAM_LOAD]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'lazy-ram-load' requires capability "
+                             "'mapped-ram'");
+            return false;
+        }
+        if (!tcg_enabled()) {
+            error_setg(errp, "lazy-ram-load requires the TCG accelerator");
+            return false;
+        }
+        if (migrate_incoming_started()) {
+            error_setg(errp, "lazy-ram-load must be set before incoming starts");
+            return false;
+        }
+    }
+
     return true;
 }
 
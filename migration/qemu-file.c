@@ -273,6 +273,8 @@ int qemu_fflush(QEMUFile *f)
     }
     if (f->iovcnt > 0) {
         Error *local_error = NULL;
+        int64_t start = migration_stage_start();
+
         if (qio_channel_writev_all(f->ioc,
                                    f->iov, f->iovcnt,
                                    &local_error) < 0) {
@@ -281,6 +283,7 @@ int qemu_fflush(QEMUFile *f)
             uint64_t size = iov_size(f->iov, f->iovcnt);
             stat64_add(&mig_stats.qemu_file_transferred, size);
         }
+        migration_stage_end(MIGRATION_STAGE_CHANNEL_WRITE, start);
 
         qemu_iovec_release_ram(f);
     }
@@ -834,3 +837,95 @@ int qemu_file_get_to_fd(QEMUFile *f, int fd, size_t size)
 
     return 0;
 }
+
+/*
+ * Move the stream position of a seekable QEMUFile.  Buffered output
+ * is flushed first and any read-ahead input is dropped, so the next
+ * qemu_put_*() or qemu_get_*() operates at the new position.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *err = NULL;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        if (whence == SEEK_CUR) {
+            off -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    if (qio_channel_io_seek(f->ioc, off, whence, &err) == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+    }
+}
+
+/*
+ * Return the position in the underlying channel of the next byte
+ * that qemu_put_*() will write or qemu_get_*() will return.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    }
+
+    ret = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &err);
+    if (ret == (off_t)-1) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return ret;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        ret -= f->buf_size - f->buf_index;
+    }
+    return ret;
+}
+
+/*
+ * Write buflen bytes at the absolute position pos of the channel,
+ * bypassing the stream buffer and leaving the stream position alone.
+ */
+void qemu_put_buffer_at(QEMUFile *f, const uint8_t *buf, size_t buflen,
+                        off_t pos)
+{
+    Error *err = NULL;
+    int64_t start;
+
+    if (f->last_error) {
+        return;
+    }
+
+    start = migration_stage_start();
+    if (qio_channel_pwrite(f->ioc, (const char *)buf, buflen, pos, &err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, err);
+    }
+    migration_stage_end(MIGRATION_STAGE_CHANNEL_WRITE, start);
+}
+
+/*
+ * Read buflen bytes from the absolute position pos of the channel,
+ * bypassing the stream buffer and leaving the stream position alone.
+ *
+ * Returns the number of bytes read, which is 0 on error.
+ */
+size_t qemu_get_buffer_at(QEMUFile *f, uint8_t *buf, size_t buflen,
+                          off_t pos)
+{
+    Error *err = NULL;
+
+    if (f->last_error) {
+        return 0;
+    }
+
+    if (qio_channel_pread(f->ioc, (char *)buf, buflen, pos, &err) < 0) {
+        qemu_file_set_error_obj(f, -EIO, err);
+        return 0;
+    }
+    return buflen;
+}
@@ -0,0 +1,154 @@
+/*
+ * zstd compression of RAM chunks for compressed-ram
+ *
+ * Each chunk is compressed on its own, so that it can be decompressed
+ * without the others.  The chunks of one call to ram_chunks_compress()
+ * are shared between the threads on a first come, first served basis.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <zstd.h>
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
+#include "qapi/error.h"
+#include "ram-chunks.h"
+
+struct RAMChunksCompress {
+    QemuThread *threads;
+    unsigned int nr_threads;
+    int level;
+    /* Posted once per thread for each call, and to make them quit */
+    QemuSemaphore work;
+    /* Posted by each thread when there are no chunks left */
+    QemuSemaphore done;
+    bool quit;
+    RAMChunk *chunks;
+    unsigned int nr_chunks;
+    unsigned int next;
+    bool failed;
+};
+
+size_t ram_chunks_bound(size_t len)
+{
+    return ZSTD_compressBound(len);
+}
+
+static void *ram_chunks_thread(void *opaque)
+{
+    RAMChunksCompress *c = opaque;
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    while (true) {
+        unsigned int i;
+
+        qemu_sem_wait(&c->work);
+        if (qatomic_read(&c->quit)) {
+            break;
+        }
+
+        while ((i = qatomic_fetch_inc(&c->next)) < c->nr_chunks) {
+            RAMChunk *chunk = &c->chunks[i];
+            size_t ret = -1;
+
+            if (cctx) {
+                ret = ZSTD_compressCCtx(cctx, chunk->buf,
+                                        ZSTD_compressBound(chunk->len),
+                                        chunk->data, chunk->len, c->level);
+            }
+            if (!cctx || ZSTD_isError(ret)) {
+                qatomic_set(&c->failed, true);
+                ret = 0;
+            }
+            chunk->size = ret;
+        }
+        qemu_sem_post(&c->done);
+    }
+
+    ZSTD_freeCCtx(cctx);
+    return NULL;
+}
+
+RAMChunksCompress *ram_chunks_compress_new(unsigned int threads, int level)
+{
+    RAMChunksCompress *c = g_new0(RAMChunksCompress, 1);
+    unsigned int i;
+
+    c->nr_threads = MAX(threads, 1);
+    c->level = level;
+    qemu_sem_init(&c->work, 0);
+    qemu_sem_init(&c->done, 0);
+
+    c->threads = g_new0(QemuThread, c->nr_threads);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_create(&c->threads[i], "mig/ram-zstd", ram_chunks_thread,
+                           c, QEMU_THREAD_JOINABLE);
+    }
+    return c;
+}
+
+int ram_chunks_compress(RAMChunksCompress *c, RAMChunk *chunks,
+                        unsigned int nr_chunks, Error **errp)
+{
+    unsigned int i;
+
+    c->chunks = chunks;
+    c->nr_chunks = nr_chunks;
+    c->next = 0;
+    c->failed = false;
+
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_post(&c->work);
+    }
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_wait(&c->done);
+    }
+
+    if (c->failed) {
+        error_setg(errp, "zstd compression of RAM failed");
+        return -1;
+    }
+    return 0;
+}
+
+void ram_chunks_compress_free(RAMChunksCompress *c)
+{
+    unsigned int i;
+
+    if (!c) {
+        return;
+    }
+
+    qatomic_set(&c->quit, true);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_post(&c->work);
+    }
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_join(&c->threads[i]);
+    }
+
+    qemu_sem_destroy(&c->work);
+    qemu_sem_destroy(&c->done);
+    g_free(c->threads);
+    g_free(c);
+}
+
+bool ram_chunks_decompress(uint8_t *dst, size_t len, const uint8_t *src,
+                           size_t size, Error **errp)
+{
+    size_t ret = ZSTD_decompress(dst, len, src, size);
+
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "zstd decompression of RAM failed: %s",
+                   ZSTD_getErrorName(ret));
+        return false;
+    }
+    if (ret != len) {
+        error_setg(errp, "compressed RAM chunk has %zu bytes, expected %zu",
+                   ret, len);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+ * zstd compression of RAM chunks for compressed-ram
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_RAM_CHUNKS_H
+#define QEMU_MIGRATION_RAM_CHUNKS_H
+
+typedef struct RAMChunk {
+    /* Uncompressed contents */
+    const uint8_t *data;
+    size_t len;
+    /* At least ram_chunks_bound(len) bytes */
+    uint8_t *buf;
+    /* Compressed size, set by ram_chunks_compress() */
+    size_t size;
+} RAMChunk;
+
+typedef struct RAMChunksCompress RAMChunksCompress;
+
+#ifdef CONFIG_ZSTD
+
+/**
+ * ram_chunks_bound:
+ * @len: size of a chunk
+ *
+ * Returns the largest size that the compressed chunk can have.
+ */
+size_t ram_chunks_bound(size_t len);
+
+/**
+ * ram_chunks_compress_new:
+ * @threads: the number of compression threads
+ * @level: the zstd compression level
+ *
+ * Starts the threads that ram_chunks_compress() hands chunks to.
+ */
+RAMChunksCompress *ram_chunks_compress_new(unsigned int threads, int level);
+
+/**
+ * ram_chunks_compress:
+ * @c: the compression threads
+ * @chunks: the chunks to compress
+ * @nr_chunks: the number of chunks
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Compresses each of @chunks into its buffer, in parallel, and returns
+ * when they are all done: 0 on success, -1 on error.
+ */
+int ram_chunks_compress(RAMChunksCompress *c, RAMChunk *chunks,
+                        unsigned int nr_chunks, Error **errp);
+
+void ram_chunks_compress_free(RAMChunksCompress *c);
+
+/**
+ * ram_chunks_decompress:
+ * @dst: where the chunk goes
+ * @len: size of the chunk
+ * @src: the compressed chunk
+ * @size: size of the compressed chunk
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Returns true if @src decompressed to exactly @len bytes.
+ */
+bool ram_chunks_decompress(uint8_t *dst, size_t len, const uint8_t *src,
+                           size_t size, Error **errp);
+
+#else
+
+/* compressed-ram cannot be enabled without zstd */
+
+static inline size_t ram_chunks_bound(size_t len)
+{
+    g_assert_not_reached();
+}
+
+static inline RAMChunksCompress *ram_chunks_compress_new(unsigned int threads,
+                                                         int level)
+{
+    g_assert_not_reached();
+}
+
+static inline int ram_chunks_compress(RAMChunksCompress *c, RAMChunk *chunks,
+                                      unsigned int nr_chunks, Error **errp)
+{
+    g_assert_not_reached();
+}
+
+static inline void ram_chunks_compress_free(RAMChunksCompress *c)
+{
+}
+
+static inline bool ram_chunks_decompress(uint8_t *dst, size_t len,
+                                         const uint8_t *src, size_t size,
+                                         Error **errp)
+{
+    g_assert_not_reached();
+}
+
+#endif
+
+#endif
@@ -93,6 +93,7 @@ static void *do_data_compress(void *opaque)
     RAMBlock *block;
     ram_addr_t offset;
     CompressResult result;
+    int64_t start;
 
     qemu_mutex_lock(&param->mutex);
     while (!param->quit) {
@@ -102,8 +103,10 @@ static void *do_data_compress(void *opaque)
             param->trigger = false;
             qemu_mutex_unlock(&param->mutex);
 
+            start = migration_stage_start();
             result = do_compress_ram_page(param->file, &param->stream,
                                           block, offset, param->originbuf);
+            migration_stage_end(MIGRATION_STAGE_COMPRESSION, start);
 
             qemu_mutex_lock(&comp_done_lock);
             param->done = true;
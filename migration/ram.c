@@ -28,12 +28,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram-compress.h"
+#include "ram-chunks.h"
 #include "ram.h"
 #include "migration.h"
 #include "migration-stats.h"
@@ -63,6 +65,10 @@
 #include "options.h"
 #include "sysemu/dirtylimit.h"
 #include "sysemu/kvm.h"
+#include "sysemu/tcg.h"
+#include "exec/cputlb.h"
+#include "hw/core/cpu.h"
+#include "io/channel-file.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
@@ -80,9 +86,10 @@
  * RAM_SAVE_FLAG_COMPRESS_PAGE just rename it.
  */
 /*
- * RAM_SAVE_FLAG_FULL was obsoleted in 2009, it can be reused now
+ * RAM_SAVE_FLAG_FULL was obsoleted in 2009, its value is now used by
+ * RAM_SAVE_FLAG_EXTENT.
  */
-#define RAM_SAVE_FLAG_FULL     0x01
+#define RAM_SAVE_FLAG_EXTENT   0x01
 #define RAM_SAVE_FLAG_ZERO     0x02
 #define RAM_SAVE_FLAG_MEM_SIZE 0x04
 #define RAM_SAVE_FLAG_PAGE     0x08
@@ -94,6 +101,116 @@
 #define RAM_SAVE_FLAG_MULTIFD_FLUSH    0x200
 /* We can't use any flag that is bigger than 0x200 */
 
+/*
+ * With dedup-pages, a RAM_SAVE_FLAG_EXTENT record stands for a run of
+ * pages: the page header is followed by the number of pages (be32)
+ * and by the offset in the migration file of their contents (be64).
+ * RAM_EXTENT_ZERO as offset means that the pages are zero; otherwise
+ * the contents were written earlier in the file, for another page.
+ */
+#define RAM_EXTENT_ZERO 0
+
+/*
+ * mapped-ram: every RAMBlock gets a fixed region in the migration file,
+ * made of a header, a bitmap of the pages that were written and then
+ * the pages themselves, each at its offset inside the block.  The
+ * region is reserved in ram_save_setup(); the stream continues after
+ * it and only carries the usual section markers for RAM.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+struct MappedRamHeader {
+    uint32_t version;
+    /* The target's page size, so we know how many pages are in the bitmap */
+    uint64_t page_size;
+    /* Offset in the migration file where the bitmap starts */
+    uint64_t bitmap_offset;
+    /* Offset in the migration file where the pages start */
+    uint64_t pages_offset;
+} QEMU_PACKED;
+typedef struct MappedRamHeader MappedRamHeader;
+
+/*
+ * prioritized-snapshot and compressed-ram write the pages of all
+ * RAMBlocks in one area of the stream once the VM is stopped, and the
+ * loader reads them with the block list.  In each block's region the
+ * bitmap is followed by the header below and by an index of where the
+ * block's contents are in the area.  The header's pages_offset is the
+ * start of the area.
+ */
+struct MappedRamArea {
+    /* The loader jumps from this stream position to the end of the area */
+    uint64_t skip_from;
+    uint64_t skip_to;
+} QEMU_PACKED;
+typedef struct MappedRamArea MappedRamArea;
+
+/*
+ * prioritized-snapshot: the pages the vCPUs accessed last come first.
+ * The index has the be32 position of each page in the area, in pages.
+ */
+#define PRIORITIZED_RAM_NO_SLOT UINT32_MAX
+
+/*
+ * compressed-ram: the area holds each chunk of this size of the block,
+ * compressed on its own with zstd, and the index says where: a chunk
+ * with a size of 0 is all zero.  The size is also the lazy-ram-load
+ * chunk size, so that a lazy load decompresses a single chunk.
+ */
+#define RAM_COMPRESSED_CHUNK_SIZE (64 * KiB)
+
+struct MappedRamChunk {
+    uint64_t offset;
+    uint32_t size;
+} QEMU_PACKED;
+typedef struct MappedRamChunk MappedRamChunk;
+
+/* Where the stream of the migration being loaded skips the RAM area */
+static MappedRamArea ram_area_skip;
+
+/*
+ * lazy-ram-load reads a RAMBlock from the migration file in chunks of
+ * this size, when something first needs a host pointer into the chunk.
+ */
+#define RAM_LAZY_LOAD_CHUNK_SIZE (64 * KiB)
+
+QEMU_BUILD_BUG_ON(RAM_LAZY_LOAD_CHUNK_SIZE != RAM_COMPRESSED_CHUNK_SIZE);
+
+typedef struct RAMBlockLazyLoad {
+    struct rcu_head rcu;
+    /* Private channel on the migration file */
+    QIOChannel *ioc;
+    uint64_t pages_offset;
+    /* Pages present in the migration file */
+    unsigned long *file_bmap;
+    /* With prioritized-snapshot, where each page is from pages_offset on */
+    uint32_t *slots;
+    /* With compressed-ram, where each chunk is, and room for one */
+    MappedRamChunk *chunks;
+    uint8_t *zbuf;
+    /* Chunks that still have to be read; cleared with lazy_load_lock held */
+    unsigned long *pending;
+    unsigned long nr_pending;
+} RAMBlockLazyLoad;
+
+static QemuMutex lazy_load_lock;
+
+/*
+ * incremental-snapshot: once a migration completes, dirty logging keeps
+ * running so that the next migration is a delta of the pages dirtied
+ * since.  A delta lists a pseudo block of this name before the real
+ * ones, so that it is not loaded without the snapshots it builds on.
+ */
+#define RAM_INCREMENTAL_MARKER "(incremental delta)"
+
+static struct {
+    /* The next migration only needs the pages dirtied since the last */
+    bool active;
+    /* Size of RAM when the last migration completed */
+    uint64_t ram_bytes;
+} ram_incremental;
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -340,6 +457,8 @@ struct RAMState {
     PageSearchStatus pss[RAM_CHANNEL_MAX];
     /* UFFD file descriptor, used in 'write-tracking' migration */
     int uffdio_fd;
+    /* Stable copy of the page being saved, when tracking writes with TCG */
+    uint8_t *write_track_page;
     /* total ram size in bytes */
     uint64_t ram_bytes_total;
     /* Last block that we have visited searching for dirty pages */
@@ -394,6 +513,22 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+
+    /*
+     * dedup-pages state, protected by the bitmap_mutex.  dedup_base is
+     * the file offset of the start of the stream; dedup_pages maps the
+     * hash of a page to the file offset where its contents were stored.
+     */
+    uint64_t dedup_base;
+    GHashTable *dedup_pages;
+    uint8_t *dedup_buf;
+    /* Run of zero pages that has not been sent yet */
+    RAMBlock *zero_run_block;
+    ram_addr_t zero_run_start;
+    uint32_t zero_run_pages;
+
+    /* incremental-snapshot: only send pages dirtied since the last time */
+    bool incremental_delta;
 };
 typedef struct RAMState RAMState;
 
@@ -597,6 +732,7 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
                             RAMBlock *block, ram_addr_t offset)
 {
     int encoded_len = 0, bytes_xbzrle;
+    int64_t start;
     uint8_t *prev_cached_page;
     QEMUFile *file = pss->pss_channel;
     uint64_t generation = stat64_get(&mig_stats.dirty_sync_count);
@@ -634,9 +770,11 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
 
     /* XBZRLE encoding (if there is no overflow) */
+    start = migration_stage_start();
     encoded_len = xbzrle_encode_buffer(prev_cached_page, XBZRLE.current_buf,
                                        TARGET_PAGE_SIZE, XBZRLE.encoded_buf,
                                        TARGET_PAGE_SIZE);
+    migration_stage_end(MIGRATION_STAGE_COMPRESSION, start);
 
     /*
      * Update the cache contents, so that it corresponds to the data
@@ -1035,6 +1173,7 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
     RAMBlock *block;
     int64_t end_time;
+    int64_t start = migration_stage_start();
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1055,6 +1194,7 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     qemu_mutex_unlock(&rs->bitmap_mutex);
 
     memory_global_after_dirty_log_sync();
+    migration_stage_end(MIGRATION_STAGE_BITMAP_SYNC, start);
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
@@ -1115,11 +1255,11 @@ void ram_release_page(const char *rbname, uint64_t offset)
  * @rs: current RAM state
  * @pss: current PSS channel
  * @offset: offset inside the block for the page
+ * @p: contents of the page
  */
 static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
-                          ram_addr_t offset)
+                          ram_addr_t offset, uint8_t *p)
 {
-    uint8_t *p = pss->block->host + offset;
     QEMUFile *file = pss->pss_channel;
     int len = 0;
 
@@ -1127,12 +1267,18 @@ static int save_zero_page(RAMState *rs, PageSearchStatus *pss,
         return 0;
     }
 
+    stat64_add(&mig_stats.zero_pages, 1);
+
+    if (migrate_mapped_ram()) {
+        /* zero pages are not transferred with mapped-ram */
+        clear_bit(offset >> TARGET_PAGE_BITS, pss->block->file_bmap);
+        return 1;
+    }
+
     len += save_page_header(pss, file, pss->block, offset | RAM_SAVE_FLAG_ZERO);
     qemu_put_byte(file, 0);
     len += 1;
     ram_release_page(pss->block->idstr, offset);
-
-    stat64_add(&mig_stats.zero_pages, 1);
     ram_transferred_add(len);
 
     /*
@@ -1190,14 +1336,20 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
 {
     QEMUFile *file = pss->pss_channel;
 
-    ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
-                                         offset | RAM_SAVE_FLAG_PAGE));
-    if (async) {
-        qemu_put_buffer_async(file, buf, TARGET_PAGE_SIZE,
-                              migrate_release_ram() &&
-                              migration_in_postcopy());
+    if (migrate_mapped_ram()) {
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
     } else {
-        qemu_put_buffer(file, buf, TARGET_PAGE_SIZE);
+        ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
+                                             offset | RAM_SAVE_FLAG_PAGE));
+        if (async) {
+            qemu_put_buffer_async(file, buf, TARGET_PAGE_SIZE,
+                                  migrate_release_ram() &&
+                                  migration_in_postcopy());
+        } else {
+            qemu_put_buffer(file, buf, TARGET_PAGE_SIZE);
+        }
     }
     ram_transferred_add(TARGET_PAGE_SIZE);
     stat64_add(&mig_stats.normal_pages, 1);
@@ -1213,19 +1365,18 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
  *                if xbzrle noticed the page was the same.
  *
  * @rs: current RAM state
- * @block: block that contains the page we want to send
- * @offset: offset inside the block for the page
+ * @pss: data about the page we want to send
+ * @p: contents of the page
  */
-static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
+static int ram_save_page(RAMState *rs, PageSearchStatus *pss, uint8_t *p)
 {
     int pages = -1;
-    uint8_t *p;
-    bool send_async = true;
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
+    /* A copy taken by ram_save_page_host() is reused for the next page */
+    bool send_async = p == block->host + offset;
 
-    p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
     XBZRLE_cache_lock();
@@ -1316,8 +1467,11 @@ int compress_send_queued_data(CompressParam *param)
  */
 static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
 {
+    int64_t start = migration_stage_start();
+
     /* Update pss->page for the next dirty bit in ramblock */
     pss_find_next_dirty(pss);
+    migration_stage_end(MIGRATION_STAGE_PAGE_SCAN, start);
 
     if (pss->complete_round && pss->block == rs->last_seen_block &&
         pss->page >= rs->last_page) {
@@ -1415,6 +1569,192 @@ static RAMBlock *unqueue_page(RAMState *rs, ram_addr_t *offset)
     return block;
 }
 
+/*
+ * Without userfaultfd, background-snapshot can still let a TCG guest run
+ * while its RAM is saved.  Every page starts out protected; the first
+ * write to a protected page, through the TLB_NOTDIRTY slow path or the
+ * memory API, calls ram_write_track() which keeps a copy of the contents
+ * the page had when the snapshot started.
+ */
+typedef struct RAMBlockWriteTrack {
+    struct rcu_head rcu;
+    unsigned long nr_pages;
+    /* Pages not saved nor copied yet; cleared with write_track_lock held */
+    unsigned long *bmap;
+    /* Contents of the pages written to before they were saved */
+    uint8_t **copies;
+} RAMBlockWriteTrack;
+
+static QemuMutex write_track_lock;
+
+static void ram_write_track_free(RAMBlockWriteTrack *wt)
+{
+    unsigned long page;
+
+    for (page = 0; page < wt->nr_pages; page++) {
+        g_free(wt->copies[page]);
+    }
+    g_free(wt->copies);
+    g_free(wt->bmap);
+    g_free(wt);
+}
+
+static bool ram_write_track_tcg_compatible(void)
+{
+    return tcg_enabled();
+}
+
+static int ram_write_track_tcg_start(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        RAMBlockWriteTrack *wt;
+
+        /* Nothing to do with read-only and MMIO-writable regions */
+        if (block->mr->readonly || block->mr->rom_device) {
+            continue;
+        }
+
+        wt = g_new0(RAMBlockWriteTrack, 1);
+        wt->nr_pages = block->max_length >> TARGET_PAGE_BITS;
+        wt->bmap = bitmap_new(wt->nr_pages);
+        bitmap_set(wt->bmap, 0, block->used_length >> TARGET_PAGE_BITS);
+        wt->copies = g_new0(uint8_t *, wt->nr_pages);
+        qatomic_rcu_set(&block->write_track, wt);
+
+        trace_ram_write_tracking_ramblock_start(block->idstr, block->page_size,
+                block->host, block->max_length);
+    }
+    rs->uffdio_fd = -1;
+    rs->write_track_page = g_malloc(TARGET_PAGE_SIZE);
+    qatomic_set(&global_write_tracking, true);
+
+    /*
+     * vCPUs only take the TLB_NOTDIRTY slow path for pages whose migration
+     * dirty bit is clear.  Clearing the bits also resets the TLB entries
+     * that were filled while they were set.
+     */
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (block->write_track) {
+            cpu_physical_memory_test_and_clear_dirty(block->offset,
+                                                     block->used_length,
+                                                     DIRTY_MEMORY_MIGRATION);
+        }
+    }
+
+    return 0;
+}
+
+static void ram_write_track_tcg_stop(void)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    qatomic_set(&global_write_tracking, false);
+
+    WITH_QEMU_LOCK_GUARD(&write_track_lock) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            RAMBlockWriteTrack *wt = block->write_track;
+
+            if (!wt) {
+                continue;
+            }
+            trace_ram_write_tracking_ramblock_stop(block->idstr,
+                    block->page_size, block->host, block->max_length);
+
+            qatomic_rcu_set(&block->write_track, NULL);
+            call_rcu(wt, ram_write_track_free, rcu);
+        }
+    }
+
+    g_free(rs->write_track_page);
+    rs->write_track_page = NULL;
+}
+
+void ram_write_track_slow(ram_addr_t addr, ram_addr_t length)
+{
+    RAMBlockWriteTrack *wt;
+    RAMBlock *block;
+    ram_addr_t offset;
+    unsigned long page, last;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        if (addr - block->offset < block->used_length) {
+            break;
+        }
+    }
+    wt = block ? qatomic_rcu_read(&block->write_track) : NULL;
+    if (!wt || !length) {
+        return;
+    }
+    offset = addr - block->offset;
+    length = MIN(length, block->used_length - offset);
+    page = offset >> TARGET_PAGE_BITS;
+    last = (offset + length - 1) >> TARGET_PAGE_BITS;
+
+    if (find_next_bit(wt->bmap, last + 1, page) > last) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&write_track_lock) {
+        if (qatomic_read(&block->write_track) != wt) {
+            return;
+        }
+        for (page = find_next_bit(wt->bmap, last + 1, page);
+             page <= last;
+             page = find_next_bit(wt->bmap, last + 1, page + 1)) {
+            offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+            wt->copies[page] = g_memdup2(block->host + offset,
+                                         TARGET_PAGE_SIZE);
+            clear_bit(page, wt->bmap);
+            trace_ram_write_track_copy(block->idstr, offset);
+        }
+    }
+}
+
+/**
+ * ram_save_page_host: get the contents of a page to save
+ *
+ * Returns a pointer to the contents of the page.  When writes are
+ * tracked with TCG this is a copy that the guest cannot change, valid
+ * until the next call.
+ *
+ * Called within an RCU critical section.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page
+ * @offset: offset inside the block for the page
+ */
+static uint8_t *ram_save_page_host(RAMState *rs, RAMBlock *block,
+                                   ram_addr_t offset)
+{
+    RAMBlockWriteTrack *wt = qatomic_rcu_read(&block->write_track);
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+
+    if (!wt) {
+        return block->host + offset;
+    }
+
+    QEMU_LOCK_GUARD(&write_track_lock);
+    if (wt->copies[page]) {
+        g_free(rs->write_track_page);
+        rs->write_track_page = wt->copies[page];
+        wt->copies[page] = NULL;
+    } else {
+        memcpy(rs->write_track_page, block->host + offset, TARGET_PAGE_SIZE);
+        clear_bit(page, wt->bmap);
+    }
+    return rs->write_track_page;
+}
+
 #if defined(__linux__)
 /**
  * poll_fault_page: try to get next UFFD write fault page and, if pending fault
@@ -1433,7 +1773,7 @@ static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
     RAMBlock *block;
     int res;
 
-    if (!migrate_background_snapshot()) {
+    if (!migrate_background_snapshot() || rs->uffdio_fd < 0) {
         return NULL;
     }
 
@@ -1489,15 +1829,11 @@ bool ram_write_tracking_available(void)
 
     res = uffd_query_features(&uffd_features);
     return (res == 0 &&
-            (uffd_features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) != 0);
+            (uffd_features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) != 0) ||
+           ram_write_track_tcg_compatible();
 }
 
-/* ram_write_tracking_compatible: check if guest configuration is
- *   compatible with 'write-tracking'
- *
- * Returns true if compatible, false otherwise
- */
-bool ram_write_tracking_compatible(void)
+static bool ram_write_tracking_uffd_compatible(void)
 {
     const uint64_t uffd_ioctls_mask = BIT(_UFFDIO_WRITEPROTECT);
     int uffd_fd;
@@ -1535,6 +1871,17 @@ out:
     return ret;
 }
 
+/* ram_write_tracking_compatible: check if guest configuration is
+ *   compatible with 'write-tracking'
+ *
+ * Returns true if compatible, false otherwise
+ */
+bool ram_write_tracking_compatible(void)
+{
+    return ram_write_tracking_uffd_compatible() ||
+           ram_write_track_tcg_compatible();
+}
+
 static inline void populate_read_range(RAMBlock *block, ram_addr_t offset,
                                        ram_addr_t size)
 {
@@ -1673,6 +2020,11 @@ int ram_write_tracking_start(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    /* Use TCG if the kernel or the memory backends do not support UFFD-WP */
+    if (!ram_write_tracking_uffd_compatible()) {
+        return ram_write_track_tcg_start();
+    }
+
     /* Open UFFD file descriptor */
     uffd_fd = uffd_create_fd(UFFD_FEATURE_PAGEFAULT_FLAG_WP, true);
     if (uffd_fd < 0) {
@@ -1733,6 +2085,11 @@ void ram_write_tracking_stop(void)
     RAMState *rs = ram_state;
     RAMBlock *block;
 
+    if (qatomic_read(&global_write_tracking)) {
+        ram_write_track_tcg_stop();
+        return;
+    }
+
     RCU_READ_LOCK_GUARD();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(block) {
@@ -1755,7 +2112,7 @@ void ram_write_tracking_stop(void)
 }
 
 #else
-/* No target OS support, stubs just fail or ignore */
+/* No userfaultfd support, writes can only be tracked with TCG */
 
 static RAMBlock *poll_fault_page(RAMState *rs, ram_addr_t *offset)
 {
@@ -1777,24 +2134,22 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
 
 bool ram_write_tracking_available(void)
 {
-    return false;
+    return ram_write_track_tcg_compatible();
 }
 
 bool ram_write_tracking_compatible(void)
 {
-    assert(0);
-    return false;
+    return ram_write_track_tcg_compatible();
 }
 
 int ram_write_tracking_start(void)
 {
-    assert(0);
-    return -1;
+    return ram_write_track_tcg_start();
 }
 
 void ram_write_tracking_stop(void)
 {
-    assert(0);
+    ram_write_track_tcg_stop();
 }
 #endif /* defined(__linux__) */
 
@@ -2034,6 +2389,125 @@ static bool save_compress_page(RAMState *rs, PageSearchStatus *pss,
                                            compress_send_queued_data);
 }
 
+static uint64_t dedup_page_hash(const uint8_t *p)
+{
+    const uint64_t *q = (const uint64_t *)p;
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    size_t i;
+
+    for (i = 0; i < TARGET_PAGE_SIZE / sizeof(uint64_t); i++) {
+        h = rol64(h ^ q[i], 29) * 0xc2b2ae3d27d4eb4fULL;
+    }
+    return h ^ (h >> 32);
+}
+
+/*
+ * Send the pending run of zero pages as one extent.  Must be called
+ * before anything else is written to the RAM section of the stream.
+ */
+static void dedup_flush_zero_run(RAMState *rs)
+{
+    PageSearchStatus *pss = &rs->pss[RAM_CHANNEL_PRECOPY];
+    QEMUFile *file = pss->pss_channel;
+    size_t len;
+
+    if (!rs->zero_run_pages) {
+        return;
+    }
+
+    len = save_page_header(pss, file, rs->zero_run_block,
+                           rs->zero_run_start | RAM_SAVE_FLAG_EXTENT);
+    qemu_put_be32(file, rs->zero_run_pages);
+    qemu_put_be64(file, RAM_EXTENT_ZERO);
+    ram_transferred_add(len + 12);
+    trace_ram_save_extent(rs->zero_run_block->idstr, rs->zero_run_start,
+                          rs->zero_run_pages, RAM_EXTENT_ZERO);
+    rs->zero_run_pages = 0;
+}
+
+/* Check that the page stored at @pos in the migration file equals @p */
+static bool dedup_page_matches(RAMState *rs, QEMUFile *file, uint8_t *p,
+                               uint64_t pos)
+{
+    if (qemu_fflush(file) < 0) {
+        return false;
+    }
+    if (qio_channel_pread(qemu_file_get_ioc(file), (char *)rs->dedup_buf,
+                          TARGET_PAGE_SIZE, pos, NULL) < 0) {
+        return false;
+    }
+    return memcmp(rs->dedup_buf, p, TARGET_PAGE_SIZE) == 0;
+}
+
+/**
+ * ram_save_dedup_page: send a page with the dedup-pages capability
+ *
+ * Zero pages are gathered into runs that are sent as one extent.  A
+ * page whose contents are already in the migration file, as checked
+ * by reading them back, is sent as a reference to them.  Other pages
+ * are sent normally and remembered for later references.
+ *
+ * Returns the number of pages written.
+ *
+ * @rs: current RAM state
+ * @pss: data about the page we want to send
+ * @offset: offset inside the block for the page
+ * @p: contents of the page
+ */
+static int ram_save_dedup_page(RAMState *rs, PageSearchStatus *pss,
+                               ram_addr_t offset, uint8_t *p)
+{
+    RAMBlock *block = pss->block;
+    QEMUFile *file = pss->pss_channel;
+    uint64_t hash, *pos;
+    size_t len;
+
+    if (buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+        stat64_add(&mig_stats.zero_pages, 1);
+        if (rs->zero_run_pages && rs->zero_run_block == block &&
+            rs->zero_run_pages < UINT32_MAX &&
+            rs->zero_run_start +
+            ((ram_addr_t)rs->zero_run_pages << TARGET_PAGE_BITS) == offset) {
+            rs->zero_run_pages++;
+            return 1;
+        }
+        dedup_flush_zero_run(rs);
+        rs->zero_run_block = block;
+        rs->zero_run_start = offset;
+        rs->zero_run_pages = 1;
+        return 1;
+    }
+
+    dedup_flush_zero_run(rs);
+
+    hash = dedup_page_hash(p);
+    pos = g_hash_table_lookup(rs->dedup_pages, &hash);
+    if (pos && dedup_page_matches(rs, file, p, *pos)) {
+        len = save_page_header(pss, file, block,
+                               offset | RAM_SAVE_FLAG_EXTENT);
+        qemu_put_be32(file, 1);
+        qemu_put_be64(file, *pos);
+        ram_transferred_add(len + 12);
+        trace_ram_save_extent(block->idstr, offset, 1, *pos);
+        return 1;
+    }
+
+    ram_transferred_add(save_page_header(pss, file, block,
+                                         offset | RAM_SAVE_FLAG_PAGE));
+    if (!pos) {
+        uint64_t *key = g_new(uint64_t, 1);
+
+        *key = hash;
+        pos = g_new(uint64_t, 1);
+        g_hash_table_insert(rs->dedup_pages, key, pos);
+    }
+    *pos = rs->dedup_base + qemu_file_transferred(file);
+    qemu_put_buffer(file, p, TARGET_PAGE_SIZE);
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    stat64_add(&mig_stats.normal_pages, 1);
+    return 1;
+}
+
 /**
  * ram_save_target_page_legacy: save one target page
  *
@@ -2046,6 +2520,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    uint8_t *p;
     int res;
 
     if (control_save_page(pss, offset, &res)) {
@@ -2056,7 +2531,13 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
-    if (save_zero_page(rs, pss, offset)) {
+    p = ram_save_page_host(rs, block, offset);
+
+    if (migrate_dedup_pages()) {
+        return ram_save_dedup_page(rs, pss, offset, p);
+    }
+
+    if (save_zero_page(rs, pss, offset, p)) {
         return 1;
     }
 
@@ -2070,7 +2551,7 @@ static int ram_save_target_page_legacy(RAMState *rs, PageSearchStatus *pss)
         return ram_save_multifd_page(pss->pss_channel, block, offset);
     }
 
-    return ram_save_page(rs, pss);
+    return ram_save_page(rs, pss, p);
 }
 
 /* Should be called before sending a host page */
@@ -2367,6 +2848,10 @@ static void ram_state_cleanup(RAMState **rsp)
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
+        if ((*rsp)->dedup_pages) {
+            g_hash_table_destroy((*rsp)->dedup_pages);
+        }
+        qemu_vfree((*rsp)->dedup_buf);
         g_free(*rsp);
         *rsp = NULL;
     }
@@ -2393,8 +2878,16 @@ static void ram_save_cleanup(void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    /*
+     * With incremental-snapshot, dirty logging stays on after a
+     * completed migration: what is dirtied from now on is the next delta.
+     */
+    ram_incremental.active = migrate_incremental_snapshot() &&
+        migrate_get_current()->state == MIGRATION_STATUS_COMPLETED;
+    ram_incremental.ram_bytes = ram_bytes_total();
+
     /* We don't use dirty log with background snapshots */
-    if (!migrate_background_snapshot()) {
+    if (!migrate_background_snapshot() && !ram_incremental.active) {
         /* caller have hold iothread lock or is in a bh, so there is
          * no writing race against the migration bitmap
          */
@@ -2413,6 +2906,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -2747,7 +3242,7 @@ static int ram_state_init(RAMState **rsp)
     return 0;
 }
 
-static void ram_list_init_bitmaps(void)
+static void ram_list_init_bitmaps(bool delta)
 {
     MigrationState *ms = migrate_get_current();
     RAMBlock *block;
@@ -2779,7 +3274,9 @@ static void ram_list_init_bitmaps(void)
              * guest memory.
              */
             block->bmap = bitmap_new(pages);
-            bitmap_set(block->bmap, 0, pages);
+            if (!delta) {
+                bitmap_set(block->bmap, 0, pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -2799,12 +3296,35 @@ static void migration_bitmap_clear_discarded_pages(RAMState *rs)
     }
 }
 
+/*
+ * With prioritized-snapshot, the dirty bitmap only serves to tell which
+ * pages were written while the migration ran: start it empty.
+ */
+static void ram_prioritized_reset_dirty(RAMState *rs)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+
+        migration_clear_memory_region_dirty_bitmap_range(block, 0, pages);
+        bitmap_zero(block->bmap, block->max_length >> TARGET_PAGE_BITS);
+    }
+    rs->migration_dirty_pages = 0;
+}
+
 static void ram_init_bitmaps(RAMState *rs)
 {
     qemu_mutex_lock_ramlist();
 
     WITH_RCU_READ_LOCK_GUARD() {
-        ram_list_init_bitmaps();
+        ram_list_init_bitmaps(rs->incremental_delta);
+        if (rs->incremental_delta) {
+            /* The first sync picks up what was dirtied since the last one */
+            rs->migration_dirty_pages = 0;
+        }
         /* We don't use dirty log with background snapshots */
         if (!migrate_background_snapshot()) {
             memory_global_dirty_log_start(GLOBAL_DIRTY_MIGRATION);
@@ -2818,6 +3338,24 @@ static void ram_init_bitmaps(RAMState *rs)
      * containing all 1s to exclude any discarded pages from migration.
      */
     migration_bitmap_clear_discarded_pages(rs);
+
+    if (migrate_prioritized_snapshot()) {
+        ram_prioritized_reset_dirty(rs);
+    }
+}
+
+/*
+ * Whether this migration can be a delta of the last one: dirty logging
+ * must have run since it completed, and RAM must not have changed size.
+ */
+static bool ram_incremental_start(void)
+{
+    if (ram_incremental.active && migrate_incremental_snapshot() &&
+        ram_incremental.ram_bytes == ram_bytes_total()) {
+        return true;
+    }
+    ram_incremental.active = false;
+    return false;
 }
 
 static int ram_init_all(RAMState **rsp)
@@ -2826,6 +3364,8 @@ static int ram_init_all(RAMState **rsp)
         return -1;
     }
 
+    (*rsp)->incremental_delta = ram_incremental_start();
+
     if (xbzrle_init()) {
         ram_state_cleanup(rsp);
         return -1;
@@ -2917,15 +3457,402 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
-/*
- * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
- * long-running RCU critical section.  When rcu-reclaims in the code
- * start to become numerous it will be necessary to reduce the
- * granularity of these critical sections.
- */
+/* Size of a mapped-ram bitmap in the migration file, in bytes */
+static size_t mapped_ram_bitmap_size(long num_pages)
+{
+    return DIV_ROUND_UP(num_pages, 64) * sizeof(uint64_t);
+}
 
-/**
- * ram_save_setup: Setup RAM for migration
+/* Whether all of RAM goes to one area of the stream once the VM stops */
+static bool mapped_ram_in_area(void)
+{
+    return migrate_prioritized_snapshot() || migrate_compressed_ram();
+}
+
+/* Size of the index that follows the MappedRamArea of a block */
+static size_t mapped_ram_index_size(ram_addr_t length)
+{
+    if (migrate_compressed_ram()) {
+        return DIV_ROUND_UP(length, RAM_COMPRESSED_CHUNK_SIZE) *
+               sizeof(MappedRamChunk);
+    }
+    return (length >> TARGET_PAGE_BITS) * sizeof(uint32_t);
+}
+
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    MappedRamHeader header = {};
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+
+    block->file_bmap = bitmap_new(num_pages);
+
+    /*
+     * Save the file offsets of where the bitmap and the pages should
+     * go as they are written at the end of migration and during the
+     * iterative phase, respectively.
+     */
+    block->bitmap_offset = qemu_get_offset(file) + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(num_pages),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    if (mapped_ram_in_area()) {
+        /* The pages come at the end, ram_save_area() says where */
+        block->pages_offset = 0;
+    }
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+
+    qemu_put_buffer(file, (uint8_t *)&header, sizeof(header));
+
+    /* prepare offset for next ramblock */
+    if (mapped_ram_in_area()) {
+        qemu_set_offset(file, block->bitmap_offset +
+                        mapped_ram_bitmap_size(num_pages) +
+                        sizeof(MappedRamArea) +
+                        mapped_ram_index_size(block->used_length), SEEK_SET);
+    } else {
+        qemu_set_offset(file, block->pages_offset + block->used_length,
+                        SEEK_SET);
+    }
+}
+
+static void mapped_ram_save_bitmaps(QEMUFile *file)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t size = mapped_ram_bitmap_size(num_pages);
+        g_autofree unsigned long *le_bmap = g_malloc0(size);
+
+        bitmap_to_le(le_bmap, block->file_bmap, num_pages);
+        qemu_put_buffer_at(file, (uint8_t *)le_bmap, size,
+                           block->bitmap_offset);
+    }
+}
+
+typedef struct RAMPrioritizedBlock {
+    /* Pages that a vCPU has in its TLB */
+    unsigned long *tlb_bmap;
+    /* Index of each page in the area, or PRIORITIZED_RAM_NO_SLOT */
+    uint32_t *slots;
+} RAMPrioritizedBlock;
+
+static void ram_prioritized_block_free(gpointer data)
+{
+    RAMPrioritizedBlock *pb = data;
+
+    g_free(pb->tlb_bmap);
+    g_free(pb->slots);
+    g_free(pb);
+}
+
+static void ram_prioritized_tlb_page(void *host, void *opaque)
+{
+    GHashTable *blocks = opaque;
+    RAMPrioritizedBlock *pb = NULL;
+    ram_addr_t offset;
+    RAMBlock *block;
+
+    block = qemu_ram_block_from_host(host, false, &offset);
+    if (block) {
+        pb = g_hash_table_lookup(blocks, block);
+    }
+    if (pb && offset < block->used_length) {
+        set_bit(offset >> TARGET_PAGE_BITS, pb->tlb_bmap);
+    }
+}
+
+/*
+ * The order pages are written in: first those that a vCPU accessed
+ * since its TLB was last flushed, then those written while the
+ * migration ran, then the others.
+ */
+#define RAM_PRIORITIZED_RANKS 3
+
+static int ram_prioritized_rank(RAMBlock *block, RAMPrioritizedBlock *pb,
+                                unsigned long page)
+{
+    if (test_bit(page, pb->tlb_bmap)) {
+        return 0;
+    }
+    if (test_bit(page, block->bmap)) {
+        return 1;
+    }
+    return 2;
+}
+
+/*
+ * prioritized-snapshot: write all non-zero pages at the current stream
+ * position, by rank and then by address, and their index.
+ */
+static int ram_save_prioritized(QEMUFile *f)
+{
+    g_autoptr(GHashTable) blocks = NULL;
+    uint32_t nr_slots = 0;
+    RAMBlock *block;
+    CPUState *cpu;
+    int rank;
+
+    blocks = g_hash_table_new_full(NULL, NULL, NULL,
+                                   ram_prioritized_block_free);
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        RAMPrioritizedBlock *pb = g_new0(RAMPrioritizedBlock, 1);
+
+        pb->tlb_bmap = bitmap_new(num_pages);
+        pb->slots = g_new(uint32_t, num_pages);
+        memset(pb->slots, 0xff, num_pages * sizeof(uint32_t));
+        g_hash_table_insert(blocks, block, pb);
+    }
+
+    CPU_FOREACH(cpu) {
+        tlb_foreach_ram_page(cpu, ram_prioritized_tlb_page, blocks);
+    }
+
+    for (rank = 0; rank < RAM_PRIORITIZED_RANKS; rank++) {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            RAMPrioritizedBlock *pb = g_hash_table_lookup(blocks, block);
+            long num_pages = block->used_length >> TARGET_PAGE_BITS;
+            long page;
+
+            for (page = 0; page < num_pages; page++) {
+                ram_addr_t offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+                uint8_t *p = block->host + offset;
+
+                if (ram_prioritized_rank(block, pb, page) != rank) {
+                    continue;
+                }
+                if (ramblock_page_is_discarded(block, offset) ||
+                    buffer_is_zero(p, TARGET_PAGE_SIZE)) {
+                    clear_bit(page, block->file_bmap);
+                    stat64_add(&mig_stats.zero_pages, 1);
+                    continue;
+                }
+                if (nr_slots == PRIORITIZED_RAM_NO_SLOT) {
+                    error_report("prioritized-snapshot: too many RAM pages");
+                    return -EFBIG;
+                }
+
+                qemu_put_buffer(f, p, TARGET_PAGE_SIZE);
+                set_bit(page, block->file_bmap);
+                pb->slots[page] = nr_slots++;
+                ram_transferred_add(TARGET_PAGE_SIZE);
+                stat64_add(&mig_stats.normal_pages, 1);
+            }
+        }
+        trace_ram_save_prioritized(rank, nr_slots);
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        RAMPrioritizedBlock *pb = g_hash_table_lookup(blocks, block);
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        long page;
+
+        for (page = 0; page < num_pages; page++) {
+            pb->slots[page] = cpu_to_be32(pb->slots[page]);
+        }
+        qemu_put_buffer_at(f, (uint8_t *)pb->slots,
+                           num_pages * sizeof(uint32_t),
+                           block->bitmap_offset +
+                           mapped_ram_bitmap_size(num_pages) +
+                           sizeof(MappedRamArea));
+    }
+
+    return 0;
+}
+
+/* Chunks that each compression thread gets at once */
+#define RAM_COMPRESSED_BATCH 16
+
+/*
+ * Mark the pages of @chunk of @block that are not zero in the file
+ * bitmap, and set up @rc to compress the chunk if there is any.
+ */
+static bool ram_compressed_chunk_prepare(RAMBlock *block, unsigned long chunk,
+                                         RAMChunk *rc)
+{
+    ram_addr_t start = (ram_addr_t)chunk * RAM_COMPRESSED_CHUNK_SIZE;
+    ram_addr_t end = MIN(start + RAM_COMPRESSED_CHUNK_SIZE,
+                         block->used_length);
+    ram_addr_t offset;
+    bool used = false;
+
+    for (offset = start; offset < end; offset += TARGET_PAGE_SIZE) {
+        if (ramblock_page_is_discarded(block, offset) ||
+            buffer_is_zero(block->host + offset, TARGET_PAGE_SIZE)) {
+            stat64_add(&mig_stats.zero_pages, 1);
+        } else {
+            set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
+            stat64_add(&mig_stats.normal_pages, 1);
+            used = true;
+        }
+    }
+
+    rc->data = block->host + start;
+    rc->len = end - start;
+    return used;
+}
+
+/*
+ * compressed-ram: write the chunks of RAM that are not all zero at the
+ * current stream position, @pos, compressed in parallel a batch at a
+ * time, and the index of each block.
+ */
+static int ram_save_compressed(QEMUFile *f, uint64_t pos)
+{
+    unsigned int threads = migrate_multifd_channels();
+    unsigned int max_chunks = threads * RAM_COMPRESSED_BATCH;
+    g_autofree RAMChunk *batch = g_new0(RAMChunk, max_chunks);
+    g_autofree unsigned long *batch_chunk = g_new(unsigned long, max_chunks);
+    size_t bound = ram_chunks_bound(RAM_COMPRESSED_CHUNK_SIZE);
+    RAMChunksCompress *c;
+    RAMBlock *block;
+    unsigned int i;
+    int ret = 0;
+
+    for (i = 0; i < max_chunks; i++) {
+        batch[i].buf = g_malloc(bound);
+    }
+    c = ram_chunks_compress_new(threads, migrate_multifd_zstd_level());
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        unsigned long nr_chunks = DIV_ROUND_UP(block->used_length,
+                                               RAM_COMPRESSED_CHUNK_SIZE);
+        g_autofree MappedRamChunk *index = g_new0(MappedRamChunk, nr_chunks);
+        uint64_t start = pos;
+        unsigned long chunk = 0;
+
+        while (chunk < nr_chunks) {
+            Error *local_err = NULL;
+            int64_t compress_start;
+            unsigned int n = 0;
+
+            for (; chunk < nr_chunks && n < max_chunks; chunk++) {
+                if (ram_compressed_chunk_prepare(block, chunk, &batch[n])) {
+                    batch_chunk[n++] = chunk;
+                }
+            }
+
+            compress_start = migration_stage_start();
+            if (ram_chunks_compress(c, batch, n, &local_err) < 0) {
+                error_report_err(local_err);
+                ret = -EIO;
+                break;
+            }
+            migration_stage_end(MIGRATION_STAGE_COMPRESSION, compress_start);
+
+            for (i = 0; i < n; i++) {
+                qemu_put_buffer(f, batch[i].buf, batch[i].size);
+                index[batch_chunk[i]].offset = cpu_to_be64(pos);
+                index[batch_chunk[i]].size = cpu_to_be32(batch[i].size);
+                pos += batch[i].size;
+                ram_transferred_add(batch[i].size);
+            }
+        }
+        if (ret) {
+            break;
+        }
+
+        qemu_put_buffer_at(f, (uint8_t *)index,
+                           nr_chunks * sizeof(MappedRamChunk),
+                           block->bitmap_offset +
+                           mapped_ram_bitmap_size(block->used_length >>
+                                                  TARGET_PAGE_BITS) +
+                           sizeof(MappedRamArea));
+        trace_ram_save_compressed(block->idstr, block->used_length,
+                                  pos - start);
+    }
+
+    ram_chunks_compress_free(c);
+    for (i = 0; i < max_chunks; i++) {
+        g_free(batch[i].buf);
+    }
+    return ret;
+}
+
+/*
+ * prioritized-snapshot and compressed-ram: write RAM in one area of the
+ * stream and fill in what mapped_ram_setup_ramblock() left room for.
+ *
+ * Called with the VM stopped.
+ */
+static int ram_save_area(QEMUFile *f)
+{
+    MappedRamArea skip;
+    uint64_t area;
+    RAMBlock *block;
+    int ret;
+
+    skip.skip_from = qemu_get_offset(f);
+    area = ROUND_UP(skip.skip_from, TARGET_PAGE_SIZE);
+    qemu_set_offset(f, area, SEEK_SET);
+
+    if (migrate_compressed_ram()) {
+        ret = ram_save_compressed(f, area);
+    } else {
+        ret = ram_save_prioritized(f);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    skip.skip_to = qemu_get_offset(f);
+    ret = qemu_file_get_error(f);
+    if (ret < 0) {
+        return ret;
+    }
+
+    skip.skip_from = cpu_to_be64(skip.skip_from);
+    skip.skip_to = cpu_to_be64(skip.skip_to);
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        MappedRamHeader header = {
+            .version = cpu_to_be32(MAPPED_RAM_HDR_VERSION),
+            .page_size = cpu_to_be64(TARGET_PAGE_SIZE),
+            .bitmap_offset = cpu_to_be64(block->bitmap_offset),
+            .pages_offset = cpu_to_be64(area),
+        };
+
+        block->pages_offset = area;
+        qemu_put_buffer_at(f, (uint8_t *)&header, sizeof(header),
+                           block->bitmap_offset - sizeof(header));
+        qemu_put_buffer_at(f, (uint8_t *)&skip, sizeof(skip),
+                           block->bitmap_offset +
+                           mapped_ram_bitmap_size(num_pages));
+    }
+
+    return qemu_file_get_error(f);
+}
+
+/*
+ * Read everything that lazy-ram-load left in the migration file, before
+ * this VM's RAM is migrated again.
+ */
+static void ram_lazy_populate_all(void)
+{
+    RAMBlock *block;
+
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ramblock_lazy_populate(block, 0, block->used_length);
+    }
+}
+
+/*
+ * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
+ * long-running RCU critical section.  When rcu-reclaims in the code
+ * start to become numerous it will be necessary to reduce the
+ * granularity of these critical sections.
+ */
+
+/**
+ * ram_save_setup: Setup RAM for migration
  *
  * Returns zero to indicate success and negative for error
  *
@@ -2942,6 +3869,8 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
         return -1;
     }
 
+    ram_lazy_populate_all();
+
     /* migration has already setup the bitmap, reuse it. */
     if (!migration_in_colo_state()) {
         if (ram_init_all(rsp) != 0) {
@@ -2951,10 +3880,26 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     }
     (*rsp)->pss[RAM_CHANNEL_PRECOPY].pss_channel = f;
 
+    if (migrate_dedup_pages()) {
+        RAMState *rs = *rsp;
+
+        rs->dedup_base = qemu_get_offset(f) - qemu_file_transferred(f);
+        rs->dedup_pages = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                g_free, g_free);
+        rs->dedup_buf = qemu_memalign(TARGET_PAGE_SIZE, TARGET_PAGE_SIZE);
+    }
+
     WITH_RCU_READ_LOCK_GUARD() {
         qemu_put_be64(f, ram_bytes_total_with_ignored()
                          | RAM_SAVE_FLAG_MEM_SIZE);
 
+        if ((*rsp)->incremental_delta) {
+            qemu_put_byte(f, strlen(RAM_INCREMENTAL_MARKER));
+            qemu_put_buffer(f, (uint8_t *)RAM_INCREMENTAL_MARKER,
+                            strlen(RAM_INCREMENTAL_MARKER));
+            qemu_put_be64(f, 0);
+        }
+
         RAMBLOCK_FOREACH_MIGRATABLE(block) {
             qemu_put_byte(f, strlen(block->idstr));
             qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
@@ -2966,6 +3911,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3016,6 +3964,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     int64_t t0;
     int done = 0;
 
+    if (mapped_ram_in_area()) {
+        /* All of RAM is written by ram_save_complete() */
+        goto out;
+    }
+
     if (blk_mig_bulk_active()) {
         /* Avoid transferring ram during bulk phase of block migration as
          * the bulk phase will usually take a long time and transferring
@@ -3108,6 +4061,9 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 out:
     if (ret >= 0
         && migration_is_setup_or_active(migrate_get_current()->state)) {
+        WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
+            dedup_flush_zero_run(rs);
+        }
         if (migrate_multifd() && migrate_multifd_flush_after_each_section()) {
             ret = multifd_send_sync_main(rs->pss[RAM_CHANNEL_PRECOPY].pss_channel);
             if (ret < 0) {
@@ -3159,19 +4115,28 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
 
         /* flush all remaining blocks regardless of rate limiting */
         qemu_mutex_lock(&rs->bitmap_mutex);
-        while (true) {
-            int pages;
-
-            pages = ram_find_and_save_block(rs);
-            /* no more blocks to sent */
-            if (pages == 0) {
-                break;
-            }
-            if (pages < 0) {
+        if (mapped_ram_in_area()) {
+            ret = ram_save_area(f);
+            if (ret < 0) {
                 qemu_mutex_unlock(&rs->bitmap_mutex);
-                return pages;
+                return ret;
+            }
+        } else {
+            while (true) {
+                int pages;
+
+                pages = ram_find_and_save_block(rs);
+                /* no more blocks to sent */
+                if (pages == 0) {
+                    break;
+                }
+                if (pages < 0) {
+                    qemu_mutex_unlock(&rs->bitmap_mutex);
+                    return pages;
+                }
             }
         }
+        dedup_flush_zero_run(rs);
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
         compress_flush_data();
@@ -3181,6 +4146,14 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
             qemu_file_set_error(f, ret);
             return ret;
         }
+
+        if (migrate_mapped_ram()) {
+            mapped_ram_save_bitmaps(f);
+            ret = qemu_file_get_error(f);
+            if (ret < 0) {
+                return ret;
+            }
+        }
     }
 
     ret = multifd_send_sync_main(rs->pss[RAM_CHANNEL_PRECOPY].pss_channel);
@@ -3203,6 +4176,11 @@ static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
 
     uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
+    if (mapped_ram_in_area()) {
+        /* Nothing is sent before the VM stops */
+        return;
+    }
+
     if (migrate_postcopy_ram()) {
         /* We can do postcopy, and all the data is postcopiable */
         *can_postcopy += remaining_size;
@@ -3220,6 +4198,10 @@ static void ram_state_pending_exact(void *opaque, uint64_t *must_precopy,
 
     uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
 
+    if (mapped_ram_in_area()) {
+        return;
+    }
+
     if (!migration_in_postcopy() && remaining_size < s->threshold_size) {
         qemu_mutex_lock_iothread();
         WITH_RCU_READ_LOCK_GUARD() {
@@ -3504,6 +4486,7 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
 {
     xbzrle_load_setup();
     ramblock_recv_map_init();
+    memset(&ram_area_skip, 0, sizeof(ram_area_skip));
 
     return 0;
 }
@@ -3690,6 +4673,9 @@ int ram_load_postcopy(QEMUFile *f, int channel)
             }
             decompress_data_with_multi_threads(f, page_buffer, len);
             break;
+        case RAM_SAVE_FLAG_EXTENT:
+            ret = load_extent(f, block, addr, host);
+            break;
         case RAM_SAVE_FLAG_MULTIFD_FLUSH:
             multifd_recv_sync_main();
             break;
@@ -3789,6 +4775,452 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
+                                   Error **errp)
+{
+    size_t size = sizeof(*header);
+    size_t ret;
+
+    ret = qemu_get_buffer(file, (uint8_t *)header, size);
+    if (ret != size) {
+        error_setg(errp, "Could not read whole mapped-ram migration header "
+                   "(expected %zd, got %zd bytes)", size, ret);
+        return false;
+    }
+
+    /* migration stream is big-endian */
+    header->version = be32_to_cpu(header->version);
+
+    if (header->version > MAPPED_RAM_HDR_VERSION) {
+        error_setg(errp, "Migration mapped-ram capability version not "
+                   "supported (expected <= %d, got %d)", MAPPED_RAM_HDR_VERSION,
+                   header->version);
+        return false;
+    }
+
+    header->page_size = be64_to_cpu(header->page_size);
+    header->bitmap_offset = be64_to_cpu(header->bitmap_offset);
+    header->pages_offset = be64_to_cpu(header->pages_offset);
+
+    return true;
+}
+
+/* Where @page is in the migration file, @slots is NULL unless prioritized */
+static uint64_t mapped_ram_page_offset(uint64_t pages_offset,
+                                       const uint32_t *slots, long page)
+{
+    return pages_offset +
+           ((uint64_t)(slots ? slots[page] : page) << TARGET_PAGE_BITS);
+}
+
+/*
+ * The end of the run of pages from @page on, before @end, that are in
+ * the migration file one after the other and can be read at once.
+ */
+static long mapped_ram_run_end(const unsigned long *bitmap,
+                               const uint32_t *slots, long page, long end)
+{
+    long next = find_next_zero_bit(bitmap, end, page);
+    long i;
+
+    if (!slots) {
+        return next;
+    }
+    for (i = page + 1; i < next && slots[i] == slots[i - 1] + 1; i++) {
+        /* nothing */
+    }
+    return i;
+}
+
+/* Read the pages of @block that are set in @bitmap from the migration file */
+static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     long num_pages, unsigned long *bitmap,
+                                     const uint32_t *slots, Error **errp)
+{
+    unsigned long set_bit_idx, clear_bit_idx;
+
+    for (set_bit_idx = find_first_bit(bitmap, num_pages);
+         set_bit_idx < num_pages;
+         set_bit_idx = find_next_bit(bitmap, num_pages, clear_bit_idx)) {
+        ram_addr_t offset = (ram_addr_t)set_bit_idx << TARGET_PAGE_BITS;
+        size_t len;
+
+        clear_bit_idx = mapped_ram_run_end(bitmap, slots, set_bit_idx,
+                                           num_pages);
+        len = (clear_bit_idx - set_bit_idx) << TARGET_PAGE_BITS;
+
+        if (!qemu_get_buffer_at(f, block->host + offset, len,
+                                mapped_ram_page_offset(block->pages_offset,
+                                                       slots, set_bit_idx))) {
+            error_setg(errp, "Error reading pages of block %s from the "
+                       "migration file", block->idstr);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Only the machine's main RAM is loaded lazily.  Devices keep host
+ * pointers into their own RAM blocks (video RAM, ROMs, ...) and use
+ * them without going through the softmmu TLB or address_space_*(),
+ * so those blocks are always read while the migration runs.
+ */
+static bool ramblock_can_load_lazily(RAMBlock *block)
+{
+    return migrate_lazy_ram_load() && current_machine &&
+           block->mr == current_machine->ram;
+}
+
+static void ram_lazy_load_free(RAMBlockLazyLoad *lazy)
+{
+    object_unref(OBJECT(lazy->ioc));
+    g_free(lazy->file_bmap);
+    g_free(lazy->slots);
+    g_free(lazy->chunks);
+    g_free(lazy->zbuf);
+    g_free(lazy->pending);
+    g_free(lazy);
+}
+
+/*
+ * Keep @bitmap, the index and a channel of our own on the migration
+ * file, so that ramblock_lazy_populate() can read the pages of @block
+ * after the migration is over.
+ */
+static bool setup_ramblock_lazy_load(QEMUFile *f, RAMBlock *block,
+                                     long num_pages, unsigned long **bitmap,
+                                     uint32_t **slots, MappedRamChunk **chunks,
+                                     Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    RAMBlockLazyLoad *lazy;
+    unsigned long nr_chunks, chunk, page;
+    int fd;
+
+    if (object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        fd = qemu_dup(QIO_CHANNEL_FILE(ioc)->fd);
+        if (fd < 0) {
+            error_setg_errno(errp, errno, "Unable to duplicate the migration "
+                             "file descriptor");
+            return false;
+        }
+        ioc = QIO_CHANNEL(qio_channel_file_new_fd(fd));
+    } else if (QIO_CHANNEL_GET_CLASS(ioc)->io_pread) {
+        /* The channel must keep serving pread after it is closed */
+        object_ref(OBJECT(ioc));
+    } else {
+        error_setg(errp, "lazy-ram-load requires a file or fetch migration URI");
+        return false;
+    }
+
+    nr_chunks = DIV_ROUND_UP(block->used_length, RAM_LAZY_LOAD_CHUNK_SIZE);
+
+    lazy = g_new0(RAMBlockLazyLoad, 1);
+    lazy->ioc = ioc;
+    lazy->pages_offset = block->pages_offset;
+    lazy->file_bmap = g_steal_pointer(bitmap);
+    lazy->slots = g_steal_pointer(slots);
+    lazy->chunks = g_steal_pointer(chunks);
+    if (lazy->chunks) {
+        lazy->zbuf = g_malloc(ram_chunks_bound(RAM_COMPRESSED_CHUNK_SIZE));
+    }
+    lazy->pending = bitmap_new(nr_chunks);
+
+    /* Chunks without a page in the file are left zero, as they are now */
+    for (page = find_first_bit(lazy->file_bmap, num_pages);
+         page < num_pages;
+         page = find_next_bit(lazy->file_bmap, num_pages, page + 1)) {
+        chunk = ((ram_addr_t)page << TARGET_PAGE_BITS) /
+                RAM_LAZY_LOAD_CHUNK_SIZE;
+        if (!test_and_set_bit(chunk, lazy->pending)) {
+            lazy->nr_pending++;
+        }
+    }
+
+    trace_ram_lazy_load_setup(block->idstr, lazy->nr_pending, nr_chunks);
+
+    if (!lazy->nr_pending) {
+        ram_lazy_load_free(lazy);
+        return true;
+    }
+
+    qatomic_rcu_set(&block->lazy_load, lazy);
+    return true;
+}
+
+/*
+ * prioritized-snapshot and compressed-ram: read the header and index
+ * that follow the bitmap of @block, at @pos, into @slots or @chunks.
+ */
+static bool mapped_ram_read_area(QEMUFile *f, RAMBlock *block, uint64_t pos,
+                                 long num_pages, uint32_t **slots,
+                                 MappedRamChunk **chunks, Error **errp)
+{
+    size_t size = mapped_ram_index_size(block->used_length);
+    MappedRamArea skip;
+    void *index;
+    long i;
+
+    if (qemu_get_buffer_at(f, (uint8_t *)&skip, sizeof(skip), pos) !=
+        sizeof(skip)) {
+        error_setg(errp, "Error reading the RAM area header of block %s",
+                   block->idstr);
+        return false;
+    }
+    skip.skip_from = be64_to_cpu(skip.skip_from);
+    skip.skip_to = be64_to_cpu(skip.skip_to);
+    if (skip.skip_from > block->pages_offset ||
+        block->pages_offset > skip.skip_to) {
+        error_setg(errp, "Invalid RAM area for block %s", block->idstr);
+        return false;
+    }
+    ram_area_skip = skip;
+
+    index = g_malloc(size);
+    if (qemu_get_buffer_at(f, index, size, pos + sizeof(skip)) != size) {
+        g_free(index);
+        error_setg(errp, "Error reading the RAM index of block %s",
+                   block->idstr);
+        return false;
+    }
+
+    if (migrate_compressed_ram()) {
+        *chunks = index;
+        for (i = 0; i < size / sizeof(MappedRamChunk); i++) {
+            (*chunks)[i].offset = be64_to_cpu((*chunks)[i].offset);
+            (*chunks)[i].size = be32_to_cpu((*chunks)[i].size);
+        }
+    } else {
+        *slots = index;
+        for (i = 0; i < num_pages; i++) {
+            (*slots)[i] = be32_to_cpu((*slots)[i]);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * compressed-ram: read chunk @chunk of @block from @ioc into place,
+ * using @zbuf for its compressed contents.
+ */
+static bool mapped_ram_read_chunk(QIOChannel *ioc, RAMBlock *block,
+                                  const MappedRamChunk *chunks,
+                                  unsigned long chunk, uint8_t *zbuf,
+                                  Error **errp)
+{
+    ram_addr_t offset = (ram_addr_t)chunk * RAM_COMPRESSED_CHUNK_SIZE;
+    size_t len = MIN(RAM_COMPRESSED_CHUNK_SIZE, block->used_length - offset);
+    const MappedRamChunk *c = &chunks[chunk];
+
+    if (!c->size) {
+        /* All zero */
+        return true;
+    }
+    if (c->size > ram_chunks_bound(RAM_COMPRESSED_CHUNK_SIZE)) {
+        error_setg(errp, "Invalid size of compressed chunk at 0x"
+                   RAM_ADDR_FMT " in block %s", offset, block->idstr);
+        return false;
+    }
+    if (qio_channel_pread(ioc, (char *)zbuf, c->size, c->offset, errp) < 0) {
+        return false;
+    }
+    return ram_chunks_decompress(block->host + offset, len, zbuf, c->size,
+                                 errp);
+}
+
+static bool read_ramblock_compressed(QEMUFile *f, RAMBlock *block,
+                                     const MappedRamChunk *chunks,
+                                     Error **errp)
+{
+    g_autofree uint8_t *zbuf = NULL;
+    unsigned long nr_chunks, chunk;
+
+    nr_chunks = DIV_ROUND_UP(block->used_length, RAM_COMPRESSED_CHUNK_SIZE);
+    zbuf = g_malloc(ram_chunks_bound(RAM_COMPRESSED_CHUNK_SIZE));
+
+    for (chunk = 0; chunk < nr_chunks; chunk++) {
+        if (!mapped_ram_read_chunk(qemu_file_get_ioc(f), block, chunks, chunk,
+                                   zbuf, errp)) {
+            error_prepend(errp, "Error reading pages of block %s from the "
+                          "migration file: ", block->idstr);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                      ram_addr_t length, Error **errp)
+{
+    g_autofree unsigned long *le_bitmap = NULL;
+    g_autofree unsigned long *bitmap = NULL;
+    g_autofree uint32_t *slots = NULL;
+    g_autofree MappedRamChunk *chunks = NULL;
+    MappedRamHeader header;
+    size_t bitmap_size;
+    long num_pages;
+    bool ok;
+
+    if (!mapped_ram_read_header(f, &header, errp)) {
+        return false;
+    }
+
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_setg(errp, "Mismatched mapped-ram page size for block %s "
+                   "(local %zu, remote %" PRIu64 ")", block->idstr,
+                   (size_t)TARGET_PAGE_SIZE, header.page_size);
+        return false;
+    }
+
+    block->pages_offset = header.pages_offset;
+
+    /*
+     * Check the alignment of the file region that contains pages.  We
+     * don't enforce MAPPED_RAM_FILE_OFFSET_ALIGNMENT to allow that
+     * value to change in the future.  Do only a sanity check with page
+     * size alignment.
+     */
+    if (!QEMU_IS_ALIGNED(block->pages_offset, TARGET_PAGE_SIZE)) {
+        error_setg(errp, "Error reading ramblock %s pages, region has bad "
+                   "alignment", block->idstr);
+        return false;
+    }
+
+    num_pages = length >> TARGET_PAGE_BITS;
+    bitmap_size = mapped_ram_bitmap_size(num_pages);
+
+    le_bitmap = g_malloc0(bitmap_size);
+    if (qemu_get_buffer_at(f, (uint8_t *)le_bitmap, bitmap_size,
+                           header.bitmap_offset) != bitmap_size) {
+        error_setg(errp, "Error reading dirty bitmap of block %s",
+                   block->idstr);
+        return false;
+    }
+    bitmap = bitmap_new(num_pages);
+    bitmap_from_le(bitmap, le_bitmap, num_pages);
+
+    if (mapped_ram_in_area() &&
+        !mapped_ram_read_area(f, block, header.bitmap_offset + bitmap_size,
+                              num_pages, &slots, &chunks, errp)) {
+        return false;
+    }
+
+    if (ramblock_can_load_lazily(block)) {
+        ok = setup_ramblock_lazy_load(f, block, num_pages, &bitmap, &slots,
+                                      &chunks, errp);
+    } else if (chunks) {
+        ok = read_ramblock_compressed(f, block, chunks, errp);
+    } else {
+        ok = read_ramblock_mapped_ram(f, block, num_pages, bitmap, slots,
+                                      errp);
+    }
+    if (!ok) {
+        return false;
+    }
+
+    if (mapped_ram_in_area()) {
+        /* Skip the index, the next block follows */
+        qemu_set_offset(f, header.bitmap_offset + bitmap_size +
+                        sizeof(MappedRamArea) +
+                        mapped_ram_index_size(length), SEEK_SET);
+    } else {
+        /* Skip pages array */
+        qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+    }
+
+    return qemu_file_get_error(f) == 0;
+}
+
+static void ram_lazy_load_chunk(RAMBlock *block, RAMBlockLazyLoad *lazy,
+                                unsigned long chunk)
+{
+    long first = (chunk * RAM_LAZY_LOAD_CHUNK_SIZE) >> TARGET_PAGE_BITS;
+    long end = MIN(first + (RAM_LAZY_LOAD_CHUNK_SIZE >> TARGET_PAGE_BITS),
+                   (long)(block->used_length >> TARGET_PAGE_BITS));
+    long page, next;
+
+    if (lazy->chunks) {
+        Error *local_err = NULL;
+
+        if (!mapped_ram_read_chunk(lazy->ioc, block, lazy->chunks, chunk,
+                                   lazy->zbuf, &local_err)) {
+            error_reportf_err(local_err, "lazy-ram-load of block %s: ",
+                              block->idstr);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        for (page = find_next_bit(lazy->file_bmap, end, first);
+             page < end;
+             page = find_next_bit(lazy->file_bmap, end, next)) {
+            ram_addr_t offset = (ram_addr_t)page << TARGET_PAGE_BITS;
+            Error *local_err = NULL;
+
+            next = mapped_ram_run_end(lazy->file_bmap, lazy->slots, page,
+                                      end);
+            if (qio_channel_pread(lazy->ioc, (char *)block->host + offset,
+                                  (next - page) << TARGET_PAGE_BITS,
+                                  mapped_ram_page_offset(lazy->pages_offset,
+                                                         lazy->slots, page),
+                                  &local_err) < 0) {
+                /* The guest already runs and cannot be given stale memory */
+                error_reportf_err(local_err, "lazy-ram-load of block %s: ",
+                                  block->idstr);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    /* Publish the contents before the chunk is seen as loaded */
+    smp_wmb();
+    clear_bit(chunk, lazy->pending);
+    lazy->nr_pending--;
+    trace_ram_lazy_load_chunk(block->idstr, chunk * RAM_LAZY_LOAD_CHUNK_SIZE,
+                              lazy->nr_pending);
+}
+
+void ramblock_lazy_populate_slow(RAMBlock *rb, ram_addr_t offset,
+                                 ram_addr_t length)
+{
+    RAMBlockLazyLoad *lazy;
+    unsigned long chunk, last;
+
+    RCU_READ_LOCK_GUARD();
+
+    lazy = qatomic_rcu_read(&rb->lazy_load);
+    if (!lazy || !length || offset >= rb->used_length) {
+        return;
+    }
+    length = MIN(length, rb->used_length - offset);
+    chunk = offset / RAM_LAZY_LOAD_CHUNK_SIZE;
+    last = (offset + length - 1) / RAM_LAZY_LOAD_CHUNK_SIZE;
+
+    if (find_next_bit(lazy->pending, last + 1, chunk) > last) {
+        /* Pairs with smp_wmb() in ram_lazy_load_chunk() */
+        smp_rmb();
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&lazy_load_lock) {
+        if (qatomic_read(&rb->lazy_load) != lazy) {
+            return;
+        }
+        for (chunk = find_next_bit(lazy->pending, last + 1, chunk);
+             chunk <= last;
+             chunk = find_next_bit(lazy->pending, last + 1, chunk + 1)) {
+            ram_lazy_load_chunk(rb, lazy, chunk);
+        }
+        if (!lazy->nr_pending) {
+            trace_ram_lazy_load_done(rb->idstr);
+            qatomic_rcu_set(&rb->lazy_load, NULL);
+            call_rcu(lazy, ram_lazy_load_free, rcu);
+        }
+    }
+}
+
 static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
 {
     int ret = 0;
@@ -3835,6 +5267,16 @@ static int parse_ramblock(QEMUFile *f, RAMBlock *block, ram_addr_t length)
     ret = rdma_block_notification_handle(f, block->idstr);
     if (ret < 0) {
         qemu_file_set_error(f, ret);
+        return ret;
+    }
+
+    if (migrate_mapped_ram()) {
+        Error *local_err = NULL;
+
+        if (!parse_ramblock_mapped_ram(f, block, length, &local_err)) {
+            error_report_err(local_err);
+            return -EINVAL;
+        }
     }
 
     return ret;
@@ -3858,6 +5300,11 @@ static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
         block = qemu_ram_block_by_name(id);
         if (block) {
             ret = parse_ramblock(f, block, length);
+        } else if (!strcmp(id, RAM_INCREMENTAL_MARKER)) {
+            error_report("The migration stream is an incremental snapshot; "
+                         "merge it with the snapshots it builds on using "
+                         "scripts/merge-snapshots.py");
+            ret = -EINVAL;
         } else {
             error_report("Unknown ramblock \"%s\", cannot accept "
                          "migration", id);
@@ -3869,6 +5316,38 @@ static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
     return ret;
 }
 
+/*
+ * Load a RAM_SAVE_FLAG_EXTENT record for the pages at @addr in @block,
+ * whose first page is mapped at @host.
+ */
+static int load_extent(QEMUFile *f, RAMBlock *block, ram_addr_t addr,
+                       void *host)
+{
+    uint32_t npages = qemu_get_be32(f);
+    uint64_t pos = qemu_get_be64(f);
+    uint64_t len = (uint64_t)npages << TARGET_PAGE_BITS;
+
+    if (!npages || len > block->used_length - addr) {
+        error_report("Invalid extent of %" PRIu32 " pages at " RAM_ADDR_FMT
+                     " in block %s", npages, addr, block->idstr);
+        return -EINVAL;
+    }
+
+    ramblock_recv_bitmap_set_range(block, host, npages);
+
+    if (pos == RAM_EXTENT_ZERO) {
+        ram_handle_zero(host, len);
+        return 0;
+    }
+
+    if (qemu_get_buffer_at(f, host, len, pos) != len) {
+        error_report("Failed to read extent at " RAM_ADDR_FMT " in block %s "
+                     "from offset %" PRIu64, addr, block->idstr, pos);
+        return -EIO;
+    }
+    return 0;
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -3887,8 +5366,12 @@ static int ram_load_precopy(QEMUFile *f)
     if (!migrate_compress()) {
         invalid_flags |= RAM_SAVE_FLAG_COMPRESS_PAGE;
     }
+    if (migration_incoming_colo_enabled()) {
+        invalid_flags |= RAM_SAVE_FLAG_EXTENT;
+    }
 
     while (!ret && !(flags & RAM_SAVE_FLAG_EOS)) {
+        RAMBlock *block = NULL;
         ram_addr_t addr;
         void *host = NULL, *host_bak = NULL;
         uint8_t ch;
@@ -3912,15 +5395,19 @@ static int ram_load_precopy(QEMUFile *f)
             if (flags & invalid_flags & RAM_SAVE_FLAG_COMPRESS_PAGE) {
                 error_report("Received an unexpected compressed page");
             }
+            if (flags & invalid_flags & RAM_SAVE_FLAG_EXTENT) {
+                error_report("Received an unexpected page extent");
+            }
 
             ret = -EINVAL;
             break;
         }
 
         if (flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE |
-                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE)) {
-            RAMBlock *block = ram_block_from_stream(mis, f, flags,
-                                                    RAM_CHANNEL_PRECOPY);
+                     RAM_SAVE_FLAG_COMPRESS_PAGE | RAM_SAVE_FLAG_XBZRLE |
+                     RAM_SAVE_FLAG_EXTENT)) {
+            block = ram_block_from_stream(mis, f, flags,
+                                          RAM_CHANNEL_PRECOPY);
 
             host = host_from_ram_block_offset(block, addr);
             /*
@@ -4043,6 +5530,13 @@ static int ram_load(QEMUFile *f, void *opaque, int version_id)
         return -EINVAL;
     }
 
+    if (ram_area_skip.skip_to &&
+        qemu_get_offset(f) == ram_area_skip.skip_from) {
+        /* prioritized-snapshot: the pages were read with the block list */
+        qemu_set_offset(f, ram_area_skip.skip_to, SEEK_SET);
+        ram_area_skip.skip_to = 0;
+    }
+
     /*
      * This RCU critical section can be very long running.
      * When RCU reclaims in the code start to become numerous,
@@ -4303,6 +5797,8 @@ static RAMBlockNotifier ram_mig_ram_notifier = {
 void ram_mig_init(void)
 {
     qemu_mutex_init(&XBZRLE.lock);
+    qemu_mutex_init(&lazy_load_lock);
+    qemu_mutex_init(&write_track_lock);
     register_savevm_live("ram", 0, 4, &savevm_ram_handlers, &ram_state);
     ram_block_notifier_add(&ram_mig_ram_notifier);
 }
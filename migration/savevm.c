@@ -1531,14 +1531,12 @@ int qemu_savevm_state_complete_precopy_iterable(QEMUFile *f, bool in_postcopy)
     return 0;
 }
 
-int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
-                                                    bool in_postcopy,
-                                                    bool inactivate_disks)
+static int qemu_savevm_state_save_devices(QEMUFile *f)
 {
     MigrationState *ms = migrate_get_current();
     int64_t start_ts_each, end_ts_each;
+    int64_t start = migration_stage_start();
     JSONWriter *vmdesc = ms->vmdesc;
-    int vmdesc_len;
     SaveStateEntry *se;
     int ret;
 
@@ -1561,6 +1559,19 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                     end_ts_each - start_ts_each);
     }
 
+    migration_stage_end(MIGRATION_STAGE_DEVICE_SAVE, start);
+    return 0;
+}
+
+/* Everything that follows the last section: EOF and the VM description */
+static int qemu_savevm_state_finish(QEMUFile *f, bool in_postcopy,
+                                    bool inactivate_disks)
+{
+    MigrationState *ms = migrate_get_current();
+    JSONWriter *vmdesc = ms->vmdesc;
+    int vmdesc_len;
+    int ret;
+
     if (inactivate_disks) {
         /* Inactivate before sending QEMU_VM_EOF so that the
          * bdrv_activate_all() on the other end won't fail. */
@@ -1599,6 +1610,20 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
     return 0;
 }
 
+int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
+                                                    bool in_postcopy,
+                                                    bool inactivate_disks)
+{
+    int ret;
+
+    ret = qemu_savevm_state_save_devices(f);
+    if (ret) {
+        return ret;
+    }
+
+    return qemu_savevm_state_finish(f, in_postcopy, inactivate_disks);
+}
+
 int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
                                        bool inactivate_disks)
 {
@@ -1614,6 +1639,27 @@ int qemu_savevm_state_complete_precopy(QEMUFile *f, bool iterable_only,
 
     cpu_synchronize_all_states();
 
+    if (migrate_prioritized_snapshot() && !in_postcopy && !iterable_only) {
+        /*
+         * The device state goes before what the iterable sections have
+         * left to send, which with prioritized-snapshot is all of RAM:
+         * a destination can then start the VM before it reads the RAM.
+         */
+        ret = qemu_savevm_state_save_devices(f);
+        if (ret) {
+            return ret;
+        }
+        ret = qemu_savevm_state_complete_precopy_iterable(f, false);
+        if (ret) {
+            return ret;
+        }
+        ret = qemu_savevm_state_finish(f, false, inactivate_disks);
+        if (ret) {
+            return ret;
+        }
+        goto flush;
+    }
+
     if (!in_postcopy || iterable_only) {
         ret = qemu_savevm_state_complete_precopy_iterable(f, in_postcopy);
         if (ret) {
@@ -3057,6 +3103,17 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         return false;
     }
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "savevm does not support the mapped-ram capability");
+        return false;
+    }
+
+    if (migrate_incremental_snapshot()) {
+        error_setg(errp, "savevm does not support the incremental-snapshot "
+                   "capability");
+        return false;
+    }
+
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
@@ -3261,6 +3318,11 @@ bool load_snapshot(const char *name, const char *vmstate,
     AioContext *aio_context;
     MigrationIncomingState *mis = migration_incoming_get_current();
 
+    if (migrate_mapped_ram()) {
+        error_setg(errp, "loadvm does not support the mapped-ram capability");
+        return false;
+    }
+
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -24,28 +24,209 @@
 #include "migration.h"
 #include "qemu-file.h"
 #include "io/channel-socket.h"
+#include "io/channel-tls.h"
+#include "io/channel-websock.h"
 #include "io/net-listener.h"
 #include "trace.h"
 #include "postcopy-ram.h"
 #include "options.h"
+#include "tls.h"
 #include "qapi/clone-visitor.h"
+#include "qapi/qapi-visit-migration.h"
 #include "qapi/qapi-visit-sockets.h"
 
 struct SocketOutgoingArgs {
     SocketAddress *saddr;
+    /* Set instead of saddr for websocket migration */
+    WebsocketMigrationArgs *ws;
 } outgoing_args;
 
+/*
+ * The websocket of a connection, over a TLS channel for wss://, over the
+ * socket.  The stack is built before connecting, so that the task of
+ * an asynchronous connection already has the channel for its callback.
+ */
+typedef struct WebsocketConnect {
+    WebsocketMigrationArgs *args;
+    QIOChannelSocket *sioc;
+    QIOChannelWebsock *wioc;
+} WebsocketConnect;
+
+typedef struct WebsocketTLSHandshake {
+    GMainLoop *loop;
+    bool complete;
+    Error *err;
+} WebsocketTLSHandshake;
+
+static void websocket_connect_free(gpointer opaque)
+{
+    WebsocketConnect *c = opaque;
+
+    qapi_free_WebsocketMigrationArgs(c->args);
+    object_unref(OBJECT(c->sioc));
+    g_free(c);
+}
+
+static WebsocketConnect *websocket_connect_new(WebsocketMigrationArgs *args,
+                                               Error **errp)
+{
+    WebsocketConnect *c = g_new0(WebsocketConnect, 1);
+    QIOChannel *master;
+
+    c->args = QAPI_CLONE(WebsocketMigrationArgs, args);
+    c->sioc = qio_channel_socket_new();
+    master = QIO_CHANNEL(c->sioc);
+
+    if (args->secure) {
+        QIOChannelTLS *tioc;
+
+        tioc = migration_tls_client_create(master, args->addr->host, errp);
+        if (!tioc) {
+            websocket_connect_free(c);
+            return NULL;
+        }
+        master = QIO_CHANNEL(tioc);
+        qio_channel_set_name(master, "migration-websocket-tls");
+    }
+
+    c->wioc = qio_channel_websock_new_client(master);
+    if (args->secure) {
+        /* The websocket holds it now */
+        object_unref(OBJECT(master));
+    }
+    return c;
+}
+
+static void websocket_tls_handshake_done(QIOTask *task, gpointer opaque)
+{
+    WebsocketTLSHandshake *data = opaque;
+
+    qio_task_propagate_error(task, &data->err);
+    data->complete = true;
+    g_main_loop_quit(data->loop);
+}
+
+static int websocket_tls_handshake_sync(QIOChannelTLS *tioc, Error **errp)
+{
+    GMainContext *ctx = g_main_context_new();
+    WebsocketTLSHandshake data = {
+        .loop = g_main_loop_new(ctx, FALSE),
+    };
+
+    qio_channel_tls_handshake(tioc, websocket_tls_handshake_done, &data,
+                              NULL, ctx);
+    if (!data.complete) {
+        g_main_loop_run(data.loop);
+    }
+    g_main_loop_unref(data.loop);
+    g_main_context_unref(ctx);
+
+    if (data.err) {
+        error_propagate(errp, data.err);
+        return -1;
+    }
+    return 0;
+}
+
+/* Connects, then runs the TLS and websocket handshakes; blocks */
+static int websocket_connect_sync(WebsocketConnect *c, Error **errp)
+{
+    InetSocketAddress *inet = c->args->addr;
+    SocketAddress saddr = {
+        .type = SOCKET_ADDRESS_TYPE_INET,
+        .u.inet = *inet,
+    };
+    g_autofree char *host = NULL;
+
+    if (qio_channel_socket_connect_sync(c->sioc, &saddr, errp) < 0) {
+        return -1;
+    }
+
+    if (c->args->secure &&
+        websocket_tls_handshake_sync(QIO_CHANNEL_TLS(c->wioc->master),
+                                     errp) < 0) {
+        return -1;
+    }
+
+    host = g_strdup_printf(strchr(inet->host, ':') ? "[%s]:%s" : "%s:%s",
+                           inet->host, inet->port);
+    return qio_channel_websock_handshake_client(c->wioc, host,
+                                                c->args->path ?: "/", errp);
+}
+
+static void websocket_connect_worker(QIOTask *task, gpointer opaque)
+{
+    Error *err = NULL;
+
+    if (websocket_connect_sync(opaque, &err) < 0) {
+        qio_task_set_error(task, err);
+    }
+}
+
+/*
+ * Like qio_channel_socket_connect_async(): @f gets the websocket channel
+ * as the source of its task, and the reference to it.
+ */
+static void websocket_connect_async(WebsocketMigrationArgs *args,
+                                    const char *name,
+                                    QIOTaskFunc f, gpointer data,
+                                    GDestroyNotify destroy)
+{
+    Error *err = NULL;
+    WebsocketConnect *c = websocket_connect_new(args, &err);
+    QIOTask *task;
+
+    if (!c) {
+        /* Hand @f an unconnected socket to fail with */
+        QIOChannelSocket *sioc = qio_channel_socket_new();
+
+        task = qio_task_new(OBJECT(sioc), f, data, destroy);
+        qio_task_set_error(task, err);
+        qio_task_complete(task);
+        return;
+    }
+
+    qio_channel_set_name(QIO_CHANNEL(c->wioc), name);
+    task = qio_task_new(OBJECT(c->wioc), f, data, destroy);
+    qio_task_run_in_thread(task, websocket_connect_worker, c,
+                           websocket_connect_free, NULL);
+}
+
 void socket_send_channel_create(QIOTaskFunc f, void *data)
 {
-    QIOChannelSocket *sioc = qio_channel_socket_new();
+    QIOChannelSocket *sioc;
+
+    if (outgoing_args.ws) {
+        websocket_connect_async(outgoing_args.ws, "migration-websocket-channel",
+                                f, data, NULL);
+        return;
+    }
+
+    sioc = qio_channel_socket_new();
     qio_channel_socket_connect_async(sioc, outgoing_args.saddr,
                                      f, data, NULL, NULL);
 }
 
 QIOChannel *socket_send_channel_create_sync(Error **errp)
 {
-    QIOChannelSocket *sioc = qio_channel_socket_new();
+    QIOChannelSocket *sioc;
+
+    if (outgoing_args.ws) {
+        WebsocketConnect *c = websocket_connect_new(outgoing_args.ws, errp);
+        QIOChannel *ioc = NULL;
+
+        if (c) {
+            if (websocket_connect_sync(c, errp) < 0) {
+                object_unref(OBJECT(c->wioc));
+            } else {
+                ioc = QIO_CHANNEL(c->wioc);
+            }
+            websocket_connect_free(c);
+        }
+        return ioc;
+    }
 
+    sioc = qio_channel_socket_new();
     if (!outgoing_args.saddr) {
         object_unref(OBJECT(sioc));
         error_setg(errp, "Initial sock address not set!");
@@ -68,6 +249,10 @@ int socket_send_channel_destroy(QIOChannel *send)
         qapi_free_SocketAddress(outgoing_args.saddr);
         outgoing_args.saddr = NULL;
     }
+    if (outgoing_args.ws) {
+        qapi_free_WebsocketMigrationArgs(outgoing_args.ws);
+        outgoing_args.ws = NULL;
+    }
     return 0;
 }
 
@@ -123,6 +308,8 @@ void socket_start_outgoing_migration(MigrationState *s,
     /* in case previous migration leaked it */
     qapi_free_SocketAddress(outgoing_args.saddr);
     outgoing_args.saddr = addr;
+    qapi_free_WebsocketMigrationArgs(outgoing_args.ws);
+    outgoing_args.ws = NULL;
 
     if (saddr->type == SOCKET_ADDRESS_TYPE_INET) {
         data->hostname = g_strdup(saddr->u.inet.host);
@@ -137,6 +324,31 @@ void socket_start_outgoing_migration(MigrationState *s,
                                      NULL);
 }
 
+void websocket_start_outgoing_migration(MigrationState *s,
+                                        WebsocketMigrationArgs *args,
+                                        Error **errp)
+{
+    struct SocketConnectData *data;
+
+    if (args->secure && !migrate_tls()) {
+        error_setg(errp, "wss:// migration needs the tls-creds parameter");
+        return;
+    }
+
+    data = g_new0(struct SocketConnectData, 1);
+    data->s = s;
+    data->hostname = g_strdup(args->addr->host);
+
+    qapi_free_SocketAddress(outgoing_args.saddr);
+    outgoing_args.saddr = NULL;
+    qapi_free_WebsocketMigrationArgs(outgoing_args.ws);
+    outgoing_args.ws = QAPI_CLONE(WebsocketMigrationArgs, args);
+
+    websocket_connect_async(args, "migration-websocket-outgoing",
+                            socket_outgoing_migration, data,
+                            socket_connect_data_free);
+}
+
 static void socket_accept_incoming_migration(QIONetListener *listener,
                                              QIOChannelSocket *cioc,
                                              gpointer opaque)
@@ -162,8 +374,10 @@ socket_incoming_migration_end(void *opaque)
     object_unref(OBJECT(listener));
 }
 
-void socket_start_incoming_migration(SocketAddress *saddr,
-                                     Error **errp)
+static void socket_listen_incoming(SocketAddress *saddr,
+                                   QIONetListenerClientFunc func,
+                                   gpointer opaque,
+                                   Error **errp)
 {
     QIONetListener *listener = qio_net_listener_new();
     MigrationIncomingState *mis = migration_incoming_get_current();
@@ -186,9 +400,7 @@ void socket_start_incoming_migration(SocketAddress *saddr,
     mis->transport_data = listener;
     mis->transport_cleanup = socket_incoming_migration_end;
 
-    qio_net_listener_set_client_func_full(listener,
-                                          socket_accept_incoming_migration,
-                                          NULL, NULL,
+    qio_net_listener_set_client_func_full(listener, func, opaque, NULL,
                                           g_main_context_get_thread_default());
 
     for (i = 0; i < listener->nsioc; i++)  {
@@ -202,3 +414,102 @@ void socket_start_incoming_migration(SocketAddress *saddr,
     }
 }
 
+void socket_start_incoming_migration(SocketAddress *saddr,
+                                     Error **errp)
+{
+    socket_listen_incoming(saddr, socket_accept_incoming_migration, NULL,
+                           errp);
+}
+
+static void websocket_incoming_handshake(QIOTask *task, gpointer opaque)
+{
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *err = NULL;
+
+    if (qio_task_propagate_error(task, &err)) {
+        trace_migration_websocket_incoming_handshake_error(
+            error_get_pretty(err));
+        error_report_err(err);
+    } else {
+        /*
+         * Without MSG_PEEK on websockets, the main channel is told apart
+         * from the multifd ones by arriving first.  The source only opens
+         * the others once the handshake of the main one is done, and we
+         * get here as soon as we sent our side of it.
+         */
+        migration_channel_process_incoming(ioc);
+    }
+    object_unref(OBJECT(ioc));
+}
+
+static void websocket_incoming_upgrade(QIOChannel *master)
+{
+    QIOChannelWebsock *wioc = qio_channel_websock_new_server(master);
+
+    qio_channel_set_name(QIO_CHANNEL(wioc), "migration-websocket-incoming");
+    qio_channel_websock_handshake(wioc, websocket_incoming_handshake,
+                                  NULL, NULL);
+}
+
+static void websocket_incoming_tls_handshake(QIOTask *task, gpointer opaque)
+{
+    QIOChannel *ioc = QIO_CHANNEL(qio_task_get_source(task));
+    Error *err = NULL;
+
+    if (qio_task_propagate_error(task, &err)) {
+        trace_migration_websocket_incoming_handshake_error(
+            error_get_pretty(err));
+        error_report_err(err);
+    } else {
+        websocket_incoming_upgrade(ioc);
+    }
+    object_unref(OBJECT(ioc));
+}
+
+static void websocket_accept_incoming_migration(QIONetListener *listener,
+                                                QIOChannelSocket *cioc,
+                                                gpointer opaque)
+{
+    bool secure = GPOINTER_TO_INT(opaque);
+    QIOChannelTLS *tioc;
+    Error *err = NULL;
+
+    trace_migration_socket_incoming_accepted();
+
+    if (migration_has_all_channels()) {
+        error_report("%s: Extra incoming migration connection; ignoring",
+                     __func__);
+        return;
+    }
+
+    if (!secure) {
+        websocket_incoming_upgrade(QIO_CHANNEL(cioc));
+        return;
+    }
+
+    tioc = migration_tls_server_create(QIO_CHANNEL(cioc), &err);
+    if (!tioc) {
+        error_report_err(err);
+        return;
+    }
+    qio_channel_set_name(QIO_CHANNEL(tioc), "migration-websocket-tls");
+    qio_channel_tls_handshake(tioc, websocket_incoming_tls_handshake,
+                              NULL, NULL, NULL);
+}
+
+void websocket_start_incoming_migration(WebsocketMigrationArgs *args,
+                                        Error **errp)
+{
+    SocketAddress saddr = {
+        .type = SOCKET_ADDRESS_TYPE_INET,
+        .u.inet = *args->addr,
+    };
+
+    if (args->secure && !migrate_tls()) {
+        error_setg(errp, "wss:// migration needs the tls-creds parameter");
+        return;
+    }
+
+    socket_listen_incoming(&saddr, websocket_accept_incoming_migration,
+                           GINT_TO_POINTER(args->secure), errp);
+}
@@ -20,6 +20,7 @@
 #include "io/channel.h"
 #include "io/task.h"
 #include "qemu/sockets.h"
+#include "qapi/qapi-types-migration.h"
 
 void socket_send_channel_create(QIOTaskFunc f, void *data);
 QIOChannel *socket_send_channel_create_sync(Error **errp);
@@ -29,4 +30,11 @@ void socket_start_incoming_migration(SocketAddress *saddr, Error **errp);
 
 void socket_start_outgoing_migration(MigrationState *s,
                                      SocketAddress *saddr, Error **errp);
+
+void websocket_start_incoming_migration(WebsocketMigrationArgs *args,
+                                        Error **errp);
+
+void websocket_start_outgoing_migration(MigrationState *s,
+                                        WebsocketMigrationArgs *args,
+                                        Error **errp);
 #endif
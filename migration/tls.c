@@ -24,6 +24,7 @@
 #include "tls.h"
 #include "options.h"
 #include "crypto/tlscreds.h"
+#include "io/channel-websock.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
 #include "trace.h"
@@ -71,19 +72,25 @@ static void migration_tls_incoming_handshake(QIOTask *task,
     object_unref(OBJECT(ioc));
 }
 
-void migration_tls_channel_process_incoming(MigrationState *s,
-                                            QIOChannel *ioc,
-                                            Error **errp)
+QIOChannelTLS *migration_tls_server_create(QIOChannel *ioc, Error **errp)
 {
     QCryptoTLSCreds *creds;
-    QIOChannelTLS *tioc;
 
     creds = migration_tls_get_creds(QCRYPTO_TLS_CREDS_ENDPOINT_SERVER, errp);
     if (!creds) {
-        return;
+        return NULL;
     }
 
-    tioc = qio_channel_tls_new_server(ioc, creds, migrate_tls_authz(), errp);
+    return qio_channel_tls_new_server(ioc, creds, migrate_tls_authz(), errp);
+}
+
+void migration_tls_channel_process_incoming(MigrationState *s,
+                                            QIOChannel *ioc,
+                                            Error **errp)
+{
+    QIOChannelTLS *tioc;
+
+    tioc = migration_tls_server_create(ioc, errp);
     if (!tioc) {
         return;
     }
@@ -162,5 +169,12 @@ bool migrate_channel_requires_tls_upgrade(QIOChannel *ioc)
         return false;
     }
 
+    /* wss:// migration already runs TLS below the websocket */
+    if (object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_WEBSOCK) &&
+        object_dynamic_cast(OBJECT(QIO_CHANNEL_WEBSOCK(ioc)->master),
+                            TYPE_QIO_CHANNEL_TLS)) {
+        return false;
+    }
+
     return !object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_TLS);
 }
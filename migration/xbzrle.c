@@ -161,6 +161,121 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 #define xbzrle_encode_buffer xbzrle_encode_buffer_int
 #endif
 
+#if defined(__aarch64__) || defined(__wasm_simd128__)
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+/* Bits per byte in the masks returned by xbzrle_vec_eq() */
+#define XBZRLE_VEC_BITS 4
+#define XBZRLE_VEC_MASK UINT64_MAX
+
+static inline uint64_t xbzrle_vec_eq(const uint8_t *a, const uint8_t *b)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8(a), vld1q_u8(b));
+
+    /* Narrow each 0x00/0xff byte to a nibble */
+    return vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+#else
+#include <wasm_simd128.h>
+
+#define XBZRLE_VEC_BITS 1
+#define XBZRLE_VEC_MASK 0xffffULL
+
+static inline uint64_t xbzrle_vec_eq(const uint8_t *a, const uint8_t *b)
+{
+    return wasm_i8x16_bitmask(wasm_i8x16_eq(wasm_v128_load(a),
+                                            wasm_v128_load(b)));
+}
+#endif
+
+/*
+ * Returns the index of the first byte from @i on where @old_buf and
+ * @new_buf are different (@same) or equal (!@same), or @slen.
+ */
+static inline int xbzrle_run_end(uint8_t *old_buf, uint8_t *new_buf,
+                                 int i, int slen, bool same)
+{
+    while (i + 16 <= slen) {
+        uint64_t mask = xbzrle_vec_eq(old_buf + i, new_buf + i);
+
+        if (same) {
+            mask ^= XBZRLE_VEC_MASK;
+        }
+        if (mask) {
+            return i + ctz64(mask) / XBZRLE_VEC_BITS;
+        }
+        i += 16;
+    }
+    while (i < slen && (old_buf[i] == new_buf[i]) == same) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen);
+
+/* Same output as xbzrle_encode_buffer_int(), 16 bytes at a time */
+static int xbzrle_encode_buffer_vec(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
+{
+    int d = 0, i = 0, start;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_run_end(old_buf, new_buf, i, slen, true);
+
+        /* buffer unchanged */
+        if (i - start == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (i == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, i - start);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        start = i;
+        i = xbzrle_run_end(old_buf, new_buf, i, slen, false);
+
+        d += uleb128_encode_small(dst + d, i - start);
+        /* overflow */
+        if (d + i - start > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + start, i - start);
+        d += i - start;
+    }
+
+    return d;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    if (slen < 16) {
+        return xbzrle_encode_buffer_int(old_buf, new_buf, slen, dst, dlen);
+    }
+    return xbzrle_encode_buffer_vec(old_buf, new_buf, slen, dst, dlen);
+}
+
+#define xbzrle_encode_buffer xbzrle_encode_buffer_int
+#endif
+
 /*
   page = zrun nzrun
        | zrun nzrun page
@@ -25,6 +25,7 @@
 #include "qapi/qapi-commands-misc.h"
 #include "qapi/qmp/qdict.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "hw/intc/intc.h"
 #include "qemu/log.h"
 #include "sysemu/sysemu.h"
@@ -232,6 +233,28 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     qapi_free_IOThreadInfoList(info_list);
 }
 
+void hmp_info_heap(Monitor *mon, const QDict *qdict)
+{
+    HeapInfo *info = qmp_query_heap(NULL);
+    HeapSubsystemInfoList *sub;
+    uint64_t total = 0;
+
+    for (sub = info->subsystems; sub; sub = sub->next) {
+        monitor_printf(mon, "%-18s %10" PRIu64 " KiB (peak %" PRIu64 " KiB)\n",
+                       HeapSubsystem_str(sub->value->subsystem),
+                       sub->value->bytes / KiB, sub->value->peak_bytes / KiB);
+        total += sub->value->bytes;
+    }
+    monitor_printf(mon, "%-18s %10" PRIu64 " KiB\n", "accounted", total / KiB);
+    if (info->has_heap_break) {
+        monitor_printf(mon, "%-18s %10" PRIu64 " KiB of %" PRIu64 " KiB\n",
+                       "heap break", info->heap_break / KiB,
+                       info->heap_max / KiB);
+    }
+
+    qapi_free_HeapInfo(info);
+}
+
 void hmp_help(Monitor *mon, const QDict *qdict)
 {
     hmp_help_cmd(mon, qdict_get_try_str(qdict, "name"));
@@ -14,6 +14,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/heap-account.h"
 #include "qemu/sockets.h"
 #include "monitor-internal.h"
 #include "monitor/qdev.h"
@@ -32,6 +33,9 @@
 #include "hw/mem/memory-device.h"
 #include "hw/intc/intc.h"
 #include "hw/rdma/rdma.h"
+#ifdef EMSCRIPTEN
+#include <emscripten/heap.h>
+#endif
 
 NameInfo *qmp_query_name(Error **errp)
 {
@@ -41,6 +45,30 @@ NameInfo *qmp_query_name(Error **errp)
     return info;
 }
 
+HeapInfo *qmp_query_heap(Error **errp)
+{
+    HeapInfo *info = g_new0(HeapInfo, 1);
+    HeapSubsystemInfoList **tail = &info->subsystems;
+
+#ifdef EMSCRIPTEN
+    info->has_heap_max = true;
+    info->heap_max = emscripten_get_heap_max();
+    info->has_heap_break = true;
+    info->heap_break = (uintptr_t)sbrk(0);
+#endif
+
+    for (HeapSubsystem i = 0; i < HEAP_SUBSYSTEM__MAX; i++) {
+        HeapSubsystemInfo *sub = g_new0(HeapSubsystemInfo, 1);
+        size_t peak;
+
+        sub->subsystem = i;
+        sub->bytes = heap_account_get(i, &peak);
+        sub->peak_bytes = peak;
+        QAPI_LIST_APPEND(tail, sub);
+    }
+    return info;
+}
+
 void qmp_quit(Error **errp)
 {
     shutdown_action = SHUTDOWN_ACTION_POWEROFF;
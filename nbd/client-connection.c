@@ -26,6 +26,7 @@
 #include "trace.h"
 
 #include "block/nbd.h"
+#include "io/channel-websock.h"
 
 #include "qapi/qapi-visit-sockets.h"
 #include "qapi/clone-visitor.h"
@@ -36,6 +37,7 @@ struct NBDClientConnection {
     SocketAddress *saddr; /* address to connect to */
     QCryptoTLSCreds *tlscreds;
     char *tlshostname;
+    char *websocket; /* path of the websocket resource, or NULL */
     NBDExportInfo initial_info;
     bool do_negotiation;
     bool do_retry;
@@ -81,7 +83,8 @@ NBDClientConnection *nbd_client_connection_new(const SocketAddress *saddr,
                                                const char *export_name,
                                                const char *x_dirty_bitmap,
                                                QCryptoTLSCreds *tlscreds,
-                                               const char *tlshostname)
+                                               const char *tlshostname,
+                                               const char *websocket)
 {
     NBDClientConnection *conn = g_new(NBDClientConnection, 1);
 
@@ -90,6 +93,7 @@ NBDClientConnection *nbd_client_connection_new(const SocketAddress *saddr,
         .saddr = QAPI_CLONE(SocketAddress, saddr),
         .tlscreds = tlscreds,
         .tlshostname = g_strdup(tlshostname),
+        .websocket = g_strdup(websocket),
         .do_negotiation = do_negotiation,
 
         .initial_info.request_sizes = true,
@@ -106,6 +110,9 @@ NBDClientConnection *nbd_client_connection_new(const SocketAddress *saddr,
 
 static void nbd_client_connection_do_free(NBDClientConnection *conn)
 {
+    if (conn->ioc) {
+        object_unref(OBJECT(conn->ioc));
+    }
     if (conn->sioc) {
         qio_channel_close(QIO_CHANNEL(conn->sioc), NULL);
         object_unref(OBJECT(conn->sioc));
@@ -113,24 +120,55 @@ static void nbd_client_connection_do_free(NBDClientConnection *conn)
     error_free(conn->err);
     qapi_free_SocketAddress(conn->saddr);
     g_free(conn->tlshostname);
+    g_free(conn->websocket);
     object_unref(OBJECT(conn->tlscreds));
     g_free(conn->initial_info.x_dirty_bitmap);
     g_free(conn->initial_info.name);
     g_free(conn);
 }
 
+/*
+ * Upgrade the connection to the websocket resource @path, for servers
+ * behind a websocket proxy, which is all a browser can reach.
+ */
+static QIOChannelWebsock *nbd_connect_websocket(QIOChannelSocket *sioc,
+                                                SocketAddress *addr,
+                                                const char *path,
+                                                Error **errp)
+{
+    QIOChannelWebsock *wioc;
+    g_autofree char *host = NULL;
+
+    if (addr->type == SOCKET_ADDRESS_TYPE_INET) {
+        host = g_strdup_printf("%s:%s", addr->u.inet.host, addr->u.inet.port);
+    } else {
+        host = g_strdup("localhost");
+    }
+
+    wioc = qio_channel_websock_new_client(QIO_CHANNEL(sioc));
+    if (qio_channel_websock_handshake_client(wioc, host, path, errp) < 0) {
+        object_unref(OBJECT(wioc));
+        return NULL;
+    }
+    return wioc;
+}
+
 /*
  * Connect to @addr and do NBD negotiation if @info is not null. If @tlscreds
- * are given @outioc is returned. @outioc is provided only on success.  The call
- * may be cancelled from other thread by simply qio_channel_shutdown(sioc).
+ * or @websocket are given @outioc is returned. @outioc is provided only on
+ * success.  The call may be cancelled from other thread by simply
+ * qio_channel_shutdown(sioc).
  */
 static int nbd_connect(QIOChannelSocket *sioc, SocketAddress *addr,
                        NBDExportInfo *info, QCryptoTLSCreds *tlscreds,
-                       const char *tlshostname,
+                       const char *tlshostname, const char *websocket,
                        QIOChannel **outioc, Error **errp)
 {
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
+    QIOChannelWebsock *wioc = NULL;
     int ret;
 
+    assert(!websocket || outioc);
     if (outioc) {
         *outioc = NULL;
     }
@@ -142,11 +180,23 @@ static int nbd_connect(QIOChannelSocket *sioc, SocketAddress *addr,
 
     qio_channel_set_delay(QIO_CHANNEL(sioc), false);
 
+    if (websocket) {
+        wioc = nbd_connect_websocket(sioc, addr, websocket, errp);
+        if (!wioc) {
+            qio_channel_close(QIO_CHANNEL(sioc), NULL);
+            return -EINVAL;
+        }
+        ioc = QIO_CHANNEL(wioc);
+    }
+
     if (!info) {
+        if (wioc) {
+            *outioc = ioc;
+        }
         return 0;
     }
 
-    ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), tlscreds, tlshostname,
+    ret = nbd_receive_negotiate(ioc, tlscreds, tlshostname,
                                 outioc, info, errp);
     if (ret < 0) {
         /*
@@ -159,12 +209,24 @@ static int nbd_connect(QIOChannelSocket *sioc, SocketAddress *addr,
             object_unref(OBJECT(*outioc));
             *outioc = NULL;
         } else {
-            qio_channel_close(QIO_CHANNEL(sioc), NULL);
+            qio_channel_close(ioc, NULL);
+        }
+        if (wioc) {
+            object_unref(OBJECT(wioc));
         }
 
         return ret;
     }
 
+    if (wioc) {
+        if (*outioc) {
+            /* TLS channel now has own reference to the websocket one */
+            object_unref(OBJECT(wioc));
+        } else {
+            *outioc = ioc;
+        }
+    }
+
     return 0;
 }
 
@@ -190,7 +252,7 @@ static void *connect_thread_func(void *opaque)
         ret = nbd_connect(conn->sioc, conn->saddr,
                           conn->do_negotiation ? &conn->updated_info : NULL,
                           conn->tlscreds, conn->tlshostname,
-                          &conn->ioc, &local_err);
+                          conn->websocket, &conn->ioc, &local_err);
 
         /*
          * conn->updated_info will finally be returned to the user. Clear the
@@ -310,16 +372,14 @@ nbd_co_establish_connection(NBDClientConnection *conn, NBDExportInfo *info,
                 /* Previous attempt finally succeeded in background */
                 if (conn->do_negotiation) {
                     memcpy(info, &conn->updated_info, sizeof(*info));
-                    if (conn->ioc) {
-                        /* TLS channel now has own reference to parent */
-                        object_unref(OBJECT(conn->sioc));
-                        conn->sioc = NULL;
-
-                        return g_steal_pointer(&conn->ioc);
-                    }
                 }
+                if (conn->ioc) {
+                    /* TLS or websocket channel has own reference to parent */
+                    object_unref(OBJECT(conn->sioc));
+                    conn->sioc = NULL;
 
-                assert(!conn->ioc);
+                    return g_steal_pointer(&conn->ioc);
+                }
 
                 return QIO_CHANNEL(g_steal_pointer(&conn->sioc));
             }
@@ -382,16 +442,14 @@ nbd_co_establish_connection(NBDClientConnection *conn, NBDExportInfo *info,
 
             if (conn->do_negotiation) {
                 memcpy(info, &conn->updated_info, sizeof(*info));
-                if (conn->ioc) {
-                    /* TLS channel now has own reference to parent */
-                    object_unref(OBJECT(conn->sioc));
-                    conn->sioc = NULL;
-
-                    return g_steal_pointer(&conn->ioc);
-                }
             }
+            if (conn->ioc) {
+                /* TLS or websocket channel now has own reference to parent */
+                object_unref(OBJECT(conn->sioc));
+                conn->sioc = NULL;
 
-            assert(!conn->ioc);
+                return g_steal_pointer(&conn->ioc);
+            }
 
             return QIO_CHANNEL(g_steal_pointer(&conn->sioc));
         }
@@ -129,6 +129,7 @@ struct NBDClient {
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     QIOChannelSocket *sioc; /* The underlying data channel */
+    QIOChannel *plain_ioc; /* sioc, or the websocket channel on top of it */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
 
     Coroutine *recv_coroutine;
@@ -1189,8 +1190,7 @@ static int nbd_negotiate_options(NBDClient *client, Error **errp)
 
         trace_nbd_negotiate_options_check_option(option,
                                                  nbd_opt_lookup(option));
-        if (client->tlscreds &&
-            client->ioc == (QIOChannel *)client->sioc) {
+        if (client->tlscreds && client->ioc == client->plain_ioc) {
             QIOChannel *tioc;
             if (!fixedNewstyle) {
                 error_setg(errp, "Unsupported option 0x%" PRIx32, option);
@@ -1515,6 +1515,7 @@ void nbd_client_put(NBDClient *client)
         assert(client->closing);
 
         object_unref(OBJECT(client->sioc));
+        object_unref(OBJECT(client->plain_ioc));
         object_unref(OBJECT(client->ioc));
         if (client->tlscreds) {
             object_unref(OBJECT(client->tlscreds));
@@ -3057,11 +3058,13 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
 }
 
 /*
- * Create a new client listener using the given channel @sioc.
+ * Create a new client listener using the given channel @sioc, or @ioc
+ * on top of it if not NULL, like a websocket channel.
  * Begin servicing it in a coroutine.  When the connection closes, call
  * @close_fn with an indication of whether the client completed negotiation.
  */
 void nbd_client_new(QIOChannelSocket *sioc,
+                    QIOChannel *ioc,
                     QCryptoTLSCreds *tlscreds,
                     const char *tlsauthz,
                     void (*close_fn)(NBDClient *, bool))
@@ -3079,7 +3082,9 @@ void nbd_client_new(QIOChannelSocket *sioc,
     client->sioc = sioc;
     qio_channel_set_delay(QIO_CHANNEL(sioc), false);
     object_ref(OBJECT(client->sioc));
-    client->ioc = QIO_CHANNEL(sioc);
+    client->plain_ioc = ioc ?: QIO_CHANNEL(sioc);
+    object_ref(OBJECT(client->plain_ioc));
+    client->ioc = client->plain_ioc;
     object_ref(OBJECT(client->ioc));
     client->close_fn = close_fn;
 
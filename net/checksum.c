@@ -16,27 +16,272 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "host/cpuinfo.h"
 #include "net/checksum.h"
 #include "net/eth.h"
 
-uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+/*
+ * The one's complement sum does not depend on the byte order, as long as
+ * the result is swapped back at the end (RFC 1071), so the words are read
+ * in host order and as many at a time as possible.  2^16 is 1 modulo
+ * 0xffff, so adding 32-bit words gives the same sum as adding their two
+ * halves.
+ */
+static uint64_t net_checksum_int(const uint8_t *buf, size_t len)
 {
-    uint32_t sum1 = 0, sum2 = 0;
-    int i;
+    uint64_t sum = 0;
 
-    for (i = 0; i < len - 1; i += 2) {
-        sum1 += (uint32_t)buf[i];
-        sum2 += (uint32_t)buf[i + 1];
+    for (; len >= 32; buf += 32, len -= 32) {
+        sum += (uint64_t)ldl_he_p(buf) + ldl_he_p(buf + 4) +
+               ldl_he_p(buf + 8) + ldl_he_p(buf + 12) +
+               ldl_he_p(buf + 16) + ldl_he_p(buf + 20) +
+               ldl_he_p(buf + 24) + ldl_he_p(buf + 28);
     }
-    if (i < len) {
-        sum1 += (uint32_t)buf[i];
+    for (; len >= 4; buf += 4, len -= 4) {
+        sum += ldl_he_p(buf);
+    }
+    if (len >= 2) {
+        sum += lduw_he_p(buf);
+        buf += 2;
+        len -= 2;
+    }
+    if (len) {
+        /* The last byte is the first of a word padded with zero */
+        uint8_t last[2] = { *buf, 0 };
+
+        sum += lduw_he_p(last);
     }
+    return sum;
+}
+
+/*
+ * The vector versions add 16-bit words into 32-bit lanes, which are folded
+ * into a 64-bit sum before they can overflow.  Each lane takes at most two
+ * words per vector, so a chunk of NET_CHECKSUM_CHUNK is safe.
+ */
+#define NET_CHECKSUM_CHUNK  (256 * KiB)
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+#include <immintrin.h>
 
-    if (seq & 1) {
-        return sum1 + (sum2 << 8);
-    } else {
-        return sum2 + (sum1 << 8);
+static uint64_t __attribute__((target("sse2")))
+net_checksum_sse2(const uint8_t *buf, size_t len)
+{
+    __m128i zero = _mm_setzero_si128();
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len, NET_CHECKSUM_CHUNK) & -16;
+        __m128i acc = zero;
+        uint32_t lanes[4];
+
+        for (; n; n -= 16, buf += 16, len -= 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)buf);
+
+            acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+            acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+        }
+        _mm_storeu_si128((__m128i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
     }
+    return sum + net_checksum_int(buf, len);
+}
+
+#ifdef CONFIG_AVX2_OPT
+static uint64_t __attribute__((target("avx2")))
+net_checksum_avx2(const uint8_t *buf, size_t len)
+{
+    __m256i zero = _mm256_setzero_si256();
+    uint64_t sum = 0;
+
+    while (len >= 32) {
+        size_t n = MIN(len, NET_CHECKSUM_CHUNK) & -32;
+        __m256i acc = zero;
+        uint32_t lanes[8];
+
+        for (; n; n -= 32, buf += 32, len -= 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)buf);
+
+            acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+            acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+        }
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+               lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+    return sum + net_checksum_int(buf, len);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+/* As in util/bufferiszero.c */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_USED     0
+# define INIT_LENGTH   0
+# define INIT_ACCEL    net_checksum_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_USED     CPUINFO_SSE2
+# define INIT_LENGTH   64
+# define INIT_ACCEL    net_checksum_sse2
+#endif
+
+static unsigned used_accel = INIT_USED;
+static unsigned length_to_accel = INIT_LENGTH;
+static uint64_t (*checksum_accel)(const uint8_t *, size_t) = INIT_ACCEL;
+
+static unsigned __attribute__((noinline))
+select_accel_cpuinfo(unsigned info)
+{
+    /* Array is sorted in order of algorithm preference. */
+    static const struct {
+        unsigned bit;
+        unsigned len;
+        uint64_t (*fn)(const uint8_t *, size_t);
+    } all[] = {
+#ifdef CONFIG_AVX2_OPT
+        { CPUINFO_AVX2,    128, net_checksum_avx2 },
+#endif
+        { CPUINFO_SSE2,     64, net_checksum_sse2 },
+        { CPUINFO_ALWAYS,    0, net_checksum_int },
+    };
+
+    for (unsigned i = 0; i < ARRAY_SIZE(all); ++i) {
+        if (info & all[i].bit) {
+            length_to_accel = all[i].len;
+            checksum_accel = all[i].fn;
+            return all[i].bit;
+        }
+    }
+    return 0;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) init_accel(void)
+{
+    used_accel = select_accel_cpuinfo(cpuinfo_init());
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_net_checksum_next_accel(void)
+{
+    unsigned used = select_accel_cpuinfo(cpuinfo & ~used_accel);
+    used_accel |= used;
+    return used;
+}
+
+static uint64_t net_checksum_sum(const uint8_t *buf, size_t len)
+{
+    if (likely(len >= length_to_accel)) {
+        return checksum_accel(buf, len);
+    }
+    return net_checksum_int(buf, len);
+}
+
+#elif defined(__aarch64__) || defined(__wasm_simd128__)
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+typedef uint32x4_t net_checksum_vec;
+
+static inline uint32x4_t net_checksum_vec_zero(void)
+{
+    return vdupq_n_u32(0);
+}
+
+static inline uint32x4_t net_checksum_vec_add(uint32x4_t acc, const uint8_t *p)
+{
+    return vpadalq_u16(acc, vreinterpretq_u16_u8(vld1q_u8(p)));
+}
+
+static inline uint64_t net_checksum_vec_sum(uint32x4_t acc)
+{
+    return vaddlvq_u32(acc);
+}
+#else
+#include <wasm_simd128.h>
+
+typedef v128_t net_checksum_vec;
+
+static inline v128_t net_checksum_vec_zero(void)
+{
+    return wasm_i32x4_splat(0);
+}
+
+static inline v128_t net_checksum_vec_add(v128_t acc, const uint8_t *p)
+{
+    return wasm_i32x4_add(acc,
+                          wasm_u32x4_extadd_pairwise_u16x8(wasm_v128_load(p)));
+}
+
+static inline uint64_t net_checksum_vec_sum(v128_t acc)
+{
+    return (uint64_t)wasm_u32x4_extract_lane(acc, 0) +
+           wasm_u32x4_extract_lane(acc, 1) +
+           wasm_u32x4_extract_lane(acc, 2) +
+           wasm_u32x4_extract_lane(acc, 3);
+}
+#endif
+
+static uint64_t net_checksum_vec128(const uint8_t *buf, size_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        size_t n = MIN(len, NET_CHECKSUM_CHUNK) & -16;
+        net_checksum_vec acc = net_checksum_vec_zero();
+
+        for (; n; n -= 16, buf += 16, len -= 16) {
+            acc = net_checksum_vec_add(acc, buf);
+        }
+        sum += net_checksum_vec_sum(acc);
+    }
+    return sum + net_checksum_int(buf, len);
+}
+
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+
+static uint64_t net_checksum_sum(const uint8_t *buf, size_t len)
+{
+    if (len >= 64) {
+        return net_checksum_vec128(buf, len);
+    }
+    return net_checksum_int(buf, len);
+}
+
+#else
+#define net_checksum_sum  net_checksum_int
+bool test_net_checksum_next_accel(void)
+{
+    return false;
+}
+#endif
+
+uint32_t net_checksum_add_cont(int len, uint8_t *buf, int seq)
+{
+    uint64_t sum;
+    uint16_t res;
+
+    if (len <= 0) {
+        return 0;
+    }
+
+    sum = net_checksum_sum(buf, len);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    /* Words were added in host order, the sum is big endian */
+    res = be16_to_cpu(sum);
+
+    /* An odd offset swaps the bytes of every word */
+    return seq & 1 ? bswap16(res) : res;
 }
 
 uint16_t net_checksum_finish(uint32_t sum)
@@ -250,11 +250,11 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     int ret;
 
     if (mode == PRIMARY_IN) {
-        pkt = packet_new(s->pri_rs.buf,
+        pkt = packet_new(s->pri_rs.packet,
                          s->pri_rs.packet_len,
                          s->pri_rs.vnet_hdr_len);
     } else {
-        pkt = packet_new(s->sec_rs.buf,
+        pkt = packet_new(s->sec_rs.packet,
                          s->sec_rs.packet_len,
                          s->sec_rs.vnet_hdr_len);
     }
@@ -1156,7 +1156,7 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
     if (packet_enqueue(s, PRIMARY_IN, &conn)) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
-                         pri_rs->buf,
+                         (uint8_t *)pri_rs->packet,
                          pri_rs->packet_len,
                          pri_rs->vnet_hdr_len,
                          false,
@@ -1188,14 +1188,14 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
     int ret;
 
     if (packet_matches_str("COLO_USERSPACE_PROXY_INIT",
-                           notify_rs->buf,
+                           notify_rs->packet,
                            notify_rs->packet_len)) {
         ret = compare_chr_send(s, (uint8_t *)msg, strlen(msg), 0, true, false);
         if (ret < 0) {
             error_report("Notify Xen COLO-frame INIT failed");
         }
     } else if (packet_matches_str("COLO_CHECKPOINT",
-                                  notify_rs->buf,
+                                  notify_rs->packet,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
         g_queue_foreach(&s->conn_list, colo_flush_packets, s);
@@ -113,7 +113,7 @@ static void net_dgram_rs_finalize(SocketReadState *rs)
 {
     NetDgramState *s = container_of(rs, NetDgramState, rs);
 
-    if (qemu_send_packet_async(&s->nc, rs->buf,
+    if (qemu_send_packet_async(&s->nc, rs->packet,
                                rs->packet_len,
                                net_dgram_send_completed) == 0) {
         net_dgram_read_poll(s, false);
@@ -0,0 +1,104 @@
+/*
+ * Packet queue statistics of network clients for query-stats
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/qapi-types-stats.h"
+#include "qemu/module.h"
+#include "net/net.h"
+#include "net/queue.h"
+#include "sysemu/stats.h"
+
+#define NET_STATS_MAX_CLIENTS 1024
+
+static const struct {
+    const char *name;
+    StatsType type;
+    size_t offset;
+    bool is_u32;
+} net_stats[] = {
+    { "queued", STATS_TYPE_CUMULATIVE, offsetof(NetQueueStats, queued) },
+    { "dropped", STATS_TYPE_CUMULATIVE, offsetof(NetQueueStats, dropped) },
+    { "purged", STATS_TYPE_CUMULATIVE, offsetof(NetQueueStats, purged) },
+    { "depth", STATS_TYPE_INSTANT, offsetof(NetQueueStats, depth), true },
+    { "max-depth", STATS_TYPE_PEAK, offsetof(NetQueueStats, max_depth), true },
+    { "pool-hits", STATS_TYPE_CUMULATIVE,
+      offsetof(NetQueueStats, pool_hits) },
+    { "pool-misses", STATS_TYPE_CUMULATIVE,
+      offsetof(NetQueueStats, pool_misses) },
+};
+
+static void net_query_stats_cb(StatsResultList **result,
+                               StatsTarget target, strList *names,
+                               strList *targets, Error **errp)
+{
+    g_autofree NetClientState **ncs = NULL;
+    int n;
+
+    if (target != STATS_TARGET_NETDEV) {
+        return;
+    }
+
+    /* No client has the type __MAX, so this returns all of them */
+    ncs = g_new(NetClientState *, NET_STATS_MAX_CLIENTS);
+    n = qemu_find_net_clients_except(NULL, ncs, NET_CLIENT_DRIVER__MAX,
+                                     NET_STATS_MAX_CLIENTS);
+    n = MIN(n, NET_STATS_MAX_CLIENTS);
+
+    for (int i = 0; i < n; i++) {
+        StatsList *list = NULL;
+        NetQueueStats qs;
+
+        if (!ncs[i]->incoming_queue ||
+            !apply_str_list_filter(ncs[i]->name, targets)) {
+            continue;
+        }
+        qemu_net_queue_get_stats(ncs[i]->incoming_queue, &qs);
+
+        /* Prepended, so in the reverse order of the schema */
+        for (int j = ARRAY_SIZE(net_stats) - 1; j >= 0; j--) {
+            const void *p = (const uint8_t *)&qs + net_stats[j].offset;
+            Stats *stats;
+
+            if (!apply_str_list_filter(net_stats[j].name, names)) {
+                continue;
+            }
+            stats = g_new0(Stats, 1);
+            stats->name = g_strdup(net_stats[j].name);
+            stats->value = g_new0(StatsValue, 1);
+            stats->value->type = QTYPE_QNUM;
+            stats->value->u.scalar = net_stats[j].is_u32 ?
+                *(const uint32_t *)p : *(const uint64_t *)p;
+            QAPI_LIST_PREPEND(list, stats);
+        }
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_NET, ncs[i]->name, list);
+        }
+    }
+}
+
+static void net_query_stats_schemas_cb(StatsSchemaList **result,
+                                       Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    for (int i = ARRAY_SIZE(net_stats) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(net_stats[i].name);
+        value->type = net_stats[i].type;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_NET, STATS_TARGET_NETDEV, list);
+}
+
+static void net_stats_register(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_NET, net_query_stats_cb,
+                        net_query_stats_schemas_cb);
+}
+
+type_init(net_stats_register);
@@ -1109,6 +1109,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_AF_XDP
         [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
 #endif
+#ifdef CONFIG_WASM_NET
+        [NET_CLIENT_DRIVER_WASM]      = net_init_wasm,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1216,6 +1219,9 @@ void show_netdevs(void)
 #ifdef CONFIG_AF_XDP
         "af-xdp",
 #endif
+#ifdef CONFIG_WASM_NET
+        "wasm",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1858,6 +1864,7 @@ void net_socket_rs_init(SocketReadState *rs,
     rs->packet_len = 0;
     rs->vnet_hdr_len = 0;
     memset(rs->buf, 0, sizeof(rs->buf));
+    rs->packet = rs->buf;
     rs->finalize = finalize;
 }
 
@@ -1871,6 +1878,24 @@ int net_fill_rstate(SocketReadState *rs, const uint8_t *buf, int size)
     unsigned int l;
 
     while (size > 0) {
+        /*
+         * Packets that are entirely in buf are passed on from there, only
+         * those that are split across reads are copied into rs->buf.
+         */
+        if (rs->state == 0 && rs->index == 0 && !rs->vnet_hdr && size >= 4) {
+            l = ldl_be_p(buf);
+            if (l <= size - 4 && l <= sizeof(rs->buf)) {
+                rs->packet_len = l;
+                rs->vnet_hdr_len = 0;
+                rs->packet = buf + 4;
+                buf += 4 + l;
+                size -= 4 + l;
+                assert(rs->finalize);
+                rs->finalize(rs);
+                continue;
+            }
+        }
+
         /* Reassemble a packet from the network.
          * 0 = getting length.
          * 1 = getting vnet header length.
@@ -1934,6 +1959,7 @@ int net_fill_rstate(SocketReadState *rs, const uint8_t *buf, int size)
             if (rs->index >= rs->packet_len) {
                 rs->index = 0;
                 rs->state = 0;
+                rs->packet = rs->buf;
                 assert(rs->finalize);
                 rs->finalize(rs);
             }
@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "net/queue.h"
 #include "qemu/queue.h"
+#include "qemu/units.h"
 #include "net/net.h"
 
 /* The delivery handler may only return zero if it will call
@@ -49,6 +50,26 @@ struct NetPacket {
     uint8_t data[];
 };
 
+/*
+ * Delivered packets are kept for reuse, so that bursts do not allocate
+ * and free a buffer for each packet.  There is one size class for frames
+ * up to the usual MTU and one for jumbo and GSO frames.
+ */
+static const struct {
+    size_t size;
+    unsigned max_free;
+} net_queue_pool_classes[] = {
+    { 2 * KiB, 64 },
+    { NET_BUFSIZE, 8 },
+};
+
+#define NET_QUEUE_POOL_CLASSES ARRAY_SIZE(net_queue_pool_classes)
+
+typedef struct NetPacketPool {
+    QTAILQ_HEAD(, NetPacket) free;
+    unsigned count;
+} NetPacketPool;
+
 struct NetQueue {
     void *opaque;
     uint32_t nq_maxlen;
@@ -56,10 +77,66 @@ struct NetQueue {
     NetQueueDeliverFunc *deliver;
 
     QTAILQ_HEAD(, NetPacket) packets;
+    NetPacketPool pool[NET_QUEUE_POOL_CLASSES];
+    NetQueueStats stats;
 
     unsigned delivering : 1;
 };
 
+/* Returns the size class of a packet, or -1 if it is too large for any */
+static int qemu_net_queue_pool_class(size_t size)
+{
+    for (int i = 0; i < NET_QUEUE_POOL_CLASSES; i++) {
+        if (size <= net_queue_pool_classes[i].size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static NetPacket *qemu_net_queue_alloc(NetQueue *queue, size_t size)
+{
+    int i = qemu_net_queue_pool_class(size);
+    NetPacket *packet;
+
+    if (i < 0) {
+        queue->stats.pool_misses++;
+        return g_malloc(sizeof(NetPacket) + size);
+    }
+
+    packet = QTAILQ_FIRST(&queue->pool[i].free);
+    if (!packet) {
+        queue->stats.pool_misses++;
+        return g_malloc(sizeof(NetPacket) + net_queue_pool_classes[i].size);
+    }
+
+    QTAILQ_REMOVE(&queue->pool[i].free, packet, entry);
+    queue->pool[i].count--;
+    queue->stats.pool_hits++;
+    return packet;
+}
+
+static void qemu_net_queue_free(NetQueue *queue, NetPacket *packet)
+{
+    int i = qemu_net_queue_pool_class(packet->size);
+
+    if (i < 0 || queue->pool[i].count >= net_queue_pool_classes[i].max_free) {
+        g_free(packet);
+        return;
+    }
+
+    QTAILQ_INSERT_HEAD(&queue->pool[i].free, packet, entry);
+    queue->pool[i].count++;
+}
+
+static void qemu_net_queue_insert(NetQueue *queue, NetPacket *packet)
+{
+    queue->nq_count++;
+    queue->stats.queued++;
+    queue->stats.max_depth = MAX(queue->stats.max_depth, queue->nq_count);
+    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+}
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
 {
     NetQueue *queue;
@@ -72,6 +149,9 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     queue->deliver = deliver;
 
     QTAILQ_INIT(&queue->packets);
+    for (int i = 0; i < NET_QUEUE_POOL_CLASSES; i++) {
+        QTAILQ_INIT(&queue->pool[i].free);
+    }
 
     queue->delivering = 0;
 
@@ -86,6 +166,12 @@ void qemu_del_net_queue(NetQueue *queue)
         QTAILQ_REMOVE(&queue->packets, packet, entry);
         g_free(packet);
     }
+    for (int i = 0; i < NET_QUEUE_POOL_CLASSES; i++) {
+        QTAILQ_FOREACH_SAFE(packet, &queue->pool[i].free, entry, next) {
+            QTAILQ_REMOVE(&queue->pool[i].free, packet, entry);
+            g_free(packet);
+        }
+    }
 
     g_free(queue);
 }
@@ -100,17 +186,17 @@ static void qemu_net_queue_append(NetQueue *queue,
     NetPacket *packet;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        queue->stats.dropped++;
         return; /* drop if queue full and no callback */
     }
-    packet = g_malloc(sizeof(NetPacket) + size);
+    packet = qemu_net_queue_alloc(queue, size);
     packet->sender = sender;
     packet->flags = flags;
     packet->size = size;
     packet->sent_cb = sent_cb;
     memcpy(packet->data, buf, size);
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_insert(queue, packet);
 }
 
 void qemu_net_queue_append_iov(NetQueue *queue,
@@ -125,13 +211,14 @@ void qemu_net_queue_append_iov(NetQueue *queue,
     int i;
 
     if (queue->nq_count >= queue->nq_maxlen && !sent_cb) {
+        queue->stats.dropped++;
         return; /* drop if queue full and no callback */
     }
     for (i = 0; i < iovcnt; i++) {
         max_len += iov[i].iov_len;
     }
 
-    packet = g_malloc(sizeof(NetPacket) + max_len);
+    packet = qemu_net_queue_alloc(queue, max_len);
     packet->sender = sender;
     packet->sent_cb = sent_cb;
     packet->flags = flags;
@@ -144,8 +231,7 @@ void qemu_net_queue_append_iov(NetQueue *queue,
         packet->size += len;
     }
 
-    queue->nq_count++;
-    QTAILQ_INSERT_TAIL(&queue->packets, packet, entry);
+    qemu_net_queue_insert(queue, packet);
 }
 
 static ssize_t qemu_net_queue_deliver(NetQueue *queue,
@@ -262,10 +348,11 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
         if (packet->sender == from) {
             QTAILQ_REMOVE(&queue->packets, packet, entry);
             queue->nq_count--;
+            queue->stats.purged++;
             if (packet->sent_cb) {
                 packet->sent_cb(packet->sender, 0);
             }
-            g_free(packet);
+            qemu_net_queue_free(queue, packet);
         }
     }
 }
@@ -298,7 +385,13 @@ bool qemu_net_queue_flush(NetQueue *queue)
             packet->sent_cb(packet->sender, ret);
         }
 
-        g_free(packet);
+        qemu_net_queue_free(queue, packet);
     }
     return true;
 }
+
+void qemu_net_queue_get_stats(NetQueue *queue, NetQueueStats *stats)
+{
+    *stats = queue->stats;
+    stats->depth = queue->nq_count;
+}
@@ -32,13 +32,19 @@
 #include "qemu/sockets.h"
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+
+/* See NET_STREAM_SEND_BUF_SIZE */
+#define NET_SOCKET_SEND_BUF_SIZE (4 * NET_BUFSIZE)
 
 typedef struct NetSocketState {
     NetClientState nc;
     int listen_fd;
     int fd;
     SocketReadState rs;
-    unsigned int send_index;      /* number of bytes sent (only SOCK_STREAM) */
+    uint8_t *send_buf;            /* frames to write (only SOCK_STREAM) */
+    size_t send_len;
+    QEMUBH *send_bh;
     struct sockaddr_in dgram_dst; /* contains inet host and port destination iff connectionless (SOCK_DGRAM) */
     IOHandler *send_fn;           /* differs between SOCK_STREAM/SOCK_DGRAM */
     bool read_poll;               /* waiting to receive data? */
@@ -68,47 +74,73 @@ static void net_socket_write_poll(NetSocketState *s, bool enable)
     net_socket_update_fd_handler(s);
 }
 
+/* Returns false if part of send_buf has to wait for the socket */
+static bool net_socket_flush_send_buf(NetSocketState *s)
+{
+    ssize_t ret;
+
+    if (!s->send_len || s->write_poll) {
+        return !s->send_len;
+    }
+
+    ret = RETRY_ON_EINTR(send(s->fd, s->send_buf, s->send_len, 0));
+    if (ret == -1 && errno == EAGAIN) {
+        ret = 0;
+    }
+    if (ret == -1) {
+        /* Drop the frames, the read side notices when the peer is gone */
+        s->send_len = 0;
+        return true;
+    }
+
+    s->send_len -= ret;
+    if (s->send_len) {
+        memmove(s->send_buf, s->send_buf + ret, s->send_len);
+        net_socket_write_poll(s, true);
+        return false;
+    }
+    return true;
+}
+
+static void net_socket_send_bh(void *opaque)
+{
+    NetSocketState *s = opaque;
+
+    if (s->fd != -1) {
+        net_socket_flush_send_buf(s);
+    }
+}
+
 static void net_socket_writable(void *opaque)
 {
     NetSocketState *s = opaque;
 
     net_socket_write_poll(s, false);
 
+    if (s->send_buf && !net_socket_flush_send_buf(s)) {
+        return;
+    }
     qemu_flush_queued_packets(&s->nc);
 }
 
 static ssize_t net_socket_receive(NetClientState *nc, const uint8_t *buf, size_t size)
 {
     NetSocketState *s = DO_UPCAST(NetSocketState, nc, nc);
-    uint32_t len = htonl(size);
-    struct iovec iov[] = {
-        {
-            .iov_base = &len,
-            .iov_len  = sizeof(len),
-        }, {
-            .iov_base = (void *)buf,
-            .iov_len  = size,
-        },
-    };
-    size_t remaining;
-    ssize_t ret;
 
-    remaining = iov_size(iov, 2) - s->send_index;
-    ret = iov_send(s->fd, iov, 2, s->send_index, remaining);
-
-    if (ret == -1 && errno == EAGAIN) {
-        ret = 0; /* handled further down */
-    }
-    if (ret == -1) {
-        s->send_index = 0;
-        return -errno;
+    if (size + sizeof(uint32_t) > NET_SOCKET_SEND_BUF_SIZE) {
+        return size;
     }
-    if (ret < (ssize_t)remaining) {
-        s->send_index += ret;
-        net_socket_write_poll(s, true);
+
+    /* Like net/stream.c, write the frames of a burst together */
+    if (s->send_len + sizeof(uint32_t) + size > NET_SOCKET_SEND_BUF_SIZE &&
+        !net_socket_flush_send_buf(s)) {
         return 0;
     }
-    s->send_index = 0;
+
+    stl_be_p(s->send_buf + s->send_len, size);
+    memcpy(s->send_buf + s->send_len + sizeof(uint32_t), buf, size);
+    s->send_len += sizeof(uint32_t) + size;
+    qemu_bh_schedule(s->send_bh);
     return size;
 }
 
@@ -145,7 +177,7 @@ static void net_socket_rs_finalize(SocketReadState *rs)
 {
     NetSocketState *s = container_of(rs, NetSocketState, rs);
 
-    if (qemu_send_packet_async(&s->nc, rs->buf,
+    if (qemu_send_packet_async(&s->nc, rs->packet,
                                rs->packet_len,
                                net_socket_send_completed) == 0) {
         net_socket_read_poll(s, false);
@@ -175,6 +207,7 @@ static void net_socket_send(void *opaque)
         close(s->fd);
 
         s->fd = -1;
+        s->send_len = 0;
         net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
         s->nc.link_down = true;
         qemu_set_info_str(&s->nc, "%s", "");
@@ -317,6 +350,12 @@ static void net_socket_cleanup(NetClientState *nc)
         close(s->listen_fd);
         s->listen_fd = -1;
     }
+    if (s->send_bh) {
+        qemu_bh_delete(s->send_bh);
+        s->send_bh = NULL;
+    }
+    g_free(s->send_buf);
+    s->send_buf = NULL;
 }
 
 static NetClientInfo net_dgram_socket_info = {
@@ -433,6 +472,8 @@ static NetSocketState *net_socket_fd_init_stream(NetClientState *peer,
 
     s->fd = fd;
     s->listen_fd = -1;
+    s->send_buf = g_malloc(NET_SOCKET_SEND_BUF_SIZE);
+    s->send_bh = qemu_bh_new(net_socket_send_bh, s);
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
 
     /* Disable Nagle algorithm on TCP sockets to reduce latency */
@@ -531,6 +572,8 @@ static int net_socket_listen_init(NetClientState *peer,
     s->fd = -1;
     s->listen_fd = fd;
     s->nc.link_down = true;
+    s->send_buf = g_malloc(NET_SOCKET_SEND_BUF_SIZE);
+    s->send_bh = qemu_bh_new(net_socket_send_bh, s);
     net_socket_rs_init(&s->rs, net_socket_rs_finalize, false);
 
     qemu_set_fd_handler(s->listen_fd, net_socket_accept, NULL, s);
@@ -35,6 +35,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/cutils.h"
+#include "qemu/bswap.h"
 #include "io/channel.h"
 #include "io/channel-socket.h"
 #include "io/net-listener.h"
@@ -42,6 +43,13 @@
 #include "qapi/qapi-visit-sockets.h"
 #include "qapi/clone-visitor.h"
 
+/*
+ * Frames from the guest are gathered in send_buf and written together
+ * from a bottom half, so that a burst costs one write rather than one
+ * per frame.
+ */
+#define NET_STREAM_SEND_BUF_SIZE (4 * NET_BUFSIZE)
+
 typedef struct NetStreamState {
     NetClientState nc;
     QIOChannel *listen_ioc;
@@ -50,7 +58,9 @@ typedef struct NetStreamState {
     guint ioc_read_tag;
     guint ioc_write_tag;
     SocketReadState rs;
-    unsigned int send_index;      /* number of bytes sent*/
+    uint8_t *send_buf;
+    size_t send_len;              /* number of bytes in send_buf */
+    QEMUBH *send_bh;
     uint32_t reconnect;
     guint timer_tag;
     SocketAddress *addr;
@@ -61,6 +71,48 @@ static void net_stream_listen(QIONetListener *listener,
                               void *opaque);
 static void net_stream_arm_reconnect(NetStreamState *s);
 
+static gboolean net_stream_writable(QIOChannel *ioc,
+                                    GIOCondition condition,
+                                    gpointer data);
+
+/* Returns false if part of send_buf has to wait for the channel */
+static bool net_stream_flush_send_buf(NetStreamState *s)
+{
+    ssize_t ret;
+
+    if (!s->send_len || s->ioc_write_tag) {
+        return !s->send_len;
+    }
+
+    ret = qio_channel_write(s->ioc, (char *)s->send_buf, s->send_len, NULL);
+    if (ret == QIO_CHANNEL_ERR_BLOCK) {
+        ret = 0;
+    }
+    if (ret < 0) {
+        /* Drop the frames, the read side notices when the peer is gone */
+        s->send_len = 0;
+        return true;
+    }
+
+    s->send_len -= ret;
+    if (s->send_len) {
+        memmove(s->send_buf, s->send_buf + ret, s->send_len);
+        s->ioc_write_tag = qio_channel_add_watch(s->ioc, G_IO_OUT,
+                                                 net_stream_writable, s, NULL);
+        return false;
+    }
+    return true;
+}
+
+static void net_stream_send_bh(void *opaque)
+{
+    NetStreamState *s = opaque;
+
+    if (!s->nc.link_down) {
+        net_stream_flush_send_buf(s);
+    }
+}
+
 static gboolean net_stream_writable(QIOChannel *ioc,
                                     GIOCondition condition,
                                     gpointer data)
@@ -69,7 +121,9 @@ static gboolean net_stream_writable(QIOChannel *ioc,
 
     s->ioc_write_tag = 0;
 
-    qemu_flush_queued_packets(&s->nc);
+    if (net_stream_flush_send_buf(s)) {
+        qemu_flush_queued_packets(&s->nc);
+    }
 
     return G_SOURCE_REMOVE;
 }
@@ -78,38 +132,21 @@ static ssize_t net_stream_receive(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     NetStreamState *s = DO_UPCAST(NetStreamState, nc, nc);
-    uint32_t len = htonl(size);
-    struct iovec iov[] = {
-        {
-            .iov_base = &len,
-            .iov_len  = sizeof(len),
-        }, {
-            .iov_base = (void *)buf,
-            .iov_len  = size,
-        },
-    };
-    struct iovec local_iov[2];
-    unsigned int nlocal_iov;
-    size_t remaining;
-    ssize_t ret;
 
-    remaining = iov_size(iov, 2) - s->send_index;
-    nlocal_iov = iov_copy(local_iov, 2, iov, 2, s->send_index, remaining);
-    ret = qio_channel_writev(s->ioc, local_iov, nlocal_iov, NULL);
-    if (ret == QIO_CHANNEL_ERR_BLOCK) {
-        ret = 0; /* handled further down */
-    }
-    if (ret == -1) {
-        s->send_index = 0;
-        return -errno;
+    if (size + sizeof(uint32_t) > NET_STREAM_SEND_BUF_SIZE) {
+        return size;
     }
-    if (ret < (ssize_t)remaining) {
-        s->send_index += ret;
-        s->ioc_write_tag = qio_channel_add_watch(s->ioc, G_IO_OUT,
-                                                 net_stream_writable, s, NULL);
+
+    if (s->send_len + sizeof(uint32_t) + size > NET_STREAM_SEND_BUF_SIZE &&
+        !net_stream_flush_send_buf(s)) {
+        /* Queue the frame until the channel takes the ones before it */
         return 0;
     }
-    s->send_index = 0;
+
+    stl_be_p(s->send_buf + s->send_len, size);
+    memcpy(s->send_buf + s->send_len + sizeof(uint32_t), buf, size);
+    s->send_len += sizeof(uint32_t) + size;
+    qemu_bh_schedule(s->send_bh);
     return size;
 }
 
@@ -131,7 +168,7 @@ static void net_stream_rs_finalize(SocketReadState *rs)
 {
     NetStreamState *s = container_of(rs, NetStreamState, rs);
 
-    if (qemu_send_packet_async(&s->nc, rs->buf,
+    if (qemu_send_packet_async(&s->nc, rs->packet,
                                rs->packet_len,
                                net_stream_send_completed) == 0) {
         if (s->ioc_read_tag) {
@@ -170,6 +207,7 @@ static gboolean net_stream_send(QIOChannel *ioc,
         }
         object_unref(OBJECT(s->ioc));
         s->ioc = NULL;
+        s->send_len = 0;
 
         net_socket_rs_init(&s->rs, net_stream_rs_finalize, false);
         s->nc.link_down = true;
@@ -225,6 +263,8 @@ static void net_stream_cleanup(NetClientState *nc)
         object_unref(OBJECT(s->listen_ioc));
         s->listen_ioc = NULL;
     }
+    qemu_bh_delete(s->send_bh);
+    g_free(s->send_buf);
 }
 
 static NetClientInfo net_stream_info = {
@@ -309,6 +349,8 @@ static int net_stream_server_init(NetClientState *peer,
 
     nc = qemu_new_net_client(&net_stream_info, peer, model, name);
     s = DO_UPCAST(NetStreamState, nc, nc);
+    s->send_buf = g_malloc(NET_STREAM_SEND_BUF_SIZE);
+    s->send_bh = qemu_bh_new(net_stream_send_bh, s);
 
     s->listen_ioc = QIO_CHANNEL(listen_sioc);
     qio_channel_socket_listen_async(listen_sioc, addr, 0,
@@ -400,6 +442,8 @@ static int net_stream_client_init(NetClientState *peer,
 
     nc = qemu_new_net_client(&net_stream_info, peer, model, name);
     s = DO_UPCAST(NetStreamState, nc, nc);
+    s->send_buf = g_malloc(NET_STREAM_SEND_BUF_SIZE);
+    s->send_bh = qemu_bh_new(net_stream_send_bh, s);
 
     s->ioc = QIO_CHANNEL(sioc);
     s->nc.link_down = true;
@@ -0,0 +1,345 @@
+/*
+ * Shared memory packet rings between QEMU-wasm and a JavaScript network stack
+ *
+ * Ethernet frames go through two rings in the wasm heap, which is a
+ * SharedArrayBuffer, so that a network stack running in a worker can
+ * exchange them with QEMU without going through the emulated sockets of
+ * emscripten.
+ *
+ * The layout, all little endian 32-bit words, is described by
+ * WasmNetShared.  Each ring holds records made of the length of a frame
+ * and the frame itself, padded to 4 bytes.  A record never wraps: if it
+ * does not fit before the end of the ring, the producer writes a length
+ * of WASM_NET_WRAP and starts over at the beginning.  head and tail count
+ * bytes and wrap around at 2^32.
+ *
+ * Doorbells are rung once per batch, not once per frame: the producer
+ * publishes as many records as it has, then increments the doorbell of
+ * the other side and wakes it up with Atomics.notify().  A consumer also
+ * rings the doorbell of the producer after it made room in a ring.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+#include "qemu/thread.h"
+#include "qemu/event_notifier.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "net/net.h"
+#include "clients.h"
+#include "trace.h"
+
+#include <emscripten.h>
+#include <emscripten/threading.h>
+
+#define WASM_NET_WRAP               UINT32_MAX
+#define WASM_NET_DEFAULT_RING_SIZE  (256 * KiB)
+#define WASM_NET_MIN_RING_SIZE      (64 * KiB)
+#define WASM_NET_MAX_RING_SIZE      (64 * MiB)
+#define WASM_NET_BATCH_SIZE         64
+
+typedef struct WasmNetRing {
+    uint32_t head;      /* written by the consumer */
+    uint32_t tail;      /* written by the producer */
+    uint32_t size;      /* power of two */
+    uint32_t data;      /* address of the records in the heap */
+} WasmNetRing;
+
+typedef struct WasmNetShared {
+    WasmNetRing rx;             /* JS to guest */
+    WasmNetRing tx;             /* guest to JS */
+    uint32_t qemu_doorbell;     /* QEMU waits on it */
+    uint32_t js_doorbell;       /* JS waits on it */
+} WasmNetShared;
+
+typedef struct WasmNetState {
+    NetClientState nc;
+
+    WasmNetShared *shared;
+    uint8_t *rx_data;
+    uint8_t *tx_data;
+
+    /* Turns the doorbell of QEMU into something the main loop can poll */
+    QemuThread thread;
+    EventNotifier kick;
+    bool quit;
+
+    /* The JS doorbell is rung by a bottom half, once per batch */
+    QEMUBH *js_bh;
+    bool rx_paused;
+    bool tx_waiting;
+} WasmNetState;
+
+static inline uint32_t wasm_net_record_size(uint32_t len)
+{
+    return ROUND_UP(len + sizeof(uint32_t), sizeof(uint32_t));
+}
+
+static void wasm_net_js_bh(void *opaque)
+{
+    WasmNetState *s = opaque;
+
+    qatomic_inc(&s->shared->js_doorbell);
+    emscripten_futex_wake(&s->shared->js_doorbell, INT_MAX);
+}
+
+static ssize_t wasm_net_receive_iov(NetClientState *nc,
+                                    const struct iovec *iov, int iovcnt)
+{
+    WasmNetState *s = DO_UPCAST(WasmNetState, nc, nc);
+    WasmNetRing *ring = &s->shared->tx;
+    size_t len = iov_size(iov, iovcnt);
+    uint32_t tail = ring->tail;
+    uint32_t head = qatomic_load_acquire(&ring->head);
+    uint32_t off = tail & (ring->size - 1);
+    uint32_t room = ring->size - (tail - head);
+    uint32_t rec;
+
+    if (len > ring->size / 2) {
+        /* Could never fit, drop it */
+        return len;
+    }
+
+    rec = wasm_net_record_size(len);
+    if (rec > ring->size - off) {
+        /* Skip to the start of the ring */
+        if (room < ring->size - off + rec) {
+            goto full;
+        }
+        stl_le_p(s->tx_data + off, WASM_NET_WRAP);
+        tail += ring->size - off;
+        room -= ring->size - off;
+        off = 0;
+    }
+    if (room < rec) {
+        goto full;
+    }
+
+    stl_le_p(s->tx_data + off, len);
+    iov_to_buf(iov, iovcnt, 0, s->tx_data + off + sizeof(uint32_t), len);
+    qatomic_store_release(&ring->tail, tail + rec);
+    qemu_bh_schedule(s->js_bh);
+    return len;
+
+full:
+    /* Let the net layer queue the frame, JS rings us once it made room */
+    s->tx_waiting = true;
+    return 0;
+}
+
+static ssize_t wasm_net_receive(NetClientState *nc,
+                                const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return wasm_net_receive_iov(nc, &iov, 1);
+}
+
+static void wasm_net_send(WasmNetState *s);
+
+static void wasm_net_send_completed(NetClientState *nc, ssize_t len)
+{
+    WasmNetState *s = DO_UPCAST(WasmNetState, nc, nc);
+
+    s->rx_paused = false;
+    wasm_net_send(s);
+}
+
+/* Hands the frames of the rx ring to the guest */
+static void wasm_net_send(WasmNetState *s)
+{
+    WasmNetRing *ring = &s->shared->rx;
+    uint32_t head = ring->head;
+    unsigned int n = 0;
+
+    while (!s->rx_paused && n < WASM_NET_BATCH_SIZE) {
+        uint32_t tail = qatomic_load_acquire(&ring->tail);
+        uint32_t off = head & (ring->size - 1);
+        const uint8_t *frame;
+        uint32_t len;
+
+        if (head == tail) {
+            break;
+        }
+
+        len = ldl_le_p(s->rx_data + off);
+        if (len == WASM_NET_WRAP) {
+            head += ring->size - off;
+            continue;
+        }
+        if (len > ring->size - off - sizeof(uint32_t) ||
+            wasm_net_record_size(len) > tail - head) {
+            error_report("wasm netdev %s: corrupted rx ring, stopping",
+                         s->nc.name);
+            s->rx_paused = true;
+            break;
+        }
+
+        frame = s->rx_data + off + sizeof(uint32_t);
+        head += wasm_net_record_size(len);
+        n++;
+        if (!qemu_send_packet_async(&s->nc, frame, len,
+                                    wasm_net_send_completed)) {
+            /* Queued, stop until the peer can take more */
+            s->rx_paused = true;
+        }
+    }
+
+    if (head != ring->head) {
+        qatomic_store_release(&ring->head, head);
+        trace_wasm_net_rx_batch(s->nc.name, n);
+        qemu_bh_schedule(s->js_bh);
+    }
+    if (n == WASM_NET_BATCH_SIZE && !s->rx_paused) {
+        /* Give other handlers a chance, come back right away */
+        event_notifier_set(&s->kick);
+    }
+}
+
+static void wasm_net_kick(EventNotifier *e)
+{
+    WasmNetState *s = container_of(e, WasmNetState, kick);
+
+    event_notifier_test_and_clear(e);
+    wasm_net_send(s);
+
+    if (s->tx_waiting) {
+        s->tx_waiting = false;
+        qemu_flush_queued_packets(&s->nc);
+    }
+}
+
+static void *wasm_net_doorbell_thread(void *opaque)
+{
+    WasmNetState *s = opaque;
+    uint32_t *doorbell = &s->shared->qemu_doorbell;
+    uint32_t seen = qatomic_load_acquire(doorbell);
+
+    while (!qatomic_read(&s->quit)) {
+        uint32_t now;
+
+        emscripten_futex_wait(doorbell, seen, INFINITY);
+        now = qatomic_load_acquire(doorbell);
+        if (now != seen) {
+            /* However many batches came in, that is one wakeup */
+            seen = now;
+            event_notifier_set(&s->kick);
+        }
+    }
+    return NULL;
+}
+
+EM_JS(void, wasm_net_attach_js, (const char *id, WasmNetShared *shared), {
+    const msg = {
+        type: 'attach', netdev: UTF8ToString(id), buffer: wasmMemory.buffer,
+        shared: shared
+    };
+
+    Module['wasmNet'] = Module['wasmNet'] || {};
+    Module['wasmNet'][msg.netdev] = msg;
+    if (Module['wasmNetPort']) {
+        Module['wasmNetPort'].postMessage(msg);
+    }
+});
+
+EM_JS(void, wasm_net_detach_js, (const char *id), {
+    const netdev = UTF8ToString(id);
+
+    if (Module['wasmNet']) {
+        delete Module['wasmNet'][netdev];
+    }
+    if (Module['wasmNetPort']) {
+        Module['wasmNetPort'].postMessage({ type: 'detach', netdev: netdev });
+    }
+});
+
+static void wasm_net_cleanup(NetClientState *nc)
+{
+    WasmNetState *s = DO_UPCAST(WasmNetState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+    wasm_net_detach_js(nc->name);
+
+    qatomic_set(&s->quit, true);
+    qatomic_inc(&s->shared->qemu_doorbell);
+    emscripten_futex_wake(&s->shared->qemu_doorbell, INT_MAX);
+    qemu_thread_join(&s->thread);
+
+    event_notifier_set_handler(&s->kick, NULL);
+    event_notifier_cleanup(&s->kick);
+    qemu_bh_delete(s->js_bh);
+    qemu_vfree(s->shared);
+}
+
+static NetClientInfo net_wasm_info = {
+    .type = NET_CLIENT_DRIVER_WASM,
+    .size = sizeof(WasmNetState),
+    .receive = wasm_net_receive,
+    .receive_iov = wasm_net_receive_iov,
+    .cleanup = wasm_net_cleanup,
+};
+
+/*
+ * The exported network device initialization routine.
+ *
+ * ... -netdev wasm,id=...[,ring-size=...]
+ */
+int net_init_wasm(const Netdev *netdev, const char *name,
+                  NetClientState *peer, Error **errp)
+{
+    const NetdevWasmOptions *opts = &netdev->u.wasm;
+    uint64_t size = opts->has_ring_size ? opts->ring_size
+                                        : WASM_NET_DEFAULT_RING_SIZE;
+    NetClientState *nc;
+    WasmNetState *s;
+    int ret;
+
+    if (size < WASM_NET_MIN_RING_SIZE || size > WASM_NET_MAX_RING_SIZE ||
+        !is_power_of_2(size)) {
+        error_setg(errp, "ring-size must be a power of two between %d KiB "
+                   "and %d MiB", (int)(WASM_NET_MIN_RING_SIZE / KiB),
+                   (int)(WASM_NET_MAX_RING_SIZE / MiB));
+        return -1;
+    }
+
+    nc = qemu_new_net_client(&net_wasm_info, peer, "wasm", name);
+    s = DO_UPCAST(WasmNetState, nc, nc);
+
+    ret = event_notifier_init(&s->kick, false);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to create the doorbell notifier");
+        qemu_del_net_client(nc);
+        return -1;
+    }
+    event_notifier_set_handler(&s->kick, wasm_net_kick);
+    s->js_bh = qemu_bh_new(wasm_net_js_bh, s);
+
+    s->shared = qemu_memalign(64, ROUND_UP(sizeof(*s->shared), 64) + 2 * size);
+    memset(s->shared, 0, sizeof(*s->shared));
+    s->rx_data = (uint8_t *)s->shared + ROUND_UP(sizeof(*s->shared), 64);
+    s->tx_data = s->rx_data + size;
+    s->shared->rx = (WasmNetRing) {
+        .size = size,
+        .data = (uintptr_t)s->rx_data,
+    };
+    s->shared->tx = (WasmNetRing) {
+        .size = size,
+        .data = (uintptr_t)s->tx_data,
+    };
+
+    qemu_thread_create(&s->thread, "wasm-net", wasm_net_doorbell_thread, s,
+                       QEMU_THREAD_JOINABLE);
+    qemu_set_info_str(nc, "wasm ring of %" PRIu64 " KiB", size / KiB);
+    wasm_net_attach_js(name, s->shared);
+    return 0;
+}
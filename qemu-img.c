@@ -34,7 +34,10 @@
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "qemu/config-file.h"
 #include "qemu/option.h"
 #include "qemu/error-report.h"
@@ -44,6 +47,7 @@
 #include "qemu/sockets.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 #include "qom/object_interfaces.h"
 #include "sysemu/block-backend.h"
 #include "block/block_int.h"
@@ -86,6 +90,9 @@ enum {
     OPTION_BITMAPS = 275,
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
+    OPTION_STATS = 278,
+    OPTION_RANDOM = 279,
+    OPTION_MIX = 280,
 };
 
 typedef enum OutputFormat {
@@ -207,6 +214,8 @@ void help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '--stats' prints the throughput of the read and write stages when the\n"
+           "       conversion has finished\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -1671,6 +1680,25 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+enum ImgConvertStage {
+    CONVERT_STAGE_READ,
+    CONVERT_STAGE_WAIT,
+    CONVERT_STAGE_WRITE,
+    CONVERT_STAGE__MAX,
+};
+
+/*
+ * Per-stage statistics: @ns is the time during which at least one coroutine
+ * was in the stage, so that throughput is not inflated by the number of
+ * coroutines running in parallel.
+ */
+typedef struct ImgConvertStageStats {
+    int active;
+    int64_t start_ns;
+    int64_t ns;
+    int64_t bytes;
+} ImgConvertStageStats;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1703,8 +1731,66 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    bool stats;
+    int64_t copy_ns;
+    ImgConvertStageStats stage[CONVERT_STAGE__MAX];
 } ImgConvertState;
 
+static void convert_stage_enter(ImgConvertState *s, enum ImgConvertStage stage)
+{
+    ImgConvertStageStats *st = &s->stage[stage];
+
+    if (s->stats && st->active++ == 0) {
+        st->start_ns = get_clock();
+    }
+}
+
+static void convert_stage_leave(ImgConvertState *s, enum ImgConvertStage stage,
+                                int64_t bytes)
+{
+    ImgConvertStageStats *st = &s->stage[stage];
+
+    if (!s->stats) {
+        return;
+    }
+    st->bytes += bytes;
+    if (--st->active == 0) {
+        st->ns += get_clock() - st->start_ns;
+    }
+}
+
+static void convert_print_stats(ImgConvertState *s)
+{
+    static const char *const names[CONVERT_STAGE__MAX] = {
+        [CONVERT_STAGE_READ] = "read",
+        [CONVERT_STAGE_WAIT] = "ordering wait",
+        [CONVERT_STAGE_WRITE] = "write",
+    };
+    int64_t total = s->stage[CONVERT_STAGE_WRITE].bytes;
+    double total_secs = s->copy_ns / 1e9;
+    int i;
+
+    qprintf(s->quiet, "Convert statistics (%ld coroutines%s):\n",
+            s->num_coroutines, s->compressed ? ", compressed target" : "");
+    for (i = 0; i < CONVERT_STAGE__MAX; i++) {
+        ImgConvertStageStats *st = &s->stage[i];
+        double secs = st->ns / 1e9;
+
+        if (i == CONVERT_STAGE_WAIT) {
+            qprintf(s->quiet, "  %-14s %.3f s\n", names[i], secs);
+            continue;
+        }
+        qprintf(s->quiet, "  %-14s %.1f MiB in %.3f s (%.1f MiB/s)\n",
+                i == CONVERT_STAGE_WRITE && s->compressed ?
+                "compress+write" : names[i],
+                (double)st->bytes / MiB, secs,
+                secs > 0 ? st->bytes / secs / MiB : 0.0);
+    }
+    qprintf(s->quiet, "  %-14s %.1f MiB in %.3f s (%.1f MiB/s)\n", "total",
+            (double)total / MiB, total_secs,
+            total_secs > 0 ? total / total_secs / MiB : 0.0);
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -2030,7 +2116,10 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
 retry:
         copy_range = s->copy_range && s->status == BLK_DATA;
         if (status == BLK_DATA && !copy_range) {
+            convert_stage_enter(s, CONVERT_STAGE_READ);
             ret = convert_co_read(s, sector_num, n, buf);
+            convert_stage_leave(s, CONVERT_STAGE_READ,
+                                (int64_t)n * BDRV_SECTOR_SIZE);
             if (ret < 0) {
                 error_report("error while reading at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2043,25 +2132,31 @@ retry:
 
         if (s->wr_in_order) {
             /* keep writes in order */
+            convert_stage_enter(s, CONVERT_STAGE_WAIT);
             while (s->wr_offs != sector_num && s->ret == -EINPROGRESS) {
                 s->wait_sector_num[index] = sector_num;
                 qemu_coroutine_yield();
             }
             s->wait_sector_num[index] = -1;
+            convert_stage_leave(s, CONVERT_STAGE_WAIT, 0);
         }
 
         if (s->ret == -EINPROGRESS) {
+            convert_stage_enter(s, CONVERT_STAGE_WRITE);
             if (copy_range) {
                 WITH_GRAPH_RDLOCK_GUARD() {
                     ret = convert_co_copy_range(s, sector_num, n);
                 }
                 if (ret) {
+                    convert_stage_leave(s, CONVERT_STAGE_WRITE, 0);
                     s->copy_range = false;
                     goto retry;
                 }
             } else {
                 ret = convert_co_write(s, sector_num, n, buf, status);
             }
+            convert_stage_leave(s, CONVERT_STAGE_WRITE,
+                                (int64_t)n * BDRV_SECTOR_SIZE);
             if (ret < 0) {
                 error_report("error while writing at byte %lld: %s",
                              sector_num * BDRV_SECTOR_SIZE, strerror(-ret));
@@ -2100,6 +2195,7 @@ static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
     int64_t sector_num = 0;
+    int64_t start_ns;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2136,6 +2232,7 @@ static int convert_do_copy(ImgConvertState *s)
     /* Do the copy */
     s->sector_next_status = 0;
     s->ret = -EINPROGRESS;
+    start_ns = get_clock();
 
     qemu_co_mutex_init(&s->lock);
     for (i = 0; i < s->num_coroutines; i++) {
@@ -2156,6 +2253,8 @@ static int convert_do_copy(ImgConvertState *s)
         }
     }
 
+    s->copy_ns = get_clock() - start_ns;
+
     return s->ret;
 }
 
@@ -2279,6 +2378,7 @@ static int img_convert(int argc, char **argv)
             {"target-is-zero", no_argument, 0, OPTION_TARGET_IS_ZERO},
             {"bitmaps", no_argument, 0, OPTION_BITMAPS},
             {"skip-broken-bitmaps", no_argument, 0, OPTION_SKIP_BROKEN},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hf:O:B:CcF:o:l:S:pt:T:qnm:WUr:",
@@ -2413,6 +2513,9 @@ static int img_convert(int argc, char **argv)
         case OPTION_SKIP_BROKEN:
             skip_broken = true;
             break;
+        case OPTION_STATS:
+            s.stats = true;
+            break;
         }
     }
 
@@ -2799,6 +2902,9 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (s.stats && !ret) {
+        convert_print_stats(&s);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
@@ -4414,10 +4520,36 @@ out_no_progress:
     return 0;
 }
 
-typedef struct BenchData {
+/*
+ * Latencies are counted in buckets that are 1/32 of a power of two wide,
+ * which keeps the percentiles within about 3% of the real values.
+ */
+#define BENCH_LAT_SUB_BITS  5
+#define BENCH_LAT_BUCKETS   ((64 - BENCH_LAT_SUB_BITS + 1) << BENCH_LAT_SUB_BITS)
+
+typedef struct BenchLatency {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[BENCH_LAT_BUCKETS];
+} BenchLatency;
+
+typedef struct BenchData BenchData;
+
+typedef struct BenchReq {
+    BenchData *b;
+    QEMUIOVector qiov;
+    int64_t start_ns;
+    bool write;
+} BenchReq;
+
+struct BenchData {
     BlockBackend *blk;
     uint64_t image_size;
     bool write;
+    bool random;
+    int read_percent;
     int bufsize;
     int step;
     int nrreq;
@@ -4425,12 +4557,119 @@ typedef struct BenchData {
     int flush_interval;
     bool drain_on_flush;
     uint8_t *buf;
-    QEMUIOVector *qiov;
+    BenchReq *reqs;
+    int *free_reqs;
+    int nr_free_reqs;
+    uint64_t rand_state;
 
     int in_flight;
     bool in_flush;
     uint64_t offset;
-} BenchData;
+
+    BenchLatency latency[2];    /* reads, writes */
+};
+
+static unsigned bench_latency_bucket(uint64_t ns)
+{
+    int shift;
+
+    if (ns < (1 << BENCH_LAT_SUB_BITS)) {
+        return ns;
+    }
+    shift = 63 - clz64(ns) - BENCH_LAT_SUB_BITS;
+    return ((shift + 1) << BENCH_LAT_SUB_BITS) +
+           ((ns >> shift) & ((1 << BENCH_LAT_SUB_BITS) - 1));
+}
+
+/* The middle of the latencies that go in @bucket */
+static uint64_t bench_latency_value(unsigned bucket)
+{
+    unsigned shift;
+    uint64_t mant;
+
+    if (bucket < (1 << BENCH_LAT_SUB_BITS)) {
+        return bucket;
+    }
+    shift = (bucket >> BENCH_LAT_SUB_BITS) - 1;
+    mant = (bucket & ((1 << BENCH_LAT_SUB_BITS) - 1)) |
+           (1 << BENCH_LAT_SUB_BITS);
+    return (mant << shift) + (shift ? 1ULL << (shift - 1) : 0);
+}
+
+static void bench_latency_add(BenchLatency *lat, uint64_t ns)
+{
+    lat->min_ns = lat->count ? MIN(lat->min_ns, ns) : ns;
+    lat->max_ns = MAX(lat->max_ns, ns);
+    lat->count++;
+    lat->sum_ns += ns;
+    lat->buckets[bench_latency_bucket(ns)]++;
+}
+
+/* Latency below which @permille of the requests completed */
+static uint64_t bench_latency_percentile(BenchLatency *lat, int permille)
+{
+    uint64_t target = DIV_ROUND_UP(lat->count * permille, 1000);
+    uint64_t seen = 0;
+
+    for (unsigned i = 0; i < BENCH_LAT_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= target && seen) {
+            return MIN(MAX(bench_latency_value(i), lat->min_ns), lat->max_ns);
+        }
+    }
+    return lat->max_ns;
+}
+
+/* xorshift64*, with a fixed seed so that runs can be compared */
+static uint64_t bench_rand(BenchData *b)
+{
+    b->rand_state ^= b->rand_state >> 12;
+    b->rand_state ^= b->rand_state << 25;
+    b->rand_state ^= b->rand_state >> 27;
+    return b->rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void bench_cb(void *opaque, int ret);
+
+static void bench_submit(BenchData *b)
+{
+    BlockAIOCB *acb;
+
+    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
+        BenchReq *req = &b->reqs[b->free_reqs[--b->nr_free_reqs]];
+        int64_t offset;
+
+        if (b->random) {
+            offset = (bench_rand(b) % (b->image_size / b->bufsize)) *
+                     b->bufsize;
+        } else {
+            offset = b->offset;
+            b->offset += b->step;
+            b->offset %= b->image_size;
+        }
+        req->write = b->write &&
+                     (b->read_percent == 0 ||
+                      bench_rand(b) % 100 >= b->read_percent);
+        req->start_ns = get_clock();
+
+        /* blk_aio_* might look for completed I/Os and kick bench_cb
+         * again, so make sure this operation is counted by in_flight
+         * and b->offset is ready for the next submission.
+         */
+        b->in_flight++;
+        if (req->write) {
+            acb = blk_aio_pwritev(b->blk, offset, &req->qiov, 0, bench_cb,
+                                  req);
+        } else {
+            acb = blk_aio_preadv(b->blk, offset, &req->qiov, 0, bench_cb,
+                                 req);
+        }
+        if (!acb) {
+            error_report("Failed to issue request");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
 
 static void bench_undrained_flush_cb(void *opaque, int ret)
 {
@@ -4440,69 +4679,157 @@ static void bench_undrained_flush_cb(void *opaque, int ret)
     }
 }
 
-static void bench_cb(void *opaque, int ret)
+static void bench_flush_cb(void *opaque, int ret)
 {
     BenchData *b = opaque;
+
+    bench_undrained_flush_cb(opaque, ret);
+
+    /* Just finished a flush with drained queue: Start next requests */
+    assert(b->in_flight == 0);
+    b->in_flush = false;
+    bench_submit(b);
+}
+
+static void bench_cb(void *opaque, int ret)
+{
+    BenchReq *req = opaque;
+    BenchData *b = req->b;
     BlockAIOCB *acb;
+    int remaining = b->n - b->in_flight;
 
     if (ret < 0) {
         error_report("Failed request: %s", strerror(-ret));
         exit(EXIT_FAILURE);
     }
 
-    if (b->in_flush) {
-        /* Just finished a flush with drained queue: Start next requests */
-        assert(b->in_flight == 0);
-        b->in_flush = false;
-    } else if (b->in_flight > 0) {
-        int remaining = b->n - b->in_flight;
-
-        b->n--;
-        b->in_flight--;
+    bench_latency_add(&b->latency[req->write], get_clock() - req->start_ns);
+    b->free_reqs[b->nr_free_reqs++] = req - b->reqs;
 
-        /* Time for flush? Drain queue if requested, then flush */
-        if (b->flush_interval && remaining % b->flush_interval == 0) {
-            if (!b->in_flight || !b->drain_on_flush) {
-                BlockCompletionFunc *cb;
+    b->n--;
+    b->in_flight--;
 
-                if (b->drain_on_flush) {
-                    b->in_flush = true;
-                    cb = bench_cb;
-                } else {
-                    cb = bench_undrained_flush_cb;
-                }
+    /* Time for flush? Drain queue if requested, then flush */
+    if (b->flush_interval && remaining % b->flush_interval == 0) {
+        if (!b->in_flight || !b->drain_on_flush) {
+            BlockCompletionFunc *cb;
 
-                acb = blk_aio_flush(b->blk, cb, b);
-                if (!acb) {
-                    error_report("Failed to issue flush request");
-                    exit(EXIT_FAILURE);
-                }
-            }
             if (b->drain_on_flush) {
-                return;
+                b->in_flush = true;
+                cb = bench_flush_cb;
+            } else {
+                cb = bench_undrained_flush_cb;
+            }
+
+            acb = blk_aio_flush(b->blk, cb, b);
+            if (!acb) {
+                error_report("Failed to issue flush request");
+                exit(EXIT_FAILURE);
             }
         }
+        if (b->drain_on_flush) {
+            return;
+        }
     }
 
-    while (b->n > b->in_flight && b->in_flight < b->nrreq) {
-        int64_t offset = b->offset;
-        /* blk_aio_* might look for completed I/Os and kick bench_cb
-         * again, so make sure this operation is counted by in_flight
-         * and b->offset is ready for the next submission.
-         */
-        b->in_flight++;
-        b->offset += b->step;
-        b->offset %= b->image_size;
-        if (b->write) {
-            acb = blk_aio_pwritev(b->blk, offset, b->qiov, 0, bench_cb, b);
+    bench_submit(b);
+}
+
+/* Parses a comma separated list of values between 1 and INT_MAX */
+static GArray *bench_parse_list(const char *arg, bool size, const char *what)
+{
+    g_auto(GStrv) items = g_strsplit(arg, ",", 0);
+    GArray *list = g_array_new(false, false, sizeof(int));
+
+    for (int i = 0; items[i]; i++) {
+        int64_t val;
+
+        if (size) {
+            val = cvtnum_full(what, items[i], 1, INT_MAX);
         } else {
-            acb = blk_aio_preadv(b->blk, offset, b->qiov, 0, bench_cb, b);
+            unsigned long res;
+
+            if (qemu_strtoul(items[i], NULL, 0, &res) < 0 || !res ||
+                res > INT_MAX) {
+                error_report("Invalid %s specified", what);
+                val = -1;
+            } else {
+                val = res;
+            }
         }
-        if (!acb) {
-            error_report("Failed to issue request");
-            exit(EXIT_FAILURE);
+        if (val < 0) {
+            g_array_free(list, true);
+            return NULL;
         }
+        g_array_append_val(list, (int){ val });
+    }
+    if (!list->len) {
+        error_report("Invalid %s specified", what);
+        g_array_free(list, true);
+        return NULL;
     }
+    return list;
+}
+
+static QDict *bench_latency_to_qdict(BenchLatency *lat)
+{
+    QDict *dict = qdict_new();
+
+    qdict_put_int(dict, "requests", lat->count);
+    qdict_put_int(dict, "min-ns", lat->min_ns);
+    qdict_put_int(dict, "mean-ns", lat->sum_ns / lat->count);
+    qdict_put_int(dict, "p50-ns", bench_latency_percentile(lat, 500));
+    qdict_put_int(dict, "p90-ns", bench_latency_percentile(lat, 900));
+    qdict_put_int(dict, "p99-ns", bench_latency_percentile(lat, 990));
+    qdict_put_int(dict, "p999-ns", bench_latency_percentile(lat, 999));
+    qdict_put_int(dict, "max-ns", lat->max_ns);
+    return dict;
+}
+
+static void bench_report(BenchData *b, int count, int64_t elapsed_ns,
+                         OutputFormat output_format, QList *results)
+{
+    static const char *const dirs[] = { "read", "write" };
+    double seconds = (double)elapsed_ns / NANOSECONDS_PER_SECOND;
+    QDict *run;
+
+    if (output_format == OFORMAT_HUMAN) {
+        printf("Run completed in %3.3f seconds.\n", seconds);
+        printf("%.0f requests/s, %.1f MiB/s\n", count / seconds,
+               (double)count * b->bufsize / MiB / seconds);
+        for (int i = 0; i < ARRAY_SIZE(dirs); i++) {
+            BenchLatency *lat = &b->latency[i];
+
+            if (!lat->count) {
+                continue;
+            }
+            printf("%s latency (us): min %.1f, mean %.1f, p50 %.1f, "
+                   "p99 %.1f, p99.9 %.1f, max %.1f\n", dirs[i],
+                   lat->min_ns / 1000.0, lat->sum_ns / lat->count / 1000.0,
+                   bench_latency_percentile(lat, 500) / 1000.0,
+                   bench_latency_percentile(lat, 990) / 1000.0,
+                   bench_latency_percentile(lat, 999) / 1000.0,
+                   lat->max_ns / 1000.0);
+        }
+        return;
+    }
+
+    run = qdict_new();
+    qdict_put_str(run, "pattern", b->random ? "random" : "sequential");
+    qdict_put_int(run, "buffer-size", b->bufsize);
+    qdict_put_int(run, "depth", b->nrreq);
+    qdict_put_int(run, "read-percent", b->write ? b->read_percent : 100);
+    qdict_put_int(run, "requests", count);
+    qdict_put_int(run, "elapsed-ns", elapsed_ns);
+    qdict_put(run, "iops", qnum_from_double(count / seconds));
+    qdict_put(run, "bytes-per-second",
+              qnum_from_double((double)count * b->bufsize / seconds));
+    for (int i = 0; i < ARRAY_SIZE(dirs); i++) {
+        if (b->latency[i].count) {
+            qdict_put(run, dirs[i], bench_latency_to_qdict(&b->latency[i]));
+        }
+    }
+    qlist_append(results, run);
 }
 
 static int img_bench(int argc, char **argv)
@@ -4512,10 +4839,12 @@ static int img_bench(int argc, char **argv)
     bool quiet = false;
     bool image_opts = false;
     bool is_write = false;
+    bool random = false;
+    int read_percent = -1;
     int count = 75000;
-    int depth = 64;
+    g_autoptr(GArray) depths = NULL;
     int64_t offset = 0;
-    size_t bufsize = 4096;
+    g_autoptr(GArray) bufsizes = NULL;
     int pattern = 0;
     size_t step = 0;
     int flush_interval = 0;
@@ -4525,10 +4854,11 @@ static int img_bench(int argc, char **argv)
     BenchData data = {};
     int flags = 0;
     bool writethrough = false;
-    struct timeval t1, t2;
     int i;
     bool force_share = false;
-    size_t buf_size = 0;
+    OutputFormat output_format = OFORMAT_HUMAN;
+    QList *results = NULL;
+    int max_depth = 0;
 
     for (;;) {
         static const struct option long_options[] = {
@@ -4538,6 +4868,9 @@ static int img_bench(int argc, char **argv)
             {"pattern", required_argument, 0, OPTION_PATTERN},
             {"no-drain", no_argument, 0, OPTION_NO_DRAIN},
             {"force-share", no_argument, 0, 'U'},
+            {"random", no_argument, 0, OPTION_RANDOM},
+            {"mix", required_argument, 0, OPTION_MIX},
+            {"output", required_argument, 0, OPTION_OUTPUT},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, ":hc:d:f:ni:o:qs:S:t:wU", long_options,
@@ -4568,16 +4901,12 @@ static int img_bench(int argc, char **argv)
             break;
         }
         case 'd':
-        {
-            unsigned long res;
-
-            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > INT_MAX) {
-                error_report("Invalid queue depth specified");
+            g_clear_pointer(&depths, g_array_unref);
+            depths = bench_parse_list(optarg, false, "queue depth");
+            if (!depths) {
                 return 1;
             }
-            depth = res;
             break;
-        }
         case 'f':
             fmt = optarg;
             break;
@@ -4605,17 +4934,12 @@ static int img_bench(int argc, char **argv)
             quiet = true;
             break;
         case 's':
-        {
-            int64_t sval;
-
-            sval = cvtnum_full("buffer size", optarg, 0, INT_MAX);
-            if (sval < 0) {
+            g_clear_pointer(&bufsizes, g_array_unref);
+            bufsizes = bench_parse_list(optarg, true, "buffer size");
+            if (!bufsizes) {
                 return 1;
             }
-
-            bufsize = sval;
             break;
-        }
         case 'S':
         {
             int64_t sval;
@@ -4671,6 +4995,31 @@ static int img_bench(int argc, char **argv)
         case OPTION_IMAGE_OPTS:
             image_opts = true;
             break;
+        case OPTION_RANDOM:
+            random = true;
+            break;
+        case OPTION_MIX:
+        {
+            unsigned long res;
+
+            if (qemu_strtoul(optarg, NULL, 0, &res) < 0 || res > 100) {
+                error_report("Invalid read percentage specified");
+                return 1;
+            }
+            read_percent = res;
+            break;
+        }
+        case OPTION_OUTPUT:
+            if (!strcmp(optarg, "json")) {
+                output_format = OFORMAT_JSON;
+            } else if (!strcmp(optarg, "human")) {
+                output_format = OFORMAT_HUMAN;
+            } else {
+                error_report("--output must be used with human or json "
+                             "as argument.");
+                return 1;
+            }
+            break;
         }
     }
 
@@ -4679,16 +5028,33 @@ static int img_bench(int argc, char **argv)
     }
     filename = argv[argc - 1];
 
+    if (!depths) {
+        depths = g_array_new(false, false, sizeof(int));
+        g_array_append_val(depths, (int){ 64 });
+    }
+    if (!bufsizes) {
+        bufsizes = g_array_new(false, false, sizeof(int));
+        g_array_append_val(bufsizes, (int){ 4096 });
+    }
+    for (i = 0; i < depths->len; i++) {
+        max_depth = MAX(max_depth, g_array_index(depths, int, i));
+    }
+
     if (!is_write && flush_interval) {
         error_report("--flush-interval is only available in write tests");
         ret = -1;
         goto out;
     }
-    if (flush_interval && flush_interval < depth) {
+    if (flush_interval && flush_interval < max_depth) {
         error_report("Flush interval can't be smaller than depth");
         ret = -1;
         goto out;
     }
+    if (!is_write && read_percent >= 0) {
+        error_report("--mix is only available in write tests");
+        ret = -1;
+        goto out;
+    }
 
     blk = img_open(image_opts, filename, fmt, flags, writethrough, quiet,
                    force_share);
@@ -4703,56 +5069,100 @@ static int img_bench(int argc, char **argv)
         goto out;
     }
 
-    data = (BenchData) {
-        .blk            = blk,
-        .image_size     = image_size,
-        .bufsize        = bufsize,
-        .step           = step ?: bufsize,
-        .nrreq          = depth,
-        .n              = count,
-        .offset         = offset,
-        .write          = is_write,
-        .flush_interval = flush_interval,
-        .drain_on_flush = drain_on_flush,
-    };
-    printf("Sending %d %s requests, %d bytes each, %d in parallel "
-           "(starting at offset %" PRId64 ", step size %d)\n",
-           data.n, data.write ? "write" : "read", data.bufsize, data.nrreq,
-           data.offset, data.step);
-    if (flush_interval) {
-        printf("Sending flush every %d requests\n", flush_interval);
+    if (output_format == OFORMAT_JSON) {
+        results = qlist_new();
     }
 
-    buf_size = data.nrreq * data.bufsize;
-    data.buf = blk_blockalign(blk, buf_size);
-    memset(data.buf, pattern, data.nrreq * data.bufsize);
+    for (int s = 0; s < bufsizes->len; s++) {
+        for (int d = 0; d < depths->len; d++) {
+            int bufsize = g_array_index(bufsizes, int, s);
+            size_t buf_size;
+            int64_t t1;
 
-    blk_register_buf(blk, data.buf, buf_size, &error_fatal);
+            if (random && image_size < bufsize) {
+                error_report("The image is smaller than the buffer size");
+                ret = -1;
+                goto out;
+            }
 
-    data.qiov = g_new(QEMUIOVector, data.nrreq);
-    for (i = 0; i < data.nrreq; i++) {
-        qemu_iovec_init(&data.qiov[i], 1);
-        qemu_iovec_add(&data.qiov[i],
-                       data.buf + i * data.bufsize, data.bufsize);
-    }
+            data = (BenchData) {
+                .blk            = blk,
+                .image_size     = image_size,
+                .bufsize        = bufsize,
+                .step           = step ?: bufsize,
+                .nrreq          = g_array_index(depths, int, d),
+                .n              = count,
+                .offset         = offset,
+                .write          = is_write,
+                .random         = random,
+                .read_percent   = MAX(read_percent, 0),
+                .flush_interval = flush_interval,
+                .drain_on_flush = drain_on_flush,
+                .rand_state     = 0x9e3779b97f4a7c15ULL,
+            };
+            if (output_format == OFORMAT_HUMAN) {
+                printf("Sending %d %s requests, %d bytes each, %d in "
+                       "parallel ", data.n,
+                       !data.write ? "read" :
+                       data.read_percent ? "mixed" : "write",
+                       data.bufsize, data.nrreq);
+                if (data.random) {
+                    printf("(at random offsets)\n");
+                } else {
+                    printf("(starting at offset %" PRId64 ", step size "
+                           "%d)\n", data.offset, data.step);
+                }
+                if (flush_interval) {
+                    printf("Sending flush every %d requests\n",
+                           flush_interval);
+                }
+            }
 
-    gettimeofday(&t1, NULL);
-    bench_cb(&data, 0);
+            buf_size = data.nrreq * data.bufsize;
+            data.buf = blk_blockalign(blk, buf_size);
+            memset(data.buf, pattern, buf_size);
 
-    while (data.n > 0) {
-        main_loop_wait(false);
+            blk_register_buf(blk, data.buf, buf_size, &error_fatal);
+
+            data.reqs = g_new0(BenchReq, data.nrreq);
+            data.free_reqs = g_new(int, data.nrreq);
+            for (i = 0; i < data.nrreq; i++) {
+                data.reqs[i].b = &data;
+                qemu_iovec_init(&data.reqs[i].qiov, 1);
+                qemu_iovec_add(&data.reqs[i].qiov,
+                               data.buf + i * data.bufsize, data.bufsize);
+                data.free_reqs[data.nr_free_reqs++] = data.nrreq - 1 - i;
+            }
+
+            t1 = get_clock();
+            bench_submit(&data);
+
+            while (data.n > 0) {
+                main_loop_wait(false);
+            }
+            bench_report(&data, count, get_clock() - t1, output_format,
+                         results);
+
+            for (i = 0; i < data.nrreq; i++) {
+                qemu_iovec_destroy(&data.reqs[i].qiov);
+            }
+            g_free(data.reqs);
+            g_free(data.free_reqs);
+            blk_unregister_buf(blk, data.buf, buf_size);
+            qemu_vfree(data.buf);
+            data.buf = NULL;
+        }
     }
-    gettimeofday(&t2, NULL);
 
-    printf("Run completed in %3.3f seconds.\n",
-           (t2.tv_sec - t1.tv_sec)
-           + ((double)(t2.tv_usec - t1.tv_usec) / 1000000));
+    if (results) {
+        GString *str = qobject_to_json_pretty(QOBJECT(results), true);
 
-out:
-    if (data.buf) {
-        blk_unregister_buf(blk, data.buf, buf_size);
+        printf("%s\n", str->str);
+        g_string_free(str, true);
     }
-    qemu_vfree(data.buf);
+
+out:
+    qobject_unref(results);
     blk_unref(blk);
 
     if (ret) {
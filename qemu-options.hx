@@ -188,7 +188,7 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi|auto (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
     This is used to enable an accelerator. Depending on the target
@@ -227,7 +227,7 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
-    ``thread=single|multi``
+    ``thread=single|multi|auto``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
         additional host cores. The default is to enable multi-threading
@@ -235,6 +235,11 @@ SRST
         incompatible TCG features have been enabled (e.g.
         icount/replay).
 
+        ``thread=auto`` enables multi-threading only when the host has more
+        cores than the guest has vCPUs, so that each vCPU thread gets a core
+        of its own next to the main loop, and when the host can run threads
+        at all, which in a browser needs cross-origin isolation.
+
     ``dirty-ring-size=n``
         When the KVM accelerator is used, it controls the size of the per-vCPU
         dirty page ring buffer (number of entries for each vCPU). It should
@@ -832,6 +837,9 @@ DEF("audiodev", HAS_ARG, QEMU_OPTION_audiodev,
 #endif
 #ifdef CONFIG_DBUS_DISPLAY
     "-audiodev dbus,id=id[,prop[=value][,...]]\n"
+#endif
+#ifdef CONFIG_AUDIO_WASM
+    "-audiodev wasm,id=id[,prop[=value][,...]]\n"
 #endif
     "-audiodev wav,id=id[,prop[=value][,...]]\n"
     "                path= path of wav file to record\n",
@@ -1027,6 +1035,15 @@ SRST
     usually you can ignore this option. This backend has no backend
     specific properties.
 
+``-audiodev wasm,id=id[,prop[=value][,...]]``
+    Creates a backend for QEMU running in a browser, that plays audio
+    through an AudioWorklet reading a ring in the wasm memory; see
+    ``examples/audio``. Playback only. The ring holds
+    ``out.buffer-length`` microseconds of audio, 30000 by default,
+    rounded up to a power of two frames; lower it together with
+    ``timer-period`` for a lower latency. This backend has no backend
+    specific properties.
+
 ``-audiodev wav,id=id[,prop[=value][,...]]``
     Creates a backend that writes audio to a WAV file.
 
@@ -1739,7 +1756,7 @@ ERST
 
 DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     "-fsdev local,id=id,path=path,security_model=mapped-xattr|mapped-file|passthrough|none\n"
-    " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode]\n"
+    " [,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,cache_ttl=ms]\n"
     " [[,throttling.bps-total=b]|[[,throttling.bps-read=r][,throttling.bps-write=w]]]\n"
     " [[,throttling.iops-total=i]|[[,throttling.iops-read=r][,throttling.iops-write=w]]]\n"
     " [[,throttling.bps-total-max=bm]|[[,throttling.bps-read-max=rm][,throttling.bps-write-max=wm]]]\n"
@@ -1747,17 +1764,20 @@ DEF("fsdev", HAS_ARG, QEMU_OPTION_fsdev,
     " [[,throttling.iops-size=is]]\n"
     "-fsdev proxy,id=id,socket=socket[,writeout=immediate][,readonly=on]\n"
     "-fsdev proxy,id=id,sock_fd=sock_fd[,writeout=immediate][,readonly=on]\n"
-    "-fsdev synth,id=id\n",
+    "-fsdev synth,id=id\n"
+    "-fsdev opfs,id=id,path=path[,readonly=on][,cache_ttl=ms]\n",
     QEMU_ARCH_ALL)
 
 SRST
-``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode] [,throttling.option=value[,throttling.option=value[,...]]]``
+``-fsdev local,id=id,path=path,security_model=security_model [,writeout=writeout][,readonly=on][,fmode=fmode][,dmode=dmode][,cache_ttl=ms] [,throttling.option=value[,throttling.option=value[,...]]]``
   \ 
 ``-fsdev proxy,id=id,socket=socket[,writeout=writeout][,readonly=on]``
   \
 ``-fsdev proxy,id=id,sock_fd=sock_fd[,writeout=writeout][,readonly=on]``
   \
 ``-fsdev synth,id=id[,readonly=on]``
+  \
+``-fsdev opfs,id=id,path=path[,readonly=on][,cache_ttl=ms]``
     Define a new file system device. Valid options are:
 
     ``local``
@@ -1771,6 +1791,12 @@ SRST
     ``synth``
         Synthetic filesystem, only used by QTests.
 
+    ``opfs``
+        Accesses are done by QEMU to the directory ``path`` of the
+        browser's Origin Private File System, which is created if needed.
+        Only available in WebAssembly builds. OPFS has no symbolic
+        links, special files or owners.
+
     ``id=id``
         Specifies identifier for this device.
 
@@ -1826,6 +1852,15 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``cache_ttl=ms``
+        Caches the attributes of files, and which files do not exist,
+        for ms milliseconds. Changes made through the export drop what
+        is cached about the files they touch, changes made on the host
+        may be missed for up to ms milliseconds. This saves many
+        metadata requests on slow host file systems, such as the ones
+        of browsers. Works only with the local fsdriver. The default is
+        0, no caching.
+
     ``throttling.bps-total=b,throttling.bps-read=r,throttling.bps-write=w``
         Specify bandwidth throttling limits in bytes per second, either
         for all request types or for reads or writes only.
@@ -1867,20 +1902,23 @@ ERST
 
 DEF("virtfs", HAS_ARG, QEMU_OPTION_virtfs,
     "-virtfs local,path=path,mount_tag=tag,security_model=mapped-xattr|mapped-file|passthrough|none\n"
-    "        [,id=id][,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,multidevs=remap|forbid|warn]\n"
+    "        [,id=id][,writeout=immediate][,readonly=on][,fmode=fmode][,dmode=dmode][,multidevs=remap|forbid|warn][,cache_ttl=ms]\n"
     "-virtfs proxy,mount_tag=tag,socket=socket[,id=id][,writeout=immediate][,readonly=on]\n"
     "-virtfs proxy,mount_tag=tag,sock_fd=sock_fd[,id=id][,writeout=immediate][,readonly=on]\n"
-    "-virtfs synth,mount_tag=tag[,id=id][,readonly=on]\n",
+    "-virtfs synth,mount_tag=tag[,id=id][,readonly=on]\n"
+    "-virtfs opfs,path=path,mount_tag=tag[,id=id][,readonly=on][,cache_ttl=ms]\n",
     QEMU_ARCH_ALL)
 
 SRST
-``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs]``
+``-virtfs local,path=path,mount_tag=mount_tag ,security_model=security_model[,writeout=writeout][,readonly=on] [,fmode=fmode][,dmode=dmode][,multidevs=multidevs][,cache_ttl=ms]``
   \ 
 ``-virtfs proxy,socket=socket,mount_tag=mount_tag [,writeout=writeout][,readonly=on]``
   \ 
 ``-virtfs proxy,sock_fd=sock_fd,mount_tag=mount_tag [,writeout=writeout][,readonly=on]``
   \
 ``-virtfs synth,mount_tag=mount_tag``
+  \
+``-virtfs opfs,path=path,mount_tag=mount_tag[,readonly=on][,cache_ttl=ms]``
     Define a new virtual filesystem device and expose it to the guest using
     a virtio-9p-device (a.k.a. 9pfs), which essentially means that a certain
     directory on host is made directly accessible by guest as a pass-through
@@ -1904,6 +1942,10 @@ SRST
     ``synth``
         Synthetic filesystem, only used by QTests.
 
+    ``opfs``
+        Accesses are done by QEMU to a directory of the browser's Origin
+        Private File System. Only available in WebAssembly builds.
+
     ``id=id``
         Specifies identifier for the filesystem device
 
@@ -1959,6 +2001,15 @@ SRST
         host. Works only with security models "mapped-xattr" and
         "mapped-file".
 
+    ``cache_ttl=ms``
+        Caches the attributes of files, and which files do not exist,
+        for ms milliseconds. Changes made through the export drop what
+        is cached about the files they touch, changes made on the host
+        may be missed for up to ms milliseconds. This saves many
+        metadata requests on slow host file systems, such as the ones
+        of browsers. Works only with the local fsdriver. The default is
+        0, no caching.
+
     ``mount_tag=mount_tag``
         Specifies the tag name to be used by the guest to mount this
         export point.
@@ -2907,6 +2958,11 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
     "                use 'start-queue=m' to specify the first queue that should be used\n"
 #endif
+#ifdef CONFIG_WASM_NET
+    "-netdev wasm,id=str[,ring-size=n]\n"
+    "                exchange frames with a network stack running in the browser\n"
+    "                through packet rings of 'n' bytes in shared memory\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
@@ -3456,6 +3512,18 @@ SRST
         |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
             -netdev af-xdp,id=n1,ifname=eth0,queues=3,inhibit=on,sock-fds=15:16:17
 
+``-netdev wasm,id=str[,ring-size=n]``
+    Exchange Ethernet frames with a network stack running in the browser,
+    when QEMU itself runs there.  Frames go through two rings, one for
+    each direction, in the memory of QEMU, which is a SharedArrayBuffer.
+    Each ring is 'n' bytes, a power of two between 64 KiB and 64 MiB,
+    256 KiB by default.
+
+    An ``attach`` message with the location of the rings is posted to
+    ``Module.wasmNetPort`` if the page has set it, and it is also kept
+    in ``Module.wasmNet[id]``.  ``examples/networking/htdocs/wasm-net.js``
+    implements the other side of the rings.
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3533,6 +3601,9 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev vc,id=id[[,width=width][,height=height]][[,cols=cols][,rows=rows]]\n"
     "         [,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev ringbuf,id=id[,size=size][,logfile=PATH][,logappend=on|off]\n"
+#ifdef CONFIG_WASM_CHARDEV
+    "-chardev wasm,id=id[,size=size][,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
+#endif
     "-chardev file,id=id,path=path[,input-path=input-file][,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev pipe,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #ifdef _WIN32
@@ -3540,7 +3611,8 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev serial,id=id,path=path[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
 #else
     "-chardev pty,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
-    "-chardev stdio,id=id[,mux=on|off][,signal=on|off][,logfile=PATH][,logappend=on|off]\n"
+    "-chardev stdio,id=id[,mux=on|off][,signal=on|off][,coalesce=on|off]\n"
+    "         [,logfile=PATH][,logappend=on|off]\n"
 #endif
 #ifdef CONFIG_BRLAPI
     "-chardev braille,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
@@ -3736,6 +3808,20 @@ The available backends are:
     Create a ring buffer with fixed size ``size``. size must be a power
     of two and defaults to ``64K``.
 
+``-chardev wasm,id=id[,size=size]``
+    Exchange the bytes with a controller written in JavaScript, when QEMU
+    runs in a browser, for example to drive QMP or a serial console from
+    the page.  The bytes go through two rings, one for each direction, in
+    the memory of QEMU, which is a SharedArrayBuffer.  Each ring is
+    ``size`` bytes, a power of two between 4 KiB and 16 MiB, 64 KiB by
+    default.
+
+    An ``attach`` message with the location of the rings is posted to
+    ``Module.wasmChardevPort`` if the page has set it, and it is also
+    kept in ``Module.wasmChardev[id]``.
+    ``examples/chardev/wasm-chardev.js`` implements the other side of the
+    rings.
+
 ``-chardev file,id=id,path=path[,input-path=input-path]``
     Log all traffic received from the guest to a file.
 
@@ -3784,13 +3870,19 @@ The available backends are:
 
     ``pty`` is not available on Windows hosts.
 
-``-chardev stdio,id=id[,signal=on|off]``
+``-chardev stdio,id=id[,signal=on|off][,coalesce=on|off]``
     Connect to standard input and standard output of the QEMU process.
 
     ``signal`` controls if signals are enabled on the terminal, that
     includes exiting QEMU with the key sequence Control-c. This option
     is enabled by default, use ``signal=off`` to disable it.
 
+    ``coalesce`` buffers the output and writes it once per main loop
+    iteration, rather than on every write of the device.  A serial port
+    otherwise writes each byte on its own, which is slow when standard
+    output is a terminal emulated in JavaScript.  This option is
+    enabled by default with emscripten, and disabled otherwise.
+
 ``-chardev braille,id=id``
     Connect to a local BrlAPI server. ``braille`` does not take any
     options.
@@ -4637,13 +4729,13 @@ SRST
 ERST
 
 DEF("icount", HAS_ARG, QEMU_OPTION_icount, \
-    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>]]\n" \
+    "-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=<filename>[,rrsnapshot=<snapshot>][,rrcompress=on|off]]\n" \
     "                enable virtual instruction counter with 2^N clock ticks per\n" \
     "                instruction, enable aligning the host and virtual clocks\n" \
     "                or disable real time cpu sleeping, and optionally enable\n" \
     "                record-and-replay mode\n", QEMU_ARCH_ALL)
 SRST
-``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot]]``
+``-icount [shift=N|auto][,align=on|off][,sleep=on|off][,rr=record|replay,rrfile=filename[,rrsnapshot=snapshot][,rrcompress=on|off]]``
     Enable virtual instruction counter. The virtual cpu will execute one
     instruction every 2^N ns of virtual time. If ``auto`` is specified
     then the virtual cpu speed will be automatically adjusted to keep
@@ -4685,6 +4777,9 @@ SRST
     name. In record mode, a new VM snapshot with the given name is created
     at the start of execution recording. In replay mode this option
     specifies the snapshot name used to load the initial VM state.
+    ``rrcompress=on`` compresses the log with zstd in record mode; in
+    replay mode, compressed logs are recognized without it. The log is
+    written and read ahead by a separate thread in large blocks.
 ERST
 
 DEF("watchdog-action", HAS_ARG, QEMU_OPTION_watchdog_action, \
@@ -4733,6 +4828,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4=on|off][,ipv6=on|off]\n" \
     "-incoming rdma:host:port[,ipv4=on|off][,ipv6=on|off]\n" \
     "-incoming unix:socketpath\n" \
+    "-incoming ws://[host]:port[/path]\n" \
+    "-incoming wss://[host]:port[/path]\n" \
     "                prepare for incoming migration, listen on\n" \
     "                specified protocol and socket address\n" \
     "-incoming fd:fd\n" \
@@ -4752,6 +4849,14 @@ SRST
 ``-incoming unix:socketpath``
     Prepare for incoming migration, listen on a given unix socket.
 
+``-incoming ws://[host]:port[/path]``
+  \ 
+``-incoming wss://[host]:port[/path]``
+    Prepare for incoming migration, listen on a given tcp port for
+    websocket connections, such as those of a source running in a
+    browser.  With ``wss://``, the websockets run over TLS with the
+    credentials of the ``tls-creds`` migration parameter.
+
 ``-incoming fd:fd``
     Accept incoming migration from a given file descriptor.
 
@@ -4984,13 +5089,15 @@ ERST
 #endif
 #ifdef CONFIG_POSIX
 DEF("run-with", HAS_ARG, QEMU_OPTION_run_with,
-    "-run-with [async-teardown=on|off][,chroot=dir]\n"
+    "-run-with [async-teardown=on|off][,chroot=dir][,clock-tick=us]\n"
     "                Set miscellaneous QEMU process lifecycle options:\n"
     "                async-teardown=on enables asynchronous teardown (Linux only)\n"
-    "                chroot=dir chroot to dir just before starting the VM\n",
+    "                chroot=dir chroot to dir just before starting the VM\n"
+    "                clock-tick=us read the guest clock from a timestamp\n"
+    "                              refreshed every us microseconds (emscripten only)\n",
     QEMU_ARCH_ALL)
 SRST
-``-run-with [async-teardown=on|off][,chroot=dir]``
+``-run-with [async-teardown=on|off][,chroot=dir][,clock-tick=us]``
     Set QEMU process lifecycle options.
 
     ``async-teardown=on`` enables asynchronous teardown. A new process called
@@ -5007,6 +5114,14 @@ SRST
     ``chroot=dir`` can be used for doing a chroot to the specified directory
     immediately before starting the guest execution. This is especially useful
     in combination with -runas.
+
+    ``clock-tick=us`` is only available with emscripten, where reading the
+    host clock is a call to ``performance.now()``. A thread then reads it
+    every us microseconds into a shared timestamp, which the guest clocks
+    read instead; the timer devices of the guest read them on every access
+    to their counters. Time measurements, such as those of tracing and of
+    the statistics, still read the host clock. The guest clocks advance in
+    steps of at most us microseconds, and never go back.
 ERST
 #endif
 
@@ -5231,6 +5346,13 @@ SRST
         ``virtio-rng`` device. By default, the ``virtio-rng`` device
         uses this RNG backend.
 
+    ``-object rng-pool,id=id[,size=size]``
+        Creates a random number generator backend which obtains entropy
+        like ``rng-builtin``, but in batches of ``size`` bytes (64 KiB by
+        default) kept in a pool that the requests of the ``virtio-rng``
+        device are served from. This is faster where each call for
+        entropy is expensive, like in a browser.
+
     ``-object rng-random,id=id,filename=/dev/random``
         Creates a random number generator backend which obtains entropy
         from a device on the host. The ``id`` parameter is a unique ID
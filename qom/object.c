@@ -1084,8 +1084,34 @@ typedef struct OCFData
     const char *implements_type;
     bool include_abstract;
     void *opaque;
+    TypeImpl *implements_target;
 } OCFData;
 
+/*
+ * Whether @target is @type, one of its ancestors or one of their
+ * interfaces, looking only at the type names so that no class has to be
+ * initialized.
+ */
+static bool type_is_derived_from(TypeImpl *type, TypeImpl *target)
+{
+    int i;
+
+    for (; type; type = type_get_parent(type)) {
+        if (type == target) {
+            return true;
+        }
+        for (i = 0; i < type->num_interfaces; i++) {
+            TypeImpl *iface = type_get_by_name(type->interfaces[i].typename);
+
+            if (iface && type_is_derived_from(iface, target)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
 static void object_class_foreach_tramp(gpointer key, gpointer value,
                                        gpointer opaque)
 {
@@ -1093,6 +1119,16 @@ static void object_class_foreach_tramp(gpointer key, gpointer value,
     TypeImpl *type = value;
     ObjectClass *k;
 
+    if (!data->include_abstract && type->abstract) {
+        return;
+    }
+
+    /* Don't run class_init for every type to list the few we want */
+    if (data->implements_target &&
+        !type_is_derived_from(type, data->implements_target)) {
+        return;
+    }
+
     type_initialize(type);
     k = type->class;
 
@@ -1114,6 +1150,8 @@ void object_class_foreach(void (*fn)(ObjectClass *klass, void *opaque),
 {
     OCFData data = { fn, implements_type, include_abstract, opaque };
 
+    data.implements_target = type_get_by_name(implements_type);
+
     enumerating_types = true;
     g_hash_table_foreach(type_table_get(), object_class_foreach_tramp, &data);
     enumerating_types = false;
@@ -15,6 +15,12 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -30,6 +36,46 @@ static unsigned long mutex_head, mutex_tail;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * The log goes through two REPLAY_BUF_SIZE buffers. The replay threads
+ * fill (or drain) one of them while the log thread writes (or reads
+ * ahead) the other, so that the replay mutex is never held across an
+ * access to the file, which can be very slow on the wasm file systems.
+ * In a compressed log, each buffer is a zstd frame preceded by its
+ * compressed and uncompressed sizes, as big endian 32-bit words.
+ */
+#define REPLAY_BUF_SIZE (4 * MiB)
+#define REPLAY_FRAME_HEADER_SIZE 8
+
+static struct {
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    bool running;
+    bool quit;
+    bool compress;
+
+    /* Filled or drained by the replay threads, under the replay mutex */
+    uint8_t *buf;
+    size_t pos;
+    size_t len;
+    uint64_t offset;    /* of buf[0] in the log, after HEADER_SIZE */
+
+    /* Owned by the log thread while io_busy, protected by lock */
+    uint8_t *io_buf;
+    size_t io_len;
+    bool io_busy;
+    bool io_eof;
+    bool io_error;
+
+#ifdef CONFIG_ZSTD
+    uint8_t *zbuf;
+    size_t zbuf_size;
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+#endif
+} rlog;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -44,12 +90,291 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static bool replay_log_write(const uint8_t *data, size_t len)
+{
+#ifdef CONFIG_ZSTD
+    if (rlog.compress) {
+        uint8_t *frame = rlog.zbuf + REPLAY_FRAME_HEADER_SIZE;
+        size_t n = ZSTD_compressCCtx(rlog.cctx, frame,
+                                     rlog.zbuf_size - REPLAY_FRAME_HEADER_SIZE,
+                                     data, len, 1);
+        if (ZSTD_isError(n)) {
+            return false;
+        }
+        stl_be_p(rlog.zbuf, n);
+        stl_be_p(rlog.zbuf + 4, len);
+        data = rlog.zbuf;
+        len = n + REPLAY_FRAME_HEADER_SIZE;
+    }
+#endif
+    return fwrite(data, 1, len, replay_file) == len;
+}
+
+/* Returns the number of bytes read into data, 0 at the end of the log */
+static size_t replay_log_read(uint8_t *data, bool *error)
+{
+#ifdef CONFIG_ZSTD
+    if (rlog.compress) {
+        uint8_t hdr[REPLAY_FRAME_HEADER_SIZE];
+        size_t zlen, len;
+
+        if (fread(hdr, 1, sizeof(hdr), replay_file) != sizeof(hdr)) {
+            *error = ferror(replay_file);
+            return 0;
+        }
+        zlen = ldl_be_p(hdr);
+        len = ldl_be_p(hdr + 4);
+        if (zlen > rlog.zbuf_size || len > REPLAY_BUF_SIZE ||
+            fread(rlog.zbuf, 1, zlen, replay_file) != zlen ||
+            ZSTD_decompressDCtx(rlog.dctx, data, REPLAY_BUF_SIZE,
+                                rlog.zbuf, zlen) != len) {
+            *error = true;
+            return 0;
+        }
+        return len;
+    }
+#endif
+    size_t len = fread(data, 1, REPLAY_BUF_SIZE, replay_file);
+    if (len == 0) {
+        *error = ferror(replay_file);
+    }
+    return len;
+}
+
+static void *replay_log_thread(void *opaque)
+{
+    bool record = replay_mode == REPLAY_MODE_RECORD;
+
+    qemu_mutex_lock(&rlog.lock);
+    for (;;) {
+        while (!rlog.io_busy && !rlog.quit) {
+            qemu_cond_wait(&rlog.cond, &rlog.lock);
+        }
+        if (!rlog.io_busy) {
+            break;
+        }
+        qemu_mutex_unlock(&rlog.lock);
+
+        bool error = false;
+        size_t len = 0;
+        if (record) {
+            error = !replay_log_write(rlog.io_buf, rlog.io_len);
+        } else {
+            len = replay_log_read(rlog.io_buf, &error);
+        }
+
+        qemu_mutex_lock(&rlog.lock);
+        if (!record) {
+            rlog.io_len = len;
+            rlog.io_eof = len == 0;
+        }
+        rlog.io_error |= error;
+        rlog.io_busy = false;
+        qemu_cond_broadcast(&rlog.cond);
+    }
+    qemu_mutex_unlock(&rlog.lock);
+    return NULL;
+}
+
+/* Waits for the log thread to be done with io_buf, lock must be held */
+static void replay_log_wait_io(void)
+{
+    while (rlog.io_busy) {
+        qemu_cond_wait(&rlog.cond, &rlog.lock);
+    }
+}
+
+/* Record: hands the filled buffer to the log thread */
+static void replay_log_flush(void)
+{
+    bool error;
+
+    qemu_mutex_lock(&rlog.lock);
+    replay_log_wait_io();
+    error = rlog.io_error;
+    if (rlog.pos > 0) {
+        uint8_t *data = rlog.io_buf;
+
+        rlog.io_buf = rlog.buf;
+        rlog.io_len = rlog.pos;
+        rlog.io_busy = true;
+        rlog.buf = data;
+        rlog.offset += rlog.pos;
+        rlog.pos = 0;
+        qemu_cond_broadcast(&rlog.cond);
+    }
+    qemu_mutex_unlock(&rlog.lock);
+
+    if (error) {
+        replay_write_error();
+    }
+}
+
+/* Play: takes the buffer read ahead and starts reading the next one */
+static void replay_log_fill(void)
+{
+    uint8_t *data;
+
+    qemu_mutex_lock(&rlog.lock);
+    replay_log_wait_io();
+    if (rlog.io_eof || rlog.io_error) {
+        qemu_mutex_unlock(&rlog.lock);
+        replay_read_error();
+    }
+    data = rlog.io_buf;
+    rlog.io_buf = rlog.buf;
+    rlog.buf = data;
+    rlog.offset += rlog.len;
+    rlog.len = rlog.io_len;
+    rlog.pos = 0;
+    rlog.io_busy = true;
+    qemu_cond_broadcast(&rlog.cond);
+    qemu_mutex_unlock(&rlog.lock);
+}
+
+void replay_log_init(uint32_t version, bool compress)
+{
+    uint8_t hdr[HEADER_SIZE];
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        rlog.compress = compress;
+        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+    } else {
+        /* the header of the log, see replay_log_finish */
+        if (fread(hdr, 1, HEADER_SIZE, replay_file) != HEADER_SIZE ||
+            ldl_be_p(hdr) != version) {
+            error_report("Replay: invalid input log file version");
+            exit(1);
+        }
+        rlog.compress = ldq_be_p(hdr + 4) & REPLAY_LOG_ZSTD;
+    }
+
+#ifdef CONFIG_ZSTD
+    if (rlog.compress) {
+        rlog.zbuf_size = REPLAY_FRAME_HEADER_SIZE +
+                         ZSTD_compressBound(REPLAY_BUF_SIZE);
+        rlog.zbuf = g_malloc(rlog.zbuf_size);
+        rlog.cctx = ZSTD_createCCtx();
+        rlog.dctx = ZSTD_createDCtx();
+    }
+#else
+    if (rlog.compress) {
+        error_report("Replay: compressed logs need zstd support, "
+                     "which is not compiled in");
+        exit(1);
+    }
+#endif
+
+    rlog.buf = g_malloc(REPLAY_BUF_SIZE);
+    rlog.io_buf = g_malloc(REPLAY_BUF_SIZE);
+    rlog.pos = rlog.len = 0;
+    rlog.offset = 0;
+    rlog.quit = rlog.io_eof = rlog.io_error = false;
+    qemu_mutex_init(&rlog.lock);
+    qemu_cond_init(&rlog.cond);
+    rlog.running = true;
+    /* in play mode, read ahead from the start */
+    rlog.io_busy = replay_mode == REPLAY_MODE_PLAY;
+    qemu_thread_create(&rlog.thread, "replay-log", replay_log_thread,
+                       NULL, QEMU_THREAD_JOINABLE);
+}
+
+void replay_log_finish(uint32_t version)
+{
+    uint8_t hdr[HEADER_SIZE];
+
+    if (!rlog.running) {
+        return;
+    }
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_log_flush();
+    }
+
+    qemu_mutex_lock(&rlog.lock);
+    replay_log_wait_io();
+    rlog.quit = true;
+    qemu_cond_broadcast(&rlog.cond);
+    qemu_mutex_unlock(&rlog.lock);
+    qemu_thread_join(&rlog.thread);
+    rlog.running = false;
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        if (rlog.io_error) {
+            replay_write_error();
+        }
+        stl_be_p(hdr, version);
+        stq_be_p(hdr + 4, rlog.compress ? REPLAY_LOG_ZSTD : 0);
+        fseek(replay_file, 0, SEEK_SET);
+        if (fwrite(hdr, 1, HEADER_SIZE, replay_file) != HEADER_SIZE) {
+            replay_write_error();
+        }
+    }
+
+    g_free(rlog.buf);
+    g_free(rlog.io_buf);
+#ifdef CONFIG_ZSTD
+    if (rlog.compress) {
+        g_free(rlog.zbuf);
+        ZSTD_freeCCtx(rlog.cctx);
+        ZSTD_freeDCtx(rlog.dctx);
+    }
+#endif
+}
+
+uint64_t replay_log_tell(void)
+{
+    return HEADER_SIZE + rlog.offset + rlog.pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    uint64_t start = HEADER_SIZE;
+
+    assert(replay_mode == REPLAY_MODE_PLAY && offset >= HEADER_SIZE);
+    qemu_mutex_lock(&rlog.lock);
+    replay_log_wait_io();
+
+    if (rlog.compress) {
+        /* find the frame with the offset, frames are not seekable */
+        uint8_t hdr[REPLAY_FRAME_HEADER_SIZE];
+
+        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        while (fread(hdr, 1, sizeof(hdr), replay_file) == sizeof(hdr)) {
+            if (offset < start + ldl_be_p(hdr + 4)) {
+                fseek(replay_file, -(long)sizeof(hdr), SEEK_CUR);
+                break;
+            }
+            start += ldl_be_p(hdr + 4);
+            fseek(replay_file, ldl_be_p(hdr), SEEK_CUR);
+        }
+    } else {
+        start = offset;
+        fseek(replay_file, start, SEEK_SET);
+    }
+
+    rlog.offset = start - HEADER_SIZE;
+    rlog.pos = rlog.len = 0;
+    rlog.io_eof = false;
+    rlog.io_busy = true;
+    qemu_cond_broadcast(&rlog.cond);
+    qemu_mutex_unlock(&rlog.lock);
+
+    if (offset > start) {
+        replay_log_fill();
+        if (offset - start > rlog.len) {
+            replay_read_error();
+        }
+        rlog.pos = offset - start;
+    }
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (unlikely(rlog.pos == REPLAY_BUF_SIZE)) {
+            replay_log_flush();
         }
+        rlog.buf[rlog.pos++] = byte;
     }
 }
 
@@ -82,8 +407,17 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size > 0) {
+            size_t n;
+
+            if (rlog.pos == REPLAY_BUF_SIZE) {
+                replay_log_flush();
+            }
+            n = MIN(size, REPLAY_BUF_SIZE - rlog.pos);
+            memcpy(rlog.buf + rlog.pos, buf, n);
+            rlog.pos += n;
+            buf += n;
+            size -= n;
         }
     }
 }
@@ -92,11 +426,10 @@ uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
+        if (unlikely(rlog.pos == rlog.len)) {
+            replay_log_fill();
         }
-        byte = r;
+        byte = rlog.buf[rlog.pos++];
     }
     return byte;
 }
@@ -134,13 +467,27 @@ int64_t replay_get_qword(void)
     return qword;
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    while (size > 0) {
+        size_t n;
+
+        if (rlog.pos == rlog.len) {
+            replay_log_fill();
+        }
+        n = MIN(size, rlog.len - rlog.pos);
+        memcpy(buf, rlog.buf + rlog.pos, n);
+        rlog.pos += n;
+        buf += n;
+        size -= n;
+    }
+}
+
 void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -149,20 +496,26 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        bool eof, error;
+
+        qemu_mutex_lock(&rlog.lock);
+        /* the read ahead hit the end, and everything before it was used */
+        eof = !rlog.io_busy && rlog.io_eof && rlog.pos == rlog.len;
+        error = rlog.io_error;
+        qemu_mutex_unlock(&rlog.lock);
+
+        if (eof) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
-        } else if (ferror(replay_file)) {
+        } else if (error) {
             error_report("replay file is over or something goes wrong");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_INTERNAL_ERROR);
@@ -94,6 +94,20 @@ extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/* Size of replay log header: the version and the flags */
+#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+/* The log is a sequence of zstd frames */
+#define REPLAY_LOG_ZSTD             (1ULL << 0)
+
+/*! Starts the log thread, and checks the header in play mode. */
+void replay_log_init(uint32_t version, bool compress);
+/*! Flushes the log, and writes the header in record mode. */
+void replay_log_finish(uint32_t version);
+/*! Returns the offset of the next byte in the log. */
+uint64_t replay_log_tell(void);
+/*! Moves the play position to an offset returned by replay_log_tell. */
+void replay_log_seek(uint64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
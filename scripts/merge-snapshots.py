@@ -0,0 +1,288 @@
+#!/usr/bin/env python3
+#
+#  Merge a chain of incremental migration snapshots
+#
+#  A migration with the incremental-snapshot capability only carries the
+#  RAM pages dirtied since the previous migration.  This tool takes the
+#  full snapshot a chain starts with and the deltas taken after it, in
+#  order, and writes a single snapshot that QEMU can load: the device
+#  state of the last delta, and for every RAM page its latest contents.
+#
+#  This work is licensed under the terms of the GNU GPL, version 2 or
+#  later.  See the COPYING file in the top-level directory.
+
+import argparse
+import json
+import os
+import struct
+import sys
+
+
+QEMU_VM_FILE_MAGIC    = 0x5145564d
+QEMU_VM_FILE_VERSION  = 0x00000003
+QEMU_VM_EOF           = 0x00
+QEMU_VM_SECTION_START = 0x01
+QEMU_VM_SECTION_PART  = 0x02
+QEMU_VM_SECTION_END   = 0x03
+QEMU_VM_SECTION_FULL  = 0x04
+QEMU_VM_VMDESCRIPTION = 0x06
+QEMU_VM_SECTION_FOOTER= 0x7e
+
+RAM_SAVE_FLAG_ZERO     = 0x02
+RAM_SAVE_FLAG_MEM_SIZE = 0x04
+RAM_SAVE_FLAG_PAGE     = 0x08
+RAM_SAVE_FLAG_EOS      = 0x10
+RAM_SAVE_FLAG_CONTINUE = 0x20
+RAM_SAVE_FLAG_MULTIFD_FLUSH = 0x200
+
+INCREMENTAL_MARKER = b'(incremental delta)'
+
+
+class SnapshotError(Exception):
+    pass
+
+
+class Snapshot(object):
+    """Locates the RAM records of one migration stream
+
+    Only the parts of the stream that RAM lives in are parsed: the
+    "ram" section is found by its header, and parsing stops at the
+    first section that is not about RAM, which is where the device
+    state starts.
+    """
+
+    def __init__(self, filename):
+        self.filename = filename
+        self.file = open(filename, 'rb')
+        self.page_size = self.read_page_size()
+        self.footers = False
+        self.section_id = None
+        # Byte range of the "ram" setup section, without any footer
+        self.start_begin = None
+        self.start_end = None
+        # Byte range of the incremental delta marker in the setup section
+        self.marker = None
+        # (block name, page address) -> (offset of the data, or None if zero)
+        self.pages = {}
+        self.block = None
+        self.parse()
+
+    def read(self, size):
+        data = self.file.read(size)
+        if len(data) != size:
+            raise SnapshotError('%s: unexpected end of file at 0x%x' %
+                                (self.filename, self.file.tell()))
+        return data
+
+    def read8(self):
+        return self.read(1)[0]
+
+    def read32(self):
+        return struct.unpack('>I', self.read(4))[0]
+
+    def read64(self):
+        return struct.unpack('>Q', self.read(8))[0]
+
+    def read_page_size(self):
+        # The VM description at the end of the stream has the page size
+        size = os.fstat(self.file.fileno()).st_size
+        tail = min(size, 10 * 1024 * 1024)
+        self.file.seek(size - tail)
+        data = self.file.read(tail)
+        jsonpos = data.find(b'{', data.rfind(b'\0'))
+        if jsonpos < 5 or data[jsonpos - 5] != QEMU_VM_VMDESCRIPTION:
+            return 4096
+        jsonlen = struct.unpack('>I', data[jsonpos - 4:jsonpos])[0]
+        desc = json.loads(data[jsonpos:jsonpos + jsonlen].decode('utf-8'))
+        return desc.get('page_size', 4096)
+
+    def find_ram_section(self):
+        # QEMU_VM_SECTION_START, section id, "ram", instance 0, version 4
+        self.file.seek(0)
+        data = self.file.read(1024 * 1024)
+        pos = data.find(b'\x03ram' + struct.pack('>II', 0, 4))
+        if pos < 5 or data[pos - 5] != QEMU_VM_SECTION_START:
+            raise SnapshotError('%s: no RAM section found' % self.filename)
+        self.file.seek(pos - 5)
+
+    def parse(self):
+        self.file.seek(0)
+        if self.read32() != QEMU_VM_FILE_MAGIC:
+            raise SnapshotError('%s: not a migration stream' % self.filename)
+        if self.read32() != QEMU_VM_FILE_VERSION:
+            raise SnapshotError('%s: unsupported stream version' %
+                                self.filename)
+
+        self.find_ram_section()
+        self.start_begin = self.file.tell()
+        self.read8()
+        self.section_id = self.read32()
+        self.read(4 + 4 + 4)
+        self.read_ram()
+        self.start_end = self.file.tell()
+        self.read_footer()
+
+        # Iterated sections all come before the device state
+        while True:
+            section_type = self.read8()
+            if section_type in (QEMU_VM_SECTION_FULL, QEMU_VM_EOF):
+                break
+            if (section_type not in (QEMU_VM_SECTION_PART,
+                                     QEMU_VM_SECTION_END) or
+                    self.read32() != self.section_id):
+                raise SnapshotError('%s: sections other than RAM are '
+                                    'iterated, which is not supported' %
+                                    self.filename)
+            self.read_ram()
+            self.read_footer()
+
+    def read_footer(self):
+        pos = self.file.tell()
+        if self.read8() == QEMU_VM_SECTION_FOOTER:
+            self.footers = True
+            self.read32()
+        else:
+            self.file.seek(pos)
+
+    def read_ram(self):
+        mask = self.page_size - 1
+        while True:
+            addr = self.read64()
+            flags = addr & mask
+            addr &= ~mask
+
+            if flags & RAM_SAVE_FLAG_MEM_SIZE:
+                total = addr
+                while total:
+                    pos = self.file.tell()
+                    name = self.read(self.read8())
+                    length = self.read64()
+                    if name == INCREMENTAL_MARKER:
+                        self.marker = (pos, self.file.tell())
+                    total -= length
+                flags &= ~RAM_SAVE_FLAG_MEM_SIZE
+
+            if flags & (RAM_SAVE_FLAG_ZERO | RAM_SAVE_FLAG_PAGE):
+                if flags & RAM_SAVE_FLAG_CONTINUE:
+                    flags &= ~RAM_SAVE_FLAG_CONTINUE
+                else:
+                    self.block = self.read(self.read8())
+                if flags & RAM_SAVE_FLAG_ZERO:
+                    if self.read8() != 0:
+                        raise SnapshotError('%s: invalid zero page' %
+                                            self.filename)
+                    self.pages[(self.block, addr)] = None
+                    flags &= ~RAM_SAVE_FLAG_ZERO
+                else:
+                    self.pages[(self.block, addr)] = self.file.tell()
+                    self.file.seek(self.page_size, os.SEEK_CUR)
+                    flags &= ~RAM_SAVE_FLAG_PAGE
+
+            flags &= ~RAM_SAVE_FLAG_MULTIFD_FLUSH
+            if flags & RAM_SAVE_FLAG_EOS:
+                break
+            if flags:
+                raise SnapshotError('%s: unsupported RAM flags 0x%x '
+                                    '(compression, xbzrle or dedup-pages?)'
+                                    % (self.filename, flags))
+
+    def page(self, offset):
+        self.file.seek(offset)
+        return self.read(self.page_size)
+
+
+def copy_range(src, dst, begin, end):
+    src.seek(begin)
+    while begin < end:
+        data = src.read(min(end - begin, 1024 * 1024))
+        if not data:
+            raise SnapshotError('unexpected end of file')
+        dst.write(data)
+        begin += len(data)
+
+
+def merge(filenames, output):
+    snapshots = [Snapshot(f) for f in filenames]
+    base, last = snapshots[0], snapshots[-1]
+
+    if base.marker:
+        raise SnapshotError('%s is a delta, the chain must start with a '
+                            'full snapshot' % base.filename)
+    for s in snapshots[1:]:
+        if not s.marker:
+            raise SnapshotError('%s is not an incremental delta' % s.filename)
+        if s.page_size != base.page_size:
+            raise SnapshotError('%s has a different page size' % s.filename)
+
+    # The latest copy of each page that the last delta does not carry
+    pages = {}
+    for s in snapshots[:-1]:
+        for key, offset in s.pages.items():
+            pages[key] = (s, offset)
+    for key in last.pages:
+        pages.pop(key, None)
+
+    with open(output, 'wb') as out:
+        # The last delta up to its RAM setup section, without the marker
+        copy_range(last.file, out, 0, last.marker[0])
+        copy_range(last.file, out, last.marker[1], last.start_end)
+        if last.footers:
+            out.write(struct.pack('>BI', QEMU_VM_SECTION_FOOTER,
+                                  last.section_id))
+
+        # The pages that come from the earlier snapshots
+        out.write(struct.pack('>BI', QEMU_VM_SECTION_PART, last.section_id))
+        block = None
+        for (name, addr), (s, offset) in sorted(pages.items()):
+            flags = RAM_SAVE_FLAG_ZERO if offset is None else RAM_SAVE_FLAG_PAGE
+            if name == block:
+                flags |= RAM_SAVE_FLAG_CONTINUE
+            out.write(struct.pack('>Q', addr | flags))
+            if name != block:
+                out.write(struct.pack('>B', len(name)) + name)
+                block = name
+            if offset is None:
+                out.write(b'\0')
+            else:
+                out.write(s.page(offset))
+        out.write(struct.pack('>Q', RAM_SAVE_FLAG_EOS))
+        if last.footers:
+            out.write(struct.pack('>BI', QEMU_VM_SECTION_FOOTER,
+                                  last.section_id))
+
+        # The rest of the last delta: its own pages and the device state
+        end = os.fstat(last.file.fileno()).st_size
+        begin = last.start_end
+        if last.footers:
+            begin += 5
+        copy_range(last.file, out, begin, end)
+
+    return len(pages), len(last.pages)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Merge a full migration snapshot and the incremental '
+                    'deltas taken after it into one snapshot.')
+    parser.add_argument('-o', '--output', required=True,
+                        help='merged snapshot to write')
+    parser.add_argument('snapshots', nargs='+',
+                        help='full snapshot, then the deltas, oldest first')
+    args = parser.parse_args()
+
+    if len(args.snapshots) < 2:
+        parser.error('need a full snapshot and at least one delta')
+    if args.output in args.snapshots:
+        parser.error('the output must not be one of the inputs')
+
+    try:
+        old, new = merge(args.snapshots, args.output)
+    except SnapshotError as e:
+        sys.stderr.write('merge-snapshots: %s\n' % e)
+        sys.exit(1)
+    print('%d pages from earlier snapshots, %d from %s' %
+          (old, new, args.snapshots[-1]))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,114 @@
+# -*- coding: utf-8 -*-
+
+"""
+Binary records in a shared memory ring, read from outside of QEMU.
+"""
+
+__license__    = "GPL version 2 or (at your option) any later version"
+
+
+from tracetool import out
+from tracetool.backend.simple import is_string
+
+
+PUBLIC = True
+
+
+def generate_h_begin(events, group):
+    for event in events:
+        out('void _ring_%(api)s(%(args)s);',
+            api=event.api(),
+            args=event.args)
+    out('')
+
+
+def generate_h(event, group):
+    out('    _ring_%(api)s(%(args)s);',
+        api=event.api(),
+        args=", ".join(event.args.names()))
+
+
+def generate_h_backend_dstate(event, group):
+    out('    trace_event_get_state_dynamic_by_id(%(event_id)s) || \\',
+        event_id="TRACE_" + event.name.upper())
+
+
+def generate_c_begin(events, group):
+    out('#include "qemu/osdep.h"',
+        '#include "trace/control.h"',
+        '#include "trace/ring.h"',
+        '')
+
+
+def generate_c(event, group):
+    out('void _ring_%(api)s(%(args)s)',
+        '{',
+        '    TraceRingWriter w;',
+        api=event.api(),
+        args=event.args)
+    sizes = []
+    for type_, name in event.args:
+        if is_string(type_):
+            out('    size_t arg%(name)s_len = %(name)s ? MIN(strlen(%(name)s), MAX_TRACE_STRLEN) : 0;',
+                name=name)
+            sizes.append("4 + arg%s_len" % name)
+        else:
+            sizes.append("8")
+    sizestr = " + ".join(sizes)
+    if len(event.args) == 0:
+        sizestr = '0'
+
+    event_id = 'TRACE_' + event.name.upper()
+    if "vcpu" in event.properties:
+        # already checked on the generic format code
+        cond = "true"
+    else:
+        cond = "trace_event_get_state(%s)" % event_id
+
+    out('',
+        '    if (!%(cond)s) {',
+        '        return;',
+        '    }',
+        '',
+        '    if (trace_ring_record_start(&w, %(event_obj)s.id, %(size_str)s)) {',
+        '        return; /* Ring full, event dropped */',
+        '    }',
+        cond=cond,
+        event_obj=event.api(event.QEMU_EVENT),
+        size_str=sizestr)
+
+    for type_, name in event.args:
+        if is_string(type_):
+            out('    trace_ring_write_str(&w, %(name)s, arg%(name)s_len);',
+                name=name)
+        elif type_.endswith('*'):
+            out('    trace_ring_write_u64(&w, (uintptr_t)%(name)s);',
+                name=name)
+        else:
+            out('    trace_ring_write_u64(&w, (uint64_t)%(name)s);',
+                name=name)
+
+    out('    trace_ring_record_finish(&w);',
+        '}',
+        '')
+
+
+def generate_c_end(events, group):
+    out('static const TraceRingDesc trace_ring_%(group)s_descs[] = {',
+        group=group.lower())
+    for event in events:
+        args = "".join("s" if is_string(type_) else "u"
+                       for type_, name in event.args)
+        out('    { &%(event_obj)s, "%(args)s", %(fmt)s },',
+            event_obj=event.api(event.QEMU_EVENT),
+            args=args,
+            fmt=event.fmt.rstrip("\n"))
+    out('    { NULL }',
+        '};',
+        '',
+        'static void trace_ring_%(group)s_register_descs(void)',
+        '{',
+        '    trace_ring_register_descs(trace_ring_%(group)s_descs);',
+        '}',
+        'trace_init(trace_ring_%(group)s_register_descs)',
+        group=group.lower())
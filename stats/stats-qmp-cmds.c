@@ -8,7 +8,12 @@
 #include "qemu/osdep.h"
 #include "sysemu/stats.h"
 #include "qapi/qapi-commands-stats.h"
+#include "qapi/qapi-events-stats.h"
+#include "qapi/qapi-visit-stats.h"
+#include "qapi/clone-visitor.h"
+#include "qemu/error-report.h"
 #include "qemu/queue.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 
 typedef struct StatsCallbacks {
@@ -65,6 +70,8 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         }
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK:
+    case STATS_TARGET_NETDEV:
         break;
     default:
         abort();
@@ -124,6 +131,176 @@ StatsSchemaList *qmp_query_stats_schemas(bool has_provider,
     return stats_results;
 }
 
+/*
+ * A subscription samples query-stats on a timer and keeps the results of
+ * the previous sample, so that the STATS event only carries the values
+ * that changed: unchanged providers are never serialized.
+ */
+#define STATS_SUBSCRIPTION_MIN_INTERVAL_MS 10
+
+typedef struct StatsSubscription {
+    char *id;
+    StatsFilter *filter;
+    uint32_t interval_ms;
+    QEMUTimer *timer;
+    /* StatsResult of the previous sample, by provider and QOM path */
+    GHashTable *last;
+    QTAILQ_ENTRY(StatsSubscription) next;
+} StatsSubscription;
+
+static QTAILQ_HEAD(, StatsSubscription) stats_subscriptions =
+    QTAILQ_HEAD_INITIALIZER(stats_subscriptions);
+
+static bool stats_value_equal(StatsValue *a, StatsValue *b)
+{
+    uint64List *la, *lb;
+
+    if (a->type != b->type) {
+        return false;
+    }
+    switch (a->type) {
+    case QTYPE_QNUM:
+        return a->u.scalar == b->u.scalar;
+    case QTYPE_QBOOL:
+        return a->u.boolean == b->u.boolean;
+    case QTYPE_QLIST:
+        for (la = a->u.list, lb = b->u.list; la && lb;
+             la = la->next, lb = lb->next) {
+            if (la->value != lb->value) {
+                return false;
+            }
+        }
+        return !la && !lb;
+    default:
+        abort();
+    }
+}
+
+static bool stats_unchanged(StatsList *prev, Stats *stats)
+{
+    for (; prev; prev = prev->next) {
+        if (g_str_equal(prev->value->name, stats->name)) {
+            return stats_value_equal(prev->value->value, stats->value);
+        }
+    }
+    return false;
+}
+
+static GHashTable *stats_subscription_new_table(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                 (GDestroyNotify)qapi_free_StatsResult);
+}
+
+static void stats_subscription_sample(void *opaque)
+{
+    StatsSubscription *sub = opaque;
+    GHashTable *last = stats_subscription_new_table();
+    StatsResultList *results, *delta = NULL, **tail = &delta;
+    Error *err = NULL;
+
+    results = qmp_query_stats(sub->filter, &err);
+    if (err) {
+        error_report_err(err);
+    }
+
+    while (results) {
+        StatsResultList *elem = results;
+        StatsResult *result = elem->value;
+        StatsResult *prev;
+        StatsList *stats, *changed = NULL, **stats_tail = &changed;
+        char *key;
+
+        key = g_strdup_printf("%s:%s", StatsProvider_str(result->provider),
+                              result->qom_path ?: "");
+        prev = g_hash_table_lookup(sub->last, key);
+        for (stats = result->stats; stats; stats = stats->next) {
+            if (!prev || !stats_unchanged(prev->stats, stats->value)) {
+                QAPI_LIST_APPEND(stats_tail, QAPI_CLONE(Stats, stats->value));
+            }
+        }
+        if (changed) {
+            StatsResult *entry = g_new0(StatsResult, 1);
+
+            entry->provider = result->provider;
+            entry->qom_path = g_strdup(result->qom_path);
+            entry->stats = changed;
+            QAPI_LIST_APPEND(tail, entry);
+        }
+
+        /* Objects that went away are dropped with the old table */
+        g_hash_table_replace(last, key, result);
+        results = elem->next;
+        g_free(elem);
+    }
+    g_hash_table_unref(sub->last);
+    sub->last = last;
+
+    if (delta) {
+        qapi_event_send_stats(sub->id, delta);
+        qapi_free_StatsResultList(delta);
+    }
+    timer_mod(sub->timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + sub->interval_ms);
+}
+
+static StatsSubscription *stats_subscription_find(const char *id)
+{
+    StatsSubscription *sub;
+
+    QTAILQ_FOREACH(sub, &stats_subscriptions, next) {
+        if (g_str_equal(sub->id, id)) {
+            return sub;
+        }
+    }
+    return NULL;
+}
+
+void qmp_stats_subscribe(const char *id, uint32_t interval,
+                         StatsFilter *filter, Error **errp)
+{
+    StatsSubscription *sub;
+
+    if (stats_subscription_find(id)) {
+        error_setg(errp, "stats subscription '%s' already exists", id);
+        return;
+    }
+    if (interval < STATS_SUBSCRIPTION_MIN_INTERVAL_MS) {
+        error_setg(errp, "interval must be at least %d ms",
+                   STATS_SUBSCRIPTION_MIN_INTERVAL_MS);
+        return;
+    }
+
+    sub = g_new0(StatsSubscription, 1);
+    sub->id = g_strdup(id);
+    sub->filter = QAPI_CLONE(StatsFilter, filter);
+    sub->interval_ms = interval;
+    sub->last = stats_subscription_new_table();
+    sub->timer = timer_new_ms(QEMU_CLOCK_REALTIME, stats_subscription_sample,
+                              sub);
+    QTAILQ_INSERT_TAIL(&stats_subscriptions, sub, next);
+
+    /* The first sample carries everything, take it right away */
+    timer_mod(sub->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
+void qmp_stats_unsubscribe(const char *id, Error **errp)
+{
+    StatsSubscription *sub = stats_subscription_find(id);
+
+    if (!sub) {
+        error_setg(errp, "stats subscription '%s' not found", id);
+        return;
+    }
+
+    QTAILQ_REMOVE(&stats_subscriptions, sub, next);
+    timer_free(sub->timer);
+    g_hash_table_unref(sub->last);
+    qapi_free_StatsFilter(sub->filter);
+    g_free(sub->id);
+    g_free(sub);
+}
+
 void add_stats_entry(StatsResultList **stats_results, StatsProvider provider,
                      const char *qom_path, StatsList *stats_list)
 {
@@ -138,8 +138,10 @@ static void help(void)
 "\n"
 "  --nbd-server addr.type=inet,addr.host=<host>,addr.port=<port>\n"
 "               [,tls-creds=<id>][,tls-authz=<id>][,max-connections=<n>]\n"
+"               [,websocket=on|off]\n"
 "  --nbd-server addr.type=unix,addr.path=<path>\n"
 "               [,tls-creds=<id>][,tls-authz=<id>][,max-connections=<n>]\n"
+"               [,websocket=on|off]\n"
 "                         start an NBD server for exporting block nodes\n"
 "\n"
 "  --object help          list object types that can be added\n"
@@ -77,7 +77,8 @@ int64_t cpu_get_clock_locked(void)
 
     time = timers_state.cpu_clock_offset;
     if (timers_state.cpu_ticks_enabled) {
-        time += get_clock();
+        /* Read by timer devices on every access to their counter */
+        time += get_clock_coarse();
     }
 
     return time;
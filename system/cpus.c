@@ -423,12 +423,23 @@ void qemu_wait_io_event(CPUState *cpu)
 {
     bool slept = false;
 
-    while (cpu_thread_is_idle(cpu)) {
+    /*
+     * Park instead of waiting on halt_cond: qemu_cpu_kick() then wakes this
+     * very thread through a futex, without the condition variable and the
+     * BQL handover of pthread_cond_wait().
+     */
+    for (;;) {
+        qemu_parker_prepare(&cpu->halt_parker);
+        if (!cpu_thread_is_idle(cpu)) {
+            break;
+        }
         if (!slept) {
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
         }
-        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+        qemu_mutex_unlock_iothread();
+        qemu_parker_park(&cpu->halt_parker);
+        qemu_mutex_lock_iothread();
     }
     if (slept) {
         qemu_plugin_vcpu_resume_cb(cpu);
@@ -457,6 +468,7 @@ void cpus_kick_thread(CPUState *cpu)
 
 void qemu_cpu_kick(CPUState *cpu)
 {
+    qemu_parker_unpark(&cpu->halt_parker);
     qemu_cond_broadcast(cpu->halt_cond);
     if (cpus_accel->kick_vcpu_thread) {
         cpus_accel->kick_vcpu_thread(cpu);
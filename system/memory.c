@@ -34,6 +34,8 @@
 #include "hw/boards.h"
 #include "migration/vmstate.h"
 #include "exec/address-spaces.h"
+#include "qemu/timer.h"
+#include "sysemu/stats.h"
 
 //#define DEBUG_UNASSIGNED
 
@@ -41,6 +43,7 @@ static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
 unsigned int global_dirty_tracking;
+bool global_write_tracking;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
     = QTAILQ_HEAD_INITIALIZER(memory_listeners);
@@ -50,6 +53,19 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/*
+ * Cost of the topology updates, for "info mtree -f" and query-stats.
+ * Protected by the BQL.
+ */
+typedef struct MemoryTopologyStats {
+    uint64_t commits;
+    uint64_t flatviews_rendered;
+    uint64_t flatviews_reused;
+    uint64_t commit_ns;
+} MemoryTopologyStats;
+
+static MemoryTopologyStats mtree_stats;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -749,8 +765,30 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+/* True if the dispatch and the listeners would see no difference. */
+static bool flatview_ranges_equal(FlatView *a, FlatView *b)
+{
+    unsigned i;
+
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ * If that gives the ranges of @old, the FlatView of @mr before the
+ * transaction, keep @old: the address spaces that use it then skip the
+ * dispatch rebuild and the listeners.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr, FlatView *old)
 {
     int i;
     FlatView *view;
@@ -764,6 +802,15 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old && flatview_ranges_equal(view, old)) {
+        flatview_unref(view);
+        flatview_ref(old);
+        g_hash_table_replace(flat_views, mr, old);
+        mtree_stats.flatviews_reused++;
+        return old;
+    }
+    mtree_stats.flatviews_rendered++;
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -1021,7 +1068,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -1032,12 +1079,10 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
@@ -1048,7 +1093,13 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1103,7 +1154,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1124,6 +1175,8 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            int64_t start = get_clock();
+
             flatviews_reset();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
@@ -1135,6 +1188,9 @@ void memory_region_transaction_commit(void)
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+
+            mtree_stats.commits++;
+            mtree_stats.commit_ns += get_clock() - start;
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -2540,6 +2596,13 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_enable_lockless_io(MemoryRegion *mr)
+{
+    assert(!mr->ioeventfd_nb);
+    mr->lockless_io = true;
+    mr->disable_reentrancy_guard = true;
+}
+
 void memory_region_add_eventfd(MemoryRegion *mr,
                                hwaddr addr,
                                unsigned size,
@@ -2556,6 +2619,7 @@ void memory_region_add_eventfd(MemoryRegion *mr,
     };
     unsigned i;
 
+    assert(!mr->lockless_io);
     if (size) {
         adjust_endianness(mr, &mrfd.data, size_memop(size) | MO_TE);
     }
@@ -3465,11 +3529,81 @@ static void mtree_info_flatview(bool dispatch_tree, bool owner)
     /* Print */
     g_hash_table_foreach(views, mtree_print_flatview, &fvi);
 
+    qemu_printf("Topology updates: %" PRIu64 " commits, %" PRIu64
+                " FlatViews rendered, %" PRIu64 " reused, %" PRIu64
+                " us\n\n", mtree_stats.commits,
+                mtree_stats.flatviews_rendered,
+                mtree_stats.flatviews_reused, mtree_stats.commit_ns / 1000);
+
     /* Free */
     g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
     g_hash_table_unref(views);
 }
 
+static const struct {
+    const char *name;
+    size_t offset;
+    bool ns;
+} mtree_stats_desc[] = {
+    { "commits", offsetof(MemoryTopologyStats, commits) },
+    { "flatviews-rendered",
+      offsetof(MemoryTopologyStats, flatviews_rendered) },
+    { "flatviews-reused", offsetof(MemoryTopologyStats, flatviews_reused) },
+    { "commit-time", offsetof(MemoryTopologyStats, commit_ns), true },
+};
+
+static void mtree_query_stats_cb(StatsResultList **result, StatsTarget target,
+                                 strList *names, strList *targets,
+                                 Error **errp)
+{
+    StatsList *list = NULL;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+
+    /* Prepended, so in the reverse order of the schema */
+    for (int i = ARRAY_SIZE(mtree_stats_desc) - 1; i >= 0; i--) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(mtree_stats_desc[i].name, names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(mtree_stats_desc[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QNUM;
+        stats->value->u.scalar =
+            *(uint64_t *)((uint8_t *)&mtree_stats + mtree_stats_desc[i].offset);
+        QAPI_LIST_PREPEND(list, stats);
+    }
+    if (list) {
+        add_stats_entry(result, STATS_PROVIDER_MEMORY, NULL, list);
+    }
+}
+
+static void mtree_query_stats_schemas_cb(StatsSchemaList **result,
+                                         Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    for (int i = ARRAY_SIZE(mtree_stats_desc) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(mtree_stats_desc[i].name);
+        value->type = STATS_TYPE_CUMULATIVE;
+        if (mtree_stats_desc[i].ns) {
+            value->has_unit = true;
+            value->unit = STATS_UNIT_SECONDS;
+            value->has_base = true;
+            value->base = 10;
+            value->exponent = -9;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_MEMORY, STATS_TARGET_VM, list);
+}
+
 struct AddressSpaceInfo {
     MemoryRegionListHead *ml_head;
     bool owner;
@@ -3678,6 +3812,8 @@ static void memory_register_types(void)
     type_register_static(&memory_region_info);
     type_register_static(&iommu_memory_region_info);
     type_register_static(&ram_discard_manager_info);
+    add_stats_callbacks(STATS_PROVIDER_MEMORY, mtree_query_stats_cb,
+                        mtree_query_stats_schemas_cb);
 }
 
 type_init(memory_register_types)
@@ -24,7 +24,9 @@
 #include "qemu/cutils.h"
 #include "qemu/cacheflush.h"
 #include "qemu/hbitmap.h"
+#include "qemu/heap-account.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 
 #ifdef CONFIG_TCG
 #include "hw/core/tcg-cpu-ops.h"
@@ -917,15 +919,26 @@ DirtyBitmapSnapshot *cpu_physical_memory_snapshot_and_clear_dirty
             unsigned long num = MIN(end - page,
                                     DIRTY_MEMORY_BLOCK_SIZE - ofs);
 
+            unsigned long *block = blocks->blocks[idx];
+            unsigned long nr;
+
             assert(QEMU_IS_ALIGNED(ofs, (1 << BITS_PER_LEVEL)));
             assert(QEMU_IS_ALIGNED(num,    (1 << BITS_PER_LEVEL)));
             ofs >>= BITS_PER_LEVEL;
-
-            bitmap_copy_and_clear_atomic(snap->dirty + dest,
-                                         blocks->blocks[idx] + ofs,
-                                         num);
             page += num;
-            dest += num >> BITS_PER_LEVEL;
+            num >>= BITS_PER_LEVEL;
+
+            /* snap->dirty is zeroed, the words of clean summary bits stay */
+            for (; num; ofs += nr, dest += nr, num -= nr) {
+                bool dirty;
+
+                nr = dirty_memory_summary_take(block, ofs, num, &dirty);
+                if (dirty) {
+                    bitmap_copy_and_clear_atomic(snap->dirty + dest,
+                                                 block + ofs,
+                                                 nr << BITS_PER_LEVEL);
+                }
+            }
         }
     }
 
@@ -1792,7 +1805,8 @@ static void dirty_memory_extend(ram_addr_t old_ram_size,
         }
 
         for (j = old_num_blocks; j < new_num_blocks; j++) {
-            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE);
+            new_blocks->blocks[j] = bitmap_new(DIRTY_MEMORY_BLOCK_SIZE +
+                                               DIRTY_MEMORY_SUMMARY_BITS);
         }
 
         qatomic_rcu_set(&ram_list.dirty_memory[i], new_blocks);
@@ -1838,6 +1852,7 @@ static void ram_block_add(RAMBlock *new_block, Error **errp)
                 return;
             }
             memory_try_enable_merging(new_block->host, new_block->max_length);
+            heap_account_add(HEAP_SUBSYSTEM_GUEST_RAM, new_block->max_length);
         }
     }
 
@@ -2077,6 +2092,7 @@ static void reclaim_ramblock(RAMBlock *block)
 #endif
     } else {
         qemu_anon_ram_free(block->host, block->max_length);
+        heap_account_sub(HEAP_SUBSYSTEM_GUEST_RAM, block->max_length);
     }
     g_free(block);
 }
@@ -2174,6 +2190,12 @@ void *qemu_map_ram_ptr(RAMBlock *ram_block, ram_addr_t addr)
 
         block->host = xen_map_cache(block->offset, block->max_length, 1, false);
     }
+    /*
+     * The length of the access is not known here; callers only touch
+     * a few bytes past @addr, and those that need more use
+     * qemu_ram_ptr_length() or populate the range themselves.
+     */
+    ramblock_lazy_populate(block, addr, TARGET_PAGE_SIZE);
     return ramblock_ptr(block, addr);
 }
 
@@ -2208,6 +2230,7 @@ static void *qemu_ram_ptr_length(RAMBlock *ram_block, ram_addr_t addr,
         block->host = xen_map_cache(block->offset, block->max_length, 1, lock);
     }
 
+    ramblock_lazy_populate(block, addr, *size);
     return ramblock_ptr(block, addr);
 }
 
@@ -2531,6 +2554,15 @@ static void tcg_commit(MemoryListener *listener)
     cpuas = container_of(listener, CPUAddressSpace, tcg_as_listener);
     cpu = cpuas->cpu;
 
+    /*
+     * The commit callback runs for every topology update; when the
+     * FlatView of this address space was kept, nothing in the TLB went
+     * stale.  A flush still pending updates memory_dispatch when it runs.
+     */
+    if (cpuas->memory_dispatch == address_space_to_dispatch(cpuas->as)) {
+        return;
+    }
+
     /*
      * Defer changes to as->memory_dispatch until the cpu is quiescent.
      * Otherwise we race between (1) other cpu threads and (2) ongoing
@@ -2639,7 +2671,7 @@ bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
@@ -2716,6 +2748,7 @@ static MemTxResult flatview_write_continue(FlatView *fv, hwaddr addr,
         } else {
             /* RAM case */
             ram_ptr = qemu_ram_ptr_length(mr->ram_block, addr1, &l, false);
+            ram_write_track(memory_region_get_ram_addr(mr) + addr1, l);
             memmove(ram_ptr, buf, l);
             invalidate_and_set_dirty(mr, addr1, l);
         }
@@ -2930,9 +2963,11 @@ static inline MemTxResult address_space_write_rom_internal(AddressSpace *as,
             l = memory_access_size(mr, l, addr1);
         } else {
             /* ROM/RAM case */
+            ramblock_lazy_populate(mr->ram_block, addr1, l);
             ram_ptr = qemu_map_ram_ptr(mr->ram_block, addr1);
             switch (type) {
             case WRITE_DATA:
+                ram_write_track(memory_region_get_ram_addr(mr) + addr1, l);
                 memcpy(ram_ptr, buf, l);
                 invalidate_and_set_dirty(mr, addr1, l);
                 break;
@@ -3139,6 +3174,7 @@ void *address_space_map(AddressSpace *as,
     hwaddr l, xlat;
     MemoryRegion *mr;
     FlatView *fv;
+    void *ptr;
 
     if (len == 0) {
         return NULL;
@@ -3176,7 +3212,11 @@ void *address_space_map(AddressSpace *as,
     *plen = flatview_extend_translation(fv, addr, len, mr, xlat,
                                         l, is_write, attrs);
     fuzz_dma_read_cb(addr, *plen, mr);
-    return qemu_ram_ptr_length(mr->ram_block, xlat, plen, true);
+    ptr = qemu_ram_ptr_length(mr->ram_block, xlat, plen, true);
+    if (is_write) {
+        ram_write_track(memory_region_get_ram_addr(mr) + xlat, *plen);
+    }
+    return ptr;
 }
 
 /* Unmaps a memory region previously mapped by address_space_map().
@@ -3321,7 +3361,8 @@ static inline MemoryRegion *address_space_translate_cached(
     IOMMUMemoryRegion *iommu_mr;
     AddressSpace *target_as;
 
-    assert(!cache->ptr);
+    /* Stores to RAM come here too while background-snapshot tracks them */
+    assert(!cache->ptr || is_write);
     *xlat = addr + cache->xlat;
 
     mr = cache->mrs.mr;
@@ -3579,7 +3620,26 @@ int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length)
              * and to fall back on the file contents (which we just
              * fallocate'd away).
              */
-#if defined(CONFIG_MADVISE)
+#if defined(EMSCRIPTEN)
+            /*
+             * The WebAssembly.Memory can't shrink, so the pages stay.
+             * Zero them, which is what a discarded range reads as, and
+             * lets migration and snapshots skip them as zero pages.
+             *
+             * Reading a page the guest never wrote does not make the host
+             * allocate it, but writing does; skip the pages that are zero
+             * already, such as all of a virtio-mem device that the guest
+             * never plugged.
+             */
+            for (size_t off = 0; off < length; off += 4 * KiB) {
+                size_t len = MIN(4 * KiB, length - off);
+
+                if (!buffer_is_zero(host_startaddr + off, len)) {
+                    memset(host_startaddr + off, 0, len);
+                }
+            }
+            ret = 0;
+#elif defined(CONFIG_MADVISE)
             if (qemu_ram_is_shared(rb) && rb->fd < 0) {
                 ret = madvise(host_startaddr, length, QEMU_MADV_REMOVE);
             } else {
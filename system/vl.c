@@ -448,6 +448,9 @@ static QemuOptsList qemu_icount_opts = {
         }, {
             .name = "rrsnapshot",
             .type = QEMU_OPT_STRING,
+        }, {
+            .name = "rrcompress",
+            .type = QEMU_OPT_BOOL,
         },
         { /* end of list */ }
     },
@@ -771,6 +774,12 @@ static QemuOptsList qemu_run_with_opts = {
             .name = "chroot",
             .type = QEMU_OPT_STRING,
         },
+#ifdef EMSCRIPTEN
+        {
+            .name = "clock-tick",
+            .type = QEMU_OPT_NUMBER,
+        },
+#endif
         { /* end of list */ }
     },
 };
@@ -2694,6 +2703,47 @@ static void qemu_machine_creation_done(void)
     }
 }
 
+/*
+ * Startup phases, timed from the start of qemu_init().  Logging and
+ * tracing are only configured once the options have been parsed, so the
+ * timestamps are kept here and reported all at once by startup_report().
+ */
+typedef struct StartupPhase {
+    const char *name;
+    int64_t end;
+} StartupPhase;
+
+static StartupPhase startup_phases[16];
+static int startup_nr_phases;
+static int64_t startup_start;
+
+static void startup_phase_done(const char *name)
+{
+    assert(startup_nr_phases < ARRAY_SIZE(startup_phases));
+    startup_phases[startup_nr_phases].name = name;
+    startup_phases[startup_nr_phases].end = g_get_monotonic_time();
+    startup_nr_phases++;
+}
+
+static void startup_report(void)
+{
+    int64_t last = startup_start;
+    int i;
+
+    for (i = 0; i < startup_nr_phases; i++) {
+        StartupPhase *p = &startup_phases[i];
+
+        trace_qemu_startup_phase(p->name, p->end - last,
+                                 p->end - startup_start);
+        qemu_log_mask(LOG_STARTUP, "startup: %-16s %10" PRId64 " us "
+                      "(%" PRId64 " us since start)\n",
+                      p->name, p->end - last, p->end - startup_start);
+        last = p->end;
+    }
+    startup_nr_phases = 0;
+    startup_start = last;
+}
+
 void qmp_x_exit_preconfig(Error **errp)
 {
     if (phase_check(PHASE_MACHINE_INITIALIZED)) {
@@ -2702,8 +2752,12 @@ void qmp_x_exit_preconfig(Error **errp)
     }
 
     qemu_init_board();
+    startup_phase_done("board");
     qemu_create_cli_devices();
+    startup_phase_done("devices");
     qemu_machine_creation_done();
+    /* registers the ROMs, including the firmware and kernel images */
+    startup_phase_done("machine-done");
 
     if (loadvm) {
         load_snapshot(loadvm, NULL, false, NULL, &error_fatal);
@@ -2724,6 +2778,10 @@ void qmp_x_exit_preconfig(Error **errp)
     } else if (autostart) {
         qmp_cont(NULL);
     }
+
+    if (preconfig_requested) {
+        startup_report();
+    }
 }
 
 void qemu_init(int argc, char **argv)
@@ -2737,6 +2795,8 @@ void qemu_init(int argc, char **argv)
     bool userconfig = true;
     FILE *vmstate_dump_file = NULL;
 
+    startup_start = g_get_monotonic_time();
+
     qemu_add_opts(&qemu_drive_opts);
     qemu_add_drive_opts(&qemu_legacy_drive_opts);
     qemu_add_drive_opts(&qemu_common_drive_opts);
@@ -2770,13 +2830,16 @@ void qemu_init(int argc, char **argv)
     qemu_add_opts(&qemu_action_opts);
     qemu_add_run_with_opts();
     module_call_init(MODULE_INIT_OPTS);
+    startup_phase_done("opts");
 
     error_init(argv[0]);
     qemu_init_exec_dir(argv[0]);
 
     qemu_init_arch_modules();
 
+    /* includes the module_call_init() of the QOM types */
     qemu_init_subsystems();
+    startup_phase_done("subsystems");
 
     /* first pass of option parsing */
     optind = 1;
@@ -3151,7 +3214,7 @@ void qemu_init(int argc, char **argv)
                 QemuOpts *fsdev;
                 QemuOpts *device;
                 const char *writeout, *sock_fd, *socket, *path, *security_model,
-                           *multidevs;
+                           *multidevs, *cache_ttl;
 
                 olist = qemu_find_opts("virtfs");
                 if (!olist) {
@@ -3215,6 +3278,10 @@ void qemu_init(int argc, char **argv)
                 if (multidevs) {
                     qemu_opt_set(fsdev, "multidevs", multidevs, &error_abort);
                 }
+                cache_ttl = qemu_opt_get(opts, "cache_ttl");
+                if (cache_ttl) {
+                    qemu_opt_set(fsdev, "cache_ttl", cache_ttl, &error_abort);
+                }
                 device = qemu_opts_create(qemu_find_opts("device"), NULL, 0,
                                           &error_abort);
                 qemu_opt_set(device, "driver", "virtio-9p-pci", &error_abort);
@@ -3624,6 +3691,18 @@ void qemu_init(int argc, char **argv)
                 if (str) {
                     os_set_chroot(str);
                 }
+#ifdef EMSCRIPTEN
+                if (qemu_opt_get(opts, "clock-tick")) {
+                    uint64_t us = qemu_opt_get_number(opts, "clock-tick", 0);
+
+                    if (us == 0 || us > 1000000) {
+                        error_report("clock-tick must be between 1 and "
+                                     "1000000 microseconds");
+                        exit(1);
+                    }
+                    qemu_clock_coarse_start(us * SCALE_US);
+                }
+#endif
                 break;
             }
 #endif /* CONFIG_POSIX */
@@ -3664,6 +3743,7 @@ void qemu_init(int argc, char **argv)
         exit(1);
     }
     trace_init_file();
+    startup_phase_done("options");
 
     qemu_init_main_loop(&error_fatal);
     cpu_timers_init();
@@ -3689,6 +3769,7 @@ void qemu_init(int argc, char **argv)
     qemu_apply_machine_options(machine_opts_dict);
     qobject_unref(machine_opts_dict);
     phase_advance(PHASE_MACHINE_CREATED);
+    startup_phase_done("machine-create");
 
     /*
      * Note: uses machine properties such as kernel-irqchip, must run
@@ -3696,6 +3777,7 @@ void qemu_init(int argc, char **argv)
      */
     configure_accelerators(argv[0]);
     phase_advance(PHASE_ACCEL_CREATED);
+    startup_phase_done("accel");
 
     /*
      * Beware, QOM objects created before this point miss global and
@@ -3749,6 +3831,8 @@ void qemu_init(int argc, char **argv)
         exit(0);
     }
 
+    startup_phase_done("backends");
+
     if (!preconfig_requested) {
         qmp_x_exit_preconfig(&error_fatal);
     }
@@ -3756,4 +3840,6 @@ void qemu_init(int argc, char **argv)
     accel_setup_post(current_machine);
     os_setup_post();
     resume_mux_open();
+    startup_phase_done("displays");
+    startup_report();
 }
@@ -4176,12 +4176,26 @@ static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
     /* If the ASID changes (with a 64-bit write), we must flush the TLB.  */
-    if (cpreg_field_is_64bit(ri) &&
-        extract64(raw_read(env, ri) ^ value, 48, 16) != 0) {
-        ARMCPU *cpu = env_archcpu(env);
-        tlb_flush(CPU(cpu));
-    }
+    bool asid_changed = cpreg_field_is_64bit(ri) &&
+                        extract64(raw_read(env, ri) ^ value, 48, 16) != 0;
+
     raw_write(env, ri, value);
+    if (!asid_changed) {
+        return;
+    }
+    if (ri->fieldoffset == offsetof(CPUARMState, cp15.ttbr0_el[1]) ||
+        ri->fieldoffset == offsetof(CPUARMState, cp15.ttbr1_el[1])) {
+        /*
+         * The EL1&0 regime: the ASIDs of both TTBRs name its address
+         * space, so the jump cache of a process switched back to can
+         * be reused.  Other regimes flush everything on an ASID change.
+         */
+        tlb_flush_asid_switch(env_cpu(env),
+                              extract64(env->cp15.ttbr0_el[1], 48, 16) |
+                              extract64(env->cp15.ttbr1_el[1], 48, 16) << 16);
+    } else {
+        tlb_flush(env_cpu(env));
+    }
 }
 
 static void vmsa_tcr_ttbr_el2_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -1072,8 +1072,6 @@ static uint64_t set_step(CPUARMState *env, uint64_t toaddr,
                          uint64_t setsize, uint32_t data, int memidx,
                          uint32_t *mtedesc, uintptr_t ra)
 {
-    void *mem;
-
     setsize = MIN(setsize, page_limit(toaddr));
     if (*mtedesc) {
         uint64_t mtesize = mte_mops_probe(env, toaddr, setsize, *mtedesc);
@@ -1089,27 +1087,7 @@ static uint64_t set_step(CPUARMState *env, uint64_t toaddr,
     }
 
     toaddr = useronly_clean_ptr(toaddr);
-    /*
-     * Trapless lookup: returns NULL for invalid page, I/O,
-     * watchpoints, clean pages, etc.
-     */
-    mem = tlb_vaddr_to_host(env, toaddr, MMU_DATA_STORE, memidx);
-
-#ifndef CONFIG_USER_ONLY
-    if (unlikely(!mem)) {
-        /*
-         * Slow-path: just do one byte write. This will handle the
-         * watchpoint, invalid page, etc handling correctly.
-         * For clean code pages, the next iteration will see
-         * the page dirty and will use the fast path.
-         */
-        cpu_stb_mmuidx_ra(env, toaddr, data, memidx, ra);
-        return 1;
-    }
-#endif
-    /* Easy case: just memset the host memory */
-    memset(mem, data, setsize);
-    return setsize;
+    return cpu_memset_page_mmuidx_ra(env, toaddr, data, setsize, memidx, ra);
 }
 
 /*
@@ -1427,9 +1405,6 @@ static uint64_t copy_step(CPUARMState *env, uint64_t toaddr, uint64_t fromaddr,
                           uint64_t copysize, int wmemidx, int rmemidx,
                           uint32_t *wdesc, uint32_t *rdesc, uintptr_t ra)
 {
-    void *rmem;
-    void *wmem;
-
     /* Don't cross a page boundary on either source or destination */
     copysize = MIN(copysize, page_limit(toaddr));
     copysize = MIN(copysize, page_limit(fromaddr));
@@ -1458,35 +1433,8 @@ static uint64_t copy_step(CPUARMState *env, uint64_t toaddr, uint64_t fromaddr,
 
     toaddr = useronly_clean_ptr(toaddr);
     fromaddr = useronly_clean_ptr(fromaddr);
-    /* Trapless lookup of whether we can get a host memory pointer */
-    wmem = tlb_vaddr_to_host(env, toaddr, MMU_DATA_STORE, wmemidx);
-    rmem = tlb_vaddr_to_host(env, fromaddr, MMU_DATA_LOAD, rmemidx);
-
-#ifndef CONFIG_USER_ONLY
-    /*
-     * If we don't have host memory for both source and dest then just
-     * do a single byte copy. This will handle watchpoints, invalid pages,
-     * etc correctly. For clean code pages, the next iteration will see
-     * the page dirty and will use the fast path.
-     */
-    if (unlikely(!rmem || !wmem)) {
-        uint8_t byte;
-        if (rmem) {
-            byte = *(uint8_t *)rmem;
-        } else {
-            byte = cpu_ldub_mmuidx_ra(env, fromaddr, rmemidx, ra);
-        }
-        if (wmem) {
-            *(uint8_t *)wmem = byte;
-        } else {
-            cpu_stb_mmuidx_ra(env, toaddr, byte, wmemidx, ra);
-        }
-        return 1;
-    }
-#endif
-    /* Easy case: just memmove the host memory */
-    memmove(wmem, rmem, copysize);
-    return copysize;
+    return cpu_memmove_page_mmuidx_ra(env, toaddr, fromaddr, copysize,
+                                      wmemidx, rmemidx, ra);
 }
 
 /*
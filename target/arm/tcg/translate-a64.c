@@ -3465,17 +3465,21 @@ static bool trans_LD_mult(DisasContext *s, arg_ldst_mult *a)
 
     /*
      * Consecutive little-endian elements from a single register
-     * can be promoted to a larger little-endian operation.
+     * can be promoted to a larger little-endian operation, which
+     * keeps the single-copy atomicity of each 64-bit half.
      */
     align = MO_ALIGN;
     if (a->selem == 1 && endian == MO_LE) {
         align = pow2_align(size);
-        size = 3;
+        size = a->q ? MO_128 : MO_64;
     }
     if (!s->align_mem) {
         align = 0;
     }
     mop = endian | size | align;
+    if (size == MO_128) {
+        mop |= MO_ATOM_IFALIGN_PAIR;
+    }
 
     elements = (a->q ? 16 : 8) >> size;
     tcg_ebytes = tcg_constant_i64(1 << size);
@@ -3485,7 +3489,11 @@ static bool trans_LD_mult(DisasContext *s, arg_ldst_mult *a)
             int xs;
             for (xs = 0; xs < a->selem; xs++) {
                 int tt = (a->rt + r + xs) % 32;
-                do_vec_ld(s, tt, e, clean_addr, mop);
+                if (size == MO_128) {
+                    do_fp_ld(s, tt, clean_addr, mop);
+                } else {
+                    do_vec_ld(s, tt, e, clean_addr, mop);
+                }
                 tcg_gen_add_i64(clean_addr, clean_addr, tcg_ebytes);
             }
         }
@@ -3556,17 +3564,21 @@ static bool trans_ST_mult(DisasContext *s, arg_ldst_mult *a)
 
     /*
      * Consecutive little-endian elements from a single register
-     * can be promoted to a larger little-endian operation.
+     * can be promoted to a larger little-endian operation, which
+     * keeps the single-copy atomicity of each 64-bit half.
      */
     align = MO_ALIGN;
     if (a->selem == 1 && endian == MO_LE) {
         align = pow2_align(size);
-        size = 3;
+        size = a->q ? MO_128 : MO_64;
     }
     if (!s->align_mem) {
         align = 0;
     }
     mop = endian | size | align;
+    if (size == MO_128) {
+        mop |= MO_ATOM_IFALIGN_PAIR;
+    }
 
     elements = (a->q ? 16 : 8) >> size;
     tcg_ebytes = tcg_constant_i64(1 << size);
@@ -3576,7 +3588,11 @@ static bool trans_ST_mult(DisasContext *s, arg_ldst_mult *a)
             int xs;
             for (xs = 0; xs < a->selem; xs++) {
                 int tt = (a->rt + r + xs) % 32;
-                do_vec_st(s, tt, e, clean_addr, mop);
+                if (size == MO_128) {
+                    do_fp_st(s, tt, clean_addr, mop);
+                } else {
+                    do_vec_st(s, tt, e, clean_addr, mop);
+                }
                 tcg_gen_add_i64(clean_addr, clean_addr, tcg_ebytes);
             }
         }
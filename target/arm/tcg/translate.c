@@ -56,6 +56,49 @@ static const char * const regnames[] =
     { "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7",
       "r8", "r9", "r10", "r11", "r12", "r13", "r14", "pc" };
 
+/* The float64 VFP helpers, which only go through softfloat */
+static const TCGFPHelper arm_fp_helpers[] = {
+    { helper_vfp_addd, TCG_FP_ADD_F64, { 0, 1 }, 2, 0 },
+    { helper_vfp_subd, TCG_FP_SUB_F64, { 0, 1 }, 2, 0 },
+    { helper_vfp_muld, TCG_FP_MUL_F64, { 0, 1 }, 2, 0 },
+    { helper_vfp_divd, TCG_FP_DIV_F64, { 0, 1 }, 2, 0 },
+    { helper_vfp_sqrtd, TCG_FP_SQRT_F64, { 0, 0 }, 1,
+      offsetof(CPUARMState, vfp.fp_status) },
+};
+
+/* Expansions of the tiny helpers, see tcg_set_helper_inline() */
+static void gen_inline_sxtb16(TCGTemp *ret, TCGTemp **args)
+{
+    TCGv_i32 res = temp_tcgv_i32(ret);
+    TCGv_i32 x = temp_tcgv_i32(args[0]);
+    TCGv_i32 hi = tcg_temp_new_i32();
+
+    tcg_gen_shli_i32(hi, x, 8);
+    tcg_gen_sari_i32(hi, hi, 24);
+    tcg_gen_ext8s_i32(res, x);
+    tcg_gen_deposit_i32(res, res, hi, 16, 16);
+}
+
+static void gen_inline_uxtb16(TCGTemp *ret, TCGTemp **args)
+{
+    tcg_gen_andi_i32(temp_tcgv_i32(ret), temp_tcgv_i32(args[0]), 0x00ff00ff);
+}
+
+static void gen_inline_sel_flags(TCGTemp *ret, TCGTemp **args)
+{
+    TCGv_i32 mask = tcg_temp_new_i32();
+    TCGv_i32 t = tcg_temp_new_i32();
+
+    /* Spread GE bit i to bit 8 * i, then to all of byte i */
+    tcg_gen_andi_i32(mask, temp_tcgv_i32(args[0]), 0xf);
+    tcg_gen_muli_i32(mask, mask, 0x00204081);
+    tcg_gen_andi_i32(mask, mask, 0x01010101);
+    tcg_gen_muli_i32(mask, mask, 0xff);
+
+    tcg_gen_and_i32(t, temp_tcgv_i32(args[1]), mask);
+    tcg_gen_andc_i32(mask, temp_tcgv_i32(args[2]), mask);
+    tcg_gen_or_i32(temp_tcgv_i32(ret), t, mask);
+}
 
 /* initialize TCG globals.  */
 void arm_translate_init(void)
@@ -78,6 +121,14 @@ void arm_translate_init(void)
         offsetof(CPUARMState, exclusive_val), "exclusive_val");
 
     a64_translate_init();
+
+    for (i = 0; i < ARRAY_SIZE(arm_fp_helpers); i++) {
+        tcg_register_fp_helper(&arm_fp_helpers[i]);
+    }
+
+    tcg_set_helper_inline(&helper_info_sxtb16, gen_inline_sxtb16);
+    tcg_set_helper_inline(&helper_info_uxtb16, gen_inline_uxtb16);
+    tcg_set_helper_inline(&helper_info_sel_flags, gen_inline_sel_flags);
 }
 
 uint64_t asimd_imm_const(uint32_t imm, int cmode, int op)
@@ -59,6 +59,11 @@ DEF_HELPER_FLAGS_2(raise_exception, TCG_CALL_NO_WG, noreturn, env, int)
 DEF_HELPER_3(boundw, void, env, tl, int)
 DEF_HELPER_3(boundl, void, env, tl, int)
 
+#ifndef CONFIG_USER_ONLY
+DEF_HELPER_4(rep_movs, void, env, tl, tl, i32)
+DEF_HELPER_3(rep_stos, void, env, tl, i32)
+#endif /* !CONFIG_USER_ONLY */
+
 #ifndef CONFIG_USER_ONLY
 DEF_HELPER_1(rsm, void, env)
 #endif /* !CONFIG_USER_ONLY */
@@ -60,6 +60,7 @@
 #define FPUS_SE (1 << 7)
 #define FPUS_B  (1 << 15)
 
+#define FPUC_PM 0x20
 #define FPUC_EM 0x3f
 
 #define floatx80_lg2 make_floatx80(0x3ffd, 0x9a209a84fbcff799LL)
@@ -154,10 +155,110 @@ static void merge_exception_flags(CPUX86State *env, uint8_t old_flags)
                        (new_flags & float_flag_input_denormal ? FPUS_DE : 0)));
 }
 
-static inline floatx80 helper_fdiv(CPUX86State *env, floatx80 a, floatx80 b)
+/*
+ * Host double arithmetic for the basic x87 ops, like hardfloat does in
+ * fpu/softfloat.c.  With precision control set to double and rounding to
+ * nearest, the x87 rounds the exact result of two doubles to 53 bits just
+ * like the host does.  The results only differ where the wider exponent
+ * range of floatx80 matters, so anything but a normal or exact zero result
+ * goes through softfloat.  The inexact flag is not computed, hence this is
+ * only done once the guest has it set and masked.
+ */
+typedef enum {
+    FPU_ADD,
+    FPU_SUB,
+    FPU_MUL,
+    FPU_DIV,
+} FPUArith;
+
+static inline bool fpu_use_host_f64(CPUX86State *env)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    floatx80 ret = floatx80_div(a, b, &env->fp_status);
+    return (env->fpus & FPUS_PE) && (env->fpuc & FPUC_PM) &&
+        get_floatx80_rounding_precision(&env->fp_status) ==
+            floatx80_precision_d &&
+        get_float_rounding_mode(&env->fp_status) == float_round_nearest_even;
+}
+
+/* Whether @a is zero or a normal double, and then its value in @d */
+static inline bool floatx80_to_host_f64(floatx80 a, double *d)
+{
+    int exp = a.high & 0x7fff;
+    uint64_t f;
+
+    if (exp == 0 && a.low == 0) {
+        f = 0;
+    } else if ((a.low >> 63) && !(a.low & 0x7ff) &&
+               exp >= EXPBIAS - 1022 && exp <= EXPBIAS + 1023) {
+        f = deposit64(extract64(a.low, 11, 52), 52, 11, exp - EXPBIAS + 1023);
+    } else {
+        return false;
+    }
+    f = deposit64(f, 63, 1, a.high >> 15);
+    memcpy(d, &f, sizeof(f));
+    return true;
+}
+
+static inline floatx80 host_f64_to_floatx80(double d)
+{
+    uint64_t f;
+    uint16_t sign;
+
+    memcpy(&f, &d, sizeof(f));
+    sign = (f >> 63) << 15;
+    if (!(f << 1)) {
+        return make_floatx80(sign, 0);
+    }
+    return make_floatx80(sign | (extract64(f, 52, 11) - 1023 + EXPBIAS),
+                         (extract64(f, 0, 52) << 11) | (1ULL << 63));
+}
+
+static inline floatx80 fpu_arith(CPUX86State *env, floatx80 a, floatx80 b,
+                                 FPUArith op)
+{
+    uint8_t old_flags;
+    double da, db, dr;
+    floatx80 ret;
+
+    if (fpu_use_host_f64(env) &&
+        floatx80_to_host_f64(a, &da) && floatx80_to_host_f64(b, &db) &&
+        !(op == FPU_DIV && db == 0)) {
+        switch (op) {
+        case FPU_ADD:
+            dr = da + db;
+            break;
+        case FPU_SUB:
+            dr = da - db;
+            break;
+        case FPU_MUL:
+            dr = da * db;
+            break;
+        default:
+            dr = da / db;
+            break;
+        }
+        /* A sum of doubles which rounds to zero is exact */
+        if (isnormal(dr) ||
+            (dr == 0 && (op == FPU_ADD || op == FPU_SUB ||
+                         da == 0 || db == 0))) {
+            return host_f64_to_floatx80(dr);
+        }
+    }
+
+    old_flags = save_exception_flags(env);
+    switch (op) {
+    case FPU_ADD:
+        ret = floatx80_add(a, b, &env->fp_status);
+        break;
+    case FPU_SUB:
+        ret = floatx80_sub(a, b, &env->fp_status);
+        break;
+    case FPU_MUL:
+        ret = floatx80_mul(a, b, &env->fp_status);
+        break;
+    default:
+        ret = floatx80_div(a, b, &env->fp_status);
+        break;
+    }
     merge_exception_flags(env, old_flags);
     return ret;
 }
@@ -505,70 +606,54 @@ void helper_fucomi_ST0_FT0(CPUX86State *env)
 
 void helper_fadd_ST0_FT0(CPUX86State *env)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST0 = floatx80_add(ST0, FT0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST0 = fpu_arith(env, ST0, FT0, FPU_ADD);
 }
 
 void helper_fmul_ST0_FT0(CPUX86State *env)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST0 = floatx80_mul(ST0, FT0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST0 = fpu_arith(env, ST0, FT0, FPU_MUL);
 }
 
 void helper_fsub_ST0_FT0(CPUX86State *env)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST0 = floatx80_sub(ST0, FT0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST0 = fpu_arith(env, ST0, FT0, FPU_SUB);
 }
 
 void helper_fsubr_ST0_FT0(CPUX86State *env)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST0 = floatx80_sub(FT0, ST0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST0 = fpu_arith(env, FT0, ST0, FPU_SUB);
 }
 
 void helper_fdiv_ST0_FT0(CPUX86State *env)
 {
-    ST0 = helper_fdiv(env, ST0, FT0);
+    ST0 = fpu_arith(env, ST0, FT0, FPU_DIV);
 }
 
 void helper_fdivr_ST0_FT0(CPUX86State *env)
 {
-    ST0 = helper_fdiv(env, FT0, ST0);
+    ST0 = fpu_arith(env, FT0, ST0, FPU_DIV);
 }
 
 /* fp operations between STN and ST0 */
 
 void helper_fadd_STN_ST0(CPUX86State *env, int st_index)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST(st_index) = floatx80_add(ST(st_index), ST0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST(st_index) = fpu_arith(env, ST(st_index), ST0, FPU_ADD);
 }
 
 void helper_fmul_STN_ST0(CPUX86State *env, int st_index)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST(st_index) = floatx80_mul(ST(st_index), ST0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST(st_index) = fpu_arith(env, ST(st_index), ST0, FPU_MUL);
 }
 
 void helper_fsub_STN_ST0(CPUX86State *env, int st_index)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST(st_index) = floatx80_sub(ST(st_index), ST0, &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST(st_index) = fpu_arith(env, ST(st_index), ST0, FPU_SUB);
 }
 
 void helper_fsubr_STN_ST0(CPUX86State *env, int st_index)
 {
-    uint8_t old_flags = save_exception_flags(env);
-    ST(st_index) = floatx80_sub(ST0, ST(st_index), &env->fp_status);
-    merge_exception_flags(env, old_flags);
+    ST(st_index) = fpu_arith(env, ST0, ST(st_index), FPU_SUB);
 }
 
 void helper_fdiv_STN_ST0(CPUX86State *env, int st_index)
@@ -576,7 +661,7 @@ void helper_fdiv_STN_ST0(CPUX86State *env, int st_index)
     floatx80 *p;
 
     p = &ST(st_index);
-    *p = helper_fdiv(env, *p, ST0);
+    *p = fpu_arith(env, *p, ST0, FPU_DIV);
 }
 
 void helper_fdivr_STN_ST0(CPUX86State *env, int st_index)
@@ -584,7 +669,7 @@ void helper_fdivr_STN_ST0(CPUX86State *env, int st_index)
     floatx80 *p;
 
     p = &ST(st_index);
-    *p = helper_fdiv(env, ST0, *p);
+    *p = fpu_arith(env, ST0, *p, FPU_DIV);
 }
 
 /* misc FPU operations */
@@ -55,3 +55,147 @@ void helper_boundl(CPUX86State *env, target_ulong a0, int v)
         raise_exception_ra(env, EXCP05_BOUND, GETPC());
     }
 }
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Bulk REP MOVS/STOS: do as many iterations as fit in the current pages of
+ * the operands with a single memmove()/memset(), which are memory.copy and
+ * memory.fill on wasm.  Nothing is done if an operand is not plain RAM in
+ * the TLB, or would cross a page or wrap its address register: the
+ * translated loop then runs the next iteration itself, taking the fault or
+ * the I/O access as usual, and calls us again on the next page.
+ */
+static uint64_t rep_elems(target_ulong lin, target_ulong reg, uint64_t mask,
+                          int shift, bool down)
+{
+    target_ulong off = lin & ~TARGET_PAGE_MASK;
+    uint64_t n;
+
+    if (down) {
+        if (off + (1 << shift) > TARGET_PAGE_SIZE ||
+            (mask != UINT64_MAX && reg + (1 << shift) - 1 > mask)) {
+            return 0;
+        }
+        n = MIN((off >> shift) + 1, ((uint64_t)reg >> shift) + 1);
+    } else {
+        n = (TARGET_PAGE_SIZE - off) >> shift;
+        if (mask != UINT64_MAX) {
+            n = MIN(n, (mask - reg + 1) >> shift);
+        }
+    }
+    return n;
+}
+
+static uint64_t rep_mask(int aflag)
+{
+    return aflag == MO_64 ? UINT64_MAX : MAKE_64BIT_MASK(0, 8 << aflag);
+}
+
+static void rep_set_reg(CPUX86State *env, int reg, target_ulong val,
+                        int aflag)
+{
+    if (aflag == MO_16) {
+        env->regs[reg] = deposit64(env->regs[reg], 0, 16, val);
+    } else {
+        env->regs[reg] = val & rep_mask(aflag);
+    }
+}
+
+static void rep_advance(CPUX86State *env, int reg, uint64_t n, int shift,
+                        int aflag)
+{
+    rep_set_reg(env, reg, env->regs[reg] + (env->df * n << shift), aflag);
+}
+
+static void *rep_host(CPUX86State *env, target_ulong lin, uint64_t n,
+                      int shift, MMUAccessType access_type)
+{
+    if (env->df < 0) {
+        lin -= (n - 1) << shift;
+    }
+    return tlb_vaddr_to_host(env, lin, access_type,
+                             cpu_mmu_index(env, false));
+}
+
+void helper_rep_movs(CPUX86State *env, target_ulong dst, target_ulong src,
+                     uint32_t desc)
+{
+    int shift = desc & 3;
+    int aflag = desc >> 2;
+    uint64_t mask = rep_mask(aflag);
+    bool down = env->df < 0;
+    uint64_t n = env->regs[R_ECX] & mask;
+    size_t len;
+    uint8_t *hs, *hd;
+
+    n = MIN(n, rep_elems(src, env->regs[R_ESI] & mask, mask, shift, down));
+    n = MIN(n, rep_elems(dst, env->regs[R_EDI] & mask, mask, shift, down));
+    if (n == 0) {
+        return;
+    }
+
+    hs = rep_host(env, src, n, shift, MMU_DATA_LOAD);
+    hd = rep_host(env, dst, n, shift, MMU_DATA_STORE);
+    if (!hs || !hd) {
+        return;
+    }
+
+    /*
+     * An element-wise copy only matches memmove() if it never reads what
+     * it wrote, e.g. not for the forward fill idiom with EDI = ESI + 1.
+     */
+    len = n << shift;
+    if (down ? (hd < hs && hd + len > hs) : (hd > hs && hd < hs + len)) {
+        return;
+    }
+    memmove(hd, hs, len);
+
+    rep_advance(env, R_ESI, n, shift, aflag);
+    rep_advance(env, R_EDI, n, shift, aflag);
+    rep_set_reg(env, R_ECX, env->regs[R_ECX] - n, aflag);
+}
+
+void helper_rep_stos(CPUX86State *env, target_ulong dst, uint32_t desc)
+{
+    int shift = desc & 3;
+    int aflag = desc >> 2;
+    uint64_t mask = rep_mask(aflag);
+    bool down = env->df < 0;
+    uint64_t n = env->regs[R_ECX] & mask;
+    uint64_t val = env->regs[R_EAX] & MAKE_64BIT_MASK(0, 8 << shift);
+    uint8_t *hd;
+    uint64_t i;
+
+    n = MIN(n, rep_elems(dst, env->regs[R_EDI] & mask, mask, shift, down));
+    if (n == 0) {
+        return;
+    }
+
+    hd = rep_host(env, dst, n, shift, MMU_DATA_STORE);
+    if (!hd) {
+        return;
+    }
+
+    if (val == ((uint8_t)val * 0x0101010101010101ull &
+                MAKE_64BIT_MASK(0, 8 << shift))) {
+        memset(hd, val, n << shift);
+    } else {
+        for (i = 0; i < n; i++) {
+            switch (shift) {
+            case MO_16:
+                stw_le_p(hd + (i << shift), val);
+                break;
+            case MO_32:
+                stl_le_p(hd + (i << shift), val);
+                break;
+            default:
+                stq_le_p(hd + (i << shift), val);
+                break;
+            }
+        }
+    }
+
+    rep_advance(env, R_EDI, n, shift, aflag);
+    rep_set_reg(env, R_ECX, env->regs[R_ECX] - n, aflag);
+}
+#endif /* !CONFIG_USER_ONLY */
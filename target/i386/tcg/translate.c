@@ -357,6 +357,13 @@ static void set_cc_op(DisasContext *s, CCOp op)
     s->cc_op = op;
 }
 
+/*
+ * The CC globals that cc_op_live[] keeps alive are always written back at
+ * the end of the TB, even when the successor is known to set the flags
+ * before reading them: an interrupt, a fault on the first insn of the
+ * successor or a signal can be taken in between, and all of them compute
+ * EFLAGS from env.
+ */
 static void gen_update_cc_op(DisasContext *s)
 {
     if (s->cc_op_dirty) {
@@ -1319,13 +1326,42 @@ static void gen_outs(DisasContext *s, MemOp ot)
     gen_bpt_io(s, s->tmp2_i32, ot);
 }
 
+#ifndef CONFIG_USER_ONLY
+static void gen_bulk_movs(DisasContext *s, MemOp ot)
+{
+    TCGv src = tcg_temp_new();
+
+    gen_string_movl_A0_ESI(s);
+    tcg_gen_mov_tl(src, s->A0);
+    gen_string_movl_A0_EDI(s);
+    gen_helper_rep_movs(tcg_env, s->A0, src,
+                        tcg_constant_i32(ot | s->aflag << 2));
+}
+
+static void gen_bulk_stos(DisasContext *s, MemOp ot)
+{
+    gen_string_movl_A0_EDI(s);
+    gen_helper_rep_stos(tcg_env, s->A0, tcg_constant_i32(ot | s->aflag << 2));
+}
+#endif
+
 /* Generate jumps to current or next instruction */
 static void gen_repz(DisasContext *s, MemOp ot,
-                     void (*fn)(DisasContext *s, MemOp ot))
+                     void (*fn)(DisasContext *s, MemOp ot),
+                     void (*bulk)(DisasContext *s, MemOp ot))
 {
     TCGLabel *l2;
     gen_update_cc_op(s);
     l2 = gen_jz_ecx_string(s);
+    /*
+     * Let the helper do what is left in the current pages, then one
+     * iteration as usual, which takes care of faults and I/O.  Not when
+     * each iteration has to be seen, see repz_opt.
+     */
+    if (bulk && s->repz_opt) {
+        bulk(s, ot);
+        gen_op_jz_ecx(s, l2);
+    }
     fn(s, ot);
     gen_op_add_reg_im(s, s->aflag, R_ECX, -1);
     /*
@@ -1340,7 +1376,15 @@ static void gen_repz(DisasContext *s, MemOp ot,
 
 #define GEN_REPZ(op) \
     static inline void gen_repz_ ## op(DisasContext *s, MemOp ot) \
-    { gen_repz(s, ot, gen_##op); }
+    { gen_repz(s, ot, gen_##op, NULL); }
+
+#ifdef CONFIG_USER_ONLY
+#define GEN_REPZ_BULK(op) GEN_REPZ(op)
+#else
+#define GEN_REPZ_BULK(op) \
+    static inline void gen_repz_ ## op(DisasContext *s, MemOp ot) \
+    { gen_repz(s, ot, gen_##op, gen_bulk_##op); }
+#endif
 
 static void gen_repz2(DisasContext *s, MemOp ot, int nz,
                       void (*fn)(DisasContext *s, MemOp ot))
@@ -1362,8 +1406,8 @@ static void gen_repz2(DisasContext *s, MemOp ot, int nz,
     static inline void gen_repz_ ## op(DisasContext *s, MemOp ot, int nz) \
     { gen_repz2(s, ot, nz, gen_##op); }
 
-GEN_REPZ(movs)
-GEN_REPZ(stos)
+GEN_REPZ_BULK(movs)
+GEN_REPZ_BULK(stos)
 GEN_REPZ(lods)
 GEN_REPZ(ins)
 GEN_REPZ(outs)
@@ -1293,6 +1293,20 @@ void gen_intermediate_code(CPUState *cs, TranslationBlock *tb, int *max_insns,
     translator_loop(cs, tb, max_insns, pc, host_pc, &riscv_tr_ops, &ctx.base);
 }
 
+/* The double precision helpers, which only go through softfloat */
+static const TCGFPHelper riscv_fp_helpers[] = {
+    { helper_fadd_d, TCG_FP_ADD_F64, { 1, 2 }, 0,
+      offsetof(CPURISCVState, fp_status) },
+    { helper_fsub_d, TCG_FP_SUB_F64, { 1, 2 }, 0,
+      offsetof(CPURISCVState, fp_status) },
+    { helper_fmul_d, TCG_FP_MUL_F64, { 1, 2 }, 0,
+      offsetof(CPURISCVState, fp_status) },
+    { helper_fdiv_d, TCG_FP_DIV_F64, { 1, 2 }, 0,
+      offsetof(CPURISCVState, fp_status) },
+    { helper_fsqrt_d, TCG_FP_SQRT_F64, { 1, 1 }, 0,
+      offsetof(CPURISCVState, fp_status) },
+};
+
 void riscv_translate_init(void)
 {
     int i;
@@ -1330,4 +1344,8 @@ void riscv_translate_init(void)
                                  "pmmask");
     pm_base = tcg_global_mem_new(tcg_env, offsetof(CPURISCVState, cur_pmbase),
                                  "pmbase");
+
+    for (i = 0; i < ARRAY_SIZE(riscv_fp_helpers); i++) {
+        tcg_register_fp_helper(&riscv_fp_helpers[i]);
+    }
 }
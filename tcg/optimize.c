@@ -55,6 +55,14 @@ typedef struct TempOptInfo {
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
 } TempOptInfo;
 
+/* Max number of env stores tracked for dead store elimination. */
+#define MAX_PEND_ST 16
+
+typedef struct PendStoreInfo {
+    TCGOp *op;
+    intptr_t start, last;
+} PendStoreInfo;
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
@@ -63,6 +71,10 @@ typedef struct OptContext {
     IntervalTreeRoot mem_copy;
     QSIMPLEQ_HEAD(, MemCopyInfo) mem_free;
 
+    /* Stores to env that nothing may have read yet. */
+    PendStoreInfo pend_st[MAX_PEND_ST];
+    int nb_pend_st;
+
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
@@ -300,6 +312,55 @@ static void record_mem_copy(OptContext *ctx, TCGType type,
     QSIMPLEQ_INSERT_TAIL(&ti->mem_copy, mc, next);
 }
 
+/*
+ * Dead store elimination for env: a store is dead if a later store
+ * overwrites all of its bytes before anything can observe them.  A load
+ * from env only observes the bytes it reads, but everything else that
+ * could see env memory (loads through other pointers, helpers, guest
+ * memory accesses that may fault, and the end of the block) observes
+ * all of them.
+ */
+static void pend_st_clear(OptContext *ctx)
+{
+    ctx->nb_pend_st = 0;
+}
+
+static void pend_st_remove(OptContext *ctx, int i)
+{
+    ctx->nb_pend_st--;
+    memmove(&ctx->pend_st[i], &ctx->pend_st[i + 1],
+            (ctx->nb_pend_st - i) * sizeof(ctx->pend_st[0]));
+}
+
+/* The bytes [s, l] of env are read. */
+static void pend_st_read(OptContext *ctx, intptr_t s, intptr_t l)
+{
+    for (int i = ctx->nb_pend_st - 1; i >= 0; i--) {
+        PendStoreInfo *p = &ctx->pend_st[i];
+        if (p->start <= l && s <= p->last) {
+            pend_st_remove(ctx, i);
+        }
+    }
+}
+
+/* OP stores the bytes [s, l] of env. */
+static void pend_st_record(OptContext *ctx, TCGOp *op, intptr_t s, intptr_t l)
+{
+    for (int i = ctx->nb_pend_st - 1; i >= 0; i--) {
+        PendStoreInfo *p = &ctx->pend_st[i];
+        if (s <= p->start && p->last <= l) {
+            tcg_op_remove(ctx->tcg, p->op);
+            pend_st_remove(ctx, i);
+        }
+    }
+    if (ctx->nb_pend_st == MAX_PEND_ST) {
+        pend_st_remove(ctx, 0);
+    }
+    ctx->pend_st[ctx->nb_pend_st++] = (PendStoreInfo){
+        .op = op, .start = s, .last = l,
+    };
+}
+
 static bool ts_are_copies(TCGTemp *ts1, TCGTemp *ts2)
 {
     TCGTemp *i;
@@ -1364,6 +1425,8 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
     if (!(flags & TCG_CALL_NO_SIDE_EFFECTS)) {
         remove_mem_copy_all(ctx);
     }
+    /* Even a pure helper may read env. */
+    pend_st_clear(ctx);
 
     /* Reset temp data for outputs. */
     for (i = 0; i < nb_oargs; i++) {
@@ -1904,6 +1967,22 @@ static bool fold_orc(OptContext *ctx, TCGOp *op)
     return false;
 }
 
+/*
+ * The barrier that tcg_gen_req_mo() places before a guest access is
+ * dropped when the backend emits the access itself ordered.  The barrier
+ * may have been merged with an explicit one by fold_mb, which is kept if
+ * it asks for more.
+ */
+static void fold_qemu_ordered(OptContext *ctx, bool is_ld)
+{
+#ifdef TCG_TARGET_HAS_ORDERED_LDST
+    if (ctx->prev_mb && !(ctx->prev_mb->args[0] & TCG_MO_ST_LD) &&
+        tcg_target_ordered_ldst(ctx->tcg, is_ld)) {
+        tcg_op_remove(ctx->tcg, ctx->prev_mb);
+    }
+#endif
+}
+
 static bool fold_qemu_ld(OptContext *ctx, TCGOp *op)
 {
     const TCGOpDef *def = &tcg_op_defs[op->opc];
@@ -1920,6 +1999,7 @@ static bool fold_qemu_ld(OptContext *ctx, TCGOp *op)
     }
 
     /* Opcodes that touch guest memory stop the mb optimization.  */
+    fold_qemu_ordered(ctx, true);
     ctx->prev_mb = NULL;
     return false;
 }
@@ -1927,6 +2007,7 @@ static bool fold_qemu_ld(OptContext *ctx, TCGOp *op)
 static bool fold_qemu_st(OptContext *ctx, TCGOp *op)
 {
     /* Opcodes that touch guest memory stop the mb optimization.  */
+    fold_qemu_ordered(ctx, false);
     ctx->prev_mb = NULL;
     return false;
 }
@@ -2205,32 +2286,47 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
 
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
+    intptr_t ofs = op->args[2];
+    intptr_t lm1;
+
     /* We can't do any folding with a load, but we can record bits. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
         ctx->s_mask = MAKE_64BIT_MASK(8, 56);
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld8u):
         ctx->z_mask = MAKE_64BIT_MASK(0, 8);
         ctx->s_mask = MAKE_64BIT_MASK(9, 55);
+        lm1 = 0;
         break;
     CASE_OP_32_64(ld16s):
         ctx->s_mask = MAKE_64BIT_MASK(16, 48);
+        lm1 = 1;
         break;
     CASE_OP_32_64(ld16u):
         ctx->z_mask = MAKE_64BIT_MASK(0, 16);
         ctx->s_mask = MAKE_64BIT_MASK(17, 47);
+        lm1 = 1;
         break;
     case INDEX_op_ld32s_i64:
         ctx->s_mask = MAKE_64BIT_MASK(32, 32);
+        lm1 = 3;
         break;
     case INDEX_op_ld32u_i64:
         ctx->z_mask = MAKE_64BIT_MASK(0, 32);
         ctx->s_mask = MAKE_64BIT_MASK(33, 31);
+        lm1 = 3;
         break;
     default:
         g_assert_not_reached();
     }
+
+    if (op->args[1] == tcgv_ptr_arg(tcg_env)) {
+        pend_st_read(ctx, ofs, ofs + lm1);
+    } else {
+        pend_st_clear(ctx);
+    }
     return false;
 }
 
@@ -2241,6 +2337,7 @@ static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
     TCGType type;
 
     if (op->args[1] != tcgv_ptr_arg(tcg_env)) {
+        pend_st_clear(ctx);
         return false;
     }
 
@@ -2252,6 +2349,7 @@ static bool fold_tcg_ld_memcopy(OptContext *ctx, TCGOp *op)
         return tcg_opt_gen_mov(ctx, op, temp_arg(dst), temp_arg(src));
     }
 
+    pend_st_read(ctx, ofs, ofs + tcg_type_size(type) - 1);
     reset_ts(ctx, dst);
     record_mem_copy(ctx, type, dst, ofs, ofs + tcg_type_size(type) - 1);
     return true;
@@ -2288,6 +2386,7 @@ static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
         g_assert_not_reached();
     }
     remove_mem_copy_in(ctx, ofs, ofs + lm1);
+    pend_st_record(ctx, op, ofs, ofs + lm1);
     return false;
 }
 
@@ -2307,12 +2406,13 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
     type = ctx->type;
 
     /*
-     * Eliminate duplicate stores of a constant.
-     * This happens frequently when the target ISA zero-extends.
+     * Eliminate stores of the value env already holds: duplicate stores
+     * of a constant, which happen frequently when the target ISA
+     * zero-extends, and values stored back where they were loaded from.
      */
-    if (ts_is_const(src)) {
+    {
         TCGTemp *prev = find_mem_copy_for(ctx, type, ofs);
-        if (src == prev) {
+        if (prev && ts_are_copies(src, prev)) {
             tcg_op_remove(ctx->tcg, op);
             return true;
         }
@@ -2321,6 +2421,7 @@ static bool fold_tcg_st_memcopy(OptContext *ctx, TCGOp *op)
     last = ofs + tcg_type_size(type) - 1;
     remove_mem_copy_in(ctx, ofs, last);
     record_mem_copy(ctx, type, src, ofs, last);
+    pend_st_record(ctx, op, ofs, last);
     return false;
 }
 
@@ -2374,6 +2475,13 @@ void tcg_optimize(TCGContext *s)
         init_arguments(&ctx, op, def->nb_oargs + def->nb_iargs);
         copy_propagate(&ctx, op, def->nb_oargs, def->nb_iargs);
 
+        /* Pending env stores may be observed past these. */
+        if ((def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS |
+                           TCG_OPF_CALL_CLOBBER)) ||
+            opc == INDEX_op_dupm_vec) {
+            pend_st_clear(&ctx);
+        }
+
         /* Pre-compute the type of the operation. */
         if (def->flags & TCG_OPF_VECTOR) {
             ctx.type = TCG_TYPE_V64 + TCGOP_VECL(op);
@@ -28,9 +28,11 @@
 #include "qemu/mprotect.h"
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
+#include "qemu/heap-account.h"
 #include "qemu/qtree.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
+#include "tcg/startup.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 #include "host/cpuinfo.h"
@@ -72,10 +74,19 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    size_t *evicted; /* regions emptied by tcg_region_evict, for reuse */
+    size_t n_evicted;
+    uint64_t *seq; /* assignment order of each region, 0 if empty */
+    uint64_t next_seq;
 };
 
 static struct tcg_region_state region;
 
+bool tcg_partial_flush;
+
+/* Number of regions the buffer is split into for partial flushes */
+#define TCG_PARTIAL_FLUSH_REGIONS 32
+
 /*
  * This is an array of struct tcg_region_tree's, with padding.
  * We use void * to simplify the computation of region_trees[i]; each
@@ -191,10 +202,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* @p must be a rw pointer into code_gen_buffer */
+static size_t tcg_region_index(const void *p)
 {
-    size_t region_idx;
+    if (p < region.start_aligned) {
+        return 0;
+    } else {
+        ptrdiff_t offset = p - region.start_aligned;
 
+        if (offset > region.stride * (region.n - 1)) {
+            return region.n - 1;
+        }
+        return offset / region.stride;
+    }
+}
+
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -206,18 +230,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_index(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +372,17 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.current < region.n) {
+        curr_region = region.current++;
+    } else if (region.n_evicted > 0) {
+        curr_region = region.evicted[--region.n_evicted];
+    } else {
         return true;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.seq[curr_region] = ++region.next_seq;
     return false;
 }
 
@@ -412,6 +431,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_evicted = 0;
+    memset(region.seq, 0, region.n * sizeof(*region.seq));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,6 +443,116 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+struct tcg_region_heat {
+    unsigned (*heat)(TranslationBlock *);
+    uint64_t sum;
+};
+
+static gboolean tcg_region_heat_iter(gpointer key, gpointer value,
+                                     gpointer data)
+{
+    struct tcg_region_heat *h = data;
+
+    h->sum += h->heat(value);
+    return false;
+}
+
+static gboolean tcg_region_collect_iter(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/*
+ * Call from a safe-work context.
+ * Empty up to @nr full regions for reuse, and return how many were
+ * emptied.  The regions whose TBs have the lowest total @heat go first,
+ * the least recently assigned among those; with a NULL @heat this is a
+ * FIFO of regions.  @evict is called on every TB of a region before its
+ * memory can be reused, and must make the TB unreachable.
+ */
+size_t tcg_region_evict(size_t nr, unsigned (*heat)(TranslationBlock *),
+                        void (*evict)(TranslationBlock *))
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree uint64_t *score = g_new0(uint64_t, region.n);
+    g_autofree bool *busy = g_new0(bool, region.n);
+    g_autofree size_t *victims = g_new(size_t, region.n);
+    size_t n_victims = 0;
+    size_t i, j;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        busy[tcg_region_index(s->code_gen_buffer)] = true;
+    }
+    for (i = 0; i < region.n; i++) {
+        struct tcg_region_tree *rt = region_trees + i * tree_size;
+        struct tcg_region_heat h = { .heat = heat };
+
+        if (busy[i] || region.seq[i] == 0 || heat == NULL) {
+            continue;
+        }
+        qemu_mutex_lock(&rt->lock);
+        q_tree_foreach(rt->tree, tcg_region_heat_iter, &h);
+        qemu_mutex_unlock(&rt->lock);
+        score[i] = h.sum;
+    }
+    while (n_victims < nr) {
+        size_t best = region.n;
+
+        for (i = 0; i < region.n; i++) {
+            if (busy[i] || region.seq[i] == 0) {
+                continue;
+            }
+            if (best == region.n || score[i] < score[best] ||
+                (score[i] == score[best] &&
+                 region.seq[i] < region.seq[best])) {
+                best = i;
+            }
+        }
+        if (best == region.n) {
+            break;
+        }
+        busy[best] = true;
+        victims[n_victims++] = best;
+    }
+    qemu_mutex_unlock(&region.lock);
+
+    for (i = 0; i < n_victims; i++) {
+        struct tcg_region_tree *rt = region_trees + victims[i] * tree_size;
+        g_autoptr(GPtrArray) tbs = g_ptr_array_new();
+
+        qemu_mutex_lock(&rt->lock);
+        q_tree_foreach(rt->tree, tcg_region_collect_iter, tbs);
+        qemu_mutex_unlock(&rt->lock);
+
+        for (j = 0; j < tbs->len; j++) {
+            evict(g_ptr_array_index(tbs, j));
+        }
+
+        qemu_mutex_lock(&rt->lock);
+        /* Increment the refcount first so that destroy acts as a reset */
+        q_tree_ref(rt->tree);
+        q_tree_destroy(rt->tree);
+        qemu_mutex_unlock(&rt->lock);
+    }
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_victims; i++) {
+        void *start, *end;
+
+        tcg_region_bounds(victims[i], &start, &end);
+        region.agg_size_full -= (end - start) - TCG_HIGHWATER;
+        region.seq[victims[i]] = 0;
+        region.evicted[region.n_evicted++] = victims[i];
+    }
+    qemu_mutex_unlock(&region.lock);
+    return n_victims;
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
 #ifdef CONFIG_USER_ONLY
@@ -435,6 +566,12 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
+    if (tcg_partial_flush) {
+        /* Partial flushes evict whole regions, so keep a few of them */
+        n_regions = MIN(tb_size / (2 * MiB), TCG_PARTIAL_FLUSH_REGIONS);
+        return MAX(n_regions, max_cpus);
+    }
+
     /* Use a single region if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
         return 1;
@@ -776,6 +913,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     have_prot = alloc_code_gen_buffer(tb_size, splitwx, &error_fatal);
     assert(have_prot >= 0);
+    heap_account_add(HEAP_SUBSYSTEM_TCG_REGIONS, region.total_size);
 
     /* Request large pages for the buffer and the splitwx.  */
     qemu_madvise(region.start_aligned, region.total_size, QEMU_MADV_HUGEPAGE);
@@ -853,6 +991,8 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     }
 
     tcg_region_trees_init();
+    region.evicted = g_new(size_t, region.n);
+    region.seq = g_new0(uint64_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
@@ -83,6 +83,17 @@ static inline TCGv_i64 TCGV128_HIGH(TCGv_i128 t)
 
 bool tcg_target_has_memory_bswap(MemOp memop);
 
+#ifdef TCG_TARGET_HAS_ORDERED_LDST
+/*
+ * Return true if the backend emits the guest loads (@is_ld) or stores of
+ * the TB being translated with the ordering that tcg_gen_req_mo() asks
+ * for, i.e. as load-acquire and store-release.  A barrier right before
+ * such an access is then redundant unless it orders stores against
+ * later loads.
+ */
+bool tcg_target_ordered_ldst(TCGContext *s, bool is_ld);
+#endif
+
 /*
  * Locate or create a read-only temporary that is a constant.
  * This kind of temporary need not be freed, but for convenience
@@ -52,6 +52,9 @@
 
 #include "elf.h"
 #include "exec/log.h"
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#include "disas/disas.h"
+#endif
 #include "tcg/tcg-ldst.h"
 #include "tcg/tcg-temp-internal.h"
 #include "tcg-internal.h"
@@ -428,56 +431,91 @@ tlb_mask_table_ofs(TCGContext *s, int which)
 
 #if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
 
-#define SUB_BUF_MAX 100000
-__thread uint8_t sub_buf[SUB_BUF_MAX];
+/*
+ * The wasm function body is generated into a per-thread buffer that grows
+ * on demand, so large TBs are not limited by its size.  Anything that has
+ * to refer back into the buffer records an offset, never a pointer.
+ */
+#define SUB_BUF_INIT_SIZE 0x10000
+/* Engines reject larger function bodies (V8's kV8MaxWasmFunctionSize) */
+#define WASM_FUNC_BODY_MAX 7654321
+__thread uint8_t *sub_buf;
 __thread uint8_t *sub_buf_ptr;
+__thread uint8_t *sub_buf_end;
+/* Set while translating a TB without its wasm module (see wasm_lazy_enabled) */
+__thread bool wasm_skip_emit;
+
+static void tcg_sub_buf_grow(size_t need)
+{
+    size_t used = sub_buf_ptr - sub_buf;
+    size_t size = sub_buf ? sub_buf_end - sub_buf : SUB_BUF_INIT_SIZE;
+
+    while (size < used + need) {
+        size *= 2;
+    }
+    sub_buf = g_realloc(sub_buf, size);
+    sub_buf_ptr = sub_buf + used;
+    sub_buf_end = sub_buf + size;
+}
 
 static inline void tcg_sub_out8(TCGContext *s, uint8_t v)
 {
-    *sub_buf_ptr++ = v;
-    if ((sub_buf_ptr - sub_buf) > SUB_BUF_MAX) {
-        printf("buffer too small\n"); fflush(stdout);
-        exit(1);
+    if (wasm_skip_emit) {
+        return;
     }
+    if (unlikely(sub_buf_ptr >= sub_buf_end)) {
+        tcg_sub_buf_grow(1);
+    }
+    *sub_buf_ptr++ = v;
 }
 
 static inline void tcg_sub_out32(TCGContext *s, uint32_t v)
 {
+    if (wasm_skip_emit) {
+        return;
+    }
+    if (unlikely(sub_buf_ptr + sizeof(v) > sub_buf_end)) {
+        tcg_sub_buf_grow(sizeof(v));
+    }
     memcpy(sub_buf_ptr, &v, sizeof(v));
     sub_buf_ptr += 4;
 }
 
-static inline void* cur_sub_buf_ptr()
-{
-    return sub_buf_ptr;
-}
-
 static inline int cur_sub_buf_off_rel()
 {
     return (int)sub_buf_ptr - (int)sub_buf;
 }
 
-#define LABEL_MAX 200
-
 struct label_placeholder {
     int label;
-    uintptr_t ptr;
+    int off; // offset of the i64.const operand in sub_buf
 };
 
 struct label_context {
     int block_idx;
 };
 
-#define WASM_NUM_HELPER_FUNCS_MAX 200
-#define WASM_HELPER_ADDED_TYPES_SECTION_MAX 200
+/* Upper bound of the size of one entry emitted by gen_func_type */
+#define WASM_HELPER_TYPE_MAX 32
 __thread uint32_t num_helper_funcs;
-__thread uint32_t target_helper_funcs[WASM_NUM_HELPER_FUNCS_MAX];
-__thread uint8_t target_helper_types[WASM_HELPER_ADDED_TYPES_SECTION_MAX];
+__thread uint32_t *target_helper_funcs;
+__thread uint32_t target_helper_funcs_size;
+__thread uint8_t *target_helper_types;
+__thread int target_helper_types_size;
 __thread int target_helper_types_pos;
+/*
+ * Helpers with the same signature share one type entry: the type of each
+ * helper, and where each distinct entry starts in target_helper_types.
+ */
+__thread uint32_t num_helper_types;
+__thread uint32_t *target_helper_type_idx;
+__thread int *target_helper_type_off;
 __thread int wasm_block_idx;
-__thread struct label_placeholder block_ptr_placeholder[LABEL_MAX];
+__thread struct label_placeholder *block_ptr_placeholder;
+__thread int block_ptr_placeholder_size;
 __thread int block_ptr_placeholder_idx_pos;
-__thread int label_to_block[LABEL_MAX];
+/* Indexed by label id + 1; allocated per TB from the TCG pool */
+__thread int *label_to_block;
 
 static int wasm_block_current_idx(TCGContext *s)
 {
@@ -516,24 +554,56 @@ static int write_uint32_leb128(uintptr_t bi, uint32_t v) {
 
 static uint8_t * wasm_get_helper_types_begin(TCGContext *s)
 {
+    if (target_helper_types_pos + WASM_HELPER_TYPE_MAX >
+        target_helper_types_size) {
+        target_helper_types_size = MAX(256, target_helper_types_size * 2);
+        target_helper_types = g_realloc(target_helper_types,
+                                        target_helper_types_size);
+    }
     return &(target_helper_types[target_helper_types_pos]);
 }
 
+/* Takes the entry of i bytes just written for the last registered helper */
 static void wasm_add_helper_types_pos(TCGContext *s, int i)
 {
-    target_helper_types_pos += i;
-    tcg_debug_assert(target_helper_types_pos <= WASM_HELPER_ADDED_TYPES_SECTION_MAX);
+    uint8_t *entry = &target_helper_types[target_helper_types_pos];
+    uint32_t t;
+
+    tcg_debug_assert(i <= WASM_HELPER_TYPE_MAX);
+    tcg_debug_assert(num_helper_funcs > 0);
+    for (t = 0; t < num_helper_types; t++) {
+        int off = target_helper_type_off[t];
+        int end = t + 1 < num_helper_types ? target_helper_type_off[t + 1] :
+                                             target_helper_types_pos;
+
+        if (end - off == i && !memcmp(&target_helper_types[off], entry, i)) {
+            break;
+        }
+    }
+    if (t == num_helper_types) {
+        target_helper_type_off[num_helper_types++] = target_helper_types_pos;
+        target_helper_types_pos += i;
+    }
+    target_helper_type_idx[num_helper_funcs - 1] = t;
 }
 
 static int wasm_register_helper_alloc_num(TCGContext *s)
 {
-    tcg_debug_assert(num_helper_funcs <= WASM_NUM_HELPER_FUNCS_MAX);
+    if (num_helper_funcs >= target_helper_funcs_size) {
+        target_helper_funcs_size = MAX(64, target_helper_funcs_size * 2);
+        target_helper_funcs = g_renew(uint32_t, target_helper_funcs,
+                                      target_helper_funcs_size);
+        target_helper_type_idx = g_renew(uint32_t, target_helper_type_idx,
+                                         target_helper_funcs_size);
+        target_helper_type_off = g_renew(int, target_helper_type_off,
+                                         target_helper_funcs_size);
+    }
     return num_helper_funcs++;
 }
 
 static void wasm_register_helper(TCGContext *s, int idx_on_tb, int helper_idx_on_qemu)
 {
-    tcg_debug_assert(idx_on_tb <= WASM_NUM_HELPER_FUNCS_MAX);
+    tcg_debug_assert(idx_on_tb < num_helper_funcs);
     target_helper_funcs[idx_on_tb] = helper_idx_on_qemu;
 }
 
@@ -549,16 +619,45 @@ static int get_wasm_helper_idx(TCGContext *s, int helper_idx_on_qemu)
 
 static void wasm_add_label_context(TCGContext *s, int label, int block)
 {
-    tcg_debug_assert(label <= LABEL_MAX);
+    tcg_debug_assert(label <= s->nb_labels);
     label_to_block[label] = block;
 }
 
-static void wasm_add_label_block_ptr_placeholder(int label, uintptr_t code_ptr)
+static void wasm_add_label_block_ptr_placeholder(int label, int off)
 {
     int i = block_ptr_placeholder_idx_pos++;
-    tcg_debug_assert(i <= LABEL_MAX);
+    if (i >= block_ptr_placeholder_size) {
+        block_ptr_placeholder_size = MAX(64, block_ptr_placeholder_size * 2);
+        block_ptr_placeholder = g_renew(struct label_placeholder,
+                                        block_ptr_placeholder,
+                                        block_ptr_placeholder_size);
+    }
     block_ptr_placeholder[i].label = label;
-    block_ptr_placeholder[i].ptr = code_ptr;
+    block_ptr_placeholder[i].off = off;
+}
+
+/*
+ * Offsets (relative to sub_buf) of the 5-byte helper index operand of each
+ * "call" instruction. These are recorded in the TB so that the batch
+ * compiler in wasm32.c can renumber the imports when merging TBs.
+ */
+#define WASM_CALL_SITES_MAX 1000
+__thread uint32_t wasm_call_sites[WASM_CALL_SITES_MAX];
+__thread int wasm_call_sites_num;
+
+/* Number of helper calls (excluding ld/st slow paths) used for tiering */
+__thread int wasm_helper_calls_num;
+
+static void wasm_add_call_site(TCGContext *s, int off)
+{
+    if (wasm_call_sites_num < 0) {
+        return;
+    }
+    if (wasm_call_sites_num >= WASM_CALL_SITES_MAX) {
+        wasm_call_sites_num = -1; // too many; this TB can't be batched
+        return;
+    }
+    wasm_call_sites[wasm_call_sites_num++] = off;
 }
 
 #endif
@@ -1085,6 +1184,38 @@ static TCGHelperInfo info_helper_st128_mmu = {
               | dh_typemask(ptr, 5)  /* uintptr_t ra */
 };
 
+/* Registered by the frontends when they initialize, searched by backends */
+#define MAX_FP_HELPERS 16
+static TCGFPHelper fp_helpers[MAX_FP_HELPERS];
+static int nb_fp_helpers;
+
+void tcg_register_fp_helper(const TCGFPHelper *h)
+{
+    if (tcg_fp_helper_lookup(h->func)) {
+        return;
+    }
+    tcg_debug_assert(nb_fp_helpers < MAX_FP_HELPERS);
+    if (nb_fp_helpers < MAX_FP_HELPERS) {
+        fp_helpers[nb_fp_helpers++] = *h;
+    }
+}
+
+const TCGFPHelper *tcg_fp_helper_lookup(const void *func)
+{
+    for (int i = 0; i < nb_fp_helpers; i++) {
+        if (fp_helpers[i].func == func) {
+            return &fp_helpers[i];
+        }
+    }
+    return NULL;
+}
+
+void tcg_set_helper_inline(TCGHelperInfo *info,
+                           void (*gen)(TCGTemp *ret, TCGTemp **args))
+{
+    info->inline_gen = gen;
+}
+
 #if defined(EMSCRIPTEN) || defined(CONFIG_TCG_INTERPRETER)
 static ffi_type *typecode_to_ffi(int argmask)
 {
@@ -2394,6 +2525,11 @@ static void tcg_gen_callN(TCGHelperInfo *info, TCGTemp *ret, TCGTemp **args)
     TCGOp *op;
     int i, n, pi = 0, total_args;
 
+    if (info->inline_gen) {
+        info->inline_gen(ret, args);
+        return;
+    }
+
     if (unlikely(g_once_init_enter(HELPER_INFO_INIT(info)))) {
         init_call_layout(info);
         g_once_init_leave(HELPER_INFO_INIT(info), HELPER_INFO_INIT_VAL(info));
@@ -5979,9 +6115,8 @@ static const uint8_t mod_header_a[] = {
     0x01, 0x80, 0x80, 0x80, 0x80, 0x00,
     0x80, 0x80, 0x80, 0x80, 0x00,
     0x60,
-    0x01, 0x7f,
-    0x01, 0x7f,
-    
+    0x01, WASM_PTR_TYPE,     // ctx
+    0x01, WASM_PTR_TYPE,     // tb_ptr to continue from, or exit_tb value
 };
 static const uint8_t mod_header_b[] = {
     // import section
@@ -5989,15 +6124,24 @@ static const uint8_t mod_header_b[] = {
     0x80, 0x80, 0x80, 0x80, 0x00,
     0x03, 0x65, 0x6e, 0x76,
     0x06, 0x62, 0x75, 0x66, 0x66, 0x65, 0x72,
-    0x02, 0x03, 0x00, 0x80, 0x80, 0x80, 0x80, 0x00,
+    0x02, WASM_MEMORY_LIMITS, 0x00, 0x80, 0x80, 0x80, 0x80, 0x00,
+    0x03, 0x65, 0x6e, 0x76,
+    0x05, 0x74, 0x61, 0x62, 0x6c, 0x65,
+    0x01, 0x70, WASM_TABLE_LIMITS, 0x00,
 };
 
 static const uint8_t mod_header_c[] = {
     // function section
     0x03, 2, 1, 0x00,
     // global section
-    0x06, 0x7e,
-    25,
+    0x06, 0x9e, 0x04,
+    57,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
@@ -6017,6 +6161,34 @@ static const uint8_t mod_header_c[] = {
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
+    // v128 globals for the vector registers
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    0x7b, 0x01, 0xfd, 0x0c, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x0b,
+    // TCG_REG_R16..R31
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
+    0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
     0x7e, 0x01, 0x42, 0x00, 0x0b,
@@ -6035,8 +6207,13 @@ static const uint8_t mod_header_d[] = {
     0x80, 0x80, 0x80, 0x80, 0x00,
     0x80, 0x80, 0x80, 0x80, 0x00,
 
-    0x2, 0x2, 0x7f, 0x5, 0x7e,
-    
+#if WASM_REG_LOCALS
+    0x6, 0x2, 0x7f, 0x5, 0x7e, 0x20, 0x7e, ENV_SLOTS, 0x7e, 0x20, 0x7f,
+    0x1, WASM_PTR_TYPE,
+#else
+    0x4, 0x2, 0x7f, 0x5, 0x7e, ENV_SLOTS, 0x7e, 0x1, WASM_PTR_TYPE,
+#endif
+
     // initialize the instance
     0x20, 0x0,               // local.get $ctx
     0x28, 0, DO_INIT_OFF,    // i32.load do_init_ptr
@@ -6049,12 +6226,20 @@ static const uint8_t mod_header_d[] = {
     0x04, 0x40,              // if
     // fundamental variables
     0x20, 0x0,               // local.get $ctx
+#if WASM_PTR64
+    0x29, 0, ENV_OFF,        // i64.load env
+#else
     0x28, 0, ENV_OFF,        // i32.load env
     0xad,                    // extend
+#endif
     0x24, 14,                // global.set $14
     0x20, 0x0,               // local.get $ctx
+#if WASM_PTR64
+    0x29, 0, STACK_OFF,      // i64.load stack
+#else
     0x28, 0, STACK_OFF,      // i32.load stack
     0xad,                    // extend
+#endif
     0x24, 15,                // global.set $15
     0x0b,                    // end
 
@@ -6065,35 +6250,122 @@ static const uint8_t mod_header_d[] = {
     0x24, 16,                // global.set $block_ptr
     0x0b,                    // end
 
-    0x03, 0x40,              // loop
+#if WASM_REG_LOCALS
+    // load the registers into locals
+    0x23, 14, 0x21, REG_LOCAL_BASE_IDX + 14, // env
+    0x23, 15, 0x21, REG_LOCAL_BASE_IDX + 15, // stack
     0x23, 16,                // global.get $block_ptr
     0x50,                    // i64.eqz
-    0x04, 0x40,              // if
+    0x45,                    // i32.eqz
+    0x04, 0x40,              // if (resuming after unwinding)
+    0x23, 0, 0x21, REG_LOCAL_BASE_IDX + 0,
+    0x23, 1, 0x21, REG_LOCAL_BASE_IDX + 1,
+    0x23, 2, 0x21, REG_LOCAL_BASE_IDX + 2,
+    0x23, 3, 0x21, REG_LOCAL_BASE_IDX + 3,
+    0x23, 4, 0x21, REG_LOCAL_BASE_IDX + 4,
+    0x23, 5, 0x21, REG_LOCAL_BASE_IDX + 5,
+    0x23, 6, 0x21, REG_LOCAL_BASE_IDX + 6,
+    0x23, 7, 0x21, REG_LOCAL_BASE_IDX + 7,
+    0x23, 8, 0x21, REG_LOCAL_BASE_IDX + 8,
+    0x23, 9, 0x21, REG_LOCAL_BASE_IDX + 9,
+    0x23, 10, 0x21, REG_LOCAL_BASE_IDX + 10,
+    0x23, 11, 0x21, REG_LOCAL_BASE_IDX + 11,
+    0x23, 12, 0x21, REG_LOCAL_BASE_IDX + 12,
+    0x23, 13, 0x21, REG_LOCAL_BASE_IDX + 13,
+    0x23, 41, 0x21, REG_LOCAL_BASE_IDX + 16,
+    0x23, 42, 0x21, REG_LOCAL_BASE_IDX + 17,
+    0x23, 43, 0x21, REG_LOCAL_BASE_IDX + 18,
+    0x23, 44, 0x21, REG_LOCAL_BASE_IDX + 19,
+    0x23, 45, 0x21, REG_LOCAL_BASE_IDX + 20,
+    0x23, 46, 0x21, REG_LOCAL_BASE_IDX + 21,
+    0x23, 47, 0x21, REG_LOCAL_BASE_IDX + 22,
+    0x23, 48, 0x21, REG_LOCAL_BASE_IDX + 23,
+    0x23, 49, 0x21, REG_LOCAL_BASE_IDX + 24,
+    0x23, 50, 0x21, REG_LOCAL_BASE_IDX + 25,
+    0x23, 51, 0x21, REG_LOCAL_BASE_IDX + 26,
+    0x23, 52, 0x21, REG_LOCAL_BASE_IDX + 27,
+    0x23, 53, 0x21, REG_LOCAL_BASE_IDX + 28,
+    0x23, 54, 0x21, REG_LOCAL_BASE_IDX + 29,
+    0x23, 55, 0x21, REG_LOCAL_BASE_IDX + 30,
+    0x23, 56, 0x21, REG_LOCAL_BASE_IDX + 31,
+    0x0b,                    // end
+#endif
+
+    0x03, 0x40,              // loop
+    // the forward branch blocks and the first if follow (tcg_out_tb_start)
 };
 
 static void write_wasm_type_section_size(TCGContext *s, void *header_a_ptr, uint32_t added) {
     uint32_t type_section_size = added + 10;
     fill_uint32_leb128((uintptr_t)header_a_ptr + 9, type_section_size);
-    fill_uint32_leb128((uintptr_t)header_a_ptr + 14, num_helper_funcs + 1);
+    fill_uint32_leb128((uintptr_t)header_a_ptr + 14, num_helper_types + 1);
 }
 static void write_wasm_memory_size(TCGContext *s, void *header_b_ptr) {
-    fill_uint32_leb128((uintptr_t)header_b_ptr + 25, (uint32_t)(~0) / 65536);
+    fill_uint32_leb128((uintptr_t)header_b_ptr + 25, wasm_memory_max_pages());
 }
 static void write_wasm_import_section_size(TCGContext *s, void *header_b_ptr, uint32_t added, uint32_t num_imported_funcs) {
-    uint32_t import_section_size = 35 + added - 11;
+    uint32_t import_section_size = sizeof(mod_header_b) - 6 + added;
     fill_uint32_leb128((uintptr_t)header_b_ptr + 1, import_section_size);
-    fill_uint32_leb128((uintptr_t)header_b_ptr + 6, num_imported_funcs + 1/*buffer+helpers...*/);
+    fill_uint32_leb128((uintptr_t)header_b_ptr + 6, num_imported_funcs + 2/*buffer+table+helpers...*/);
 }
 static void write_wasm_export_section_size(TCGContext *s, void *header_c_ptr, uint32_t startidx) {
-    fill_uint32_leb128((uintptr_t)header_c_ptr + 142, startidx);
+    fill_uint32_leb128((uintptr_t)header_c_ptr + sizeof(mod_header_c) - 5, startidx);
 }
 static void write_wasm_code_size(TCGContext *s, void *header_d_ptr, int code_size, int code_nums) {
-    code_size = code_size + 66;
+    // the section holds the function count, the body size and the body,
+    // which starts after the 16 bytes of these three fields
+    code_size = code_size + sizeof(mod_header_d) - 16 + 10;
     fill_uint32_leb128((uintptr_t)header_d_ptr + 1, code_size);
     fill_uint32_leb128((uintptr_t)header_d_ptr + 6, code_nums);
     fill_uint32_leb128((uintptr_t)header_d_ptr + 11, code_size - 10);
 }
 
+/* Upper bound of the size of the name section written by tcg_out_name_section */
+#define WASM_NAME_SECTION_MAX 160
+
+/*
+ * Writes a "name" custom section naming function func_idx after the guest
+ * code of the TB, which browser profilers show instead of wasm-function[n].
+ * The name is at *name_off from p.
+ */
+static uint8_t *tcg_out_name_section(TCGContext *s, uint8_t *p, uint32_t func_idx,
+                                     uint64_t pc, int *name_off, int *name_len)
+{
+    char name[128];
+    uint8_t sub[WASM_NAME_SECTION_MAX];
+    const char *sym = lookup_symbol(pc);
+    int n, len = 0;
+
+    if (sym[0]) {
+        n = snprintf(name, sizeof(name), "%s@0x%" PRIx64, sym, pc);
+    } else {
+        n = snprintf(name, sizeof(name), "tb@0x%" PRIx64, pc);
+    }
+    n = MIN(n, sizeof(name) - 1);
+
+    len += write_uint32_leb128((uintptr_t)sub + len, 1); // one function
+    len += write_uint32_leb128((uintptr_t)sub + len, func_idx);
+    len += write_uint32_leb128((uintptr_t)sub + len, n);
+    memcpy(sub + len, name, n);
+    *name_len = n;
+    int sub_name_off = len;
+    len += n;
+
+    uint8_t tmp[5];
+    int len_leb = write_uint32_leb128((uintptr_t)tmp, len);
+    uint8_t *base = p;
+    *p++ = 0x00; // custom section
+    p += write_uint32_leb128((uintptr_t)p, 1 + 4 + 1 + len_leb + len);
+    *p++ = 4;
+    memcpy(p, "name", 4);
+    p += 4;
+    *p++ = 0x01; // function names
+    p += write_uint32_leb128((uintptr_t)p, len);
+    *name_off = p - base + sub_name_off;
+    memcpy(p, sub, len);
+    return p + len;
+}
+
 uint8_t *tcg_out_import_entry(TCGContext *s, uint8_t* wasm_blob_ptr, int i, int typeidx)
 {
     *wasm_blob_ptr++ = 6; // helper
@@ -6109,7 +6381,7 @@ uint8_t *tcg_out_import_entry(TCGContext *s, uint8_t* wasm_blob_ptr, int i, int
     memcpy(wasm_blob_ptr, buf, n);
     wasm_blob_ptr += n;
     *wasm_blob_ptr++ = 0x00;    //type(0)
-    *wasm_blob_ptr++ = typeidx; //typeidx
+    wasm_blob_ptr += write_uint32_leb128((uintptr_t)wasm_blob_ptr, typeidx);
     return wasm_blob_ptr;
 }
 
@@ -6393,21 +6665,30 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     s->code_ptr = s->code_buf;
 
 #if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+    if (unlikely(sub_buf == NULL)) {
+        tcg_sub_buf_grow(SUB_BUF_INIT_SIZE);
+    }
     sub_buf_ptr = sub_buf;
+    wasm_skip_emit = wasm_lazy_enabled && !wasm_tb_is_hot(tb);
     tcg_out_init();
     num_helper_funcs = 0;
+    wasm_call_sites_num = 0;
+    wasm_helper_calls_num = 0;
     wasm_block_idx = 0;
     block_ptr_placeholder_idx_pos = 0;
     target_helper_types_pos = 0;
-    memset(label_to_block, -1, LABEL_MAX);
-    memset(target_helper_funcs, -1, WASM_NUM_HELPER_FUNCS_MAX);
+    num_helper_types = 0;
+    label_to_block = tcg_malloc(sizeof(int) * (s->nb_labels + 1));
+    for (i = 0; i <= s->nb_labels; i++) {
+        label_to_block[i] = -1;
+    }
 
     uint32_t *tci_code_off = (uint32_t*)s->code_ptr;
     s->code_ptr += 4;
     uint32_t *size_base = (uint32_t*)s->code_ptr;
     s->code_ptr += 4;
     uint32_t *export_vec_base = (uint32_t*)s->code_ptr;
-    int export_size = get_core_nums() * 4;
+    int export_size = get_core_nums() * sizeof(void *);
     memset(s->code_ptr, 0, export_size);
     s->code_ptr += export_size;
     *size_base = export_size;
@@ -6418,7 +6699,14 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     memset(s->code_ptr, 0, counter_size);
     s->code_ptr += counter_size;
     *size_base = counter_size;
-    
+
+    // threshold, tier and code cache key of the TB, filled after codegen
+    size_base = (uint32_t*)s->code_ptr;
+    s->code_ptr += 4;
+    uint32_t *tier_vec = (uint32_t*)s->code_ptr;
+    s->code_ptr += 16;
+    *size_base = 16;
+
     uint8_t *code_begin = s->code_ptr;
     s->code_ptr += 4; // placeholder for size
     *tci_code_off = s->code_ptr - s->code_buf;
@@ -6504,6 +6792,12 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
         if (unlikely(tcg_current_code_size(s) > UINT16_MAX)) {
             return -2;
         }
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+        /* Likewise for a wasm body the engine would refuse to compile.  */
+        if (unlikely(sub_buf_ptr - sub_buf > WASM_FUNC_BODY_MAX)) {
+            return -2;
+        }
+#endif
     }
     tcg_debug_assert(num_insns + 1 == s->gen_tb->icount);
     s->gen_insn_end_off[num_insns] = tcg_current_code_size(s);
@@ -6539,9 +6833,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     tcg_sub_out8(s, 0x0b); //end func
 
     // fill blocks
-    for (int i = 0; i < block_ptr_placeholder_idx_pos; i++) {
+    for (int i = 0; !wasm_skip_emit && (i < block_ptr_placeholder_idx_pos); i++) {
         int label = block_ptr_placeholder[i].label;
-        int ph = block_ptr_placeholder[i].ptr;
+        uintptr_t ph = (uintptr_t)(sub_buf + block_ptr_placeholder[i].off);
         int blk = label_to_block[label];
         tcg_debug_assert(blk >= 0);
         *(uint8_t*)ph = 0x80;
@@ -6551,6 +6845,18 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     int code_size = (uint32_t)((uintptr_t)s->code_ptr - (uintptr_t)code_begin - 4);
     *(uint32_t *)code_begin = code_size;
 
+    wasm_init_tb_tier(tier_vec, tb, wasm_helper_calls_num);
+
+    if (wasm_skip_emit) {
+        // TCI only: empty wasm module, import vec and batch vec
+        if (unlikely(((void *)s->code_ptr + 12) > s->code_gen_highwater)) {
+            return -1;
+        }
+        memset(s->code_ptr, 0, 12);
+        s->code_ptr += 12;
+        return tcg_current_code_size(s);
+    }
+
     int sub_buf_len = sub_buf_ptr - sub_buf;
     int wasm_body_size = sub_buf_len;
 
@@ -6576,10 +6882,14 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     memcpy(wasm_blob_ptr, mod_header_b, sizeof(mod_header_b));
     wasm_blob_ptr += sizeof(mod_header_b);
     uint8_t *header_b_adding_base = wasm_blob_ptr;
+    if (unlikely(((void *)wasm_blob_ptr + num_helper_funcs * 24) > s->code_gen_highwater)) {
+        return -1;
+    }
     for (int i = 0; i < num_helper_funcs; i++) {
-        wasm_blob_ptr = tcg_out_import_entry(s, wasm_blob_ptr, i, i+1/*type0=start,1=helpers...*/);
+        wasm_blob_ptr = tcg_out_import_entry(s, wasm_blob_ptr, i,
+                                             target_helper_type_idx[i] + 1/*type0=start,1=helpers...*/);
     }
-    write_wasm_import_section_size(s, header_b_base, (uint32_t)wasm_blob_ptr - (uint32_t)header_b_adding_base, num_helper_funcs);
+    write_wasm_import_section_size(s, header_b_base, wasm_blob_ptr - header_b_adding_base, num_helper_funcs);
     write_wasm_memory_size(s, header_b_base);
 
     if (unlikely(((void *)wasm_blob_ptr + sizeof(mod_header_c)) > s->code_gen_highwater)) {
@@ -6606,11 +6916,18 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     memcpy(s->code_ptr, sub_buf, sub_buf_len);
     s->code_ptr += sub_buf_len;
 
-    // write blob size
-    if (sub_buf_len > SUB_BUF_MAX) {
-        printf("sub too large sub_buf_len: %d\n", sub_buf_len); fflush(stdout);
-        exit(1);
+    int name_off = 0, name_len = 0;
+    if (wasm_names_enabled) {
+        if (unlikely(((void *)s->code_ptr + WASM_NAME_SECTION_MAX) > s->code_gen_highwater)) {
+            return -1;
+        }
+        uint8_t *name_base = s->code_ptr;
+        s->code_ptr = tcg_out_name_section(s, s->code_ptr, num_helper_funcs,
+                                           pc_start, &name_off, &name_len);
+        name_off += name_base - (wasm_blob_ptr_base + 4);
     }
+
+    // write blob size
     *(uint32_t *)wasm_blob_ptr_base = s->code_ptr - wasm_blob_ptr_base - 4;
 
     // record importing helper functions
@@ -6622,10 +6939,55 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
     memcpy(s->code_ptr, target_helper_funcs, num_helper_funcs * 4);
     s->code_ptr += num_helper_funcs * 4;
     *size_base = num_helper_funcs * 4;
-    
+
+    // record the layout of the module for batching (see wasm32.c)
+    // types off, types size, body off, body size, call sites num, call sites...,
+    // name off, name size (0 if there is no name section), type of each helper
+    int batch_vec_size = 0;
+    if (wasm_call_sites_num >= 0) {
+        batch_vec_size = (7 + wasm_call_sites_num + num_helper_funcs) * 4;
+    }
+    if (unlikely(((void *)s->code_ptr + 4 + batch_vec_size) > s->code_gen_highwater)) {
+        return -1;
+    }
+    size_base = (uint32_t*)s->code_ptr;
+    s->code_ptr += 4;
+    *size_base = batch_vec_size;
+    if (batch_vec_size > 0) {
+        uint8_t *mod_begin = wasm_blob_ptr_base + 4;
+        uint32_t body_head_size = sizeof(mod_header_d) - 16;
+        uint32_t *batch_vec = (uint32_t*)s->code_ptr;
+        batch_vec[0] = header_a_base + sizeof(mod_header_a) - mod_begin;
+        batch_vec[1] = target_helper_types_pos;
+        batch_vec[2] = header_d_ptr + 16 - mod_begin;
+        batch_vec[3] = body_head_size + sub_buf_len;
+        batch_vec[4] = wasm_call_sites_num;
+        for (int i = 0; i < wasm_call_sites_num; i++) {
+            batch_vec[5 + i] = body_head_size + wasm_call_sites[i];
+        }
+        batch_vec[5 + wasm_call_sites_num] = name_off;
+        batch_vec[6 + wasm_call_sites_num] = name_len;
+        memcpy(&batch_vec[7 + wasm_call_sites_num], target_helper_type_idx,
+               num_helper_funcs * 4);
+        s->code_ptr += batch_vec_size;
+    }
+
     if (unlikely((void *)s->code_ptr > s->code_gen_highwater)) {
         return -1;
     }
+
+    if (wasm_transient_modules_enabled) {
+        // leave only a pointer to the module, see wasm_mod_pool_add
+        uint32_t mod_size = *(uint32_t *)wasm_blob_ptr_base;
+        uint8_t *tail = wasm_blob_ptr_base + 4 + mod_size;
+        size_t tail_size = s->code_ptr - tail;
+        void *blob = wasm_mod_pool_add(wasm_blob_ptr_base + 4, mod_size);
+
+        *(uint32_t *)wasm_blob_ptr_base = WASM_MOD_TRANSIENT;
+        *wasm_mod_transient_ptr((uint32_t *)wasm_blob_ptr_base) = blob;
+        memmove(wasm_blob_ptr_base + WASM_MOD_TRANSIENT_SIZE, tail, tail_size);
+        s->code_ptr = wasm_blob_ptr_base + WASM_MOD_TRANSIENT_SIZE + tail_size;
+    }
 #endif
 
     return tcg_current_code_size(s);
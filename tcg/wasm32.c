@@ -25,182 +25,1987 @@
 #include "exec/cpu_ldst.h"
 #include "tcg/tcg-op.h"
 #include "tcg/tcg-ldst.h"
+#include "exec/exec-all.h"
+#include "exec/translation-block.h"
 #include <string.h>
 #include <emscripten.h>
 #include <emscripten/threading.h>
+#include <emscripten/heap.h>
 #include "wasm32.h"
+#include "../accel/tcg/tb-context.h"
+#include "qemu/crc32c.h"
+#include "qemu/xxhash.h"
+#include "hw/core/cpu.h"
+#include "qemu/timer.h"
+#include "qemu/rcu.h"
+#include "qemu/heap-account.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#ifndef CONFIG_USER_ONLY
+#include "migration/vmstate.h"
+#include "sysemu/stats.h"
+#endif
+
+__thread uintptr_t tci_tb_ptr;
+
+/* Disassemble TCI bytecode. */
+int print_insn_tci(bfd_vma addr, disassemble_info *info)
+{
+    return 0; //nop
+}
+
+/* The module and the helper vec are found by get_wasm_tb_layout */
+EM_JS(int, instantiate_wasm, (const void *mod_ptr, int mod_size, const void *helper_vec_ptr, int helpers_num, int mod_id, int gen), {
+        const memory_v = new DataView(wasmMemory.buffer);
+        mod_ptr = Module.__wasm32_tb.ptr(mod_ptr);
+        helper_vec_ptr = Module.__wasm32_tb.ptr(helper_vec_ptr);
+
+        const tb_ptr = Module.__wasm32_tb.get_ptr(memory_v, Module.__wasm32_tb.tb_ptr_ptr);
+
+        // Create a full copy of the bytes instead of a subarray view to fix Firefox compatibility
+        // See: https://bugzilla.mozilla.org/show_bug.cgi?id=1965217
+        const wasmBytes = new Uint8Array(wasmMemory.buffer).slice(mod_ptr, mod_ptr + mod_size);
+        
+        var hidx = [];
+        for (var i = 0; i < helpers_num; i++) {
+            hidx[i] = memory_v.getInt32(helper_vec_ptr + i * 4, true);
+        }
+        const mod = new WebAssembly.Module(wasmBytes);
+        const inst = new WebAssembly.Instance(mod, Module.__wasm32_tb.imports_for(hidx));
+
+        Module.__wasm32_tb.insts[mod_id] = inst;
+        Module.__wasm32_tb.share(gen, [tb_ptr], ["start"], mod, hidx);
+
+        return Module.__wasm32_tb.add_func(inst.exports.start);
+});
+
+EM_JS(void, instantiate_wasm_batch, (const void *mod_ptr, int mod_size, const void *helper_vec_ptr, int helpers_num, int funcs_num, int *fidx_vec_ptr, int mod_id, void **tbs_ptr, int gen), {
+        const memory_v = new DataView(wasmMemory.buffer);
+        mod_ptr = Module.__wasm32_tb.ptr(mod_ptr);
+        helper_vec_ptr = Module.__wasm32_tb.ptr(helper_vec_ptr);
+        fidx_vec_ptr = Module.__wasm32_tb.ptr(fidx_vec_ptr);
+        tbs_ptr = Module.__wasm32_tb.ptr(tbs_ptr);
+
+        // Same as instantiate_wasm, copy the bytes for Firefox compatibility
+        const wasmBytes = new Uint8Array(wasmMemory.buffer).slice(mod_ptr, mod_ptr + mod_size);
+
+        var hidx = [];
+        for (var i = 0; i < helpers_num; i++) {
+            hidx[i] = memory_v.getInt32(helper_vec_ptr + i * 4, true);
+        }
+        const mod = new WebAssembly.Module(wasmBytes);
+        const inst = new WebAssembly.Instance(mod, Module.__wasm32_tb.imports_for(hidx));
+
+        Module.__wasm32_tb.insts[mod_id] = inst;
+        Module.__wasm32_tb.share_batch(gen, tbs_ptr, funcs_num, mod, hidx);
+
+        for (var i = 0; i < funcs_num; i++) {
+            memory_v.setInt32(fidx_vec_ptr + i * 4, Module.__wasm32_tb.add_func(inst.exports["f" + i]), true);
+        }
+});
+
+/*
+ * Asynchronous variant of instantiate_wasm_batch. The module is compiled
+ * by WebAssembly.compile in the background and the instance is queued in
+ * Module.__wasm32_tb.ready once the thread returns to its event loop.
+ * publish_wasm_job then adds the functions to the table.
+ */
+EM_JS(void, compile_wasm_async, (int job, const void *mod_ptr, int mod_size, const void *helper_vec_ptr, int helpers_num), {
+        const memory_v = new DataView(wasmMemory.buffer);
+        mod_ptr = Module.__wasm32_tb.ptr(mod_ptr);
+        helper_vec_ptr = Module.__wasm32_tb.ptr(helper_vec_ptr);
+        const wasmBytes = new Uint8Array(wasmMemory.buffer).slice(mod_ptr, mod_ptr + mod_size);
+
+        var hidx = [];
+        for (var i = 0; i < helpers_num; i++) {
+            hidx[i] = memory_v.getInt32(helper_vec_ptr + i * 4, true);
+        }
+        var mod = null;
+        const done = (inst) => {
+            Module.__wasm32_tb.ready.push({job: job, inst: inst, mod: mod, hidx: hidx});
+            const memory_v = new DataView(wasmMemory.buffer);
+            let v = memory_v.getInt32(Module.__wasm32_tb.compile_ready_num_ptr, true);
+            memory_v.setInt32(Module.__wasm32_tb.compile_ready_num_ptr, v + 1, true);
+        };
+        WebAssembly.compile(wasmBytes).then((m) => {
+                mod = m;
+                return WebAssembly.instantiate(m, Module.__wasm32_tb.imports_for(hidx));
+            }).then(done, () => done(null));
+});
+
+EM_JS(int, peek_wasm_job, (), {
+        if (Module.__wasm32_tb.ready.length == 0) {
+            return -1;
+        }
+        return Module.__wasm32_tb.ready[0].job;
+});
+
+/* Returns the number of functions added to the table (0 on failure) */
+EM_JS(int, publish_wasm_job, (int funcs_num, int *fidx_vec_ptr, int keep, int mod_id, void **tbs_ptr, int gen), {
+        const memory_v = new DataView(wasmMemory.buffer);
+        fidx_vec_ptr = Module.__wasm32_tb.ptr(fidx_vec_ptr);
+        tbs_ptr = Module.__wasm32_tb.ptr(tbs_ptr);
+        const e = Module.__wasm32_tb.ready.shift();
+        let v = memory_v.getInt32(Module.__wasm32_tb.compile_ready_num_ptr, true);
+        memory_v.setInt32(Module.__wasm32_tb.compile_ready_num_ptr, v - 1, true);
+        if ((e.inst == null) || !keep) {
+            return 0;
+        }
+        Module.__wasm32_tb.insts[mod_id] = e.inst;
+        Module.__wasm32_tb.share_batch(gen, tbs_ptr, funcs_num, e.mod, e.hidx);
+        for (var i = 0; i < funcs_num; i++) {
+            memory_v.setInt32(fidx_vec_ptr + i * 4, Module.__wasm32_tb.add_func(e.inst.exports["f" + i]), true);
+        }
+        return funcs_num;
+});
+
+/*
+ * Instantiates the module received from another vCPU thread which contains
+ * the TB. Returns the table index of its function or 0 if there is none.
+ */
+EM_JS(int, instantiate_shared_wasm, (const void *tb_ptr, int gen, int mod_id), {
+        const tb = Module.__wasm32_tb;
+        if ((tb.chan == null) || ((gen >>> 0) != tb.shared_gen)) {
+            return 0;
+        }
+        const e = tb.shared.get(tb.ptr(tb_ptr));
+        if (e === undefined) {
+            return 0;
+        }
+        const inst = new WebAssembly.Instance(e.mod, tb.imports_for(e.hidx));
+        tb.insts[mod_id] = inst;
+        return tb.add_func(inst.exports[e.name]);
+});
+
+bool wasm_shared_modules_enabled;
+bool wasm_names_enabled;
+bool wasm_marks_enabled;
+bool wasm_lazy_enabled;
+bool wasm_ram_window_enabled;
+bool wasm_transient_modules_enabled;
+bool wasm_jit_enabled = true;
+bool wasm_guest_bounds_enabled = true;
+bool wasm_tso_enabled;
+bool wasm_exit_stats_enabled;
+static unsigned wasm_tb_promoted;
+static unsigned wasm_instance_shared;
+static size_t wasm_mod_pool_bytes;
+static unsigned wasm_mod_released;
+
+__thread bool initdone = false;
+__thread int cur_core_num = -1;
+__thread int export_vec_off = -1;
+__thread int counter_vec_off = -1;
+__thread int tier_vec_off = -1;
+// tier_vec_off is the same in all threads, for those that don't have it set
+static int wasm_tier_vec_off = -1;
+__thread int all_cores_num = -1;
+int cur_core_num_max = 0;
+
+/* The table slot is reused by the next add_func of this thread */
+EM_JS(void, remove_func_js, (int fidx), {
+        wasmTable.set(Module.__wasm32_tb.tidx(fidx), null);
+        Module.__wasm32_tb.free_slots.push(fidx);
+});
+
+/* Drops the last reference to the instance so the JS GC can reclaim it */
+EM_JS(void, release_module_js, (int mod_id), {
+        delete Module.__wasm32_tb.insts[mod_id];
+});
+
+#define MAX_INSTANCE_ALIVE 15000
+/* Number of functions evicted at once when the limit is reached */
+#define WASM_EVICT_NUM 256
+/* Assumed size of a function whose module was already released */
+#define WASM_EVICT_SIZE_UNKNOWN 1024
+
+int instance_alive_global = 0;
+static unsigned wasm_instance_evicted;
+
+/*
+ * log2 histograms reported by "info jit": bucket n counts the values
+ * below 2^n. The first two are for the functions alive, the last one for
+ * the functions evicted.
+ */
+static unsigned wasm_alive_bytes_hist[WASM_STATS_HIST_BUCKETS];
+static unsigned wasm_alive_cost_hist[WASM_STATS_HIST_BUCKETS];    // ns
+static unsigned wasm_evicted_execs_hist[WASM_STATS_HIST_BUCKETS];
+
+static inline int wasm_hist_bucket(uint64_t v)
+{
+    return MIN(64 - clz64(v), WASM_STATS_HIST_BUCKETS - 1);
+}
+
+/* Tiering statistics reported by "info jit" */
+static unsigned wasm_tier_translated[WASM_TIER_NUM];
+static unsigned wasm_tier_instantiated[WASM_TIER_NUM];
+static unsigned wasm_tier_loop_found;
+
+static const char *wasm_tier_names[WASM_TIER_NUM] = {
+    [WASM_TIER_DEFAULT] = "default",
+    [WASM_TIER_LOOP] = "loop",
+    [WASM_TIER_HELPER] = "helper",
+    [WASM_TIER_NEVER] = "never",
+    [WASM_TIER_CACHED] = "cached",
+};
+
+static const int32_t wasm_tier_thresholds[WASM_TIER_NUM] = {
+    [WASM_TIER_DEFAULT] = INSTANTIATE_NUM,
+    [WASM_TIER_LOOP] = WASM_TIER_LOOP_THRESHOLD,
+    [WASM_TIER_HELPER] = WASM_TIER_HELPER_THRESHOLD,
+    [WASM_TIER_NEVER] = WASM_TIER_NEVER_THRESHOLD,
+    [WASM_TIER_CACHED] = 0,
+};
+
+void wasm_init_tb_tier(uint32_t *tier_vec, TranslationBlock *tb, int helper_calls)
+{
+    int tier = WASM_TIER_DEFAULT;
+    int icount = tb->icount;
+    if (!wasm_jit_enabled || (tb_cflags(tb) & CF_NOIRQ)) {
+        tier = WASM_TIER_NEVER;
+    } else if (tb_page_smc_hot(tb_page_addr0(tb))) {
+        tier = WASM_TIER_NEVER; // the guest rewrites it before a module pays off
+    } else if (helper_calls * WASM_TIER_HELPER_DENSITY > icount) {
+        tier = WASM_TIER_HELPER;
+    }
+    tier_vec[0] = wasm_tier_thresholds[tier];
+    tier_vec[1] = tier;
+    tier_vec[2] = 0; // no code cache key
+    tier_vec[3] = 0;
+    qatomic_inc(&wasm_tier_translated[tier]);
+}
+
+static inline int32_t tb_threshold(void *tb_ptr)
+{
+    return *(int32_t*)((uintptr_t)tb_ptr + tier_vec_off);
+}
+
+static inline uint32_t tb_tier(void *tb_ptr)
+{
+    return *(uint32_t*)((uintptr_t)tb_ptr + tier_vec_off + 4);
+}
+
+/* Moves a TB of a loop found by TCI to WASM_TIER_LOOP */
+static void tb_found_loop(void *tb_ptr)
+{
+    uint32_t tier = tb_tier(tb_ptr);
+    if ((tier == WASM_TIER_DEFAULT) || (tier == WASM_TIER_HELPER)) {
+        // racy with other vCPUs but all of them write the same values
+        *(int32_t*)((uintptr_t)tb_ptr + tier_vec_off) = WASM_TIER_LOOP_THRESHOLD;
+        *(uint32_t*)((uintptr_t)tb_ptr + tier_vec_off + 4) = WASM_TIER_LOOP;
+        qatomic_inc(&wasm_tier_loop_found);
+    }
+}
+
+/*
+ * Trace formation
+ *
+ * TCI remembers the TBs it went through by chained jumps since it was
+ * entered. When a jump goes back to one of them, the TBs from there on
+ * are the body of a loop whose branches split it into several TBs: all
+ * of them go to WASM_TIER_LOOP, and the body becomes the hot trace of
+ * the thread, which is queued for batch compilation in one go as soon as
+ * one of its TBs gets hot. The whole loop then runs in a single module,
+ * its TBs tail-calling each other (see tcg_wasm_out_chain_tb), instead of
+ * going back and forth between TCI and wasm.
+ */
+__thread static void *trace_tbs[WASM_TRACE_LEN];
+__thread static int trace_len;
+__thread static void *hot_trace[WASM_TRACE_LEN];
+__thread static int hot_trace_len;
+__thread static unsigned hot_trace_flush_count;
+static unsigned wasm_trace_found;
+
+/* Called by TCI on each chained jump from tb_ptr to next */
+static void tb_trace_edge(void *tb_ptr, void *next)
+{
+    if (next == tb_ptr) {
+        tb_found_loop(tb_ptr);
+        trace_len = 0;
+        return;
+    }
+    if (trace_len == 0 || trace_tbs[trace_len - 1] != tb_ptr) {
+        if (trace_len == WASM_TRACE_LEN) {
+            memmove(trace_tbs, trace_tbs + 1, sizeof(trace_tbs[0]) * --trace_len);
+        }
+        trace_tbs[trace_len++] = tb_ptr;
+    }
+    for (int i = trace_len - 1; i >= 0; i--) {
+        if (trace_tbs[i] != next) {
+            continue;
+        }
+        hot_trace_len = trace_len - i;
+        memcpy(hot_trace, trace_tbs + i, sizeof(hot_trace[0]) * hot_trace_len);
+        hot_trace_flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+        for (int j = 0; j < hot_trace_len; j++) {
+            tb_found_loop(hot_trace[j]);
+        }
+        qatomic_inc(&wasm_trace_found);
+        trace_len = 0;
+        return;
+    }
+}
+
+/* Statistics */
+
+static WasmJitStats wasm_stats_vcpus[WASM_STATS_VCPUS_MAX];
+static WasmJitStats wasm_stats_overflow; // vCPUs beyond WASM_STATS_VCPUS_MAX
+__thread static WasmJitStats *wasm_stats = &wasm_stats_overflow;
+
+static WasmJitStats *wasm32_vcpu_stats(int cpu_index)
+{
+    if ((cpu_index < 0) || (cpu_index >= WASM_STATS_VCPUS_MAX)) {
+        return &wasm_stats_overflow;
+    }
+    return &wasm_stats_vcpus[cpu_index];
+}
+
+/* Adds a User Timing entry ending now, shown by the browser profiler */
+EM_JS(void, wasm_mark_js, (const char *label, double dur_ms), {
+        if (typeof performance != "undefined" && performance.measure) {
+            const end = performance.now();
+            performance.measure(UTF8ToString(label), {start: end - dur_ms, end: end});
+        }
+});
+
+/* Returns how long the compilation took, in ns */
+static uint64_t wasm_stats_compile_done(int64_t start, const char *label)
+{
+    uint64_t ns = MAX(get_clock() - start, 0);
+
+    wasm_stats->compile_ns += ns;
+    wasm_stats->compile_hist[wasm_hist_bucket(ns)]++;
+    if (wasm_marks_enabled) {
+        wasm_mark_js(label, ns / 1e6);
+    }
+    return ns;
+}
+
+/*
+ * qemu_ld/st descriptors, see WasmLdstDesc.  Entries are only appended,
+ * and an entry is written before any code holding its index is published,
+ * so the interpreter reads them without locking.
+ */
+static WasmLdstDesc wasm_ldst_descs[1 << WASM_LDST_DESC_BITS];
+static unsigned wasm_ldst_desc_num;
+static uint64_t wasm_ldst_page_mask;
+static unsigned wasm_ldst_tlb_shift;
+static GHashTable *wasm_ldst_desc_table;  // WasmLdstDesc * -> index + 1
+static QemuMutex wasm_ldst_desc_lock;
+
+static guint wasm_ldst_desc_hash(gconstpointer p)
+{
+    uint32_t w[3];
+
+    QEMU_BUILD_BUG_ON(sizeof(WasmLdstDesc) != sizeof(w));
+    memcpy(w, p, sizeof(w));
+    return qemu_xxhash4(deposit64(w[0], 32, 32, w[1]), w[2]);
+}
+
+static gboolean wasm_ldst_desc_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(WasmLdstDesc));
+}
+
+static gpointer wasm_ldst_desc_init(gpointer data)
+{
+    qemu_mutex_init(&wasm_ldst_desc_lock);
+    wasm_ldst_desc_table = g_hash_table_new(wasm_ldst_desc_hash,
+                                            wasm_ldst_desc_equal);
+    return NULL;
+}
+
+uint32_t wasm_ldst_desc_index(const WasmLdstDesc *desc, uint64_t page_mask,
+                              unsigned tlb_shift)
+{
+    static GOnce desc_once = G_ONCE_INIT;
+    gpointer val;
+    uint32_t idx;
+
+    g_once(&desc_once, wasm_ldst_desc_init, NULL);
+    QEMU_LOCK_GUARD(&wasm_ldst_desc_lock);
+
+    if (!wasm_ldst_desc_num) {
+        wasm_ldst_page_mask = page_mask;
+        wasm_ldst_tlb_shift = tlb_shift;
+    }
+    tcg_debug_assert(page_mask == wasm_ldst_page_mask &&
+                     tlb_shift == wasm_ldst_tlb_shift);
+
+    val = g_hash_table_lookup(wasm_ldst_desc_table, desc);
+    if (val) {
+        return GPOINTER_TO_UINT(val) - 1;
+    }
+    if (wasm_ldst_desc_num == ARRAY_SIZE(wasm_ldst_descs)) {
+        /* Takes thousands of distinct MemOps per mmu index */
+        error_report("wasm32: out of qemu_ld/st descriptors");
+        abort();
+    }
+    idx = wasm_ldst_desc_num;
+    wasm_ldst_descs[idx] = *desc;
+    g_hash_table_insert(wasm_ldst_desc_table, &wasm_ldst_descs[idx],
+                        GUINT_TO_POINTER(idx + 1));
+    qatomic_set(&wasm_ldst_desc_num, idx + 1);
+    return idx;
+}
+
+static void wasm32_dump_hist(GString *buf, const char *label, const unsigned *hist)
+{
+    g_string_append_printf(buf, "%-19s", label);
+    for (int i = 0; i < WASM_STATS_HIST_BUCKETS; i++) {
+        unsigned v = qatomic_read(&hist[i]);
+        if (v) {
+            g_string_append_printf(buf, " %d:%u", i, v);
+        }
+    }
+    g_string_append_c(buf, '\n');
+}
+
+void wasm32_dump_info(GString *buf)
+{
+    g_string_append_printf(buf, "\nWasm tiers:\n");
+    for (int i = 0; i < WASM_TIER_NUM; i++) {
+        g_string_append_printf(buf, "%-8s threshold %-10d translated %-8u instantiated %u\n",
+                               wasm_tier_names[i], wasm_tier_thresholds[i],
+                               qatomic_read(&wasm_tier_translated[i]),
+                               qatomic_read(&wasm_tier_instantiated[i]));
+    }
+    g_string_append_printf(buf, "loops found in TCI  %u\n",
+                           qatomic_read(&wasm_tier_loop_found));
+    g_string_append_printf(buf, "traces found in TCI %u\n",
+                           qatomic_read(&wasm_trace_found));
+    g_string_append_printf(buf, "functions alive     %d/%d\n",
+                           qatomic_read(&instance_alive_global), MAX_INSTANCE_ALIVE);
+    g_string_append_printf(buf, "functions evicted   %u\n",
+                           qatomic_read(&wasm_instance_evicted));
+    g_string_append_printf(buf, "ld/st descriptors   %u (%zu bytes each)\n",
+                           qatomic_read(&wasm_ldst_desc_num),
+                           sizeof(WasmLdstDesc));
+    g_string_append_printf(buf, "log2 histograms, n:count counts the values below 2^n\n");
+    wasm32_dump_hist(buf, "  alive bytes", wasm_alive_bytes_hist);
+    wasm32_dump_hist(buf, "  alive cost (ns)", wasm_alive_cost_hist);
+    wasm32_dump_hist(buf, "  evicted execs", wasm_evicted_execs_hist);
+    /* The break only moves up, so this is the high-water mark of the heap */
+    g_string_append_printf(buf, "heap high water     %" PRIuPTR " KiB\n",
+                           (uintptr_t)sbrk(0) / 1024);
+    if (wasm_shared_modules_enabled) {
+        g_string_append_printf(buf, "shared instantiated %u\n",
+                               qatomic_read(&wasm_instance_shared));
+    }
+    if (wasm_lazy_enabled) {
+        g_string_append_printf(buf, "retranslated hot   %u\n",
+                               qatomic_read(&wasm_tb_promoted));
+    }
+    if (wasm_transient_modules_enabled) {
+        g_string_append_printf(buf, "transient modules   %zu bytes (released %u)\n",
+                               qatomic_read(&wasm_mod_pool_bytes),
+                               qatomic_read(&wasm_mod_released));
+    }
+
+    CPUState *cpu;
+    CPU_FOREACH(cpu) {
+        const WasmJitStats *st = wasm32_vcpu_stats(cpu->cpu_index);
+        if (st == &wasm_stats_overflow) {
+            continue;
+        }
+        g_string_append_printf(buf, "vCPU %-3d TBs %-12" PRIu64 " wasm %" PRIu64 "%%"
+                               " instantiated %-8" PRIu64 " evicted %-8" PRIu64
+                               " refused %" PRIu64 "\n", cpu->cpu_index, st->tb_execs,
+                               st->tb_execs ? st->wasm_execs * 100 / st->tb_execs : 0,
+                               st->instantiated, st->evicted, st->refused);
+        g_string_append_printf(buf, "         compile time %" PRIu64 " us"
+                               " modules %" PRIu64 " bytes\n",
+                               st->compile_ns / 1000, st->module_bytes);
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+static StatsList *wasm32_stats_add(StatsList *list, strList *names,
+                                   const char *name, uint64_t v)
+{
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    Stats *stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = v;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsList *wasm32_stats_add_hist(StatsList *list, strList *names,
+                                        const char *name, const uint64_t *hist)
+{
+    uint64List *val_list = NULL;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    for (int i = WASM_STATS_HIST_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(val_list, hist[i]);
+    }
+    Stats *stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = val_list;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void wasm32_query_stats_cb(StatsResultList **result, StatsTarget target,
+                                  strList *names, strList *targets, Error **errp)
+{
+    StatsList *list = NULL;
+    CPUState *cpu;
+
+    switch (target) {
+    case STATS_TARGET_VM:
+        list = wasm32_stats_add(list, names, "functions-alive",
+                                qatomic_read(&instance_alive_global));
+        list = wasm32_stats_add(list, names, "functions-evicted",
+                                qatomic_read(&wasm_instance_evicted));
+        list = wasm32_stats_add(list, names, "shared-instantiated",
+                                qatomic_read(&wasm_instance_shared));
+        list = wasm32_stats_add(list, names, "loops-found",
+                                qatomic_read(&wasm_tier_loop_found));
+        for (int i = 0; i < WASM_TIER_NUM; i++) {
+            g_autofree char *t = g_strdup_printf("translated-%s", wasm_tier_names[i]);
+            g_autofree char *n = g_strdup_printf("instantiated-%s", wasm_tier_names[i]);
+            list = wasm32_stats_add(list, names, t,
+                                    qatomic_read(&wasm_tier_translated[i]));
+            list = wasm32_stats_add(list, names, n,
+                                    qatomic_read(&wasm_tier_instantiated[i]));
+        }
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_TCG, NULL, list);
+        }
+        break;
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            const WasmJitStats *st = wasm32_vcpu_stats(cpu->cpu_index);
+            if ((st == &wasm_stats_overflow) ||
+                !apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
+                continue;
+            }
+            list = NULL;
+            list = wasm32_stats_add(list, names, "tci-execs",
+                                    st->tb_execs - st->wasm_execs);
+            list = wasm32_stats_add(list, names, "wasm-execs", st->wasm_execs);
+            list = wasm32_stats_add(list, names, "instantiated", st->instantiated);
+            list = wasm32_stats_add(list, names, "evicted", st->evicted);
+            list = wasm32_stats_add(list, names, "refused", st->refused);
+            list = wasm32_stats_add(list, names, "compile-time", st->compile_ns);
+            list = wasm32_stats_add(list, names, "module-bytes", st->module_bytes);
+            list = wasm32_stats_add_hist(list, names, "compile-time-histogram",
+                                         st->compile_hist);
+            if (list) {
+                add_stats_entry(result, STATS_PROVIDER_TCG,
+                                cpu->parent_obj.canonical_path, list);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static StatsSchemaValueList *wasm32_schema_add(StatsSchemaValueList *list,
+                                               const char *name, StatsType type,
+                                               bool ns)
+{
+    StatsSchemaValueList *entry = g_new0(StatsSchemaValueList, 1);
+
+    entry->value = g_new0(StatsSchemaValue, 1);
+    entry->value->name = g_strdup(name);
+    entry->value->type = type;
+    if (ns) {
+        entry->value->has_unit = true;
+        entry->value->unit = STATS_UNIT_SECONDS;
+        entry->value->has_base = true;
+        entry->value->base = 10;
+        entry->value->exponent = -9;
+    }
+    entry->next = list;
+    return entry;
+}
+
+static void wasm32_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = wasm32_schema_add(list, "functions-alive", STATS_TYPE_INSTANT, false);
+    list = wasm32_schema_add(list, "functions-evicted", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "shared-instantiated", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "loops-found", STATS_TYPE_CUMULATIVE, false);
+    for (int i = 0; i < WASM_TIER_NUM; i++) {
+        g_autofree char *t = g_strdup_printf("translated-%s", wasm_tier_names[i]);
+        g_autofree char *n = g_strdup_printf("instantiated-%s", wasm_tier_names[i]);
+        list = wasm32_schema_add(list, t, STATS_TYPE_INSTANT, false);
+        list = wasm32_schema_add(list, n, STATS_TYPE_INSTANT, false);
+    }
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VM, list);
+
+    list = NULL;
+    list = wasm32_schema_add(list, "tci-execs", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "wasm-execs", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "instantiated", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "evicted", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "refused", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "compile-time", STATS_TYPE_CUMULATIVE, true);
+    list = wasm32_schema_add(list, "module-bytes", STATS_TYPE_CUMULATIVE, false);
+    list = wasm32_schema_add(list, "compile-time-histogram",
+                             STATS_TYPE_LOG2_HISTOGRAM, true);
+    add_stats_schema(result, STATS_PROVIDER_TCG, STATS_TARGET_VCPU, list);
+}
+#endif
+
+void wasm32_stats_init(void)
+{
+#ifndef CONFIG_USER_ONLY
+    add_stats_callbacks(STATS_PROVIDER_TCG, wasm32_query_stats_cb,
+                        wasm32_query_stats_schemas_cb);
+#endif
+}
+
+/* Persistent code cache */
+
+bool wasm_code_cache_enabled;
+__thread static int wasm_code_cache_loaded;
+
+EM_JS(void, wasm_code_cache_open_js, (const char *name, int *loaded_ptr), {
+        const loaded = () => {
+            const memory_v = new DataView(wasmMemory.buffer);
+            memory_v.setInt32(Number(loaded_ptr), 1, true);
+        };
+        Module.__wasm32_cache = {
+            hot: new Set(),
+            db: null,
+        };
+        if (typeof indexedDB == "undefined") {
+            loaded();
+            return;
+        }
+        const req = indexedDB.open(UTF8ToString(name), 1);
+        req.onupgradeneeded = () => req.result.createObjectStore("hot");
+        req.onerror = loaded;
+        req.onsuccess = () => {
+            const db = req.result;
+            Module.__wasm32_cache.db = db;
+            const keys = db.transaction("hot", "readonly").objectStore("hot").getAllKeys();
+            keys.onsuccess = () => {
+                for (const k of keys.result) {
+                    Module.__wasm32_cache.hot.add(k);
+                }
+                loaded();
+            };
+            keys.onerror = loaded;
+        };
+});
+
+EM_JS(int, wasm_code_cache_lookup_js, (uint32_t key_lo, uint32_t key_hi), {
+        if (!Module.__wasm32_cache) {
+            return 0;
+        }
+        const k = (key_hi >>> 0).toString(16) + ":" + (key_lo >>> 0).toString(16);
+        return Module.__wasm32_cache.hot.has(k) ? 1 : 0;
+});
+
+EM_JS(void, wasm_code_cache_update_js, (uint32_t key_lo, uint32_t key_hi, int add), {
+        const c = Module.__wasm32_cache;
+        if (!c) {
+            return;
+        }
+        const k = (key_hi >>> 0).toString(16) + ":" + (key_lo >>> 0).toString(16);
+        if (c.hot.has(k) == !!add) {
+            return;
+        }
+        if (add) {
+            c.hot.add(k);
+        } else {
+            c.hot.delete(k);
+        }
+        if (c.db) {
+            // committed once the thread returns to its event loop
+            const store = c.db.transaction("hot", "readwrite").objectStore("hot");
+            if (add) {
+                store.put(1, k);
+            } else {
+                store.delete(k);
+            }
+        }
+});
+
+/*
+ * Bundles of hot keys
+ *
+ * A bundle is a text file: a "qemu-wasm-bundle <version> <cpu model>" line
+ * followed by one key per line, written as in the IndexedDB store.
+ */
+
+#define WASM_BUNDLE_MAGIC "qemu-wasm-bundle"
+
+char *wasm_bundle_in;
+char *wasm_bundle_out;
+bool wasm_snapshot_hot_enabled;
+// read-only once loaded, only added to with the vCPUs stopped by loadvm
+static GHashTable *wasm_bundle_keys;
+static GHashTable *wasm_bundle_hot;  // compiled in this session
+static QemuMutex wasm_bundle_lock;
+// keys invalidated out of a vCPU thread, dropped by the next vCPU to add one
+static GArray *wasm_code_cache_dropped;
+
+static bool wasm_code_cache_keyed(void)
+{
+    return wasm_code_cache_enabled || wasm_bundle_in || wasm_bundle_out ||
+           wasm_snapshot_hot_enabled || qatomic_read(&wasm_bundle_keys);
+}
+
+static char *wasm_bundle_header(void)
+{
+    return g_strdup_printf(WASM_BUNDLE_MAGIC " %s %s", QEMU_VERSION,
+                           object_get_typename(OBJECT(first_cpu)));
+}
+
+static bool wasm_bundle_parse_key(const char *line, uint64_t *key)
+{
+    unsigned int hi, lo;
+    char end;
+
+    if (sscanf(line, "%x:%x%c", &hi, &lo, &end) != 2) {
+        return false;
+    }
+    *key = deposit64(lo, 32, 32, hi);
+    return true;
+}
+
+static void wasm_bundle_load(void)
+{
+    g_autofree char *contents = NULL;
+    g_autofree char *header = wasm_bundle_header();
+    g_autoptr(GError) err = NULL;
+    g_auto(GStrv) lines = NULL;
+
+    if (!g_file_get_contents(wasm_bundle_in, &contents, NULL, &err)) {
+        warn_report("Could not read wasm bundle %s: %s", wasm_bundle_in,
+                    err->message);
+        return;
+    }
+    lines = g_strsplit(contents, "\n", -1);
+    if (!lines[0] || strcmp(lines[0], header)) {
+        warn_report("wasm bundle %s was not written for %s, ignored",
+                    wasm_bundle_in, header + strlen(WASM_BUNDLE_MAGIC " "));
+        return;
+    }
+    wasm_bundle_keys = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                             g_free, NULL);
+    for (int i = 1; lines[i]; i++) {
+        uint64_t key;
+
+        if (wasm_bundle_parse_key(lines[i], &key)) {
+            g_hash_table_add(wasm_bundle_keys, g_memdup2(&key, sizeof(key)));
+        }
+    }
+}
+
+static gpointer wasm_bundle_init(gpointer data)
+{
+    qemu_mutex_init(&wasm_bundle_lock);
+    if (wasm_code_cache_enabled) {
+        wasm_code_cache_dropped = g_array_new(false, false, sizeof(uint64_t));
+    }
+    if (wasm_bundle_in) {
+        wasm_bundle_load();
+    }
+    if (wasm_bundle_out || wasm_snapshot_hot_enabled) {
+        wasm_bundle_hot = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                                g_free, NULL);
+    }
+    return NULL;
+}
+
+static void wasm_bundle_init_once(void)
+{
+    static GOnce bundle_once = G_ONCE_INIT;
+
+    g_once(&bundle_once, wasm_bundle_init, NULL);
+}
+
+static bool wasm_bundle_lookup(uint32_t key_lo, uint32_t key_hi)
+{
+    uint64_t key = deposit64(key_lo, 32, 32, key_hi);
+
+    return wasm_bundle_keys && g_hash_table_contains(wasm_bundle_keys, &key);
+}
+
+static void wasm_bundle_update(uint32_t key_lo, uint32_t key_hi, bool add)
+{
+    uint64_t key = deposit64(key_lo, 32, 32, key_hi);
+
+    if (!wasm_bundle_hot) {
+        return;
+    }
+    qemu_mutex_lock(&wasm_bundle_lock);
+    if (add) {
+        g_hash_table_add(wasm_bundle_hot, g_memdup2(&key, sizeof(key)));
+    } else {
+        g_hash_table_remove(wasm_bundle_hot, &key);
+    }
+    qemu_mutex_unlock(&wasm_bundle_lock);
+}
+
+void wasm_bundle_save(void)
+{
+    g_autofree char *header = NULL;
+    g_autoptr(GError) err = NULL;
+    g_autoptr(GString) buf = NULL;
+    GHashTableIter iter;
+    gpointer key;
+
+    if (!wasm_bundle_hot) {
+        // no vCPU ever ran
+        return;
+    }
+    header = wasm_bundle_header();
+    buf = g_string_new(header);
+    g_string_append_c(buf, '\n');
+
+    qemu_mutex_lock(&wasm_bundle_lock);
+    g_hash_table_iter_init(&iter, wasm_bundle_hot);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        uint64_t k = *(uint64_t *)key;
+        g_string_append_printf(buf, "%x:%x\n", (uint32_t)(k >> 32), (uint32_t)k);
+    }
+    qemu_mutex_unlock(&wasm_bundle_lock);
+
+    if (!g_file_set_contents(wasm_bundle_out, buf->str, buf->len, &err)) {
+        warn_report("Could not write wasm bundle %s: %s", wasm_bundle_out,
+                    err->message);
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * Hot TBs in snapshots (-accel tcg,wasm-snapshot-hot=on)
+ *
+ * The keys of the TBs compiled to wasm go into the migration stream, and
+ * on load they are added to those of the bundle, so that the hot code of
+ * the resumed guest skips the TCI tier right away.
+ */
+typedef struct WasmHotTBs {
+    uint32_t header_len;
+    uint8_t *header;
+    uint32_t nb_keys;
+    uint64_t *keys;
+} WasmHotTBs;
+
+static WasmHotTBs wasm_hot_tbs;
+
+static bool wasm_hot_tbs_needed(void *opaque)
+{
+    return wasm_snapshot_hot_enabled && wasm_bundle_hot;
+}
+
+static int wasm_hot_tbs_pre_save(void *opaque)
+{
+    WasmHotTBs *s = opaque;
+    GHashTableIter iter;
+    gpointer key;
+
+    s->header = (uint8_t *)wasm_bundle_header();
+    s->header_len = strlen((char *)s->header);
+
+    qemu_mutex_lock(&wasm_bundle_lock);
+    s->nb_keys = 0;
+    s->keys = g_new(uint64_t, g_hash_table_size(wasm_bundle_hot));
+    g_hash_table_iter_init(&iter, wasm_bundle_hot);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        s->keys[s->nb_keys++] = *(uint64_t *)key;
+    }
+    qemu_mutex_unlock(&wasm_bundle_lock);
+    return 0;
+}
+
+static void wasm_hot_tbs_free(WasmHotTBs *s)
+{
+    g_free(s->header);
+    g_free(s->keys);
+    s->header = NULL;
+    s->keys = NULL;
+}
+
+static int wasm_hot_tbs_post_save(void *opaque)
+{
+    wasm_hot_tbs_free(opaque);
+    return 0;
+}
+
+static int wasm_hot_tbs_post_load(void *opaque, int version_id)
+{
+    WasmHotTBs *s = opaque;
+    g_autofree char *header = wasm_bundle_header();
+    GHashTable *keys;
+
+    /* Only a hint, a snapshot of another build still loads */
+    if (s->header_len != strlen(header) ||
+        memcmp(s->header, header, s->header_len)) {
+        warn_report("hot TBs of the snapshot were not recorded for %s, "
+                    "ignored", header + strlen(WASM_BUNDLE_MAGIC " "));
+        goto out;
+    }
+
+    wasm_bundle_init_once();
+    keys = wasm_bundle_keys ?: g_hash_table_new_full(g_int64_hash,
+                                                     g_int64_equal,
+                                                     g_free, NULL);
+    for (uint32_t i = 0; i < s->nb_keys; i++) {
+        g_hash_table_add(keys, g_memdup2(&s->keys[i], sizeof(uint64_t)));
+    }
+    qatomic_set(&wasm_bundle_keys, keys);
+
+out:
+    wasm_hot_tbs_free(s);
+    return 0;
+}
+
+static const VMStateDescription vmstate_wasm_hot_tbs = {
+    .name = "wasm-hot-tbs",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = wasm_hot_tbs_needed,
+    .pre_save = wasm_hot_tbs_pre_save,
+    .post_save = wasm_hot_tbs_post_save,
+    .post_load = wasm_hot_tbs_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(header_len, WasmHotTBs),
+        VMSTATE_VBUFFER_ALLOC_UINT32(header, WasmHotTBs, 0, NULL,
+                                     header_len),
+        VMSTATE_UINT32(nb_keys, WasmHotTBs),
+        VMSTATE_VARRAY_UINT32_ALLOC(keys, WasmHotTBs, nb_keys, 0,
+                                    vmstate_info_uint64, uint64_t),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+void wasm_snapshot_hot_init(void)
+{
+    /* Registered either way, so that any snapshot with the section loads */
+    vmstate_register(NULL, 0, &vmstate_wasm_hot_tbs, &wasm_hot_tbs);
+}
+#endif
+
+static void wasm_code_cache_init(void)
+{
+    g_autofree char *name = g_strdup_printf("qemu-wasm-tb-%s-%s", QEMU_VERSION,
+                                            object_get_typename(OBJECT(first_cpu)));
+    wasm_code_cache_open_js(name, &wasm_code_cache_loaded);
+    // wait for the keys to be loaded (or give up after a while)
+    for (int i = 0; (i < 100) && !wasm_code_cache_loaded; i++) {
+        emscripten_sleep(10);
+    }
+}
+
+void wasm_code_cache_tb(TranslationBlock *tb, uint64_t pc, void *host_pc)
+{
+    // only TBs in a single RAM page can be hashed by their guest code
+    if (!wasm_code_cache_keyed() || (tier_vec_off < 0) || !host_pc ||
+        (tb_page_addr1(tb) != -1)) {
+        return;
+    }
+    uint32_t *tier_vec = (uint32_t*)((uintptr_t)tb->tc.ptr + tier_vec_off);
+    uint32_t key_hi = crc32c(0xffffffff, host_pc, tb->size);
+    uint32_t key_lo = qemu_xxhash7(pc, tb->cs_base, tb->flags,
+                                   tb_cflags(tb) & ~CF_INVALID, key_hi);
+    if ((key_lo | key_hi) == 0) {
+        key_lo = 1;
+    }
+    tier_vec[2] = key_lo;
+    tier_vec[3] = key_hi;
+    if ((tier_vec[1] != WASM_TIER_NEVER) &&
+        (wasm_bundle_lookup(key_lo, key_hi) ||
+         (wasm_code_cache_enabled && wasm_code_cache_lookup_js(key_lo, key_hi)))) {
+        qatomic_dec(&wasm_tier_translated[tier_vec[1]]);
+        tier_vec[0] = wasm_tier_thresholds[WASM_TIER_CACHED];
+        tier_vec[1] = WASM_TIER_CACHED;
+        qatomic_inc(&wasm_tier_translated[WASM_TIER_CACHED]);
+    }
+}
+
+static void wasm_code_cache_flush_dropped(void)
+{
+    if (!wasm_code_cache_dropped ||
+        !qatomic_read(&wasm_code_cache_dropped->len)) {
+        return;
+    }
+    qemu_mutex_lock(&wasm_bundle_lock);
+    for (guint i = 0; i < wasm_code_cache_dropped->len; i++) {
+        uint64_t key = g_array_index(wasm_code_cache_dropped, uint64_t, i);
+        wasm_code_cache_update_js((uint32_t)key, key >> 32, 0);
+    }
+    g_array_set_size(wasm_code_cache_dropped, 0);
+    qemu_mutex_unlock(&wasm_bundle_lock);
+}
+
+static void wasm_code_cache_add(void *tb_ptr)
+{
+    uint32_t *tier_vec = (uint32_t*)((uintptr_t)tb_ptr + tier_vec_off);
+    // before adding, so that a key translated again stays in the cache
+    wasm_code_cache_flush_dropped();
+    if ((tier_vec[2] | tier_vec[3]) == 0) {
+        return;
+    }
+    if (wasm_code_cache_enabled && (tier_vec[1] != WASM_TIER_CACHED)) {
+        wasm_code_cache_update_js(tier_vec[2], tier_vec[3], 1);
+    }
+    // TBs taken from a bundle go into the next one as well
+    wasm_bundle_update(tier_vec[2], tier_vec[3], true);
+}
+
+void wasm_code_cache_invalidate(TranslationBlock *tb)
+{
+    int off = tier_vec_off > 0 ? tier_vec_off : qatomic_read(&wasm_tier_vec_off);
+    if (off <= 0) {
+        return;
+    }
+    uint32_t *tier_vec = (uint32_t*)((uintptr_t)tb->tc.ptr + off);
+    if ((tier_vec[2] | tier_vec[3]) == 0) {
+        return;
+    }
+    if (wasm_code_cache_enabled && (tier_vec_off <= 0)) {
+        // the cache is only open in the vCPU threads, let one of them drop it
+        uint64_t key = deposit64(tier_vec[2], 32, 32, tier_vec[3]);
+
+        qemu_mutex_lock(&wasm_bundle_lock);
+        g_array_append_val(wasm_code_cache_dropped, key);
+        qemu_mutex_unlock(&wasm_bundle_lock);
+    } else if (wasm_code_cache_enabled) {
+        wasm_code_cache_update_js(tier_vec[2], tier_vec[3], 0);
+    }
+    wasm_bundle_update(tier_vec[2], tier_vec[3], false);
+}
+
+/*
+ * Instance lifetime
+ *
+ * Every TB function in the table has an instance_info owned by the thread
+ * that added it. Functions of a batch share one instance, which is
+ * refcounted by wasm_module_ref and released as soon as its last function
+ * is evicted.
+ *
+ * When the global limit is reached, functions are evicted by GreedyDual-
+ * Size with frequency: each one is worth what it costs to rebuild per byte
+ * it takes, times the log2 of how often it was entered since promotion.
+ * Its priority is that worth on top of the clock, the priority of the
+ * last function evicted, and it is brought up to date by the sweep if the
+ * TB was entered since the previous one (execs is counted by chained jumps
+ * too, see tcg_wasm_out_chain_tb). The cheapest functions go first, and
+ * the ones left untouched age as the clock goes up.
+ */
+struct instance_info {
+    uint8_t *tb;  // NULL if the entry is free
+    int fidx;
+    uint32_t execs;      // entries since promotion
+    int mod_id;
+    uint32_t size;       // bytes of its wasm module
+    uint32_t cost_ns;    // time to compile and instantiate it
+    uint32_t execs_seen; // execs at the last sweep
+    double prio;
+};
+
+/* Read by tcg_wasm_out_chain_tb */
+QEMU_BUILD_BUG_ON(offsetof(struct instance_info, tb) != INSTANCE_INFO_TB_OFF);
+QEMU_BUILD_BUG_ON(offsetof(struct instance_info, fidx) != INSTANCE_INFO_FIDX_OFF);
+QEMU_BUILD_BUG_ON(offsetof(struct instance_info, execs) != INSTANCE_INFO_EXECS_OFF);
+
+struct wasm_module_ref {
+    int refs;
+};
+
+__thread struct instance_info instance_running[MAX_INSTANCE_ALIVE];
+__thread static int instance_free[MAX_INSTANCE_ALIVE];
+__thread static int instance_free_num = -1;
+__thread static int instance_running_local = 0;
+__thread static double instance_clock;
+__thread static int instance_evict_order[MAX_INSTANCE_ALIVE];
+
+__thread static struct wasm_module_ref module_refs[MAX_INSTANCE_ALIVE];
+__thread static int module_free[MAX_INSTANCE_ALIVE];
+__thread static int module_free_num = -1;
+
+static void init_instance_pool(void)
+{
+    instance_free_num = MAX_INSTANCE_ALIVE;
+    module_free_num = MAX_INSTANCE_ALIVE;
+    for (int i = 0; i < MAX_INSTANCE_ALIVE; i++) {
+        instance_free[i] = MAX_INSTANCE_ALIVE - 1 - i;
+        module_free[i] = MAX_INSTANCE_ALIVE - 1 - i;
+    }
+}
+
+static bool can_add_instance()
+{
+    return qatomic_read(&instance_alive_global) < MAX_INSTANCE_ALIVE;
+}
+
+/* Returns the id of a new module with "refs" functions or -1 */
+static int alloc_module(int refs)
+{
+    if ((module_free_num == 0) || (instance_free_num < refs)) {
+        return -1;
+    }
+    int mod_id = module_free[--module_free_num];
+    module_refs[mod_id].refs = refs;
+    return mod_id;
+}
+
+static void put_module(int mod_id)
+{
+    if (--module_refs[mod_id].refs == 0) {
+        release_module_js(mod_id);
+        module_free[module_free_num++] = mod_id;
+    }
+}
+
+static double instance_worth(const struct instance_info *elm)
+{
+    return (double)(elm->cost_ns + 1) * (64 - clz64(elm->execs)) / elm->size;
+}
+
+static void evict_instance(struct instance_info *elm)
+{
+    qatomic_dec(&wasm_alive_bytes_hist[wasm_hist_bucket(elm->size)]);
+    qatomic_dec(&wasm_alive_cost_hist[wasm_hist_bucket(elm->cost_ns)]);
+    qatomic_inc(&wasm_evicted_execs_hist[wasm_hist_bucket(elm->execs)]);
+    elm->tb = NULL;
+    remove_func_js(elm->fidx);
+    put_module(elm->mod_id);
+    instance_free[instance_free_num++] = elm - instance_running;
+    instance_running_local--;
+    qatomic_dec(&instance_alive_global);
+    qatomic_inc(&wasm_instance_evicted);
+    wasm_stats->evicted++;
+}
+
+static int instance_prio_cmp(const void *a, const void *b)
+{
+    double pa = instance_running[*(const int *)a].prio;
+    double pb = instance_running[*(const int *)b].prio;
+
+    return (pa > pb) - (pa < pb);
+}
+
+/* Evicts the "n" functions of this thread which are the cheapest to keep out */
+static void evict_instances(int n)
+{
+    int num = 0;
+
+    if (instance_running_local == 0) {
+        return;
+    }
+    for (int i = 0; i < MAX_INSTANCE_ALIVE; i++) {
+        struct instance_info *elm = &instance_running[i];
+        if (elm->tb == NULL) {
+            continue;
+        }
+        if (elm->execs != elm->execs_seen) {
+            elm->execs_seen = elm->execs;
+            elm->prio = instance_clock + instance_worth(elm);
+        }
+        instance_evict_order[num++] = i;
+    }
+    qsort(instance_evict_order, num, sizeof(instance_evict_order[0]),
+          instance_prio_cmp);
+    for (int i = 0; i < MIN(n, num); i++) {
+        struct instance_info *elm = &instance_running[instance_evict_order[i]];
+        instance_clock = MAX(instance_clock, elm->prio);
+        evict_instance(elm);
+    }
+}
+
+static void wasm_mod_release(void *tb_ptr);
+static uint32_t tb_wasm_size(void *tb_ptr);
+
+/* cost_ns is the share of the TB in the compilation of its module */
+static void add_instance_running_local(int fidx, void *tb_ptr, int mod_id,
+                                       uint64_t cost_ns)
+{
+    struct instance_info *elm = &instance_running[instance_free[--instance_free_num]];
+    uint32_t size = tb_wasm_size(tb_ptr);
+
+    elm->tb = tb_ptr;
+    elm->fidx = fidx;
+    elm->execs = 1;
+    elm->mod_id = mod_id;
+    elm->size = size ? size : WASM_EVICT_SIZE_UNKNOWN;
+    elm->cost_ns = MIN(cost_ns, UINT32_MAX);
+    elm->execs_seen = elm->execs;
+    elm->prio = instance_clock + instance_worth(elm);
+    qatomic_inc(&wasm_alive_bytes_hist[wasm_hist_bucket(elm->size)]);
+    qatomic_inc(&wasm_alive_cost_hist[wasm_hist_bucket(elm->cost_ns)]);
+
+    uintptr_t tb_export_ptr = (uintptr_t)tb_ptr + export_vec_off;
+    *(struct instance_info **)tb_export_ptr = elm;
+
+    instance_running_local++;
+    wasm_stats->instantiated++;
+    qatomic_inc(&wasm_tier_instantiated[tb_tier(tb_ptr)]);
+    wasm_code_cache_add(tb_ptr);
+    wasm_mod_release(tb_ptr);
+    qatomic_inc(&instance_alive_global);
+}
+
+static int get_instance_running_local(void *tb_ptr)
+{
+    uintptr_t tb_export_ptr = (uintptr_t)tb_ptr + export_vec_off;
+    struct instance_info *elm = *(struct instance_info **)tb_export_ptr;
+    if (elm == NULL) {
+        return 0;
+    }
+    if (elm->tb != tb_ptr) {
+        *(struct instance_info **)tb_export_ptr = NULL;
+        uintptr_t tb_counter_ptr = (uintptr_t)tb_ptr + counter_vec_off;
+        if (*(int32_t*)tb_counter_ptr != WASM_BATCH_QUEUED) {
+            *(uint32_t*)tb_counter_ptr = tb_threshold(tb_ptr); // will be instanciated immediately
+        }
+        return 0;
+    }
+    elm->execs++;
+    return elm->fidx;
+}
+
+/* Instantiates a module shared by another vCPU thread; returns 0 if none */
+static int instantiate_shared(void *tb_ptr)
+{
+    int mod_id = alloc_module(1);
+    if (mod_id < 0) {
+        return 0;
+    }
+    int64_t start = get_clock();
+    int fidx = instantiate_shared_wasm(tb_ptr, qatomic_read(&tb_ctx.tb_flush_count), mod_id);
+    if (fidx == 0) {
+        module_free[module_free_num++] = mod_id;
+        return 0;
+    }
+    uint64_t ns = wasm_stats_compile_done(start, "wasm32: instantiate shared module");
+    add_instance_running_local(fidx, tb_ptr, mod_id, ns);
+    qatomic_inc(&wasm_instance_shared);
+    return fidx;
+}
+
+/*
+ * Batch compilation
+ *
+ * Hot TBs are queued instead of being instantiated one by one. When the
+ * queue is full, the per-TB modules are merged into one module that has a
+ * shared type/import section, the same globals and one exported function
+ * ("f<n>") per TB. tcg_gen_code records where the helper types, the function
+ * body and the "call" operands of each module are (batch vec), so merging
+ * only needs to concatenate them and renumber the helper imports.
+ */
+
+struct wasm_tb_layout {
+    uint32_t *mod_slot;  // module size or WASM_MOD_TRANSIENT
+    uint8_t *mod;        // per-TB wasm module (NULL if released)
+    uint32_t mod_size;
+    uint32_t *helpers;   // imported helper functions
+    uint32_t helpers_num;
+    uint32_t *batch_vec; // NULL if the TB can't be batched
+};
+
+// same as mod_header_c in tcg.c
+#define WASM_GLOBALS_NUM 25
+#define WASM_GLOBALS_V128_NUM 16
+#define WASM_GLOBALS_HI_NUM 16 // TCG_REG_R16..R31, after the v128 globals
+
+__thread static void *batch_queue[WASM_BATCH_NUM];
+__thread static int batch_queue_num = 0;
+__thread static unsigned batch_queue_flush_count;
+__thread static int batch_fidx[WASM_BATCH_NUM];
+
+struct wasm_compile_job {
+    bool used;
+    int n;
+    unsigned flush_count;
+    int64_t start;
+    void *tbs[WASM_BATCH_NUM];
+};
+
+#define WASM_COMPILE_JOBS_MAX 8
+__thread static struct wasm_compile_job compile_jobs[WASM_COMPILE_JOBS_MAX];
+__thread static int compile_jobs_pending = 0;
+__thread int compile_ready_num = 0; // updated by JS
+
+static int alloc_compile_job(void)
+{
+    for (int i = 0; i < WASM_COMPILE_JOBS_MAX; i++) {
+        if (!compile_jobs[i].used) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void get_wasm_tb_layout(void *tb_ptr, struct wasm_tb_layout *l)
+{
+    uint8_t *p = (uint8_t*)tb_ptr + 4;
+    p += 4 + *(uint32_t*)p; // export vec
+    p += 4 + *(uint32_t*)p; // counter vec
+    p += 4 + *(uint32_t*)p; // tier vec
+    p += 4 + *(uint32_t*)p; // tci code
+    l->mod_slot = (uint32_t*)p;
+    if (*(uint32_t*)p == WASM_MOD_TRANSIENT) {
+        struct wasm_mod_blob *b = qatomic_rcu_read(wasm_mod_transient_ptr(l->mod_slot));
+        l->mod = b ? b->data : NULL;
+        l->mod_size = b ? b->size : 0;
+        p += WASM_MOD_TRANSIENT_SIZE; // pointer to the wasm module
+    } else {
+        l->mod = p + 4;
+        l->mod_size = *(uint32_t*)p;
+        p += 4 + l->mod_size; // wasm module
+    }
+    l->helpers_num = *(uint32_t*)p / 4;
+    l->helpers = (uint32_t*)(p + 4);
+    p += 4 + *(uint32_t*)p; // import vec
+    l->batch_vec = (*(uint32_t*)p > 0) ? (uint32_t*)(p + 4) : NULL;
+}
 
-__thread uintptr_t tci_tb_ptr;
+/* Returns false if the TB has no module (wasm-lazy) or it was released */
+static bool get_wasm_tb_module(void *tb_ptr, struct wasm_tb_layout *l)
+{
+    get_wasm_tb_layout(tb_ptr, l);
+    return l->mod_size != 0;
+}
 
-/* Disassemble TCI bytecode. */
-int print_insn_tci(bfd_vma addr, disassemble_info *info)
+static bool tb_has_wasm(void *tb_ptr)
 {
-    return 0; //nop
+    struct wasm_tb_layout l;
+    return get_wasm_tb_module(tb_ptr, &l);
 }
 
-EM_JS(int, instantiate_wasm, (), {
-        const memory_v = new DataView(HEAP8.buffer);
+/* Returns 0 if the module of the TB was already released */
+static uint32_t tb_wasm_size(void *tb_ptr)
+{
+    struct wasm_tb_layout l;
+    get_wasm_tb_layout(tb_ptr, &l);
+    return l.mod_size;
+}
 
-        const tb_ptr = memory_v.getInt32(Module.__wasm32_tb.tb_ptr_ptr, true);
-        const export_vec_size = memory_v.getInt32(tb_ptr + 4, true);
-        const export_vec_begin = tb_ptr + 4 + 4;
+/*
+ * Transient module pool
+ *
+ * Blobs are released with RCU: another vCPU thread may be reading the
+ * module to instantiate the same TB.
+ */
+struct wasm_mod_blob {
+    struct rcu_head rcu;
+    QLIST_ENTRY(wasm_mod_blob) next;
+    uint32_t size;
+    uint8_t data[];
+};
 
-        const counter_vec_size = memory_v.getInt32(export_vec_begin + export_vec_size, true);
-        const counter_vec_begin = export_vec_begin + export_vec_size + 4;
-        
-        const tmp_body_size = memory_v.getInt32(counter_vec_begin + counter_vec_size, true);
-        const tmp_body_begin = counter_vec_begin + counter_vec_size + 4;
-        const wasm_size = memory_v.getInt32(tmp_body_begin + tmp_body_size, true);
-        const wasm_begin = tmp_body_begin + tmp_body_size + 4;
-        const import_vec_size = memory_v.getInt32(wasm_begin + wasm_size, true);
-        const import_vec_begin = wasm_begin + wasm_size + 4;
+static QLIST_HEAD(, wasm_mod_blob) wasm_mod_pool = QLIST_HEAD_INITIALIZER(wasm_mod_pool);
+static QemuSpin wasm_mod_pool_lock;
 
-        // Create a full copy of the bytes instead of a subarray view to fix Firefox compatibility
-        // See: https://bugzilla.mozilla.org/show_bug.cgi?id=1965217
-        const wasmBytes = new Uint8Array(HEAP8.slice(wasm_begin, wasm_begin + wasm_size));
-        
-        var helper = {};
-        for (var i = 0; i < import_vec_size / 4; i++) {
-            helper[i] = wasmTable.get(memory_v.getInt32(import_vec_begin + i * 4, true));
-        }
-        const mod = new WebAssembly.Module(wasmBytes);
-        const inst = new WebAssembly.Instance(mod, {
-                "env": {
-                    "buffer": wasmMemory,
-                        },
-                    "helper": helper,
-                        });
+void *wasm_mod_pool_add(const void *mod, uint32_t size)
+{
+    struct wasm_mod_blob *b = g_malloc(sizeof(*b) + size);
+    b->size = size;
+    memcpy(b->data, mod, size);
+
+    qemu_spin_lock(&wasm_mod_pool_lock);
+    QLIST_INSERT_HEAD(&wasm_mod_pool, b, next);
+    qatomic_set(&wasm_mod_pool_bytes, wasm_mod_pool_bytes + size);
+    qemu_spin_unlock(&wasm_mod_pool_lock);
+    heap_account_add(HEAP_SUBSYSTEM_WASM_MODULES, sizeof(*b) + size);
+    return b;
+}
 
-        Module.__wasm32_tb.inst_gc_registry.register(inst, "instance");
+static void wasm_mod_free(uint32_t *mod_slot)
+{
+    if (*mod_slot != WASM_MOD_TRANSIENT) {
+        return;
+    }
+    struct wasm_mod_blob *b = qatomic_xchg(wasm_mod_transient_ptr(mod_slot), NULL);
+    if (b == NULL) {
+        return;
+    }
+    qemu_spin_lock(&wasm_mod_pool_lock);
+    QLIST_REMOVE(b, next);
+    qatomic_set(&wasm_mod_pool_bytes, wasm_mod_pool_bytes - b->size);
+    qemu_spin_unlock(&wasm_mod_pool_lock);
+    heap_account_sub(HEAP_SUBSYSTEM_WASM_MODULES, sizeof(*b) + b->size);
+    g_free_rcu(b, rcu);
+}
 
-        const fidx = addFunction(inst.exports.start, 'ii');
+/* Drops the module of an instantiated TB; wasm-lazy can retranslate it */
+static void wasm_mod_release(void *tb_ptr)
+{
+    struct wasm_tb_layout l;
+    if (!wasm_lazy_enabled) {
+        return;
+    }
+    get_wasm_tb_layout(tb_ptr, &l);
+    if (*l.mod_slot == WASM_MOD_TRANSIENT && l.mod != NULL) {
+        wasm_mod_free(l.mod_slot);
+        qatomic_inc(&wasm_mod_released);
+    }
+}
 
-        return fidx;
-});
+/* Called by tb_flush, which drops every TB pointing to the pool */
+void wasm_mod_pool_reset(void)
+{
+    struct wasm_mod_blob *b, *nb;
 
-__thread bool initdone = false;
-__thread int cur_core_num = -1;
-__thread int export_vec_off = -1;
-__thread int counter_vec_off = -1;
-__thread int all_cores_num = -1;
-int cur_core_num_max = 0;
+    qemu_spin_lock(&wasm_mod_pool_lock);
+    QLIST_FOREACH_SAFE(b, &wasm_mod_pool, next, nb) {
+        QLIST_REMOVE(b, next);
+        heap_account_sub(HEAP_SUBSYSTEM_WASM_MODULES, sizeof(*b) + b->size);
+        g_free_rcu(b, rcu);
+    }
+    qatomic_set(&wasm_mod_pool_bytes, 0);
+    qemu_spin_unlock(&wasm_mod_pool_lock);
+}
 
-EM_JS(void, remove_module_js, (), {
-        const memory_v = new DataView(HEAP8.buffer);
-        const remove_n = memory_v.getInt32(Module.__wasm32_tb.to_remove_instance_idx_ptr, true);
-        for (var i = 0; i < remove_n * 4; i += 4) {
-            removeFunction(memory_v.getInt32(Module.__wasm32_tb.to_remove_instance_ptr + i, true));
+/*
+ * Heat of a TB for tb_flush_partial, from the per-thread vectors: 2 for
+ * each thread it has a function on, 1 for each thread where it got hot.
+ */
+unsigned wasm_tb_heat(TranslationBlock *tb)
+{
+    uint32_t *p = (uint32_t*)tb->tc.ptr + 1;
+    uint32_t cores = p[0] / sizeof(void *);
+    struct instance_info **exports = (struct instance_info **)(p + 1);
+    uint32_t *counters = (uint32_t *)(exports + cores) + 1;
+    int32_t threshold = *(int32_t*)(counters + cores + 1);
+    unsigned heat = 0;
+
+    for (uint32_t i = 0; i < cores; i++) {
+        int32_t c = counters[i];
+        if (exports[i] != NULL) {
+            heat += 2;
+        } else if ((c == WASM_BATCH_QUEUED) || (c >= threshold)) {
+            heat += 1;
         }
-        memory_v.setInt32(Module.__wasm32_tb.to_remove_instance_idx_ptr, 0, true);
-    });
-
-int instance_alive_global = 0;
-__thread int instance_alive_local = 0;
-__thread int instance_running_local = 0;
-__thread uint32_t instance_garbage_collected_local = 0;
+    }
+    return heat;
+}
 
-struct instance_info {
-    uint8_t *tb;
-    int fidx;
-};
+/* Called by tb_flush_partial on the TBs whose memory is about to be reused */
+void wasm_tb_evict(TranslationBlock *tb)
+{
+    struct wasm_tb_layout l;
+    get_wasm_tb_layout(tb->tc.ptr, &l);
+    wasm_mod_free(l.mod_slot);
+}
 
-#define MAX_INSTANCE_ALIVE 15000
-#define INSTANCE_RUNNING_LEN MAX_INSTANCE_ALIVE
-__thread struct instance_info instance_running[INSTANCE_RUNNING_LEN];
-__thread int instance_running_begin = 0;
-__thread int instance_running_end = 0;
+/*
+ * Lazy wasm translation
+ *
+ * Hot keys are hashes of the TB lookup key in a direct mapped table. A
+ * collision only makes a cold TB carry its wasm module or a hot TB go
+ * through TCI a while longer, so no locking is needed.
+ */
+#define WASM_HOT_KEYS 4096
+static uint32_t wasm_hot_keys[WASM_HOT_KEYS];
 
-#define TO_REMOVE_INSTANCE_SIZE 50000
-__thread static int to_remove_instance[TO_REMOVE_INSTANCE_SIZE];
-__thread static int to_remove_instance_idx = 0;
+static uint32_t wasm_tb_hot_key(TranslationBlock *tb)
+{
+    uint32_t h = qemu_xxhash7(tb_page_addr0(tb), tb->pc, tb->cs_base, tb->flags,
+                              tb_cflags(tb) & ~CF_INVALID);
+    return h | 1;
+}
 
-static bool can_add_instance()
+bool wasm_tb_is_hot(TranslationBlock *tb)
 {
-    return qatomic_read(&instance_alive_global) < MAX_INSTANCE_ALIVE;
+    uint32_t h = wasm_tb_hot_key(tb);
+    return qatomic_read(&wasm_hot_keys[h % WASM_HOT_KEYS]) == h;
 }
 
-static void inc_instance_local()
+/* Retranslates the TB with its wasm module the next time it is looked up */
+static void wasm_promote_tb(void *tb_ptr)
 {
-    instance_running_local++;
-    instance_alive_local++;
+    uintptr_t tb_counter_ptr = (uintptr_t)tb_ptr + counter_vec_off;
+    TranslationBlock *tb = tcg_tb_lookup((uintptr_t)tb_ptr);
+
+    *(int32_t*)tb_counter_ptr = WASM_BATCH_QUEUED; // keep using TCI meanwhile
+    if (tb == NULL || (tb_cflags(tb) & CF_INVALID)) {
+        return;
+    }
+    uint32_t h = wasm_tb_hot_key(tb);
+    qatomic_set(&wasm_hot_keys[h % WASM_HOT_KEYS], h);
+    // not a code change; keep the TB in the persistent code cache
+    uint32_t *tier_vec = (uint32_t*)((uintptr_t)tb_ptr + tier_vec_off);
+    tier_vec[2] = 0;
+    tier_vec[3] = 0;
+    tb_phys_invalidate(tb, -1);
+    qatomic_inc(&wasm_tb_promoted);
 }
 
-static int instance_pending_gc_local()
+static bool tb_is_batchable(void *tb_ptr)
 {
-    return (instance_alive_local - instance_running_local);
+    struct wasm_tb_layout l;
+    get_wasm_tb_layout(tb_ptr, &l);
+    return l.batch_vec != NULL;
 }
 
-static void check_instance_garbage_collected()
+static void batch_out_leb128(GByteArray *b, uint32_t v)
 {
-    if (instance_garbage_collected_local > 0) {
-        if (instance_garbage_collected_local > instance_pending_gc_local()) {
-            printf("unexpected number of removed instances %d > %d",
-                   instance_garbage_collected_local, instance_pending_gc_local()); fflush(stdout);
-            exit(1);
+    uint8_t tmp[5];
+    int n = 0;
+    do {
+        tmp[n] = v & 0x7f;
+        v >>= 7;
+        if (v != 0) {
+            tmp[n] |= 0x80;
         }
-        qatomic_sub(&instance_alive_global, instance_garbage_collected_local);
-        instance_alive_local -= instance_garbage_collected_local;
-        instance_garbage_collected_local = 0;
+        n++;
+    } while (v != 0);
+    g_byte_array_append(b, tmp, n);
+}
+
+static void batch_out_name(GByteArray *b, const char *prefix, int i)
+{
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%s%d", prefix, i);
+    batch_out_leb128(b, n);
+    g_byte_array_append(b, (uint8_t *)buf, n);
+}
+
+static void batch_out_str(GByteArray *b, const char *str)
+{
+    batch_out_leb128(b, strlen(str));
+    g_byte_array_append(b, (const uint8_t *)str, strlen(str));
+}
+
+static void batch_out_section(GByteArray *mod, uint8_t id, GByteArray *sec)
+{
+    g_byte_array_append(mod, &id, 1);
+    batch_out_leb128(mod, sec->len);
+    g_byte_array_append(mod, sec->data, sec->len);
+    g_byte_array_set_size(sec, 0);
+}
+
+/* Length of the func type entry at p */
+static uint32_t batch_type_len(const uint8_t *p)
+{
+    const uint8_t *q = p + 1; // 0x60
+    for (int vec = 0; vec < 2; vec++) { // params, results
+        uint32_t len = 0;
+        int shift = 0;
+        do {
+            len |= (uint32_t)(*q & 0x7f) << shift;
+            shift += 7;
+        } while (*q++ & 0x80);
+        q += len;
     }
+    return q - p;
 }
 
-static void remove_instance_running_local()
+/* Maps the 5-byte fixed width operand of a call instruction through "map" */
+static void batch_remap_call(uint8_t *op, const uint32_t *map)
 {
-    if (instance_pending_gc_local() > 0) {
-        return;
+    uint32_t v = 0;
+    for (int i = 0; i < 5; i++) {
+        v |= (uint32_t)(op[i] & 0x7f) << (i * 7);
     }
-    int to_remove = instance_running_local / 2;
-    for (int i = 0; i < to_remove; i++) {
-        instance_running[instance_running_begin].tb = NULL;
-        to_remove_instance[to_remove_instance_idx++] = instance_running[instance_running_begin].fidx;
-        instance_running_local--;
-        instance_running_begin = (instance_running_begin + 1)%INSTANCE_RUNNING_LEN;
+    v = map[v];
+    for (int i = 0; i < 4; i++) {
+        op[i] = 0x80 | ((v >> (i * 7)) & 0x7f);
     }
-    if (to_remove_instance_idx > 0) {
-        remove_module_js();
+    op[4] = (v >> 28) & 0x0f;
+}
+
+static bool batch_queue_is_stale(void)
+{
+    // TBs queued before tb_flush don't exist anymore
+    return batch_queue_flush_count != qatomic_read(&tb_ctx.tb_flush_count);
+}
+
+/*
+ * Called on TBs queued before tb_flush_count changed. After a partial
+ * flush some of them are still alive and must leave WASM_BATCH_QUEUED.
+ */
+static void release_stale_tbs(void **tbs, int n)
+{
+    for (int i = 0; i < n; i++) {
+        TranslationBlock *tb = tcg_tb_lookup((uintptr_t)tbs[i]);
+        if (tb && (tb->tc.ptr == tbs[i]) && !(tb_cflags(tb) & CF_INVALID)) {
+            *(int32_t*)((uintptr_t)tbs[i] + counter_vec_off) = 0;
+        }
     }
 }
 
-static void add_instance_running_local(int fidx, void *tb_ptr)
+static void compile_wasm_batch(void)
 {
-    instance_running[instance_running_end].tb = tb_ptr;
-    instance_running[instance_running_end].fidx = fidx;
+    static const uint8_t header[] = {
+        0x0, 0x61, 0x73, 0x6d, // magic
+        0x01, 0x0, 0x0, 0x0,   // version
+    };
+    static const uint8_t start_type[] = {
+        0x60, 0x01, WASM_PTR_TYPE, 0x01, WASM_PTR_TYPE
+    };
+    static const uint8_t global_entry[] = { 0x7e, 0x01, 0x42, 0x00, 0x0b };
+    static const uint8_t global_v128_entry[] = {
+        0x7b, 0x01, 0xfd, 0x0c,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x0b
+    };
+    static const uint8_t memory_import[] = { 0x02, WASM_MEMORY_LIMITS, 0x00 };
+    static const uint8_t table_import[] = { 0x01, 0x70, WASM_TABLE_LIMITS, 0x00 };
+    struct wasm_tb_layout l[WASM_BATCH_NUM];
+    int n = batch_queue_num;
+    uint32_t helpers_num = 0;
+
+    if (n == 0) {
+        return;
+    }
+    if (batch_queue_is_stale()) {
+        release_stale_tbs(batch_queue, n);
+        batch_queue_num = 0;
+        return;
+    }
+    // functions of in-flight jobs are counted when published, so the limit
+    // can be exceeded by at most WASM_COMPILE_JOBS_MAX batches.
+    if (qatomic_read(&instance_alive_global) + n > MAX_INSTANCE_ALIVE) {
+        // make room and retry on the next flush
+        wasm_stats->refused += n;
+        evict_instances(n);
+        return;
+    }
+    int job = -1;
+    if (WASM_ASYNC_COMPILE) {
+        job = alloc_compile_job();
+        if (job < 0) {
+            return; // too many compilations in flight; retry later
+        }
+    }
+    batch_queue_num = 0;
+
+    for (int i = 0; i < n; i++) {
+        get_wasm_tb_layout(batch_queue[i], &l[i]);
+        if (l[i].mod == NULL) {
+            // released after another vCPU instantiated it; retranslate
+            wasm_promote_tb(batch_queue[i]);
+            batch_queue[i--] = batch_queue[--n];
+            continue;
+        }
+        helpers_num += l[i].helpers_num;
+    }
+    if (n == 0) {
+        return;
+    }
+    /*
+     * The TBs of a batch mostly call the same helpers: import each helper
+     * once, with one type entry per distinct signature. helper_map takes
+     * the helpers of all TBs, one after the other, to their import.
+     */
+    uint32_t *helpers = g_new(uint32_t, helpers_num + 1);
+    uint32_t *helper_type = g_new(uint32_t, helpers_num + 1);
+    uint32_t *helper_map = g_new(uint32_t, helpers_num + 1);
+    const uint8_t **type_at = g_new(const uint8_t *, helpers_num + 1);
+    GHashTable *helper_set = g_hash_table_new(NULL, NULL);
+    GHashTable *type_set = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                                 (GDestroyNotify)g_bytes_unref,
+                                                 NULL);
+    GByteArray *types = g_byte_array_new();
+    uint32_t imports_num = 0;
+    uint32_t types_num = 0;
+
+    for (int i = 0, k = 0; i < n; i++) {
+        uint32_t *bv = l[i].batch_vec;
+        const uint8_t *tp = l[i].mod + bv[0];
+
+        for (uint32_t t = 0, off = 0; off < bv[1]; t++) {
+            type_at[t] = tp + off;
+            off += batch_type_len(tp + off);
+        }
+        for (int j = 0; j < l[i].helpers_num; j++, k++) {
+            gpointer key = GUINT_TO_POINTER(l[i].helpers[j]);
+            gpointer v;
 
-    int tb_export_ptr = (uint32_t)tb_ptr + export_vec_off;
-    *(uint32_t*)tb_export_ptr = (uint32_t)(&(instance_running[instance_running_end]));
+            if (g_hash_table_lookup_extended(helper_set, key, NULL, &v)) {
+                helper_map[k] = GPOINTER_TO_UINT(v);
+                continue;
+            }
 
-    instance_running_end  = (instance_running_end+1)%INSTANCE_RUNNING_LEN;
-    inc_instance_local();
-    qatomic_inc(&instance_alive_global);
+            const uint8_t *e = type_at[bv[7 + bv[4] + j]];
+            GBytes *entry = g_bytes_new(e, batch_type_len(e));
+            gpointer t;
+
+            if (g_hash_table_lookup_extended(type_set, entry, NULL, &t)) {
+                g_bytes_unref(entry);
+            } else {
+                t = GUINT_TO_POINTER(types_num++);
+                g_byte_array_append(types, e, batch_type_len(e));
+                g_hash_table_insert(type_set, entry, t);
+            }
+            helper_type[imports_num] = GPOINTER_TO_UINT(t);
+            helpers[imports_num] = l[i].helpers[j];
+            g_hash_table_insert(helper_set, key, GUINT_TO_POINTER(imports_num));
+            helper_map[k] = imports_num++;
+        }
+    }
+    g_hash_table_destroy(helper_set);
+    g_hash_table_destroy(type_set);
+    g_free(type_at);
+
+    GByteArray *mod = g_byte_array_new();
+    GByteArray *sec = g_byte_array_new();
+
+    g_byte_array_append(mod, header, sizeof(header));
+
+    // type section: type0 is the entry of TBs, then the helper signatures
+    batch_out_leb128(sec, types_num + 1);
+    g_byte_array_append(sec, start_type, sizeof(start_type));
+    g_byte_array_append(sec, types->data, types->len);
+    g_byte_array_free(types, true);
+    batch_out_section(mod, 0x01, sec);
+
+    // import section
+    batch_out_leb128(sec, imports_num + 2);
+    batch_out_str(sec, "env");
+    batch_out_str(sec, "buffer");
+    g_byte_array_append(sec, memory_import, sizeof(memory_import));
+    batch_out_leb128(sec, wasm_memory_max_pages());
+    batch_out_str(sec, "env");
+    batch_out_str(sec, "table");
+    g_byte_array_append(sec, table_import, sizeof(table_import));
+    for (int k = 0; k < imports_num; k++) {
+        batch_out_str(sec, "helper");
+        batch_out_name(sec, "", k);
+        batch_out_leb128(sec, 0x00); // func
+        batch_out_leb128(sec, helper_type[k] + 1);
+    }
+    batch_out_section(mod, 0x02, sec);
+
+    // function section
+    batch_out_leb128(sec, n);
+    for (int i = 0; i < n; i++) {
+        batch_out_leb128(sec, 0);
+    }
+    batch_out_section(mod, 0x03, sec);
+
+    // global section
+    batch_out_leb128(sec, WASM_GLOBALS_NUM + WASM_GLOBALS_V128_NUM +
+                     WASM_GLOBALS_HI_NUM);
+    for (int i = 0; i < WASM_GLOBALS_NUM; i++) {
+        g_byte_array_append(sec, global_entry, sizeof(global_entry));
+    }
+    for (int i = 0; i < WASM_GLOBALS_V128_NUM; i++) {
+        g_byte_array_append(sec, global_v128_entry, sizeof(global_v128_entry));
+    }
+    for (int i = 0; i < WASM_GLOBALS_HI_NUM; i++) {
+        g_byte_array_append(sec, global_entry, sizeof(global_entry));
+    }
+    batch_out_section(mod, 0x06, sec);
+
+    // export section
+    batch_out_leb128(sec, n);
+    for (int i = 0; i < n; i++) {
+        batch_out_name(sec, "f", i);
+        batch_out_leb128(sec, 0x00); // func
+        batch_out_leb128(sec, imports_num + i);
+    }
+    batch_out_section(mod, 0x07, sec);
+
+    // code section
+    batch_out_leb128(sec, n);
+    for (int i = 0, base = 0; i < n; i++) {
+        uint32_t *bv = l[i].batch_vec;
+        batch_out_leb128(sec, bv[3]);
+        int body_off = sec->len;
+        g_byte_array_append(sec, l[i].mod + bv[2], bv[3]);
+        for (int c = 0; c < bv[4]; c++) {
+            batch_remap_call(sec->data + body_off + bv[5 + c], helper_map + base);
+        }
+        base += l[i].helpers_num;
+    }
+    batch_out_section(mod, 0x0a, sec);
+
+    // name section with the function names of the TBs (tcg_out_name_section)
+    int named = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t *bv = l[i].batch_vec;
+        if (bv[6 + bv[4]] > 0) {
+            named++;
+        }
+    }
+    if (named > 0) {
+        static const uint8_t func_names = 0x01;
+        GByteArray *names = g_byte_array_new();
+        batch_out_leb128(sec, named);
+        for (int i = 0; i < n; i++) {
+            uint32_t *bv = l[i].batch_vec;
+            if (bv[6 + bv[4]] > 0) {
+                batch_out_leb128(sec, imports_num + i);
+                batch_out_leb128(sec, bv[6 + bv[4]]);
+                g_byte_array_append(sec, l[i].mod + bv[5 + bv[4]], bv[6 + bv[4]]);
+            }
+        }
+        batch_out_str(names, "name");
+        g_byte_array_append(names, &func_names, 1);
+        batch_out_leb128(names, sec->len);
+        g_byte_array_append(names, sec->data, sec->len);
+        g_byte_array_set_size(sec, 0);
+        batch_out_section(mod, 0x00, names);
+        g_byte_array_free(names, true);
+    }
+
+    if (WASM_ASYNC_COMPILE) {
+        // TBs stay queued (executed by TCI) until publish_wasm_jobs
+        compile_jobs[job].used = true;
+        compile_jobs[job].n = n;
+        compile_jobs[job].flush_count = batch_queue_flush_count;
+        compile_jobs[job].start = get_clock();
+        memcpy(compile_jobs[job].tbs, batch_queue, n * sizeof(void *));
+        compile_jobs_pending++;
+        wasm_stats->module_bytes += mod->len;
+        compile_wasm_async(job, mod->data, mod->len, helpers, imports_num);
+    } else {
+        int mod_id = alloc_module(n);
+        tcg_debug_assert(mod_id >= 0);
+        int64_t start = get_clock();
+        wasm_stats->module_bytes += mod->len;
+        instantiate_wasm_batch(mod->data, mod->len, helpers, imports_num, n, batch_fidx, mod_id,
+                               batch_queue, batch_queue_flush_count);
+        uint64_t ns = wasm_stats_compile_done(start, "wasm32: compile batch");
+        for (int i = 0; i < n; i++) {
+            add_instance_running_local(batch_fidx[i], batch_queue[i], mod_id, ns / n);
+            uintptr_t tb_counter_ptr = (uintptr_t)batch_queue[i] + counter_vec_off;
+            *(int32_t*)tb_counter_ptr = tb_threshold(batch_queue[i]); // leave TCI on the next entry
+        }
+    }
 
+    g_byte_array_free(sec, true);
+    g_byte_array_free(mod, true);
+    g_free(helpers);
+    g_free(helper_type);
+    g_free(helper_map);
 }
 
-static int get_instance_running_local(void *tb_ptr)
+/* Registers the functions of the background compilations finished so far */
+static void publish_wasm_jobs(void)
 {
-    int tb_export_ptr = (uint32_t)tb_ptr + export_vec_off;
-    struct instance_info *elm = (struct instance_info *)(*(uint32_t*)tb_export_ptr);
-    if (elm == NULL) {
-        return 0;
+    while (compile_ready_num > 0) {
+        int job = peek_wasm_job();
+        tcg_debug_assert(job >= 0 && job < WASM_COMPILE_JOBS_MAX);
+        struct wasm_compile_job *j = &compile_jobs[job];
+
+        // TBs of the job are gone if tb_flush happened during compilation
+        bool keep = j->flush_count == qatomic_read(&tb_ctx.tb_flush_count);
+        int mod_id = keep ? alloc_module(j->n) : -1;
+        int added = publish_wasm_job(j->n, batch_fidx, mod_id >= 0, mod_id,
+                                     j->tbs, j->flush_count);
+        uint64_t ns = 0;
+        if (added > 0) {
+            // includes the time waiting for this thread to return here
+            ns = wasm_stats_compile_done(j->start, "wasm32: compile batch (async)");
+        }
+        if (keep) {
+            for (int i = 0; i < j->n; i++) {
+                uintptr_t tb_counter_ptr = (uintptr_t)j->tbs[i] + counter_vec_off;
+                if (added > 0) {
+                    add_instance_running_local(batch_fidx[i], j->tbs[i], mod_id, ns / j->n);
+                    *(int32_t*)tb_counter_ptr = tb_threshold(j->tbs[i]); // leave TCI on the next entry
+                } else {
+                    *(int32_t*)tb_counter_ptr = 0; // compilation failed; retry later
+                }
+            }
+        } else {
+            release_stale_tbs(j->tbs, j->n);
+        }
+        j->used = false;
+        compile_jobs_pending--;
     }
-    if (elm->tb != tb_ptr) {
-        *(uint32_t*)tb_export_ptr = 0;
-        int tb_counter_ptr = (uint32_t)tb_ptr + counter_vec_off;
-        *(uint32_t*)tb_counter_ptr = INSTANTIATE_NUM; // will be instanciated immediately
-        return 0;
+}
+
+static void enqueue_wasm_batch(void *tb_ptr)
+{
+    if ((batch_queue_num > 0) && batch_queue_is_stale()) {
+        release_stale_tbs(batch_queue, batch_queue_num);
+        batch_queue_num = 0;
     }
-    return elm->fidx;
+    if (batch_queue_num == 0) {
+        batch_queue_flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+    }
+    if (batch_queue_num < WASM_BATCH_NUM) {
+        batch_queue[batch_queue_num++] = tb_ptr;
+        uintptr_t tb_counter_ptr = (uintptr_t)tb_ptr + counter_vec_off;
+        *(int32_t*)tb_counter_ptr = WASM_BATCH_QUEUED;
+    }
+    if (batch_queue_num == WASM_BATCH_NUM) {
+        compile_wasm_batch();
+    }
+}
+
+/* Queues the other TBs of the hot trace with tb_ptr, if it is part of it */
+static void enqueue_hot_trace(void *tb_ptr)
+{
+    int i;
+
+    if (hot_trace_flush_count != qatomic_read(&tb_ctx.tb_flush_count)) {
+        hot_trace_len = 0;
+    }
+    for (i = 0; i < hot_trace_len && hot_trace[i] != tb_ptr; i++) {
+        ;
+    }
+    if (i == hot_trace_len) {
+        return;
+    }
+    for (i = 0; i < hot_trace_len; i++) {
+        void *t = hot_trace[i];
+        int32_t counter = *(int32_t*)((uintptr_t)t + counter_vec_off);
+
+        if ((t == tb_ptr) || (counter < 0) ||
+            (*(uintptr_t *)((uintptr_t)t + export_vec_off) != 0) ||
+            !tb_has_wasm(t) || !tb_is_batchable(t)) {
+            continue; // queued, instantiated or not compilable as a batch
+        }
+        enqueue_wasm_batch(t);
+    }
+    hot_trace_len = 0;
+}
+
+/*
+ * The results of WebAssembly.compile and the modules posted by the other
+ * vCPU threads are only delivered when this thread returns to the browser
+ * main loop. It does so at most once per time slice of wasm_yield_ms, and
+ * only when something is waiting for it: a compile job in flight, or a
+ * shared module that was posted but not received yet.
+ */
+#define YIELD_CHECK_NUM 1024 // TB dispatches between two looks at the clock
+__thread int exec_cnt = YIELD_CHECK_NUM;
+__thread static int64_t yield_deadline;
+unsigned wasm_yield_ms = 10;
+
+uint32_t wasm_shared_posted;          // modules posted by all threads, by JS
+__thread uint32_t wasm_shared_own;    // those posted by this thread, by JS
+__thread uint32_t wasm_shared_recv;   // those received by this thread, by JS
+
+static bool yield_wanted(void)
+{
+    return (compile_jobs_pending > 0) ||
+        (qatomic_read(&wasm_shared_posted) - wasm_shared_own != wasm_shared_recv);
 }
 
-#define MAX_EXEC_NUM 50000
-__thread int exec_cnt = MAX_EXEC_NUM;
 static inline void trysleep()
 {
     if (--exec_cnt == 0) {
-        if (!can_add_instance()) {
-            emscripten_sleep(0); // return to the browser main loop
-            check_instance_garbage_collected();
+        int64_t now = get_clock();
+
+        exec_cnt = YIELD_CHECK_NUM;
+        if (now < yield_deadline) {
+            return;
+        }
+        yield_deadline = now + wasm_yield_ms * SCALE_MS;
+        // don't let a partially filled batch wait forever
+        compile_wasm_batch();
+        if (yield_wanted()) {
+            emscripten_sleep(0);
+            publish_wasm_jobs();
         }
-        exec_cnt = MAX_EXEC_NUM;
     }
 }
 
@@ -223,28 +2028,159 @@ void set_unwinding_flag()
     ctx.unwinding = 1;
 }
 
-typedef uint32_t (*wasm_func_ptr)(struct wasmContext*);
+typedef uintptr_t (*wasm_func_ptr)(struct wasmContext*);
+
+/* Maximum of the memory imported by the TB modules, in 64KiB pages */
+uint32_t wasm_memory_max_pages(void)
+{
+#if WASM_PTR64
+    return DIV_ROUND_UP(emscripten_get_heap_max(), 65536);
+#else
+    return (uint32_t)(~0) / 65536;
+#endif
+}
 
 int get_core_nums()
 {
     return emscripten_num_logical_cores();
 }
 
-EM_JS(void, init_wasm32_js, (int tb_ptr_ptr, int cur_core_num, int to_remove_instance_ptr, int to_remove_instance_idx_ptr, int instance_garbage_collected_ptr), {
+EM_JS(int, wasm32_threads_available_js, (), {
+        return (typeof SharedArrayBuffer != "undefined") &&
+            (globalThis.crossOriginIsolated !== false);
+});
+
+bool wasm32_threads_available(void)
+{
+    return wasm32_threads_available_js();
+}
+
+void wasm32_prespawn_workers(int n)
+{
+    /*
+     * A thread is only started once its worker loaded the wasm module,
+     * which takes a while when the pool is empty; workers can only be
+     * created by the main browser thread.
+     */
+    MAIN_THREAD_ASYNC_EM_ASM({
+            while (PThread.unusedWorkers.length < $0) {
+                PThread.allocateUnusedWorker();
+                PThread.loadWasmModuleToWorker(
+                    PThread.unusedWorkers[PThread.unusedWorkers.length - 1]);
+            }
+        }, n);
+}
+
+#define WASM_SHARED_TBS_MAX (MAX_INSTANCE_ALIVE * 2)
+
+EM_JS(void, init_wasm32_js, (void *tb_ptr_ptr, int cur_core_num, int *compile_ready_num_ptr, int shared_modules, int shared_max,
+                            uint32_t *shared_posted_ptr, uint32_t *shared_own_ptr, uint32_t *shared_recv_ptr, int ptr_size), {
+        // pointers are BigInts on wasm64 and so are table indices (table64)
+        const ptr = (p) => (ptr_size == 8) ? Number(p) : (p >>> 0);
+        tb_ptr_ptr = ptr(tb_ptr_ptr);
+        compile_ready_num_ptr = ptr(compile_ready_num_ptr);
+        shared_posted_ptr = ptr(shared_posted_ptr);
+        shared_own_ptr = ptr(shared_own_ptr);
+        shared_recv_ptr = ptr(shared_recv_ptr);
         Module.__wasm32_tb = {
             tb_ptr_ptr: tb_ptr_ptr,
             cur_core_num: cur_core_num,
-            to_remove_instance_ptr: to_remove_instance_ptr,
-            to_remove_instance_idx_ptr: to_remove_instance_idx_ptr,
-            instance_garbage_collected_ptr: instance_garbage_collected_ptr,
-            inst_gc_registry: new FinalizationRegistry((i) => {
-                    if (i == "instance") {
-                        const memory_v = new DataView(HEAP8.buffer);
-                        let v = memory_v.getInt32(Module.__wasm32_tb.instance_garbage_collected_ptr, true);
-                        memory_v.setInt32(Module.__wasm32_tb.instance_garbage_collected_ptr, v + 1, true);
+            compile_ready_num_ptr: compile_ready_num_ptr,
+            ptr_size: ptr_size,
+            ptr: ptr,
+            get_ptr: (view, p) => (ptr_size == 8) ? Number(view.getBigUint64(p, true)) : view.getUint32(p, true),
+            tidx: (i) => (ptr_size == 8) ? BigInt(i) : i,
+            ready: [],
+            insts: {},      // live instances by module id
+            free_slots: [], // table slots released by remove_func_js
+            add_func: (f) => {
+                const tb = Module.__wasm32_tb;
+                const fidx = tb.free_slots.length > 0 ? tb.free_slots.pop() : Number(wasmTable.grow(tb.tidx(1)));
+                wasmTable.set(tb.tidx(fidx), f);
+                return fidx;
+            },
+            // import objects by helper set; TBs of a guest loop over few sets
+            imports: new Map(),
+            imports_for: (hidx) => {
+                const tb = Module.__wasm32_tb;
+                const key = hidx.join();
+                let imp = tb.imports.get(key);
+                if (imp !== undefined) {
+                    // keep the most recently used sets (Map iterates in insertion order)
+                    tb.imports.delete(key);
+                } else {
+                    const helper = {};
+                    for (var i = 0; i < hidx.length; i++) {
+                        helper[i] = wasmTable.get(tb.tidx(hidx[i]));
+                    }
+                    imp = {
+                        "env": {
+                            "buffer": wasmMemory,
+                            "table": wasmTable,
+                        },
+                        "helper": helper,
+                    };
+                    if (tb.imports.size >= 1024) {
+                        tb.imports.delete(tb.imports.keys().next().value);
                     }
-            })
+                }
+                tb.imports.set(key, imp);
+                return imp;
+            },
+            chan: null,        // BroadcastChannel to the other vCPU threads
+            shared: new Map(), // tb ptr -> {mod, hidx, name} received from them
+            shared_gen: 0,     // tb_flush count of the entries in "shared"
+            share: (gen, tbs, names, mod, hidx) => {
+                const tb = Module.__wasm32_tb;
+                if ((tb.chan != null) && (mod != null)) {
+                    tb.chan.postMessage({gen: gen >>> 0, tbs: tbs, names: names, mod: mod, hidx: hidx});
+                    // lets the other threads know there is something to receive
+                    Atomics.add(new Int32Array(wasmMemory.buffer), shared_posted_ptr / 4, 1);
+                    const memory_v = new DataView(wasmMemory.buffer);
+                    memory_v.setUint32(shared_own_ptr, memory_v.getUint32(shared_own_ptr, true) + 1, true);
+                }
+            },
+            share_batch: (gen, tbs_ptr, n, mod, hidx) => {
+                const tb = Module.__wasm32_tb;
+                const memory_v = new DataView(wasmMemory.buffer);
+                var tbs = [];
+                var names = [];
+                for (var i = 0; i < n; i++) {
+                    tbs[i] = tb.get_ptr(memory_v, tbs_ptr + i * ptr_size);
+                    names[i] = "f" + i;
+                }
+                Module.__wasm32_tb.share(gen, tbs, names, mod, hidx);
+            },
         };
+        if (shared_modules && (typeof BroadcastChannel != "undefined")) {
+            const tb = Module.__wasm32_tb;
+            // delivered when this thread returns to its event loop (trysleep),
+            // which it does while wasm_shared_recv lags behind
+            tb.chan = new BroadcastChannel("qemu-wasm32-tb");
+            // what was posted before the channel existed will never come
+            const memory_v = new DataView(wasmMemory.buffer);
+            memory_v.setUint32(shared_recv_ptr, Atomics.load(new Int32Array(wasmMemory.buffer), shared_posted_ptr / 4), true);
+            tb.chan.onmessage = (ev) => {
+                const d = ev.data;
+                const memory_v = new DataView(wasmMemory.buffer);
+                memory_v.setUint32(shared_recv_ptr, memory_v.getUint32(shared_recv_ptr, true) + 1, true);
+                if (d.gen != tb.shared_gen) {
+                    if (((d.gen - tb.shared_gen) | 0) < 0) {
+                        return; // TBs flushed since then
+                    }
+                    tb.shared.clear();
+                    tb.shared_gen = d.gen;
+                }
+                for (var i = 0; i < d.tbs.length; i++) {
+                    tb.shared.delete(d.tbs[i]);
+                    tb.shared.set(d.tbs[i], {mod: d.mod, hidx: d.hidx, name: d.names[i]});
+                }
+                // forget the oldest entries (Map iterates in insertion order)
+                while (tb.shared.size > shared_max) {
+                    tb.shared.delete(tb.shared.keys().next().value);
+                }
+            };
+        }
 });
 
 void init_wasm32()
@@ -252,12 +2188,28 @@ void init_wasm32()
     if (!initdone) {
         cur_core_num = qatomic_fetch_inc(&cur_core_num_max);
         all_cores_num = get_core_nums();
-        export_vec_off = 4 + 4 + cur_core_num * 4;
-        counter_vec_off = 4 + 4 + all_cores_num * 4 + 4 + cur_core_num * 4;
+        export_vec_off = 4 + 4 + cur_core_num * sizeof(void *);
+        counter_vec_off = 4 + 4 + all_cores_num * sizeof(void *) + 4 +
+                          cur_core_num * 4;
+        tier_vec_off = 4 + 4 + all_cores_num * sizeof(void *) + 4 +
+                       all_cores_num * 4 + 4;
+        qatomic_set(&wasm_tier_vec_off, tier_vec_off);
         ctx.stack = (uint64_t*)malloc(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE);
         ctx.stack128 = (uint64_t*)malloc(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE);
-        ctx.tci_tb_ptr = (uint32_t*)&tci_tb_ptr;
-        init_wasm32_js((int)&ctx.tb_ptr, cur_core_num, (int)to_remove_instance, (int)&to_remove_instance_idx, (int)&instance_garbage_collected_local);
+        ctx.tci_tb_ptr = &tci_tb_ptr;
+        ctx.export_vec_off = export_vec_off;
+        if (wasm_code_cache_enabled) {
+            wasm_code_cache_init();
+        }
+        if (wasm_code_cache_enabled || wasm_bundle_in || wasm_bundle_out ||
+            wasm_snapshot_hot_enabled) {
+            wasm_bundle_init_once();
+        }
+        init_instance_pool();
+        init_wasm32_js(&ctx.tb_ptr, cur_core_num, &compile_ready_num,
+                       wasm_shared_modules_enabled, WASM_SHARED_TBS_MAX,
+                       &wasm_shared_posted, &wasm_shared_own,
+                       &wasm_shared_recv, sizeof(void *));
         initdone = true;
     }
 }
@@ -277,17 +2229,6 @@ static uint64_t tci_uint64(uint32_t high, uint32_t low)
     return ((uint64_t)high << 32) + low;
 }
 
-static void tci_args_ldst(uint32_t insn, TCGReg *r0, TCGReg *r1, MemOpIdx *m2, const void *tb_ptr, void **l0)
-{
-    int diff = sextract32(insn, 12, 20);
-    *l0 = diff ? (uint8_t *)tb_ptr + diff : NULL;
-
-    uint64_t *data64 = (uint64_t*)*l0;
-    *r0 = (TCGReg)data64[0];
-    *r1 = (TCGReg)data64[1];
-    *m2 = (MemOpIdx)data64[2];
-}
-
 /*
  * Load sets of arguments all at once.  The naming convention is:
  *   tci_args_<arguments>
@@ -302,126 +2243,174 @@ static void tci_args_ldst(uint32_t insn, TCGReg *r0, TCGReg *r1, MemOpIdx *m2, c
  *   n = immediate (call return length)
  *   r = register
  *   s = signed ldst offset
+ *
+ * The insn is preceded by a tci_wide word when it names any of
+ * TCG_REG_R16..R31; the loop puts the bits of that word at bit 32 + n
+ * of insn, for the n-th register operand.
  */
 
-static void tci_args_l(uint32_t insn, const void *tb_ptr, void **l0)
+static TCGReg tci_reg(uint64_t insn, int n)
+{
+    return extract64(insn, 8 + 4 * n, 4) | (extract64(insn, 32 + n, 1) << 4);
+}
+
+static void tci_args_l(uint64_t insn, const void *tb_ptr, void **l0)
 {
     int diff = sextract32(insn, 12, 20);
     *l0 = diff ? (uint8_t *)tb_ptr + diff : NULL;
 }
 
-static void tci_args_r(uint32_t insn, TCGReg *r0)
+static void tci_args_r(uint64_t insn, TCGReg *r0)
 {
-    *r0 = extract32(insn, 8, 4);
+    *r0 = tci_reg(insn, 0);
 }
 
-static void tci_args_nl(uint32_t insn, const void *tb_ptr,
+static void tci_args_nl(uint64_t insn, const void *tb_ptr,
                         uint8_t *n0, void **l1)
 {
     *n0 = extract32(insn, 8, 4);
     *l1 = sextract32(insn, 12, 20) + (void *)tb_ptr;
 }
 
-static void tci_args_rl(uint32_t insn, const void *tb_ptr,
+static void tci_args_rl(uint64_t insn, const void *tb_ptr,
                         TCGReg *r0, void **l1)
 {
-    *r0 = extract32(insn, 8, 4);
+    *r0 = tci_reg(insn, 0);
     *l1 = sextract32(insn, 12, 20) + (void *)tb_ptr;
 }
 
-static void tci_args_rr(uint32_t insn, TCGReg *r0, TCGReg *r1)
+static void tci_args_rr(uint64_t insn, TCGReg *r0, TCGReg *r1)
+{
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+}
+
+static void tci_args_ldst(uint64_t insn, TCGReg *r0, TCGReg *r1, MemOpIdx *m2,
+                          const WasmLdstDesc **desc)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *desc = &wasm_ldst_descs[extract32(insn, 16, WASM_LDST_DESC_BITS)];
+    *m2 = (*desc)->oi;
 }
 
-static void tci_args_ri(uint32_t insn, TCGReg *r0, tcg_target_ulong *i1)
+static void tci_args_ri(uint64_t insn, TCGReg *r0, tcg_target_ulong *i1)
 {
-    *r0 = extract32(insn, 8, 4);
+    *r0 = tci_reg(insn, 0);
     *i1 = sextract32(insn, 12, 20);
 }
 
-static void tci_args_rrr(uint32_t insn, TCGReg *r0, TCGReg *r1, TCGReg *r2)
+static void tci_args_rrr(uint64_t insn, TCGReg *r0, TCGReg *r1, TCGReg *r2)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
 }
 
-static void tci_args_rrs(uint32_t insn, TCGReg *r0, TCGReg *r1, int32_t *i2)
+static void tci_args_rrs(uint64_t insn, TCGReg *r0, TCGReg *r1, int32_t *i2)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
     *i2 = sextract32(insn, 16, 16);
 }
 
-static void tci_args_rrbb(uint32_t insn, TCGReg *r0, TCGReg *r1,
+static void tci_args_rrcl(uint64_t insn, const void *tb_ptr, TCGReg *r0,
+                          TCGReg *r1, TCGCond *c2, void **l3)
+{
+    uint32_t slot = *(const uint32_t *)tb_ptr;
+
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *c2 = extract32(insn, 16, 4);
+    *l3 = sextract32(slot, 12, 20) + (void *)tb_ptr + 4;
+}
+
+static void tci_args_rrbb(uint64_t insn, TCGReg *r0, TCGReg *r1,
                           uint8_t *i2, uint8_t *i3)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
     *i2 = extract32(insn, 16, 6);
     *i3 = extract32(insn, 22, 6);
 }
 
-static void tci_args_rrrc(uint32_t insn,
+static void tci_args_rrrc(uint64_t insn,
                           TCGReg *r0, TCGReg *r1, TCGReg *r2, TCGCond *c3)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
     *c3 = extract32(insn, 20, 4);
 }
 
-static void tci_args_rrrbb(uint32_t insn, TCGReg *r0, TCGReg *r1,
+static void tci_args_rrrbb(uint64_t insn, TCGReg *r0, TCGReg *r1,
                            TCGReg *r2, uint8_t *i3, uint8_t *i4)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
     *i3 = extract32(insn, 20, 6);
     *i4 = extract32(insn, 26, 6);
 }
 
-static void tci_args_rrrrr(uint32_t insn, TCGReg *r0, TCGReg *r1,
+static void tci_args_rrrrr(uint64_t insn, TCGReg *r0, TCGReg *r1,
                            TCGReg *r2, TCGReg *r3, TCGReg *r4)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
-    *r3 = extract32(insn, 20, 4);
-    *r4 = extract32(insn, 24, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
+    *r3 = tci_reg(insn, 3);
+    *r4 = tci_reg(insn, 4);
 }
 
-static void tci_args_rrrr(uint32_t insn,
+static void tci_args_rrrr(uint64_t insn,
                           TCGReg *r0, TCGReg *r1, TCGReg *r2, TCGReg *r3)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
-    *r3 = extract32(insn, 20, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
+    *r3 = tci_reg(insn, 3);
 }
 
-static void tci_args_rrrrrc(uint32_t insn, TCGReg *r0, TCGReg *r1,
+static void tci_args_rrrrrc(uint64_t insn, TCGReg *r0, TCGReg *r1,
                             TCGReg *r2, TCGReg *r3, TCGReg *r4, TCGCond *c5)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
-    *r3 = extract32(insn, 20, 4);
-    *r4 = extract32(insn, 24, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
+    *r3 = tci_reg(insn, 3);
+    *r4 = tci_reg(insn, 4);
     *c5 = extract32(insn, 28, 4);
 }
 
-static void tci_args_rrrrrr(uint32_t insn, TCGReg *r0, TCGReg *r1,
+static void tci_args_rrrrrr(uint64_t insn, TCGReg *r0, TCGReg *r1,
                             TCGReg *r2, TCGReg *r3, TCGReg *r4, TCGReg *r5)
 {
-    *r0 = extract32(insn, 8, 4);
-    *r1 = extract32(insn, 12, 4);
-    *r2 = extract32(insn, 16, 4);
-    *r3 = extract32(insn, 20, 4);
-    *r4 = extract32(insn, 24, 4);
-    *r5 = extract32(insn, 28, 4);
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
+    *r3 = tci_reg(insn, 3);
+    *r4 = tci_reg(insn, 4);
+    *r5 = tci_reg(insn, 5);
+}
+
+static void tci_args_rrrvi(uint64_t insn, TCGReg *r0, TCGReg *r1,
+                           TCGReg *r2, unsigned *vece, uint32_t *i4)
+{
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *r2 = tci_reg(insn, 2);
+    *vece = extract32(insn, 20, 2);
+    *i4 = extract32(insn, 22, 10);
+}
+
+static void tci_args_rrvs(uint64_t insn, TCGReg *r0, TCGReg *r1,
+                          unsigned *vece, int32_t *i3)
+{
+    *r0 = tci_reg(insn, 0);
+    *r1 = tci_reg(insn, 1);
+    *vece = extract32(insn, 16, 2);
+    *i3 = sextract32(insn, 18, 14);
 }
 
 static bool tci_compare32(uint32_t u0, uint32_t u1, TCGCond condition)
@@ -493,86 +2482,178 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
     case TCG_COND_LTU:
         result = (u0 < u1);
         break;
-    case TCG_COND_GEU:
-        result = (u0 >= u1);
+    case TCG_COND_GEU:
+        result = (u0 >= u1);
+        break;
+    case TCG_COND_LEU:
+        result = (u0 <= u1);
+        break;
+    case TCG_COND_GTU:
+        result = (u0 > u1);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    return result;
+}
+
+/*
+ * Last TLB hit of this thread, one for loads and one for stores. Guest code
+ * tends to hit the same page many times in a row so this skips the TLB
+ * index computation and the entry load. It is valid as long as no entry of
+ * the vCPU changed since, which is tracked by CPUTLBCommon.gen.
+ */
+typedef struct TCITLBCache {
+    CPUArchState *env;
+    uint32_t gen;
+    int32_t fast_ofs;
+    uint64_t cmp;
+    uintptr_t addend;
+} TCITLBCache;
+
+__thread static TCITLBCache tci_tlb_cache[2];
+
+static uint64_t tlb_load(CPUArchState *env, uint64_t taddr,
+                         const WasmLdstDesc *desc, bool is_ld)
+{
+    TCITLBCache *cache = &tci_tlb_cache[is_ld];
+    if (desc->slow_only) {
+        return 0;
+    }
+    uint32_t gen = qatomic_read(&env_cpu(env)->neg.tlb.c.gen);
+    uint64_t c_addr = (taddr + desc->addr_adj) &
+                      (wasm_ldst_page_mask | desc->a_mask);
+
+    if (cache->env == env && cache->gen == gen &&
+        cache->fast_ofs == desc->fast_ofs && cache->cmp == c_addr) {
+        return taddr + cache->addend;
+    }
+
+    CPUTLBDescFast *fast = (CPUTLBDescFast*)((uint8_t*)env + desc->fast_ofs);
+    CPUTLBEntry *entry = (CPUTLBEntry*)
+        (((taddr >> wasm_ldst_tlb_shift) & fast->mask) + (uintptr_t)fast->table);
+    uint64_t target = *(uint64_t*)((uint8_t*)entry + desc->cmp_ofs);
+
+    if (c_addr == target) {
+        cache->env = env;
+        cache->gen = gen;
+        cache->fast_ofs = desc->fast_ofs;
+        cache->cmp = c_addr;
+        cache->addend = entry->addend;
+        return taddr + entry->addend;
+    }
+    return 0;
+}
+
+static uint64_t tci_ld_host(uintptr_t haddr, MemOp mop)
+{
+    switch (mop & MO_SSIZE) {
+    case MO_UB:
+        return *(uint8_t*)haddr;
+    case MO_SB:
+        return *(int8_t*)haddr;
+    case MO_UW:
+        return *(uint16_t*)haddr;
+    case MO_SW:
+        return *(int16_t*)haddr;
+    case MO_UL:
+        return *(uint32_t*)haddr;
+    case MO_SL:
+        return *(int32_t*)haddr;
+    case MO_UQ:
+        return *(uint64_t*)haddr;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void tci_st_host(uintptr_t haddr, uint64_t val, MemOp mop)
+{
+    switch (mop & MO_SIZE) {
+    case MO_UB:
+        *(uint8_t*)haddr = (uint8_t)val;
+        break;
+    case MO_UW:
+        *(uint16_t*)haddr = (uint16_t)val;
         break;
-    case TCG_COND_LEU:
-        result = (u0 <= u1);
+    case MO_UL:
+        *(uint32_t*)haddr = (uint32_t)val;
         break;
-    case TCG_COND_GTU:
-        result = (u0 > u1);
+    case MO_UQ:
+        *(uint64_t*)haddr = (uint64_t)val;
         break;
     default:
         g_assert_not_reached();
     }
-    return result;
 }
 
-static uint64_t tlb_load(CPUArchState *env, uint64_t taddr, MemOp mop, uint64_t* ptr, bool is_ld)
+/*
+ * Accesses of desc->ordered are load-acquire and store-release, see
+ * wasm_tso_enabled. Atomics must be naturally aligned, so a misaligned
+ * one is a plain access between two full barriers.
+ */
+static uint64_t tci_ld_host_ordered(uintptr_t haddr, MemOp mop)
 {
-    uint64_t *data64 = (uint64_t*)ptr;
-    unsigned a_mask = (unsigned)data64[3];
-    int mask_ofs = (int)data64[4];
-    int8_t page_bits = (int8_t)data64[5];
-    uint64_t page_mask = (uint64_t)data64[6];
-    int table_ofs = (uint64_t)data64[7];
-
-    unsigned s_bits = mop & MO_SIZE;
-    unsigned s_mask = (1u << s_bits) - 1;
-    tcg_target_long compare_mask;
-    int add_off = offsetof(CPUTLBEntry, addend);
+    uint64_t val;
 
-    uint64_t tmp0 = taddr >> (page_bits - CPU_TLB_ENTRY_BITS);
-    uint64_t tmp2 = *(uint64_t*)((uint8_t*)env + mask_ofs);
-    uint64_t tmp2_b = *(uint64_t*)((uint8_t*)env + table_ofs);
-    uint64_t tmp3 = (tmp0 & tmp2) + tmp2_b;
-    int off = off = is_ld ? offsetof(CPUTLBEntry, addr_read)
-        : offsetof(CPUTLBEntry, addr_write);
-    uint64_t target = *(uint64_t*)((uint8_t*)tmp3 + off);
-    uint64_t c_addr = taddr;
-    if (a_mask < s_mask) {
-        c_addr += s_mask - a_mask;
+    if (haddr & (memop_size(mop) - 1)) {
+        smp_mb();
+        val = tci_ld_host(haddr, mop);
+        smp_mb();
+        return val;
     }
-    compare_mask = page_mask | a_mask;
-    c_addr &= compare_mask;
 
-    if (c_addr == target) {
-        int32_t addend = *(uint32_t*)((uint8_t*)tmp3 + add_off);
-        uint64_t target_addr = taddr + addend;
-        return target_addr;
+    switch (mop & MO_SSIZE) {
+    case MO_UB:
+        return qatomic_load_acquire((uint8_t*)haddr);
+    case MO_SB:
+        return (int8_t)qatomic_load_acquire((uint8_t*)haddr);
+    case MO_UW:
+        return qatomic_load_acquire((uint16_t*)haddr);
+    case MO_SW:
+        return (int16_t)qatomic_load_acquire((uint16_t*)haddr);
+    case MO_UL:
+        return qatomic_load_acquire((uint32_t*)haddr);
+    case MO_SL:
+        return (int32_t)qatomic_load_acquire((uint32_t*)haddr);
+    case MO_UQ:
+        return qatomic_load_acquire((uint64_t*)haddr);
+    default:
+        g_assert_not_reached();
     }
-    return 0;
 }
 
-static uint64_t tci_qemu_ld(CPUArchState *env, uint64_t taddr,
-                            MemOpIdx oi, const void *tb_ptr, uint64_t* ptr)
+static void tci_st_host_ordered(uintptr_t haddr, uint64_t val, MemOp mop)
 {
-    MemOp mop = get_memop(oi);
-    uintptr_t ra = (uintptr_t)tb_ptr;
+    if (haddr & (memop_size(mop) - 1)) {
+        smp_mb();
+        tci_st_host(haddr, val, mop);
+        smp_mb();
+        return;
+    }
 
-    uint64_t target_addr = tlb_load(env, taddr, mop, ptr, true);
-    if (target_addr != 0) {
-        switch (mop & MO_SSIZE) {
-        case MO_UB:
-            return *(uint8_t*)target_addr;
-        case MO_SB:
-            return *(int8_t*)target_addr;
-        case MO_UW:
-            return *(uint16_t*)target_addr;
-        case MO_SW:
-            return *(int16_t*)target_addr;
-        case MO_UL:
-            return *(uint32_t*)target_addr;
-        case MO_SL:
-            return *(int32_t*)target_addr;
-        case MO_UQ:
-            return *(uint64_t*)target_addr;
-        default:
-            g_assert_not_reached();
-        }
+    switch (mop & MO_SIZE) {
+    case MO_UB:
+        qatomic_store_release((uint8_t*)haddr, (uint8_t)val);
+        break;
+    case MO_UW:
+        qatomic_store_release((uint16_t*)haddr, (uint16_t)val);
+        break;
+    case MO_UL:
+        qatomic_store_release((uint32_t*)haddr, (uint32_t)val);
+        break;
+    case MO_UQ:
+        qatomic_store_release((uint64_t*)haddr, val);
+        break;
+    default:
+        g_assert_not_reached();
     }
+}
 
-    switch (mop & MO_SSIZE) {
+static uint64_t tci_qemu_ld_helper(CPUArchState *env, uint64_t taddr,
+                                   MemOpIdx oi, uintptr_t ra)
+{
+    switch (get_memop(oi) & MO_SSIZE) {
     case MO_UB:
         return helper_ldub_mmu(env, taddr, oi, ra);
     case MO_SB:
@@ -592,49 +2673,220 @@ static uint64_t tci_qemu_ld(CPUArchState *env, uint64_t taddr,
     }
 }
 
+static void tci_qemu_st_helper(CPUArchState *env, uint64_t taddr,
+                               uint64_t val, MemOpIdx oi, uintptr_t ra)
+{
+    switch (get_memop(oi) & MO_SIZE) {
+    case MO_UB:
+        helper_stb_mmu(env, taddr, val, oi, ra);
+        break;
+    case MO_UW:
+        helper_stw_mmu(env, taddr, val, oi, ra);
+        break;
+    case MO_UL:
+        helper_stl_mmu(env, taddr, val, oi, ra);
+        break;
+    case MO_UQ:
+        helper_stq_mmu(env, taddr, val, oi, ra);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static uint64_t tci_qemu_ld(CPUArchState *env, uint64_t taddr,
+                            MemOpIdx oi, const void *tb_ptr,
+                            const WasmLdstDesc *desc)
+{
+    MemOp mop = get_memop(oi);
+    uintptr_t ra = (uintptr_t)tb_ptr;
+    uint64_t val;
+
+    uint64_t target_addr = tlb_load(env, taddr, desc, true);
+    if (target_addr != 0) {
+        if (desc->ordered) {
+            return tci_ld_host_ordered(target_addr, mop);
+        }
+        return tci_ld_host(target_addr, mop);
+    }
+
+    if (!desc->ordered) {
+        return tci_qemu_ld_helper(env, taddr, oi, ra);
+    }
+    smp_mb();
+    val = tci_qemu_ld_helper(env, taddr, oi, ra);
+    smp_mb();
+    return val;
+}
+
 static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
-                        MemOpIdx oi, const void *tb_ptr, uint64_t* ptr)
+                        MemOpIdx oi, const void *tb_ptr,
+                        const WasmLdstDesc *desc)
 {
     MemOp mop = get_memop(oi);
     uintptr_t ra = (uintptr_t)tb_ptr;
 
-    uint64_t target_addr = tlb_load(env, taddr, mop, ptr, false);
+    uint64_t target_addr = tlb_load(env, taddr, desc, false);
     if (target_addr != 0) {
-        switch (mop & MO_SIZE) {
-        case MO_UB:
-            *(uint8_t*)target_addr = (uint8_t)val;
-            break;
-        case MO_UW:
-            *(uint16_t*)target_addr = (uint16_t)val;
-            break;
-        case MO_UL:
-            *(uint32_t*)target_addr = (uint32_t)val;
-            break;
-        case MO_UQ:
-            *(uint64_t*)target_addr = (uint64_t)val;
+        if (desc->ordered) {
+            tci_st_host_ordered(target_addr, val, mop);
+        } else {
+            tci_st_host(target_addr, val, mop);
+        }
+        return;
+    }
+
+    if (!desc->ordered) {
+        tci_qemu_st_helper(env, taddr, val, oi, ra);
+        return;
+    }
+    smp_mb();
+    tci_qemu_st_helper(env, taddr, val, oi, ra);
+    smp_mb();
+}
+
+static void tci_qemu_ld128(CPUArchState *env, uint64_t taddr, MemOpIdx oi,
+                           const void *tb_ptr, const WasmLdstDesc *desc,
+                           uint64_t *lo, uint64_t *hi)
+{
+    /* Two plain accesses, between two full barriers if ordered */
+    if (desc->ordered) {
+        smp_mb();
+    }
+    uint64_t target_addr = tlb_load(env, taddr, desc, true);
+    if (target_addr != 0) {
+        *lo = *(uint64_t*)target_addr;
+        *hi = *(uint64_t*)(target_addr + 8);
+    } else {
+        Int128 val = helper_ld16_mmu(env, taddr, oi, (uintptr_t)tb_ptr);
+        *lo = int128_getlo(val);
+        *hi = int128_gethi(val);
+    }
+    if (desc->ordered) {
+        smp_mb();
+    }
+}
+
+static void tci_qemu_st128(CPUArchState *env, uint64_t taddr, MemOpIdx oi,
+                           const void *tb_ptr, const WasmLdstDesc *desc,
+                           uint64_t lo, uint64_t hi)
+{
+    if (desc->ordered) {
+        smp_mb();
+    }
+    uint64_t target_addr = tlb_load(env, taddr, desc, false);
+    if (target_addr != 0) {
+        *(uint64_t*)target_addr = lo;
+        *(uint64_t*)(target_addr + 8) = hi;
+    } else {
+        helper_st16_mmu(env, taddr, int128_make128(lo, hi), oi,
+                        (uintptr_t)tb_ptr);
+    }
+    if (desc->ordered) {
+        smp_mb();
+    }
+}
+
+#ifndef CONFIG_USER_ONLY
+/*
+ * The host address of an atomic when its page is RAM in the TLB, writable
+ * and readable, and it is aligned, which is all that atomic_mmu_lookup()
+ * checks before doing the host atomic. Plugins expect the helper to report
+ * the access.
+ */
+static void *tci_atomic_host_addr(CPUArchState *env, uint64_t addr,
+                                  MemOpIdx oi, MemOp size)
+{
+    CPUState *cpu = env_cpu(env);
+    CPUTLBEntry *entry = tlb_entry(cpu, get_mmuidx(oi), addr);
+    uint64_t cmp = addr & ((vaddr)TARGET_PAGE_MASK | ((1 << size) - 1));
+
+    if (cpu_plugin_mem_cbs_enabled(cpu) ||
+        tlb_addr_write(entry) != cmp ||
+        tlb_read_idx(entry, MMU_DATA_LOAD) != cmp) {
+        return NULL;
+    }
+    return (void *)(uintptr_t)(addr + entry->addend);
+}
+#endif
+
+/*
+ * The cmpxchg of guest exclusives, e.g. AArch64 STXR without LSE, runs in
+ * tight loops under MTTCG. Call these helpers without libffi, and on a
+ * TLB hit do the host atomic right here, like the wasm tier does inline.
+ * Returns false for the other helpers.
+ */
+static bool tci_call_cmpxchg(void *func, const tcg_target_ulong *args,
+                             tcg_target_ulong *ret)
+{
+    CPUArchState *env = (CPUArchState *)args[0];
+    uint64_t addr = args[1];
+    MemOpIdx oi = args[4];
+    MemOp size;
+
+    if (func == (void *)helper_atomic_cmpxchgb) {
+        size = MO_8;
+    } else if (func == (void *)helper_atomic_cmpxchgw_le) {
+        size = MO_16;
+    } else if (func == (void *)helper_atomic_cmpxchgl_le) {
+        size = MO_32;
+#ifdef CONFIG_ATOMIC64
+    } else if (func == (void *)helper_atomic_cmpxchgq_le) {
+        size = MO_64;
+#endif
+    } else {
+        return false;
+    }
+
+#ifndef CONFIG_USER_ONLY
+    void *haddr = tci_atomic_host_addr(env, addr, oi, size);
+    if (haddr) {
+        switch (size) {
+        case MO_8:
+            *ret = qatomic_cmpxchg__nocheck((uint8_t *)haddr,
+                                            (uint8_t)args[2],
+                                            (uint8_t)args[3]);
+            break;
+        case MO_16:
+            *ret = qatomic_cmpxchg__nocheck((uint16_t *)haddr,
+                                            (uint16_t)args[2],
+                                            (uint16_t)args[3]);
+            break;
+        case MO_32:
+            *ret = qatomic_cmpxchg__nocheck((uint32_t *)haddr,
+                                            (uint32_t)args[2],
+                                            (uint32_t)args[3]);
             break;
         default:
-            g_assert_not_reached();
+            *ret = qatomic_cmpxchg__nocheck((uint64_t *)haddr,
+                                            (uint64_t)args[2],
+                                            (uint64_t)args[3]);
+            break;
         }
-        return;
+        return true;
     }
-    
-    switch (mop & MO_SIZE) {
-    case MO_UB:
-        helper_stb_mmu(env, taddr, val, oi, ra);
+#endif
+
+    switch (size) {
+    case MO_8:
+        *ret = helper_atomic_cmpxchgb(env, addr, args[2], args[3], oi);
         break;
-    case MO_UW:
-        helper_stw_mmu(env, taddr, val, oi, ra);
+    case MO_16:
+        *ret = helper_atomic_cmpxchgw_le(env, addr, args[2], args[3], oi);
         break;
-    case MO_UL:
-        helper_stl_mmu(env, taddr, val, oi, ra);
+    case MO_32:
+        *ret = helper_atomic_cmpxchgl_le(env, addr, args[2], args[3], oi);
         break;
-    case MO_UQ:
-        helper_stq_mmu(env, taddr, val, oi, ra);
+#ifdef CONFIG_ATOMIC64
+    default:
+        *ret = helper_atomic_cmpxchgq_le(env, addr, args[2], args[3], oi);
         break;
+#else
     default:
         g_assert_not_reached();
+#endif
     }
+    return true;
 }
 
 #if TCG_TARGET_REG_BITS == 64
@@ -651,16 +2903,159 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
 
 __thread tcg_target_ulong regs[TCG_TARGET_NB_REGS];
 
+/* Vector registers, indexed by TCG_REG_V* - TCG_REG_V0. */
+typedef union {
+    uint8_t b[16];
+    uint16_t h[8];
+    uint32_t w[4];
+    uint64_t d[2];
+} tci_vec;
+
+__thread static tci_vec vregs[16];
+
+static uint64_t tci_vec_get(const tci_vec *v, unsigned vece, int i)
+{
+    switch (vece) {
+    case MO_8:
+        return v->b[i];
+    case MO_16:
+        return v->h[i];
+    case MO_32:
+        return v->w[i];
+    default:
+        return v->d[i];
+    }
+}
+
+static void tci_vec_set(tci_vec *v, unsigned vece, int i, uint64_t x)
+{
+    switch (vece) {
+    case MO_8:
+        v->b[i] = x;
+        break;
+    case MO_16:
+        v->h[i] = x;
+        break;
+    case MO_32:
+        v->w[i] = x;
+        break;
+    default:
+        v->d[i] = x;
+        break;
+    }
+}
+
+static void tci_vec_dup(tci_vec *v, unsigned vece, uint64_t x)
+{
+    for (int i = 0; i < (16 >> vece); i++) {
+        tci_vec_set(v, vece, i, x);
+    }
+}
+
+/* Element-wise operations; the shift count or condition is in i2. */
+static void tci_vec_op(TCGOpcode opc, unsigned vece, tci_vec *d,
+                       const tci_vec *a, const tci_vec *b, uint64_t i2)
+{
+    int bits = 8 << vece;
+    int64_t smax = INT64_MAX >> (64 - bits);
+    int64_t smin = -smax - 1;
+    uint64_t umax = UINT64_MAX >> (64 - bits);
+    tci_vec r;
+
+    for (int i = 0; i < (16 >> vece); i++) {
+        uint64_t ua = tci_vec_get(a, vece, i);
+        uint64_t ub = b ? tci_vec_get(b, vece, i) : 0;
+        int64_t sa = sextract64(ua, 0, bits);
+        int64_t sb = sextract64(ub, 0, bits);
+        uint64_t x;
+
+        switch (opc) {
+        case INDEX_op_add_vec:
+            x = ua + ub;
+            break;
+        case INDEX_op_sub_vec:
+            x = ua - ub;
+            break;
+        case INDEX_op_mul_vec:
+            x = ua * ub;
+            break;
+        case INDEX_op_neg_vec:
+            x = -ua;
+            break;
+        case INDEX_op_abs_vec:
+            x = sa < 0 ? -sa : sa;
+            break;
+        case INDEX_op_ssadd_vec:
+            x = MIN(MAX(sa + sb, smin), smax);
+            break;
+        case INDEX_op_usadd_vec:
+            x = MIN(ua + ub, umax);
+            break;
+        case INDEX_op_sssub_vec:
+            x = MIN(MAX(sa - sb, smin), smax);
+            break;
+        case INDEX_op_ussub_vec:
+            x = ua < ub ? 0 : ua - ub;
+            break;
+        case INDEX_op_smin_vec:
+            x = MIN(sa, sb);
+            break;
+        case INDEX_op_umin_vec:
+            x = MIN(ua, ub);
+            break;
+        case INDEX_op_smax_vec:
+            x = MAX(sa, sb);
+            break;
+        case INDEX_op_umax_vec:
+            x = MAX(ua, ub);
+            break;
+        case INDEX_op_shli_vec:
+        case INDEX_op_shls_vec:
+            x = ua << (i2 & (bits - 1));
+            break;
+        case INDEX_op_shri_vec:
+        case INDEX_op_shrs_vec:
+            x = ua >> (i2 & (bits - 1));
+            break;
+        case INDEX_op_sari_vec:
+        case INDEX_op_sars_vec:
+            x = sa >> (i2 & (bits - 1));
+            break;
+        case INDEX_op_cmp_vec:
+            /* Sign extension keeps the unsigned order, too. */
+            x = tci_compare64(sa, sb, i2) ? -1 : 0;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        tci_vec_set(&r, vece, i, x);
+    }
+    *d = r;
+}
+
+/* Returns true if the TB is still executed by TCI (not hot or queued). */
+static inline bool tci_keep_tb(void *tb_ptr)
+{
+    uintptr_t tb_counter_ptr = (uintptr_t)tb_ptr + counter_vec_off;
+    if ((*(int32_t*)tb_counter_ptr >= 0) && (*(int32_t*)tb_counter_ptr < tb_threshold(tb_ptr))) {
+        *(int32_t*)tb_counter_ptr += 1;
+        return true;
+    }
+    return *(int32_t*)tb_counter_ptr == WASM_BATCH_QUEUED;
+}
+
 static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
 {
     uint32_t *tb_ptr = (uint8_t*)ctx.tb_ptr + *(uint32_t*)ctx.tb_ptr;
     uint64_t *stack = ctx.stack;
 
+    trace_len = 0;
+
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
     
     for (;;) {
-        uint32_t insn;
+        uint64_t insn;
         TCGOpcode opc;
         TCGReg r0, r1, r2, r3, r4, r5;
         tcg_target_ulong t1;
@@ -670,14 +3065,18 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
         uint64_t tmp64, taddr;
         uint64_t T1, T2;
         MemOpIdx oi;
+        const WasmLdstDesc *desc;
         int32_t ofs;
         void *ptr;
+        unsigned vece;
 
         uint32_t *savep = tb_ptr;
         insn = *tb_ptr++;
         opc = extract32(insn, 0, 8);
-
-        TCGOpDef *def = &tcg_op_defs[opc];
+        if (unlikely(opc == INDEX_op_tci_wide)) {
+            insn = ((uint64_t)extract32(insn, 8, 6) << 32) | *tb_ptr++;
+            opc = extract32(insn, 0, 8);
+        }
 
         switch (opc) {
         case INDEX_op_call:
@@ -693,8 +3092,14 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
                 cif = (void*)data64[1];
 
                 int reg_iarg_base = 8;
-                if ((uint32_t)func == (uint32_t)helper_lookup_tb_ptr) {
-                    regs[TCG_REG_R0] = (uint32_t)helper_lookup_tb_ptr((CPUArchState *)regs[reg_iarg_base]);
+                if (func == helper_lookup_tb_ptr) {
+                    regs[TCG_REG_R0] = (uintptr_t)helper_lookup_tb_ptr((CPUArchState *)regs[reg_iarg_base]);
+                    break;
+                }
+                /* Helper functions may need to access the "return address" */
+                tci_tb_ptr = (uintptr_t)tb_ptr;
+                if (tci_call_cmpxchg(func, &regs[reg_iarg_base],
+                                     &regs[TCG_REG_R0])) {
                     break;
                 }
                 
@@ -713,8 +3118,6 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
                     }
                 }
 
-                /* Helper functions may need to access the "return address" */
-                tci_tb_ptr = (uintptr_t)tb_ptr;
                 ffi_call(cif, func, stack, call_slots);
             }
 
@@ -981,6 +3384,13 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
                 tb_ptr = ptr;
             }
             break;
+        case INDEX_op_tci_brcond_i32:
+            tci_args_rrcl(insn, tb_ptr, &r0, &r1, &condition, &ptr);
+            tb_ptr++;
+            if (tci_compare32(regs[r0], regs[r1], condition)) {
+                tb_ptr = ptr;
+            }
+            break;
 #if TCG_TARGET_REG_BITS == 32 || TCG_TARGET_HAS_add2_i32
         case INDEX_op_add2_i32:
             tci_args_rrrrrr(insn, &r0, &r1, &r2, &r3, &r4, &r5);
@@ -1127,6 +3537,20 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
             muls64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
             break;
 #endif
+#if TCG_TARGET_HAS_muluh_i64
+        case INDEX_op_muluh_i64:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            mulu64(&T1, &T2, regs[r1], regs[r2]);
+            regs[r0] = T2;
+            break;
+#endif
+#if TCG_TARGET_HAS_mulsh_i64
+        case INDEX_op_mulsh_i64:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            muls64(&T1, &T2, regs[r1], regs[r2]);
+            regs[r0] = T2;
+            break;
+#endif
 #if TCG_TARGET_HAS_add2_i64
         case INDEX_op_add2_i64:
             tci_args_rrrrrr(insn, &r0, &r1, &r2, &r3, &r4, &r5);
@@ -1194,6 +3618,13 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
                 tb_ptr = ptr;
             }
             break;
+        case INDEX_op_tci_brcond_i64:
+            tci_args_rrcl(insn, tb_ptr, &r0, &r1, &condition, &ptr);
+            tb_ptr++;
+            if (tci_compare64(regs[r0], regs[r1], condition)) {
+                tb_ptr = ptr;
+            }
+            break;
         case INDEX_op_ext32s_i64:
         case INDEX_op_ext_i32_i64:
             tci_args_rr(insn, &r0, &r1);
@@ -1223,11 +3654,9 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
             tci_args_l(insn, tb_ptr, &ptr);
             if (*(uint32_t **)ptr != 0) {
                 tb_ptr = *(uint32_t **)ptr;
+                tb_trace_edge(ctx.tb_ptr, tb_ptr);
                 ctx.tb_ptr = tb_ptr;
-                int tb_counter_ptr = (uint32_t)tb_ptr + counter_vec_off;
-                if ((*(int32_t*)tb_counter_ptr >= 0) && (*(int32_t*)tb_counter_ptr < INSTANTIATE_NUM)) {
-                    *(int32_t*)tb_counter_ptr += 1;
-                } else {
+                if (!tci_keep_tb(tb_ptr)) {
                     // enter to wasm TB
                     return 0;
                 }
@@ -1245,10 +3674,7 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
             tb_ptr = ptr;
 
             ctx.tb_ptr = tb_ptr;
-            int tb_counter_ptr = (uint32_t)tb_ptr + counter_vec_off;
-            if ((*(int32_t*)tb_counter_ptr >= 0) && (*(int32_t*)tb_counter_ptr < INSTANTIATE_NUM)) {
-                *(int32_t*)tb_counter_ptr += 1;
-            } else {
+            if (!tci_keep_tb(tb_ptr)) {
                 // enter to wasm TB
                 return 0;
             }
@@ -1257,25 +3683,25 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
             break;
 
         case INDEX_op_qemu_ld_a32_i32:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = (uint32_t)regs[r1];
             goto do_ld_i32;
         case INDEX_op_qemu_ld_a64_i32:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = regs[r1];
         do_ld_i32:
-            regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr, ptr);
+            regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr, desc);
             break;
 
         case INDEX_op_qemu_ld_a32_i64:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = (uint32_t)regs[r1];
             goto do_ld_i64;
         case INDEX_op_qemu_ld_a64_i64:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = regs[r1];
         do_ld_i64:
-            tmp64 = tci_qemu_ld(env, taddr, oi, tb_ptr, ptr);
+            tmp64 = tci_qemu_ld(env, taddr, oi, tb_ptr, desc);
             if (TCG_TARGET_REG_BITS == 32) {
                 tci_write_reg64(regs, r1, r0, tmp64);
             } else {
@@ -1284,27 +3710,151 @@ static inline uintptr_t tcg_qemu_tb_exec_tci(CPUArchState *env)
             break;
 
         case INDEX_op_qemu_st_a32_i32:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = (uint32_t)regs[r1];
             goto do_st_i32;
         case INDEX_op_qemu_st_a64_i32:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             taddr = regs[r1];
         do_st_i32:
-            tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr, ptr);
+            tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr, desc);
             break;
 
         case INDEX_op_qemu_st_a32_i64:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             tmp64 = regs[r0];
             taddr = (uint32_t)regs[r1];
             goto do_st_i64;
         case INDEX_op_qemu_st_a64_i64:
-            tci_args_ldst(insn, &r0, &r1, &oi, tb_ptr, &ptr);
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
             tmp64 = regs[r0];
             taddr = regs[r1];
         do_st_i64:
-            tci_qemu_st(env, taddr, tmp64, oi, tb_ptr, ptr);
+            tci_qemu_st(env, taddr, tmp64, oi, tb_ptr, desc);
+            break;
+
+        case INDEX_op_qemu_ld_a32_i128:
+        case INDEX_op_qemu_ld_a64_i128:
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
+            r2 = *tb_ptr++;
+            taddr = opc == INDEX_op_qemu_ld_a32_i128 ? (uint32_t)regs[r2] : regs[r2];
+            tci_qemu_ld128(env, taddr, oi, tb_ptr, desc, &regs[r0], &regs[r1]);
+            break;
+
+        case INDEX_op_qemu_st_a32_i128:
+        case INDEX_op_qemu_st_a64_i128:
+            tci_args_ldst(insn, &r0, &r1, &oi, &desc);
+            r2 = *tb_ptr++;
+            taddr = opc == INDEX_op_qemu_st_a32_i128 ? (uint32_t)regs[r2] : regs[r2];
+            tci_qemu_st128(env, taddr, oi, tb_ptr, desc, regs[r0], regs[r1]);
+            break;
+
+            /* Vector operations. */
+
+        case INDEX_op_mov_vec:
+            tci_args_rr(insn, &r0, &r1);
+            vregs[r0] = vregs[r1];
+            break;
+        case INDEX_op_ld_vec:
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            memcpy(&vregs[r0], ptr, sizeof(tci_vec));
+            break;
+        case INDEX_op_st_vec:
+            tci_args_rrs(insn, &r0, &r1, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            memcpy(ptr, &vregs[r0], sizeof(tci_vec));
+            break;
+        case INDEX_op_dup_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tmp64 = tmp32 ? tci_vec_get(&vregs[r1], vece, 0) : regs[r1];
+            tci_vec_dup(&vregs[r0], vece, tmp64);
+            break;
+        case INDEX_op_dupm_vec:
+            tci_args_rrvs(insn, &r0, &r1, &vece, &ofs);
+            ptr = (void *)(regs[r1] + ofs);
+            switch (vece) {
+            case MO_8:
+                tmp64 = *(uint8_t *)ptr;
+                break;
+            case MO_16:
+                tmp64 = *(uint16_t *)ptr;
+                break;
+            case MO_32:
+                tmp64 = *(uint32_t *)ptr;
+                break;
+            default:
+                tmp64 = *(uint64_t *)ptr;
+                break;
+            }
+            tci_vec_dup(&vregs[r0], vece, tmp64);
+            break;
+        case INDEX_op_and_vec:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            vregs[r0].d[0] = vregs[r1].d[0] & vregs[r2].d[0];
+            vregs[r0].d[1] = vregs[r1].d[1] & vregs[r2].d[1];
+            break;
+        case INDEX_op_or_vec:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            vregs[r0].d[0] = vregs[r1].d[0] | vregs[r2].d[0];
+            vregs[r0].d[1] = vregs[r1].d[1] | vregs[r2].d[1];
+            break;
+        case INDEX_op_xor_vec:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            vregs[r0].d[0] = vregs[r1].d[0] ^ vregs[r2].d[0];
+            vregs[r0].d[1] = vregs[r1].d[1] ^ vregs[r2].d[1];
+            break;
+        case INDEX_op_andc_vec:
+            tci_args_rrr(insn, &r0, &r1, &r2);
+            vregs[r0].d[0] = vregs[r1].d[0] & ~vregs[r2].d[0];
+            vregs[r0].d[1] = vregs[r1].d[1] & ~vregs[r2].d[1];
+            break;
+        case INDEX_op_not_vec:
+            tci_args_rr(insn, &r0, &r1);
+            vregs[r0].d[0] = ~vregs[r1].d[0];
+            vregs[r0].d[1] = ~vregs[r1].d[1];
+            break;
+        case INDEX_op_bitsel_vec:
+            tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
+            for (int i = 0; i < 2; i++) {
+                vregs[r0].d[i] = (vregs[r2].d[i] & vregs[r1].d[i]) |
+                                 (vregs[r3].d[i] & ~vregs[r1].d[i]);
+            }
+            break;
+        case INDEX_op_neg_vec:
+        case INDEX_op_abs_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tci_vec_op(opc, vece, &vregs[r0], &vregs[r1], NULL, 0);
+            break;
+        case INDEX_op_shli_vec:
+        case INDEX_op_shri_vec:
+        case INDEX_op_sari_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tci_vec_op(opc, vece, &vregs[r0], &vregs[r1], NULL, tmp32);
+            break;
+        case INDEX_op_shls_vec:
+        case INDEX_op_shrs_vec:
+        case INDEX_op_sars_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tci_vec_op(opc, vece, &vregs[r0], &vregs[r1], NULL, regs[r2]);
+            break;
+        case INDEX_op_cmp_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tci_vec_op(opc, vece, &vregs[r0], &vregs[r1], &vregs[r2], tmp32);
+            break;
+        case INDEX_op_add_vec:
+        case INDEX_op_sub_vec:
+        case INDEX_op_mul_vec:
+        case INDEX_op_ssadd_vec:
+        case INDEX_op_usadd_vec:
+        case INDEX_op_sssub_vec:
+        case INDEX_op_ussub_vec:
+        case INDEX_op_smin_vec:
+        case INDEX_op_umin_vec:
+        case INDEX_op_smax_vec:
+        case INDEX_op_umax_vec:
+            tci_args_rrrvi(insn, &r0, &r1, &r2, &vece, &tmp32);
+            tci_vec_op(opc, vece, &vregs[r0], &vregs[r1], &vregs[r2], 0);
             break;
 
         case INDEX_op_mb:
@@ -1323,26 +3873,56 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
     ctx.env = env;
     ctx.tb_ptr = (uint32_t*)v_tb_ptr;
     ctx.do_init = 1;
+    wasm_stats = wasm32_vcpu_stats(env_cpu(env)->cpu_index);
     while (true) {
         trysleep();
-        int tb_counter_ptr = (uint32_t)ctx.tb_ptr + counter_vec_off;
-        uint32_t res;
+        uintptr_t tb_counter_ptr = (uintptr_t)ctx.tb_ptr + counter_vec_off;
+        uintptr_t res;
+        struct wasm_tb_layout l;
         int fidx = get_instance_running_local(ctx.tb_ptr);
+        ctx.chain_budget = WASM_CHAIN_MAX;
+        wasm_stats->tb_execs++;
         if (fidx > 0) {
-            res = ((wasm_func_ptr)(fidx))(&ctx);
-        } else if (*(int32_t*)tb_counter_ptr < INSTANTIATE_NUM) {
+            wasm_stats->wasm_execs++;
+            res = ((wasm_func_ptr)(uintptr_t)fidx)(&ctx);
+        } else if (*(int32_t*)tb_counter_ptr == WASM_BATCH_QUEUED) {
+            res = tcg_qemu_tb_exec_tci(env);
+        } else if (*(int32_t*)tb_counter_ptr < tb_threshold(ctx.tb_ptr)) {
             *(int32_t*)tb_counter_ptr += 1;
             res = tcg_qemu_tb_exec_tci(env);
+        } else if (wasm_lazy_enabled && !tb_has_wasm(ctx.tb_ptr)) {
+            wasm_promote_tb(ctx.tb_ptr);
+            res = tcg_qemu_tb_exec_tci(env);
         } else if (!can_add_instance()) {
-            remove_instance_running_local();
-            check_instance_garbage_collected();
+            wasm_stats->refused++;
+            evict_instances(WASM_EVICT_NUM);
+            res = tcg_qemu_tb_exec_tci(env);
+        } else if (wasm_shared_modules_enabled &&
+                   (fidx = instantiate_shared(ctx.tb_ptr)) > 0) {
+            wasm_stats->wasm_execs++;
+            res = ((wasm_func_ptr)(uintptr_t)fidx)(&ctx);
+        } else if ((WASM_BATCH_NUM > 1) && tb_is_batchable(ctx.tb_ptr)) {
+            enqueue_wasm_batch(ctx.tb_ptr);
+            enqueue_hot_trace(ctx.tb_ptr);
+            res = tcg_qemu_tb_exec_tci(env);
+        } else if (!get_wasm_tb_module(ctx.tb_ptr, &l)) {
+            // released after another vCPU instantiated it
+            wasm_promote_tb(ctx.tb_ptr);
             res = tcg_qemu_tb_exec_tci(env);
         } else {
-            int fidx = instantiate_wasm();
-            add_instance_running_local(fidx, ctx.tb_ptr);
-            res = ((wasm_func_ptr)(fidx))(&ctx);
+            // the local pool can't be full while the global count is below the limit
+            int mod_id = alloc_module(1);
+            tcg_debug_assert(mod_id >= 0);
+            int64_t start = get_clock();
+            wasm_stats->module_bytes += l.mod_size;
+            int fidx = instantiate_wasm(l.mod, l.mod_size, l.helpers, l.helpers_num,
+                                        mod_id, qatomic_read(&tb_ctx.tb_flush_count));
+            uint64_t ns = wasm_stats_compile_done(start, "wasm32: compile TB");
+            add_instance_running_local(fidx, ctx.tb_ptr, mod_id, ns);
+            wasm_stats->wasm_execs++;
+            res = ((wasm_func_ptr)(uintptr_t)fidx)(&ctx);
         }
-        if ((uint32_t)ctx.tb_ptr == 0) {
+        if (ctx.tb_ptr == NULL) {
             return res;
         }
     }
@@ -1,33 +1,61 @@
 #ifndef TCG_WASM32_H
 #define TCG_WASM32_H
 
+/*
+ * Host pointers are i32 in wasm32 builds and i64 in wasm64 (memory64)
+ * builds. Generated modules import the memory and the function table with
+ * the matching index type, and take and return their pointers with it.
+ */
+#ifdef __wasm64__
+#define WASM_PTR64 1
+#define WASM_PTR_TYPE 0x7e
+#define WASM_MEMORY_LIMITS 0x07 // shared, max, 64-bit index
+#define WASM_TABLE_LIMITS 0x04  // 64-bit index
+#else
+#define WASM_PTR64 0
+#define WASM_PTR_TYPE 0x7f
+#define WASM_MEMORY_LIMITS 0x03 // shared, max
+#define WASM_TABLE_LIMITS 0x00
+#endif
+
 struct wasmContext {
-    // 0
     CPUArchState *env;
-    // 4
     uint64_t *stack;
-    // 8
     uint32_t *tb_ptr;
-    // 12
-    uint32_t *tci_tb_ptr;
-    // 16
+    uintptr_t *tci_tb_ptr;
     uint32_t do_init;
-    // 20
     uint32_t done_flag;
-    // 24
     uint64_t *stack128;
-    // 28
     uint32_t unwinding;
+    uint32_t export_vec_off;
+    uint32_t chain_budget;
 };
 
-#define ENV_OFF 0
-#define STACK_OFF 4
-#define TB_PTR_OFF 8
-#define HELPER_RET_TB_PTR_OFF 12
-#define DO_INIT_OFF 16
-#define DONE_FLAG_OFF 20
-#define STACK128_OFF 24
-#define UNWINDING_OFF 28
+/* Offsets used by the generated code, encoded as one-byte LEB128 memargs */
+#define ENV_OFF offsetof(struct wasmContext, env)
+#define STACK_OFF offsetof(struct wasmContext, stack)
+#define TB_PTR_OFF offsetof(struct wasmContext, tb_ptr)
+#define HELPER_RET_TB_PTR_OFF offsetof(struct wasmContext, tci_tb_ptr)
+#define DO_INIT_OFF offsetof(struct wasmContext, do_init)
+#define DONE_FLAG_OFF offsetof(struct wasmContext, done_flag)
+#define STACK128_OFF offsetof(struct wasmContext, stack128)
+#define UNWINDING_OFF offsetof(struct wasmContext, unwinding)
+#define EXPORT_VEC_OFF_OFF offsetof(struct wasmContext, export_vec_off)
+#define CHAIN_BUDGET_OFF offsetof(struct wasmContext, chain_budget)
+
+/*
+ * Layout of the head of struct instance_info in tcg/wasm32.c, as read
+ * by the chained jumps of the generated code.
+ */
+#define INSTANCE_INFO_TB_OFF 0
+#define INSTANCE_INFO_FIDX_OFF sizeof(void *)
+#define INSTANCE_INFO_EXECS_OFF (sizeof(void *) + 4)
+
+/* Number of 64KiB pages the generated modules declare as memory max */
+uint32_t wasm_memory_max_pages(void);
+
+/* Max number of TBs chained in wasm before returning to tcg_qemu_tb_exec */
+#define WASM_CHAIN_MAX 64
 
 void set_done_flag();
 
@@ -35,8 +63,281 @@ void set_unwinding_flag();
 
 int get_core_nums();
 
+/* Whether the page can run threads, i.e. has a SharedArrayBuffer */
+bool wasm32_threads_available(void);
+
+/* Start loading @n Web Workers for the threads about to be created */
+void wasm32_prespawn_workers(int n);
+
 void init_wasm32();
 
+/*
+ * Tiers deciding how many executions in TCI a TB needs before it is
+ * compiled to wasm. The tier is picked in tcg_gen_code and a TB is moved
+ * to WASM_TIER_LOOP when TCI sees it jumping to itself, or closing a loop
+ * of up to WASM_TRACE_LEN TBs chained to each other.
+ */
+enum {
+    WASM_TIER_DEFAULT,
+    WASM_TIER_LOOP,   // tight loop; promoted early
+    WASM_TIER_HELPER, // mostly helper calls; little to gain from wasm
+    WASM_TIER_NEVER,  // one-shot TB (e.g. for exclusive or io step) or SMC-hot page
+    WASM_TIER_CACHED, // was hot in a previous session; promoted immediately
+    WASM_TIER_NUM,
+};
+
+#define WASM_TIER_LOOP_THRESHOLD (INSTANTIATE_NUM / 8)
+
+/* Max number of chained TBs remembered by TCI to find loops */
+#define WASM_TRACE_LEN 8
+#define WASM_TIER_HELPER_THRESHOLD (INSTANTIATE_NUM * 4)
+#define WASM_TIER_NEVER_THRESHOLD INT32_MAX
+
+/* A TB is in WASM_TIER_HELPER if helper calls * this > guest insns */
+#define WASM_TIER_HELPER_DENSITY 2
+
+void wasm_init_tb_tier(uint32_t *tier_vec, TranslationBlock *tb, int helper_calls);
+
+void wasm32_dump_info(GString *buf);
+
+/*
+ * Per-vCPU statistics of the wasm tier, reported by "info jit" and by
+ * query-stats (provider "tcg"). Each entry is only written by the thread
+ * currently running the vCPU.
+ */
+#define WASM_STATS_VCPUS_MAX 64
+#define WASM_STATS_HIST_BUCKETS 32
+
+typedef struct WasmJitStats {
+    uint64_t tb_execs;     // TBs entered from tcg_qemu_tb_exec
+    uint64_t wasm_execs;   // ... of which ran as wasm
+    uint64_t instantiated; // functions added to the table
+    uint64_t evicted;
+    uint64_t refused;      // instantiations delayed by MAX_INSTANCE_ALIVE
+    uint64_t compile_ns;   // time spent compiling and instantiating
+    uint64_t module_bytes; // size of the wasm modules compiled
+    uint64_t compile_hist[WASM_STATS_HIST_BUCKETS]; // log2 of compile_ns
+} WasmJitStats;
+
+void wasm32_stats_init(void);
+
+/*
+ * Persistent code cache (-accel tcg,wasm-code-cache=on)
+ *
+ * TBs which were compiled to wasm are remembered in IndexedDB keyed by
+ * the hash of their guest code, pc, cs_base and flags. The database is
+ * per QEMU version and CPU model. When such TB is translated again in a
+ * later session, it skips the TCI tier.
+ */
+extern bool wasm_code_cache_enabled;
+
+void wasm_code_cache_tb(TranslationBlock *tb, uint64_t pc, void *host_pc);
+
+void wasm_code_cache_invalidate(TranslationBlock *tb);
+
+/*
+ * Bundles of hot TBs (-accel tcg,wasm-bundle-out=FILE,wasm-bundle-in=FILE)
+ *
+ * The keys of the persistent code cache, in a file instead of IndexedDB,
+ * so that a headless boot can record them once for everybody. With
+ * wasm-bundle-out, the keys of the TBs compiled to wasm are written to
+ * FILE at exit. With wasm-bundle-in, the TBs whose key is in FILE skip
+ * the TCI tier. A bundle is only used with the QEMU version and CPU model
+ * which wrote it.
+ */
+extern char *wasm_bundle_in;
+extern char *wasm_bundle_out;
+
+void wasm_bundle_save(void);
+
+/*
+ * Hot TBs in snapshots (-accel tcg,wasm-snapshot-hot=on)
+ *
+ * The same keys, saved in a "wasm-hot-tbs" section of the migration
+ * stream. After -incoming or loadvm, the TBs whose key is in the
+ * snapshot skip the TCI tier, whether the option is set there or not.
+ */
+extern bool wasm_snapshot_hot_enabled;
+
+void wasm_snapshot_hot_init(void);
+
+/*
+ * Shared modules (-accel tcg,wasm-shared-modules=on)
+ *
+ * A vCPU thread which compiles a module posts the WebAssembly.Module to
+ * the other vCPU threads over a BroadcastChannel, keyed by the TBs it
+ * contains and the tb_flush count. When a TB becomes hot on another vCPU,
+ * that thread only instantiates the received module instead of compiling
+ * the TB again. Table slots and instances stay per thread.
+ */
+extern bool wasm_shared_modules_enabled;
+
+/*
+ * Profiling (-accel tcg,wasm-names=on,wasm-marks=on)
+ *
+ * wasm-names adds a "name" section to each module so that browser profilers
+ * show TB functions as <guest symbol>@<pc> instead of wasm-function[n].
+ * wasm-marks records every compilation as a performance.measure() entry.
+ */
+extern bool wasm_names_enabled;
+extern bool wasm_marks_enabled;
+
+/*
+ * Lazy wasm translation (-accel tcg,wasm-lazy=on)
+ *
+ * TBs are first translated to TCI bytecode only. When one reaches its
+ * tier threshold, it is invalidated and its lookup key is remembered as
+ * hot, so the next translation also emits the wasm module. Cold TBs, the
+ * vast majority, then use only their TCI share of code_gen_buffer.
+ */
+extern bool wasm_lazy_enabled;
+
+/*
+ * Linear RAM window (-accel tcg,wasm-ram-window=on)
+ *
+ * Each softmmu TLB also tracks one run of adjacent readable RAM pages
+ * sharing the same addend, as for paging off or a kernel direct map.
+ * Guest loads falling inside it skip the TLB lookup in the wasm fast path
+ * and only do a bounds check. Any flush touching the window empties it.
+ */
+extern bool wasm_ram_window_enabled;
+
+/* Slack of CPUTLBDescFast.win_lim for the largest windowed access */
+#define WASM_RAM_WINDOW_SLACK 7
+
+/*
+ * Transient modules (-accel tcg,wasm-transient-modules=on)
+ *
+ * The wasm module of a TB is only read to instantiate it, so tcg_gen_code
+ * moves it out of code_gen_buffer into a heap pool and leaves
+ * WASM_MOD_TRANSIENT and a pointer to it in its place. With wasm-lazy the
+ * module is released once the TB is instantiated, and rebuilt by
+ * retranslation if the TB needs it again; code_gen_buffer then only holds
+ * what TCI needs. tb_flush empties the pool.
+ */
+extern bool wasm_transient_modules_enabled;
+
+/*
+ * Wasm tier switch (-accel tcg,wasm-jit=off)
+ *
+ * With the tier off, every TB stays in TCI as if it were in
+ * WASM_TIER_NEVER, which gives the baseline of tests/bench/wasm-tcg-bench.
+ */
+extern bool wasm_jit_enabled;
+
+/* Print "info jit" to stderr at exit (-accel tcg,wasm-exit-stats=on) */
+extern bool wasm_exit_stats_enabled;
+
+/*
+ * Time slice (-accel tcg,wasm-yield-ms=N)
+ *
+ * Longest run in milliseconds of host time before a vCPU thread which
+ * waits for background compilations or shared modules returns to the
+ * browser main loop to receive them. Threads waiting for nothing keep
+ * running.
+ */
+extern unsigned wasm_yield_ms;
+
+/*
+ * User-mode bounds checks (-accel tcg,wasm-guest-bounds=off)
+ *
+ * On by default, user-mode accesses outside of reserved_va fault through
+ * the helper. Turned off, accesses with no alignment to check become a single
+ * wasm load or store with guest_base as its offset; a wild guest pointer
+ * then traps in wasm instead of raising SIGSEGV in the guest.
+ */
+extern bool wasm_guest_bounds_enabled;
+
+/*
+ * TSO lowering of guest accesses (-accel tcg,wasm-tso=on)
+ *
+ * Off by default, the barriers that a strongly ordered guest needs around
+ * its loads and stores under MTTCG are a full fence each. Turned on, the
+ * accesses that the guest orders are emitted as wasm atomics in the wasm
+ * tier and as load-acquire and store-release in TCI, and tcg/optimize.c
+ * drops the barriers that they make redundant. Only a barrier ordering
+ * stores against later loads, like the one of mfence, stays a fence.
+ * Misaligned accesses and those going through the helpers sit between two
+ * fences instead.
+ */
+extern bool wasm_tso_enabled;
+
+#define WASM_MOD_TRANSIENT 0xffffffff
+
+/*
+ * Size of what replaces a transient module in code_gen_buffer: the
+ * WASM_MOD_TRANSIENT word, then the pointer to the pool copy, aligned.
+ */
+#define WASM_MOD_TRANSIENT_SIZE (2 * sizeof(void *))
+
+struct wasm_mod_blob;
+
+static inline struct wasm_mod_blob **wasm_mod_transient_ptr(uint32_t *mod_slot)
+{
+    return QEMU_ALIGN_PTR_UP(mod_slot + 1, sizeof(void *));
+}
+
+void *wasm_mod_pool_add(const void *mod, uint32_t size);
+void wasm_mod_pool_reset(void);
+
+/* Hooks of tb_flush_partial (-accel tcg,partial-flush=on) */
+unsigned wasm_tb_heat(TranslationBlock *tb);
+void wasm_tb_evict(TranslationBlock *tb);
+
+bool wasm_tb_is_hot(TranslationBlock *tb);
+
 #define INSTANTIATE_NUM 1500
 
+/*
+ * Number of hot TBs compiled together into a single module. Each TB becomes
+ * one exported function of the shared instance. 1 disables batching.
+ */
+#define WASM_BATCH_NUM 64
+
+/*
+ * Compile batches with WebAssembly.compile in the background instead of
+ * blocking the vCPU thread. Queued TBs keep running in TCI meanwhile.
+ */
+#define WASM_ASYNC_COMPILE 1
+
+/*
+ * Keep TCG_REG_R0..R31 in function locals instead of module globals while
+ * a TB runs. The globals are only written before returning for unwinding
+ * and read back when the TB is resumed.
+ */
+#define WASM_REG_LOCALS 1
+
+/* Counter value of a TB waiting in the batch queue (executed by TCI) */
+#define WASM_BATCH_QUEUED -2
+
+/*
+ * Pre-decoded qemu_ld/st operands.  Everything that only depends on the
+ * op is computed at translation time so the interpreter's TLB fast path is
+ * a shift, a mask and a compare.  The registers are in the insn; the rest
+ * is the same for every op with the same oi and ordering, so descriptors
+ * are kept once in a global table and the insn carries their index.  The
+ * page mask and the TLB shift are the same for all of them and kept aside.
+ */
+typedef struct WasmLdstDesc {
+    uint32_t oi;
+    int16_t fast_ofs;        /* env offset of the CPUTLBDescFast */
+    uint8_t a_mask;
+    uint8_t addr_adj;        /* s_mask - a_mask when the access may cross */
+    uint8_t cmp_ofs;         /* offset of addr_read or addr_write */
+    uint8_t slow_only;       /* always use the helper (16 byte atomicity) */
+    uint8_t ordered;         /* see wasm_tso_enabled */
+    uint8_t pad;
+} WasmLdstDesc;
+
+/* Width of the descriptor index in the insn */
+#define WASM_LDST_DESC_BITS 16
+
+/*
+ * Returns the index of the descriptor equal to @desc, adding it if needed.
+ * @page_mask and @tlb_shift (page_bits - CPU_TLB_ENTRY_BITS) must be the
+ * same on every call.
+ */
+uint32_t wasm_ldst_desc_index(const WasmLdstDesc *desc, uint64_t page_mask,
+                              unsigned tlb_shift);
+
 #endif
@@ -0,0 +1,46 @@
+/*
+ * buffer_is_zero speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+static const size_t sizes[] = { 64, 512, 4 * KiB, 64 * KiB, 1 * MiB };
+
+static void test_bufferiszero_speed(void)
+{
+    const size_t total = 16 * GiB;
+    /* Zeroed, so that every call has to look at the whole buffer */
+    uint8_t *buf = g_malloc0(1 * MiB + 1);
+    int accel = 0;
+
+    do {
+        for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+            size_t remain;
+
+            g_test_timer_start();
+            for (remain = total; remain >= sizes[i]; remain -= sizes[i]) {
+                /* Unaligned, like the pages of a guest often are not */
+                g_assert(buffer_is_zero(buf + 1, sizes[i]));
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("buffer_is_zero: accel %d, %zu bytes %.2f MB/sec",
+                           accel, sizes[i], total / MiB / g_test_timer_last());
+        }
+        accel++;
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/benchmark/bufferiszero", test_bufferiszero_speed);
+    return g_test_run();
+}
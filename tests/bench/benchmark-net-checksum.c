@@ -0,0 +1,80 @@
+/*
+ * Internet checksum speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "net/checksum.h"
+
+static const size_t sizes[] = { 64, 576, 1500, 9000, 65535 };
+
+/* The byte loop that net_checksum_add_cont() used to be */
+static uint32_t checksum_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += buf[i];
+        sum2 += buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += buf[i];
+    }
+    return seq & 1 ? sum1 + (sum2 << 8) : sum2 + (sum1 << 8);
+}
+
+static void check_accel(const uint8_t *buf)
+{
+    for (int len = 0; len < 2048; len++) {
+        for (int off = 0; off < 4; off++) {
+            uint8_t *p = (uint8_t *)buf + off;
+
+            g_assert_cmpuint(net_checksum_finish(checksum_ref(len, p, off)), ==,
+                             net_checksum_finish(
+                                 net_checksum_add_cont(len, p, off)));
+        }
+    }
+}
+
+static void test_checksum_speed(void)
+{
+    const size_t total = 2 * GiB;
+    uint8_t *buf = g_malloc(64 * KiB + 4);
+    int accel = 0;
+
+    for (size_t i = 0; i < 64 * KiB + 4; i++) {
+        buf[i] = g_test_rand_int();
+    }
+
+    do {
+        check_accel(buf);
+
+        for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+            volatile uint32_t sum = 0;
+            size_t remain;
+
+            g_test_timer_start();
+            for (remain = total; remain >= sizes[i]; remain -= sizes[i]) {
+                sum += net_checksum_add(sizes[i], buf + 1);
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("checksum: accel %d, %zu bytes %.2f MB/sec",
+                           accel, sizes[i], total / MiB / g_test_timer_last());
+        }
+        accel++;
+    } while (test_net_checksum_next_accel());
+
+    g_free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/benchmark/checksum", test_checksum_speed);
+    return g_test_run();
+}
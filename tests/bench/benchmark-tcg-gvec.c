@@ -0,0 +1,83 @@
+/*
+ * Generic vector runtime helper speed benchmark
+ *
+ * Run it from builds with and without --enable-wasm-simd128 to compare
+ * the auto-vectorized helpers with the scalar ones.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "exec/helper-proto-common.h"
+#include "tcg/tcg-gvec-desc.h"
+
+typedef void GVecHelper3(void *d, void *a, void *b, uint32_t desc);
+
+static const struct {
+    const char *name;
+    GVecHelper3 *fn;
+} helpers[] = {
+    { "add8", helper_gvec_add8 },
+    { "add32", helper_gvec_add32 },
+    { "sub16", helper_gvec_sub16 },
+    { "mul16", helper_gvec_mul16 },
+    { "mul32", helper_gvec_mul32 },
+    { "and", helper_gvec_and },
+    { "xor", helper_gvec_xor },
+    { "ssadd8", helper_gvec_ssadd8 },
+    { "usadd16", helper_gvec_usadd16 },
+    { "umin8", helper_gvec_umin8 },
+    { "smax32", helper_gvec_smax32 },
+    { "shl16v", helper_gvec_shl16v },
+    { "eq8", helper_gvec_eq8 },
+};
+
+/* One SSE or NEON register, and the largest SVE one */
+static const uint32_t sizes[] = { 16, 256 };
+
+/* The descriptor simd_desc() builds for oprsz == maxsz and no data */
+static uint32_t bench_desc(uint32_t size)
+{
+    return deposit32(size / 8 - 1, SIMD_OPRSZ_SHIFT, SIMD_OPRSZ_BITS, 2);
+}
+
+static void test_gvec_speed(void)
+{
+    const size_t total = 1 * GiB;
+    /* Like the vector registers in CPUArchState, 16-byte aligned */
+    uint8_t *d = g_malloc0(256), *a = g_malloc(256), *b = g_malloc(256);
+
+    for (int i = 0; i < 256; i++) {
+        a[i] = i * 7;
+        b[i] = i * 13 + 5;
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(helpers); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(sizes); j++) {
+            uint32_t desc = bench_desc(sizes[j]);
+            size_t remain;
+
+            g_test_timer_start();
+            for (remain = total; remain >= sizes[j]; remain -= sizes[j]) {
+                helpers[i].fn(d, a, b, desc);
+            }
+            g_test_timer_elapsed();
+
+            g_test_message("gvec_%s: %u bytes %.2f MB/sec", helpers[i].name,
+                           sizes[j], total / MiB / g_test_timer_last());
+        }
+    }
+
+    g_free(d);
+    g_free(a);
+    g_free(b);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/tcg/benchmark/gvec", test_gvec_speed);
+    return g_test_run();
+}
@@ -0,0 +1,132 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Benchmark of the QEMUTimerList operations with many pending timers
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+enum timer_op {
+    OP_MOD,
+    OP_MOD_ANTICIPATE,
+    OP_DEL_MOD,
+    OP_DEADLINE,
+    OP_RUN,
+};
+
+struct benchmark {
+    const char * const name;
+    enum timer_op op;
+};
+
+static const struct benchmark benchmarks[] = {
+    { .name = "Mod", .op = OP_MOD },
+    { .name = "Anticipate", .op = OP_MOD_ANTICIPATE },
+    { .name = "DelMod", .op = OP_DEL_MOD },
+    { .name = "Deadline", .op = OP_DEADLINE },
+    { .name = "Run", .op = OP_RUN },
+};
+
+#define N_OPS 100000
+
+static void timer_cb(void *opaque)
+{
+}
+
+/* Far in the future, so that OP_RUN is the only one to expire timers */
+static int64_t random_deadline(void)
+{
+    return (int64_t)1 << 62 | g_random_int();
+}
+
+static int64_t run_benchmark(const struct benchmark *bench, size_t n_timers)
+{
+    QEMUTimer **timers = g_new(QEMUTimer *, n_timers);
+    int64_t start_ns, ns;
+    size_t n_ops = N_OPS;
+
+    for (size_t i = 0; i < n_timers; i++) {
+        timers[i] = timer_new_ns(QEMU_CLOCK_REALTIME, timer_cb, NULL);
+        timer_mod_ns(timers[i], random_deadline());
+    }
+    /* an external timer in front, which deadline computations skip */
+    timer_mod_ns(timers[0], 1);
+    timers[0]->attributes = QEMU_TIMER_ATTR_EXTERNAL;
+
+    start_ns = get_clock();
+    switch (bench->op) {
+    case OP_MOD:
+        for (size_t i = 0; i < n_ops; i++) {
+            timer_mod_ns(timers[1 + i % (n_timers - 1)], random_deadline());
+        }
+        break;
+    case OP_MOD_ANTICIPATE:
+        for (size_t i = 0; i < n_ops; i++) {
+            QEMUTimer *ts = timers[1 + i % (n_timers - 1)];
+
+            timer_mod_anticipate_ns(ts, ts->expire_time - 1);
+        }
+        break;
+    case OP_DEL_MOD:
+        for (size_t i = 0; i < n_ops; i++) {
+            QEMUTimer *ts = timers[1 + i % (n_timers - 1)];
+
+            timer_del(ts);
+            timer_mod_ns(ts, random_deadline());
+        }
+        break;
+    case OP_DEADLINE:
+        for (size_t i = 0; i < n_ops; i++) {
+            qemu_clock_deadline_ns_all(QEMU_CLOCK_REALTIME,
+                                       ~QEMU_TIMER_ATTR_EXTERNAL);
+            timer_mod_ns(timers[1 + i % (n_timers - 1)], random_deadline());
+        }
+        break;
+    case OP_RUN:
+        for (size_t i = 0; i < n_timers; i++) {
+            timer_mod_ns(timers[i], g_random_int());
+        }
+        n_ops = n_timers;
+        qemu_clock_run_timers(QEMU_CLOCK_REALTIME);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    ns = get_clock() - start_ns;
+
+    for (size_t i = 0; i < n_timers; i++) {
+        timer_free(timers[i]);
+    }
+    g_free(timers);
+
+    /* per operation */
+    return ns / n_ops;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[] = {
+        8,
+        64,
+        512,
+        4096,
+    };
+
+    init_clocks(NULL);
+
+    printf("# Results' breakdown: Op and #Timers. Units: ns/op\n");
+    printf("%10s ", "Op");
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        printf("%8zu ", sizes[i]);
+    }
+    printf("\n");
+    for (int k = 0; k < ARRAY_SIZE(benchmarks); k++) {
+        printf("%10s ", benchmarks[k].name);
+        for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+            /* warm-up run */
+            run_benchmark(&benchmarks[k], sizes[i]);
+            printf("%8" PRId64 " ", run_benchmark(&benchmarks[k], sizes[i]));
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * Micro-benchmarks of the wasm32 TCG backend
+ *
+ *   node tests/bench/wasm-tcg-bench.mjs <qemu-system-i386 or x86_64 .js>
+ *                                       [--steady N] [--only NAME]
+ *
+ * Each benchmark is a tiny BIOS image, generated below, that runs one kind
+ * of TCG op stream in a loop: an ALU chain, a load/store loop, a block of
+ * helper calls and a chain of short branchy blocks.  The loop runs a
+ * warm-up pass, long enough for its TBs to reach the wasm tier, then a
+ * steady-state pass timed by the guest with RDTSC.  The ticks are written
+ * to the debugcon port and the machine powers off through isa-debug-exit.
+ *
+ * Every benchmark is run twice, with -accel tcg,wasm-jit=off for the TCI
+ * baseline and with the wasm tier, and wasm-exit-stats=on so that QEMU
+ * prints its "info jit" at exit.  From that we report the TCG output
+ * (TB count, average host code size), the wasm modules compiled and the
+ * average compile plus instantiate latency of a module.
+ */
+
+import { pathToFileURL } from 'node:url';
+import path from 'node:path';
+
+const ROM_SIZE = 64 * 1024;
+const WARM_UP = 4000;   // above the threshold of every tier but "never"
+
+// Minimal 16-bit assembler: raw bytes plus rel16 fixups
+class Asm {
+    constructor() {
+        this.code = [];
+        this.labels = {};
+        this.fixups = [];
+    }
+
+    emit(...bytes) {
+        this.code.push(...bytes);
+    }
+
+    imm16(v) {
+        this.emit(v & 0xff, (v >> 8) & 0xff);
+    }
+
+    label(name) {
+        this.labels[name] = this.code.length;
+    }
+
+    rel16(opcode, name) {
+        this.emit(...opcode);
+        this.fixups.push([this.code.length, name]);
+        this.imm16(0);
+    }
+
+    call(name) {
+        this.rel16([0xe8], name);
+    }
+
+    link() {
+        for (const [pos, name] of this.fixups) {
+            const rel = this.labels[name] - (pos + 2);
+
+            this.code[pos] = rel & 0xff;
+            this.code[pos + 1] = (rel >> 8) & 0xff;
+        }
+        return this.code;
+    }
+}
+
+const repeat = (n, f) => {
+    for (let i = 0; i < n; i++) {
+        f(i);
+    }
+};
+
+// Loop bodies, run SI times by "work"
+const BENCHMARKS = {
+    alu(a) {
+        repeat(16, () => {
+            a.emit(0x66, 0x01, 0xd8);           // add eax, ebx
+            a.emit(0x66, 0x31, 0xcb);           // xor ebx, ecx
+            a.emit(0x66, 0xc1, 0xe0, 0x03);     // shl eax, 3
+            a.emit(0x66, 0x0f, 0xaf, 0xc1);     // imul eax, ecx
+        });
+    },
+    ldst(a) {
+        a.emit(0xbf, 0x00, 0x80);               // mov di, 0x8000
+        a.emit(0xb9, 0x00, 0x04);               // mov cx, 1024
+        a.emit(0x66, 0x8b, 0x05);               // 1: mov eax, [di]
+        a.emit(0x66, 0x01, 0xd8);               // add eax, ebx
+        a.emit(0x66, 0x89, 0x05);               // mov [di], eax
+        a.emit(0x83, 0xc7, 0x04);               // add di, 4
+        a.emit(0xe2, 0xf2);                     // loop 1b
+    },
+    helper(a) {
+        repeat(16, () => {
+            a.emit(0x66, 0x89, 0xd8);           // mov eax, ebx
+            a.emit(0x66, 0x31, 0xd2);           // xor edx, edx
+            a.emit(0x66, 0xf7, 0xf1);           // div ecx
+            a.emit(0x66, 0x43);                 // inc ebx
+        });
+    },
+    branchy(a) {
+        repeat(16, (i) => {
+            a.emit(0xf6, 0xc3, 1 << (i % 8));   // test bl, 1 << i
+            a.emit(0x74, 0x01);                 // jz 1f
+            a.emit(0x40);                       // inc ax
+        });                                     // 1:
+        a.emit(0x81, 0xc3, 0x37, 0x9e);         // add bx, 0x9e37
+    },
+};
+
+function buildRom(body, steady) {
+    const a = new Asm();
+
+    a.emit(0xfa);                               // cli
+    a.emit(0x31, 0xc0);                         // xor ax, ax
+    a.emit(0x8e, 0xd8, 0x8e, 0xc0, 0x8e, 0xd0); // mov ds/es/ss, ax
+    a.emit(0xbc, 0x00, 0x70);                   // mov sp, 0x7000
+    a.emit(0x66, 0xb9, 7, 0, 0, 0);             // mov ecx, 7
+    a.emit(0x66, 0xbb, 0x45, 0x23, 0x01, 0);    // mov ebx, 0x12345
+
+    a.emit(0xbe);                               // mov si, WARM_UP
+    a.imm16(WARM_UP);
+    a.call('work');
+    a.emit(0x0f, 0x31);                         // rdtsc
+    a.emit(0x66, 0xa3, 0x00, 0x05);             // mov [0x500], eax
+    a.emit(0x66, 0x89, 0x16, 0x04, 0x05);       // mov [0x504], edx
+    a.emit(0xbe);                               // mov si, steady
+    a.imm16(steady);
+    a.call('work');
+    a.emit(0x0f, 0x31);                         // rdtsc
+    a.emit(0x66, 0x2b, 0x06, 0x00, 0x05);       // sub eax, [0x500]
+    a.emit(0x66, 0x1b, 0x16, 0x04, 0x05);       // sbb edx, [0x504]
+    a.emit(0x66, 0x50);                         // push eax
+    a.emit(0x66, 0x89, 0xd0);                   // mov eax, edx
+    a.call('hex32');
+    a.emit(0x66, 0x58);                         // pop eax
+    a.call('hex32');
+    a.emit(0xb0, 0x0a, 0xe6, 0xe9);             // newline to debugcon
+    a.emit(0xb0, 0x00, 0xe6, 0xf4);             // isa-debug-exit
+    a.emit(0xf4, 0xeb, 0xfe);                   // hlt; jmp $
+
+    a.label('work');
+    body(a);
+    a.emit(0x4e);                               // dec si
+    a.rel16([0x0f, 0x85], 'work');              // jnz work
+    a.emit(0xc3);                               // ret
+
+    // Prints eax as 8 hex digits to debugcon
+    a.label('hex32');
+    a.emit(0xb9, 0x08, 0x00);                   // mov cx, 8
+    a.emit(0x66, 0xc1, 0xc0, 0x04);             // 1: rol eax, 4
+    a.emit(0x50);                               // push ax
+    a.emit(0x24, 0x0f);                         // and al, 0xf
+    a.emit(0x3c, 0x0a, 0x72, 0x02);             // cmp al, 10; jb 2f
+    a.emit(0x04, 0x07);                         // add al, 'A' - '0' - 10
+    a.emit(0x04, 0x30);                         // 2: add al, '0'
+    a.emit(0xe6, 0xe9);                         // out 0xe9, al
+    a.emit(0x58);                               // pop ax
+    a.emit(0xe2, 0xec);                         // loop 1b
+    a.emit(0xc3);                               // ret
+
+    const rom = new Uint8Array(ROM_SIZE);
+    rom.set(a.link());
+    // Reset vector: jmp f000:0000
+    rom.set([0xea, 0x00, 0x00, 0x00, 0xf0], ROM_SIZE - 16);
+    return rom;
+}
+
+// Picks the numbers we report out of "info jit"
+function parseJitInfo(lines) {
+    const stats = { tbs: 0, hostSize: 0, modules: 0, moduleBytes: 0,
+                    compileUs: 0 };
+
+    for (const line of lines) {
+        let m;
+
+        if ((m = line.match(/^TB count\s+(\d+)/))) {
+            stats.tbs = +m[1];
+        } else if ((m = line.match(/^TB avg host size\s+(\d+)/))) {
+            stats.hostSize = +m[1];
+        } else if ((m = line.match(/instantiated (\d+)\s+evicted/))) {
+            stats.modules += +m[1];
+        } else if ((m = line.match(/compile time (\d+) us modules (\d+)/))) {
+            stats.compileUs += +m[1];
+            stats.moduleBytes += +m[2];
+        }
+    }
+    return stats;
+}
+
+async function run(factory, rom, jit) {
+    const stderr = [];
+    const start = performance.now();
+    let mod = null;
+
+    await new Promise((resolve, reject) => {
+        factory({
+            arguments: [
+                '-M', 'isapc', '-cpu', 'pentium', '-m', '16',
+                '-bios', '/bench.rom', '-display', 'none',
+                '-serial', 'none', '-monitor', 'none', '-parallel', 'none',
+                '-chardev', 'file,id=out,path=/bench.out',
+                '-device', 'isa-debugcon,chardev=out,iobase=0xe9',
+                '-device', 'isa-debug-exit,iobase=0xf4,iosize=4',
+                '-accel', `tcg,wasm-jit=${jit ? 'on' : 'off'},` +
+                          'wasm-exit-stats=on',
+            ],
+            preRun: [(m) => m.FS.writeFile('/bench.rom', rom)],
+            print: () => {},
+            printErr: (line) => stderr.push(line),
+            // Keep node alive for the next benchmark
+            quit: () => {},
+            onExit: resolve,
+            onAbort: reject,
+        }).then((m) => {
+            mod = m;
+        }, reject);
+    });
+
+    let debugcon = '';
+    try {
+        debugcon = mod.FS.readFile('/bench.out', { encoding: 'utf8' });
+    } catch (e) {
+        // the guest wrote nothing
+    }
+    const ticks = parseInt(debugcon.trim(), 16);
+    if (Number.isNaN(ticks)) {
+        throw new Error('no result from the guest:\n' + stderr.join('\n'));
+    }
+    return { wallMs: performance.now() - start, ticks,
+             ...parseJitInfo(stderr) };
+}
+
+async function main() {
+    const args = process.argv.slice(2);
+    let steady = 20000;
+    let only = null;
+    let qemu = null;
+
+    for (let i = 0; i < args.length; i++) {
+        if (args[i] === '--steady') {
+            steady = +args[++i];
+        } else if (args[i] === '--only') {
+            only = args[++i];
+        } else {
+            qemu = args[i];
+        }
+    }
+    if (!qemu || !(steady > 0 && steady < 65536)) {
+        console.error('usage: wasm-tcg-bench.mjs <qemu .js> ' +
+                      '[--steady N (< 65536)] [--only NAME]');
+        process.exit(1);
+    }
+
+    const factory = (await import(pathToFileURL(path.resolve(qemu)))).default;
+
+    console.log('bench    tier  wall(ms) steady(ticks) TBs host(B) ' +
+                'modules mod(KiB) inst(us)');
+    for (const [name, body] of Object.entries(BENCHMARKS)) {
+        if (only && name !== only) {
+            continue;
+        }
+        const rom = buildRom(body, steady);
+
+        for (const jit of [false, true]) {
+            const r = await run(factory, rom, jit);
+            const inst = r.modules ? Math.round(r.compileUs / r.modules) : 0;
+
+            console.log(`${name.padEnd(8)} ${(jit ? 'wasm' : 'tci').padEnd(5)}` +
+                        ` ${r.wallMs.toFixed(0).padStart(8)}` +
+                        ` ${String(r.ticks).padStart(13)}` +
+                        ` ${String(r.tbs).padStart(3)}` +
+                        ` ${String(r.hostSize).padStart(7)}` +
+                        ` ${String(r.modules).padStart(7)}` +
+                        ` ${(r.moduleBytes / 1024).toFixed(1).padStart(8)}` +
+                        ` ${String(inst).padStart(8)}`);
+        }
+    }
+}
+
+await main();
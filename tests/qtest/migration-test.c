@@ -67,6 +67,7 @@ static bool got_dst_resume;
 #define DIRTYLIMIT_TOLERANCE_RANGE  25  /* MB/s */
 
 #define ANALYZE_SCRIPT "scripts/analyze-migration.py"
+#define MERGE_SCRIPT "scripts/merge-snapshots.py"
 
 #define QEMU_VM_FILE_MAGIC 0x5145564d
 #define FILE_TEST_FILENAME "migfile"
@@ -635,6 +636,8 @@ typedef struct {
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
     bool use_dirty_ring;
+    /* Use TCG even if KVM is available */
+    bool use_tcg;
     const char *opts_source;
     const char *opts_target;
 } MigrateStart;
@@ -744,6 +747,7 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     g_autofree char *shmem_opts = NULL;
     g_autofree char *shmem_path = NULL;
     const char *kvm_opts = NULL;
+    g_autofree char *accel_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
     const char *machine_alias, *machine_opts = "";
@@ -825,19 +829,25 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     if (args->use_dirty_ring) {
         kvm_opts = ",dirty-ring-size=4096";
     }
+    if (args->use_tcg) {
+        accel_opts = g_strdup("-accel tcg");
+    } else {
+        accel_opts = g_strdup_printf("-accel kvm%s -accel tcg",
+                                     kvm_opts ? kvm_opts : "");
+    }
 
     machine = resolve_machine_version(machine_alias, QEMU_ENV_SRC,
                                       QEMU_ENV_DST);
 
     g_test_message("Using machine type: %s", machine);
 
-    cmd_source = g_strdup_printf("-accel kvm%s -accel tcg "
+    cmd_source = g_strdup_printf("%s "
                                  "-machine %s,%s "
                                  "-name source,debug-threads=on "
                                  "-m %s "
                                  "-serial file:%s/src_serial "
                                  "%s %s %s %s %s",
-                                 kvm_opts ? kvm_opts : "",
+                                 accel_opts,
                                  machine, machine_opts,
                                  memory_size, tmpfs,
                                  arch_opts ? arch_opts : "",
@@ -852,14 +862,14 @@ static int test_migrate_start(QTestState **from, QTestState **to,
                                      &got_src_stop);
     }
 
-    cmd_target = g_strdup_printf("-accel kvm%s -accel tcg "
+    cmd_target = g_strdup_printf("%s "
                                  "-machine %s,%s "
                                  "-name target,debug-threads=on "
                                  "-m %s "
                                  "-serial file:%s/dest_serial "
                                  "-incoming %s "
                                  "%s %s %s %s %s",
-                                 kvm_opts ? kvm_opts : "",
+                                 accel_opts,
                                  machine, machine_opts,
                                  memory_size, tmpfs, uri,
                                  arch_opts ? arch_opts : "",
@@ -2012,6 +2022,31 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_xbzrle_small_cache_start(QTestState *from,
+                                      QTestState *to)
+{
+    test_migrate_xbzrle_start(from, to);
+    /* Far less than the guest RAM, so that cached pages get evicted */
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 1048576);
+
+    return NULL;
+}
+
+static void test_precopy_unix_xbzrle_small_cache(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_xbzrle_small_cache_start,
+        .iterations = 2,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_compress(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2124,6 +2159,447 @@ static void test_precopy_file_offset_bad(void)
     test_file_common(&args, false);
 }
 
+static void *test_mapped_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void *test_mapped_ram_lazy_start(QTestState *from, QTestState *to)
+{
+    test_mapped_ram_start(from, to);
+    migrate_set_capability(to, "lazy-ram-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_mapped_ram_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_file_mapped_ram_live(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_mapped_ram_start,
+    };
+
+    /* pages dirtied while RAM is saved are rewritten at their offset */
+    test_file_common(&args, false);
+}
+
+static void test_precopy_file_mapped_ram_lazy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .start = {
+            .use_tcg = true,
+        },
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_mapped_ram_lazy_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_unix_mapped_ram_bad(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_mapped_ram_start,
+        .result = MIG_TEST_QMP_ERROR,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *test_prioritized_snapshot_start(QTestState *from, QTestState *to)
+{
+    test_mapped_ram_start(from, to);
+    migrate_set_capability(from, "prioritized-snapshot", true);
+    migrate_set_capability(to, "prioritized-snapshot", true);
+
+    return NULL;
+}
+
+static void *test_prioritized_snapshot_lazy_start(QTestState *from,
+                                                  QTestState *to)
+{
+    test_prioritized_snapshot_start(from, to);
+    migrate_set_capability(to, "lazy-ram-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_prioritized_snapshot(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_prioritized_snapshot_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void test_precopy_file_prioritized_snapshot_lazy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .start = {
+            .use_tcg = true,
+        },
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_prioritized_snapshot_lazy_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+#ifdef CONFIG_ZSTD
+static void *test_compressed_ram_start(QTestState *from, QTestState *to)
+{
+    test_mapped_ram_start(from, to);
+    /* the chunks are compressed by that many threads */
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_capability(from, "compressed-ram", true);
+    migrate_set_capability(to, "compressed-ram", true);
+
+    return NULL;
+}
+
+static void *test_compressed_ram_lazy_start(QTestState *from, QTestState *to)
+{
+    test_compressed_ram_start(from, to);
+    migrate_set_capability(to, "lazy-ram-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_compressed_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_compressed_ram_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_file_compressed_ram_lazy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .start = {
+            .use_tcg = true,
+        },
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_compressed_ram_lazy_start,
+    };
+
+    test_file_common(&args, true);
+}
+#endif /* CONFIG_ZSTD */
+
+static void *test_dedup_pages_start(QTestState *from, QTestState *to)
+{
+    /* the destination loads extents without the capability */
+    migrate_set_capability(from, "dedup-pages", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_dedup_pages(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_dedup_pages_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+static void test_precopy_unix_dedup_pages_bad(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_dedup_pages_start,
+        .result = MIG_TEST_QMP_ERROR,
+    };
+
+    test_precopy_common(&args);
+}
+
+static void *test_background_snapshot_start(QTestState *from, QTestState *to)
+{
+    migrate_set_capability(from, "background-snapshot", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_background_snapshot(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        /*
+         * With TCG, writes are tracked by the softmmu when userfaultfd
+         * write protection is missing.
+         */
+        .start = {
+            .use_tcg = true,
+        },
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_background_snapshot_start,
+    };
+
+    /* the guest keeps running, and writing, while its RAM is saved */
+    test_file_common(&args, false);
+}
+
+static void *
+test_migrate_multifd_file_start_common(QTestState *from, QTestState *to,
+                                       const char *method)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_parameter_str(from, "multifd-compression", method);
+    migrate_set_parameter_str(to, "multifd-compression", method);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return NULL;
+}
+
+static void *test_migrate_multifd_file_start(QTestState *from, QTestState *to)
+{
+    return test_migrate_multifd_file_start_common(from, to, "none");
+}
+
+static void test_multifd_file_none(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_migrate_multifd_file_start,
+    };
+
+    test_file_common(&args, true);
+}
+
+#ifdef CONFIG_ZSTD
+static void *test_migrate_multifd_file_zstd_start(QTestState *from,
+                                                  QTestState *to)
+{
+    return test_migrate_multifd_file_start_common(from, to, "zstd");
+}
+
+static void test_multifd_file_zstd(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = test_migrate_multifd_file_zstd_start,
+    };
+
+    test_file_common(&args, true);
+}
+#endif /* CONFIG_ZSTD */
+
+#ifndef _WIN32
+static void test_precopy_file_incremental_snapshot(void)
+{
+    g_autofree char *full = g_strdup_printf("%s/migfile.full", tmpfs);
+    g_autofree char *delta = g_strdup_printf("%s/migfile.delta", tmpfs);
+    g_autofree char *merged = g_strdup_printf("%s/%s", tmpfs,
+                                              FILE_TEST_FILENAME);
+    g_autofree char *full_uri = g_strdup_printf("file:%s", full);
+    g_autofree char *delta_uri = g_strdup_printf("file:%s", delta);
+    g_autofree char *merged_uri = g_strdup_printf("file:%s", merged);
+    const char *python = g_getenv("PYTHON");
+    MigrateStart args = {};
+    QTestState *from, *to;
+    uint8_t watch_byte;
+    int pid, wstatus;
+
+    if (!python) {
+        g_test_skip("PYTHON variable not set");
+        return;
+    }
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "incremental-snapshot", true);
+    migrate_ensure_converge(from);
+    wait_for_serial("src_serial");
+
+    /* The full snapshot the chain starts with */
+    migrate_qmp(from, full_uri, "{}");
+    wait_for_migration_complete(from);
+
+    /* Let the guest dirty part of its RAM before taking the delta */
+    qtest_qmp_assert_success(from, "{ 'execute' : 'cont'}");
+    watch_byte = qtest_readb(from, start_address + MAGIC_OFFSET_BASE);
+    do {
+        usleep(1000 * 10);
+    } while (qtest_readb(from, start_address + MAGIC_OFFSET_BASE) ==
+             watch_byte);
+
+    qtest_qmp_assert_success(from, "{ 'execute' : 'stop'}");
+    migrate_qmp(from, delta_uri, "{}");
+    wait_for_migration_complete(from);
+
+    pid = fork();
+    if (!pid) {
+        close(1);
+        open("/dev/null", O_WRONLY);
+        execl(python, python, MERGE_SCRIPT, "-o", merged, full, delta, NULL);
+        g_assert_not_reached();
+    }
+
+    g_assert(waitpid(pid, &wstatus, 0) == pid);
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        g_test_message("Failed to merge the snapshots");
+        g_test_fail();
+        test_migrate_end(from, to, false);
+        goto out;
+    }
+
+    /* The merged snapshot holds what the source had when it stopped */
+    migrate_incoming_qmp(to, merged_uri, "{}");
+    wait_for_migration_complete(to);
+    qtest_qmp_assert_success(to, "{ 'execute' : 'cont'}");
+    if (!got_dst_resume) {
+        qtest_qmp_eventwait(to, "RESUME");
+    }
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+out:
+    cleanup("migfile.full");
+    cleanup("migfile.delta");
+}
+#endif /* _WIN32 */
+
+static void
+migrate_set_capabilities_fail(QTestState *who, const char *error, ...)
+{
+    QList *caps = qlist_new();
+    const char *cap;
+    QDict *err;
+    va_list ap;
+
+    va_start(ap, error);
+    while ((cap = va_arg(ap, const char *))) {
+        QDict *state = qdict_new();
+
+        qdict_put_str(state, "capability", cap);
+        qdict_put_bool(state, "state", true);
+        qlist_append(caps, state);
+    }
+    va_end(ap);
+
+    err = qtest_qmp_assert_failure_ref(
+        who, "{ 'execute': 'migrate-set-capabilities',"
+             "  'arguments': { 'capabilities': %p } }", caps);
+    g_assert_nonnull(strstr(qdict_get_str(err, "desc"), error));
+    qobject_unref(err);
+}
+
+static void test_snapshot_caps_check(void)
+{
+    MigrateStart args = {};
+    QTestState *from, *to;
+
+    if (test_migrate_start(&from, &to, "defer", &args)) {
+        return;
+    }
+
+    migrate_set_capabilities_fail(from, "Mapped-ram is not compatible with "
+                                  "multifd", "mapped-ram", "multifd", NULL);
+    migrate_set_capabilities_fail(from, "Mapped-ram is not compatible with "
+                                  "xbzrle", "mapped-ram", "xbzrle", NULL);
+    migrate_set_capabilities_fail(from, "Mapped-ram is not compatible with "
+                                  "dedup-pages", "mapped-ram", "dedup-pages",
+                                  NULL);
+    migrate_set_capabilities_fail(from, "Dedup-pages is not compatible with "
+                                  "multifd", "dedup-pages", "multifd", NULL);
+    migrate_set_capabilities_fail(from, "Dedup-pages is not compatible with "
+                                  "xbzrle", "dedup-pages", "xbzrle", NULL);
+    migrate_set_capabilities_fail(from, "Incremental-snapshot is not "
+                                  "compatible with mapped-ram",
+                                  "incremental-snapshot", "mapped-ram", NULL);
+    migrate_set_capabilities_fail(from, "Incremental-snapshot is not "
+                                  "compatible with dedup-pages",
+                                  "incremental-snapshot", "dedup-pages", NULL);
+    migrate_set_capabilities_fail(from, "Incremental-snapshot is not "
+                                  "compatible with multifd",
+                                  "incremental-snapshot", "multifd", NULL);
+    migrate_set_capabilities_fail(from, "requires capability 'mapped-ram'",
+                                  "prioritized-snapshot", NULL);
+    migrate_set_capabilities_fail(from, "requires capability 'mapped-ram'",
+                                  "lazy-ram-load", NULL);
+#ifdef CONFIG_ZSTD
+    migrate_set_capabilities_fail(from, "requires capability 'mapped-ram'",
+                                  "compressed-ram", NULL);
+    migrate_set_capabilities_fail(from, "not compatible with "
+                                  "prioritized-snapshot", "mapped-ram",
+                                  "compressed-ram", "prioritized-snapshot",
+                                  NULL);
+#else
+    migrate_set_capabilities_fail(from, "requires QEMU built with zstd",
+                                  "mapped-ram", "compressed-ram", NULL);
+#endif
+
+#ifdef CONFIG_WASM_MIGRATION
+    /* fetch: only reads a stream */
+    migrate_qmp_fail(from, "fetch:http://127.0.0.1/migfile", "{}");
+#endif
+
+    test_migrate_end(from, to, false);
+}
+
 static void *test_mode_reboot_start(QTestState *from, QTestState *to)
 {
     migrate_set_parameter_str(from, "mode", "cpr-reboot");
@@ -2368,6 +2844,28 @@ static void test_migrate_fd_proto(void)
     };
     test_precopy_common(&args);
 }
+
+static void *test_migrate_multifd_fd_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return test_migrate_fd_start_hook(from, to);
+}
+
+static void test_multifd_fd(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .connect_uri = "fd:fd-mig",
+        .start_hook = test_migrate_multifd_fd_start,
+        .finish_hook = test_migrate_fd_finish_hook
+    };
+    test_precopy_common(&args);
+}
 #endif /* _WIN32 */
 
 static void do_test_validate_uuid(MigrateStart *args, bool should_fail)
@@ -3366,6 +3864,8 @@ int main(int argc, char **argv)
 #endif
     qtest_add_func("/migration/precopy/unix/plain", test_precopy_unix_plain);
     qtest_add_func("/migration/precopy/unix/xbzrle", test_precopy_unix_xbzrle);
+    qtest_add_func("/migration/precopy/unix/xbzrle/small-cache",
+                   test_precopy_unix_xbzrle_small_cache);
     /*
      * Compression fails from time to time.
      * Put test here but don't enable it until everything is fixed.
@@ -3383,6 +3883,43 @@ int main(int argc, char **argv)
                    test_precopy_file_offset);
     qtest_add_func("/migration/precopy/file/offset/bad",
                    test_precopy_file_offset_bad);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    qtest_add_func("/migration/precopy/file/mapped-ram/live",
+                   test_precopy_file_mapped_ram_live);
+    qtest_add_func("/migration/precopy/unix/mapped-ram/bad",
+                   test_precopy_unix_mapped_ram_bad);
+    qtest_add_func("/migration/precopy/file/prioritized-snapshot",
+                   test_precopy_file_prioritized_snapshot);
+#ifdef CONFIG_ZSTD
+    qtest_add_func("/migration/precopy/file/compressed-ram",
+                   test_precopy_file_compressed_ram);
+#endif
+    if (has_tcg) {
+        qtest_add_func("/migration/precopy/file/mapped-ram/lazy",
+                       test_precopy_file_mapped_ram_lazy);
+        qtest_add_func("/migration/precopy/file/prioritized-snapshot/lazy",
+                       test_precopy_file_prioritized_snapshot_lazy);
+#ifdef CONFIG_ZSTD
+        qtest_add_func("/migration/precopy/file/compressed-ram/lazy",
+                       test_precopy_file_compressed_ram_lazy);
+#endif
+        qtest_add_func("/migration/precopy/file/background-snapshot",
+                       test_precopy_file_background_snapshot);
+    }
+    qtest_add_func("/migration/precopy/file/dedup-pages",
+                   test_precopy_file_dedup_pages);
+    qtest_add_func("/migration/precopy/unix/dedup-pages/bad",
+                   test_precopy_unix_dedup_pages_bad);
+#ifndef _WIN32
+    qtest_add_func("/migration/precopy/file/incremental-snapshot",
+                   test_precopy_file_incremental_snapshot);
+#endif
+    qtest_add_func("/migration/multifd/file/none", test_multifd_file_none);
+#ifdef CONFIG_ZSTD
+    qtest_add_func("/migration/multifd/file/zstd", test_multifd_file_zstd);
+#endif
+    qtest_add_func("/migration/snapshot-caps-check", test_snapshot_caps_check);
 
     /*
      * Our CI system has problems with shared memory.
@@ -3449,6 +3986,7 @@ int main(int argc, char **argv)
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
 #ifndef _WIN32
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
+    qtest_add_func("/migration/multifd/fd", test_multifd_fd);
 #endif
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
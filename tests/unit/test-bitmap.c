@@ -123,6 +123,28 @@ static void check_bitmap_set(void)
     bitmap_set_case(bitmap_set_atomic);
 }
 
+static void check_find_next_bit_sparse(void)
+{
+    /* Several zero chunks of find_next_bit(), and a partial one */
+    long size = 5 * 4096 * BITS_PER_BYTE + 77;
+    unsigned long *bmap = bitmap_new(size);
+    long bits[] = { 3, 40000, 4096 * BITS_PER_BYTE * 3 + 1, size - 1 };
+    long i, last = 0;
+
+    g_assert_cmpint(find_next_bit(bmap, size, 0), ==, size);
+    for (i = 0; i < ARRAY_SIZE(bits); i++) {
+        set_bit(bits[i], bmap);
+    }
+    for (i = 0; i < ARRAY_SIZE(bits); i++) {
+        g_assert_cmpint(find_next_bit(bmap, size, last), ==, bits[i]);
+        last = bits[i] + 1;
+    }
+    g_assert_cmpint(find_next_bit(bmap, size, last), ==, size);
+    g_assert_cmpint(find_next_bit(bmap, size - 1, 4), ==, 40000);
+
+    g_free(bmap);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -131,6 +153,8 @@ int main(int argc, char **argv)
                     check_bitmap_copy_with_offset);
     g_test_add_func("/bitmap/bitmap_set",
                     check_bitmap_set);
+    g_test_add_func("/bitmap/find_next_bit_sparse",
+                    check_find_next_bit_sparse);
 
     g_test_run();
 
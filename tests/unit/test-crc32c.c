@@ -0,0 +1,82 @@
+/*
+ * CRC32C test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/iov.h"
+
+/* Bit at a time, for reference */
+static uint32_t crc32c_ref(uint32_t crc, const uint8_t *data, size_t length)
+{
+    while (length--) {
+        crc ^= *data++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (crc & 1 ? 0x82F63B78 : 0);
+        }
+    }
+    return crc ^ 0xffffffff;
+}
+
+/* The test patterns of RFC 3720, B.4 */
+static void test_crc32c_rfc3720(void)
+{
+    uint8_t buf[32];
+
+    memset(buf, 0, sizeof(buf));
+    g_assert_cmphex(crc32c(0xffffffff, buf, sizeof(buf)), ==, 0x8a9136aa);
+    memset(buf, 0xff, sizeof(buf));
+    g_assert_cmphex(crc32c(0xffffffff, buf, sizeof(buf)), ==, 0x62a8ab43);
+    for (int i = 0; i < 32; i++) {
+        buf[i] = i;
+    }
+    g_assert_cmphex(crc32c(0xffffffff, buf, sizeof(buf)), ==, 0x46dd794e);
+    for (int i = 0; i < 32; i++) {
+        buf[i] = 31 - i;
+    }
+    g_assert_cmphex(crc32c(0xffffffff, buf, sizeof(buf)), ==, 0x113fdb5c);
+}
+
+/* Every alignment and length around the 8-byte steps */
+static void test_crc32c_align(void)
+{
+    uint8_t buf[1024 + 8];
+
+    for (int i = 0; i < sizeof(buf); i++) {
+        buf[i] = i * 31 + 7;
+    }
+    for (int a = 0; a < 8; a++) {
+        for (int len = 0; len <= 1024; len++) {
+            g_assert_cmphex(crc32c(0x12345678, buf + a, len), ==,
+                            crc32c_ref(0x12345678, buf + a, len));
+        }
+    }
+}
+
+static void test_crc32c_iov(void)
+{
+    uint8_t buf[300];
+    struct iovec iov[3] = {
+        { .iov_base = buf, .iov_len = 5 },
+        { .iov_base = buf + 5, .iov_len = 100 },
+        { .iov_base = buf + 105, .iov_len = 195 },
+    };
+
+    for (int i = 0; i < sizeof(buf); i++) {
+        buf[i] = i ^ 0x5a;
+    }
+    g_assert_cmphex(iov_crc32c(0xffffffff, iov, ARRAY_SIZE(iov)), ==,
+                    crc32c(0xffffffff, buf, sizeof(buf)));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/crc32c/rfc3720", test_crc32c_rfc3720);
+    g_test_add_func("/crc32c/align", test_crc32c_align);
+    g_test_add_func("/crc32c/iov", test_crc32c_iov);
+    return g_test_run();
+}
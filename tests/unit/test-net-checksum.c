@@ -0,0 +1,133 @@
+/*
+ * Internet checksum tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "net/checksum.h"
+
+/* The chunk the vector kernels fold their lanes after, see net/checksum.c */
+#define CHUNK (256 * KiB)
+#define BUF_SIZE (2 * CHUNK + 64)
+
+/* The byte loop that net_checksum_add_cont() used to be */
+static uint32_t checksum_ref(int len, const uint8_t *buf, int seq)
+{
+    uint32_t sum1 = 0, sum2 = 0;
+    int i;
+
+    for (i = 0; i < len - 1; i += 2) {
+        sum1 += buf[i];
+        sum2 += buf[i + 1];
+    }
+    if (i < len) {
+        sum1 += buf[i];
+    }
+    return seq & 1 ? sum1 + (sum2 << 8) : sum2 + (sum1 << 8);
+}
+
+static uint32_t fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static void check(const uint8_t *buf, int len, int off)
+{
+    for (int seq = 0; seq < 2; seq++) {
+        uint8_t *p = (uint8_t *)buf + off;
+        uint32_t sum = net_checksum_add_cont(len, p, seq);
+
+        g_assert_cmphex(sum, <=, 0xffff);
+        g_assert_cmphex(sum, ==, fold(checksum_ref(len, p, seq)));
+    }
+}
+
+static void check_kernel(uint8_t *buf)
+{
+    /*
+     * Around the vector widths (16 and 32 bytes), the lengths from which
+     * the vector kernels are used (64 and 128 bytes) and the chunks they
+     * fold their lanes after.
+     */
+    static const int big[] = { CHUNK, 2 * CHUNK };
+    static const int delta[] = { -33, -32, -17, -16, -1, 0, 1, 16, 17, 33 };
+
+    for (int len = 0; len <= 300; len++) {
+        /* every alignment of a 32-byte vector */
+        for (int off = 0; off <= 32; off++) {
+            check(buf, len, off);
+        }
+    }
+    for (int i = 0; i < ARRAY_SIZE(big); i++) {
+        for (int j = 0; j < ARRAY_SIZE(delta); j++) {
+            check(buf, big[i] + delta[j], 0);
+            check(buf, big[i] + delta[j], 17);
+        }
+    }
+}
+
+static void test_kernels(void)
+{
+    uint8_t *buf = g_malloc(BUF_SIZE);
+    uint8_t *ones = g_malloc(BUF_SIZE);
+
+    for (int i = 0; i < BUF_SIZE; i++) {
+        buf[i] = g_test_rand_int();
+    }
+    /* the largest sums, where 32-bit lanes would overflow first */
+    memset(ones, 0xff, BUF_SIZE);
+
+    do {
+        check_kernel(buf);
+        check_kernel(ones);
+    } while (test_net_checksum_next_accel());
+
+    g_free(buf);
+    g_free(ones);
+}
+
+static void test_partial(void)
+{
+    uint8_t buf[1500];
+
+    for (int i = 0; i < sizeof(buf); i++) {
+        buf[i] = g_test_rand_int();
+    }
+
+    /* negative lengths and empty buffers add nothing */
+    g_assert_cmphex(net_checksum_add_cont(0, buf, 1), ==, 0);
+    g_assert_cmphex(net_checksum_add_cont(-1, buf, 0), ==, 0);
+    /* a sum of zero bytes is 0, not 0xffff */
+    memset(buf, 0, 64);
+    g_assert_cmphex(net_checksum_add(64, buf), ==, 0);
+    g_assert_cmphex(net_raw_checksum(buf, 64), ==, 0xffff);
+    buf[7] = 1;
+    g_assert_cmphex(net_checksum_add(64, buf), ==, 1);
+    g_assert_cmphex(net_checksum_add_cont(64, buf, 1), ==, 0x100);
+
+    /* the sums of consecutive pieces add up to the sum of the whole */
+    for (int i = 0; i < 100; i++) {
+        int split = g_test_rand_int_range(0, sizeof(buf));
+        uint32_t sum = net_checksum_add(split, buf) +
+                       net_checksum_add_cont(sizeof(buf) - split,
+                                             buf + split, split);
+
+        g_assert_cmphex(net_checksum_finish(sum), ==,
+                        net_raw_checksum(buf, sizeof(buf)));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/checksum/kernels", test_kernels);
+    g_test_add_func("/net/checksum/partial", test_partial);
+
+    return g_test_run();
+}
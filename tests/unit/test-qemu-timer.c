@@ -0,0 +1,382 @@
+/*
+ * QEMUTimerList tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "sysemu/cpu-timers.h"
+#include "qemu/timer.h"
+
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t my_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return my_clock_value;
+}
+
+#define N_TIMERS 64
+
+typedef struct TestTimers {
+    QEMUTimerListGroup tlg;
+    QEMUTimer timers[N_TIMERS];
+    /* indexes of the timers, in the order they fired */
+    int fired[N_TIMERS * 2];
+    int nr_fired;
+    int notified;
+} TestTimers;
+
+static TestTimers *test_timers;
+
+static void timer_fired(void *opaque)
+{
+    TestTimers *t = test_timers;
+    QEMUTimer *ts = opaque;
+
+    g_assert(ts >= t->timers && ts < t->timers + N_TIMERS);
+    g_assert_cmpint(t->nr_fired, <, ARRAY_SIZE(t->fired));
+    t->fired[t->nr_fired++] = ts - t->timers;
+}
+
+static void timers_notified(void *opaque, QEMUClockType type)
+{
+    TestTimers *t = opaque;
+
+    t->notified++;
+}
+
+static TestTimers *timers_new(void)
+{
+    TestTimers *t = g_new0(TestTimers, 1);
+
+    test_timers = t;
+    my_clock_value = 0;
+    timerlistgroup_init(&t->tlg, timers_notified, t);
+    for (int i = 0; i < N_TIMERS; i++) {
+        timer_init_full(&t->timers[i], &t->tlg, QEMU_CLOCK_VIRTUAL,
+                        SCALE_NS, 0, timer_fired, &t->timers[i]);
+    }
+    return t;
+}
+
+static void timers_free(TestTimers *t)
+{
+    for (int i = 0; i < N_TIMERS; i++) {
+        timer_del(&t->timers[i]);
+        timer_deinit(&t->timers[i]);
+    }
+    timerlistgroup_deinit(&t->tlg);
+    g_free(t);
+    test_timers = NULL;
+}
+
+/* Run the timers that expired at @now */
+static void timers_run(TestTimers *t, int64_t now)
+{
+    my_clock_value = now;
+    timerlist_run_timers(t->tlg.tl[QEMU_CLOCK_VIRTUAL]);
+}
+
+static void assert_fired(TestTimers *t, const int *expected, int n)
+{
+    g_assert_cmpint(t->nr_fired, ==, n);
+    for (int i = 0; i < n; i++) {
+        g_assert_cmpint(t->fired[i], ==, expected[i]);
+    }
+    t->nr_fired = 0;
+}
+
+static void test_order(void)
+{
+    TestTimers *t = timers_new();
+    static const int64_t expire[] = { 50, 10, 40, 20, 30 };
+    static const int order[] = { 1, 3, 4, 2, 0 };
+
+    for (int i = 0; i < ARRAY_SIZE(expire); i++) {
+        timer_mod_ns(&t->timers[i], expire[i]);
+    }
+    g_assert_cmpint(timerlist_deadline_ns(t->tlg.tl[QEMU_CLOCK_VIRTUAL]),
+                    ==, 10);
+
+    timers_run(t, 5);
+    assert_fired(t, NULL, 0);
+    timers_run(t, 35);
+    assert_fired(t, order, 3);
+    g_assert(timer_pending(&t->timers[0]));
+    g_assert(!timer_pending(&t->timers[1]));
+    timers_run(t, 100);
+    assert_fired(t, order + 3, 2);
+    g_assert(!timerlist_has_timers(t->tlg.tl[QEMU_CLOCK_VIRTUAL]));
+    timers_free(t);
+}
+
+static void test_equal_fifo(void)
+{
+    TestTimers *t = timers_new();
+    int order[N_TIMERS];
+
+    /* Interleave the arming with timers that fire earlier and later */
+    for (int i = 0; i < N_TIMERS / 2; i++) {
+        timer_mod_ns(&t->timers[i], 100);
+        timer_mod_ns(&t->timers[N_TIMERS / 2 + i], i & 1 ? 50 : 150);
+    }
+    for (int i = 0; i < N_TIMERS / 2; i++) {
+        order[i] = i;
+    }
+    timers_run(t, 99);
+    g_assert_cmpint(t->nr_fired, ==, N_TIMERS / 4);
+    t->nr_fired = 0;
+    timers_run(t, 100);
+    assert_fired(t, order, N_TIMERS / 2);
+    timers_free(t);
+}
+
+static void test_del(void)
+{
+    TestTimers *t = timers_new();
+    int order[N_TIMERS] = { 0 }, n = 0;
+
+    for (int i = 0; i < N_TIMERS; i++) {
+        timer_mod_ns(&t->timers[i], 10 + i * 10);
+    }
+    /*
+     * All are children of the first one.  Run it, so that the others are
+     * melded into a heap with more than one level, then delete timers
+     * that have children as well as leaves.
+     */
+    timers_run(t, 10);
+    assert_fired(t, order, 1);
+    for (int i = 3; i < N_TIMERS; i += 3) {
+        timer_del(&t->timers[i]);
+        g_assert(!timer_pending(&t->timers[i]));
+        g_assert_cmpint(timer_expire_time_ns(&t->timers[i]), ==, -1);
+    }
+    /* deleting a timer that is not pending is a no-op */
+    timer_del(&t->timers[3]);
+
+    for (int i = 1; i < N_TIMERS; i++) {
+        if (i % 3) {
+            order[n++] = i;
+        }
+    }
+    timers_run(t, 10 + N_TIMERS * 10);
+    assert_fired(t, order, n);
+    timers_free(t);
+}
+
+static void test_del_root(void)
+{
+    TestTimers *t = timers_new();
+    static const int order[] = { 2, 3, 1 };
+
+    timer_mod_ns(&t->timers[0], 10);
+    timer_mod_ns(&t->timers[1], 40);
+    timer_mod_ns(&t->timers[2], 20);
+    timer_mod_ns(&t->timers[3], 30);
+    timer_del(&t->timers[0]);
+    g_assert_cmpint(timerlist_deadline_ns(t->tlg.tl[QEMU_CLOCK_VIRTUAL]),
+                    ==, 20);
+    timers_run(t, 100);
+    assert_fired(t, order, ARRAY_SIZE(order));
+    timers_free(t);
+}
+
+static void test_rearm(void)
+{
+    TestTimers *t = timers_new();
+    static const int order[] = { 2, 1, 0, 3 };
+
+    timer_mod_ns(&t->timers[0], 10);
+    timer_mod_ns(&t->timers[1], 20);
+    timer_mod_ns(&t->timers[2], 20);
+    timer_mod_ns(&t->timers[3], 40);
+
+    /* later: moves behind the others */
+    timer_mod_ns(&t->timers[0], 30);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[0]), ==, 30);
+    /* at the same time again: fires after those armed since */
+    timer_mod_ns(&t->timers[1], 20);
+    /* earlier, then back */
+    timer_mod_ns(&t->timers[3], 5);
+    timer_mod_ns(&t->timers[3], 40);
+
+    timers_run(t, 100);
+    assert_fired(t, order, ARRAY_SIZE(order));
+    timers_free(t);
+}
+
+static void test_mod_anticipate(void)
+{
+    TestTimers *t = timers_new();
+    static const int order[] = { 0, 1, 2 };
+
+    /* arms a timer that is not pending */
+    timer_mod_anticipate_ns(&t->timers[0], 50);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[0]), ==, 50);
+    /* never delays it */
+    timer_mod_anticipate_ns(&t->timers[0], 70);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[0]), ==, 50);
+
+    timer_mod_ns(&t->timers[1], 40);
+    timer_mod_ns(&t->timers[2], 60);
+    /* but brings it forward, here behind a timer that is not the root */
+    timer_mod_anticipate_ns(&t->timers[2], 45);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[2]), ==, 45);
+    timer_mod_anticipate_ns(&t->timers[0], 30);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[0]), ==, 30);
+
+    timers_run(t, 30);
+    assert_fired(t, order, 1);
+    timer_mod_anticipate_ns(&t->timers[1], 45);
+    g_assert_cmpint(timer_expire_time_ns(&t->timers[1]), ==, 40);
+    timers_run(t, 100);
+    assert_fired(t, order + 1, 2);
+    timers_free(t);
+}
+
+static void test_notify(void)
+{
+    TestTimers *t = timers_new();
+
+    /* only a timer that becomes the first one notifies */
+    timer_mod_ns(&t->timers[0], 20);
+    g_assert_cmpint(t->notified, ==, 1);
+    timer_mod_ns(&t->timers[1], 30);
+    timer_mod_ns(&t->timers[2], 20);
+    g_assert_cmpint(t->notified, ==, 1);
+    timer_mod_ns(&t->timers[3], 10);
+    g_assert_cmpint(t->notified, ==, 2);
+    timer_mod_anticipate_ns(&t->timers[1], 5);
+    g_assert_cmpint(t->notified, ==, 3);
+    timers_free(t);
+}
+
+static void test_deadline_attr(void)
+{
+    TestTimers *t = timers_new();
+    QEMUTimer ext[4];
+    int64_t deadline;
+
+    /* external timers expiring first, some above internal ones only */
+    for (int i = 0; i < ARRAY_SIZE(ext); i++) {
+        timer_init_full(&ext[i], &t->tlg, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                        QEMU_TIMER_ATTR_EXTERNAL, timer_fired, NULL);
+        timer_mod_ns(&ext[i], 10 + i * 100);
+    }
+    timer_mod_ns(&t->timers[0], 250);
+    timer_mod_ns(&t->timers[1], 150);
+    timer_mod_ns(&t->timers[2], 350);
+
+    g_assert_cmpint(timerlistgroup_deadline_ns(&t->tlg), ==, 10);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          QEMU_TIMER_ATTR_ALL);
+    g_assert_cmpint(deadline, ==, 10);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    g_assert_cmpint(deadline, ==, 150);
+
+    /* relative to the current time, and 0 once expired */
+    my_clock_value = 100;
+    g_assert_cmpint(timerlistgroup_deadline_ns(&t->tlg), ==, 0);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    g_assert_cmpint(deadline, ==, 50);
+
+    timer_del(&t->timers[1]);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    g_assert_cmpint(deadline, ==, 150);
+
+    /* no timer matches */
+    timer_del(&t->timers[0]);
+    timer_del(&t->timers[2]);
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          ~QEMU_TIMER_ATTR_EXTERNAL);
+    g_assert_cmpint(deadline, ==, -1);
+
+    for (int i = 0; i < ARRAY_SIZE(ext); i++) {
+        timer_del(&ext[i]);
+        timer_deinit(&ext[i]);
+    }
+    g_assert_cmpint(timerlistgroup_deadline_ns(&t->tlg), ==, -1);
+    timers_free(t);
+}
+
+/* Random operations, checked against the expected (expire, arming) order */
+static void test_random(void)
+{
+    TestTimers *t = timers_new();
+    int64_t expire[N_TIMERS];
+    uint64_t armed[N_TIMERS], seq = 0;
+    int order[N_TIMERS], n = 0;
+
+    for (int i = 0; i < N_TIMERS; i++) {
+        expire[i] = -1;
+    }
+    for (int k = 0; k < 10000; k++) {
+        int i = g_test_rand_int_range(0, N_TIMERS);
+        int64_t e = g_test_rand_int_range(0, 200);
+
+        switch (g_test_rand_int_range(0, 3)) {
+        case 0:
+            timer_mod_ns(&t->timers[i], e);
+            expire[i] = e;
+            armed[i] = seq++;
+            break;
+        case 1:
+            timer_mod_anticipate_ns(&t->timers[i], e);
+            if (expire[i] == -1 || expire[i] > e) {
+                expire[i] = e;
+                armed[i] = seq++;
+            }
+            break;
+        case 2:
+            timer_del(&t->timers[i]);
+            expire[i] = -1;
+            break;
+        }
+        g_assert_cmpint(timer_expire_time_ns(&t->timers[i]), ==, expire[i]);
+    }
+
+    for (int i = 0; i < N_TIMERS; i++) {
+        int j;
+
+        if (expire[i] == -1) {
+            continue;
+        }
+        for (j = n; j > 0; j--) {
+            int o = order[j - 1];
+
+            if (expire[o] < expire[i] ||
+                (expire[o] == expire[i] && armed[o] < armed[i])) {
+                break;
+            }
+            order[j] = o;
+        }
+        order[j] = i;
+        n++;
+    }
+    timers_run(t, 200);
+    assert_fired(t, order, n);
+    timers_free(t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    init_clocks(NULL);
+    qemu_clock_enable(QEMU_CLOCK_VIRTUAL, true);
+
+    g_test_add_func("/qemu-timer/order", test_order);
+    g_test_add_func("/qemu-timer/equal-fifo", test_equal_fifo);
+    g_test_add_func("/qemu-timer/del", test_del);
+    g_test_add_func("/qemu-timer/del-root", test_del_root);
+    g_test_add_func("/qemu-timer/rearm", test_rearm);
+    g_test_add_func("/qemu-timer/mod-anticipate", test_mod_anticipate);
+    g_test_add_func("/qemu-timer/notify", test_notify);
+    g_test_add_func("/qemu-timer/deadline-attr", test_deadline_attr);
+    g_test_add_func("/qemu-timer/random", test_random);
+    return g_test_run();
+}
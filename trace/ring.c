@@ -0,0 +1,122 @@
+/*
+ * Shared memory ring trace backend
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/memalign.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "trace/control.h"
+#include "trace/ring.h"
+#ifdef EMSCRIPTEN
+#include <emscripten.h>
+#endif
+
+/* Power of two; a reader polling every 100 ms keeps up with 40 MB/s */
+#define TRACE_RING_SIZE (4 * MiB)
+
+static TraceRingHeader *ring;
+static uint8_t *ring_data;
+
+/* Arrays of TraceRingDesc, one per group of events */
+static GPtrArray *ring_descs;
+
+int trace_ring_record_start(TraceRingWriter *w, uint32_t event, size_t arglen)
+{
+    uint32_t length = ROUND_UP(sizeof(TraceRingRecord) + arglen, 8);
+    uint32_t head, off, pad;
+
+    if (!ring) {
+        return -ENOSPC;
+    }
+
+    do {
+        head = qatomic_read(&ring->head);
+        off = head & (TRACE_RING_SIZE - 1);
+        pad = off + length > TRACE_RING_SIZE ? TRACE_RING_SIZE - off : 0;
+
+        if (head + pad + length - qatomic_read(&ring->tail) > TRACE_RING_SIZE) {
+            qatomic_inc(&ring->dropped);
+            return -ENOSPC;
+        }
+    } while (qatomic_cmpxchg(&ring->head, head, head + pad + length) != head);
+
+    if (pad) {
+        TraceRingRecord *p = (TraceRingRecord *)(ring_data + off);
+
+        p->event = TRACE_RING_PAD_ID;
+        qatomic_store_release(&p->length, pad);
+        off = 0;
+    }
+
+    w->rec = (TraceRingRecord *)(ring_data + off);
+    w->rec->event = event;
+    w->rec->timestamp_ns = get_clock();
+    w->length = length;
+    w->ptr = (uint8_t *)(w->rec + 1);
+    return 0;
+}
+
+static void trace_ring_publish_table(void)
+{
+    GString *table = g_string_new(NULL);
+
+    for (guint i = 0; i < ring_descs->len; i++) {
+        const TraceRingDesc *d = g_ptr_array_index(ring_descs, i);
+
+        for (; d->event; d++) {
+            g_string_append_printf(table, "%" PRIu32 " %s %s %s\n",
+                                   trace_event_get_id(d->event),
+                                   trace_event_get_name(d->event),
+                                   *d->args ? d->args : "-", d->fmt);
+        }
+    }
+
+    /* The reader may still be parsing the previous table, leak it */
+    qatomic_store_release(&ring->table,
+                          (uintptr_t)g_string_free(table, false));
+    qatomic_inc(&ring->table_gen);
+}
+
+void trace_ring_register_descs(const TraceRingDesc *descs)
+{
+    if (!ring_descs) {
+        ring_descs = g_ptr_array_new();
+    }
+    g_ptr_array_add(ring_descs, (gpointer)descs);
+
+    /* Groups of modules loaded after startup */
+    if (ring) {
+        trace_ring_publish_table();
+    }
+}
+
+bool trace_ring_init(void)
+{
+    TraceRingHeader *hdr;
+
+    hdr = qemu_memalign(64, sizeof(*hdr) + TRACE_RING_SIZE);
+    memset(hdr, 0, sizeof(*hdr) + TRACE_RING_SIZE);
+    hdr->magic = TRACE_RING_MAGIC;
+    hdr->version = TRACE_RING_VERSION;
+    hdr->size = TRACE_RING_SIZE;
+    ring_data = (uint8_t *)(hdr + 1);
+
+    if (!ring_descs) {
+        ring_descs = g_ptr_array_new();
+    }
+    ring = hdr;
+    trace_ring_publish_table();
+    return true;
+}
+
+#ifdef EMSCRIPTEN
+EMSCRIPTEN_KEEPALIVE
+#endif
+TraceRingHeader *qemu_trace_ring_get(void)
+{
+    return ring;
+}
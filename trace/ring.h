@@ -0,0 +1,117 @@
+/*
+ * Shared memory ring trace backend
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "trace/control.h"
+
+/*
+ * Trace records are written in binary to a ring in the memory of the
+ * process, where a reader running next to it takes them: with emscripten,
+ * the wasm memory is a SharedArrayBuffer that JavaScript reads directly,
+ * see examples/tracing/trace-ring.js.  A record costs a few stores, with
+ * no formatting and no I/O.
+ *
+ * The ring starts with a TraceRingHeader, whose address is returned by
+ * qemu_trace_ring_get(), and is followed by @size bytes of records.
+ * @head and @tail count bytes since the start and wrap around at 2^32.
+ * Writers claim [head, head + length) while head + length - tail fits in
+ * @size, and drop the record otherwise.  The reader releases records by
+ * moving @tail.
+ *
+ * A record is a TraceRingRecord followed by the arguments of the event,
+ * each a 64-bit little endian value, or for strings a 32-bit length and
+ * the bytes of the string.  Records are padded to 8 bytes and never wrap:
+ * a record that would is preceded by a record of event TRACE_RING_PAD_ID
+ * which fills the end of the ring, and may be only 8 bytes long.
+ * @length is stored last, so a zero @length is a record still being
+ * written; the reader clears @length again before releasing a record.
+ *
+ * @table is a NUL-terminated text with one line per event:
+ * "<id> <name> <args> <format>", where each character of <args> is 'u'
+ * for an integer or pointer argument and 's' for a string, or <args> is
+ * '-' for an event without arguments, and <format> is the printf format
+ * of the event.  The table is replaced, and @table_gen incremented,
+ * whenever a group of events is registered.
+ */
+
+#define TRACE_RING_MAGIC 0x51524e47 /* "QRNG" */
+#define TRACE_RING_VERSION 1
+#define TRACE_RING_PAD_ID UINT32_MAX
+
+#define MAX_TRACE_STRLEN 512
+
+typedef struct TraceRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    uint32_t table;
+    uint32_t table_gen;
+} TraceRingHeader;
+
+typedef struct TraceRingRecord {
+    uint32_t length;
+    uint32_t event;
+    uint64_t timestamp_ns;
+} TraceRingRecord;
+
+/* Each generated trace-<group>.c registers one of these per event */
+typedef struct TraceRingDesc {
+    TraceEvent *event;
+    const char *args;
+    const char *fmt;
+} TraceRingDesc;
+
+void trace_ring_register_descs(const TraceRingDesc *descs);
+
+bool trace_ring_init(void);
+TraceRingHeader *qemu_trace_ring_get(void);
+
+typedef struct TraceRingWriter {
+    TraceRingRecord *rec;
+    uint32_t length;
+    uint8_t *ptr;
+} TraceRingWriter;
+
+/**
+ * trace_ring_record_start:
+ * @arglen: number of bytes of the arguments
+ *
+ * Claim space for a record of @event.  Returns -ENOSPC if the ring is
+ * full, in which case the record is dropped.
+ */
+int trace_ring_record_start(TraceRingWriter *w, uint32_t event, size_t arglen);
+
+static inline void trace_ring_write_u64(TraceRingWriter *w, uint64_t val)
+{
+    stq_le_p(w->ptr, val);
+    w->ptr += 8;
+}
+
+static inline void trace_ring_write_str(TraceRingWriter *w, const char *s,
+                                        uint32_t slen)
+{
+    stl_le_p(w->ptr, slen);
+    if (slen) {
+        memcpy(w->ptr + 4, s, slen);
+    }
+    w->ptr += 4 + slen;
+}
+
+/* Publish the record to the reader */
+static inline void trace_ring_record_finish(TraceRingWriter *w)
+{
+    qatomic_store_release(&w->rec->length, w->length);
+}
+
+#endif /* TRACE_RING_H */
@@ -30,6 +30,7 @@
 #include "qapi/visitor.h"
 #include "qemu/coroutine.h"
 #include "qemu/error-report.h"
+#include "qemu/heap-account.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
@@ -544,6 +545,8 @@ DisplaySurface *qemu_create_displaysurface(int width, int height)
         width * 4, bits
     );
     surface->flags = QEMU_ALLOCATED_FLAG;
+    heap_account_add(HEAP_SUBSYSTEM_FRAMEBUFFERS,
+                     (size_t)surface_stride(surface) * surface_height(surface));
 
 #ifdef WIN32
     qemu_displaysurface_win32_set_handle(surface, handle, 0);
@@ -610,6 +613,11 @@ void qemu_free_displaysurface(DisplaySurface *surface)
         return;
     }
     trace_displaysurface_free(surface);
+    if (surface->flags & QEMU_ALLOCATED_FLAG) {
+        heap_account_sub(HEAP_SUBSYSTEM_FRAMEBUFFERS,
+                         (size_t)surface_stride(surface) *
+                         surface_height(surface));
+    }
     qemu_pixman_image_unref(surface->image);
     g_free(surface);
 }
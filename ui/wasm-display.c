@@ -24,6 +24,8 @@
 #include "qemu/osdep.h"
 #include "qemu/module.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+#include "qemu/heap-account.h"
 #include "qapi/error.h"
 #include "ui/console.h"
 #include "ui/wasm-display.h"
@@ -35,6 +37,10 @@
 #include <emscripten/html5.h>
 #endif
 
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
 /* Maximum framebuffer size (4K resolution with RGBA) */
 #define WASM_FB_MAX_WIDTH  3840
 #define WASM_FB_MAX_HEIGHT 2160
@@ -44,6 +50,17 @@
 #define WASM_FB_DEFAULT_WIDTH  1024
 #define WASM_FB_DEFAULT_HEIGHT 768
 
+/*
+ * Refresh rate in coalescing mode.  In all modes the refresh backs off
+ * while the guest does not draw, and goes idle while the page is hidden.
+ */
+#define WASM_REFRESH_FPS_DEFAULT 60
+#define WASM_REFRESH_INTERVAL_INC 50
+#define WASM_REFRESH_INTERVAL_MAX 500
+
+/* Converts @n pixels of a surface format to RGBA */
+typedef void (*WasmConvertFunc)(uint8_t *dst, const uint8_t *src, int n);
+
 typedef struct WasmDisplayState {
     DisplayChangeListener dcl;
     DisplaySurface *ds;
@@ -54,6 +71,34 @@ typedef struct WasmDisplayState {
     size_t fb_allocated_size;
     WasmFramebufferInfo fb_info;
 
+    /* Export 32 bpp surfaces directly instead of converting to fb_data */
+    bool zero_copy;
+    /* fb_info points at the current surface */
+    bool shared;
+    /* Converter from the surface format, or NULL to go through pixman */
+    WasmConvertFunc convert;
+    /* fb_data as a pixman image, for the formats without a converter */
+    pixman_image_t *fb_image;
+
+    /* Notify JavaScript once per refresh instead of once per update */
+    bool coalesce;
+    /* Updated since the last refresh */
+    bool updated;
+    /* Inside graphic_hw_update(), and updated from there */
+    bool in_refresh;
+    bool refresh_updated;
+    /* Shortest refresh interval in ms */
+    uint64_t refresh_interval;
+    /* The page is hidden, nobody looks at the framebuffer */
+    bool hidden;
+
+    /* Input events queued by JavaScript, drained by input_bh */
+    WasmInputRing input_ring;
+    QEMUBH *input_bh;
+
+    /* Hardware cursor for JavaScript access */
+    WasmCursorInfo cursor_info;
+
     /* Mouse state */
     int mouse_x;
     int mouse_y;
@@ -64,6 +109,14 @@ typedef struct WasmDisplayState {
 /* Global state for JavaScript access */
 static WasmDisplayState *wasm_display_state = NULL;
 
+/* Input is likely to make the guest draw, so go back to full rate */
+static void wasm_display_activity(WasmDisplayState *wds)
+{
+    if (!wds->hidden && wds->dcl.update_interval != wds->refresh_interval) {
+        update_displaychangelistener(&wds->dcl, wds->refresh_interval);
+    }
+}
+
 /* ------------------------------------------------------------------ */
 /* Exported functions for JavaScript access                           */
 /* ------------------------------------------------------------------ */
@@ -84,10 +137,10 @@ EMSCRIPTEN_KEEPALIVE
 #endif
 uint8_t *wasm_get_framebuffer_data(void)
 {
-    if (!wasm_display_state || !wasm_display_state->fb_data) {
+    if (!wasm_display_state) {
         return NULL;
     }
-    return wasm_display_state->fb_data;
+    return wasm_display_state->fb_info.data;
 }
 
 #ifdef __EMSCRIPTEN__
@@ -112,6 +165,7 @@ void wasm_framebuffer_ack(void)
 {
     if (wasm_display_state) {
         wasm_display_state->fb_info.dirty = false;
+        wasm_display_state->fb_info.damage_count = 0;
     }
 }
 
@@ -126,6 +180,28 @@ bool wasm_framebuffer_is_dirty(void)
     return wasm_display_state->fb_info.dirty;
 }
 
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+int32_t wasm_get_framebuffer_damage_count(void)
+{
+    if (!wasm_display_state) {
+        return 0;
+    }
+    return wasm_display_state->fb_info.damage_count;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+WasmRect *wasm_get_framebuffer_damage(void)
+{
+    if (!wasm_display_state) {
+        return NULL;
+    }
+    return wasm_display_state->fb_info.damage;
+}
+
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
@@ -137,6 +213,32 @@ uint64_t wasm_get_frame_count(void)
     return wasm_display_state->fb_info.frame_count;
 }
 
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+uint32_t wasm_get_refresh_interval(void)
+{
+    if (!wasm_display_state) {
+        return 0;
+    }
+    return wasm_display_state->dcl.update_interval;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void wasm_set_display_visible(bool visible)
+{
+    if (!wasm_display_state) {
+        return;
+    }
+
+    wasm_display_state->hidden = !visible;
+    update_displaychangelistener(&wasm_display_state->dcl,
+                                 visible ? wasm_display_state->refresh_interval
+                                         : GUI_REFRESH_INTERVAL_IDLE);
+}
+
 #ifdef __EMSCRIPTEN__
 EMSCRIPTEN_KEEPALIVE
 #endif
@@ -146,6 +248,7 @@ void wasm_send_keyboard_event(int keycode, bool down)
         return;
     }
 
+    wasm_display_activity(wasm_display_state);
     qkbd_state_key_event(wasm_display_state->kbd, (QKeyCode)keycode, down);
 }
 
@@ -158,6 +261,7 @@ void wasm_send_mouse_motion(int x, int y)
         return;
     }
 
+    wasm_display_activity(wasm_display_state);
     wasm_display_state->mouse_x = x;
     wasm_display_state->mouse_y = y;
 
@@ -179,6 +283,8 @@ void wasm_send_mouse_button(int button, bool down)
         return;
     }
 
+    wasm_display_activity(wasm_display_state);
+
     InputButton btn;
     switch (button) {
     case 0:
@@ -207,6 +313,8 @@ void wasm_send_mouse_wheel(int dx, int dy)
         return;
     }
 
+    wasm_display_activity(wasm_display_state);
+
     if (dy != 0) {
         InputButton btn = dy > 0 ? INPUT_BUTTON_WHEEL_UP : INPUT_BUTTON_WHEEL_DOWN;
         qemu_input_queue_btn(wasm_display_state->dcl.con, btn, true);
@@ -216,13 +324,482 @@ void wasm_send_mouse_wheel(int dx, int dy)
     }
 }
 
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+WasmCursorInfo *wasm_get_cursor_info(void)
+{
+    if (!wasm_display_state) {
+        return NULL;
+    }
+    return &wasm_display_state->cursor_info;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+WasmInputRing *wasm_get_input_ring(void)
+{
+    if (!wasm_display_state) {
+        return NULL;
+    }
+    return &wasm_display_state->input_ring;
+}
+
+#ifdef __EMSCRIPTEN__
+EMSCRIPTEN_KEEPALIVE
+#endif
+void wasm_input_kick(void)
+{
+    if (wasm_display_state) {
+        qemu_bh_schedule(wasm_display_state->input_bh);
+    }
+}
+
+/*
+ * Process the events of the input ring.  Mouse motion that is followed
+ * by more motion is dropped, only the last position matters.
+ */
+static void wasm_input_drain(WasmDisplayState *wds)
+{
+    WasmInputRing *ring = &wds->input_ring;
+    uint32_t head = qatomic_load_acquire(&ring->head);
+    uint32_t tail = ring->tail;
+
+    while (tail != head) {
+        WasmInputEvent *ev = &ring->events[tail % WASM_INPUT_RING_SIZE];
+        WasmInputEvent *next = &ring->events[(tail + 1) %
+                                             WASM_INPUT_RING_SIZE];
+
+        switch (ev->type) {
+        case WASM_INPUT_KEY:
+            wasm_send_keyboard_event(ev->a, ev->b);
+            break;
+        case WASM_INPUT_MOTION:
+            if (tail + 1 == head || next->type != WASM_INPUT_MOTION) {
+                wasm_send_mouse_motion(ev->a, ev->b);
+            }
+            break;
+        case WASM_INPUT_BUTTON:
+            wasm_send_mouse_button(ev->a, ev->b);
+            break;
+        case WASM_INPUT_WHEEL:
+            wasm_send_mouse_wheel(ev->a, ev->b);
+            break;
+        }
+        tail++;
+    }
+
+    qatomic_store_release(&ring->tail, tail);
+}
+
+static void wasm_input_bh(void *opaque)
+{
+    wasm_input_drain(opaque);
+}
+
+/* ------------------------------------------------------------------ */
+/* Damage tracking                                                    */
+/* ------------------------------------------------------------------ */
+
+static int64_t wasm_rect_area(const WasmRect *r)
+{
+    return (int64_t)r->w * r->h;
+}
+
+static bool wasm_rect_intersects(const WasmRect *a, const WasmRect *b)
+{
+    return a->x < b->x + b->w && b->x < a->x + a->w &&
+           a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+static WasmRect wasm_rect_union(const WasmRect *a, const WasmRect *b)
+{
+    WasmRect r;
+
+    r.x = MIN(a->x, b->x);
+    r.y = MIN(a->y, b->y);
+    r.w = MAX(a->x + a->w, b->x + b->w) - r.x;
+    r.h = MAX(a->y + a->h, b->y + b->h) - r.y;
+    return r;
+}
+
+/*
+ * Add a region to the damage list.  It is merged with the rectangles
+ * it overlaps, or that cover no more area merged than apart, so that
+ * the list never has overlapping rectangles.  When the list is full,
+ * it is merged with the rectangle whose union wastes the least area.
+ */
+static void wasm_damage_add(WasmFramebufferInfo *info, int x, int y,
+                            int w, int h)
+{
+    WasmRect r = { x, y, w, h };
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+
+    while (info->damage_count) {
+        int64_t best_cost = INT64_MAX;
+        int merge = -1, best = 0;
+
+        for (int i = 0; i < info->damage_count && merge < 0; i++) {
+            WasmRect *d = &info->damage[i];
+            WasmRect u = wasm_rect_union(&r, d);
+            int64_t cost = wasm_rect_area(&u) - wasm_rect_area(&r) -
+                           wasm_rect_area(d);
+
+            if (wasm_rect_intersects(&r, d) || cost <= 0) {
+                merge = i;
+            } else if (cost < best_cost) {
+                best_cost = cost;
+                best = i;
+            }
+        }
+
+        if (merge < 0) {
+            if (info->damage_count < WASM_FB_MAX_DAMAGE) {
+                break;
+            }
+            merge = best;
+        }
+
+        /* The union may now overlap others, so look again */
+        r = wasm_rect_union(&r, &info->damage[merge]);
+        info->damage[merge] = info->damage[--info->damage_count];
+    }
+
+    info->damage[info->damage_count++] = r;
+}
+
 /* ------------------------------------------------------------------ */
 /* DisplayChangeListener callbacks                                    */
 /* ------------------------------------------------------------------ */
 
+static void wasm_notify_update(void)
+{
+#ifdef __EMSCRIPTEN__
+    /*
+     * Notify JavaScript that framebuffer was updated, and the rendering
+     * worker if the page has set one up
+     */
+    EM_ASM({
+        if (typeof window !== 'undefined' && window.onWasmFramebufferUpdate) {
+            window.onWasmFramebufferUpdate();
+        }
+        if (Module['wasmDisplayPort']) {
+            Module['wasmDisplayPort'].postMessage({ type: 'update' });
+        }
+    });
+#endif
+}
+
 static void wasm_refresh(DisplayChangeListener *dcl)
 {
+    WasmDisplayState *wds = container_of(dcl, WasmDisplayState, dcl);
+
+    /* In case JavaScript queued input events without a kick */
+    wasm_input_drain(wds);
+
+    /*
+     * VGA reports each run of dirty scanlines with its own update: tell
+     * JavaScript once for all of them, even without coalescing
+     */
+    wds->in_refresh = true;
     graphic_hw_update(dcl->con);
+    wds->in_refresh = false;
+    if (wds->refresh_updated) {
+        wds->refresh_updated = false;
+        if (!wds->coalesce) {
+            wasm_notify_update();
+        }
+    }
+
+    if (wds->updated) {
+        wds->updated = false;
+        if (wds->coalesce) {
+            /* One notification for all the updates of this refresh */
+            wasm_notify_update();
+        }
+        dcl->update_interval = MAX(dcl->update_interval / 2,
+                                   wds->refresh_interval);
+    } else {
+        /* Back off like vnc_refresh() while the screen is static */
+        dcl->update_interval = MIN(dcl->update_interval +
+                                   WASM_REFRESH_INTERVAL_INC,
+                                   MAX(WASM_REFRESH_INTERVAL_MAX,
+                                       wds->refresh_interval));
+    }
+
+    if (wds->hidden) {
+        dcl->update_interval = GUI_REFRESH_INTERVAL_IDLE;
+    }
+}
+
+/*
+ * Formats that JavaScript can take as they are in zero-copy mode: RGBA
+ * byte order for putImageData(), or the other 32 bpp byte orders for a
+ * WebGL shader to swizzle.  These are all the formats of virtio-gpu 2D
+ * resources, whose surfaces share the resource memory, so that
+ * TRANSFER_TO_HOST_2D writes straight into what JavaScript reads, and
+ * of the VBE modes of VGA at 32 bpp, whose surfaces share the VRAM.
+ */
+static bool wasm_format_is_exported(pixman_format_code_t format)
+{
+    switch (format) {
+    case PIXMAN_x8r8g8b8:
+    case PIXMAN_a8r8g8b8:
+    case PIXMAN_x8b8g8r8:
+    case PIXMAN_a8b8g8r8:
+    case PIXMAN_b8g8r8x8:
+    case PIXMAN_b8g8r8a8:
+    case PIXMAN_r8g8b8x8:
+    case PIXMAN_r8g8b8a8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* Pixel format conversion                                            */
+/* ------------------------------------------------------------------ */
+
+/* Widen a 5 or 6 bit channel to 8 bits, replicating the high bits */
+#define WASM_EXPAND5(c) (((c) << 3) | ((c) >> 2))
+#define WASM_EXPAND6(c) (((c) << 2) | ((c) >> 4))
+
+static void wasm_convert_rgbx(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t alpha = wasm_u32x4_splat(0xff000000);
+
+    for (; i + 4 <= n; i += 4) {
+        v128_t v = wasm_v128_load(src + i * 4);
+        wasm_v128_store(dst + i * 4, wasm_v128_or(v, alpha));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 4 + 0] = src[i * 4 + 0];
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = src[i * 4 + 2];
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+static void wasm_convert_bgrx(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t alpha = wasm_u32x4_splat(0xff000000);
+
+    for (; i + 4 <= n; i += 4) {
+        v128_t v = wasm_v128_load(src + i * 4);
+        v = wasm_i8x16_shuffle(v, v, 2, 1, 0, 3, 6, 5, 4, 7,
+                               10, 9, 8, 11, 14, 13, 12, 15);
+        wasm_v128_store(dst + i * 4, wasm_v128_or(v, alpha));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 4 + 0] = src[i * 4 + 2];
+        dst[i * 4 + 1] = src[i * 4 + 1];
+        dst[i * 4 + 2] = src[i * 4 + 0];
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+/* PIXMAN_b8g8r8x8, X R G B in memory */
+static void wasm_convert_xrgb(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t alpha = wasm_u32x4_splat(0xff000000);
+
+    for (; i + 4 <= n; i += 4) {
+        v128_t v = wasm_v128_load(src + i * 4);
+        v = wasm_i8x16_shuffle(v, v, 1, 2, 3, 0, 5, 6, 7, 4,
+                               9, 10, 11, 8, 13, 14, 15, 12);
+        wasm_v128_store(dst + i * 4, wasm_v128_or(v, alpha));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 4 + 0] = src[i * 4 + 1];
+        dst[i * 4 + 1] = src[i * 4 + 2];
+        dst[i * 4 + 2] = src[i * 4 + 3];
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+/* PIXMAN_b8g8r8, R G B in memory */
+static void wasm_convert_rgb24(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t alpha = wasm_u8x16_splat(0xff);
+
+    /* 4 pixels per 16 byte load, which reads 4 bytes past them */
+    for (; i + 6 <= n; i += 4) {
+        v128_t v = wasm_v128_load(src + i * 3);
+        v = wasm_i8x16_shuffle(v, alpha, 0, 1, 2, 16, 3, 4, 5, 16,
+                               6, 7, 8, 16, 9, 10, 11, 16);
+        wasm_v128_store(dst + i * 4, v);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 4 + 0] = src[i * 3 + 0];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 2];
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+/* PIXMAN_r8g8b8, B G R in memory */
+static void wasm_convert_bgr24(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t alpha = wasm_u8x16_splat(0xff);
+
+    for (; i + 6 <= n; i += 4) {
+        v128_t v = wasm_v128_load(src + i * 3);
+        v = wasm_i8x16_shuffle(v, alpha, 2, 1, 0, 16, 5, 4, 3, 16,
+                               8, 7, 6, 16, 11, 10, 9, 16);
+        wasm_v128_store(dst + i * 4, v);
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i * 4 + 0] = src[i * 3 + 2];
+        dst[i * 4 + 1] = src[i * 3 + 1];
+        dst[i * 4 + 2] = src[i * 3 + 0];
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+#ifdef __wasm_simd128__
+/*
+ * Store 8 pixels, given as 16 bit lanes of R | G << 8 and B, as RGBA
+ */
+static inline void wasm_store_rgba16(uint8_t *dst, v128_t rg, v128_t b)
+{
+    v128_t ba = wasm_v128_or(b, wasm_u16x8_splat(0xff00));
+
+    wasm_v128_store(dst, wasm_i16x8_shuffle(rg, ba, 0, 8, 1, 9,
+                                            2, 10, 3, 11));
+    wasm_v128_store(dst + 16, wasm_i16x8_shuffle(rg, ba, 4, 12, 5, 13,
+                                                 6, 14, 7, 15));
+}
+#endif
+
+static void wasm_convert_r5g6b5(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t mask5 = wasm_i16x8_splat(0x1f);
+    const v128_t mask6 = wasm_i16x8_splat(0x3f);
+
+    for (; i + 8 <= n; i += 8) {
+        v128_t p = wasm_v128_load(src + i * 2);
+        v128_t r = wasm_u16x8_shr(p, 11);
+        v128_t g = wasm_v128_and(wasm_u16x8_shr(p, 5), mask6);
+        v128_t b = wasm_v128_and(p, mask5);
+
+        r = wasm_v128_or(wasm_i16x8_shl(r, 3), wasm_u16x8_shr(r, 2));
+        g = wasm_v128_or(wasm_i16x8_shl(g, 2), wasm_u16x8_shr(g, 4));
+        b = wasm_v128_or(wasm_i16x8_shl(b, 3), wasm_u16x8_shr(b, 2));
+        wasm_store_rgba16(dst + i * 4,
+                          wasm_v128_or(r, wasm_i16x8_shl(g, 8)), b);
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t p = lduw_le_p(src + i * 2);
+        uint8_t r = p >> 11, g = (p >> 5) & 0x3f, b = p & 0x1f;
+
+        dst[i * 4 + 0] = WASM_EXPAND5(r);
+        dst[i * 4 + 1] = WASM_EXPAND6(g);
+        dst[i * 4 + 2] = WASM_EXPAND5(b);
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+static void wasm_convert_x1r5g5b5(uint8_t *dst, const uint8_t *src, int n)
+{
+    int i = 0;
+
+#ifdef __wasm_simd128__
+    const v128_t mask5 = wasm_i16x8_splat(0x1f);
+
+    for (; i + 8 <= n; i += 8) {
+        v128_t p = wasm_v128_load(src + i * 2);
+        v128_t r = wasm_v128_and(wasm_u16x8_shr(p, 10), mask5);
+        v128_t g = wasm_v128_and(wasm_u16x8_shr(p, 5), mask5);
+        v128_t b = wasm_v128_and(p, mask5);
+
+        r = wasm_v128_or(wasm_i16x8_shl(r, 3), wasm_u16x8_shr(r, 2));
+        g = wasm_v128_or(wasm_i16x8_shl(g, 3), wasm_u16x8_shr(g, 2));
+        b = wasm_v128_or(wasm_i16x8_shl(b, 3), wasm_u16x8_shr(b, 2));
+        wasm_store_rgba16(dst + i * 4,
+                          wasm_v128_or(r, wasm_i16x8_shl(g, 8)), b);
+    }
+#endif
+    for (; i < n; i++) {
+        uint16_t p = lduw_le_p(src + i * 2);
+        uint8_t r = (p >> 10) & 0x1f, g = (p >> 5) & 0x1f, b = p & 0x1f;
+
+        dst[i * 4 + 0] = WASM_EXPAND5(r);
+        dst[i * 4 + 1] = WASM_EXPAND5(g);
+        dst[i * 4 + 2] = WASM_EXPAND5(b);
+        dst[i * 4 + 3] = 0xff;
+    }
+}
+
+/*
+ * The formats that VGA, bochs-display, virtio-gpu and ramfb create
+ * surfaces in.  The rest is left to pixman.
+ */
+static WasmConvertFunc wasm_convert_func(pixman_format_code_t format)
+{
+    switch (format) {
+    case PIXMAN_x8r8g8b8:
+    case PIXMAN_a8r8g8b8:
+        return wasm_convert_bgrx;
+    case PIXMAN_x8b8g8r8:
+    case PIXMAN_a8b8g8r8:
+        return wasm_convert_rgbx;
+    case PIXMAN_b8g8r8x8:
+    case PIXMAN_b8g8r8a8:
+        return wasm_convert_xrgb;
+    case PIXMAN_r8g8b8:
+        return wasm_convert_bgr24;
+    case PIXMAN_b8g8r8:
+        return wasm_convert_rgb24;
+    case PIXMAN_r5g6b5:
+        return wasm_convert_r5g6b5;
+    case PIXMAN_x1r5g5b5:
+        return wasm_convert_x1r5g5b5;
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Devices such as VGA share their framebuffer with the surface when the
+ * format is accepted here, instead of drawing it into a shadow surface
+ * first.  Take every format with a converter, which includes all those
+ * that can be exported: the only copy left is then the conversion to
+ * RGBA, made straight from the memory of the device, and none at all in
+ * zero-copy mode for 32 bpp.
+ */
+static bool wasm_check_format(DisplayChangeListener *dcl,
+                              pixman_format_code_t format)
+{
+    return wasm_convert_func(format) != NULL;
 }
 
 static void wasm_gfx_update(DisplayChangeListener *dcl,
@@ -235,6 +812,16 @@ static void wasm_gfx_update(DisplayChangeListener *dcl,
         return;
     }
 
+    if (wds->shared) {
+        /* JavaScript reads the surface itself, only track what changed */
+        int max_x = MIN(x + w, surface_width(surface));
+        int max_y = MIN(y + h, surface_height(surface));
+        x = MAX(0, x);
+        y = MAX(0, y);
+        wasm_damage_add(&wds->fb_info, x, y, max_x - x, max_y - y);
+        goto out;
+    }
+
     int src_stride = surface_stride(surface);
     int dst_stride = wds->fb_info.stride;
     uint8_t *src = (uint8_t *)surface_data(surface);
@@ -247,41 +834,36 @@ static void wasm_gfx_update(DisplayChangeListener *dcl,
     x = MAX(0, x);
     y = MAX(0, y);
 
-    /* Copy updated region */
-    for (int row = y; row < max_y; row++) {
-        uint8_t *src_line = src + row * src_stride + x * bpp;
-        uint8_t *dst_line = dst + row * dst_stride + x * 4;
-
-        if (bpp == 4) {
-            /* Direct copy for 32-bit surfaces (XRGB/ARGB) */
-            /* Convert BGRX to RGBA for Canvas compatibility */
-            for (int col = x; col < max_x; col++) {
-                uint32_t pixel = *(uint32_t *)src_line;
-                /* Extract BGRX and convert to RGBA */
-                dst_line[0] = (pixel >> 16) & 0xFF; /* R */
-                dst_line[1] = (pixel >> 8) & 0xFF;  /* G */
-                dst_line[2] = pixel & 0xFF;         /* B */
-                dst_line[3] = 0xFF;                 /* A */
-                src_line += 4;
-                dst_line += 4;
-            }
-        } else {
-            /* For other formats, copy as-is (may need conversion) */
-            memcpy(dst_line, src_line, (max_x - x) * bpp);
+    if (max_x <= x || max_y <= y) {
+        return;
+    }
+
+    /* Convert updated region to RGBA for Canvas compatibility */
+    if (wds->convert) {
+        for (int row = y; row < max_y; row++) {
+            wds->convert(dst + row * dst_stride + x * 4,
+                         src + row * src_stride + x * bpp, max_x - x);
         }
+    } else {
+#ifdef CONFIG_PIXMAN
+        pixman_image_composite(PIXMAN_OP_SRC, surface->image, NULL,
+                               wds->fb_image, x, y, 0, 0, x, y,
+                               max_x - x, max_y - y);
+#endif
     }
 
+    wasm_damage_add(&wds->fb_info, x, y, max_x - x, max_y - y);
+
+out:
     wds->fb_info.dirty = true;
     wds->fb_info.frame_count++;
 
-#ifdef __EMSCRIPTEN__
-    /* Notify JavaScript that framebuffer was updated */
-    EM_ASM({
-        if (typeof window !== 'undefined' && window.onWasmFramebufferUpdate) {
-            window.onWasmFramebufferUpdate();
-        }
-    });
-#endif
+    wds->updated = true;
+    if (wds->in_refresh) {
+        wds->refresh_updated = true;
+    } else if (!wds->coalesce) {
+        wasm_notify_update();
+    }
 }
 
 static void wasm_gfx_switch(DisplayChangeListener *dcl,
@@ -299,38 +881,81 @@ static void wasm_gfx_switch(DisplayChangeListener *dcl,
     int height = surface_height(new_surface);
     int stride = width * 4;  /* Always RGBA in output */
     size_t size = stride * height;
+    /* Page flips switch surfaces too, without changing the resolution */
+    bool resized = width != wds->fb_info.width ||
+                   height != wds->fb_info.height;
 
     /* Clamp to maximum size */
     if (width > WASM_FB_MAX_WIDTH || height > WASM_FB_MAX_HEIGHT) {
         fprintf(stderr, "wasm-display: resolution %dx%d exceeds maximum %dx%d\n",
                 width, height, WASM_FB_MAX_WIDTH, WASM_FB_MAX_HEIGHT);
+        /* Drop its updates, fb_info still describes the old surface */
+        wds->ds = NULL;
         return;
     }
 
-    /* Reallocate buffer if needed */
-    if (size > wds->fb_allocated_size) {
-        g_free(wds->fb_data);
-        wds->fb_data = g_malloc0(size);
-        wds->fb_allocated_size = size;
+    wds->shared = wds->zero_copy &&
+                  wasm_format_is_exported(surface_format(new_surface));
+
+    if (wds->shared) {
+        /* Hand out the surface as it is */
+        wds->fb_info.data = (uint8_t *)surface_data(new_surface);
+        wds->fb_info.stride = surface_stride(new_surface);
+        wds->fb_info.format = surface_format(new_surface);
+    } else {
+        /* Reallocate buffer if needed */
+        if (size > wds->fb_allocated_size) {
+            g_free(wds->fb_data);
+            heap_account_sub(HEAP_SUBSYSTEM_FRAMEBUFFERS,
+                             wds->fb_allocated_size);
+            wds->fb_data = g_malloc0(size);
+            wds->fb_allocated_size = size;
+            heap_account_add(HEAP_SUBSYSTEM_FRAMEBUFFERS, size);
+        }
+        wds->fb_info.data = wds->fb_data;
+        wds->fb_info.stride = stride;
+        wds->fb_info.format = PIXMAN_a8b8g8r8;
+
+        wds->convert = wasm_convert_func(surface_format(new_surface));
+        qemu_pixman_image_unref(wds->fb_image);
+        wds->fb_image = pixman_image_create_bits(PIXMAN_a8b8g8r8,
+                                                 width, height,
+                                                 (uint32_t *)wds->fb_data,
+                                                 stride);
     }
 
     /* Update framebuffer info */
-    wds->fb_info.data = wds->fb_data;
     wds->fb_info.width = width;
     wds->fb_info.height = height;
-    wds->fb_info.stride = stride;
     wds->fb_info.bpp = 32;
-    wds->fb_info.format = surface_format(new_surface);
+    wds->fb_info.damage_count = 0;
     wds->fb_info.dirty = true;
     wds->fb_info.frame_count++;
 
 #ifdef __EMSCRIPTEN__
     /* Notify JavaScript about resolution change */
+    if (resized) {
+        EM_ASM({
+            if (typeof window !== 'undefined' &&
+                window.onWasmFramebufferResize) {
+                window.onWasmFramebufferResize($0, $1);
+            }
+        }, width, height);
+    }
+
+    /*
+     * The rendering worker needs the heap again on every switch: the
+     * data may now be beyond the end of the view it had before the
+     * memory grew
+     */
     EM_ASM({
-        if (typeof window !== 'undefined' && window.onWasmFramebufferResize) {
-            window.onWasmFramebufferResize($0, $1);
+        if (Module['wasmDisplayPort']) {
+            Module['wasmDisplayPort'].postMessage({
+                type: 'switch', width: $0, height: $1, buffer: wasmMemory.buffer,
+                info: $2
+            });
         }
-    }, width, height);
+    }, width, height, &wds->fb_info);
 #endif
 
     /* Do initial full update */
@@ -345,6 +970,11 @@ static void wasm_mouse_set(DisplayChangeListener *dcl,
     wds->mouse_x = x;
     wds->mouse_y = y;
 
+    wds->cursor_info.x = x;
+    wds->cursor_info.y = y;
+    wds->cursor_info.visible = on;
+    wds->cursor_info.move_serial++;
+
 #ifdef __EMSCRIPTEN__
     EM_ASM({
         if (typeof window !== 'undefined' && window.onWasmMouseUpdate) {
@@ -357,6 +987,30 @@ static void wasm_mouse_set(DisplayChangeListener *dcl,
 static void wasm_cursor_define(DisplayChangeListener *dcl,
                                QEMUCursor *cursor)
 {
+    WasmDisplayState *wds = container_of(dcl, WasmDisplayState, dcl);
+    WasmCursorInfo *info = &wds->cursor_info;
+
+    if (cursor) {
+        size_t n = cursor->width * cursor->height;
+
+        /* QEMUCursor pixels are ARGB words, with straight alpha */
+        g_free(info->data);
+        info->data = g_malloc(n * 4);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t p = cursor->data[i];
+
+            info->data[i * 4 + 0] = p >> 16;
+            info->data[i * 4 + 1] = p >> 8;
+            info->data[i * 4 + 2] = p;
+            info->data[i * 4 + 3] = p >> 24;
+        }
+        info->width = cursor->width;
+        info->height = cursor->height;
+        info->hot_x = cursor->hot_x;
+        info->hot_y = cursor->hot_y;
+        info->shape_serial++;
+    }
+
 #ifdef __EMSCRIPTEN__
     if (cursor) {
         /* Export cursor data to JavaScript for custom cursor rendering */
@@ -370,12 +1024,13 @@ static void wasm_cursor_define(DisplayChangeListener *dcl,
 }
 
 static const DisplayChangeListenerOps wasm_display_ops = {
-    .dpy_name          = "wasm",
-    .dpy_refresh       = wasm_refresh,
-    .dpy_gfx_update    = wasm_gfx_update,
-    .dpy_gfx_switch    = wasm_gfx_switch,
-    .dpy_mouse_set     = wasm_mouse_set,
-    .dpy_cursor_define = wasm_cursor_define,
+    .dpy_name             = "wasm",
+    .dpy_refresh          = wasm_refresh,
+    .dpy_gfx_update       = wasm_gfx_update,
+    .dpy_gfx_switch       = wasm_gfx_switch,
+    .dpy_gfx_check_format = wasm_check_format,
+    .dpy_mouse_set        = wasm_mouse_set,
+    .dpy_cursor_define    = wasm_cursor_define,
 };
 
 /* ------------------------------------------------------------------ */
@@ -392,6 +1047,7 @@ static void wasm_display_init(DisplayState *ds, DisplayOptions *opts)
     /* Allocate initial framebuffer */
     wds->fb_allocated_size = WASM_FB_DEFAULT_WIDTH * WASM_FB_DEFAULT_HEIGHT * 4;
     wds->fb_data = g_malloc0(wds->fb_allocated_size);
+    heap_account_add(HEAP_SUBSYSTEM_FRAMEBUFFERS, wds->fb_allocated_size);
 
     /* Initialize framebuffer info */
     wds->fb_info.data = wds->fb_data;
@@ -401,6 +1057,7 @@ static void wasm_display_init(DisplayState *ds, DisplayOptions *opts)
     wds->fb_info.bpp = 32;
     wds->fb_info.dirty = false;
     wds->fb_info.frame_count = 0;
+    wds->fb_info.damage_count = 0;
 
     /* Initialize keyboard state */
     wds->kbd = qkbd_state_init(NULL);
@@ -409,11 +1066,26 @@ static void wasm_display_init(DisplayState *ds, DisplayOptions *opts)
     con = qemu_console_lookup_by_index(0);
     if (!con || !qemu_console_is_graphic(con)) {
         fprintf(stderr, "wasm-display: no graphic console found\n");
+        heap_account_sub(HEAP_SUBSYSTEM_FRAMEBUFFERS, wds->fb_allocated_size);
         g_free(wds->fb_data);
         g_free(wds);
         return;
     }
 
+    wds->zero_copy = opts->u.wasm.has_zero_copy && opts->u.wasm.zero_copy;
+    wds->coalesce = opts->u.wasm.has_coalesce && opts->u.wasm.coalesce;
+
+    if (opts->u.wasm.has_max_fps && opts->u.wasm.max_fps) {
+        wds->refresh_interval = MAX(1000 / opts->u.wasm.max_fps, 1);
+    } else if (wds->coalesce) {
+        wds->refresh_interval = 1000 / WASM_REFRESH_FPS_DEFAULT;
+    } else {
+        wds->refresh_interval = GUI_REFRESH_INTERVAL_DEFAULT;
+    }
+    wds->dcl.update_interval = wds->refresh_interval;
+
+    wds->input_bh = qemu_bh_new(wasm_input_bh, wds);
+
     wds->dcl.con = con;
     wds->dcl.ops = &wasm_display_ops;
 
@@ -431,8 +1103,9 @@ static void wasm_display_init(DisplayState *ds, DisplayOptions *opts)
     });
 #endif
 
-    fprintf(stderr, "wasm-display: initialized with %dx%d framebuffer\n",
-            wds->fb_info.width, wds->fb_info.height);
+    fprintf(stderr, "wasm-display: initialized with %dx%d framebuffer%s\n",
+            wds->fb_info.width, wds->fb_info.height,
+            wds->zero_copy ? " (zero-copy)" : "");
 }
 
 static QemuDisplay qemu_display_wasm = {
@@ -736,6 +736,11 @@ void aio_context_setup(AioContext *ctx)
     ctx->fdmon_ops = &fdmon_poll_ops;
     ctx->epollfd = -1;
 
+#ifdef EMSCRIPTEN
+    ctx->fdmon_ops = &fdmon_emscripten_ops;
+    return;
+#endif
+
     /* Use the fastest fd monitoring implementation if available */
     if (fdmon_io_uring_setup(ctx)) {
         return;
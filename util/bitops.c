@@ -13,6 +13,14 @@
 
 #include "qemu/osdep.h"
 #include "qemu/bitops.h"
+#include "qemu/cutils.h"
+
+/*
+ * Sparse bitmaps, like the dirty bitmap of a migration between two
+ * iterations, are skipped this many bits at a time with buffer_is_zero(),
+ * which uses the vector unit of the host.
+ */
+#define FIND_BIT_ZERO_CHUNK (4096 * BITS_PER_BYTE)
 
 /*
  * Find the next set bit in a memory region.
@@ -41,6 +49,12 @@ unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
         size -= BITS_PER_LONG;
         result += BITS_PER_LONG;
     }
+    while (size >= FIND_BIT_ZERO_CHUNK &&
+           buffer_is_zero(p, FIND_BIT_ZERO_CHUNK / BITS_PER_BYTE)) {
+        p += FIND_BIT_ZERO_CHUNK / BITS_PER_LONG;
+        result += FIND_BIT_ZERO_CHUNK;
+        size -= FIND_BIT_ZERO_CHUNK;
+    }
     while (size >= 4*BITS_PER_LONG) {
         unsigned long d1, d2, d3;
         tmp = *p;
@@ -264,6 +264,103 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__) || defined(__wasm_simd128__)
+#if defined(__aarch64__)
+#include <arm_neon.h>
+
+typedef uint8x16_t buffer_zero_vec;
+
+static inline uint8x16_t buffer_zero_vec_load(const void *p)
+{
+    return vld1q_u8(p);
+}
+
+static inline uint8x16_t buffer_zero_vec_or(uint8x16_t a, uint8x16_t b)
+{
+    return vorrq_u8(a, b);
+}
+
+static inline bool buffer_zero_vec_test(uint8x16_t t)
+{
+    return vmaxvq_u32(vreinterpretq_u32_u8(t)) == 0;
+}
+#else
+#include <wasm_simd128.h>
+
+typedef v128_t buffer_zero_vec;
+
+static inline v128_t buffer_zero_vec_load(const void *p)
+{
+    return wasm_v128_load(p);
+}
+
+static inline v128_t buffer_zero_vec_or(v128_t a, v128_t b)
+{
+    return wasm_v128_or(a, b);
+}
+
+static inline bool buffer_zero_vec_test(v128_t t)
+{
+    return !wasm_v128_any_true(t);
+}
+#endif
+
+/*
+ * Advanced SIMD is part of the AArch64 baseline, and a wasm module built
+ * with SIMD128 does not load without it, so there is nothing to probe at
+ * run time.  Like buffer_zero_sse2, this requires len >= 64.
+ */
+static bool buffer_zero_vec128(const void *buf, size_t len)
+{
+    buffer_zero_vec t = buffer_zero_vec_load(buf);
+    const uint8_t *p = (uint8_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint8_t *e = (uint8_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        if (unlikely(!buffer_zero_vec_test(t))) {
+            return false;
+        }
+        t = buffer_zero_vec_or(
+                buffer_zero_vec_or(buffer_zero_vec_load(p - 4 * 16),
+                                   buffer_zero_vec_load(p - 3 * 16)),
+                buffer_zero_vec_or(buffer_zero_vec_load(p - 2 * 16),
+                                   buffer_zero_vec_load(p - 1 * 16)));
+        p += 4 * 16;
+    }
+
+    /* Finish the aligned tail.  */
+    t = buffer_zero_vec_or(t, buffer_zero_vec_load(e - 3 * 16));
+    t = buffer_zero_vec_or(t, buffer_zero_vec_load(e - 2 * 16));
+    t = buffer_zero_vec_or(t, buffer_zero_vec_load(e - 1 * 16));
+
+    /* Finish the unaligned tail.  */
+    t = buffer_zero_vec_or(t, buffer_zero_vec_load(buf + len - 16));
+
+    return buffer_zero_vec_test(t);
+}
+
+static bool (*buffer_accel)(const void *, size_t) = buffer_zero_vec128;
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    /* The integer loop is the only other one to test.  */
+    if (buffer_accel == buffer_zero_int) {
+        return false;
+    }
+    buffer_accel = buffer_zero_int;
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64)) {
+        return buffer_accel(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
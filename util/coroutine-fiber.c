@@ -19,9 +19,20 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * With --with-coroutine=jspi, the same code is built for binaries linked
+ * with -sJSPI instead of -sASYNCIFY: the engine suspends the stack of a
+ * fiber as it is, so a switch costs the same whatever the depth of the
+ * stack, and TBs do not need to return for it to be unwound.
+ */
+
 #include "qemu/osdep.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
+#include "qemu/heap-account.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "trace.h"
 
 #include <emscripten/fiber.h>
 
@@ -38,37 +49,177 @@ typedef struct {
     emscripten_fiber_t fiber;
 } CoroutineEmscripten;
 
+/*
+ * Stacks are only needed from the time a coroutine is entered to the time
+ * it terminates: coroutines waiting for reuse in the pools of
+ * qemu-coroutine.c give theirs back, and get some again when entered.
+ * Asyncify stacks come in power of two sizes, so that coroutines that need
+ * less than COROUTINE_STACK_SIZE can take a smaller one.
+ */
+#define FIBER_ASYNCIFY_MIN_SIZE (64 * KiB)
+/* the native stacks, then asyncify stacks of 64 KiB up to 1 MiB */
+#define FIBER_NR_POOLS 6
+QEMU_BUILD_BUG_ON(FIBER_ASYNCIFY_MIN_SIZE << (FIBER_NR_POOLS - 2) !=
+                  COROUTINE_STACK_SIZE);
+/* free stacks kept in each pool */
+#define FIBER_POOL_MAX 64
+
+static struct {
+    QemuMutex lock;
+    void *free[FIBER_NR_POOLS][FIBER_POOL_MAX];
+    unsigned int nr_free[FIBER_NR_POOLS];
+    size_t native_size;
+    /* coroutines that hold stacks, and memory of all the stacks */
+    unsigned int live;
+    unsigned int live_max;
+    size_t bytes;
+    size_t bytes_max;
+} fiber_pool;
+
+static void __attribute__((constructor)) fiber_pool_init(void)
+{
+    qemu_mutex_init(&fiber_pool.lock);
+}
+
 /**
  * Per-thread coroutine bookkeeping
  */
 QEMU_DEFINE_STATIC_CO_TLS(Coroutine *, current);
 QEMU_DEFINE_STATIC_CO_TLS(CoroutineEmscripten *, leader);
+/* Terminated coroutine whose stacks are released once switched away from */
+QEMU_DEFINE_STATIC_CO_TLS(CoroutineEmscripten *, terminated);
+#ifdef CONFIG_COROUTINE_JSPI
+size_t leader_asyncify_stack_size = FIBER_ASYNCIFY_MIN_SIZE;
+#else
 size_t leader_asyncify_stack_size = COROUTINE_STACK_SIZE;
+#endif
+
+/* Returns the pool for an asyncify stack of @size, or -1 if it is too big */
+static int fiber_pool_index(size_t size)
+{
+    size_t pool_size = FIBER_ASYNCIFY_MIN_SIZE;
+    int i = 1;
+
+    while (pool_size < size) {
+        pool_size <<= 1;
+        i++;
+    }
+    return i < FIBER_NR_POOLS ? i : -1;
+}
+
+static void *fiber_pool_get(int i, size_t *size)
+{
+    void *buf = NULL;
+
+    qemu_mutex_lock(&fiber_pool.lock);
+    if (i >= 0 && fiber_pool.nr_free[i]) {
+        buf = fiber_pool.free[i][--fiber_pool.nr_free[i]];
+        if (i == 0) {
+            *size = fiber_pool.native_size;
+        }
+    }
+    qemu_mutex_unlock(&fiber_pool.lock);
+
+    if (!buf) {
+        if (i == 0) {
+            buf = qemu_alloc_stack(size);
+        } else {
+            buf = g_malloc0(*size);
+        }
+        qemu_mutex_lock(&fiber_pool.lock);
+        if (i == 0) {
+            fiber_pool.native_size = *size;
+        }
+        fiber_pool.bytes += *size;
+        heap_account_add(HEAP_SUBSYSTEM_COROUTINE_STACKS, *size);
+        if (fiber_pool.bytes > fiber_pool.bytes_max) {
+            fiber_pool.bytes_max = fiber_pool.bytes;
+        }
+        qemu_mutex_unlock(&fiber_pool.lock);
+    }
+    return buf;
+}
+
+static void fiber_pool_put(int i, void *buf, size_t size)
+{
+    qemu_mutex_lock(&fiber_pool.lock);
+    if (i >= 0 && fiber_pool.nr_free[i] < FIBER_POOL_MAX) {
+        fiber_pool.free[i][fiber_pool.nr_free[i]++] = buf;
+        buf = NULL;
+    } else {
+        fiber_pool.bytes -= size;
+        heap_account_sub(HEAP_SUBSYSTEM_COROUTINE_STACKS, size);
+    }
+    qemu_mutex_unlock(&fiber_pool.lock);
+
+    if (!buf) {
+        return;
+    }
+    if (i == 0) {
+        qemu_free_stack(buf, size);
+    } else {
+        g_free(buf);
+    }
+}
 
 static void coroutine_trampoline(void *co_)
 {
     Coroutine *co = co_;
 
-    while (true) {
-        co->entry(co->entry_arg);
-        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    co->entry(co->entry_arg);
+    qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    /* the fiber is set up again if the coroutine is reused */
+    g_assert_not_reached();
+}
+
+/* Gives stacks to @co, which is about to be entered for the first time */
+static void fiber_start(CoroutineEmscripten *co)
+{
+#ifdef CONFIG_COROUTINE_JSPI
+    /* Nothing is unwound into it, emscripten only keeps its state there */
+    size_t size = FIBER_ASYNCIFY_MIN_SIZE;
+#else
+    size_t size = co->base.stack_hint ?: COROUTINE_STACK_SIZE;
+#endif
+    unsigned int live;
+
+    co->asyncify_stack_size = MAX(pow2ceil(size), FIBER_ASYNCIFY_MIN_SIZE);
+    co->asyncify_stack = fiber_pool_get(fiber_pool_index(size),
+                                        &co->asyncify_stack_size);
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = fiber_pool_get(0, &co->stack_size);
+    emscripten_fiber_init(&co->fiber, coroutine_trampoline, &co->base,
+                          co->stack, co->stack_size, co->asyncify_stack, co->asyncify_stack_size);
+
+    qemu_mutex_lock(&fiber_pool.lock);
+    live = ++fiber_pool.live;
+    if (live > fiber_pool.live_max) {
+        fiber_pool.live_max = live;
+        trace_qemu_coroutine_fiber_high_water(live, fiber_pool.bytes_max);
     }
+    qemu_mutex_unlock(&fiber_pool.lock);
+}
+
+/* Takes back the stacks of a coroutine that terminated */
+static void fiber_release(CoroutineEmscripten *co)
+{
+    fiber_pool_put(fiber_pool_index(co->asyncify_stack_size),
+                   co->asyncify_stack, co->asyncify_stack_size);
+    fiber_pool_put(0, co->stack, co->stack_size);
+    co->asyncify_stack = NULL;
+    co->stack = NULL;
+
+    qemu_mutex_lock(&fiber_pool.lock);
+    fiber_pool.live--;
+    qemu_mutex_unlock(&fiber_pool.lock);
 }
 
 Coroutine *qemu_coroutine_new(void)
 {
     CoroutineEmscripten *co;
 
+    /* The stacks are only allocated once it is entered */
     co = g_malloc0(sizeof(*co));
-
-    co->stack_size = COROUTINE_STACK_SIZE;
-    co->stack = qemu_alloc_stack(&co->stack_size);
-
-    co->asyncify_stack_size = COROUTINE_STACK_SIZE;
-    co->asyncify_stack = g_malloc0(co->asyncify_stack_size);
-    emscripten_fiber_init(&co->fiber, coroutine_trampoline, &co->base,
-                          co->stack, co->stack_size, co->asyncify_stack, co->asyncify_stack_size);
-    
     return &co->base;
 }
 
@@ -76,8 +227,7 @@ void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineEmscripten *co = DO_UPCAST(CoroutineEmscripten, base, co_);
 
-    qemu_free_stack(co->stack, co->stack_size);
-    g_free(co->asyncify_stack);
+    assert(!co->stack);
     g_free(co);
 }
 
@@ -89,13 +239,28 @@ CoroutineAction qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
     CoroutineEmscripten *from = DO_UPCAST(CoroutineEmscripten, base, from_);
     CoroutineEmscripten *to = DO_UPCAST(CoroutineEmscripten, base, to_);
 
-#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER)
+#if defined(EMSCRIPTEN) && !defined(CONFIG_TCG_INTERPRETER) && \
+    !defined(CONFIG_COROUTINE_JSPI)
     set_unwinding_flag();
 #endif
     
+    if (!to->stack) {
+        fiber_start(to);
+    }
+    if (action == COROUTINE_TERMINATE) {
+        /* its stacks are in use until the swap is done */
+        set_terminated(from);
+    }
+
     set_current(to_);
     to->action = action;
     emscripten_fiber_swap(&from->fiber, &to->fiber);
+
+    /* Back in from, on the stack that was switched to */
+    if (get_terminated()) {
+        fiber_release(get_terminated());
+        set_terminated(NULL);
+    }
     return from->action;
 }
 
@@ -118,6 +118,10 @@ int event_notifier_set(EventNotifier *e)
     if (ret < 0 && errno != EAGAIN) {
         return -errno;
     }
+#ifdef EMSCRIPTEN
+    /* Nothing blocks in poll() for the fd to wake up */
+    qemu_poll_notify(e->rfd);
+#endif
     return 0;
 }
 
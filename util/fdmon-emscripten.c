@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * File descriptor monitoring for emscripten
+ *
+ * emscripten's poll() does not block: it returns what is ready right away,
+ * whatever the timeout, so event loops would spin while they are idle.
+ * Instead, waiters check the fds without blocking and then sleep on a
+ * futex with Atomics.wait().  event_notifier_set() wakes them, which
+ * covers aio_notify(), the thread pool and ioeventfds.  Other fds, whose
+ * readiness is only known to JS, are checked again every
+ * FDMON_EMSCRIPTEN_SLICE_MS.
+ *
+ * The fds of an AioContext are only collected again when its handlers
+ * change, and however many notifications come in during a wait, they
+ * only cost one wakeup.
+ *
+ * The main loop and IOThreads do not sleep on the same futex, or every
+ * virtqueue kick handled by an IOThread would also wake the main loop up,
+ * and the other way around.  When an IOThread collects the fds of its
+ * context, it records their owner in fdmon_emscripten_owner, so that
+ * qemu_poll_notify() bumps the futex of that context instead of the
+ * shared one.  The contexts of the main loop keep the shared futex, as
+ * glib polls their fds along with all the others.  A stale owner left by
+ * an fd that moved to another context only delays the wakeup to the end
+ * of the slice.
+ */
+
+#include "qemu/osdep.h"
+#include "aio-posix.h"
+#include "qemu/atomic.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu_queue.h"
+#include "qemu/timer.h"
+#include <emscripten/threading.h>
+
+#define FDMON_EMSCRIPTEN_SLICE_MS 5
+
+/* fds past this one always wake the shared futex up */
+#define FDMON_EMSCRIPTEN_MAX_OWNED_FD 1024
+
+/* Bumped on every notification of an fd that no IOThread owns */
+static uint32_t fdmon_emscripten_seq;
+
+/* fdmon_seq of the IOThread context waiting for each fd, or NULL */
+static uint32_t *fdmon_emscripten_owner[FDMON_EMSCRIPTEN_MAX_OWNED_FD];
+
+void qemu_poll_notify(int fd)
+{
+    uint32_t *seq = NULL;
+
+    /* Pairs with the barrier in fdmon_emscripten_own() */
+    smp_mb();
+    if (fd >= 0 && fd < FDMON_EMSCRIPTEN_MAX_OWNED_FD) {
+        seq = qatomic_read(&fdmon_emscripten_owner[fd]);
+    }
+    seq = seq ?: &fdmon_emscripten_seq;
+
+    qatomic_inc(seq);
+    emscripten_futex_wake(seq, INT_MAX);
+}
+
+static int fdmon_emscripten_poll(uint32_t *futex, GPollFD *fds, guint nfds,
+                                 int64_t timeout)
+{
+    int64_t deadline = 0;
+
+    if (timeout > 0) {
+        deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + timeout;
+    }
+
+    while (true) {
+        /* Read before polling, so that no notification is missed */
+        uint32_t seq = qatomic_load_acquire(futex);
+        double wait_ms = FDMON_EMSCRIPTEN_SLICE_MS;
+        int ret = g_poll(fds, nfds, 0);
+
+        if (ret != 0 || timeout == 0) {
+            return ret;
+        }
+        if (timeout > 0) {
+            int64_t left = deadline - qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+            if (left <= 0) {
+                return 0;
+            }
+            wait_ms = MIN(wait_ms, left / (double)SCALE_MS);
+        }
+        emscripten_futex_wait(futex, seq, wait_ms);
+    }
+}
+
+int qemu_poll_emscripten(GPollFD *fds, guint nfds, int64_t timeout)
+{
+    return fdmon_emscripten_poll(&fdmon_emscripten_seq, fds, nfds, timeout);
+}
+
+/* Whether the waiters of @ctx sleep on its own futex */
+static bool fdmon_emscripten_owns_fds(AioContext *ctx)
+{
+    return ctx != qemu_get_aio_context() && ctx != iohandler_get_aio_context();
+}
+
+static void fdmon_emscripten_own(AioContext *ctx, int fd)
+{
+    if (fd >= 0 && fd < FDMON_EMSCRIPTEN_MAX_OWNED_FD) {
+        qatomic_set(&fdmon_emscripten_owner[fd], &ctx->fdmon_seq);
+    }
+}
+
+/*
+ * Like in fdmon-poll.c, the arrays are thread-local as poll() is called
+ * without any lock held.  They are kept for the AioContext the thread
+ * last waited on, until its handlers change.
+ */
+static __thread GPollFD *pollfds;
+static __thread AioHandler **nodes;
+static __thread unsigned npfd, nalloc;
+static __thread AioContext *pollfds_ctx;
+static __thread unsigned pollfds_generation;
+static __thread Notifier pollfds_cleanup_notifier;
+
+static void pollfds_cleanup(Notifier *n, void *unused)
+{
+    g_free(pollfds);
+    g_free(nodes);
+    nalloc = 0;
+    npfd = 0;
+    pollfds_ctx = NULL;
+}
+
+static void add_pollfd(AioHandler *node)
+{
+    if (npfd == nalloc) {
+        if (nalloc == 0) {
+            pollfds_cleanup_notifier.notify = pollfds_cleanup;
+            qemu_thread_atexit_add(&pollfds_cleanup_notifier);
+            nalloc = 8;
+        } else {
+            g_assert(nalloc <= INT_MAX);
+            nalloc *= 2;
+        }
+        pollfds = g_renew(GPollFD, pollfds, nalloc);
+        nodes = g_renew(AioHandler *, nodes, nalloc);
+    }
+    nodes[npfd] = node;
+    pollfds[npfd] = (GPollFD) {
+        .fd = node->pfd.fd,
+        .events = node->pfd.events,
+    };
+    npfd++;
+}
+
+static int fdmon_emscripten_wait(AioContext *ctx, AioHandlerList *ready_list,
+                                 int64_t timeout)
+{
+    unsigned generation = qatomic_load_acquire(&ctx->fdmon_generation);
+    AioHandler *node;
+    int ret;
+    int i;
+
+    if (pollfds_ctx != ctx || pollfds_generation != generation) {
+        npfd = 0;
+        QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+            if (!QLIST_IS_INSERTED(node, node_deleted) && node->pfd.events) {
+                add_pollfd(node);
+            }
+        }
+        pollfds_ctx = ctx;
+        pollfds_generation = generation;
+
+        if (fdmon_emscripten_owns_fds(ctx)) {
+            for (i = 0; i < npfd; i++) {
+                fdmon_emscripten_own(ctx, pollfds[i].fd);
+            }
+            /* Notifiers from now on see the owner, or poll sees the fd */
+            smp_mb();
+        }
+    }
+
+    if (fdmon_emscripten_owns_fds(ctx)) {
+        ret = fdmon_emscripten_poll(&ctx->fdmon_seq, pollfds, npfd, timeout);
+    } else {
+        ret = qemu_poll_ns(pollfds, npfd, timeout);
+    }
+    if (ret > 0) {
+        for (i = 0; i < npfd; i++) {
+            int revents = pollfds[i].revents;
+
+            if (revents) {
+                aio_add_ready_handler(ready_list, nodes[i], revents);
+            }
+        }
+    }
+    return ret;
+}
+
+static void fdmon_emscripten_update(AioContext *ctx,
+                                    AioHandler *old_node,
+                                    AioHandler *new_node)
+{
+    /* The nodes collected by waiters may be gone, have them start over */
+    qatomic_store_release(&ctx->fdmon_generation, ctx->fdmon_generation + 1);
+
+    /* A removed fd may be reused by another context */
+    if (old_node && !new_node) {
+        int fd = old_node->pfd.fd;
+
+        if (fd >= 0 && fd < FDMON_EMSCRIPTEN_MAX_OWNED_FD) {
+            qatomic_cmpxchg(&fdmon_emscripten_owner[fd], &ctx->fdmon_seq,
+                            NULL);
+        }
+    }
+}
+
+const FDMonOps fdmon_emscripten_ops = {
+    .update = fdmon_emscripten_update,
+    .wait = fdmon_emscripten_wait,
+    .need_wait = aio_poll_disabled,
+};
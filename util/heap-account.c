@@ -0,0 +1,41 @@
+/*
+ * Heap accounting by subsystem
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/heap-account.h"
+
+static struct {
+    size_t bytes;
+    size_t peak;
+} heap_account[HEAP_SUBSYSTEM__MAX];
+
+void heap_account_add(HeapSubsystem sub, size_t bytes)
+{
+    size_t cur = qatomic_add_fetch(&heap_account[sub].bytes, bytes);
+    size_t peak = qatomic_read(&heap_account[sub].peak);
+
+    while (cur > peak) {
+        size_t old = qatomic_cmpxchg(&heap_account[sub].peak, peak, cur);
+
+        if (old == peak) {
+            break;
+        }
+        peak = old;
+    }
+}
+
+void heap_account_sub(HeapSubsystem sub, size_t bytes)
+{
+    qatomic_sub(&heap_account[sub].bytes, bytes);
+}
+
+size_t heap_account_get(HeapSubsystem sub, size_t *peak)
+{
+    *peak = qatomic_read(&heap_account[sub].peak);
+    return qatomic_read(&heap_account[sub].bytes);
+}
@@ -499,6 +499,8 @@ const QEMULogItem qemu_log_items[] = {
       "open a separate log file per thread; filename must contain '%d'" },
     { CPU_LOG_TB_VPU, "vpu",
       "include VPU registers in the 'cpu' logging" },
+    { LOG_STARTUP, "startup",
+      "show the time spent in each phase of the system emulator startup" },
     { 0, NULL, NULL },
 };
 
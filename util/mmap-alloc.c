@@ -22,6 +22,9 @@
 #include "qemu/host-utils.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/queue.h"
+#include "qemu/units.h"
 
 #define HUGETLBFS_MAGIC       0x958458f6
 
@@ -244,6 +247,131 @@ static inline size_t mmap_guard_pagesize(int fd)
 #endif
 }
 
+#if defined(EMSCRIPTEN)
+/*
+ * Anonymous RAM blocks are taken from the break, see qemu_ram_mmap().
+ * The break never moves back, so the ranges that RAM blocks are freed
+ * from (a memory backend deleted, a DIMM unplugged, a ROM resized) are
+ * kept here, sorted and coalesced, and reused before the memory grows.
+ * Without them, every free would be lost for good under the fixed
+ * maximum of the WebAssembly.Memory.
+ */
+typedef struct BrkRange {
+    uintptr_t start;
+    uintptr_t end;
+    QSLIST_ENTRY(BrkRange) next;
+} BrkRange;
+
+static QSLIST_HEAD(, BrkRange) brk_free = QSLIST_HEAD_INITIALIZER(brk_free);
+static QemuMutex brk_lock;
+
+static void __attribute__((__constructor__)) brk_init(void)
+{
+    qemu_mutex_init(&brk_lock);
+}
+
+/* Called with brk_lock held */
+static void brk_free_range(uintptr_t start, uintptr_t end)
+{
+    BrkRange *r, *prev = NULL, *new;
+
+    if (start == end) {
+        return;
+    }
+    QSLIST_FOREACH(r, &brk_free, next) {
+        if (r->start > start) {
+            break;
+        }
+        prev = r;
+    }
+    if (prev && prev->end == start) {
+        prev->end = end;
+        if (r && r->start == end) {
+            prev->end = r->end;
+            QSLIST_REMOVE_AFTER(prev, next);
+            g_free(r);
+        }
+        return;
+    }
+    if (r && r->start == end) {
+        r->start = start;
+        return;
+    }
+    new = g_new(BrkRange, 1);
+    new->start = start;
+    new->end = end;
+    if (prev) {
+        QSLIST_INSERT_AFTER(prev, new, next);
+    } else {
+        QSLIST_INSERT_HEAD(&brk_free, new, next);
+    }
+}
+
+/* Called with brk_lock held */
+static void *brk_reuse(size_t size, size_t align)
+{
+    BrkRange *r, *prev = NULL;
+
+    QSLIST_FOREACH(r, &brk_free, next) {
+        uintptr_t start = QEMU_ALIGN_UP(r->start, align);
+
+        if (start < r->end && r->end - start >= size) {
+            uintptr_t head = r->start, tail = start + size, end = r->end;
+
+            if (prev) {
+                QSLIST_REMOVE_AFTER(prev, next);
+            } else {
+                QSLIST_REMOVE_HEAD(&brk_free, next);
+            }
+            g_free(r);
+            brk_free_range(head, start);
+            brk_free_range(tail, end);
+
+            /*
+             * Anonymous memory reads as zero.  Only clear what was
+             * written, so that pages the previous block never touched
+             * still take no host memory.
+             */
+            for (size_t off = 0; off < size; off += 4 * KiB) {
+                size_t len = MIN(4 * KiB, size - off);
+
+                if (!buffer_is_zero((void *)start + off, len)) {
+                    memset((void *)start + off, 0, len);
+                }
+            }
+            return (void *)start;
+        }
+        prev = r;
+    }
+    return NULL;
+}
+
+/* Called with brk_lock held */
+static void *brk_grow(size_t size, size_t align)
+{
+    uintptr_t cur = (uintptr_t)sbrk(0);
+    uintptr_t pad = QEMU_ALIGN_UP(cur, align) - cur;
+    void *ptr = sbrk(pad + size);
+
+    if (ptr == (void *)-1) {
+        return MAP_FAILED;
+    }
+    if ((uintptr_t)ptr != cur) {
+        /* The allocator moved the break meanwhile, which can't be undone */
+        brk_free_range((uintptr_t)ptr, (uintptr_t)ptr + pad + size);
+        ptr = sbrk(size + align);
+        if (ptr == (void *)-1) {
+            return MAP_FAILED;
+        }
+        cur = (uintptr_t)ptr;
+        pad = QEMU_ALIGN_UP(cur, align) - cur;
+        brk_free_range(cur + pad + size, cur + size + align);
+    }
+    brk_free_range(cur, cur + pad);
+    return (void *)(cur + pad);
+}
+#endif
+
 void *qemu_ram_mmap(int fd,
                     size_t size,
                     size_t align,
@@ -252,7 +380,51 @@ void *qemu_ram_mmap(int fd,
 {
 #if defined(EMSCRIPTEN)
     void *ptr;
+
+    if (fd < 0) {
+        /*
+         * The pages the WebAssembly.Memory grows by read as zero and only
+         * take host memory once written, but the mmap() of emscripten
+         * clears what it returns, which writes all of it.  Take anonymous
+         * RAM blocks straight from the break instead, which grows the
+         * memory: guest RAM then only costs what the guest touches, which
+         * matters for the unplugged part of a virtio-mem device.
+         *
+         * Nothing moves the break back (mimalloc does not), so what lies
+         * above it was never written.  Ranges freed by qemu_ram_munmap()
+         * are zeroed when they are reused.
+         */
+        QEMU_LOCK_GUARD(&brk_lock);
+        ptr = brk_reuse(size, align);
+        return ptr ?: brk_grow(size, align);
+    }
+
+    if ((qemu_map_flags & QEMU_MAP_SHARED) &&
+        (qemu_map_flags & QEMU_MAP_READONLY)) {
+        /*
+         * MEMFS may already keep the contents in the wasm heap, like for
+         * the files that the file packager preloaded, and then a read-only
+         * shared mapping returns them in place instead of copying them:
+         * a virtio-pmem root filesystem costs no memory of its own.  There
+         * are no host pages to line up, only the atomics of the guest need
+         * the accesses to be aligned, so the contents are used as they are
+         * unless they are not even aligned for those.
+         */
+        ptr = mmap_activate(0, size, fd, qemu_map_flags, map_offset);
+        if (ptr != MAP_FAILED &&
+            QEMU_IS_ALIGNED((uintptr_t)ptr, MIN(align, 16))) {
+            return ptr;
+        }
+        if (ptr != MAP_FAILED) {
+            munmap(ptr, size);
+        }
+        /* Aligning an alias would shift the contents, take a copy */
+        qemu_map_flags &= ~QEMU_MAP_SHARED;
+    }
     ptr = mmap_activate(0, size + align, fd, qemu_map_flags, map_offset);
+    if (ptr == MAP_FAILED) {
+        return MAP_FAILED;
+    }
     return (void *)QEMU_ALIGN_UP((uintptr_t)ptr, align);
 #else
     const size_t guard_pagesize = mmap_guard_pagesize(fd);
@@ -302,6 +474,16 @@ void *qemu_ram_mmap(int fd,
 
 void qemu_ram_munmap(int fd, void *ptr, size_t size)
 {
+#if defined(EMSCRIPTEN)
+    if (fd < 0) {
+        /* The break can't move back, keep the range for the next block */
+        if (ptr) {
+            QEMU_LOCK_GUARD(&brk_lock);
+            brk_free_range((uintptr_t)ptr, (uintptr_t)ptr + size);
+        }
+        return;
+    }
+#endif
     if (ptr) {
         /* Unmap both the RAM block and the guard page */
         munmap(ptr, size + mmap_guard_pagesize(fd));
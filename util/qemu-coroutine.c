@@ -91,10 +91,17 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 
     co->entry = entry;
     co->entry_arg = opaque;
+    co->stack_hint = 0;
     QSIMPLEQ_INIT(&co->co_queue_wakeup);
     return co;
 }
 
+void qemu_coroutine_set_stack_hint(Coroutine *co, size_t size)
+{
+    assert(!co->caller);
+    co->stack_hint = size;
+}
+
 static void coroutine_delete(Coroutine *co)
 {
     co->caller = NULL;
@@ -0,0 +1,56 @@
+/*
+ * QemuParker, built on QemuEvent
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/atomic.h"
+
+void qemu_parker_init(QemuParker *p)
+{
+    *p = (QemuParker) { };
+    qemu_event_init(&p->event, false);
+}
+
+void qemu_parker_prepare(QemuParker *p)
+{
+    qatomic_set(&p->unpark_us, 0);
+    qemu_event_reset(&p->event);
+}
+
+void qemu_parker_park(QemuParker *p)
+{
+    uint32_t t;
+
+    qatomic_set(&p->parked, true);
+    qemu_event_wait(&p->event);
+    qatomic_set(&p->parked, false);
+
+    t = qatomic_xchg(&p->unpark_us, 0);
+    if (t) {
+        uint32_t lat = (uint32_t)g_get_monotonic_time() - t;
+
+        p->wakeups++;
+        p->wakeup_us += lat;
+        p->wakeup_max_us = MAX(p->wakeup_max_us, lat);
+    }
+}
+
+void qemu_parker_unpark(QemuParker *p)
+{
+    if (qatomic_read(&p->parked)) {
+        /* Microseconds modulo 2^32, 0 means no timestamp */
+        uint32_t now = (uint32_t)g_get_monotonic_time() ?: 1;
+
+        qatomic_cmpxchg(&p->unpark_us, 0, now);
+    }
+    qemu_event_set(&p->event);
+}
+
+void qemu_parker_destroy(QemuParker *p)
+{
+    qemu_event_destroy(&p->event);
+}
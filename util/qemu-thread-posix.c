@@ -319,6 +319,19 @@ void qemu_sem_wait(QemuSemaphore *sem)
 
 #ifdef __linux__
 #include "qemu/futex.h"
+#elif defined(EMSCRIPTEN)
+#include <emscripten/threading.h>
+
+/* Atomics.notify() and Atomics.wait() on the wasm memory */
+static inline void qemu_futex_wake(QemuEvent *ev, int n)
+{
+    emscripten_futex_wake(&ev->value, n);
+}
+
+static inline void qemu_futex_wait(QemuEvent *ev, unsigned val)
+{
+    emscripten_futex_wait(&ev->value, val, INFINITY);
+}
 #else
 static inline void qemu_futex_wake(QemuEvent *ev, int n)
 {
@@ -363,7 +376,7 @@ static inline void qemu_futex_wait(QemuEvent *ev, unsigned val)
 
 void qemu_event_init(QemuEvent *ev, bool init)
 {
-#ifndef __linux__
+#if !defined(__linux__) && !defined(EMSCRIPTEN)
     pthread_mutex_init(&ev->lock, NULL);
     pthread_cond_init(&ev->cond, NULL);
 #endif
@@ -376,7 +389,7 @@ void qemu_event_destroy(QemuEvent *ev)
 {
     assert(ev->initialized);
     ev->initialized = false;
-#ifndef __linux__
+#if !defined(__linux__) && !defined(EMSCRIPTEN)
     pthread_mutex_destroy(&ev->lock);
     pthread_cond_destroy(&ev->cond);
 #endif
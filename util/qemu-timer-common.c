@@ -22,6 +22,7 @@
  * THE SOFTWARE.
  */
 #include "qemu/osdep.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
 
 /***********************************************************/
@@ -60,4 +61,32 @@ static void __attribute__((constructor)) init_get_clock(void)
     }
     clock_start = get_clock();
 }
+
+#ifdef EMSCRIPTEN
+int64_t clock_coarse_ns;
+
+static int64_t clock_coarse_period_ns;
+
+static void *clock_coarse_thread(void *opaque)
+{
+    for (;;) {
+        get_clock();
+        g_usleep(clock_coarse_period_ns / SCALE_US);
+    }
+    return NULL;
+}
+
+void qemu_clock_coarse_start(int64_t period_ns)
+{
+    QemuThread thread;
+
+    if (qatomic_read__nocheck(&clock_coarse_ns)) {
+        return;
+    }
+    clock_coarse_period_ns = MAX(period_ns, SCALE_US);
+    qatomic_set__nocheck(&clock_coarse_ns, get_clock());
+    qemu_thread_create(&thread, "clock-tick", clock_coarse_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+#endif
 #endif
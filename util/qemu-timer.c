@@ -61,12 +61,21 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
  * used by different AioContexts / threads. Each clock also has
  * a list of the QEMUTimerLists associated with it, in order that
  * reenabling the clock can call all the notifiers.
+ *
+ * The pending timers form a pairing heap ordered by expire_time, so
+ * that arming and deleting a timer take O(log n) amortized time however
+ * many timers are pending.  Timers that expire at the same time are
+ * ordered by seq, i.e. fire in the order they were armed.  active_timers is the root of the heap, i.e.
+ * the timer that expires first.  A timer links to its leftmost child and
+ * to its right sibling with next; prev is its left sibling, or its
+ * parent for a leftmost child.
  */
 
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
     QEMUTimer *active_timers;
+    uint64_t next_seq;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -265,11 +274,8 @@ int64_t qemu_clock_deadline_ns_all(QEMUClockType type, int attr_mask)
             continue;
         }
         qemu_mutex_lock(&timer_list->active_timers_lock);
-        ts = timer_list->active_timers;
         /* Skip all external timers */
-        while (ts && (ts->attributes & ~attr_mask)) {
-            ts = ts->next;
-        }
+        ts = timer_heap_first(timer_list->active_timers, attr_mask);
         if (!ts) {
             qemu_mutex_unlock(&timer_list->active_timers_lock);
             continue;
@@ -334,7 +340,9 @@ int qemu_timeout_ns_to_ms(int64_t ns)
  */
 int qemu_poll_ns(GPollFD *fds, guint nfds, int64_t timeout)
 {
-#ifdef CONFIG_PPOLL
+#if defined(EMSCRIPTEN)
+    return qemu_poll_emscripten(fds, nfds, timeout);
+#elif defined(CONFIG_PPOLL)
     if (timeout < 0) {
         return ppoll((struct pollfd *)fds, nfds, NULL, NULL);
     } else {
@@ -378,43 +386,149 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
-static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+/* Whether a fires before b */
+static bool timer_heap_before(QEMUTimer *a, QEMUTimer *b)
 {
-    QEMUTimer **pt, *t;
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
 
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            qatomic_set(pt, t->next);
-            break;
+/* Link the heaps a and b, each without siblings, and return the root */
+static QEMUTimer *timer_heap_meld(QEMUTimer *a, QEMUTimer *b)
+{
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (timer_heap_before(b, a)) {
+        QEMUTimer *t = a;
+        a = b;
+        b = t;
+    }
+    b->prev = a;
+    b->next = a->child;
+    if (a->child) {
+        a->child->prev = b;
+    }
+    a->child = b;
+    a->prev = NULL;
+    return a;
+}
+
+/* Meld the siblings starting at first into one heap */
+static QEMUTimer *timer_heap_merge_pairs(QEMUTimer *first)
+{
+    QEMUTimer *pairs = NULL, *root = NULL;
+
+    /* meld them by pairs from left to right, stacking the results... */
+    while (first) {
+        QEMUTimer *a = first, *b = a->next, *m;
+
+        a->next = NULL;
+        if (b) {
+            first = b->next;
+            b->next = NULL;
+        } else {
+            first = NULL;
         }
-        pt = &t->next;
+        m = timer_heap_meld(a, b);
+        m->next = pairs;
+        pairs = m;
+    }
+
+    /* ...then meld the pairs from right to left */
+    while (pairs) {
+        QEMUTimer *m = pairs;
+
+        pairs = m->next;
+        m->next = NULL;
+        root = timer_heap_meld(root, m);
     }
+    return root;
 }
 
-static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
-                                QEMUTimer *ts, int64_t expire_time)
+static QEMUTimer *timer_heap_parent(QEMUTimer *t)
 {
-    QEMUTimer **pt, *t;
+    while (t->prev->child != t) {
+        t = t->prev;
+    }
+    return t->prev;
+}
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
+/* Remove the pending timer ts from the heap */
+static void timer_heap_remove(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    QEMUTimer *sub = timer_heap_merge_pairs(ts->child);
+
+    if (ts == timer_list->active_timers) {
+        if (sub) {
+            sub->prev = NULL;
+        }
+        qatomic_set(&timer_list->active_timers, sub);
+    } else {
+        if (ts->prev->child == ts) {
+            ts->prev->child = ts->next;
+        } else {
+            ts->prev->next = ts->next;
+        }
+        if (ts->next) {
+            ts->next->prev = ts->prev;
+        }
+        /* below ts, sub cannot become the root */
+        timer_heap_meld(timer_list->active_timers, sub);
+    }
+    ts->child = ts->next = ts->prev = NULL;
+}
+
+/*
+ * Return the pending timer that expires first among those whose
+ * attributes are all in attr_mask.  The heap is walked depth first, but
+ * a subtree is skipped when its root cannot expire before the best
+ * timer found so far, or matches itself.
+ */
+static QEMUTimer *timer_heap_first(QEMUTimer *root, int attr_mask)
+{
+    QEMUTimer *best = NULL, *t = root;
+
+    while (t) {
+        if (!best || timer_heap_before(t, best)) {
+            if (!(t->attributes & ~attr_mask)) {
+                best = t;
+            } else if (t->child) {
+                t = t->child;
+                continue;
+            }
         }
-        pt = &t->next;
+        while (t != root && !t->next) {
+            t = timer_heap_parent(t);
+        }
+        t = t == root ? NULL : t->next;
     }
+    return best;
+}
+
+static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    if (ts->expire_time != -1) {
+        timer_heap_remove(timer_list, ts);
+    }
+    ts->expire_time = -1;
+}
+
+static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
+                                QEMUTimer *ts, int64_t expire_time)
+{
+    QEMUTimer *root;
+
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    qatomic_set(pt, ts);
+    ts->seq = timer_list->next_seq++;
+    ts->child = ts->next = ts->prev = NULL;
+    root = timer_heap_meld(timer_list->active_timers, ts);
+    qatomic_set(&timer_list->active_timers, root);
 
-    return pt == &timer_list->active_timers;
+    return root == ts;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -565,9 +679,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
         cb = ts->cb;
         opaque = ts->opaque;
 
@@ -32,6 +32,7 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -174,14 +175,31 @@ void synchronize_rcu(void)
 }
 
 
-#define RCU_CALL_MIN_SIZE        30
+/*
+ * A batch of callbacks shares one grace period.  The call_rcu thread waits
+ * for RCU_CALL_BATCH_SIZE of them to pile up, or for RCU_CALL_BATCH_MS
+ * after it found the first one, whichever comes first.  drain_call_rcu()
+ * does not wait for the budget.
+ */
+#define RCU_CALL_BATCH_SIZE      30
+#define RCU_CALL_BATCH_MS        50
+#define RCU_CALL_SLICE_MS        10
 
 /* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
 static struct rcu_head dummy;
 static struct rcu_head *head = &dummy, **tail = &dummy.next;
-static int rcu_call_count;
+
+/*
+ * Callbacks are counted in the rcu_reader_data of the thread that queued
+ * them, so that call_rcu1() does not bounce a shared counter around.
+ * rcu_call_count holds those of unregistered threads, and of threads that
+ * have gone away.  The counts only go up, the call_rcu thread keeps track
+ * of how many callbacks it has run in rcu_call_done.
+ */
+static unsigned long rcu_call_count;
+static unsigned long rcu_call_done;
 static QemuEvent rcu_call_ready_event;
 
 static void enqueue(struct rcu_head *node)
@@ -252,37 +270,75 @@ retry:
     return node;
 }
 
+/* Must be called with rcu_registry_lock held */
+static void rcu_retire_call_count(struct rcu_reader_data *index)
+{
+    qatomic_add(&rcu_call_count, index->call_count);
+    qatomic_set(&index->call_count, 0);
+}
+
+static unsigned long rcu_call_pending(void)
+{
+    struct rcu_reader_data *index;
+    unsigned long n;
+
+    /*
+     * synchronize_rcu() moves readers out of the registry while it waits
+     * for them, wait until they are all back.
+     */
+    QEMU_LOCK_GUARD(&rcu_sync_lock);
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
+    n = qatomic_load_acquire(&rcu_call_count);
+    QLIST_FOREACH(index, &registry, node) {
+        n += qatomic_load_acquire(&index->call_count);
+    }
+    return n - rcu_call_done;
+}
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
+    int64_t gp_max_us = 0;
 
     rcu_register_thread();
 
     for (;;) {
-        int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+        int64_t start, deadline, gp_us;
+        unsigned long n = rcu_call_pending();
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
-         */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
-            g_usleep(10000);
-            if (n == 0) {
-                qemu_event_reset(&rcu_call_ready_event);
-                n = qatomic_read(&rcu_call_count);
-                if (n == 0) {
+        if (n == 0) {
+            g_usleep(RCU_CALL_SLICE_MS * 1000);
+            qemu_event_reset(&rcu_call_ready_event);
+            if (rcu_call_pending() == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
-                    malloc_trim(4 * 1024 * 1024);
+                malloc_trim(4 * 1024 * 1024);
 #endif
-                    qemu_event_wait(&rcu_call_ready_event);
-                }
+                qemu_event_wait(&rcu_call_ready_event);
             }
-            n = qatomic_read(&rcu_call_count);
+            continue;
         }
 
-        qatomic_sub(&rcu_call_count, n);
+        /* Heuristically wait for a decent number of callbacks to pile up.
+         * Fetch the count now, we only must process elements that were
+         * added before synchronize_rcu() starts.
+         */
+        start = g_get_monotonic_time();
+        deadline = start + RCU_CALL_BATCH_MS * 1000;
+        while (n < RCU_CALL_BATCH_SIZE &&
+               !qatomic_read(&in_drain_call_rcu) &&
+               g_get_monotonic_time() < deadline) {
+            g_usleep(RCU_CALL_SLICE_MS * 1000);
+            n = rcu_call_pending();
+        }
+
+        gp_us = g_get_monotonic_time();
         synchronize_rcu();
+        gp_us = g_get_monotonic_time() - gp_us;
+        gp_max_us = MAX(gp_max_us, gp_us);
+        trace_call_rcu_batch(n, g_get_monotonic_time() - start - gp_us,
+                             gp_us, gp_max_us);
+
+        rcu_call_done += n;
         qemu_mutex_lock_iothread();
         while (n > 0) {
             node = try_dequeue();
@@ -307,9 +363,18 @@ static void *call_rcu_thread(void *opaque)
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_reader_data *p_rcu_reader = get_ptr_rcu_reader();
+
     node->func = func;
     enqueue(node);
-    qatomic_inc(&rcu_call_count);
+
+    /* Count the node only once it is in the queue */
+    if (p_rcu_reader->registered) {
+        qatomic_store_release(&p_rcu_reader->call_count,
+                              p_rcu_reader->call_count + 1);
+    } else {
+        qatomic_inc(&rcu_call_count);
+    }
     qemu_event_set(&rcu_call_ready_event);
 }
 
@@ -375,12 +440,15 @@ void rcu_register_thread(void)
     assert(get_ptr_rcu_reader()->ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_INSERT_HEAD(&registry, get_ptr_rcu_reader(), node);
+    get_ptr_rcu_reader()->registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
 void rcu_unregister_thread(void)
 {
     qemu_mutex_lock(&rcu_registry_lock);
+    rcu_retire_call_count(get_ptr_rcu_reader());
+    get_ptr_rcu_reader()->registered = false;
     QLIST_REMOVE(get_ptr_rcu_reader(), node);
     qemu_mutex_unlock(&rcu_registry_lock);
 }
@@ -453,10 +521,16 @@ static void rcu_init_unlock(void)
 
 static void rcu_init_child(void)
 {
+    struct rcu_reader_data *index;
+
     if (atfork_depth < 1) {
         return;
     }
 
+    /* The callbacks queued by the threads that are gone still count */
+    QLIST_FOREACH(index, &registry, node) {
+        rcu_retire_call_count(index);
+    }
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
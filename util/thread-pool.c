@@ -25,6 +25,13 @@
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Requests are spread over several queues, so that submitting and taking
+ * them does not contend on a single lock.  Each worker takes from its own
+ * queue first and steals from the others when it is empty.
+ */
+#define THREAD_POOL_QUEUES 8
+
 typedef struct ThreadPoolElement ThreadPoolElement;
 
 enum ThreadState {
@@ -39,20 +46,29 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by the lock of the
+     * queue.  After that, only the worker thread can write to it.  Reads
+     * and writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* The queue it was submitted to */
+    int queue;
+    /* Access to this list is protected by the lock of the queue.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+typedef struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* Written under lock, read without it to skip empty queues */
+    int len;
+} ThreadPoolQueue;
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
@@ -63,35 +79,90 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    unsigned int next_queue;
+
+    ThreadPoolQueue queues[THREAD_POOL_QUEUES];
+    /* Requests in all queues, and the most there have been */
+    int queued;
+    int queued_max;
+    /* Requests taken from another queue than a worker's own */
+    uint64_t steals;
 
     /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
     int cur_threads;
+    /* Written under lock, read without it by submitters */
     int idle_threads;
+    unsigned int next_home;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
 };
 
+/* Takes a request, from the queue @home if it has any */
+static ThreadPoolElement *thread_pool_take(ThreadPool *pool, int home)
+{
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[(home + i) % THREAD_POOL_QUEUES];
+        ThreadPoolElement *req;
+
+        if (!qatomic_read(&q->len)) {
+            continue;
+        }
+
+        qemu_mutex_lock(&q->lock);
+        req = QTAILQ_FIRST(&q->request_list);
+        if (req) {
+            QTAILQ_REMOVE(&q->request_list, req, reqs);
+            qatomic_set(&q->len, q->len - 1);
+            req->state = THREAD_ACTIVE;
+        }
+        qemu_mutex_unlock(&q->lock);
+
+        if (req) {
+            qatomic_dec(&pool->queued);
+            if (i) {
+                trace_thread_pool_steal(pool, req, req->queue, home,
+                                        qatomic_fetch_inc(&pool->steals) + 1);
+            }
+            return req;
+        }
+    }
+    return NULL;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    int home;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
     do_spawn_thread(pool);
+    home = pool->next_home++ % THREAD_POOL_QUEUES;
 
     while (pool->cur_threads <= pool->max_threads) {
         ThreadPoolElement *req;
         int ret;
 
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
+        qemu_mutex_unlock(&pool->lock);
+        req = thread_pool_take(pool, home);
+        if (!req) {
+            qemu_mutex_lock(&pool->lock);
+            qatomic_inc(&pool->idle_threads);
+            /*
+             * Pairs with the barrier in thread_pool_submit_aio(): either it
+             * sees this thread idle and signals it, or this sees the request.
+             */
+            smp_mb();
+            if (qatomic_read(&pool->queued)) {
+                qatomic_dec(&pool->idle_threads);
+                continue;
+            }
             ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
+            qatomic_dec(&pool->idle_threads);
             if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
+                !qatomic_read(&pool->queued) &&
                 pool->cur_threads > pool->min_threads) {
                 /* Timed out + no work to do + no need for warm threads = exit.  */
                 break;
@@ -103,11 +174,6 @@ static void *worker_thread(void *opaque)
             continue;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
-
         ret = req->func(req->arg);
 
         req->ret = ret;
@@ -220,11 +286,15 @@ static void thread_pool_cancel(BlockAIOCB *acb)
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
 
+    ThreadPoolQueue *q = &pool->queues[elem->queue];
+
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&q->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&q->request_list, elem, reqs);
+        qatomic_set(&q->len, q->len - 1);
+        qatomic_dec(&pool->queued);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -242,8 +312,10 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
     AioContext *ctx = qemu_get_current_aio_context();
     ThreadPool *pool = aio_get_thread_pool(ctx);
+    int queued;
 
     /* Assert that the thread submitting work is the same running the pool */
     assert(pool->ctx == qemu_get_current_aio_context());
@@ -253,18 +325,33 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->queue = pool->next_queue++ % THREAD_POOL_QUEUES;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
+    q = &pool->queues[req->queue];
+    qemu_mutex_lock(&q->lock);
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    qatomic_set(&q->len, q->len + 1);
+    qemu_mutex_unlock(&q->lock);
+
+    /* Implies a full barrier, see worker_thread() */
+    queued = qatomic_fetch_inc(&pool->queued) + 1;
+    if (queued > pool->queued_max) {
+        pool->queued_max = queued;
+        trace_thread_pool_queue_depth(pool, queued);
+    }
+
+    /* The pool lock is only needed to wake up or create a worker */
     qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
+    if (qatomic_read(&pool->idle_threads)) {
+        qemu_cond_signal(&pool->request_cond);
+    } else if (pool->cur_threads < pool->max_threads) {
         spawn_thread(pool);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
     qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -337,7 +424,10 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
 
     thread_pool_update_params(pool, ctx);
 }
@@ -376,6 +466,9 @@ void thread_pool_free(ThreadPool *pool)
     qemu_bh_delete(pool->completion_bh);
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
+    for (int i = 0; i < THREAD_POOL_QUEUES; i++) {
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
 }
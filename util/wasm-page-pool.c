@@ -0,0 +1,158 @@
+/*
+ * Guest pages lent to host caches on emscripten
+ *
+ * Pages are tracked by address in a hash table, free ones are also on a
+ * list.  Everything is under one lock: donations and reclaims come from
+ * the main loop, borrowers may run in iothreads.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/wasm-page-pool.h"
+#include "trace.h"
+
+typedef struct WasmPoolPage {
+    void *host;
+    /* NULL while the page is free */
+    WasmPagePoolReclaimFunc *reclaim;
+    void *opaque;
+    QSLIST_ENTRY(WasmPoolPage) next;
+} WasmPoolPage;
+
+static QemuRecMutex pool_lock;
+/* host address -> WasmPoolPage */
+static GHashTable *pool_pages;
+static QSLIST_HEAD(, WasmPoolPage) pool_free;
+static size_t pool_nr_free;
+
+static void __attribute__((constructor)) wasm_page_pool_init(void)
+{
+    qemu_rec_mutex_init(&pool_lock);
+    pool_pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+}
+
+size_t wasm_page_pool_page_size(void)
+{
+    return qemu_real_host_page_size();
+}
+
+void wasm_page_pool_lock(void)
+{
+    qemu_rec_mutex_lock(&pool_lock);
+}
+
+void wasm_page_pool_unlock(void)
+{
+    qemu_rec_mutex_unlock(&pool_lock);
+}
+
+/* The guest won't touch @host until it is reclaimed */
+void wasm_page_pool_donate(void *host, size_t size)
+{
+    size_t page_size = wasm_page_pool_page_size();
+    uint8_t *p = host;
+
+    assert(QEMU_PTR_IS_ALIGNED(host, page_size));
+
+    QEMU_LOCK_GUARD(&pool_lock);
+    for (; p < (uint8_t *)host + QEMU_ALIGN_DOWN(size, page_size);
+         p += page_size) {
+        WasmPoolPage *page;
+
+        if (g_hash_table_contains(pool_pages, p)) {
+            continue;
+        }
+        page = g_new0(WasmPoolPage, 1);
+        page->host = p;
+        g_hash_table_insert(pool_pages, p, page);
+        QSLIST_INSERT_HEAD(&pool_free, page, next);
+        pool_nr_free++;
+    }
+    trace_wasm_page_pool_donate(host, size, g_hash_table_size(pool_pages));
+}
+
+/* Takes @page out of the pool, the lock is held */
+static void wasm_page_pool_take_back(WasmPoolPage *page)
+{
+    if (page->reclaim) {
+        page->reclaim(page->opaque, page->host);
+        /* The borrower may have written anything, the guest expects zeroes */
+        memset(page->host, 0, wasm_page_pool_page_size());
+    } else {
+        QSLIST_REMOVE(&pool_free, page, WasmPoolPage, next);
+        pool_nr_free--;
+    }
+    g_hash_table_remove(pool_pages, page->host);
+}
+
+/* The donor needs the pages of @host back, whoever borrowed them */
+void wasm_page_pool_reclaim(void *host, size_t size)
+{
+    size_t page_size = wasm_page_pool_page_size();
+    uint8_t *p = QEMU_ALIGN_PTR_DOWN(host, page_size);
+
+    QEMU_LOCK_GUARD(&pool_lock);
+    for (; p < (uint8_t *)host + size; p += page_size) {
+        WasmPoolPage *page = g_hash_table_lookup(pool_pages, p);
+
+        if (page) {
+            trace_wasm_page_pool_reclaim(p, !!page->reclaim);
+            wasm_page_pool_take_back(page);
+        }
+    }
+}
+
+void wasm_page_pool_reclaim_all(void)
+{
+    GHashTableIter iter;
+    WasmPoolPage *page;
+
+    QEMU_LOCK_GUARD(&pool_lock);
+    trace_wasm_page_pool_reclaim_all(g_hash_table_size(pool_pages),
+                                     pool_nr_free);
+    g_hash_table_iter_init(&iter, pool_pages);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&page)) {
+        if (page->reclaim) {
+            page->reclaim(page->opaque, page->host);
+            memset(page->host, 0, wasm_page_pool_page_size());
+        }
+    }
+    g_hash_table_remove_all(pool_pages);
+    QSLIST_INIT(&pool_free);
+    pool_nr_free = 0;
+}
+
+void *wasm_page_pool_borrow(WasmPagePoolReclaimFunc *reclaim, void *opaque)
+{
+    WasmPoolPage *page;
+
+    assert(reclaim);
+
+    QEMU_LOCK_GUARD(&pool_lock);
+    page = QSLIST_FIRST(&pool_free);
+    if (!page) {
+        return NULL;
+    }
+    QSLIST_REMOVE_HEAD(&pool_free, next);
+    pool_nr_free--;
+    page->reclaim = reclaim;
+    page->opaque = opaque;
+    return page->host;
+}
+
+void wasm_page_pool_return(void *host)
+{
+    WasmPoolPage *page;
+
+    QEMU_LOCK_GUARD(&pool_lock);
+    page = g_hash_table_lookup(pool_pages, host);
+    assert(page && page->reclaim);
+    page->reclaim = NULL;
+    page->opaque = NULL;
+    QSLIST_INSERT_HEAD(&pool_free, page, next);
+    pool_nr_free++;
+}